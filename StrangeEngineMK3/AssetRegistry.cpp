@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "AssetRegistry.h"
+#include "CookDatabase.h"
+#include "Log.h"
+#include <mutex>
+
+// gives the singleton an initial value to clear up any unresolved externals
+AssetRegistry* AssetRegistry::singleton = nullptr;
+
+static std::once_flag gAssetRegistryOnce;
+
+// the name the id is hashed from, spelled the way HashAssetName() sees it
+static std::string NormalizeAssetName(const std::string& name)
+{
+	std::string normalized = name;
+	for (char& c : normalized)
+	{
+		if (c == '\\')
+			c = '/';
+		else if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+	}
+	return normalized;
+}
+
+static std::string ToUTF8(const std::wstring& text)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, nullptr, 0, nullptr, nullptr);
+	std::string result(length > 0 ? length - 1 : 0, '\0');
+	if (length > 1)
+		WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, &result[0], length, nullptr, nullptr);
+	return result;
+}
+
+AssetRegistry* AssetRegistry::Get()
+{
+	// never deleted, there is nothing in it to shut down
+	std::call_once(gAssetRegistryOnce, []()
+	{
+		singleton = new AssetRegistry();
+	});
+	return singleton;
+}
+
+AssetRegistry::AssetRegistry()
+{
+	mCount = 0;
+}
+
+AssetRegistry::~AssetRegistry()
+{
+}
+
+AssetRef AssetRegistry::Register(const std::string& name, const std::wstring& path, AssetType type)
+{
+	std::string normalized = NormalizeAssetName(name);
+	AssetId id = GetAssetId(normalized);
+
+	auto found = mLookup.find(id);
+	if (found != mLookup.end())
+	{
+		Slot& slot = mSlots[found->second];
+
+		// release builds don't have the names to compare, they trust the cooker to have caught collisions
+		#if defined(DEBUG)||defined(_DEBUG)
+		const std::string& existing = mNames[id];
+		if (existing != normalized)
+		{
+			ReportError(LogCategory_Assets, "Asset {} has the same id as {}, it can't be registered", normalized, existing);
+			return AssetRef();
+		}
+		#endif
+
+		// the same name again, it may have been cooked somewhere else since
+		slot.asset.path = path;
+		slot.asset.type = type;
+		return { found->second, slot.generation };
+	}
+
+	UINT index;
+	if (!mFreeSlots.empty())
+	{
+		index = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	else
+	{
+		index = (UINT)mSlots.size();
+		mSlots.push_back(Slot());
+		mSlots.back().generation = 1;
+	}
+
+	Slot& slot = mSlots[index];
+	slot.used = true;
+	slot.asset.id = id;
+	slot.asset.path = path;
+	slot.asset.type = type;
+
+	mLookup[id] = index;
+	mCount++;
+	#if defined(DEBUG)||defined(_DEBUG)
+	mNames[id] = normalized;
+	#endif
+	return { index, slot.generation };
+}
+
+UINT AssetRegistry::RegisterCooked(const std::wstring& cookedFolder)
+{
+	CookDatabase database;
+	if (!database.Load(cookedFolder + L"\\cook.db"))
+		return 0;
+
+	std::vector<std::wstring> sources;
+	database.GetSources(&sources);
+
+	// cooked files are handed to the game as they are, the texture and mesh loaders read the bytes
+	UINT registered = 0;
+	for (const std::wstring& source : sources)
+	{
+		if (Register(ToUTF8(source), cookedFolder + L"\\" + GetCookedPath(source), AssetType_Raw).IsValid())
+			registered++;
+	}
+	return registered;
+}
+
+void AssetRegistry::Unregister(AssetRef ref)
+{
+	if (Resolve(ref) == nullptr)
+		return;
+
+	Slot& slot = mSlots[ref.index];
+	mLookup.erase(slot.asset.id);
+	#if defined(DEBUG)||defined(_DEBUG)
+	mNames.erase(slot.asset.id);
+	#endif
+
+	slot.used = false;
+	slot.asset = RegisteredAsset();
+	if (++slot.generation == 0)
+		slot.generation = 1;
+	mFreeSlots.push_back(ref.index);
+	mCount--;
+}
+
+void AssetRegistry::Clear()
+{
+	for (UINT i = 0; i < mSlots.size(); i++)
+	{
+		if (mSlots[i].used)
+			Unregister({ i, mSlots[i].generation });
+	}
+}
+
+AssetRef AssetRegistry::Find(AssetId id) const
+{
+	auto found = mLookup.find(id);
+	if (found == mLookup.end())
+		return AssetRef();
+	return { found->second, mSlots[found->second].generation };
+}
+
+const RegisteredAsset* AssetRegistry::Resolve(AssetRef ref) const
+{
+	if (ref.index >= mSlots.size() || mSlots[ref.index].generation != ref.generation || !mSlots[ref.index].used)
+		return nullptr;
+	return &mSlots[ref.index].asset;
+}
+
+AssetHandle AssetRegistry::Load(AssetId id, float priority)
+{
+	const RegisteredAsset* asset = Resolve(Find(id));
+	if (asset == nullptr)
+	{
+		ReportError(LogCategory_Assets, "No asset is registered under id {}", id);
+		return AssetHandle();
+	}
+	return AssetStreamer::Get()->Load(asset->path, asset->type, priority);
+}
+
+const char* AssetRegistry::GetName(AssetId id) const
+{
+	#if defined(DEBUG)||defined(_DEBUG)
+	auto found = mNames.find(id);
+	if (found != mNames.end())
+		return found->second.c_str();
+	#endif
+	return nullptr;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Common.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AssetStreamer.h"
+#include "Hash.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// index + generation like AssetHandle, an unregistered asset's refs stop resolving instead of finding whatever
+// was registered into its slot after it
+struct AssetRef
+{
+	UINT index;
+	UINT generation; // 0 is never used, so a zeroed ref is invalid
+
+	bool IsValid() const { return generation != 0; }
+};
+
+struct RegisteredAsset
+{
+	AssetId		 id;
+	std::wstring path; // what AssetStreamer::Load() is given
+	AssetType	 type;
+};
+
+// maps asset ids to the files they are loaded from, so game code says ASSET_ID("Textures/Brick.png") instead of
+// carrying paths around. Find() is a hash lookup, after that a ref gets to its asset with an index and a compare
+// every function here is meant to be called from the main thread, same as the streamer
+class STRANGEENGINEMK3_API AssetRegistry
+{
+public:
+	static AssetRegistry* Get();
+
+	// 'name' is what the id is hashed from. the same name again returns the ref it already has, a different name
+	// with the same id is a collision, it is reported and the ref is invalid
+	AssetRef Register(const std::string& name, const std::wstring& path, AssetType type);
+
+	// every source a cook database knows about, each under its source relative name with its cooked path
+	// returns how many were registered
+	UINT RegisterCooked(const std::wstring& cookedFolder);
+
+	// the ref and every copy of it stop resolving
+	void Unregister(AssetRef ref);
+	void Clear();
+
+	// an invalid ref when nothing is registered under 'id'
+	AssetRef Find(AssetId id) const;
+
+	// nullptr for a stale or invalid ref
+	const RegisteredAsset* Resolve(AssetRef ref) const;
+
+	// the streamer's Load() for a registered asset, an invalid handle when it isn't registered
+	AssetHandle Load(AssetId id, float priority);
+
+	// the name an id was registered with. debug builds only, release builds don't keep the names and return nullptr
+	const char* GetName(AssetId id) const;
+
+	UINT GetCount() const { return mCount; }
+
+private:
+	AssetRegistry();
+	~AssetRegistry();
+	AssetRegistry(const AssetRegistry&);
+	AssetRegistry& operator=(const AssetRegistry&);
+
+	struct Slot
+	{
+		UINT			generation;
+		bool			used;
+		RegisteredAsset asset;
+	};
+
+	static AssetRegistry* singleton;
+
+	std::vector<Slot>				   mSlots;
+	std::vector<UINT>				   mFreeSlots;
+	std::unordered_map<AssetId, UINT> mLookup; // id -> slot index
+	UINT							   mCount;
+
+	#if defined(DEBUG)||defined(_DEBUG)
+	std::unordered_map<AssetId, std::string> mNames; // the reverse lookup, for logs and the debugger
+	#endif
+};
@@ -0,0 +1,599 @@
+#include "pch.h"
+#include "AssetStreamer.h"
+#include "Log.h"
+#include "ImageImport.h"
+#include "MemoryTracking.h"
+#include <algorithm>
+#include <cstring>
+
+// gives the singleton an initial value to clear up any unresolved externals
+AssetStreamer* AssetStreamer::singleton = nullptr;
+
+static std::once_flag gAssetStreamerOnce;
+
+// what a packet on the completion port means
+enum CompletionKey
+{
+	CompletionKey_Read = 1, // a ReadFile finished
+	CompletionKey_Submit,	// the main thread handed over a new load
+	CompletionKey_Quit,
+};
+
+// reads bigger than this are split up, so one huge file doesn't hold a single giant request
+static const DWORD kReadChunkSize = 4 * 1024 * 1024;
+
+struct AssetStreamer::LoadTask
+{
+	OVERLAPPED		  overlapped; // has to be first, the completion port hands this pointer back to us
+	UINT			  slot;
+	std::wstring	  path;
+	AssetType		  type;
+	HANDLE			  file;
+	std::vector<BYTE> fileData;
+	UINT64			  bytesDone;
+	StreamedAsset	  result;
+	bool			  succeeded;
+	LONGLONG		  readStart;
+	LONGLONG		  readEnd;
+	LONGLONG		  decodeEnd;
+};
+
+static LONGLONG Now()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+static std::wstring LookupKey(const std::wstring& path, AssetType type)
+{
+	return path + L'|' + (wchar_t)(L'0' + type);
+}
+
+AssetStreamer* AssetStreamer::Get()
+{
+	// never deleted, same as the job system. StrangeEngine::StopEngine calls Shutdown() instead
+	std::call_once(gAssetStreamerOnce, []()
+	{
+		singleton = new AssetStreamer();
+		singleton->Init(256ull * 1024 * 1024);
+	});
+	return singleton;
+}
+
+AssetStreamer::AssetStreamer()
+{
+	mBudget = 0;
+	mBytesResident = 0;
+	mFrame = 0;
+	mMaxInFlight = 0;
+	mInFlight = 0;
+	mPort = nullptr;
+	mBytesRead = 0;
+	mEvictions = 0;
+	mLastLatencyMs = 0.0;
+	mAverageLatencyMs = 0.0;
+	mMaxLatencyMs = 0.0;
+	mAverageReadMs = 0.0;
+	mAverageDecodeMs = 0.0;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mTicksToMs = 1000.0 / (double)frequency.QuadPart;
+}
+
+AssetStreamer::~AssetStreamer()
+{
+	Shutdown();
+}
+
+void AssetStreamer::Init(UINT64 budgetBytes, UINT maxInFlight)
+{
+	Shutdown();
+
+	mBudget = budgetBytes;
+	mMaxInFlight = std::max(1u, maxInFlight);
+
+	mPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+	if (mPort == nullptr)
+	{
+		ReportError(LogCategory_Assets, "Failed to create the asset streamer's completion port");
+		return;
+	}
+
+	mIOThread = std::thread(&AssetStreamer::IOThreadLoop, this);
+}
+
+void AssetStreamer::Shutdown()
+{
+	if (mPort == nullptr)
+		return;
+
+	// the I/O thread cancels whatever it still has open before it leaves
+	PostQueuedCompletionStatus(mPort, 0, CompletionKey_Quit, nullptr);
+	mIOThread.join();
+	CloseHandle(mPort);
+	mPort = nullptr;
+
+	// decodes that were already running still report back
+	JobSystem::Get()->Wait(&mDecodeJobs);
+	CompleteLoads();
+
+	for (UINT i = 0; i < mSlots.size(); i++)
+	{
+		if (mSlots[i].state != AssetState_Invalid)
+			FreeSlot(i);
+	}
+	mQueue.clear();
+	mInFlight = 0;
+}
+
+
+// ==============================================================
+//		main thread
+// ==============================================================
+
+AssetHandle AssetStreamer::Load(const std::wstring& path, AssetType type, float priority)
+{
+	auto found = mLookup.find(LookupKey(path, type));
+	if (found != mLookup.end())
+	{
+		Slot& slot = mSlots[found->second];
+		slot.refCount++;
+		slot.priority = std::max(slot.priority, priority);
+		slot.lastUsedFrame = mFrame;
+		return { found->second, slot.generation };
+	}
+
+	UINT index;
+	if (!mFreeSlots.empty())
+	{
+		index = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	else
+	{
+		index = (UINT)mSlots.size();
+		mSlots.push_back(Slot());
+		mSlots.back().generation = 1;
+	}
+
+	Slot& slot = mSlots[index];
+	slot.state = AssetState_Queued;
+	slot.refCount = 1;
+	slot.priority = priority;
+	slot.lastUsedFrame = mFrame;
+	slot.requestTime = Now();
+	slot.reloading = false;
+	slot.stale = false;
+	slot.asset = StreamedAsset();
+	slot.asset.path = path;
+	slot.asset.type = type;
+	slot.asset.width = 0;
+	slot.asset.height = 0;
+	slot.asset.version = 0;
+
+	mLookup[LookupKey(path, type)] = index;
+	mQueue.push_back(index);
+	return { index, slot.generation };
+}
+
+void AssetStreamer::Release(AssetHandle handle)
+{
+	Slot* slot = Resolve(handle);
+	if (slot == nullptr || slot->refCount == 0)
+		return;
+
+	if (--slot->refCount > 0)
+		return;
+
+	UINT index = handle.index;
+	if (slot->state == AssetState_Queued)
+	{
+		// never started, nothing to wait for
+		mQueue.erase(std::find(mQueue.begin(), mQueue.end(), index));
+		FreeSlot(index);
+	}
+	else if (slot->state == AssetState_Failed)
+		FreeSlot(index);
+	// ready or loading assets stay around for the LRU
+}
+
+void AssetStreamer::SetPriority(AssetHandle handle, float priority)
+{
+	Slot* slot = Resolve(handle);
+	if (slot)
+		slot->priority = priority;
+}
+
+void AssetStreamer::Reload(const std::wstring& path)
+{
+	const AssetType types[] = { AssetType_Raw, AssetType_Image };
+	for (AssetType type : types)
+	{
+		auto found = mLookup.find(LookupKey(path, type));
+		if (found == mLookup.end())
+			continue;
+
+		UINT index = found->second;
+		Slot& slot = mSlots[index];
+		bool queued = std::find(mQueue.begin(), mQueue.end(), index) != mQueue.end();
+		if (queued)
+			continue; // hasn't been read yet, it will get the new file anyway
+
+		if (slot.state == AssetState_Ready && !slot.reloading)
+		{
+			slot.reloading = true;
+			slot.requestTime = Now();
+			mQueue.push_back(index);
+		}
+		else if (slot.state == AssetState_Loading || slot.reloading)
+			slot.stale = true; // part way through reading, it may have the old bytes
+		else if (slot.state == AssetState_Failed)
+		{
+			// the new file might be the fix
+			slot.state = AssetState_Queued;
+			slot.requestTime = Now();
+			mQueue.push_back(index);
+		}
+	}
+}
+
+AssetState AssetStreamer::GetState(AssetHandle handle) const
+{
+	const Slot* slot = Resolve(handle);
+	return slot ? slot->state : AssetState_Invalid;
+}
+
+const StreamedAsset* AssetStreamer::GetAsset(AssetHandle handle)
+{
+	Slot* slot = Resolve(handle);
+	if (slot == nullptr || slot->state != AssetState_Ready)
+		return nullptr;
+
+	slot->lastUsedFrame = mFrame;
+	return &slot->asset;
+}
+
+void AssetStreamer::Update()
+{
+	CompleteLoads();
+	EvictToBudget();
+	StartLoads();
+	mFrame++;
+}
+
+AssetStreamingStats AssetStreamer::GetStats() const
+{
+	AssetStreamingStats stats = {};
+	stats.queueDepth = (UINT)mQueue.size();
+	stats.inFlight = mInFlight;
+	for (const Slot& slot : mSlots)
+	{
+		if (slot.state == AssetState_Ready)
+			stats.assetsReady++;
+		else if (slot.state == AssetState_Failed)
+			stats.assetsFailed++;
+	}
+	stats.bytesResident = mBytesResident;
+	stats.budgetBytes = mBudget;
+	stats.bytesRead = mBytesRead.load(std::memory_order_relaxed);
+	stats.evictions = mEvictions;
+	stats.lastLatencyMs = mLastLatencyMs;
+	stats.averageLatencyMs = mAverageLatencyMs;
+	stats.maxLatencyMs = mMaxLatencyMs;
+	stats.averageReadMs = mAverageReadMs;
+	stats.averageDecodeMs = mAverageDecodeMs;
+	return stats;
+}
+
+float AssetStreamer::PriorityFromDistance(float distance, bool visible)
+{
+	// 1 / (1 + d) is in (0, 1], visible things get pushed up into (1, 2]
+	float closeness = 1.0f / (1.0f + std::max(0.0f, distance));
+	return visible ? 1.0f + closeness : closeness;
+}
+
+AssetStreamer::Slot* AssetStreamer::Resolve(AssetHandle handle)
+{
+	if (handle.index >= mSlots.size() || mSlots[handle.index].generation != handle.generation || mSlots[handle.index].state == AssetState_Invalid)
+		return nullptr;
+	return &mSlots[handle.index];
+}
+
+const AssetStreamer::Slot* AssetStreamer::Resolve(AssetHandle handle) const
+{
+	if (handle.index >= mSlots.size() || mSlots[handle.index].generation != handle.generation || mSlots[handle.index].state == AssetState_Invalid)
+		return nullptr;
+	return &mSlots[handle.index];
+}
+
+void AssetStreamer::FreeSlot(UINT index)
+{
+	Slot& slot = mSlots[index];
+	if (slot.state == AssetState_Ready)
+	{
+		mBytesResident -= slot.asset.data.size();
+		MemoryTracker::Get()->TrackFree(MemoryTag_Assets, slot.asset.data.size());
+	}
+
+	mLookup.erase(LookupKey(slot.asset.path, slot.asset.type));
+	slot.asset = StreamedAsset();
+	slot.state = AssetState_Invalid;
+	slot.refCount = 0;
+
+	// old handles to this slot stop resolving
+	if (++slot.generation == 0)
+		slot.generation = 1;
+	mFreeSlots.push_back(index);
+}
+
+void AssetStreamer::CompleteLoads()
+{
+	std::vector<LoadTask*> completed;
+	{
+		std::lock_guard<std::mutex> lock(mCompletedMutex);
+		completed.swap(mCompleted);
+	}
+
+	LONGLONG now = Now();
+	for (LoadTask* task : completed)
+	{
+		Slot& slot = mSlots[task->slot];
+		mInFlight--;
+
+		if (task->succeeded)
+		{
+			// a reload replaces the data the game has been using until now
+			UINT version = slot.asset.version;
+			if (slot.state == AssetState_Ready)
+			{
+				mBytesResident -= slot.asset.data.size();
+				MemoryTracker::Get()->TrackFree(MemoryTag_Assets, slot.asset.data.size());
+			}
+
+			slot.asset = std::move(task->result);
+			slot.asset.version = version + 1;
+			slot.state = AssetState_Ready;
+			slot.lastUsedFrame = mFrame;
+			mBytesResident += slot.asset.data.size();
+			MemoryTracker::Get()->TrackAllocation(MemoryTag_Assets, slot.asset.data.size());
+
+			// moving averages over roughly the last 16 loads
+			const double blend = 1.0 / 16.0;
+			mLastLatencyMs = (now - slot.requestTime) * mTicksToMs;
+			mMaxLatencyMs = std::max(mMaxLatencyMs, mLastLatencyMs);
+			mAverageLatencyMs += (mLastLatencyMs - mAverageLatencyMs) * blend;
+			mAverageReadMs += ((task->readEnd - task->readStart) * mTicksToMs - mAverageReadMs) * blend;
+			mAverageDecodeMs += ((task->decodeEnd - task->readEnd) * mTicksToMs - mAverageDecodeMs) * blend;
+		}
+		else
+		{
+			LOG_ERROR(LogCategory_Assets, "Failed to stream asset {}", task->path);
+
+			// a failed reload keeps the old data
+			if (!slot.reloading)
+			{
+				slot.state = AssetState_Failed;
+				if (slot.refCount == 0 && !slot.stale)
+				{
+					FreeSlot(task->slot);
+					delete task;
+					continue;
+				}
+			}
+		}
+
+		slot.reloading = false;
+		if (slot.stale)
+		{
+			slot.stale = false;
+			slot.reloading = slot.state == AssetState_Ready;
+			if (slot.state == AssetState_Failed)
+				slot.state = AssetState_Queued;
+			slot.requestTime = Now();
+			mQueue.push_back(task->slot);
+		}
+		delete task;
+	}
+}
+
+void AssetStreamer::EvictToBudget()
+{
+	if (mBytesResident <= mBudget)
+		return;
+
+	// only assets nobody holds a reference to can go, least recently used first
+	std::vector<UINT> candidates;
+	for (UINT i = 0; i < mSlots.size(); i++)
+	{
+		if (mSlots[i].state == AssetState_Ready && mSlots[i].refCount == 0 && !mSlots[i].reloading)
+			candidates.push_back(i);
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](UINT a, UINT b)
+	{
+		return mSlots[a].lastUsedFrame < mSlots[b].lastUsedFrame;
+	});
+
+	for (UINT index : candidates)
+	{
+		if (mBytesResident <= mBudget)
+			break;
+		FreeSlot(index);
+		mEvictions++;
+	}
+}
+
+void AssetStreamer::StartLoads()
+{
+	if (mPort == nullptr || mQueue.empty() || mInFlight >= mMaxInFlight)
+		return;
+
+	// priorities can change every frame, so sort now rather than keeping a heap up to date
+	std::stable_sort(mQueue.begin(), mQueue.end(), [this](UINT a, UINT b)
+	{
+		return mSlots[a].priority > mSlots[b].priority;
+	});
+
+	UINT count = std::min((UINT)mQueue.size(), mMaxInFlight - mInFlight);
+	for (UINT i = 0; i < count; i++)
+	{
+		Slot& slot = mSlots[mQueue[i]];
+		if (!slot.reloading)
+			slot.state = AssetState_Loading;
+
+		LoadTask* task = new LoadTask();
+		task->slot = mQueue[i];
+		task->path = slot.asset.path;
+		task->type = slot.asset.type;
+		task->file = INVALID_HANDLE_VALUE;
+		task->bytesDone = 0;
+		task->succeeded = false;
+		task->readStart = task->readEnd = task->decodeEnd = 0;
+
+		mInFlight++;
+		PostQueuedCompletionStatus(mPort, 0, CompletionKey_Submit, &task->overlapped);
+	}
+	mQueue.erase(mQueue.begin(), mQueue.begin() + count);
+}
+
+
+// ==============================================================
+//		I/O thread
+// ==============================================================
+
+void AssetStreamer::IOThreadLoop()
+{
+	bool quitting = false;
+	while (!quitting || !mOpenReads.empty())
+	{
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* overlapped = nullptr;
+		BOOL ok = GetQueuedCompletionStatus(mPort, &bytes, &key, &overlapped, INFINITE);
+
+		if (key == CompletionKey_Quit)
+		{
+			// cancelled reads still come back through the port, keep going until they have
+			quitting = true;
+			for (LoadTask* task : mOpenReads)
+				CancelIoEx(task->file, &task->overlapped);
+			continue;
+		}
+
+		LoadTask* task = (LoadTask*)overlapped;
+		if (task == nullptr)
+			continue;
+
+		if (key == CompletionKey_Submit)
+		{
+			if (quitting)
+				FinishRead(task, false);
+			else
+				StartRead(task);
+			continue;
+		}
+
+		// CompletionKey_Read
+		if (!ok || bytes == 0 || quitting)
+		{
+			FinishRead(task, false);
+			continue;
+		}
+
+		task->bytesDone += bytes;
+		mBytesRead.fetch_add(bytes, std::memory_order_relaxed);
+		if (task->bytesDone < task->fileData.size())
+			IssueRead(task);
+		else
+			FinishRead(task, true);
+	}
+}
+
+void AssetStreamer::StartRead(LoadTask* task)
+{
+	task->readStart = Now();
+	task->file = CreateFileW(task->path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (task->file == INVALID_HANDLE_VALUE)
+	{
+		FinishRead(task, false);
+		return;
+	}
+	mOpenReads.push_back(task);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(task->file, &size) || (UINT64)size.QuadPart > 0x7FFFFFFF
+		|| CreateIoCompletionPort(task->file, mPort, CompletionKey_Read, 0) == nullptr)
+	{
+		FinishRead(task, false);
+		return;
+	}
+
+	task->fileData.resize((size_t)size.QuadPart);
+	if (task->fileData.empty())
+		FinishRead(task, true);
+	else
+		IssueRead(task);
+}
+
+void AssetStreamer::IssueRead(LoadTask* task)
+{
+	memset(&task->overlapped, 0, sizeof(task->overlapped));
+	task->overlapped.Offset = (DWORD)(task->bytesDone & 0xFFFFFFFF);
+	task->overlapped.OffsetHigh = (DWORD)(task->bytesDone >> 32);
+
+	DWORD chunk = (DWORD)std::min<UINT64>(kReadChunkSize, task->fileData.size() - task->bytesDone);
+
+	// even a read that finishes straight away still posts its completion, so either way we hear back on the port
+	if (!ReadFile(task->file, task->fileData.data() + task->bytesDone, chunk, nullptr, &task->overlapped)
+		&& GetLastError() != ERROR_IO_PENDING)
+		FinishRead(task, false);
+}
+
+void AssetStreamer::FinishRead(LoadTask* task, bool succeeded)
+{
+	task->readEnd = Now();
+	if (task->file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(task->file);
+		task->file = INVALID_HANDLE_VALUE;
+		mOpenReads.erase(std::find(mOpenReads.begin(), mOpenReads.end(), task));
+	}
+
+	if (!succeeded)
+	{
+		task->succeeded = false;
+		task->decodeEnd = task->readEnd;
+		std::lock_guard<std::mutex> lock(mCompletedMutex);
+		mCompleted.push_back(task);
+		return;
+	}
+
+	JobSystem::Get()->Run([this, task]() { Decode(task); }, &mDecodeJobs);
+}
+
+void AssetStreamer::Decode(LoadTask* task)
+{
+	task->result.path = task->path;
+	task->result.type = task->type;
+	task->result.width = 0;
+	task->result.height = 0;
+	task->result.version = 0;
+
+	if (task->type == AssetType_Image)
+	{
+		task->succeeded = DecodeImageFromMemory(task->fileData.data(), task->fileData.size(),
+			&task->result.width, &task->result.height, &task->result.data);
+		task->fileData = std::vector<BYTE>();
+	}
+	else
+	{
+		task->result.data.swap(task->fileData);
+		task->succeeded = true;
+	}
+	task->decodeEnd = Now();
+
+	std::lock_guard<std::mutex> lock(mCompletedMutex);
+	mCompleted.push_back(task);
+}
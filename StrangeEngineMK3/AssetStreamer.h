@@ -0,0 +1,179 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "JobSystem.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+enum AssetType
+{
+	AssetType_Raw,	 // the file's bytes as they are
+	AssetType_Image, // PNG/JPG/... decoded to RGBA8 on a worker
+};
+
+enum AssetState
+{
+	AssetState_Invalid, // the handle was never valid, or its asset has been released and evicted
+	AssetState_Queued,	// waiting for a free I/O slot, highest priority first
+	AssetState_Loading, // being read or decoded
+	AssetState_Ready,
+	AssetState_Failed,
+};
+
+// index + generation, a handle to an evicted asset stops being valid instead of pointing at whatever reused the slot
+struct AssetHandle
+{
+	UINT index;
+	UINT generation; // 0 is never used, so a zeroed handle is invalid
+
+	bool IsValid() const { return generation != 0; }
+};
+
+struct StreamedAsset
+{
+	std::wstring	  path;
+	AssetType		  type;
+	std::vector<BYTE> data;	  // file bytes for raw assets, tightly packed RGBA8 for images
+	UINT			  width;  // images only
+	UINT			  height;
+	UINT			  version; // 1 once loaded, goes up every time a reload swaps new data in
+};
+
+struct AssetStreamingStats
+{
+	UINT   queueDepth;		  // requests waiting for an I/O slot
+	UINT   inFlight;		  // being read or decoded right now
+	UINT   assetsReady;
+	UINT   assetsFailed;
+	UINT64 bytesResident;	  // decoded size of every ready asset
+	UINT64 budgetBytes;
+	UINT64 bytesRead;		  // running total read from disk
+	UINT64 evictions;		  // running total
+	double lastLatencyMs;	  // request -> ready, queue time included
+	double averageLatencyMs;  // moving average over roughly the last 16 loads
+	double maxLatencyMs;
+	double averageReadMs;	  // just the disk part
+	double averageDecodeMs;	  // just the worker part
+};
+
+// loads files in the background so a frame never waits on the disk
+// reads go through one I/O thread using overlapped I/O on a completion port, decoding runs on the job system
+// every function here is meant to be called from the main thread, StrangeEngine::Run calls Update() once a frame
+class STRANGEENGINEMK3_API AssetStreamer
+{
+public:
+	// started the first time it is asked for, with a 256MB budget
+	static AssetStreamer* Get();
+
+	void Init(UINT64 budgetBytes, UINT maxInFlight = 8);
+	void Shutdown();
+	bool IsRunning() const { return mPort != nullptr; }
+
+	// asks for a file, returns straight away. the same path + type again just adds a reference
+	// a higher priority is loaded first, see PriorityFromDistance()
+	AssetHandle Load(const std::wstring& path, AssetType type, float priority);
+
+	// drops a reference. unreferenced assets stay cached until the budget needs the space
+	// if it hasn't started loading yet the request is cancelled
+	void Release(AssetHandle handle);
+
+	// re-prioritise a request that is still queued, e.g. as the camera moves
+	void SetPriority(AssetHandle handle, float priority);
+
+	// the file has changed on disk (see HotReloader), read it again for every asset loaded from 'path'
+	// the old data stays ready until the new data has arrived, Update() then swaps it in and bumps the asset's version
+	// if the reload fails the old data is kept. 'path' has to be spelled the same way it was given to Load()
+	void Reload(const std::wstring& path);
+
+	AssetState GetState(AssetHandle handle) const;
+	bool	   IsReady(AssetHandle handle) const { return GetState(handle) == AssetState_Ready; }
+
+	// nullptr until the asset is ready. counts as a use for the LRU
+	const StreamedAsset* GetAsset(AssetHandle handle);
+
+	// hands finished loads over, evicts down to the budget and starts the most important queued reads
+	void Update();
+
+	void   SetBudget(UINT64 budgetBytes) { mBudget = budgetBytes; }
+	UINT64 GetBudget() const { return mBudget; }
+	UINT   GetMaxInFlight() const { return mMaxInFlight; }
+
+	AssetStreamingStats GetStats() const;
+
+	// anything visible beats anything that isn't, then closer beats further away
+	static float PriorityFromDistance(float distance, bool visible);
+
+private:
+	AssetStreamer();
+	~AssetStreamer();
+
+	struct Slot
+	{
+		UINT		  generation;
+		AssetState	  state;
+		UINT		  refCount;
+		float		  priority;
+		UINT64		  lastUsedFrame;
+		LONGLONG	  requestTime; // QueryPerformanceCounter ticks
+		bool		  reloading;   // ready, with a newer copy queued or being read
+		bool		  stale;	   // the file changed again while it was being read, read it once more after
+		StreamedAsset asset;
+	};
+
+	struct LoadTask;
+
+	Slot* Resolve(AssetHandle handle);
+	const Slot* Resolve(AssetHandle handle) const;
+	void  FreeSlot(UINT index);
+	void  CompleteLoads();
+	void  EvictToBudget();
+	void  StartLoads();
+
+	void IOThreadLoop();
+	void StartRead(LoadTask* task);
+	void IssueRead(LoadTask* task);
+	void FinishRead(LoadTask* task, bool succeeded);
+	void Decode(LoadTask* task);
+
+	static AssetStreamer* singleton;
+
+	// main thread only
+	std::vector<Slot>					   mSlots;
+	std::vector<UINT>					   mFreeSlots;
+	std::vector<UINT>					   mQueue;	// slot indices waiting for an I/O slot
+	std::unordered_map<std::wstring, UINT> mLookup; // path + type -> slot index
+	UINT64								   mBudget;
+	UINT64								   mBytesResident;
+	UINT64								   mFrame;
+	UINT								   mMaxInFlight;
+	UINT								   mInFlight;
+
+	// filled by the job system, emptied by Update()
+	std::mutex			   mCompletedMutex;
+	std::vector<LoadTask*> mCompleted;
+	JobCounter			   mDecodeJobs;
+
+	// completion port + I/O thread
+	HANDLE				   mPort;
+	std::thread			   mIOThread;
+	std::vector<LoadTask*> mOpenReads; // I/O thread only, so a shutdown can cancel them
+
+	// stats
+	std::atomic<UINT64> mBytesRead;
+	UINT64				mEvictions;
+	double				mLastLatencyMs;
+	double				mAverageLatencyMs;
+	double				mMaxLatencyMs;
+	double				mAverageReadMs;
+	double				mAverageDecodeMs;
+	double				mTicksToMs;
+};
@@ -0,0 +1,947 @@
+#include "pch.h"
+#include "BlockCompression.h"
+#include "JobSystem.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+// ==============================================================
+//		helpers
+// ==============================================================
+
+static inline float Clampf(float v, float lo, float hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// copies a 4x4 block out of the surface, clamping at the right and bottom edges
+static void LoadBlock(const BYTE* rgba, UINT width, UINT height, UINT rowPitch, UINT bx, UINT by, BYTE block[64])
+{
+	for (UINT y = 0; y < 4; y++)
+	{
+		UINT sy = std::min(by * 4 + y, height - 1);
+		const BYTE* row = rgba + sy * rowPitch;
+		for (UINT x = 0; x < 4; x++)
+		{
+			UINT sx = std::min(bx * 4 + x, width - 1);
+			memcpy(&block[(y * 4 + x) * 4], &row[sx * 4], 4);
+		}
+	}
+}
+
+// principal axis of a point cloud of 'dims' channels by power iteration on the covariance matrix
+static void PrincipalAxis(const float* points, int count, int dims, const float* mean, float* axis)
+{
+	float cov[4][4] = {};
+	for (int i = 0; i < count; i++)
+	{
+		float d[4];
+		for (int c = 0; c < dims; c++)
+			d[c] = points[i * 4 + c] - mean[c];
+		for (int a = 0; a < dims; a++)
+			for (int b = a; b < dims; b++)
+				cov[a][b] += d[a] * d[b];
+	}
+	for (int a = 0; a < dims; a++)
+		for (int b = 0; b < a; b++)
+			cov[a][b] = cov[b][a];
+
+	// start from the diagonal with the largest spread, which converges in a handful of steps
+	for (int c = 0; c < dims; c++)
+		axis[c] = cov[c][c];
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		for (int a = 0; a < dims; a++)
+			for (int b = 0; b < dims; b++)
+				next[a] += cov[a][b] * axis[b];
+
+		float length = 0.0f;
+		for (int c = 0; c < dims; c++)
+			length += next[c] * next[c];
+		if (length < 1e-12f)
+			break;
+		length = 1.0f / sqrtf(length);
+		for (int c = 0; c < dims; c++)
+			axis[c] = next[c] * length;
+	}
+}
+
+// endpoints = the extremes of the points projected onto the principal axis
+static void FitAxisEndpoints(const float* points, int count, int dims, float* e0, float* e1)
+{
+	float mean[4] = {};
+	for (int i = 0; i < count; i++)
+		for (int c = 0; c < dims; c++)
+			mean[c] += points[i * 4 + c];
+	for (int c = 0; c < dims; c++)
+		mean[c] /= (float)count;
+
+	float axis[4] = {};
+	PrincipalAxis(points, count, dims, mean, axis);
+
+	float minT = 1e30f, maxT = -1e30f;
+	for (int i = 0; i < count; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < dims; c++)
+			t += (points[i * 4 + c] - mean[c]) * axis[c];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	if (count == 0)
+		minT = maxT = 0.0f;
+
+	for (int c = 0; c < dims; c++)
+	{
+		e0[c] = Clampf(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+		e1[c] = Clampf(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+	}
+}
+
+static void FitBoxEndpoints(const float* points, int count, int dims, float* e0, float* e1)
+{
+	for (int c = 0; c < dims; c++)
+	{
+		e0[c] = 0.0f;
+		e1[c] = 255.0f;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		for (int c = 0; c < dims; c++)
+		{
+			e0[c] = std::max(e0[c], points[i * 4 + c]);
+			e1[c] = std::min(e1[c], points[i * 4 + c]);
+		}
+	}
+	// pull the corners in by 1/16th of the range, the extremes are rarely worth hitting exactly
+	for (int c = 0; c < dims; c++)
+	{
+		float inset = (e0[c] - e1[c]) / 16.0f;
+		e0[c] -= inset;
+		e1[c] += inset;
+	}
+}
+
+// chooses the nearest palette entry for each of the 16 points, 4 points at a time
+// 'points' is SoA (4 rows of 16), returns the total squared error
+static float SelectIndicesSSE(const float points[4][16], int dims, const float palette[][4], int paletteSize, const bool* skip, BYTE indices[16])
+{
+	float totalError = 0.0f;
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 p[4];
+		for (int c = 0; c < dims; c++)
+			p[c] = _mm_loadu_ps(&points[c][i]);
+
+		__m128  best = _mm_set1_ps(1e30f);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int k = 0; k < paletteSize; k++)
+		{
+			__m128 distance = _mm_setzero_ps();
+			for (int c = 0; c < dims; c++)
+			{
+				__m128 d = _mm_sub_ps(p[c], _mm_set1_ps(palette[k][c]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+			}
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+			best = _mm_min_ps(distance, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+		}
+
+		alignas(16) int bestIndices[4];
+		alignas(16) float bestErrors[4];
+		_mm_store_si128((__m128i*)bestIndices, bestIndex);
+		_mm_store_ps(bestErrors, best);
+		for (int j = 0; j < 4; j++)
+		{
+			if (skip && skip[i + j])
+				continue;
+			indices[i + j] = (BYTE)bestIndices[j];
+			totalError += bestErrors[j];
+		}
+	}
+	return totalError;
+}
+
+// least squares endpoints for a fixed set of indices, where index k blends e0 and e1 by weights[k]
+// returns false if the system is degenerate (every point uses the same weight)
+static bool LeastSquaresEndpoints(const float points[4][16], int dims, const BYTE indices[16], const bool* skip, const float* weights, float* e0, float* e1)
+{
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		if (skip && skip[i])
+			continue;
+		float b = weights[indices[i]];
+		float a = 1.0f - b;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int c = 0; c < dims; c++)
+		{
+			ax[c] += a * points[c][i];
+			bx[c] += b * points[c][i];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+	det = 1.0f / det;
+	for (int c = 0; c < dims; c++)
+	{
+		e0[c] = Clampf((ax[c] * bb - bx[c] * ab) * det, 0.0f, 255.0f);
+		e1[c] = Clampf((bx[c] * aa - ax[c] * ab) * det, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		BC1 colour block
+// ==============================================================
+
+static inline WORD PackRGB565(const float* c)
+{
+	int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+	return (WORD)((r << 11) | (g << 5) | b);
+}
+
+static inline void UnpackRGB565(WORD c, int* out)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+static void BuildBC1Palette(WORD c0, WORD c1, bool fourColor, int palette[4][3])
+{
+	UnpackRGB565(c0, palette[0]);
+	UnpackRGB565(c1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		if (fourColor)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// index k of a four colour block blends the endpoints by these amounts
+static const float kBC1Weights4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+static const float kBC1Weights3[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+
+// quantizes the endpoints, orders them for the block mode and picks indices. returns the squared error
+static float FinishBC1Block(const float points[4][16], const bool* transparent, bool threeColor, const float* e0, const float* e1, WORD* outC0, WORD* outC1, BYTE indices[16])
+{
+	WORD c0 = PackRGB565(e0);
+	WORD c1 = PackRGB565(e1);
+
+	// four colour mode needs c0 > c1, three colour (punch-through) mode needs c0 <= c1
+	if (threeColor ? (c0 > c1) : (c0 < c1))
+		std::swap(c0, c1);
+
+	int palette[4][3];
+	float paletteF[4][4] = {};
+	BuildBC1Palette(c0, c1, !threeColor, palette);
+	for (int k = 0; k < 4; k++)
+		for (int c = 0; c < 3; c++)
+			paletteF[k][c] = (float)palette[k][c];
+
+	float error;
+	if (!threeColor && c0 == c1)
+	{
+		// both endpoints collapsed, the block is one flat colour
+		memset(indices, 0, 16);
+		error = SelectIndicesSSE(points, 3, paletteF, 1, nullptr, indices);
+	}
+	else
+	{
+		error = SelectIndicesSSE(points, 3, paletteF, threeColor ? 3 : 4, transparent, indices);
+	}
+
+	if (threeColor)
+	{
+		for (int i = 0; i < 16; i++)
+			if (transparent[i])
+				indices[i] = 3;
+	}
+
+	*outC0 = c0;
+	*outC1 = c1;
+	return error;
+}
+
+// encodes the colour half of a BC1/BC3 block. punch-through alpha is only used for BC1A ('allowAlpha')
+static void EncodeBC1Block(const BYTE block[64], BCQuality quality, bool allowAlpha, BYTE out[8])
+{
+	float points[4][16];
+	float packed[16 * 4];
+	bool  transparent[16];
+	int   opaqueCount = 0;
+	bool  anyTransparent = false;
+
+	for (int i = 0; i < 16; i++)
+	{
+		transparent[i] = allowAlpha && block[i * 4 + 3] < 128;
+		anyTransparent |= transparent[i];
+		for (int c = 0; c < 3; c++)
+			points[c][i] = (float)block[i * 4 + c];
+		points[3][i] = 0.0f;
+
+		if (!transparent[i])
+		{
+			for (int c = 0; c < 3; c++)
+				packed[opaqueCount * 4 + c] = (float)block[i * 4 + c];
+			opaqueCount++;
+		}
+	}
+
+	WORD  c0 = 0, c1 = 0;
+	BYTE  indices[16] = {};
+
+	if (opaqueCount == 0)
+	{
+		// fully transparent, three colour mode with every pixel on index 3
+		memset(indices, 3, 16);
+	}
+	else
+	{
+		float e0[4], e1[4];
+		if (quality == BCQuality_Fast)
+			FitBoxEndpoints(packed, opaqueCount, 3, e0, e1);
+		else
+			FitAxisEndpoints(packed, opaqueCount, 3, e0, e1);
+
+		float bestError = FinishBC1Block(points, transparent, anyTransparent, e0, e1, &c0, &c1, indices);
+
+		if (quality == BCQuality_High)
+		{
+			// the principal axis isn't always the better start, e.g. blocks made of a few separate clusters
+			float b0[4], b1[4];
+			WORD  n0, n1;
+			BYTE  newIndices[16];
+			FitBoxEndpoints(packed, opaqueCount, 3, b0, b1);
+			float error = FinishBC1Block(points, transparent, anyTransparent, b0, b1, &n0, &n1, newIndices);
+			if (error < bestError)
+			{
+				bestError = error;
+				c0 = n0;
+				c1 = n1;
+				memcpy(indices, newIndices, 16);
+			}
+		}
+
+		const float* weights = anyTransparent ? kBC1Weights3 : kBC1Weights4;
+		int iterations = (quality == BCQuality_High) ? 4 : (quality == BCQuality_Normal ? 1 : 0);
+		for (int iteration = 0; iteration < iterations && bestError > 0.0f; iteration++)
+		{
+			// indices refer to the ordered endpoints, so refit those rather than e0/e1
+			float f0[4], f1[4];
+			if (!LeastSquaresEndpoints(points, 3, indices, transparent, weights, f0, f1))
+				break;
+
+			WORD  n0, n1;
+			BYTE  newIndices[16];
+			float error = FinishBC1Block(points, transparent, anyTransparent, f0, f1, &n0, &n1, newIndices);
+			if (error >= bestError)
+				break;
+
+			bestError = error;
+			c0 = n0;
+			c1 = n1;
+			memcpy(indices, newIndices, 16);
+		}
+	}
+
+	UINT bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= (UINT)(indices[i] & 3) << (i * 2);
+
+	out[0] = (BYTE)(c0 & 0xff);
+	out[1] = (BYTE)(c0 >> 8);
+	out[2] = (BYTE)(c1 & 0xff);
+	out[3] = (BYTE)(c1 >> 8);
+	memcpy(&out[4], &bits, 4);
+}
+
+static void DecodeBC1Block(const BYTE in[8], bool forceFourColor, BYTE block[64])
+{
+	WORD c0 = (WORD)(in[0] | (in[1] << 8));
+	WORD c1 = (WORD)(in[2] | (in[3] << 8));
+	UINT bits;
+	memcpy(&bits, &in[4], 4);
+
+	bool fourColor = forceFourColor || c0 > c1;
+	int palette[4][3];
+	BuildBC1Palette(c0, c1, fourColor, palette);
+
+	for (int i = 0; i < 16; i++)
+	{
+		int index = (bits >> (i * 2)) & 3;
+		for (int c = 0; c < 3; c++)
+			block[i * 4 + c] = (BYTE)palette[index][c];
+		block[i * 4 + 3] = (!fourColor && index == 3) ? 0 : 255;
+	}
+}
+
+
+// ==============================================================
+//		BC4 single channel block (BC3 alpha, BC5 red/green)
+// ==============================================================
+
+static void BuildBC4Palette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static int SelectBC4Indices(const BYTE values[16], int a0, int a1, BYTE indices[16])
+{
+	int palette[8];
+	BuildBC4Palette(a0, a1, palette);
+
+	int totalError = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int bestError = INT_MAX;
+		for (int k = 0; k < 8; k++)
+		{
+			int d = values[i] - palette[k];
+			if (d * d < bestError)
+			{
+				bestError = d * d;
+				indices[i] = (BYTE)k;
+			}
+		}
+		totalError += bestError;
+	}
+	return totalError;
+}
+
+static void EncodeBC4Block(const BYTE values[16], BCQuality quality, BYTE out[8])
+{
+	int minValue = 255, maxValue = 0;
+	int minInner = 255, maxInner = 0; // ignoring 0 and 255, which six value mode gets for free
+	for (int i = 0; i < 16; i++)
+	{
+		minValue = std::min(minValue, (int)values[i]);
+		maxValue = std::max(maxValue, (int)values[i]);
+		if (values[i] != 0 && values[i] != 255)
+		{
+			minInner = std::min(minInner, (int)values[i]);
+			maxInner = std::max(maxInner, (int)values[i]);
+		}
+	}
+
+	// eight value mode first (a0 > a1)
+	int bestA0 = maxValue, bestA1 = minValue;
+	BYTE indices[16];
+	int bestError = SelectBC4Indices(values, bestA0, bestA1, indices);
+
+	if (quality != BCQuality_Fast && bestError > 0)
+	{
+		// candidate endpoint pairs, eight value mode with shrunken ends and six value mode
+		int range = (quality == BCQuality_High) ? 2 : 0;
+		for (int d0 = 0; d0 <= range; d0++)
+		{
+			for (int d1 = 0; d1 <= range; d1++)
+			{
+				int a0 = maxValue - d0, a1 = minValue + d1;
+				if (a0 > a1)
+				{
+					BYTE candidate[16];
+					int error = SelectBC4Indices(values, a0, a1, candidate);
+					if (error < bestError)
+					{
+						bestError = error;
+						bestA0 = a0;
+						bestA1 = a1;
+						memcpy(indices, candidate, 16);
+					}
+				}
+
+				if (minInner <= maxInner)
+				{
+					int s0 = std::min(255, minInner + d1), s1 = std::max(0, maxInner - d0);
+					if (s0 <= s1)
+					{
+						BYTE candidate[16];
+						int error = SelectBC4Indices(values, s0, s1, candidate);
+						if (error < bestError)
+						{
+							bestError = error;
+							bestA0 = s0;
+							bestA1 = s1;
+							memcpy(indices, candidate, 16);
+						}
+					}
+				}
+			}
+		}
+	}
+	UINT64 bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= (UINT64)(indices[i] & 7) << (i * 3);
+
+	out[0] = (BYTE)bestA0;
+	out[1] = (BYTE)bestA1;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (BYTE)(bits >> (i * 8));
+}
+
+static void DecodeBC4Block(const BYTE in[8], BYTE values[16])
+{
+	int palette[8];
+	BuildBC4Palette(in[0], in[1], palette);
+
+	UINT64 bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= (UINT64)in[2 + i] << (i * 8);
+
+	for (int i = 0; i < 16; i++)
+		values[i] = (BYTE)palette[(bits >> (i * 3)) & 7];
+}
+
+
+// ==============================================================
+//		BC7 (mode 6: one subset, RGBA 7.7.7.7 + p-bit endpoints, 4 bit indices)
+// ==============================================================
+
+static const int kBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter128
+{
+	UINT64 words[2];
+	int	   position;
+
+	BitWriter128() : position(0) { words[0] = words[1] = 0; }
+
+	void Write(UINT value, int bits)
+	{
+		for (int i = 0; i < bits; i++, position++)
+			words[position >> 6] |= (UINT64)((value >> i) & 1) << (position & 63);
+	}
+};
+
+struct BitReader128
+{
+	UINT64 words[2];
+	int	   position;
+
+	BitReader128(const BYTE* in) : position(0) { memcpy(words, in, 16); }
+
+	UINT Read(int bits)
+	{
+		UINT value = 0;
+		for (int i = 0; i < bits; i++, position++)
+			value |= (UINT)((words[position >> 6] >> (position & 63)) & 1) << i;
+		return value;
+	}
+};
+
+// 7 bit endpoint + shared p-bit, picks the p-bit that lands closest to the wanted colour
+static void QuantizeBC7Endpoint(const float* e, int forcedP, int q[4], int* p)
+{
+	float bestError = 1e30f;
+	for (int pBit = 0; pBit < 2; pBit++)
+	{
+		if (forcedP >= 0 && pBit != forcedP)
+			continue;
+
+		int candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++)
+		{
+			candidate[c] = std::min(127, std::max(0, (int)((e[c] - pBit) / 2.0f + 0.5f)));
+			float d = (float)((candidate[c] << 1) | pBit) - e[c];
+			error += d * d;
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			memcpy(q, candidate, sizeof(candidate));
+			*p = pBit;
+		}
+	}
+}
+
+static float FinishBC7Block(const float points[4][16], const float* e0, const float* e1, int forcedP0, int forcedP1,
+	int q0[4], int q1[4], int* p0, int* p1, BYTE indices[16])
+{
+	QuantizeBC7Endpoint(e0, forcedP0, q0, p0);
+	QuantizeBC7Endpoint(e1, forcedP1, q1, p1);
+
+	float palette[16][4];
+	for (int k = 0; k < 16; k++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			int a = (q0[c] << 1) | *p0;
+			int b = (q1[c] << 1) | *p1;
+			palette[k][c] = (float)(((64 - kBC7Weights4[k]) * a + kBC7Weights4[k] * b + 32) >> 6);
+		}
+	}
+	return SelectIndicesSSE(points, 4, palette, 16, nullptr, indices);
+}
+
+static void EncodeBC7Block(const BYTE block[64], BCQuality quality, BYTE out[16])
+{
+	float points[4][16];
+	float packed[16 * 4];
+	for (int i = 0; i < 16; i++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			points[c][i] = (float)block[i * 4 + c];
+			packed[i * 4 + c] = (float)block[i * 4 + c];
+		}
+	}
+
+	float e0[4], e1[4];
+	if (quality == BCQuality_Fast)
+		FitBoxEndpoints(packed, 16, 4, e0, e1);
+	else
+		FitAxisEndpoints(packed, 16, 4, e0, e1);
+
+	int  q0[4], q1[4], p0, p1;
+	BYTE indices[16];
+	float bestError = FinishBC7Block(points, e0, e1, -1, -1, q0, q1, &p0, &p1, indices);
+
+	if (quality == BCQuality_High)
+	{
+		// as with BC1, sometimes the bounding box is the better place to start refining from
+		float b0[4], b1[4];
+		int  n0[4], n1[4], np0, np1;
+		BYTE newIndices[16];
+		FitBoxEndpoints(packed, 16, 4, b0, b1);
+		float error = FinishBC7Block(points, b0, b1, -1, -1, n0, n1, &np0, &np1, newIndices);
+		if (error < bestError)
+		{
+			bestError = error;
+			memcpy(q0, n0, sizeof(n0));
+			memcpy(q1, n1, sizeof(n1));
+			p0 = np0;
+			p1 = np1;
+			memcpy(indices, newIndices, 16);
+		}
+	}
+
+	float weights[16];
+	for (int k = 0; k < 16; k++)
+		weights[k] = kBC7Weights4[k] / 64.0f;
+
+	int iterations = (quality == BCQuality_High) ? 4 : (quality == BCQuality_Normal ? 1 : 0);
+	for (int iteration = 0; iteration < iterations && bestError > 0.0f; iteration++)
+	{
+		float f0[4], f1[4];
+		if (!LeastSquaresEndpoints(points, 4, indices, nullptr, weights, f0, f1))
+			break;
+
+		// the refit endpoints can prefer either p-bit, so high quality tries every combination
+		bool improved = false;
+		int pCombos = (quality == BCQuality_High) ? 4 : 1;
+		for (int pCombo = 0; pCombo < pCombos; pCombo++)
+		{
+			int  n0[4], n1[4], np0, np1;
+			BYTE newIndices[16];
+			int  forcedP0 = (pCombos == 1) ? -1 : (pCombo & 1);
+			int  forcedP1 = (pCombos == 1) ? -1 : (pCombo >> 1);
+			float error = FinishBC7Block(points, f0, f1, forcedP0, forcedP1, n0, n1, &np0, &np1, newIndices);
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(q0, n0, sizeof(n0));
+				memcpy(q1, n1, sizeof(n1));
+				p0 = np0;
+				p1 = np1;
+				memcpy(indices, newIndices, 16);
+				improved = true;
+			}
+		}
+		if (!improved)
+			break;
+	}
+
+	// the anchor (pixel 0) only has 3 index bits, so its index must be < 8. swapping the endpoints flips every index
+	if (indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; c++)
+			std::swap(q0[c], q1[c]);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; i++)
+			indices[i] = (BYTE)(15 - indices[i]);
+	}
+
+	BitWriter128 writer;
+	writer.Write(1 << 6, 7); // mode 6
+	for (int c = 0; c < 4; c++)
+	{
+		writer.Write(q0[c], 7);
+		writer.Write(q1[c], 7);
+	}
+	writer.Write(p0, 1);
+	writer.Write(p1, 1);
+	writer.Write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.Write(indices[i], 4);
+
+	memcpy(out, writer.words, 16);
+}
+
+static void DecodeBC7Block(const BYTE in[16], BYTE block[64])
+{
+	BitReader128 reader(in);
+	if (reader.Read(7) != (1 << 6))
+	{
+		// not mode 6, we never write anything else. show it as magenta so it stands out
+		for (int i = 0; i < 16; i++)
+		{
+			block[i * 4 + 0] = 255;
+			block[i * 4 + 1] = 0;
+			block[i * 4 + 2] = 255;
+			block[i * 4 + 3] = 255;
+		}
+		return;
+	}
+
+	int e[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		e[0][c] = reader.Read(7);
+		e[1][c] = reader.Read(7);
+	}
+	int p0 = reader.Read(1);
+	int p1 = reader.Read(1);
+	for (int c = 0; c < 4; c++)
+	{
+		e[0][c] = (e[0][c] << 1) | p0;
+		e[1][c] = (e[1][c] << 1) | p1;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		int w = kBC7Weights4[reader.Read(i == 0 ? 3 : 4)];
+		for (int c = 0; c < 4; c++)
+			block[i * 4 + c] = (BYTE)(((64 - w) * e[0][c] + w * e[1][c] + 32) >> 6);
+	}
+}
+
+
+// ==============================================================
+//		surface level API
+// ==============================================================
+
+UINT GetBCBlockBytes(BCFormat format)
+{
+	return (format == BCFormat_BC1 || format == BCFormat_BC1A) ? 8 : 16;
+}
+
+DXGI_FORMAT GetBCDXGIFormat(BCFormat format, bool srgb)
+{
+	switch (format)
+	{
+	case BCFormat_BC1:
+	case BCFormat_BC1A: return srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+	case BCFormat_BC3:  return srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+	case BCFormat_BC5:  return DXGI_FORMAT_BC5_UNORM;
+	case BCFormat_BC7:  return srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+	default:			return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+UINT GetBCSurfaceSize(BCFormat format, UINT width, UINT height)
+{
+	UINT blocksWide = std::max(1u, (width + 3) / 4);
+	UINT blocksHigh = std::max(1u, (height + 3) / 4);
+	return blocksWide * blocksHigh * GetBCBlockBytes(format);
+}
+
+void CompressBCBlockRows(const BYTE* rgba, UINT width, UINT height, UINT rowPitch,
+	BCFormat format, BCQuality quality, BYTE* blocksOut, UINT firstBlockRow, UINT numBlockRows)
+{
+	UINT blocksWide = std::max(1u, (width + 3) / 4);
+	UINT blockBytes = GetBCBlockBytes(format);
+
+	for (UINT by = firstBlockRow; by < firstBlockRow + numBlockRows; by++)
+	{
+		for (UINT bx = 0; bx < blocksWide; bx++)
+		{
+			BYTE block[64];
+			LoadBlock(rgba, width, height, rowPitch, bx, by, block);
+			BYTE* out = blocksOut + (by * blocksWide + bx) * blockBytes;
+
+			switch (format)
+			{
+			case BCFormat_BC1:
+			case BCFormat_BC1A:
+			{
+				EncodeBC1Block(block, quality, format == BCFormat_BC1A, out);
+				break;
+			}
+			case BCFormat_BC3:
+			{
+				BYTE alpha[16];
+				for (int i = 0; i < 16; i++)
+					alpha[i] = block[i * 4 + 3];
+				EncodeBC4Block(alpha, quality, out);
+				EncodeBC1Block(block, quality, false, out + 8);
+				break;
+			}
+			case BCFormat_BC5:
+			{
+				BYTE red[16], green[16];
+				for (int i = 0; i < 16; i++)
+				{
+					red[i] = block[i * 4 + 0];
+					green[i] = block[i * 4 + 1];
+				}
+				EncodeBC4Block(red, quality, out);
+				EncodeBC4Block(green, quality, out + 8);
+				break;
+			}
+			case BCFormat_BC7:
+			{
+				EncodeBC7Block(block, quality, out);
+				break;
+			}
+			}
+		}
+	}
+}
+
+void CompressBC(const BYTE* rgba, UINT width, UINT height, UINT rowPitch, BCFormat format, BCQuality quality, BYTE* blocksOut)
+{
+	UINT blocksHigh = std::max(1u, (height + 3) / 4);
+	JobSystem::Get()->ParallelFor(blocksHigh, 4, [&](unsigned int begin, unsigned int end)
+	{
+		CompressBCBlockRows(rgba, width, height, rowPitch, format, quality, blocksOut, begin, end - begin);
+	});
+}
+
+void DecompressBC(const BYTE* blocks, UINT width, UINT height, BCFormat format, BYTE* rgbaOut)
+{
+	UINT blocksWide = std::max(1u, (width + 3) / 4);
+	UINT blocksHigh = std::max(1u, (height + 3) / 4);
+	UINT blockBytes = GetBCBlockBytes(format);
+
+	for (UINT by = 0; by < blocksHigh; by++)
+	{
+		for (UINT bx = 0; bx < blocksWide; bx++)
+		{
+			const BYTE* in = blocks + (by * blocksWide + bx) * blockBytes;
+			BYTE block[64];
+
+			switch (format)
+			{
+			case BCFormat_BC1:
+			case BCFormat_BC1A:
+				DecodeBC1Block(in, false, block);
+				break;
+			case BCFormat_BC3:
+			{
+				BYTE alpha[16];
+				DecodeBC4Block(in, alpha);
+				DecodeBC1Block(in + 8, true, block);
+				for (int i = 0; i < 16; i++)
+					block[i * 4 + 3] = alpha[i];
+				break;
+			}
+			case BCFormat_BC5:
+			{
+				BYTE red[16], green[16];
+				DecodeBC4Block(in, red);
+				DecodeBC4Block(in + 8, green);
+				for (int i = 0; i < 16; i++)
+				{
+					block[i * 4 + 0] = red[i];
+					block[i * 4 + 1] = green[i];
+					block[i * 4 + 2] = 0;
+					block[i * 4 + 3] = 255;
+				}
+				break;
+			}
+			case BCFormat_BC7:
+				DecodeBC7Block(in, block);
+				break;
+			}
+
+			// write back, dropping the parts of edge blocks that hang off the surface
+			for (UINT y = 0; y < 4 && by * 4 + y < height; y++)
+			{
+				for (UINT x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(&rgbaOut[((by * 4 + y) * width + bx * 4 + x) * 4], &block[(y * 4 + x) * 4], 4);
+			}
+		}
+	}
+}
+
+BCErrorReport MeasureBCError(const BYTE* original, UINT originalPitch, const BYTE* decoded, UINT decodedPitch,
+	UINT width, UINT height, BCFormat format)
+{
+	double sum[4] = {};
+	for (UINT y = 0; y < height; y++)
+	{
+		const BYTE* a = original + y * originalPitch;
+		const BYTE* b = decoded + y * decodedPitch;
+		for (UINT x = 0; x < width * 4; x += 4)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				double d = (double)a[x + c] - (double)b[x + c];
+				sum[c] += d * d;
+			}
+		}
+	}
+
+	bool channels[4] = { true, true, true, true };
+	if (format == BCFormat_BC1)
+		channels[3] = false;
+	if (format == BCFormat_BC5)
+		channels[2] = channels[3] = false;
+
+	BCErrorReport report = {};
+	double pixels = (double)width * height;
+	double total = 0.0;
+	int channelCount = 0;
+	for (int c = 0; c < 4; c++)
+	{
+		report.channelRmse[c] = sqrt(sum[c] / pixels);
+		if (channels[c])
+		{
+			total += sum[c];
+			channelCount++;
+		}
+	}
+
+	report.rmse = sqrt(total / (pixels * channelCount));
+	report.psnr = (report.rmse > 0.0) ? 20.0 * log10(255.0 / report.rmse) : 99.0;
+	return report;
+}
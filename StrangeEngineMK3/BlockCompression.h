@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Common.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+enum BCFormat
+{
+	BCFormat_BC1,  // opaque RGB, 4 bits per pixel. alpha is dropped
+	BCFormat_BC1A, // RGB + 1 bit alpha (pixels under half alpha are cut out), 4 bits per pixel
+	BCFormat_BC3,  // RGBA, 8 bits per pixel
+	BCFormat_BC5,  // two channels (RG), 8 bits per pixel. for tangent space normal maps
+	BCFormat_BC7,  // RGBA, 8 bits per pixel, best quality
+};
+
+enum BCQuality
+{
+	BCQuality_Fast,	  // bounding box endpoints, one pass
+	BCQuality_Normal, // principal axis endpoints, exact index search and one least squares refinement
+	BCQuality_High,	  // best of both starts and several refinement passes
+};
+
+// the size of one 4x4 block in bytes (8 or 16)
+STRANGEENGINEMK3_API UINT GetBCBlockBytes(BCFormat format);
+
+// the DXGI format the blocks should be uploaded as
+STRANGEENGINEMK3_API DXGI_FORMAT GetBCDXGIFormat(BCFormat format, bool srgb);
+
+// bytes needed to hold a width x height surface once compressed
+STRANGEENGINEMK3_API UINT GetBCSurfaceSize(BCFormat format, UINT width, UINT height);
+
+// compresses rows [firstBlockRow, firstBlockRow + numBlockRows) of 4x4 blocks of an RGBA8 surface
+// 'blocksOut' points at the first block of the whole surface. edge blocks repeat the last row/column
+STRANGEENGINEMK3_API void CompressBCBlockRows(const BYTE* rgba, UINT width, UINT height, UINT rowPitch,
+	BCFormat format, BCQuality quality, BYTE* blocksOut, UINT firstBlockRow, UINT numBlockRows);
+
+// compresses a whole RGBA8 surface, block rows are spread over the job system
+STRANGEENGINEMK3_API void CompressBC(const BYTE* rgba, UINT width, UINT height, UINT rowPitch,
+	BCFormat format, BCQuality quality, BYTE* blocksOut);
+
+// decodes blocks back to tightly packed RGBA8 (width * 4 byte rows), used for measuring error
+// BC7 only decodes mode 6, which is the only mode the encoder writes
+STRANGEENGINEMK3_API void DecompressBC(const BYTE* blocks, UINT width, UINT height, BCFormat format, BYTE* rgbaOut);
+
+struct BCErrorReport
+{
+	double rmse;		   // over the channels the format stores
+	double psnr;		   // in dB, against a peak of 255
+	double channelRmse[4]; // r, g, b, a
+};
+
+// compares two RGBA8 surfaces. BC1 ignores alpha, BC1A counts it and BC5 only looks at red and green
+STRANGEENGINEMK3_API BCErrorReport MeasureBCError(const BYTE* original, UINT originalPitch, const BYTE* decoded, UINT decodedPitch,
+	UINT width, UINT height, BCFormat format);
@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "Broadphase.h"
+#include "JobSystem.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+// entries past the end of the SoA arrays, one SSE load's worth
+static const UINT kPadding = 4;
+
+static float Component(const XMFLOAT3& vector, int axis)
+{
+	return (&vector.x)[axis];
+}
+
+static UINT64 PairKey(UINT a, UINT b)
+{
+	return (a < b) ? ((UINT64)a << 32) | b : ((UINT64)b << 32) | a;
+}
+
+static void KeysToPairs(const std::vector<UINT64>& keys, std::vector<BroadphasePair>* pairs)
+{
+	pairs->resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		(*pairs)[i].a = (UINT)(keys[i] >> 32);
+		(*pairs)[i].b = (UINT)keys[i];
+	}
+}
+
+Broadphase::Broadphase()
+{
+	mProxyCount = 0;
+	mAxis = 0;
+}
+
+UINT Broadphase::AddProxy(const Aabb& bounds, UINT64 userData)
+{
+	UINT id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (UINT)mProxies.size();
+		mProxies.push_back(Proxy());
+	}
+
+	mProxies[id].bounds = bounds;
+	mProxies[id].userData = userData;
+	mProxies[id].alive = true;
+	mNewIds.push_back(id);
+	mProxyCount++;
+	return id;
+}
+
+void Broadphase::UpdateProxy(UINT id, const Aabb& bounds)
+{
+	mProxies[id].bounds = bounds;
+}
+
+void Broadphase::RemoveProxy(UINT id)
+{
+	mProxies[id].alive = false;
+	mRemovedIds.push_back(id);
+	mProxyCount--;
+}
+
+// sweeping along the axis the proxies are most spread out on leaves the fewest false candidates
+// returns true if the axis changed
+bool Broadphase::ChooseAxis()
+{
+	double sum[3] = { 0.0, 0.0, 0.0 };
+	double sumSquared[3] = { 0.0, 0.0, 0.0 };
+	UINT count = 0;
+	for (const Proxy& proxy : mProxies)
+	{
+		if (!proxy.alive)
+			continue;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double center = (Component(proxy.bounds.min, axis) + Component(proxy.bounds.max, axis)) * 0.5;
+			sum[axis] += center;
+			sumSquared[axis] += center * center;
+		}
+		count++;
+	}
+	if (count == 0)
+		return false;
+
+	double variance[3];
+	for (int axis = 0; axis < 3; axis++)
+		variance[axis] = sumSquared[axis] / count - (sum[axis] / count) * (sum[axis] / count);
+
+	// only switch for a clear win, a full re-sort costs more than a slightly worse axis
+	int best = mAxis;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (variance[axis] > variance[best] * 1.25)
+			best = axis;
+	}
+	if (best == mAxis)
+		return false;
+	mAxis = best;
+	return true;
+}
+
+void Broadphase::Sort(bool full)
+{
+	for (SortEntry& entry : mSorted)
+		entry.key = Component(mProxies[entry.id].bounds.min, mAxis);
+
+	auto less = [](const SortEntry& a, const SortEntry& b) { return a.key < b.key; };
+	if (full)
+	{
+		std::sort(mSorted.begin(), mSorted.end(), less);
+		return;
+	}
+
+	// things only move a little between frames, so the order is nearly right already and an insertion sort is ~O(n)
+	for (size_t i = 1; i < mSorted.size(); i++)
+	{
+		SortEntry entry = mSorted[i];
+		size_t j = i;
+		while (j > 0 && mSorted[j - 1].key > entry.key)
+		{
+			mSorted[j] = mSorted[j - 1];
+			j--;
+		}
+		mSorted[j] = entry;
+	}
+}
+
+void Broadphase::Sweep(std::vector<UINT64>* keys)
+{
+	UINT count = (UINT)mSorted.size();
+
+	// gather the sorted bounds into SoA, the sweep axis as array 0
+	const int axes[3] = { mAxis, (mAxis + 1) % 3, (mAxis + 2) % 3 };
+	for (int i = 0; i < 3; i++)
+	{
+		mMin[i].resize(count + kPadding);
+		mMax[i].resize(count + kPadding);
+		for (UINT entry = 0; entry < count; entry++)
+		{
+			const Aabb& bounds = mProxies[mSorted[entry].id].bounds;
+			mMin[i][entry] = Component(bounds.min, axes[i]);
+			mMax[i][entry] = Component(bounds.max, axes[i]);
+		}
+		for (UINT entry = count; entry < count + kPadding; entry++)
+		{
+			mMin[i][entry] = std::numeric_limits<float>::infinity();
+			mMax[i][entry] = -std::numeric_limits<float>::infinity();
+		}
+	}
+
+	// a few slabs of the sorted list per thread, each finds the pairs its proxies start
+	unsigned int slabCount = (JobSystem::Get()->GetWorkerCount() + 1) * 4;
+	unsigned int slabSize = std::max(256u, (count + slabCount - 1) / slabCount);
+	slabCount = (count + slabSize - 1) / slabSize;
+	std::vector<std::vector<UINT64>> slabKeys(slabCount);
+
+	const float* min0 = mMin[0].data();
+	const float* max0 = mMax[0].data();
+	const float* min1 = mMin[1].data();
+	const float* max1 = mMax[1].data();
+	const float* min2 = mMin[2].data();
+	const float* max2 = mMax[2].data();
+	const SortEntry* sorted = mSorted.data();
+
+	JobSystem::Get()->ParallelFor(count, slabSize, [&](unsigned int begin, unsigned int end)
+	{
+		std::vector<UINT64>& out = slabKeys[begin / slabSize];
+		for (unsigned int i = begin; i < end; i++)
+		{
+			__m128 sweepMax = _mm_set1_ps(max0[i]);
+			__m128 otherMin1 = _mm_set1_ps(min1[i]);
+			__m128 otherMax1 = _mm_set1_ps(max1[i]);
+			__m128 otherMin2 = _mm_set1_ps(min2[i]);
+			__m128 otherMax2 = _mm_set1_ps(max2[i]);
+			UINT id = sorted[i].id;
+
+			// everything after i starts at or after i does, so only ones that start before i ends can overlap
+			for (unsigned int j = i + 1; j < count; j += 4)
+			{
+				__m128 started = _mm_cmple_ps(_mm_loadu_ps(min0 + j), sweepMax);
+				int startedMask = _mm_movemask_ps(started);
+				if (startedMask == 0)
+					break;
+
+				__m128 overlap1 = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min1 + j), otherMax1), _mm_cmpge_ps(_mm_loadu_ps(max1 + j), otherMin1));
+				__m128 overlap2 = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(min2 + j), otherMax2), _mm_cmpge_ps(_mm_loadu_ps(max2 + j), otherMin2));
+				int mask = _mm_movemask_ps(_mm_and_ps(started, _mm_and_ps(overlap1, overlap2)));
+				for (int lane = 0; mask != 0; lane++, mask >>= 1)
+				{
+					if (mask & 1)
+						out.push_back(PairKey(id, sorted[j + lane].id));
+				}
+
+				// sorted, so once one of the four starts too late the rest do as well
+				if (startedMask != 0xF)
+					break;
+			}
+		}
+	});
+
+	keys->clear();
+	for (const std::vector<UINT64>& slab : slabKeys)
+		keys->insert(keys->end(), slab.begin(), slab.end());
+}
+
+void Broadphase::UpdatePairs()
+{
+	// drop removed proxies and bring in new ones
+	bool fullSort = false;
+	if (!mRemovedIds.empty())
+	{
+		mSorted.erase(std::remove_if(mSorted.begin(), mSorted.end(), [this](const SortEntry& entry)
+		{
+			return !mProxies[entry.id].alive;
+		}), mSorted.end());
+	}
+	for (UINT id : mNewIds)
+	{
+		if (!mProxies[id].alive)
+			continue;
+		SortEntry entry = { 0.0f, id };
+		mSorted.push_back(entry);
+	}
+
+	// lots of new proxies at the end would make the insertion sort quadratic
+	if (mNewIds.size() > mSorted.size() / 16)
+		fullSort = true;
+	mNewIds.clear();
+
+	if (ChooseAxis())
+		fullSort = true;
+	Sort(fullSort);
+
+	std::vector<UINT64> keys;
+	Sweep(&keys);
+	std::sort(keys.begin(), keys.end());
+
+	// what changed since last time
+	std::vector<UINT64> added, removed;
+	std::set_difference(keys.begin(), keys.end(), mPairKeys.begin(), mPairKeys.end(), std::back_inserter(added));
+	std::set_difference(mPairKeys.begin(), mPairKeys.end(), keys.begin(), keys.end(), std::back_inserter(removed));
+	KeysToPairs(added, &mAddedPairs);
+	KeysToPairs(removed, &mRemovedPairs);
+	KeysToPairs(keys, &mPairs);
+	mPairKeys.swap(keys);
+
+	// their pairs have been reported gone, so the ids can be handed out again
+	mFreeIds.insert(mFreeIds.end(), mRemovedIds.begin(), mRemovedIds.end());
+	mRemovedIds.clear();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include "Geometry.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// two proxies whose bounds overlap, always a < b
+struct BroadphasePair
+{
+	UINT a;
+	UINT b;
+};
+
+// finds every pair of overlapping bounding boxes, the step before testing actual shapes against each other
+// sweep and prune: proxies are kept sorted along one axis, so each one is only tested against the few whose
+// range on that axis starts before its own ends. the order barely changes between frames, so keeping it sorted
+// is close to free, and the sweep is split into slabs that run on the job system
+class STRANGEENGINEMK3_API Broadphase
+{
+public:
+	Broadphase();
+
+	// ids of removed proxies are reused, but never before the next UpdatePairs()
+	UINT AddProxy(const Aabb& bounds, UINT64 userData);
+	void UpdateProxy(UINT id, const Aabb& bounds);
+	void RemoveProxy(UINT id);
+
+	// brings the pairs up to date with every add/update/remove since the last call
+	void UpdatePairs();
+
+	// every overlapping pair, sorted by a then b
+	const std::vector<BroadphasePair>& GetPairs() const { return mPairs; }
+	// pairs that started or stopped overlapping in the last UpdatePairs(), a removed proxy loses all its pairs
+	const std::vector<BroadphasePair>& GetAddedPairs() const { return mAddedPairs; }
+	const std::vector<BroadphasePair>& GetRemovedPairs() const { return mRemovedPairs; }
+
+	const Aabb& GetBounds(UINT id) const { return mProxies[id].bounds; }
+	UINT64 GetUserData(UINT id) const { return mProxies[id].userData; }
+	UINT GetProxyCount() const { return mProxyCount; }
+
+	// 0, 1 or 2 for x, y or z. the axis the proxies are most spread along, picked again every update
+	int GetSweepAxis() const { return mAxis; }
+
+private:
+	Broadphase(const Broadphase&);
+	Broadphase& operator=(const Broadphase&);
+
+	struct Proxy
+	{
+		Aabb   bounds;
+		UINT64 userData;
+		bool   alive;
+	};
+
+	struct SortEntry
+	{
+		float key; // bounds.min along the sweep axis
+		UINT  id;
+	};
+
+	bool ChooseAxis();
+	void Sort(bool full);
+	void Sweep(std::vector<UINT64>* keys);
+
+	std::vector<Proxy> mProxies; // by id
+	std::vector<UINT>  mFreeIds;
+	std::vector<UINT>  mRemovedIds; // free once UpdatePairs() has reported their pairs gone
+	std::vector<UINT>  mNewIds;		// not in mSorted yet
+	UINT			   mProxyCount;
+	int				   mAxis;
+
+	std::vector<SortEntry> mSorted; // live proxies by their minimum on the sweep axis
+
+	// the sorted proxies' bounds as one array per side per axis, the sweep axis first, so the sweep can load
+	// four neighbours at a time. each has 4 entries past the end that never overlap anything
+	std::vector<float> mMin[3];
+	std::vector<float> mMax[3];
+
+	std::vector<UINT64>			mPairKeys; // a << 32 | b, sorted
+	std::vector<BroadphasePair> mPairs;
+	std::vector<BroadphasePair> mAddedPairs;
+	std::vector<BroadphasePair> mRemovedPairs;
+};
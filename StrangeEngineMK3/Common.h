@@ -5,5 +5,3 @@
 #include <string>
 
 extern GameTimer gTimer;
-
-extern std::string gLastError;
\ No newline at end of file
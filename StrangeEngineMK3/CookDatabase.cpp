@@ -0,0 +1,402 @@
+#include "pch.h"
+#include "CookDatabase.h"
+#include "FileUtils.h"
+#include "Log.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include "MeshImport.h"
+#include <algorithm>
+#include <cstring>
+
+static std::wstring GetExtension(const std::wstring& path)
+{
+	size_t dot = path.find_last_of(L'.');
+	size_t slash = path.find_last_of(L"\\/");
+	if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash))
+		return L"";
+
+	std::wstring extension = path.substr(dot + 1);
+	for (wchar_t& c : extension)
+	{
+		if (c >= L'A' && c <= L'Z')
+			c = c - L'A' + L'a';
+	}
+	return extension;
+}
+
+CookAssetKind GetCookAssetKind(const std::wstring& path)
+{
+	std::wstring extension = GetExtension(path);
+	if (extension == L"png" || extension == L"jpg" || extension == L"jpeg" || extension == L"bmp"
+		|| extension == L"tif" || extension == L"tiff" || extension == L"dds")
+		return CookAssetKind_Texture;
+	if (extension == L"x")
+		return CookAssetKind_Mesh;
+	return CookAssetKind_None;
+}
+
+std::wstring GetCookedPath(const std::wstring& relativePath)
+{
+	switch (GetCookAssetKind(relativePath))
+	{
+	case CookAssetKind_Texture: return relativePath + L".dds";
+	case CookAssetKind_Mesh:	return relativePath + L".mesh";
+	default:					return relativePath;
+	}
+}
+
+// the database key for a relative path, so "Textures/Brick.PNG" and "textures\brick.png" are one record
+static std::wstring RecordName(const std::wstring& relativePath)
+{
+	std::wstring name = relativePath;
+	for (wchar_t& c : name)
+	{
+		if (c == L'/')
+			c = L'\\';
+		else if (c >= L'A' && c <= L'Z')
+			c = c - L'A' + L'a';
+	}
+	return name;
+}
+
+// every field on its own, hashing the struct would pick up whatever is in its padding
+static UINT64 HashSettings(CookAssetKind kind, const AssetCookSettings& settings)
+{
+	if (kind != CookAssetKind_Texture)
+		return 0;
+
+	const TextureCookSettings& texture = settings.texture;
+	UINT fields[6] = { (UINT)texture.format, (UINT)texture.quality, texture.srgb ? 1u : 0u, (UINT)texture.mipFilter,
+		texture.preserveAlphaCoverage ? 1u : 0u, 0 };
+	memcpy(&fields[5], &texture.alphaCutoff, sizeof(float));
+	return HashBytes(fields, sizeof(fields));
+}
+
+static bool ReadWholeFile(const std::wstring& path, std::vector<BYTE>* bytes)
+{
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart > 0x7FFFFFFF)
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		return false;
+	}
+
+	bytes->resize((size_t)size.QuadPart);
+	DWORD read = 0;
+	bool ok = bytes->empty() || (ReadFile(file, bytes->data(), (DWORD)bytes->size(), &read, nullptr) && read == bytes->size());
+	CloseHandle(file);
+	return ok;
+}
+
+static bool FileExists(const std::wstring& path)
+{
+	DWORD attributes = GetFileAttributesW(path.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+// creates every folder between 'root' and the file at root\relativePath
+static void CreateParentFolders(const std::wstring& root, const std::wstring& relativePath)
+{
+	for (size_t slash = relativePath.find_first_of(L"\\/"); slash != std::wstring::npos; slash = relativePath.find_first_of(L"\\/", slash + 1))
+		CreateDirectoryW((root + L"\\" + relativePath.substr(0, slash)).c_str(), nullptr);
+}
+
+static void ListCookableFiles(const std::wstring& folder, const std::wstring& prefix, std::vector<std::wstring>* relativePaths)
+{
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileW((folder + L"\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		std::wstring name = data.cFileName;
+		if (name == L"." || name == L"..")
+			continue;
+
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			ListCookableFiles(folder + L"\\" + name, prefix + name + L"\\", relativePaths);
+		else if (GetCookAssetKind(name) != CookAssetKind_None)
+			relativePaths->push_back(prefix + name);
+	} while (FindNextFileW(find, &data));
+
+	FindClose(find);
+}
+
+
+// ==============================================================
+//		CookDatabase
+// ==============================================================
+
+CookDatabase::CookDatabase()
+{
+}
+
+void CookDatabase::Clear()
+{
+	mRecords.clear();
+}
+
+bool CookDatabase::Load(const std::wstring& path)
+{
+	mRecords.clear();
+
+	std::vector<BYTE> bytes;
+	if (!ReadWholeFile(path, &bytes))
+		return true;
+
+	// magic, version, count, then per record: key, name length in characters, name
+	size_t cursor = 0;
+	auto read = [&](void* dest, size_t size)
+	{
+		if (size > bytes.size() - cursor)
+			return false;
+		memcpy(dest, bytes.data() + cursor, size);
+		cursor += size;
+		return true;
+	};
+
+	UINT magic = 0, version = 0, count = 0;
+	bool ok = read(&magic, sizeof(UINT)) && read(&version, sizeof(UINT)) && read(&count, sizeof(UINT)) && magic == COOK_DATABASE_MAGIC;
+	if (ok && version != COOK_DATABASE_VERSION)
+		return true; // from an older cooker, start over
+
+	for (UINT i = 0; i < count && ok; i++)
+	{
+		UINT64 key;
+		UINT length;
+		ok = read(&key, sizeof(key)) && read(&length, sizeof(length)) && length <= (bytes.size() - cursor) / sizeof(wchar_t);
+		if (ok)
+		{
+			std::wstring name(length, L'\0');
+			ok = length == 0 || read(&name[0], length * sizeof(wchar_t));
+			mRecords[name] = key;
+		}
+	}
+
+	if (!ok)
+	{
+		mRecords.clear();
+
+		ReportError(LogCategory_Assets, "Cook database is corrupt, everything will be cooked again {}", path);
+		return false;
+	}
+	return true;
+}
+
+bool CookDatabase::Save(const std::wstring& path) const
+{
+	std::vector<BYTE> bytes;
+	auto write = [&](const void* source, size_t size)
+	{
+		bytes.insert(bytes.end(), (const BYTE*)source, (const BYTE*)source + size);
+	};
+
+	UINT header[3] = { COOK_DATABASE_MAGIC, COOK_DATABASE_VERSION, (UINT)mRecords.size() };
+	write(header, sizeof(header));
+	for (const auto& record : mRecords)
+	{
+		UINT length = (UINT)record.first.size();
+		write(&record.second, sizeof(UINT64));
+		write(&length, sizeof(UINT));
+		write(record.first.data(), length * sizeof(wchar_t));
+	}
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	bool ok = file != INVALID_HANDLE_VALUE && WriteFileBytes(file, bytes.data(), bytes.size());
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Could not write the cook database {}", path);
+		return false;
+	}
+	return true;
+}
+
+void CookDatabase::GetSources(std::vector<std::wstring>* relativePaths) const
+{
+	relativePaths->clear();
+	for (const auto& record : mRecords)
+		relativePaths->push_back(record.first);
+}
+
+bool CookDatabase::CookFolder(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const AssetCookSettings& settings,
+	IncrementalCookReport* report)
+{
+	std::vector<std::wstring> relativePaths;
+	ListCookableFiles(sourceFolder, L"", &relativePaths);
+
+	// sources that have been deleted or renamed don't need a record any more, their old outputs are left alone
+	std::unordered_map<std::wstring, UINT64> present;
+	for (const std::wstring& relativePath : relativePaths)
+	{
+		auto found = mRecords.find(RecordName(relativePath));
+		if (found != mRecords.end())
+			present.insert(*found);
+	}
+	mRecords.swap(present);
+
+	return CookFiles(sourceFolder, cookedFolder, relativePaths, settings, report);
+}
+
+bool CookDatabase::CookFiles(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const std::vector<std::wstring>& relativePaths,
+	const AssetCookSettings& settings, IncrementalCookReport* report)
+{
+	struct CookItem
+	{
+		std::wstring  relativePath;
+		std::wstring  sourcePath;
+		std::wstring  cookedPath;
+		CookAssetKind kind;
+		UINT64		  key;
+		bool		  readable;
+		bool		  dirty;
+		bool		  succeeded;
+	};
+
+	*report = IncrementalCookReport();
+
+	std::vector<CookItem> items;
+	for (const std::wstring& relativePath : relativePaths)
+	{
+		CookAssetKind kind = GetCookAssetKind(relativePath);
+		std::wstring sourcePath = sourceFolder + L"\\" + relativePath;
+
+		// editors delete and rename temporary files next to the real one, the watcher reports those too
+		if (kind == CookAssetKind_None || !FileExists(sourcePath))
+			continue;
+
+		CookItem item;
+		item.relativePath = relativePath;
+		item.sourcePath = sourcePath;
+		item.cookedPath = cookedFolder + L"\\" + GetCookedPath(relativePath);
+		item.kind = kind;
+		item.key = 0;
+		item.readable = item.dirty = item.succeeded = false;
+		items.push_back(item);
+	}
+
+	// the game asks for assets by the hash of their name, two sources with the same id would load each other. the
+	// sources being cooked are checked against each other and against every source the database already has a record of
+	std::unordered_map<AssetId, std::wstring> ids;
+	for (const auto& record : mRecords)
+		ids.insert(std::make_pair(GetAssetId(record.first), record.first));
+	bool collided = false;
+	for (const CookItem& item : items)
+	{
+		std::wstring name = RecordName(item.relativePath);
+		auto inserted = ids.insert(std::make_pair(GetAssetId(name), name));
+		if (!inserted.second && inserted.first->second != name)
+		{
+			ReportError(LogCategory_Assets, "{} and {} have the same asset id, rename one of them", inserted.first->second, name);
+			collided = true;
+		}
+	}
+	if (collided)
+		return false;
+	report->sources = (UINT)items.size();
+
+	LARGE_INTEGER frequency, start, hashed, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	// ==============================================================
+	//		hash every source, one file per job
+	// ==============================================================
+
+	JobSystem::Get()->ParallelFor((unsigned int)items.size(), 1, [&](unsigned int begin, unsigned int itemEnd)
+	{
+		std::vector<BYTE> bytes;
+		for (unsigned int i = begin; i < itemEnd; i++)
+		{
+			CookItem& item = items[i];
+			item.readable = ReadWholeFile(item.sourcePath, &bytes);
+			if (!item.readable)
+				continue;
+
+			UINT64 parts[4] = { HashBytes(bytes.data(), bytes.size()), (UINT64)item.kind,
+				(UINT64)(item.kind == CookAssetKind_Texture ? TEXTURE_IMPORTER_VERSION : MESH_IMPORTER_VERSION),
+				HashSettings(item.kind, settings) };
+			item.key = HashBytes(parts, sizeof(parts));
+		}
+	});
+
+	std::vector<UINT> dirty;
+	for (UINT i = 0; i < items.size(); i++)
+	{
+		CookItem& item = items[i];
+		auto found = mRecords.find(RecordName(item.relativePath));
+		item.dirty = !item.readable || found == mRecords.end() || found->second != item.key || !FileExists(item.cookedPath);
+		if (item.dirty)
+			dirty.push_back(i);
+		else
+			report->upToDate++;
+	}
+	QueryPerformanceCounter(&hashed);
+
+	// ==============================================================
+	//		cook what changed, one asset per job
+	// ==============================================================
+
+	// the texture cooker spreads its blocks over the job system as well, waiting jobs help out so nesting is fine
+	JobSystem::Get()->ParallelFor((unsigned int)dirty.size(), 1, [&](unsigned int begin, unsigned int dirtyEnd)
+	{
+		for (unsigned int i = begin; i < dirtyEnd; i++)
+		{
+			CookItem& item = items[dirty[i]];
+			if (!item.readable)
+				continue;
+
+			// write next to the output and swap it in at the end, so a reader never sees half a file
+			CreateParentFolders(cookedFolder, GetCookedPath(item.relativePath));
+			std::wstring temporaryPath = item.cookedPath + L".tmp";
+			bool ok;
+			if (item.kind == CookAssetKind_Texture)
+				ok = CookTexture(item.sourcePath, temporaryPath, settings.texture, nullptr);
+			else
+			{
+				MeshData mesh;
+				ok = ImportXMeshFile(item.sourcePath, &mesh) && SaveCookedMesh(temporaryPath, mesh);
+			}
+
+			item.succeeded = ok && MoveFileExW(temporaryPath.c_str(), item.cookedPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+			if (!item.succeeded)
+				DeleteFileW(temporaryPath.c_str());
+		}
+	});
+	QueryPerformanceCounter(&end);
+
+	for (UINT index : dirty)
+	{
+		CookItem& item = items[index];
+		if (item.succeeded)
+		{
+			mRecords[RecordName(item.relativePath)] = item.key;
+			report->cooked++;
+			report->cookedOutputs.push_back(item.cookedPath);
+		}
+		else
+		{
+			// forget it, so fixing the source (or the reason it failed) cooks it again even if the bytes match
+			mRecords.erase(RecordName(item.relativePath));
+			report->failed++;
+			report->failedSources.push_back(item.sourcePath);
+
+			LOG_ERROR(LogCategory_Assets, "Failed to cook {}", item.sourcePath);
+		}
+	}
+
+	report->hashSeconds = (double)(hashed.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	report->cookSeconds = (double)(end.QuadPart - hashed.QuadPart) / (double)frequency.QuadPart;
+
+	if (report->failed > 0)
+	{
+		ReportError(LogCategory_Assets, "Some assets failed to cook");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Common.h"
+#include "TextureCooker.h"
+#include <unordered_map>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// bump these whenever an importer's output changes, every asset it made gets cooked again
+#define TEXTURE_IMPORTER_VERSION 1
+#define MESH_IMPORTER_VERSION 1
+
+#define COOK_DATABASE_MAGIC 0x42444353 // "SCDB"
+#define COOK_DATABASE_VERSION 1
+
+enum CookAssetKind
+{
+	CookAssetKind_None,	   // not something we cook, ignored
+	CookAssetKind_Texture, // .png/.jpg/.bmp/.tif/uncompressed .dds -> block compressed .dds
+	CookAssetKind_Mesh,	   // text .x -> .mesh
+};
+
+struct AssetCookSettings
+{
+	TextureCookSettings texture;
+};
+
+struct IncrementalCookReport
+{
+	UINT   sources;	 // cookable files looked at
+	UINT   upToDate; // skipped, their key matched the database and the output exists
+	UINT   cooked;
+	UINT   failed;
+	double hashSeconds;
+	double cookSeconds;
+	std::vector<std::wstring> cookedOutputs; // full paths of every file written, for hot reload
+	std::vector<std::wstring> failedSources;
+};
+
+// decides from the extension
+STRANGEENGINEMK3_API CookAssetKind GetCookAssetKind(const std::wstring& path);
+
+// "Textures\Brick.png" -> "Textures\Brick.png.dds", the source extension is kept so Glass.png and Glass.jpg don't collide
+STRANGEENGINEMK3_API std::wstring GetCookedPath(const std::wstring& relativePath);
+
+// remembers what every output was cooked from, so only sources whose bytes, importer or settings changed are cooked again
+// the key of an output is HashBytes(source bytes) combined with the importer version and a hash of the settings
+// lives in <cooked folder>\cook.db, the cooked folder must not be inside the source folder
+// a cook whose sources don't all have different asset ids (see ASSET_ID), from each other and from every source already
+// recorded, fails before anything is written
+class STRANGEENGINEMK3_API CookDatabase
+{
+public:
+	CookDatabase();
+
+	// a missing database just means everything is out of date
+	bool Load(const std::wstring& path);
+	bool Save(const std::wstring& path) const;
+
+	// every cookable file under 'sourceFolder'. out of date ones are cooked in parallel on the job system
+	bool CookFolder(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const AssetCookSettings& settings,
+		IncrementalCookReport* report);
+
+	// the same for a list of paths relative to 'sourceFolder', e.g. what the file watcher saw change
+	bool CookFiles(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const std::vector<std::wstring>& relativePaths,
+		const AssetCookSettings& settings, IncrementalCookReport* report);
+
+	// forget everything, the next cook rebuilds every output
+	void Clear();
+
+	UINT GetRecordCount() const { return (UINT)mRecords.size(); }
+
+	// relative paths of every source with a record, lowercase with backslashes. AssetRegistry::RegisterCooked uses them
+	void GetSources(std::vector<std::wstring>* relativePaths) const;
+
+private:
+	// relative source path (lowercase, backslashes) -> cook key
+	std::unordered_map<std::wstring, UINT64> mRecords;
+};
@@ -0,0 +1,664 @@
+#include "pch.h"
+#include "DDSTexture.h"
+#include "FileUtils.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+
+// any mip this size or smaller is part of the "mip tail" and is made resident as soon as the file is opened
+// for the 512x512 ARGB textures in Media/ this is mip 2 (128x128) and below
+static const UINT kMipTailBytes = 64 * 1024;
+
+// DDSStreamingStats as atomics, the streaming path updates them while other threads read them
+struct DDSStreamingCounters
+{
+	std::atomic<UINT64> bytesMapped;
+	std::atomic<UINT64> bytesResident;
+	std::atomic<UINT64> bytesLoaded;
+	std::atomic<UINT64> bytesEvicted;
+	std::atomic<UINT>	texturesMapped;
+	std::atomic<UINT>	mipsResident;
+	std::atomic<UINT>	pendingRequests;
+};
+static DDSStreamingCounters gDDSStats;
+
+DDSStreamingStats GetTextureStreamingStats()
+{
+	DDSStreamingStats stats;
+	stats.bytesMapped = gDDSStats.bytesMapped.load();
+	stats.bytesResident = gDDSStats.bytesResident.load();
+	stats.bytesLoaded = gDDSStats.bytesLoaded.load();
+	stats.bytesEvicted = gDDSStats.bytesEvicted.load();
+	stats.texturesMapped = gDDSStats.texturesMapped.load();
+	stats.mipsResident = gDDSStats.mipsResident.load();
+	stats.pendingRequests = gDDSStats.pendingRequests.load();
+	return stats;
+}
+
+
+// ==============================================================
+//		format helpers
+// ==============================================================
+
+static bool IsBlockCompressed(DXGI_FORMAT format, UINT* bytesPerBlock)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		*bytesPerBlock = 8;
+		return true;
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		*bytesPerBlock = 16;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static UINT BytesPerPixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		return 16;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+		return 8;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:
+		return 4;
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R16_UNORM:
+		return 2;
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_A8_UNORM:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+bool GetSurfaceInfo(DXGI_FORMAT format, UINT width, UINT height, UINT* rowPitch, UINT* numRows)
+{
+	UINT bytesPerBlock;
+	if (IsBlockCompressed(format, &bytesPerBlock))
+	{
+		// BC formats are stored as rows of 4x4 blocks, a 1x1 mip still takes a whole block
+		UINT64 pitch = (UINT64)std::max(1u, (width + 3) / 4) * bytesPerBlock;
+		if (pitch > UINT_MAX)
+			return false;
+		*rowPitch = (UINT)pitch;
+		*numRows = std::max(1u, (height + 3) / 4);
+		return true;
+	}
+
+	UINT bpp = BytesPerPixel(format);
+	UINT64 pitch = (UINT64)width * bpp;
+	if (bpp == 0 || pitch > UINT_MAX)
+		return false;
+
+	*rowPitch = (UINT)pitch;
+	*numRows = height;
+	return true;
+}
+
+// works out the DXGI format of an old-style (pre DX10) pixel format
+static DXGI_FORMAT FormatFromPixelFormat(const DDS_PIXELFORMAT& pf)
+{
+	if (pf.flags & DDPF_FOURCC)
+	{
+		switch (pf.fourCC)
+		{
+		case DDS_FOURCC('D', 'X', 'T', '1'): return DXGI_FORMAT_BC1_UNORM;
+		case DDS_FOURCC('D', 'X', 'T', '2'):
+		case DDS_FOURCC('D', 'X', 'T', '3'): return DXGI_FORMAT_BC2_UNORM;
+		case DDS_FOURCC('D', 'X', 'T', '4'):
+		case DDS_FOURCC('D', 'X', 'T', '5'): return DXGI_FORMAT_BC3_UNORM;
+		case DDS_FOURCC('A', 'T', 'I', '1'):
+		case DDS_FOURCC('B', 'C', '4', 'U'): return DXGI_FORMAT_BC4_UNORM;
+		case DDS_FOURCC('A', 'T', 'I', '2'):
+		case DDS_FOURCC('B', 'C', '5', 'U'): return DXGI_FORMAT_BC5_UNORM;
+		case 113:							 return DXGI_FORMAT_R16G16B16A16_FLOAT; // D3DFMT_A16B16G16R16F
+		case 116:							 return DXGI_FORMAT_R32G32B32A32_FLOAT; // D3DFMT_A32B32G32R32F
+		default:							 return DXGI_FORMAT_UNKNOWN;
+		}
+	}
+
+	if ((pf.flags & DDPF_RGB) && pf.RGBBitCount == 32)
+	{
+		if (pf.RBitMask == 0x000000ff && pf.GBitMask == 0x0000ff00 && pf.BBitMask == 0x00ff0000)
+			return DXGI_FORMAT_R8G8B8A8_UNORM;
+		if (pf.RBitMask == 0x00ff0000 && pf.GBitMask == 0x0000ff00 && pf.BBitMask == 0x000000ff)
+			return (pf.ABitMask != 0) ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+	}
+
+	if ((pf.flags & DDPF_LUMINANCE) && pf.RGBBitCount == 8)
+		return DXGI_FORMAT_R8_UNORM;
+
+	return DXGI_FORMAT_UNKNOWN;
+}
+
+
+bool SaveDDS(const std::wstring& path, DXGI_FORMAT format, UINT width, UINT height, const std::vector<std::vector<BYTE>>& mips)
+{
+	UINT rowPitch, numRows;
+	if (mips.empty() || !GetSurfaceInfo(format, width, height, &rowPitch, &numRows))
+	{
+		ReportError(LogCategory_Assets, "Can't save .dds, unsupported format");
+		return false;
+	}
+
+	DDS_HEADER header = {};
+	header.size = sizeof(DDS_HEADER);
+	header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+	header.width = width;
+	header.height = height;
+	header.mipMapCount = (UINT)mips.size();
+	header.caps = DDSCAPS_TEXTURE;
+	if (mips.size() > 1)
+	{
+		header.flags |= DDSD_MIPMAPCOUNT;
+		header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
+
+	UINT bytesPerBlock;
+	if (IsBlockCompressed(format, &bytesPerBlock))
+	{
+		header.flags |= DDSD_LINEARSIZE;
+		header.pitchOrLinearSize = rowPitch * numRows;
+	}
+	else
+	{
+		header.flags |= DDSD_PITCH;
+		header.pitchOrLinearSize = rowPitch;
+	}
+
+	DDS_PIXELFORMAT& pf = header.ddspf;
+	pf.size = sizeof(DDS_PIXELFORMAT);
+	bool needsDX10 = false;
+	switch (format)
+	{
+	case DXGI_FORMAT_BC1_UNORM: pf.flags = DDPF_FOURCC; pf.fourCC = DDS_FOURCC('D', 'X', 'T', '1'); break;
+	case DXGI_FORMAT_BC3_UNORM: pf.flags = DDPF_FOURCC; pf.fourCC = DDS_FOURCC('D', 'X', 'T', '5'); break;
+	case DXGI_FORMAT_BC5_UNORM: pf.flags = DDPF_FOURCC; pf.fourCC = DDS_FOURCC('A', 'T', 'I', '2'); break;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+		pf.flags = DDPF_RGB | DDPF_ALPHAPIXELS;
+		pf.RGBBitCount = 32;
+		pf.RBitMask = 0x000000ff; pf.GBitMask = 0x0000ff00; pf.BBitMask = 0x00ff0000; pf.ABitMask = 0xff000000;
+		break;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+		pf.flags = DDPF_RGB | DDPF_ALPHAPIXELS;
+		pf.RGBBitCount = 32;
+		pf.RBitMask = 0x00ff0000; pf.GBitMask = 0x0000ff00; pf.BBitMask = 0x000000ff; pf.ABitMask = 0xff000000;
+		break;
+	default:
+		pf.flags = DDPF_FOURCC;
+		pf.fourCC = DDS_FOURCC('D', 'X', '1', '0');
+		needsDX10 = true;
+		break;
+	}
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not create {}", path);
+		return false;
+	}
+
+	UINT magic = DDS_MAGIC;
+	bool ok = WriteFileBytes(file, &magic, sizeof(magic)) && WriteFileBytes(file, &header, sizeof(header));
+	if (ok && needsDX10)
+	{
+		DDS_HEADER_DXT10 dx10 = {};
+		dx10.dxgiFormat = format;
+		dx10.resourceDimension = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+		dx10.arraySize = 1;
+		ok = WriteFileBytes(file, &dx10, sizeof(dx10));
+	}
+	for (size_t i = 0; ok && i < mips.size(); i++)
+		ok = WriteFileBytes(file, mips[i].data(), mips[i].size());
+
+	CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Error writing .dds file");
+		return false;
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		DDSTexture
+// ==============================================================
+
+DDSTexture::DDSTexture()
+{
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mFileData = nullptr;
+	mFileSize = 0;
+
+	mWidth = 0;
+	mHeight = 0;
+	mFormat = DXGI_FORMAT_UNKNOWN;
+	mMipTailStart = 0;
+}
+
+DDSTexture::~DDSTexture()
+{
+	Close();
+}
+
+bool DDSTexture::Open(const std::wstring& path)
+{
+	Close();
+
+	// ==============================================================
+	//		map the file
+	// ==============================================================
+
+	mFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not open texture {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart < (LONGLONG)(sizeof(UINT) + sizeof(DDS_HEADER)))
+	{
+		ReportError(LogCategory_Assets, "Texture is too small to be a .dds file {}", path);
+		Close();
+		return false;
+	}
+	mFileSize = (UINT64)fileSize.QuadPart;
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != nullptr)
+		mFileData = (const BYTE*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mFileData == nullptr)
+	{
+		ReportError(LogCategory_Assets, "Could not map texture {}", path);
+		Close();
+		return false;
+	}
+
+	// ==============================================================
+	//		validate the header
+	// ==============================================================
+
+	const UINT magic = *(const UINT*)mFileData;
+	const DDS_HEADER* header = (const DDS_HEADER*)(mFileData + sizeof(UINT));
+	size_t dataOffset = sizeof(UINT) + sizeof(DDS_HEADER);
+
+	if (magic != DDS_MAGIC || header->size != sizeof(DDS_HEADER) || header->ddspf.size != sizeof(DDS_PIXELFORMAT))
+	{
+		ReportError(LogCategory_Assets, "Invalid .dds header {}", path);
+		Close();
+		return false;
+	}
+
+	// cube maps and volume textures are not supported (caps2 DDSCAPS2_CUBEMAP / DDSCAPS2_VOLUME)
+	if ((header->caps2 & 0x200) || (header->caps2 & 0x200000) || header->width == 0 || header->height == 0)
+	{
+		ReportError(LogCategory_Assets, "Unsupported .dds layout (only 2D textures are supported) {}", path);
+		Close();
+		return false;
+	}
+
+	if ((header->ddspf.flags & DDPF_FOURCC) && header->ddspf.fourCC == DDS_FOURCC('D', 'X', '1', '0'))
+	{
+		if (mFileSize < dataOffset + sizeof(DDS_HEADER_DXT10))
+		{
+			ReportError(LogCategory_Assets, "Invalid .dds header");
+			Close();
+			return false;
+		}
+		const DDS_HEADER_DXT10* dx10 = (const DDS_HEADER_DXT10*)(mFileData + dataOffset);
+		dataOffset += sizeof(DDS_HEADER_DXT10);
+
+		// D3D10_RESOURCE_DIMENSION_TEXTURE2D == 3
+		mFormat = (dx10->resourceDimension == 3 && dx10->arraySize <= 1) ? dx10->dxgiFormat : DXGI_FORMAT_UNKNOWN;
+	}
+	else
+	{
+		mFormat = FormatFromPixelFormat(header->ddspf);
+	}
+
+	UINT rowPitch, numRows;
+	if (mFormat == DXGI_FORMAT_UNKNOWN || !GetSurfaceInfo(mFormat, 1, 1, &rowPitch, &numRows))
+	{
+		ReportError(LogCategory_Assets, "Unsupported .dds pixel format {}", path);
+		Close();
+		return false;
+	}
+
+	mWidth = header->width;
+	mHeight = header->height;
+
+	// ==============================================================
+	//		lay out the mips
+	// ==============================================================
+
+	UINT mipCount = (header->flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header->mipMapCount) : 1;
+	UINT width = mWidth;
+	UINT height = mHeight;
+	size_t offset = dataOffset;
+
+	for (UINT level = 0; level < mipCount; level++)
+	{
+		// a header claiming a size no mip can have is broken, not just truncated
+		UINT64 size = 0;
+		if (GetSurfaceInfo(mFormat, width, height, &rowPitch, &numRows))
+			size = (UINT64)rowPitch * numRows;
+		if (size == 0 || size > UINT_MAX)
+		{
+			ReportError(LogCategory_Assets, "Invalid .dds size {}x{} {}", width, height, path);
+			Close();
+			return false;
+		}
+
+		MipInfo mip;
+		mip.offset = offset;
+		mip.width = width;
+		mip.height = height;
+		mip.rowPitch = rowPitch;
+		mip.size = (UINT)size;
+		mip.resident = false;
+
+		// a truncated file, keep the mips we do have rather than failing outright
+		if (offset + (UINT64)mip.size > mFileSize)
+		{
+			LOG_WARNING(LogCategory_Assets, ".dds file is truncated, only {} mips are usable {}", level, path);
+			break;
+		}
+		mMips.push_back(mip);
+
+		offset += mip.size;
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	if (mMips.empty())
+	{
+		ReportError(LogCategory_Assets, "Texture has no usable mips");
+		Close();
+		return false;
+	}
+
+	gDDSStats.bytesMapped += mFileSize;
+	gDDSStats.texturesMapped++;
+
+	// ==============================================================
+	//		make the mip tail resident
+	// ==============================================================
+
+	mMipTailStart = (UINT)mMips.size() - 1;
+	while (mMipTailStart > 0 && mMips[mMipTailStart - 1].size <= kMipTailBytes)
+		mMipTailStart--;
+
+	for (UINT level = mMipTailStart; level < mMips.size(); level++)
+		MakeResident(level);
+
+	LOG_DEBUG(LogCategory_Assets, "texture mapped: {} ({}x{}, {} mips, tail starts at mip {})", path, mWidth, mHeight, mMips.size(), mMipTailStart);
+
+	return true;
+}
+
+void DDSTexture::Close()
+{
+	if (mFileData)
+	{
+		for (UINT level = 0; level < mMips.size(); level++)
+			Evict(level);
+
+		gDDSStats.bytesMapped -= mFileSize;
+		gDDSStats.texturesMapped--;
+
+		UnmapViewOfFile(mFileData);
+		mFileData = nullptr;
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+
+	mMips.clear();
+	mFileSize = 0;
+	mWidth = 0;
+	mHeight = 0;
+	mFormat = DXGI_FORMAT_UNKNOWN;
+	mMipTailStart = 0;
+}
+
+DDSMipView DDSTexture::GetMip(UINT level) const
+{
+	DDSMipView view = {};
+	if (level >= mMips.size())
+		return view;
+
+	const MipInfo& mip = mMips[level];
+	view.data = mFileData + mip.offset;
+	view.width = mip.width;
+	view.height = mip.height;
+	view.rowPitch = mip.rowPitch;
+	view.size = mip.size;
+	view.resident = mip.resident;
+	return view;
+}
+
+UINT DDSTexture::GetBestResidentMip(UINT level) const
+{
+	if (mMips.empty())
+		return 0;
+
+	level = std::min(level, (UINT)mMips.size() - 1);
+	while (level < mMipTailStart && !mMips[level].resident)
+		level++;
+	return level;
+}
+
+UINT64 DDSTexture::GetResidentBytes() const
+{
+	UINT64 bytes = 0;
+	for (UINT level = 0; level < mMipTailStart; level++)
+	{
+		if (mMips[level].resident)
+			bytes += mMips[level].size;
+	}
+	return bytes;
+}
+
+void DDSTexture::MakeResident(UINT level)
+{
+	MipInfo& mip = mMips[level];
+	if (mip.resident)
+		return;
+
+	// ask the memory manager to start reading the pages in the background
+	// so the first time the renderer touches them it doesn't stall on the disk
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = (PVOID)(mFileData + mip.offset);
+	range.NumberOfBytes = mip.size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+	mip.resident = true;
+	gDDSStats.bytesResident += mip.size;
+	gDDSStats.bytesLoaded += mip.size;
+	gDDSStats.mipsResident++;
+}
+
+void DDSTexture::Evict(UINT level)
+{
+	MipInfo& mip = mMips[level];
+	if (!mip.resident)
+		return;
+
+	// unlocking pages that were never locked fails, but it still trims them out of
+	// the working set, which is exactly what we want for a read-only file mapping
+	VirtualUnlock((LPVOID)(mFileData + mip.offset), mip.size);
+
+	mip.resident = false;
+	gDDSStats.bytesResident -= mip.size;
+	gDDSStats.bytesEvicted += mip.size;
+	gDDSStats.mipsResident--;
+}
+
+
+// ==============================================================
+//		DDSMipStreamer
+// ==============================================================
+
+DDSMipStreamer::DDSMipStreamer(UINT64 budgetBytes, UINT64 bytesPerFrame)
+{
+	mBudget = budgetBytes;
+	mBytesPerFrame = bytesPerFrame;
+}
+
+void DDSMipStreamer::RequestMip(DDSTexture* texture, UINT level, float priority)
+{
+	if (texture == nullptr || !texture->IsOpen() || level >= texture->mMipTailStart)
+		return;
+
+	// merge with an existing request for the same texture
+	for (Request& request : mRequests)
+	{
+		if (request.texture == texture)
+		{
+			request.level = std::min(request.level, level);
+			request.priority = std::max(request.priority, priority);
+			gDDSStats.pendingRequests = (UINT)mRequests.size();
+			return;
+		}
+	}
+
+	Request request;
+	request.texture = texture;
+	request.level = level;
+	request.priority = priority;
+	mRequests.push_back(request);
+	gDDSStats.pendingRequests = (UINT)mRequests.size();
+}
+
+void DDSMipStreamer::Forget(DDSTexture* texture)
+{
+	mRequests.erase(std::remove_if(mRequests.begin(), mRequests.end(),
+		[texture](const Request& r) { return r.texture == texture; }), mRequests.end());
+	mLRU.remove(texture);
+	gDDSStats.pendingRequests = (UINT)mRequests.size();
+}
+
+void DDSMipStreamer::Touch(DDSTexture* texture)
+{
+	mLRU.remove(texture);
+	mLRU.push_front(texture);
+}
+
+// evicts the finest mips of the least recently used textures until 'bytesNeeded' more bytes fit in the budget
+// the requesting texture is never evicted to make room for itself
+bool DDSMipStreamer::EvictFor(UINT64 bytesNeeded, DDSTexture* requester)
+{
+	UINT64 resident = 0;
+	for (DDSTexture* texture : mLRU)
+		resident += texture->GetResidentBytes();
+
+	for (auto it = mLRU.rbegin(); it != mLRU.rend() && resident + bytesNeeded > mBudget; ++it)
+	{
+		DDSTexture* texture = *it;
+		if (texture == requester)
+			continue;
+
+		for (UINT level = 0; level < texture->mMipTailStart && resident + bytesNeeded > mBudget; level++)
+		{
+			if (texture->mMips[level].resident)
+			{
+				resident -= texture->mMips[level].size;
+				texture->Evict(level);
+			}
+		}
+	}
+
+	return resident + bytesNeeded <= mBudget;
+}
+
+void DDSMipStreamer::Update()
+{
+	if (mRequests.empty())
+		return;
+
+	std::stable_sort(mRequests.begin(), mRequests.end(),
+		[](const Request& a, const Request& b) { return a.priority > b.priority; });
+
+	UINT64 frameBytes = 0;
+	size_t completed = 0;
+
+	for (Request& request : mRequests)
+	{
+		// most recently used before anything is evicted to make room for it
+		DDSTexture* texture = request.texture;
+		Touch(texture);
+		bool done = true;
+
+		// stream coarse to fine, so a partially serviced request still improves the image
+		for (int level = (int)texture->mMipTailStart - 1; level >= (int)request.level; level--)
+		{
+			const DDSTexture::MipInfo& mip = texture->mMips[level];
+			if (mip.resident)
+				continue;
+
+			if (frameBytes + mip.size > mBytesPerFrame && frameBytes > 0)
+			{
+				done = false;
+				break;
+			}
+			if (!EvictFor(mip.size, texture))
+			{
+				// the mip can never fit, settle for what is resident
+				LOG_WARNING(LogCategory_Assets, "texture streaming budget exhausted, mip {} was not loaded", level);
+				break;
+			}
+
+			texture->MakeResident(level);
+			frameBytes += mip.size;
+		}
+
+		if (done)
+		{
+			// mark as serviced by moving it to the front of the list
+			std::swap(mRequests[completed], request);
+			completed++;
+		}
+		if (frameBytes >= mBytesPerFrame)
+			break;
+	}
+
+	mRequests.erase(mRequests.begin(), mRequests.begin() + completed);
+	gDDSStats.pendingRequests = (UINT)mRequests.size();
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include <list>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+
+// ==============================================================
+//		DDS file layout
+// ==============================================================
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+
+#define DDSD_CAPS        0x1
+#define DDSD_HEIGHT      0x2
+#define DDSD_WIDTH       0x4
+#define DDSD_PITCH       0x8
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE  0x80000
+
+#define DDPF_ALPHAPIXELS 0x1
+#define DDPF_FOURCC      0x4
+#define DDPF_RGB         0x40
+#define DDPF_LUMINANCE   0x20000
+
+#define DDSCAPS_COMPLEX  0x8
+#define DDSCAPS_TEXTURE  0x1000
+#define DDSCAPS_MIPMAP   0x400000
+
+#define DDS_FOURCC(a, b, c, d) ((UINT)(BYTE)(a) | ((UINT)(BYTE)(b) << 8) | ((UINT)(BYTE)(c) << 16) | ((UINT)(BYTE)(d) << 24))
+
+#pragma pack(push, 1)
+struct DDS_PIXELFORMAT
+{
+	UINT size;
+	UINT flags;
+	UINT fourCC;
+	UINT RGBBitCount;
+	UINT RBitMask;
+	UINT GBitMask;
+	UINT BBitMask;
+	UINT ABitMask;
+};
+
+struct DDS_HEADER
+{
+	UINT size;
+	UINT flags;
+	UINT height;
+	UINT width;
+	UINT pitchOrLinearSize;
+	UINT depth;
+	UINT mipMapCount;
+	UINT reserved1[11];
+	DDS_PIXELFORMAT ddspf;
+	UINT caps;
+	UINT caps2;
+	UINT caps3;
+	UINT caps4;
+	UINT reserved2;
+};
+
+// only present when ddspf.fourCC == "DX10"
+struct DDS_HEADER_DXT10
+{
+	DXGI_FORMAT dxgiFormat;
+	UINT resourceDimension;
+	UINT miscFlag;
+	UINT arraySize;
+	UINT miscFlags2;
+};
+#pragma pack(pop)
+
+// returns the number of bytes one row of blocks/pixels takes up, and the number of rows
+// for a surface of the given format and size. returns false for formats we can't size, and rows too wide for a UINT
+STRANGEENGINEMK3_API bool GetSurfaceInfo(DXGI_FORMAT format, UINT width, UINT height, UINT* rowPitch, UINT* numRows);
+
+// writes a 2D texture with a full or partial mip chain, mips[0] is the largest
+// BC1/BC3/BC5 and 32 bit RGBA use a legacy header, anything else gets a DX10 header
+STRANGEENGINEMK3_API bool SaveDDS(const std::wstring& path, DXGI_FORMAT format, UINT width, UINT height, const std::vector<std::vector<BYTE>>& mips);
+
+
+// ==============================================================
+//		memory-mapped texture
+// ==============================================================
+
+// a view of one mip level inside the mapped file, nothing is copied
+struct DDSMipView
+{
+	const BYTE* data;  // first byte of this mip in the mapped file
+	UINT		width;
+	UINT		height;
+	UINT		rowPitch;  // bytes per row of pixels (or row of 4x4 blocks for BC formats)
+	UINT		size;	   // total bytes of this mip
+	bool		resident;  // has the streamer brought this mip into memory yet?
+};
+
+// counters for the texture streaming dashboards
+struct DDSStreamingStats
+{
+	UINT64 bytesMapped;		 // total size of every mapped .dds file
+	UINT64 bytesResident;	 // bytes of mips currently marked resident
+	UINT64 bytesLoaded;		 // running total of bytes ever made resident (counts reloads too)
+	UINT64 bytesEvicted;	 // running total of bytes dropped to stay inside the budget
+	UINT   texturesMapped;
+	UINT   mipsResident;
+	UINT   pendingRequests;
+};
+
+STRANGEENGINEMK3_API DDSStreamingStats GetTextureStreamingStats();
+
+class STRANGEENGINEMK3_API DDSTexture
+{
+public:
+	DDSTexture();
+	~DDSTexture();
+
+	// maps the file and validates the header, the mip tail is made resident straight away
+	bool Open(const std::wstring& path);
+	void Close();
+
+	bool IsOpen() const { return mFileData != nullptr; }
+
+	UINT		GetWidth() const	 { return mWidth; }
+	UINT		GetHeight() const	 { return mHeight; }
+	UINT		GetMipCount() const	 { return (UINT)mMips.size(); }
+	DXGI_FORMAT GetFormat() const	 { return mFormat; }
+	UINT		GetMipTailStart() const { return mMipTailStart; }
+
+	// zero copy view of a mip level. the pointer is valid until Close()
+	// even when the mip is not resident, touching it will just page fault it in
+	DDSMipView GetMip(UINT level) const;
+
+	// the finest mip that is resident and not finer than 'level'
+	// the mip tail is always resident, so this always returns something usable
+	UINT GetBestResidentMip(UINT level) const;
+
+	// bytes of every mip finer than the tail that are resident
+	UINT64 GetResidentBytes() const;
+
+private:
+	friend class DDSMipStreamer;
+
+	struct MipInfo
+	{
+		size_t offset;
+		UINT   width;
+		UINT   height;
+		UINT   rowPitch;
+		UINT   size;
+		bool   resident;
+	};
+
+	void MakeResident(UINT level);
+	void Evict(UINT level);
+
+	HANDLE		mFile;
+	HANDLE		mMapping;
+	const BYTE* mFileData;
+	UINT64		mFileSize;
+
+	UINT		mWidth;
+	UINT		mHeight;
+	DXGI_FORMAT mFormat;
+	UINT		mMipTailStart; // first mip level that belongs to the always-resident tail
+
+	std::vector<MipInfo> mMips;
+};
+
+
+// ==============================================================
+//		mip streaming
+// ==============================================================
+
+// brings the higher mips of mapped textures in on demand while keeping the
+// total resident size under a budget. call Update() once per frame
+class STRANGEENGINEMK3_API DDSMipStreamer
+{
+public:
+	DDSMipStreamer(UINT64 budgetBytes, UINT64 bytesPerFrame);
+
+	// ask for 'level' and everything coarser to be made resident
+	// a higher priority is serviced first (e.g. larger on screen / closer to the camera)
+	void RequestMip(DDSTexture* texture, UINT level, float priority);
+
+	// the texture is being closed, forget any requests and LRU entries for it
+	void Forget(DDSTexture* texture);
+
+	void Update();
+
+	void   SetBudget(UINT64 budgetBytes) { mBudget = budgetBytes; }
+	UINT64 GetBudget() const { return mBudget; }
+
+private:
+	struct Request
+	{
+		DDSTexture* texture;
+		UINT		level;
+		float		priority;
+	};
+
+	void Touch(DDSTexture* texture);
+	bool EvictFor(UINT64 bytesNeeded, DDSTexture* requester);
+
+	UINT64 mBudget;
+	UINT64 mBytesPerFrame;
+
+	std::vector<Request>   mRequests;
+	std::list<DDSTexture*> mLRU; // front = most recently used
+};
@@ -0,0 +1,698 @@
+#include "pch.h"
+#include "DebugDraw.h"
+#include "Log.h"
+#include "SystemScheduler.h"
+#include "Telemetry.h"
+#include <d3dcompiler.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+DebugDraw* DebugDraw::singleton = nullptr;
+static std::once_flag gDebugDrawOnce;
+
+// what one frame can draw, past this lines and characters are dropped (and counted)
+static const UINT kMaxLines = 65536;
+static const UINT kMaxCharacters = 16384;
+
+// segments in each of a sphere's rings
+static const int kSphereSegments = 24;
+static float gCircle[kSphereSegments + 1][2];
+
+// the font, 5x8 glyphs for ' ' to '~' in a row with a blank column after each
+static const UINT kFirstGlyph = 32;
+static const UINT kGlyphCount = 95;
+static const UINT kGlyphWidth = 5;
+static const UINT kGlyphHeight = 8;
+static const UINT kCellWidth = 6;
+static const UINT kCellHeight = 10;
+static const UINT kFontWidth = kGlyphCount * kCellWidth;
+
+// a column per byte, left to right, the low bit is the top row
+static const BYTE kFontColumns[kGlyphCount][kGlyphWidth] =
+{
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, // space ! " #
+	{ 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 }, { 0x36, 0x49, 0x56, 0x20, 0x50 }, { 0x00, 0x08, 0x07, 0x03, 0x00 }, // $ % & '
+	{ 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x2A, 0x1C, 0x7F, 0x1C, 0x2A }, { 0x08, 0x08, 0x3E, 0x08, 0x08 }, // ( ) * +
+	{ 0x00, 0x80, 0x70, 0x30, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x00, 0x60, 0x60, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 }, // , - . /
+	{ 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 }, { 0x72, 0x49, 0x49, 0x49, 0x46 }, { 0x21, 0x41, 0x49, 0x4D, 0x33 }, // 0 1 2 3
+	{ 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x31 }, { 0x41, 0x21, 0x11, 0x09, 0x07 }, // 4 5 6 7
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x46, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x00, 0x14, 0x00, 0x00 }, { 0x00, 0x40, 0x34, 0x00, 0x00 }, // 8 9 : ;
+	{ 0x00, 0x08, 0x14, 0x22, 0x41 }, { 0x14, 0x14, 0x14, 0x14, 0x14 }, { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x59, 0x09, 0x06 }, // < = > ?
+	{ 0x3E, 0x41, 0x5D, 0x59, 0x4E }, { 0x7C, 0x12, 0x11, 0x12, 0x7C }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 }, // @ A B C
+	{ 0x7F, 0x41, 0x41, 0x41, 0x3E }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x41, 0x51, 0x73 }, // D E F G
+	{ 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 }, { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 }, // H I J K
+	{ 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x1C, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E }, // L M N O
+	{ 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x26, 0x49, 0x49, 0x49, 0x32 }, // P Q R S
+	{ 0x03, 0x01, 0x7F, 0x01, 0x03 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F }, { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F }, // T U V W
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x03, 0x04, 0x78, 0x04, 0x03 }, { 0x61, 0x59, 0x49, 0x4D, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x41 }, // X Y Z [
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x41, 0x7F }, { 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 }, // \ ] ^ _
+	{ 0x00, 0x03, 0x07, 0x08, 0x00 }, { 0x20, 0x54, 0x54, 0x78, 0x40 }, { 0x7F, 0x28, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x28 }, // ` a b c
+	{ 0x38, 0x44, 0x44, 0x28, 0x7F }, { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x00, 0x08, 0x7E, 0x09, 0x02 }, { 0x18, 0xA4, 0xA4, 0x9C, 0x78 }, // d e f g
+	{ 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 }, { 0x20, 0x40, 0x40, 0x3D, 0x00 }, { 0x7F, 0x10, 0x28, 0x44, 0x00 }, // h i j k
+	{ 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x78, 0x04, 0x78 }, { 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, // l m n o
+	{ 0xFC, 0x18, 0x24, 0x24, 0x18 }, { 0x18, 0x24, 0x24, 0x18, 0xFC }, { 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x24 }, // p q r s
+	{ 0x04, 0x04, 0x3F, 0x44, 0x24 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C }, { 0x1C, 0x20, 0x40, 0x20, 0x1C }, { 0x3C, 0x40, 0x30, 0x40, 0x3C }, // t u v w
+	{ 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x4C, 0x90, 0x90, 0x90, 0x7C }, { 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, // x y z {
+	{ 0x00, 0x00, 0x77, 0x00, 0x00 }, { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x02, 0x01, 0x02, 0x04, 0x02 },								   // | } ~
+};
+
+// lines in world space through the game's camera, text in pixels through the font
+static const char kDebugShaders[] =
+	"cbuffer DebugConstants : register(b0)\n"
+	"{\n"
+	"	row_major float4x4 viewProjection;\n"
+	"	float2 pixelToClip;\n"
+	"	float2 padding;\n"
+	"};\n"
+	"Texture2D font : register(t0);\n"
+	"SamplerState fontSampler : register(s0);\n"
+	"struct LineVertex { float3 position : POSITION; float4 color : COLOR; };\n"
+	"struct LinePixel { float4 position : SV_Position; float4 color : COLOR; };\n"
+	"struct TextVertex { float2 position : POSITION; float2 uv : TEXCOORD; float4 color : COLOR; };\n"
+	"struct TextPixel { float4 position : SV_Position; float2 uv : TEXCOORD; float4 color : COLOR; };\n"
+	"LinePixel LineVS(LineVertex input)\n"
+	"{\n"
+	"	LinePixel output;\n"
+	"	output.position = mul(float4(input.position, 1.0f), viewProjection);\n"
+	"	output.color = input.color;\n"
+	"	return output;\n"
+	"}\n"
+	"float4 LinePS(LinePixel input) : SV_Target { return input.color; }\n"
+	"TextPixel TextVS(TextVertex input)\n"
+	"{\n"
+	"	TextPixel output;\n"
+	"	output.position = float4(input.position * pixelToClip + float2(-1.0f, 1.0f), 0.0f, 1.0f);\n"
+	"	output.uv = input.uv;\n"
+	"	output.color = input.color;\n"
+	"	return output;\n"
+	"}\n"
+	"float4 TextPS(TextPixel input) : SV_Target\n"
+	"{\n"
+	"	return float4(input.color.rgb, input.color.a * font.Sample(fontSampler, input.uv).r);\n"
+	"}\n";
+
+// the layout of DebugConstants
+struct DebugConstants
+{
+	XMFLOAT4X4 viewProjection;
+	XMFLOAT2   pixelToClip;
+	XMFLOAT2   padding;
+};
+
+// gives a thread's buffer back when the thread exits
+struct DebugThreadSlot
+{
+	DebugDraw::ThreadBuffer* buffer;
+
+	DebugThreadSlot() : buffer(nullptr) {}
+	~DebugThreadSlot()
+	{
+		if (buffer)
+			buffer->inUse.store(false, std::memory_order_release);
+	}
+};
+static thread_local DebugThreadSlot tDebugSlot;
+
+template<typename T> static void SafeRelease(T*& object)
+{
+	if (object)
+	{
+		object->Release();
+		object = nullptr;
+	}
+}
+
+DebugDraw* DebugDraw::Get()
+{
+	// gives the singleton an initial value, never deleted, threads can still be recording while the DLL unloads
+	std::call_once(gDebugDrawOnce, []()
+	{
+		singleton = new DebugDraw();
+	});
+	return singleton;
+}
+
+DebugDraw::DebugDraw()
+{
+	mEnabled = true;
+	mStatsVisible = false;
+	mAverageFrameMs = 0.0f;
+	memset(&mViewProjection, 0, sizeof(mViewProjection));
+	mViewProjection._11 = mViewProjection._22 = mViewProjection._33 = mViewProjection._44 = 1.0f;
+	memset(&mStats, 0, sizeof(mStats));
+
+	mConstants = nullptr;
+	mLineVertexShader = nullptr;
+	mLinePixelShader = nullptr;
+	mLineLayout = nullptr;
+	mTextVertexShader = nullptr;
+	mTextPixelShader = nullptr;
+	mTextLayout = nullptr;
+	mFontTexture = nullptr;
+	mFontView = nullptr;
+	mFontSampler = nullptr;
+	mBlendState = nullptr;
+	mTextDepthState = nullptr;
+
+	for (int i = 0; i <= kSphereSegments; i++)
+	{
+		float angle = XM_2PI * i / kSphereSegments;
+		gCircle[i][0] = cosf(angle);
+		gCircle[i][1] = sinf(angle);
+	}
+}
+
+DebugDraw::~DebugDraw()
+{
+	ReleaseRenderer();
+}
+
+bool DebugDraw::CreateRenderer(ID3D11Device* device)
+{
+	ReleaseRenderer();
+
+	if (!mLineBuffer.Create(device, kMaxLines * 2 * sizeof(DebugLineVertex)) || !mTextBuffer.Create(device, kMaxCharacters * 6 * sizeof(DebugTextVertex)))
+	{
+		ReleaseRenderer();
+		return false;
+	}
+	if (!device)
+		return true;
+
+	if (!CreateShaders(device) || !CreateFontTexture(device))
+	{
+		ReleaseRenderer();
+		return false;
+	}
+
+	D3D11_BUFFER_DESC constantsDesc;
+	constantsDesc.ByteWidth = sizeof(DebugConstants);
+	constantsDesc.Usage = D3D11_USAGE_DEFAULT;
+	constantsDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	constantsDesc.CPUAccessFlags = 0;
+	constantsDesc.MiscFlags = 0;
+	constantsDesc.StructureByteStride = 0;
+
+	D3D11_BLEND_DESC blendDesc;
+	ZeroMemory(&blendDesc, sizeof(blendDesc));
+	blendDesc.RenderTarget[0].BlendEnable = TRUE;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+
+	D3D11_DEPTH_STENCIL_DESC depthDesc;
+	ZeroMemory(&depthDesc, sizeof(depthDesc));
+	depthDesc.DepthEnable = FALSE;
+	depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+	depthDesc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+
+	HRESULT hr = device->CreateBuffer(&constantsDesc, 0, &mConstants);
+	if (SUCCEEDED(hr))
+		hr = device->CreateBlendState(&blendDesc, &mBlendState);
+	if (SUCCEEDED(hr))
+		hr = device->CreateDepthStencilState(&depthDesc, &mTextDepthState);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the debug draw states");
+		ReleaseRenderer();
+		return false;
+	}
+	return true;
+}
+
+bool DebugDraw::CreateShaders(ID3D11Device* device)
+{
+	const char* entryPoints[4] = { "LineVS", "LinePS", "TextVS", "TextPS" };
+	const char* targets[4] = { "vs_4_0", "ps_4_0", "vs_4_0", "ps_4_0" };
+	ID3DBlob* code[4] = { nullptr, nullptr, nullptr, nullptr };
+
+	bool succeeded = true;
+	for (int i = 0; i < 4 && succeeded; i++)
+	{
+		ID3DBlob* errors = nullptr;
+		HRESULT hr = D3DCompile(kDebugShaders, sizeof(kDebugShaders) - 1, "DebugDraw", nullptr, nullptr, entryPoints[i], targets[i],
+			D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &code[i], &errors);
+		// check for failure
+		if (FAILED(hr))
+		{
+			ReportError(LogCategory_Render, "Could not compile the debug draw shader {}: {}", entryPoints[i],
+				errors ? (const char*)errors->GetBufferPointer() : "no compiler output");
+			succeeded = false;
+		}
+		SafeRelease(errors);
+	}
+
+	D3D11_INPUT_ELEMENT_DESC lineLayout[2] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	D3D11_INPUT_ELEMENT_DESC textLayout[3] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	};
+
+	if (succeeded)
+	{
+		HRESULT hr = device->CreateVertexShader(code[0]->GetBufferPointer(), code[0]->GetBufferSize(), nullptr, &mLineVertexShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreatePixelShader(code[1]->GetBufferPointer(), code[1]->GetBufferSize(), nullptr, &mLinePixelShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreateVertexShader(code[2]->GetBufferPointer(), code[2]->GetBufferSize(), nullptr, &mTextVertexShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreatePixelShader(code[3]->GetBufferPointer(), code[3]->GetBufferSize(), nullptr, &mTextPixelShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreateInputLayout(lineLayout, 2, code[0]->GetBufferPointer(), code[0]->GetBufferSize(), &mLineLayout);
+		if (SUCCEEDED(hr))
+			hr = device->CreateInputLayout(textLayout, 3, code[2]->GetBufferPointer(), code[2]->GetBufferSize(), &mTextLayout);
+		// check for failure
+		if (FAILED(hr))
+		{
+			ReportError(LogCategory_Render, "Could not create the debug draw shaders");
+			succeeded = false;
+		}
+	}
+
+	// so a render capture can make them again
+	if (succeeded)
+	{
+		RenderContext::RegisterShader(mLineVertexShader, code[0]->GetBufferPointer(), code[0]->GetBufferSize());
+		RenderContext::RegisterShader(mLinePixelShader, code[1]->GetBufferPointer(), code[1]->GetBufferSize());
+		RenderContext::RegisterShader(mTextVertexShader, code[2]->GetBufferPointer(), code[2]->GetBufferSize());
+		RenderContext::RegisterShader(mTextPixelShader, code[3]->GetBufferPointer(), code[3]->GetBufferSize());
+		RenderContext::RegisterInputLayout(mLineLayout, lineLayout, 2, code[0]->GetBufferPointer(), code[0]->GetBufferSize());
+		RenderContext::RegisterInputLayout(mTextLayout, textLayout, 3, code[2]->GetBufferPointer(), code[2]->GetBufferSize());
+	}
+
+	for (int i = 0; i < 4; i++)
+		SafeRelease(code[i]);
+	return succeeded;
+}
+
+bool DebugDraw::CreateFontTexture(ID3D11Device* device)
+{
+	// one byte a pixel, the glyphs side by side
+	std::vector<BYTE> pixels(kFontWidth * kGlyphHeight, 0);
+	for (UINT glyph = 0; glyph < kGlyphCount; glyph++)
+	{
+		for (UINT column = 0; column < kGlyphWidth; column++)
+		{
+			for (UINT row = 0; row < kGlyphHeight; row++)
+			{
+				if (kFontColumns[glyph][column] & (1 << row))
+					pixels[row * kFontWidth + glyph * kCellWidth + column] = 255;
+			}
+		}
+	}
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	textureDesc.Width = kFontWidth;
+	textureDesc.Height = kGlyphHeight;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA data;
+	data.pSysMem = pixels.data();
+	data.SysMemPitch = kFontWidth;
+	data.SysMemSlicePitch = 0;
+
+	// point sampled, the glyphs stay sharp at whole number scales
+	D3D11_SAMPLER_DESC samplerDesc;
+	ZeroMemory(&samplerDesc, sizeof(samplerDesc));
+	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	HRESULT hr = device->CreateTexture2D(&textureDesc, &data, &mFontTexture);
+	if (SUCCEEDED(hr))
+		hr = device->CreateShaderResourceView(mFontTexture, nullptr, &mFontView);
+	if (SUCCEEDED(hr))
+		hr = device->CreateSamplerState(&samplerDesc, &mFontSampler);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the debug draw font");
+		return false;
+	}
+	return true;
+}
+
+void DebugDraw::ReleaseRenderer()
+{
+	mLineBuffer.Release();
+	mTextBuffer.Release();
+	SafeRelease(mConstants);
+	SafeRelease(mLineVertexShader);
+	SafeRelease(mLinePixelShader);
+	SafeRelease(mLineLayout);
+	SafeRelease(mTextVertexShader);
+	SafeRelease(mTextPixelShader);
+	SafeRelease(mTextLayout);
+	SafeRelease(mFontView);
+	SafeRelease(mFontTexture);
+	SafeRelease(mFontSampler);
+	SafeRelease(mBlendState);
+	SafeRelease(mTextDepthState);
+}
+
+void DebugDraw::SetViewProjection(const XMFLOAT4X4& viewProjection)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mViewProjection = viewProjection;
+}
+
+DebugDraw::ThreadBuffer* DebugDraw::GetThreadBuffer()
+{
+	if (tDebugSlot.buffer)
+		return tDebugSlot.buffer;
+
+	// first time on this thread, the buffer of a thread that has exited if there is one
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (const std::unique_ptr<ThreadBuffer>& buffer : mThreadBuffers)
+	{
+		bool inUse = false;
+		if (buffer->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire))
+		{
+			tDebugSlot.buffer = buffer.get();
+			return tDebugSlot.buffer;
+		}
+	}
+	mThreadBuffers.emplace_back(new ThreadBuffer());
+	mThreadBuffers.back()->inUse.store(true, std::memory_order_relaxed);
+	tDebugSlot.buffer = mThreadBuffers.back().get();
+	return tDebugSlot.buffer;
+}
+
+void DebugDraw::AddLine(const XMFLOAT3& from, const XMFLOAT3& to, UINT color)
+{
+	if (!IsEnabled())
+		return;
+
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	DebugLineVertex vertices[2] = { { from, color }, { to, color } };
+	buffer->lines.insert(buffer->lines.end(), vertices, vertices + 2);
+}
+
+void DebugDraw::AddBox(const Aabb& box, UINT color)
+{
+	if (!IsEnabled())
+		return;
+
+	// corner i has the max of x when bit 0 is set, of y for bit 1 and of z for bit 2
+	XMFLOAT3 corners[8];
+	for (int i = 0; i < 8; i++)
+		corners[i] = XMFLOAT3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+	static const int kEdges[12][2] = { { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	for (int i = 0; i < 12; i++)
+	{
+		DebugLineVertex vertices[2] = { { corners[kEdges[i][0]], color }, { corners[kEdges[i][1]], color } };
+		buffer->lines.insert(buffer->lines.end(), vertices, vertices + 2);
+	}
+}
+
+void DebugDraw::AddSphere(const Sphere& sphere, UINT color)
+{
+	if (!IsEnabled())
+		return;
+
+	const XMFLOAT3& c = sphere.center;
+	float r = sphere.radius;
+
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	for (int i = 0; i < kSphereSegments; i++)
+	{
+		float a0 = gCircle[i][0] * r, b0 = gCircle[i][1] * r;
+		float a1 = gCircle[i + 1][0] * r, b1 = gCircle[i + 1][1] * r;
+		DebugLineVertex vertices[6] =
+		{
+			{ XMFLOAT3(c.x + a0, c.y + b0, c.z), color }, { XMFLOAT3(c.x + a1, c.y + b1, c.z), color }, // around z
+			{ XMFLOAT3(c.x + a0, c.y, c.z + b0), color }, { XMFLOAT3(c.x + a1, c.y, c.z + b1), color }, // around y
+			{ XMFLOAT3(c.x, c.y + a0, c.z + b0), color }, { XMFLOAT3(c.x, c.y + a1, c.z + b1), color }, // around x
+		};
+		buffer->lines.insert(buffer->lines.end(), vertices, vertices + 6);
+	}
+}
+
+// the point on all three planes, from the cross products of their normals
+static XMFLOAT3 PlaneIntersection(const XMFLOAT4& a, const XMFLOAT4& b, const XMFLOAT4& c)
+{
+	XMFLOAT3 bc(b.y * c.z - b.z * c.y, b.z * c.x - b.x * c.z, b.x * c.y - b.y * c.x);
+	XMFLOAT3 ca(c.y * a.z - c.z * a.y, c.z * a.x - c.x * a.z, c.x * a.y - c.y * a.x);
+	XMFLOAT3 ab(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	float denominator = a.x * bc.x + a.y * bc.y + a.z * bc.z;
+	if (fabsf(denominator) < 1e-12f)
+		return XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	float scale = -1.0f / denominator;
+	return XMFLOAT3((a.w * bc.x + b.w * ca.x + c.w * ab.x) * scale, (a.w * bc.y + b.w * ca.y + c.w * ab.y) * scale,
+		(a.w * bc.z + b.w * ca.z + c.w * ab.z) * scale);
+}
+
+void DebugDraw::AddFrustum(const Frustum& frustum, UINT color)
+{
+	if (!IsEnabled())
+		return;
+
+	// near then far, each going bottom left, bottom right, top right, top left
+	const XMFLOAT4* p = frustum.planes;
+	XMFLOAT3 corners[8];
+	for (int depth = 0; depth < 2; depth++)
+	{
+		const XMFLOAT4& plane = p[4 + depth];
+		corners[depth * 4 + 0] = PlaneIntersection(plane, p[0], p[2]);
+		corners[depth * 4 + 1] = PlaneIntersection(plane, p[1], p[2]);
+		corners[depth * 4 + 2] = PlaneIntersection(plane, p[1], p[3]);
+		corners[depth * 4 + 3] = PlaneIntersection(plane, p[0], p[3]);
+	}
+
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	for (int i = 0; i < 4; i++)
+	{
+		int next = (i + 1) % 4;
+		DebugLineVertex vertices[6] =
+		{
+			{ corners[i], color }, { corners[next], color },
+			{ corners[4 + i], color }, { corners[4 + next], color },
+			{ corners[i], color }, { corners[4 + i], color },
+		};
+		buffer->lines.insert(buffer->lines.end(), vertices, vertices + 6);
+	}
+}
+
+void DebugDraw::AddText(float x, float y, const char* text, UINT color, float scale)
+{
+	if (!IsEnabled() || !text)
+		return;
+
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	float penX = x, penY = y;
+	const float width = kGlyphWidth * scale, height = kGlyphHeight * scale;
+	for (const char* c = text; *c; c++)
+	{
+		UINT character = (UINT)(unsigned char)*c;
+		if (character == '\n')
+		{
+			penX = x;
+			penY += kCellHeight * scale;
+			continue;
+		}
+
+		// spaces and anything the font doesn't have only move along
+		if (character > kFirstGlyph && character < kFirstGlyph + kGlyphCount)
+		{
+			float u0 = (float)((character - kFirstGlyph) * kCellWidth) / kFontWidth;
+			float u1 = u0 + (float)kGlyphWidth / kFontWidth;
+			DebugTextVertex vertices[6] =
+			{
+				{ XMFLOAT2(penX, penY), XMFLOAT2(u0, 0.0f), color }, { XMFLOAT2(penX + width, penY), XMFLOAT2(u1, 0.0f), color },
+				{ XMFLOAT2(penX, penY + height), XMFLOAT2(u0, 1.0f), color }, { XMFLOAT2(penX, penY + height), XMFLOAT2(u0, 1.0f), color },
+				{ XMFLOAT2(penX + width, penY), XMFLOAT2(u1, 0.0f), color }, { XMFLOAT2(penX + width, penY + height), XMFLOAT2(u1, 1.0f), color },
+			};
+			buffer->text.insert(buffer->text.end(), vertices, vertices + 6);
+		}
+		penX += kCellWidth * scale;
+	}
+}
+
+void DebugDraw::AddStatsOverlay(float x, float y)
+{
+	float frameMs = gTimer.DeltaTime() * 1000.0f;
+	mAverageFrameMs = (mAverageFrameMs > 0.0f) ? mAverageFrameMs * 0.95f + frameMs * 0.05f : frameMs;
+
+	std::string stats;
+	char line[128];
+	snprintf(line, sizeof(line), "frame %7.2f ms %6.0f fps\n", mAverageFrameMs, mAverageFrameMs > 0.0f ? 1000.0f / mAverageFrameMs : 0.0f);
+	stats += line;
+
+	// the scheduler's last frame, * is on the critical path
+	const SchedulerReport& report = SystemScheduler::Get()->GetReport();
+	if (!report.systems.empty())
+	{
+		snprintf(line, sizeof(line), "systems %5.2f ms, critical path %5.2f ms\n", report.frameMs, report.criticalPathMs);
+		stats += line;
+		for (const SystemTiming& timing : report.systems)
+		{
+			snprintf(line, sizeof(line), "  %-20.20s %6.2f ms%s\n", timing.name.c_str(), timing.averageMs, timing.critical ? " *" : "");
+			stats += line;
+		}
+	}
+
+	// as they were published at the start of this frame
+	Telemetry* telemetry = Telemetry::Get();
+	TelemetryFrame frame;
+	telemetry->GetLastFrame(&frame);
+	UINT counters = telemetry->GetCounterCount();
+	for (UINT i = 0; i < counters; i++)
+	{
+		snprintf(line, sizeof(line), "%-22.22s %10lld\n", telemetry->GetCounterName(i), (long long)frame.counters[i]);
+		stats += line;
+	}
+
+	AddText(x, y, stats.c_str(), kDebugWhite);
+}
+
+void DebugDraw::Collect()
+{
+	mLines.clear();
+	mText.clear();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (const std::unique_ptr<ThreadBuffer>& buffer : mThreadBuffers)
+	{
+		std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+		mLines.insert(mLines.end(), buffer->lines.begin(), buffer->lines.end());
+		mText.insert(mText.end(), buffer->text.begin(), buffer->text.end());
+		buffer->lines.clear();
+		buffer->text.clear();
+	}
+}
+
+void DebugDraw::Render(RenderContext* context, UINT width, UINT height)
+{
+	Collect();
+
+	UINT lines = std::min((UINT)mLines.size() / 2, kMaxLines);
+	UINT characters = std::min((UINT)mText.size() / 6, kMaxCharacters);
+	mStats.lines = lines;
+	mStats.characters = characters;
+	mStats.dropped = (UINT)mLines.size() / 2 - lines + (UINT)mText.size() / 6 - characters;
+
+	if (!context || !mLineVertexShader)
+		return;
+
+	RenderLines(context);
+	RenderText(context, width, height);
+
+	// back to what everything else expects
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	context->OMSetBlendState(nullptr, blendFactor, 0xffffffff);
+	context->OMSetDepthStencilState(nullptr, 0);
+}
+
+void DebugDraw::RenderLines(RenderContext* context)
+{
+	UINT count = mStats.lines * 2;
+	if (count == 0)
+		return;
+
+	UINT firstVertex = 0;
+	if (!mLineBuffer.Begin(context))
+		return;
+	void* vertices = mLineBuffer.Allocate(count, sizeof(DebugLineVertex), &firstVertex);
+	if (vertices)
+		memcpy(vertices, mLines.data(), count * sizeof(DebugLineVertex));
+	mLineBuffer.End(context);
+	if (!vertices)
+		return;
+
+	DebugConstants constants;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		constants.viewProjection = mViewProjection;
+	}
+	constants.pixelToClip = XMFLOAT2(0.0f, 0.0f);
+	constants.padding = XMFLOAT2(0.0f, 0.0f);
+	context->UpdateSubresource(mConstants, 0, nullptr, &constants, 0, 0);
+
+	ID3D11Buffer* buffer = mLineBuffer.GetBuffer();
+	UINT stride = sizeof(DebugLineVertex), offset = 0;
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	context->IASetInputLayout(mLineLayout);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+	context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+	context->VSSetShader(mLineVertexShader);
+	context->VSSetConstantBuffers(0, 1, &mConstants);
+	context->PSSetShader(mLinePixelShader);
+	context->OMSetBlendState(mBlendState, blendFactor, 0xffffffff);
+	context->OMSetDepthStencilState(nullptr, 0);
+	context->Draw(count, firstVertex);
+}
+
+void DebugDraw::RenderText(RenderContext* context, UINT width, UINT height)
+{
+	UINT count = mStats.characters * 6;
+	if (count == 0 || width == 0 || height == 0)
+		return;
+
+	UINT firstVertex = 0;
+	if (!mTextBuffer.Begin(context))
+		return;
+	void* vertices = mTextBuffer.Allocate(count, sizeof(DebugTextVertex), &firstVertex);
+	if (vertices)
+		memcpy(vertices, mText.data(), count * sizeof(DebugTextVertex));
+	mTextBuffer.End(context);
+	if (!vertices)
+		return;
+
+	// pixels to clip space, y flips
+	DebugConstants constants;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		constants.viewProjection = mViewProjection;
+	}
+	constants.pixelToClip = XMFLOAT2(2.0f / width, -2.0f / height);
+	constants.padding = XMFLOAT2(0.0f, 0.0f);
+	context->UpdateSubresource(mConstants, 0, nullptr, &constants, 0, 0);
+
+	ID3D11Buffer* buffer = mTextBuffer.GetBuffer();
+	UINT stride = sizeof(DebugTextVertex), offset = 0;
+	float blendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	context->IASetInputLayout(mTextLayout);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+	context->VSSetShader(mTextVertexShader);
+	context->VSSetConstantBuffers(0, 1, &mConstants);
+	context->PSSetShader(mTextPixelShader);
+	context->PSSetShaderResources(0, 1, &mFontView);
+	context->PSSetSamplers(0, 1, &mFontSampler);
+	context->OMSetBlendState(mBlendState, blendFactor, 0xffffffff);
+	context->OMSetDepthStencilState(mTextDepthState, 0);
+	context->Draw(count, firstVertex);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <xnamath.h>
+#include "Geometry.h"
+#include "RenderCapture.h"
+#include "TransientBuffer.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// RGBA8, R in the low byte, the same as particle colours
+static const UINT kDebugWhite = 0xffffffff;
+static const UINT kDebugRed = 0xff0000ff;
+static const UINT kDebugGreen = 0xff00ff00;
+static const UINT kDebugBlue = 0xffff0000;
+static const UINT kDebugYellow = 0xff00ffff;
+static const UINT kDebugCyan = 0xffffff00;
+static const UINT kDebugMagenta = 0xffff00ff;
+
+inline UINT MakeDebugColor(float r, float g, float b, float a = 1.0f)
+{
+	return (UINT)(r * 255.0f + 0.5f) | ((UINT)(g * 255.0f + 0.5f) << 8) | ((UINT)(b * 255.0f + 0.5f) << 16) | ((UINT)(a * 255.0f + 0.5f) << 24);
+}
+
+// one end of a line, in world space
+struct DebugLineVertex
+{
+	XMFLOAT3 position;
+	UINT	 color;
+};
+
+// one corner of a character's quad, in pixels from the top left of the screen
+struct DebugTextVertex
+{
+	XMFLOAT2 position;
+	XMFLOAT2 uv; // into the built in 5x8 font
+	UINT	 color;
+};
+
+struct DebugDrawStats
+{
+	UINT lines;		 // drawn last frame
+	UINT characters;
+	UINT dropped;	 // lines and characters that didn't fit in the frame's buffers
+};
+
+// immediate mode lines and text for debugging, from any thread. every thread records into its own buffers, once a
+// frame Render() gathers them and draws all the lines in one call and all the text in another, then starts over
+// StrangeEngine renders it at the end of DrawScene. anything recorded after that shows up the frame after
+class STRANGEENGINEMK3_API DebugDraw
+{
+public:
+	static DebugDraw* Get();
+
+	// null 'device' keeps everything in system memory and Render() only gathers (tools, benchmarks, headless runs)
+	bool CreateRenderer(ID3D11Device* device);
+	void ReleaseRenderer();
+
+	// off, the calls below return straight away, so they can stay in shipping code
+	void SetEnabled(bool enabled) { mEnabled.store(enabled, std::memory_order_relaxed); }
+	bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+	// lines are drawn through this, the game sets it whenever its camera moves
+	void SetViewProjection(const XMFLOAT4X4& viewProjection);
+
+	void AddLine(const XMFLOAT3& from, const XMFLOAT3& to, UINT color);
+	void AddBox(const Aabb& box, UINT color);
+	// three rings, one around each axis
+	void AddSphere(const Sphere& sphere, UINT color);
+	// the twelve edges between the corners the six planes meet at
+	void AddFrustum(const Frustum& frustum, UINT color);
+	// at a pixel position from the top left, '\n' starts a new line. 'scale' times the font's 6x10 pixel cell
+	void AddText(float x, float y, const char* text, UINT color, float scale = 2.0f);
+
+	// frame time, the system scheduler's timings and every telemetry counter, top left of the screen
+	// StrangeEngine adds it every frame while it is visible
+	void SetStatsVisible(bool visible) { mStatsVisible = visible; }
+	bool IsStatsVisible() const { return mStatsVisible; }
+	void AddStatsOverlay(float x, float y);
+
+	// takes everything every thread has recorded since the last call, GetLines()/GetText() have it afterwards
+	void Collect();
+	const std::vector<DebugLineVertex>& GetLines() const { return mLines; }
+	const std::vector<DebugTextVertex>& GetText() const { return mText; }
+
+	// collects and draws, 'width' and 'height' are the render target's. null 'context' only collects
+	void Render(RenderContext* context, UINT width, UINT height);
+	DebugDrawStats GetStats() const { return mStats; }
+
+private:
+	DebugDraw();
+	~DebugDraw();
+
+	// what one thread has recorded, its own mutex is only ever contended while Collect() empties it
+	struct ThreadBuffer
+	{
+		std::mutex					 mutex;
+		std::vector<DebugLineVertex> lines;
+		std::vector<DebugTextVertex> text;
+		std::atomic<bool>			 inUse; // a thread that has exited leaves its buffer for the next new one
+	};
+
+	ThreadBuffer* GetThreadBuffer();
+	bool CreateShaders(ID3D11Device* device);
+	bool CreateFontTexture(ID3D11Device* device);
+	void RenderLines(RenderContext* context);
+	void RenderText(RenderContext* context, UINT width, UINT height);
+
+	static DebugDraw* singleton;
+	friend struct DebugThreadSlot;
+
+	std::atomic<bool> mEnabled;
+	bool			  mStatsVisible;
+	float			  mAverageFrameMs; // smoothed for the overlay, a raw frame time is unreadable
+
+	std::mutex								   mMutex; // mThreadBuffers and mViewProjection
+	std::vector<std::unique_ptr<ThreadBuffer>> mThreadBuffers;
+	XMFLOAT4X4								   mViewProjection;
+
+	// the last Collect()
+	std::vector<DebugLineVertex> mLines;
+	std::vector<DebugTextVertex> mText;
+	DebugDrawStats				 mStats;
+
+	TransientVertexBuffer	  mLineBuffer;
+	TransientVertexBuffer	  mTextBuffer;
+	ID3D11Buffer*			  mConstants;
+	ID3D11VertexShader*		  mLineVertexShader;
+	ID3D11PixelShader*		  mLinePixelShader;
+	ID3D11InputLayout*		  mLineLayout;
+	ID3D11VertexShader*		  mTextVertexShader;
+	ID3D11PixelShader*		  mTextPixelShader;
+	ID3D11InputLayout*		  mTextLayout;
+	ID3D11Texture2D*		  mFontTexture;
+	ID3D11ShaderResourceView* mFontView;
+	ID3D11SamplerState*		  mFontSampler;
+	ID3D11BlendState*		  mBlendState;
+	ID3D11DepthStencilState*  mTextDepthState; // text is on top of everything
+};
@@ -0,0 +1,698 @@
+#include "pch.h"
+#include "ECS.h"
+#include "Log.h"
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <mutex>
+#include <string>
+
+// a command buffer's placeholder entities use this generation, real entities never get it
+static const UINT kPendingGeneration = 0xFFFFFFFF;
+
+// payload pages for the command buffers
+static const size_t kCommandPageSize = 64 * 1024;
+
+// the command buffer a thread has in each world it has asked for one from, by the world's serial
+struct ThreadCommandBuffer
+{
+	UINT64				 world;
+	EntityCommandBuffer* commands;
+};
+static thread_local std::vector<ThreadCommandBuffer> tCommandBuffers;
+static std::atomic<UINT64> gNextWorldSerial(1);
+
+// serials of the worlds that still exist, so a thread can drop the entries it has for ones that are gone
+static std::mutex gLiveWorldsLock;
+static std::vector<UINT64> gLiveWorlds;
+
+// component arrays start on at least a 16 byte boundary so SSE loads line up
+static const UINT kMinimumArrayAlignment = 16;
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static void Relocate(const ComponentInfo& info, void* target, void* source)
+{
+	if (info.trivial)
+		memcpy(target, source, info.size);
+	else
+	{
+		info.moveConstruct(target, source);
+		info.destroy(source);
+	}
+}
+
+
+// ==============================================================
+//		component registry
+// ==============================================================
+
+static ComponentInfo gComponents[ECS_MAX_COMPONENTS];
+static std::string	 gComponentNames[ECS_MAX_COMPONENTS]; // our own copy, the name may belong to a module that gets unloaded
+static UINT			 gComponentCount = 0;
+static std::mutex	 gComponentMutex;
+
+ComponentId RegisterComponent(const ComponentInfo& info)
+{
+	std::lock_guard<std::mutex> lock(gComponentMutex);
+	for (UINT i = 0; i < gComponentCount; i++)
+	{
+		if (gComponentNames[i] == info.name)
+			return i;
+	}
+
+	if (gComponentCount == ECS_MAX_COMPONENTS)
+	{
+		LOG_ERROR(LogCategory_Engine, "Too many component types, raise ECS_MAX_COMPONENTS ({})", info.name);
+
+		MessageBoxA(nullptr, "Too many component types, raise ECS_MAX_COMPONENTS", nullptr, MB_OK);
+		abort();
+	}
+
+	gComponentNames[gComponentCount] = info.name;
+	gComponents[gComponentCount] = info;
+	gComponents[gComponentCount].name = gComponentNames[gComponentCount].c_str();
+	return gComponentCount++;
+}
+
+const ComponentInfo& GetComponentInfo(ComponentId id)
+{
+	return gComponents[id];
+}
+
+bool FindComponent(const char* name, ComponentId* id)
+{
+	std::lock_guard<std::mutex> lock(gComponentMutex);
+	for (UINT i = 0; i < gComponentCount; i++)
+	{
+		if (gComponentNames[i] == name)
+		{
+			*id = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// ==============================================================
+//		EntityCommandBuffer
+// ==============================================================
+
+EntityCommandBuffer::EntityCommandBuffer()
+{
+	mPageUsed = 0;
+	mPendingCount = 0;
+}
+
+EntityCommandBuffer::~EntityCommandBuffer()
+{
+	Clear();
+	for (BYTE* page : mPages)
+		_aligned_free(page);
+}
+
+Entity EntityCommandBuffer::Create()
+{
+	Entity placeholder = { mPendingCount++, kPendingGeneration };
+	Push(Command_Create, placeholder, 0, 0, 1);
+	return placeholder;
+}
+
+void EntityCommandBuffer::Destroy(Entity entity)
+{
+	Push(Command_Destroy, entity, 0, 0, 1);
+}
+
+void* EntityCommandBuffer::Push(CommandType type, Entity entity, ComponentId component, size_t size, size_t alignment)
+{
+	void* payload = nullptr;
+	if (size > 0)
+	{
+		size_t offset = AlignUp(mPageUsed, alignment);
+		if (mPages.empty() || offset + size > mPageSizes.back())
+		{
+			// pages are 64 byte aligned, which covers any component's alignment
+			size_t pageSize = std::max(kCommandPageSize, size);
+			mPages.push_back((BYTE*)_aligned_malloc(pageSize, 64));
+			mPageSizes.push_back(pageSize);
+			offset = 0;
+		}
+		payload = mPages.back() + offset;
+		mPageUsed = offset + size;
+	}
+
+	Command command = { type, entity, component, payload };
+	mCommands.push_back(command);
+	return payload;
+}
+
+void EntityCommandBuffer::Playback(EntityWorld* world)
+{
+	std::vector<Entity> created(mPendingCount);
+	for (const Command& command : mCommands)
+	{
+		Entity entity = command.entity;
+		if (entity.generation == kPendingGeneration && command.type != Command_Create)
+			entity = created[entity.index];
+
+		switch (command.type)
+		{
+		case Command_Create:
+			created[entity.index] = world->Create();
+			break;
+		case Command_Destroy:
+			world->Destroy(entity);
+			break;
+		case Command_Add:
+		{
+			world->AddComponent(entity, command.component, command.payload);
+			const ComponentInfo& info = GetComponentInfo(command.component);
+			if (!info.trivial)
+				info.destroy(command.payload);
+			break;
+		}
+		case Command_Remove:
+			world->RemoveComponent(entity, command.component);
+			break;
+		}
+	}
+
+	mCommands.clear();
+	Clear();
+}
+
+void EntityCommandBuffer::Clear()
+{
+	for (const Command& command : mCommands)
+	{
+		if (command.type != Command_Add)
+			continue;
+		const ComponentInfo& info = GetComponentInfo(command.component);
+		if (!info.trivial)
+			info.destroy(command.payload);
+	}
+	mCommands.clear();
+	mPendingCount = 0;
+
+	// keep one page around for next frame's commands
+	size_t keep = (!mPages.empty() && mPageSizes[0] == kCommandPageSize) ? 1 : 0;
+	for (size_t i = keep; i < mPages.size(); i++)
+		_aligned_free(mPages[i]);
+	mPages.resize(keep);
+	mPageSizes.resize(keep);
+	mPageUsed = 0;
+}
+
+
+// ==============================================================
+//		EntityWorld
+// ==============================================================
+
+EntityWorld::EntityWorld()
+{
+	mEntityCount = 0;
+
+	// archetype 0 has no components, Create() with nothing starts there
+	GetArchetype(ComponentMask());
+
+	mSerial = gNextWorldSerial.fetch_add(1);
+	std::lock_guard<std::mutex> lock(gLiveWorldsLock);
+	gLiveWorlds.push_back(mSerial);
+}
+
+EntityWorld::~EntityWorld()
+{
+	{
+		std::lock_guard<std::mutex> lock(gLiveWorldsLock);
+		gLiveWorlds.erase(std::find(gLiveWorlds.begin(), gLiveWorlds.end(), mSerial));
+	}
+
+	for (const auto& commands : mCommandBuffers)
+		delete commands.second;
+
+	for (Archetype* archetype : mArchetypes)
+	{
+		for (EntityChunk& chunk : archetype->chunks)
+		{
+			for (UINT column = 0; column < archetype->components.size(); column++)
+			{
+				const ComponentInfo& info = GetComponentInfo(archetype->components[column]);
+				if (info.trivial)
+					continue;
+				for (UINT row = 0; row < chunk.count; row++)
+					info.destroy(chunk.data + archetype->offsets[column] + (size_t)row * info.size);
+			}
+			FreeChunk(chunk.data, archetype->chunkBytes);
+		}
+		delete archetype;
+	}
+
+	for (BYTE* chunk : mFreeChunks)
+		_aligned_free(chunk);
+}
+
+Entity EntityWorld::Create()
+{
+	return CreateWith(nullptr, nullptr, 0);
+}
+
+Entity EntityWorld::CreateWith(const ComponentId* ids, void* const* values, UINT count)
+{
+	ComponentMask mask;
+	for (UINT i = 0; i < count; i++)
+		mask.Set(ids[i]);
+
+	UINT archetypeIndex = GetArchetype(mask);
+	Entity entity = AllocateEntity();
+	EntityRecord& record = mEntities[entity.index];
+	record.archetype = archetypeIndex;
+	AllocateRow(archetypeIndex, entity, &record.chunk, &record.row);
+
+	Archetype* archetype = mArchetypes[archetypeIndex];
+	BYTE* data = archetype->chunks[record.chunk].data;
+	for (UINT column = 0; column < archetype->components.size(); column++)
+	{
+		ComponentId id = archetype->components[column];
+		const ComponentInfo& info = GetComponentInfo(id);
+		BYTE* target = data + archetype->offsets[column] + (size_t)record.row * info.size;
+
+		void* value = nullptr;
+		for (UINT i = 0; i < count && value == nullptr; i++)
+		{
+			if (ids[i] == id)
+				value = values[i];
+		}
+
+		if (value == nullptr)
+			info.construct(target);
+		else if (info.trivial)
+			memcpy(target, value, info.size);
+		else
+			info.moveConstruct(target, value);
+	}
+	return entity;
+}
+
+void EntityWorld::Destroy(Entity entity)
+{
+	if (Resolve(entity) == nullptr)
+		return;
+
+	EntityRecord& record = mEntities[entity.index];
+	Archetype* archetype = mArchetypes[record.archetype];
+	BYTE* data = archetype->chunks[record.chunk].data;
+	for (UINT column = 0; column < archetype->components.size(); column++)
+	{
+		const ComponentInfo& info = GetComponentInfo(archetype->components[column]);
+		if (!info.trivial)
+			info.destroy(data + archetype->offsets[column] + (size_t)record.row * info.size);
+	}
+	FreeRow(record.archetype, record.chunk, record.row);
+
+	// old handles to this entity stop resolving
+	record.alive = false;
+	if (++record.generation == 0 || record.generation == kPendingGeneration)
+		record.generation = 1;
+	mFreeEntities.push_back(entity.index);
+	mEntityCount--;
+}
+
+bool EntityWorld::IsAlive(Entity entity) const
+{
+	return Resolve(entity) != nullptr;
+}
+
+void* EntityWorld::GetComponent(Entity entity, ComponentId id)
+{
+	const EntityRecord* record = Resolve(entity);
+	if (record == nullptr)
+		return nullptr;
+
+	const Archetype* archetype = mArchetypes[record->archetype];
+	int column = archetype->GetColumn(id);
+	if (column < 0)
+		return nullptr;
+	return archetype->chunks[record->chunk].data + archetype->offsets[column] + (size_t)record->row * GetComponentInfo(id).size;
+}
+
+bool EntityWorld::HasComponent(Entity entity, ComponentId id) const
+{
+	const EntityRecord* record = Resolve(entity);
+	return record && mArchetypes[record->archetype]->GetColumn(id) >= 0;
+}
+
+void EntityWorld::AddComponent(Entity entity, ComponentId id, void* value)
+{
+	const EntityRecord* record = Resolve(entity);
+	if (record == nullptr)
+		return;
+
+	// already there, just replace the value
+	void* existing = GetComponent(entity, id);
+	if (existing)
+	{
+		const ComponentInfo& info = GetComponentInfo(id);
+		if (info.trivial)
+		{
+			if (value)
+				memcpy(existing, value, info.size);
+		}
+		else
+		{
+			info.destroy(existing);
+			if (value)
+				info.moveConstruct(existing, value);
+			else
+				info.construct(existing);
+		}
+		return;
+	}
+
+	MoveEntity(entity, GetArchetypeWith(record->archetype, id), id, value);
+}
+
+void EntityWorld::RemoveComponent(Entity entity, ComponentId id)
+{
+	const EntityRecord* record = Resolve(entity);
+	if (record == nullptr || mArchetypes[record->archetype]->GetColumn(id) < 0)
+		return;
+
+	MoveEntity(entity, GetArchetypeWithout(record->archetype, id), ECS_MAX_COMPONENTS, nullptr);
+}
+
+EntityCommandBuffer& EntityWorld::GetCommands()
+{
+	// a world's serial is never reused, so entries left behind by worlds that are gone never match
+	for (const ThreadCommandBuffer& buffer : tCommandBuffers)
+	{
+		if (buffer.world == mSerial)
+			return *buffer.commands;
+	}
+
+	// first time in this world, a good moment to forget the worlds that were destroyed since. their buffers went with them
+	{
+		std::lock_guard<std::mutex> lock(gLiveWorldsLock);
+		tCommandBuffers.erase(std::remove_if(tCommandBuffers.begin(), tCommandBuffers.end(), [](const ThreadCommandBuffer& buffer)
+		{
+			return std::find(gLiveWorlds.begin(), gLiveWorlds.end(), buffer.world) == gLiveWorlds.end();
+		}), tCommandBuffers.end());
+	}
+
+	EntityCommandBuffer* commands = new EntityCommandBuffer();
+	{
+		std::lock_guard<std::mutex> lock(mCommandLock);
+		mCommandBuffers.push_back(std::make_pair(JobSystem::GetThreadIndex(), commands));
+	}
+	ThreadCommandBuffer buffer;
+	buffer.world = mSerial;
+	buffer.commands = commands;
+	tCommandBuffers.push_back(buffer);
+	return *commands;
+}
+
+void EntityWorld::PlaybackCommands()
+{
+	std::vector<std::pair<unsigned int, EntityCommandBuffer*>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(mCommandLock);
+		std::stable_sort(mCommandBuffers.begin(), mCommandBuffers.end(),
+			[](const std::pair<unsigned int, EntityCommandBuffer*>& a, const std::pair<unsigned int, EntityCommandBuffer*>& b) { return a.first < b.first; });
+		buffers = mCommandBuffers;
+	}
+	for (const auto& commands : buffers)
+		commands.second->Playback(this);
+}
+
+void EntityWorld::Clear()
+{
+	for (Archetype* archetype : mArchetypes)
+	{
+		for (EntityChunk& chunk : archetype->chunks)
+		{
+			for (UINT column = 0; column < archetype->components.size(); column++)
+			{
+				const ComponentInfo& info = GetComponentInfo(archetype->components[column]);
+				if (info.trivial)
+					continue;
+				for (UINT row = 0; row < chunk.count; row++)
+					info.destroy(chunk.data + archetype->offsets[column] + (size_t)row * info.size);
+			}
+			FreeChunk(chunk.data, archetype->chunkBytes);
+		}
+		archetype->chunks.clear();
+		archetype->entityCount = 0;
+	}
+
+	// handles from before stop resolving, every record is dead until something reuses it
+	for (UINT i = 0; i < mEntities.size(); i++)
+	{
+		if (!mEntities[i].alive)
+			continue;
+		mEntities[i].alive = false;
+		if (++mEntities[i].generation == 0 || mEntities[i].generation == kPendingGeneration)
+			mEntities[i].generation = 1;
+		mFreeEntities.push_back(i);
+	}
+	mEntityCount = 0;
+}
+
+UINT EntityWorld::GetChunkCount() const
+{
+	UINT count = 0;
+	for (const Archetype* archetype : mArchetypes)
+		count += (UINT)archetype->chunks.size();
+	return count;
+}
+
+const EntityWorld::EntityRecord* EntityWorld::Resolve(Entity entity) const
+{
+	if (entity.index >= mEntities.size() || !mEntities[entity.index].alive || mEntities[entity.index].generation != entity.generation)
+		return nullptr;
+	return &mEntities[entity.index];
+}
+
+Entity EntityWorld::AllocateEntity()
+{
+	UINT index;
+	if (!mFreeEntities.empty())
+	{
+		index = mFreeEntities.back();
+		mFreeEntities.pop_back();
+	}
+	else
+	{
+		index = (UINT)mEntities.size();
+		EntityRecord record = { 0, 0, 0, 1, false };
+		mEntities.push_back(record);
+	}
+
+	mEntities[index].alive = true;
+	mEntityCount++;
+	Entity entity = { index, mEntities[index].generation };
+	return entity;
+}
+
+// the bytes a chunk needs for 'capacity' entities, filling in where each component's array starts
+static size_t LayoutChunk(const std::vector<ComponentId>& components, UINT capacity, std::vector<UINT>* offsets)
+{
+	size_t offset = sizeof(Entity) * capacity;
+	for (UINT column = 0; column < components.size(); column++)
+	{
+		const ComponentInfo& info = GetComponentInfo(components[column]);
+		offset = AlignUp(offset, std::max(info.alignment, kMinimumArrayAlignment));
+		(*offsets)[column] = (UINT)offset;
+		offset += (size_t)info.size * capacity;
+	}
+	return offset;
+}
+
+UINT EntityWorld::GetArchetype(const ComponentMask& mask)
+{
+	auto found = mArchetypeLookup.find(mask);
+	if (found != mArchetypeLookup.end())
+		return found->second;
+
+	Archetype* archetype = new Archetype();
+	archetype->mask = mask;
+	for (ComponentId id = 0; id < ECS_MAX_COMPONENTS; id++)
+	{
+		if (mask.Has(id))
+			archetype->components.push_back(id);
+	}
+
+	archetype->columns.assign(archetype->components.empty() ? 0 : archetype->components.back() + 1, -1);
+	for (UINT column = 0; column < archetype->components.size(); column++)
+		archetype->columns[archetype->components[column]] = (int)column;
+
+	// as many entities as fit in a chunk once every array has been aligned
+	size_t bytesPerEntity = sizeof(Entity);
+	for (ComponentId id : archetype->components)
+		bytesPerEntity += GetComponentInfo(id).size;
+
+	archetype->offsets.resize(archetype->components.size());
+	UINT capacity = (UINT)(ECS_CHUNK_SIZE / bytesPerEntity);
+	while (capacity > 1 && LayoutChunk(archetype->components, capacity, &archetype->offsets) > ECS_CHUNK_SIZE)
+		capacity--;
+
+	// an entity bigger than a chunk gets a chunk of its own size
+	capacity = std::max(1u, capacity);
+	archetype->capacity = capacity;
+	archetype->chunkBytes = (UINT)std::max<size_t>(ECS_CHUNK_SIZE, AlignUp(LayoutChunk(archetype->components, capacity, &archetype->offsets), 64));
+	archetype->entityCount = 0;
+
+	UINT index = (UINT)mArchetypes.size();
+	mArchetypes.push_back(archetype);
+	mArchetypeLookup[mask] = index;
+	return index;
+}
+
+UINT EntityWorld::GetArchetypeWith(UINT from, ComponentId id)
+{
+	auto edge = mArchetypes[from]->addEdges.find(id);
+	if (edge != mArchetypes[from]->addEdges.end())
+		return edge->second;
+
+	ComponentMask mask = mArchetypes[from]->mask;
+	mask.Set(id);
+	UINT to = GetArchetype(mask);
+	mArchetypes[from]->addEdges[id] = to;
+	mArchetypes[to]->removeEdges[id] = from;
+	return to;
+}
+
+UINT EntityWorld::GetArchetypeWithout(UINT from, ComponentId id)
+{
+	auto edge = mArchetypes[from]->removeEdges.find(id);
+	if (edge != mArchetypes[from]->removeEdges.end())
+		return edge->second;
+
+	ComponentMask mask = mArchetypes[from]->mask;
+	mask.Clear(id);
+	UINT to = GetArchetype(mask);
+	mArchetypes[from]->removeEdges[id] = to;
+	mArchetypes[to]->addEdges[id] = from;
+	return to;
+}
+
+void EntityWorld::AllocateRow(UINT archetypeIndex, Entity entity, UINT* chunk, UINT* row)
+{
+	Archetype* archetype = mArchetypes[archetypeIndex];
+	if (archetype->chunks.empty() || archetype->chunks.back().count == archetype->capacity)
+	{
+		EntityChunk fresh = { AllocateChunk(archetype->chunkBytes), 0 };
+		archetype->chunks.push_back(fresh);
+	}
+
+	EntityChunk& last = archetype->chunks.back();
+	*chunk = (UINT)archetype->chunks.size() - 1;
+	*row = last.count++;
+	((Entity*)last.data)[*row] = entity;
+	archetype->entityCount++;
+}
+
+// the row's components have already been destroyed or moved out
+// the archetype's last entity moves into the hole, so chunks stay packed and only the last one is ever partly full
+void EntityWorld::FreeRow(UINT archetypeIndex, UINT chunk, UINT row)
+{
+	Archetype* archetype = mArchetypes[archetypeIndex];
+	UINT lastChunk = (UINT)archetype->chunks.size() - 1;
+	EntityChunk& last = archetype->chunks[lastChunk];
+	UINT lastRow = last.count - 1;
+
+	if (chunk != lastChunk || row != lastRow)
+	{
+		EntityChunk& hole = archetype->chunks[chunk];
+		Entity moved = ((Entity*)last.data)[lastRow];
+		((Entity*)hole.data)[row] = moved;
+		for (UINT column = 0; column < archetype->components.size(); column++)
+		{
+			const ComponentInfo& info = GetComponentInfo(archetype->components[column]);
+			UINT offset = archetype->offsets[column];
+			Relocate(info, hole.data + offset + (size_t)row * info.size, last.data + offset + (size_t)lastRow * info.size);
+		}
+		mEntities[moved.index].chunk = chunk;
+		mEntities[moved.index].row = row;
+	}
+
+	last.count--;
+	archetype->entityCount--;
+	if (last.count == 0)
+	{
+		FreeChunk(last.data, archetype->chunkBytes);
+		archetype->chunks.pop_back();
+	}
+}
+
+// 'newComponent' is constructed from 'newValue' (moved from) if the destination has it and the source doesn't,
+// components the destination doesn't have are destroyed
+void EntityWorld::MoveEntity(Entity entity, UINT to, ComponentId newComponent, void* newValue)
+{
+	EntityRecord& record = mEntities[entity.index];
+	UINT from = record.archetype;
+	UINT fromChunk = record.chunk;
+	UINT fromRow = record.row;
+
+	UINT toChunk, toRow;
+	AllocateRow(to, entity, &toChunk, &toRow);
+
+	Archetype* source = mArchetypes[from];
+	Archetype* destination = mArchetypes[to];
+	BYTE* sourceData = source->chunks[fromChunk].data;
+	BYTE* destinationData = destination->chunks[toChunk].data;
+
+	for (UINT column = 0; column < destination->components.size(); column++)
+	{
+		ComponentId id = destination->components[column];
+		const ComponentInfo& info = GetComponentInfo(id);
+		BYTE* target = destinationData + destination->offsets[column] + (size_t)toRow * info.size;
+
+		int sourceColumn = source->GetColumn(id);
+		if (sourceColumn >= 0)
+			Relocate(info, target, sourceData + source->offsets[sourceColumn] + (size_t)fromRow * info.size);
+		else if (id == newComponent && newValue != nullptr)
+		{
+			if (info.trivial)
+				memcpy(target, newValue, info.size);
+			else
+				info.moveConstruct(target, newValue);
+		}
+		else
+			info.construct(target);
+	}
+
+	for (UINT column = 0; column < source->components.size(); column++)
+	{
+		ComponentId id = source->components[column];
+		const ComponentInfo& info = GetComponentInfo(id);
+		if (!info.trivial && destination->GetColumn(id) < 0)
+			info.destroy(sourceData + source->offsets[column] + (size_t)fromRow * info.size);
+	}
+
+	FreeRow(from, fromChunk, fromRow);
+	record.archetype = to;
+	record.chunk = toChunk;
+	record.row = toRow;
+}
+
+BYTE* EntityWorld::AllocateChunk(UINT bytes)
+{
+	if (bytes == ECS_CHUNK_SIZE && !mFreeChunks.empty())
+	{
+		BYTE* chunk = mFreeChunks.back();
+		mFreeChunks.pop_back();
+		return chunk;
+	}
+	return (BYTE*)_aligned_malloc(bytes, 64);
+}
+
+void EntityWorld::FreeChunk(BYTE* data, UINT bytes)
+{
+	if (bytes == ECS_CHUNK_SIZE)
+		mFreeChunks.push_back(data);
+	else
+		_aligned_free(data);
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "JobSystem.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		entity component system
+// ==============================================================
+//
+// entities with the same set of components share an archetype. an archetype keeps its entities in 16KB chunks,
+// and inside a chunk every component has its own tightly packed array (SoA), so a query walks memory front to back
+// adding or removing a component moves the entity to another archetype, which is why those structural changes
+// have to go through a command buffer while anything is iterating
+
+#define ECS_CHUNK_SIZE (16 * 1024)
+#define ECS_MAX_COMPONENTS 128
+
+typedef UINT ComponentId;
+
+// index + generation, a handle to a destroyed entity stops being valid instead of pointing at whatever reused the slot
+struct Entity
+{
+	UINT index;
+	UINT generation; // 0 is never used, so a zeroed handle is invalid
+
+	bool IsValid() const { return generation != 0; }
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+struct ComponentInfo
+{
+	const char* name;
+	UINT		size;
+	UINT		alignment;
+	bool		trivial; // can be moved with memcpy and needs no destructor
+	void (*construct)(void* target);
+	void (*moveConstruct)(void* target, void* source); // the source is left to be destroyed
+	void (*destroy)(void* target);
+};
+
+// ids are handed out by name so a type gets the same id in the engine and in the game, either side of the DLL
+// more than ECS_MAX_COMPONENTS types is a programming error and stops the program
+STRANGEENGINEMK3_API ComponentId RegisterComponent(const ComponentInfo& info);
+STRANGEENGINEMK3_API const ComponentInfo& GetComponentInfo(ComponentId id);
+// the id a name was registered under, false if nothing has been registered with it yet
+STRANGEENGINEMK3_API bool FindComponent(const char* name, ComponentId* id);
+
+template<typename T> struct ComponentFunctions
+{
+	static void Construct(void* target) { new (target) T(); }
+	static void MoveConstruct(void* target, void* source) { new (target) T(std::move(*(T*)source)); }
+	static void Destroy(void* target) { ((T*)target)->~T(); }
+};
+
+template<typename T> struct ComponentType
+{
+	static ComponentId GetId()
+	{
+		static const ComponentId id = RegisterComponent({ typeid(T).name(), (UINT)sizeof(T), (UINT)alignof(T),
+			std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+			&ComponentFunctions<T>::Construct, &ComponentFunctions<T>::MoveConstruct, &ComponentFunctions<T>::Destroy });
+		return id;
+	}
+};
+
+// const T is the same component as T, queries use it for components they only read
+template<typename T> ComponentId GetComponentId()
+{
+	return ComponentType<typename std::remove_const<T>::type>::GetId();
+}
+
+struct ComponentMask
+{
+	UINT64 bits[ECS_MAX_COMPONENTS / 64];
+
+	ComponentMask() { memset(bits, 0, sizeof(bits)); }
+
+	void Set(ComponentId id)   { bits[id / 64] |= 1ull << (id % 64); }
+	void Clear(ComponentId id) { bits[id / 64] &= ~(1ull << (id % 64)); }
+	bool Has(ComponentId id) const { return (bits[id / 64] & (1ull << (id % 64))) != 0; }
+
+	// every component in 'other' is also in this mask
+	bool Contains(const ComponentMask& other) const
+	{
+		for (UINT i = 0; i < ECS_MAX_COMPONENTS / 64; i++)
+		{
+			if ((bits[i] & other.bits[i]) != other.bits[i])
+				return false;
+		}
+		return true;
+	}
+
+	bool operator==(const ComponentMask& other) const { return memcmp(bits, other.bits, sizeof(bits)) == 0; }
+};
+
+struct ComponentMaskHash
+{
+	size_t operator()(const ComponentMask& mask) const
+	{
+		UINT64 hash = 0;
+		for (UINT i = 0; i < ECS_MAX_COMPONENTS / 64; i++)
+			hash = (hash ^ mask.bits[i]) * 0x9E3779B97F4A7C15ull;
+		return (size_t)(hash ^ (hash >> 32));
+	}
+};
+
+struct EntityChunk
+{
+	BYTE* data;	 // the entity array first, then one array per component
+	UINT  count; // live entities, always the first 'count' rows
+};
+
+struct Archetype
+{
+	ComponentMask			 mask;
+	std::vector<ComponentId> components; // sorted
+	std::vector<UINT>		 offsets;	 // where each component's array starts in a chunk
+	std::vector<int>		 columns;	 // component id -> index into 'components', -1 if it isn't here
+	UINT					 capacity;	 // entities per chunk
+	UINT					 chunkBytes; // ECS_CHUNK_SIZE unless a single entity doesn't fit
+	UINT					 entityCount;
+	std::vector<EntityChunk> chunks;	 // every chunk is full apart from the last one
+
+	// the archetype you get by adding or removing one component, filled in as they're found
+	std::unordered_map<ComponentId, UINT> addEdges;
+	std::unordered_map<ComponentId, UINT> removeEdges;
+
+	int GetColumn(ComponentId id) const { return id < columns.size() ? columns[id] : -1; }
+};
+
+class EntityWorld;
+
+// records creates, destroys and component adds/removes to apply later with Playback()
+// one per thread, so jobs iterating a world in parallel can queue changes without locking (see EntityWorld::GetCommands)
+class STRANGEENGINEMK3_API EntityCommandBuffer
+{
+public:
+	EntityCommandBuffer();
+	~EntityCommandBuffer();
+
+	// a placeholder the other commands in this buffer can use, it becomes a real entity on playback
+	Entity Create();
+	void   Destroy(Entity entity);
+
+	// adding a component the entity already has replaces its value
+	template<typename T> void Add(Entity entity, T value)
+	{
+		void* payload = Push(Command_Add, entity, GetComponentId<T>(), sizeof(T), alignof(T));
+		new (payload) T(std::move(value));
+	}
+
+	template<typename T> void Remove(Entity entity)
+	{
+		Push(Command_Remove, entity, GetComponentId<T>(), 0, 1);
+	}
+
+	// applies the commands in the order they were recorded and empties the buffer
+	// commands for entities that have been destroyed in the meantime are skipped
+	void Playback(EntityWorld* world);
+
+	// throws the commands away without applying them
+	void Clear();
+
+	bool IsEmpty() const { return mCommands.empty(); }
+
+private:
+	EntityCommandBuffer(const EntityCommandBuffer&);
+	EntityCommandBuffer& operator=(const EntityCommandBuffer&);
+
+	enum CommandType
+	{
+		Command_Create,
+		Command_Destroy,
+		Command_Add,
+		Command_Remove,
+	};
+
+	struct Command
+	{
+		CommandType type;
+		Entity		entity;
+		ComponentId component;
+		void*		payload; // the component value for adds, it lives in mPages so it never moves
+	};
+
+	void* Push(CommandType type, Entity entity, ComponentId component, size_t size, size_t alignment);
+
+	std::vector<Command> mCommands;
+	std::vector<BYTE*>	 mPages; // payload storage, 64KB each unless a payload is bigger
+	std::vector<size_t>	 mPageSizes;
+	size_t				 mPageUsed; // bytes used in the last page
+	UINT				 mPendingCount;
+};
+
+// a set of entities and their components
+class STRANGEENGINEMK3_API EntityWorld
+{
+public:
+	EntityWorld();
+	~EntityWorld();
+
+	Entity Create();
+
+	template<typename... Ts> Entity Create(Ts... components)
+	{
+		const ComponentId ids[sizeof...(Ts) + 1] = { GetComponentId<Ts>()... };
+		void* values[] = { (void*)&components... };
+		return CreateWith(ids, values, (UINT)sizeof...(Ts));
+	}
+
+	void Destroy(Entity entity);
+	bool IsAlive(Entity entity) const;
+
+	// nullptr if the entity is dead or doesn't have one. only valid until the entity's components change
+	template<typename T> T* Get(Entity entity) { return (T*)GetComponent(entity, GetComponentId<T>()); }
+	template<typename T> bool Has(Entity entity) const { return HasComponent(entity, GetComponentId<T>()); }
+
+	// adding a component the entity already has replaces its value
+	template<typename T> void Add(Entity entity, T value) { AddComponent(entity, GetComponentId<T>(), &value); }
+	template<typename T> void Remove(Entity entity) { RemoveComponent(entity, GetComponentId<T>()); }
+
+	// fn(Entity, Ts&...) for every entity that has all of Ts
+	template<typename... Ts, typename Fn> void Each(Fn fn)
+	{
+		const ComponentId ids[sizeof...(Ts) + 1] = { GetComponentId<Ts>()... };
+		for (Archetype* archetype : mArchetypes)
+		{
+			UINT offsets[sizeof...(Ts) + 1];
+			if (!MatchArchetype(archetype, ids, (UINT)sizeof...(Ts), offsets))
+				continue;
+			for (const EntityChunk& chunk : archetype->chunks)
+				EachInChunk<Ts...>(chunk.data, chunk.count, offsets, fn, std::index_sequence_for<Ts...>());
+		}
+	}
+
+	// fn(UINT count, const Entity* entities, Ts*... arrays) once per chunk, for loops the compiler can vectorise
+	template<typename... Ts, typename Fn> void EachChunk(Fn fn)
+	{
+		const ComponentId ids[sizeof...(Ts) + 1] = { GetComponentId<Ts>()... };
+		for (Archetype* archetype : mArchetypes)
+		{
+			UINT offsets[sizeof...(Ts) + 1];
+			if (!MatchArchetype(archetype, ids, (UINT)sizeof...(Ts), offsets))
+				continue;
+			for (const EntityChunk& chunk : archetype->chunks)
+				CallForChunk<Ts...>(chunk.data, chunk.count, offsets, fn, std::index_sequence_for<Ts...>());
+		}
+	}
+
+	// Each() with the chunks spread over the job system, returns once every chunk is done
+	// the world can't change shape while this runs, queue structural changes with GetCommands() and play them back after
+	template<typename... Ts, typename Fn> void ParallelEach(Fn fn)
+	{
+		struct ChunkWork
+		{
+			BYTE* data;
+			UINT  count;
+			UINT  offsets[sizeof...(Ts) + 1];
+		};
+
+		const ComponentId ids[sizeof...(Ts) + 1] = { GetComponentId<Ts>()... };
+		std::vector<ChunkWork> work;
+		for (Archetype* archetype : mArchetypes)
+		{
+			ChunkWork item;
+			if (!MatchArchetype(archetype, ids, (UINT)sizeof...(Ts), item.offsets))
+				continue;
+			for (const EntityChunk& chunk : archetype->chunks)
+			{
+				item.data = chunk.data;
+				item.count = chunk.count;
+				work.push_back(item);
+			}
+		}
+
+		// a few batches per thread, so one slow batch doesn't leave the others idle
+		unsigned int threads = JobSystem::Get()->GetWorkerCount() + 1;
+		unsigned int grain = std::max(1u, (unsigned int)work.size() / (threads * 4));
+		JobSystem::Get()->ParallelFor((unsigned int)work.size(), grain, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+				EachInChunk<Ts...>(work[i].data, work[i].count, work[i].offsets, fn, std::index_sequence_for<Ts...>());
+		});
+	}
+
+	// entities that have all of Ts
+	template<typename... Ts> UINT Count()
+	{
+		const ComponentId ids[sizeof...(Ts) + 1] = { GetComponentId<Ts>()... };
+		UINT count = 0;
+		for (Archetype* archetype : mArchetypes)
+		{
+			UINT offsets[sizeof...(Ts) + 1];
+			if (MatchArchetype(archetype, ids, (UINT)sizeof...(Ts), offsets))
+				count += archetype->entityCount;
+		}
+		return count;
+	}
+
+	// the calling thread's command buffer, every thread gets its own the first time it asks
+	EntityCommandBuffer& GetCommands();
+
+	// plays back every thread's command buffer, by job system thread index (the main thread and any other thread that
+	// isn't a worker first). which entities a worker got to in ParallelEach changes from run to run, so the order
+	// commands from different threads land in does too
+	void PlaybackCommands();
+
+	// destroys every entity. the archetypes stay but lose their chunks, the memory of ECS_CHUNK_SIZE ones is kept for reuse
+	void Clear();
+
+	UINT GetEntityCount() const { return mEntityCount; }
+	UINT GetArchetypeCount() const { return (UINT)mArchetypes.size(); }
+	UINT GetChunkCount() const;
+
+	// the untyped versions the templates and the command buffers go through
+	// 'values' are moved from, a null value default constructs the component
+	Entity CreateWith(const ComponentId* ids, void* const* values, UINT count);
+	void*  GetComponent(Entity entity, ComponentId id);
+	bool   HasComponent(Entity entity, ComponentId id) const;
+	void   AddComponent(Entity entity, ComponentId id, void* value);
+	void   RemoveComponent(Entity entity, ComponentId id);
+
+private:
+	EntityWorld(const EntityWorld&);
+	EntityWorld& operator=(const EntityWorld&);
+
+	// snapshots copy chunks in and out whole
+	friend class WorldState;
+
+	struct EntityRecord
+	{
+		UINT archetype;
+		UINT chunk;
+		UINT row;
+		UINT generation;
+		bool alive;
+	};
+
+	// writes the chunk offset of each id's array, false if the archetype is empty or lacks one of them
+	static bool MatchArchetype(const Archetype* archetype, const ComponentId* ids, UINT count, UINT* offsets)
+	{
+		if (archetype->entityCount == 0)
+			return false;
+		for (UINT i = 0; i < count; i++)
+		{
+			int column = archetype->GetColumn(ids[i]);
+			if (column < 0)
+				return false;
+			offsets[i] = archetype->offsets[column];
+		}
+		return true;
+	}
+
+	template<typename... Ts, typename Fn, size_t... Is>
+	static void EachInChunk(BYTE* data, UINT count, const UINT* offsets, Fn& fn, std::index_sequence<Is...>)
+	{
+		const Entity* entities = (const Entity*)data;
+		for (UINT row = 0; row < count; row++)
+			fn(entities[row], ((Ts*)(data + offsets[Is]))[row]...);
+	}
+
+	template<typename... Ts, typename Fn, size_t... Is>
+	static void CallForChunk(BYTE* data, UINT count, const UINT* offsets, Fn& fn, std::index_sequence<Is...>)
+	{
+		fn(count, (const Entity*)data, (Ts*)(data + offsets[Is])...);
+	}
+
+	const EntityRecord* Resolve(Entity entity) const;
+	Entity AllocateEntity();
+	UINT   GetArchetype(const ComponentMask& mask);
+	UINT   GetArchetypeWith(UINT from, ComponentId id);
+	UINT   GetArchetypeWithout(UINT from, ComponentId id);
+	void   AllocateRow(UINT archetype, Entity entity, UINT* chunk, UINT* row);
+	void   FreeRow(UINT archetype, UINT chunk, UINT row);
+	void   MoveEntity(Entity entity, UINT to, ComponentId newComponent, void* newValue);
+	BYTE*  AllocateChunk(UINT bytes);
+	void   FreeChunk(BYTE* data, UINT bytes);
+
+	std::vector<Archetype*>									   mArchetypes;
+	std::unordered_map<ComponentMask, UINT, ComponentMaskHash> mArchetypeLookup;
+	std::vector<EntityRecord>								   mEntities;
+	std::vector<UINT>										   mFreeEntities;
+	UINT													   mEntityCount;
+	std::vector<BYTE*>										   mFreeChunks; // ECS_CHUNK_SIZE chunks kept for reuse
+	UINT64													   mSerial; // tells a thread's buffers for this world apart from a freed one's at the same address
+	std::mutex												   mCommandLock;
+	std::vector<std::pair<unsigned int, EntityCommandBuffer*>> mCommandBuffers; // thread index and buffer
+};
@@ -0,0 +1,17 @@
+#include "pch.h"
+#include "FileUtils.h"
+#include <algorithm>
+
+bool WriteFileBytes(HANDLE file, const void* data, size_t size)
+{
+	const BYTE* bytes = (const BYTE*)data;
+	for (size_t offset = 0; offset < size;)
+	{
+		DWORD chunk = (DWORD)std::min(size - offset, (size_t)1 << 30);
+		DWORD written = 0;
+		if (!WriteFile(file, bytes + offset, chunk, &written, nullptr) || written != chunk)
+			return false;
+		offset += chunk;
+	}
+	return true;
+}
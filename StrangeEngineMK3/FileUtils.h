@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Common.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// writes all of 'size' bytes to a file opened for writing, in pieces because WriteFile takes 32 bit sizes
+// false if any piece isn't written in full, the file is left however far it got
+STRANGEENGINEMK3_API bool WriteFileBytes(HANDLE file, const void* data, size_t size);
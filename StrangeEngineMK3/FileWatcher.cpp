@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "FileWatcher.h"
+#include "Log.h"
+
+FileWatcher::FileWatcher()
+{
+	mDirectory = INVALID_HANDLE_VALUE;
+	mStopEvent = nullptr;
+	mOverflowed = false;
+}
+
+FileWatcher::~FileWatcher()
+{
+	Stop();
+}
+
+bool FileWatcher::Start(const std::wstring& folder)
+{
+	Stop();
+
+	mDirectory = CreateFileW(folder.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+	if (mDirectory == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not watch folder {}", folder);
+		return false;
+	}
+
+	mStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	mOverflowed = false;
+	mThread = std::thread(&FileWatcher::WatchThreadLoop, this);
+	return true;
+}
+
+void FileWatcher::Stop()
+{
+	if (mDirectory == INVALID_HANDLE_VALUE)
+		return;
+
+	SetEvent(mStopEvent);
+	mThread.join();
+	CloseHandle(mStopEvent);
+	CloseHandle(mDirectory);
+	mStopEvent = nullptr;
+	mDirectory = INVALID_HANDLE_VALUE;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPending.clear();
+}
+
+void FileWatcher::GetChanges(std::vector<std::wstring>* relativePaths, bool* rescan, DWORD settleMs)
+{
+	relativePaths->clear();
+	ULONGLONG now = GetTickCount64();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto it = mPending.begin(); it != mPending.end();)
+	{
+		if (now - it->second >= settleMs)
+		{
+			relativePaths->push_back(it->first);
+			it = mPending.erase(it);
+		}
+		else
+			++it;
+	}
+
+	*rescan = mOverflowed;
+	mOverflowed = false;
+}
+
+void FileWatcher::WatchThreadLoop()
+{
+	// DWORD aligned, as ReadDirectoryChangesW wants. 64KB is the most it will fill over a network share
+	std::vector<DWORD> buffer(64 * 1024 / sizeof(DWORD));
+
+	OVERLAPPED overlapped = {};
+	overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	HANDLE events[2] = { overlapped.hEvent, mStopEvent };
+
+	const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+	for (;;)
+	{
+		ResetEvent(overlapped.hEvent);
+		if (!ReadDirectoryChangesW(mDirectory, buffer.data(), (DWORD)(buffer.size() * sizeof(DWORD)), TRUE, filter, nullptr, &overlapped, nullptr))
+		{
+			LOG_ERROR(LogCategory_Assets, "ReadDirectoryChangesW failed, the file watcher has stopped");
+			break;
+		}
+
+		if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+		{
+			// stopping, the read has to be finished with before the buffer and event go away
+			CancelIoEx(mDirectory, &overlapped);
+			DWORD ignored;
+			GetOverlappedResult(mDirectory, &overlapped, &ignored, TRUE);
+			break;
+		}
+
+		DWORD bytes = 0;
+		if (!GetOverlappedResult(mDirectory, &overlapped, &bytes, FALSE))
+			break;
+
+		ULONGLONG now = GetTickCount64();
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		// 0 bytes means more changed than fit in the buffer
+		if (bytes == 0)
+		{
+			mOverflowed = true;
+			continue;
+		}
+
+		const BYTE* cursor = (const BYTE*)buffer.data();
+		for (;;)
+		{
+			const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)cursor;
+
+			// deletes and the old half of a rename don't give us anything to cook
+			if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+				mPending[std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR))] = now;
+
+			if (info->NextEntryOffset == 0)
+				break;
+			cursor += info->NextEntryOffset;
+		}
+	}
+
+	CloseHandle(overlapped.hEvent);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Common.h"
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// watches a folder and everything under it for files being written, created or renamed into place
+// a background thread waits on ReadDirectoryChangesW, so nothing is polled
+class STRANGEENGINEMK3_API FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	bool Start(const std::wstring& folder);
+	void Stop();
+
+	bool IsRunning() const { return mDirectory != INVALID_HANDLE_VALUE; }
+
+	// paths (relative to the folder) that changed and have then been left alone for 'settleMs'
+	// saving a file is usually several writes, waiting for it to go quiet means it is only reported once
+	// 'rescan' is set when so much changed at once that some changes were lost, the whole folder should be checked
+	void GetChanges(std::vector<std::wstring>* relativePaths, bool* rescan, DWORD settleMs = 200);
+
+private:
+	void WatchThreadLoop();
+
+	HANDLE		mDirectory;
+	HANDLE		mStopEvent;
+	std::thread mThread;
+
+	std::mutex										mMutex;
+	std::unordered_map<std::wstring, ULONGLONG> mPending; // path -> GetTickCount64() of its last change
+	bool											mOverflowed;
+};
@@ -1,5 +1,12 @@
 #pragma once
-class GameTimer
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+class STRANGEENGINEMK3_API GameTimer
 {
 public:
 	GameTimer();
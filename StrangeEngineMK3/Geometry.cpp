@@ -0,0 +1,76 @@
+#include "pch.h"
+#include "Geometry.h"
+#include <cmath>
+#include <cfloat>
+
+static XMFLOAT3 Cross(const XMFLOAT4& a, const XMFLOAT4& b)
+{
+	return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// the point where three planes meet
+static XMFLOAT3 Intersect(const XMFLOAT4& p1, const XMFLOAT4& p2, const XMFLOAT4& p3)
+{
+	XMFLOAT3 c23 = Cross(p2, p3);
+	XMFLOAT3 c31 = Cross(p3, p1);
+	XMFLOAT3 c12 = Cross(p1, p2);
+	float denominator = p1.x * c23.x + p1.y * c23.y + p1.z * c23.z;
+	float scale = (fabsf(denominator) > 1e-20f) ? -1.0f / denominator : 0.0f;
+	return XMFLOAT3((p1.w * c23.x + p2.w * c31.x + p3.w * c12.x) * scale,
+		(p1.w * c23.y + p2.w * c31.y + p3.w * c12.y) * scale,
+		(p1.w * c23.z + p2.w * c31.z + p3.w * c12.z) * scale);
+}
+
+Frustum MakeFrustum(const XMFLOAT4X4& m)
+{
+	// clip = v * M, so each plane comes from the matrix columns (Gribb & Hartmann)
+	Frustum frustum;
+	frustum.planes[0] = XMFLOAT4(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41); // left
+	frustum.planes[1] = XMFLOAT4(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41); // right
+	frustum.planes[2] = XMFLOAT4(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42); // bottom
+	frustum.planes[3] = XMFLOAT4(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42); // top
+	frustum.planes[4] = XMFLOAT4(m._13, m._23, m._33, m._43);								  // near
+	frustum.planes[5] = XMFLOAT4(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43); // far
+
+	for (int i = 0; i < 6; i++)
+	{
+		XMFLOAT4& plane = frustum.planes[i];
+		float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.0f)
+		{
+			plane.x /= length;
+			plane.y /= length;
+			plane.z /= length;
+			plane.w /= length;
+		}
+	}
+
+	frustum.bounds.min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	frustum.bounds.max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		XMFLOAT3 point = Intersect(frustum.planes[(corner & 1) ? 1 : 0], frustum.planes[(corner & 2) ? 3 : 2], frustum.planes[(corner & 4) ? 5 : 4]);
+		frustum.bounds.min = XMFLOAT3(std::min(frustum.bounds.min.x, point.x), std::min(frustum.bounds.min.y, point.y), std::min(frustum.bounds.min.z, point.z));
+		frustum.bounds.max = XMFLOAT3(std::max(frustum.bounds.max.x, point.x), std::max(frustum.bounds.max.y, point.y), std::max(frustum.bounds.max.z, point.z));
+	}
+	return frustum;
+}
+
+void MakePickRay(float x, float y, float width, float height, const XMFLOAT4X4& m, XMFLOAT3* origin, XMFLOAT3* direction)
+{
+	// clip x = ndc x * clip w and the same for y are two planes through the eye, the ray is where they cross
+	float ndcX = 2.0f * (x + 0.5f) / width - 1.0f;
+	float ndcY = 1.0f - 2.0f * (y + 0.5f) / height;
+	XMFLOAT4 planeX(m._11 - ndcX * m._14, m._21 - ndcX * m._24, m._31 - ndcX * m._34, m._41 - ndcX * m._44);
+	XMFLOAT4 planeY(m._12 - ndcY * m._14, m._22 - ndcY * m._24, m._32 - ndcY * m._34, m._42 - ndcY * m._44);
+	XMFLOAT4 nearPlane(m._13, m._23, m._33, m._43);
+	XMFLOAT4 farPlane(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+
+	XMFLOAT3 nearPoint = Intersect(planeX, planeY, nearPlane);
+	XMFLOAT3 farPoint = Intersect(planeX, planeY, farPlane);
+	XMFLOAT3 along(farPoint.x - nearPoint.x, farPoint.y - nearPoint.y, farPoint.z - nearPoint.z);
+	float length = sqrtf(along.x * along.x + along.y * along.y + along.z * along.z);
+	float scale = (length > 0.0f) ? 1.0f / length : 0.0f;
+	*origin = nearPoint;
+	*direction = XMFLOAT3(along.x * scale, along.y * scale, along.z * scale);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Common.h"
+#include <algorithm>
+#include <xnamath.h>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		bounding volumes and the overlap tests between them
+// ==============================================================
+
+struct Aabb
+{
+	XMFLOAT3 min;
+	XMFLOAT3 max;
+};
+
+struct Sphere
+{
+	XMFLOAT3 center;
+	float	 radius;
+};
+
+// planes face inwards, a point is inside when a*x + b*y + c*z + d >= 0 for all six
+struct Frustum
+{
+	XMFLOAT4 planes[6]; // left, right, bottom, top, near, far
+	Aabb	 bounds;	// around the eight corners, for structures that can only be walked by box
+};
+
+// from a view * projection matrix in the xnamath convention (row vectors, clip space z from 0 to 1)
+STRANGEENGINEMK3_API Frustum MakeFrustum(const XMFLOAT4X4& viewProjection);
+
+// the ray under a pixel (GetMouseX(), GetMouseY()) of a width x height view, from the near plane through the pixel's
+// centre. 'direction' is unit length, so distances along it are in world units
+STRANGEENGINEMK3_API void MakePickRay(float x, float y, float width, float height, const XMFLOAT4X4& viewProjection, XMFLOAT3* origin, XMFLOAT3* direction);
+
+inline Aabb MakeAabb(const XMFLOAT3& center, const XMFLOAT3& halfExtents)
+{
+	Aabb box;
+	box.min = XMFLOAT3(center.x - halfExtents.x, center.y - halfExtents.y, center.z - halfExtents.z);
+	box.max = XMFLOAT3(center.x + halfExtents.x, center.y + halfExtents.y, center.z + halfExtents.z);
+	return box;
+}
+
+inline Aabb SphereBounds(const Sphere& sphere)
+{
+	return MakeAabb(sphere.center, XMFLOAT3(sphere.radius, sphere.radius, sphere.radius));
+}
+
+inline bool AabbOverlaps(const Aabb& a, const Aabb& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x
+		&& a.min.y <= b.max.y && a.max.y >= b.min.y
+		&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+inline bool SphereOverlapsAabb(const Sphere& sphere, const Aabb& box)
+{
+	// distance from the centre to the closest point in the box
+	float dx = sphere.center.x - std::max(box.min.x, std::min(sphere.center.x, box.max.x));
+	float dy = sphere.center.y - std::max(box.min.y, std::min(sphere.center.y, box.max.y));
+	float dz = sphere.center.z - std::max(box.min.z, std::min(sphere.center.z, box.max.z));
+	return dx * dx + dy * dy + dz * dz <= sphere.radius * sphere.radius;
+}
+
+// conservative, a box near a corner of the frustum can pass without actually touching it
+inline bool FrustumOverlapsAabb(const Frustum& frustum, const Aabb& box)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		// the box corner furthest along the plane's normal
+		const XMFLOAT4& plane = frustum.planes[i];
+		float x = (plane.x >= 0.0f) ? box.max.x : box.min.x;
+		float y = (plane.y >= 0.0f) ? box.max.y : box.min.y;
+		float z = (plane.z >= 0.0f) ? box.max.z : box.min.z;
+		if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
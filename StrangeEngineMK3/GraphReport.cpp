@@ -0,0 +1,37 @@
+#include "pch.h"
+#include "GraphReport.h"
+#include <iomanip>
+
+ReportTable::ReportTable(LogCategory category, const ReportColumn* columns, UINT count)
+{
+	mCategory = category;
+	mColumns = columns;
+	mCount = count;
+	mColumn = 0;
+	mLine << std::fixed << std::setprecision(3);
+}
+
+void ReportTable::LogTitles()
+{
+	for (UINT i = 0; i < mCount; i++)
+		*this << mColumns[i].title;
+	LogRow();
+}
+
+void ReportTable::NextColumn()
+{
+	// values past the last column just run on after it
+	if (mColumn >= mCount)
+		return;
+	const ReportColumn& column = mColumns[mColumn++];
+	mLine.setf(column.left ? std::ios::left : std::ios::right, std::ios::adjustfield);
+	mLine.width(column.width);
+}
+
+void ReportTable::LogRow(const char* suffix)
+{
+	mLine << suffix;
+	LOG_INFO(mCategory, "{}", mLine.str());
+	mLine.str("");
+	mColumn = 0;
+}
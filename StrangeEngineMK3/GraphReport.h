@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Common.h"
+#include "Log.h"
+#include <climits>
+#include <sstream>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// the longest chain through a graph of timed tasks, what running them would take with unlimited threads.
+// 'order' has every node after its predecessors (nullptr if the nodes already are), 'nodes' are anything with a
+// 'predecessors' list of indices. returns the chain's ms and puts its nodes in 'path', first to last
+template<typename Node> double FindCriticalPath(const Node* nodes, const UINT* order, UINT count, const std::vector<double>& ms, std::vector<UINT>* path)
+{
+	std::vector<double> chainMs(count, 0.0);
+	std::vector<UINT> chainPrevious(count, UINT_MAX);
+	UINT chainEnd = UINT_MAX;
+	for (UINT n = 0; n < count; n++)
+	{
+		UINT i = order ? order[n] : n;
+		chainMs[i] = ms[i];
+		for (UINT predecessor : nodes[i].predecessors)
+		{
+			if (chainMs[predecessor] + ms[i] > chainMs[i])
+			{
+				chainMs[i] = chainMs[predecessor] + ms[i];
+				chainPrevious[i] = predecessor;
+			}
+		}
+		if (chainEnd == UINT_MAX || chainMs[i] > chainMs[chainEnd])
+			chainEnd = i;
+	}
+
+	path->clear();
+	for (UINT i = chainEnd; i != UINT_MAX; i = chainPrevious[i])
+		path->insert(path->begin(), i);
+	return chainEnd != UINT_MAX ? chainMs[chainEnd] : 0.0;
+}
+
+struct ReportColumn
+{
+	const char* title;
+	int			width;
+	bool		left; // names line up on the left, numbers on the right
+};
+
+// a table logged a row at a time, so the startup and system scheduler timings land in the .slog looking the same.
+// numbers get 3 decimals
+class STRANGEENGINEMK3_API ReportTable
+{
+public:
+	ReportTable(LogCategory category, const ReportColumn* columns, UINT count);
+
+	// the column titles as a row of their own
+	void LogTitles();
+
+	// fills the next column of the row being built
+	template<typename T> ReportTable& operator<<(const T& value)
+	{
+		NextColumn();
+		mLine << value;
+		return *this;
+	}
+
+	// 'suffix' goes after the last column, for markers like " *"
+	void LogRow(const char* suffix = "");
+
+private:
+	ReportTable(const ReportTable&);
+	ReportTable& operator=(const ReportTable&);
+
+	void NextColumn();
+
+	LogCategory			mCategory;
+	const ReportColumn* mColumns;
+	UINT				mCount;
+	UINT				mColumn;
+	std::ostringstream	mLine;
+};
@@ -0,0 +1,129 @@
+#include "pch.h"
+#include "Hash.h"
+#include <cstring>
+
+// ==============================================================
+//		xxHash64
+// ==============================================================
+
+static const UINT64 kPrime1 = 0x9E3779B185EBCA87ull;
+static const UINT64 kPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const UINT64 kPrime3 = 0x165667B19E3779F9ull;
+static const UINT64 kPrime4 = 0x85EBCA77C2B2AE63ull;
+static const UINT64 kPrime5 = 0x27D4EB2F165667C5ull;
+
+static inline UINT64 RotateLeft(UINT64 value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// unaligned little endian reads, memcpy compiles down to a plain load
+static inline UINT64 Read64(const BYTE* p)
+{
+	UINT64 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT Read32(const BYTE* p)
+{
+	UINT value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT64 Round(UINT64 accumulator, UINT64 input)
+{
+	accumulator += input * kPrime2;
+	accumulator = RotateLeft(accumulator, 31);
+	return accumulator * kPrime1;
+}
+
+static inline UINT64 MergeRound(UINT64 accumulator, UINT64 value)
+{
+	accumulator ^= Round(0, value);
+	return accumulator * kPrime1 + kPrime4;
+}
+
+UINT64 HashBytes(const void* data, size_t size, UINT64 seed)
+{
+	const BYTE* p = (const BYTE*)data;
+	const BYTE* end = p + size;
+	UINT64 hash;
+
+	if (size >= 32)
+	{
+		// four independent lanes over 32 byte stripes
+		UINT64 v1 = seed + kPrime1 + kPrime2;
+		UINT64 v2 = seed + kPrime2;
+		UINT64 v3 = seed;
+		UINT64 v4 = seed - kPrime1;
+
+		const BYTE* limit = end - 32;
+		do
+		{
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+		hash = MergeRound(hash, v1);
+		hash = MergeRound(hash, v2);
+		hash = MergeRound(hash, v3);
+		hash = MergeRound(hash, v4);
+	}
+	else
+		hash = seed + kPrime5;
+
+	hash += (UINT64)size;
+
+	// whatever is left over, 8, 4 then 1 byte at a time
+	while (p + 8 <= end)
+	{
+		hash ^= Round(0, Read64(p));
+		hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+		p += 8;
+	}
+	if (p + 4 <= end)
+	{
+		hash ^= (UINT64)Read32(p) * kPrime1;
+		hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+		p += 4;
+	}
+	while (p < end)
+	{
+		hash ^= (*p) * kPrime5;
+		hash = RotateLeft(hash, 11) * kPrime1;
+		p++;
+	}
+
+	// avalanche
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+// ==============================================================
+//		asset ids
+// ==============================================================
+
+AssetId GetAssetId(const std::string& name)
+{
+	return HashAssetName(name.data(), name.size());
+}
+
+AssetId GetAssetId(const std::wstring& name)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, name.c_str(), (int)name.size(), nullptr, 0, nullptr, nullptr);
+	std::string utf8(length > 0 ? length : 0, '\0');
+	if (length > 0)
+		WideCharToMultiByte(CP_UTF8, 0, name.c_str(), (int)name.size(), &utf8[0], length, nullptr, nullptr);
+	return HashAssetName(utf8.data(), utf8.size());
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Common.h"
+#include <type_traits>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// xxHash64, fast and well distributed. used for content addressing (pack dedupe, cook database)
+// not cryptographic, always compare the bytes as well when a collision would matter
+STRANGEENGINEMK3_API UINT64 HashBytes(const void* data, size_t size, UINT64 seed = 0);
+
+
+// ==============================================================
+//		asset ids
+// ==============================================================
+
+// FNV-1a over an asset's name the way PackFile spells names, lower case with forward slashes, so
+// "Textures\Brick.png" and "textures/brick.png" are the same asset. constexpr, so a name written in the code costs
+// nothing at runtime. ids are only unique while no two names collide, the cooker checks every source it sees
+typedef UINT64 AssetId;
+
+#define ASSET_ID_OFFSET 0xcbf29ce484222325ull
+#define ASSET_ID_PRIME 0x100000001b3ull
+
+constexpr AssetId HashAssetName(const char* name, size_t length)
+{
+	AssetId hash = ASSET_ID_OFFSET;
+	for (size_t i = 0; i < length; i++)
+	{
+		char c = name[i];
+		if (c == '\\')
+			c = '/';
+		else if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+		hash = (hash ^ (BYTE)c) * ASSET_ID_PRIME;
+	}
+	return hash;
+}
+
+// the length of a string literal less its terminator
+template <size_t N>
+constexpr AssetId HashAssetName(const char (&name)[N])
+{
+	return HashAssetName(name, N - 1);
+}
+
+// forces the hash to happen while compiling, ASSET_ID("Meshes/Hills.x") is just a number in the executable
+#define ASSET_ID(name) (std::integral_constant<AssetId, HashAssetName(name)>::value)
+
+// the same for names only known at runtime, wide ones are hashed as UTF-8
+STRANGEENGINEMK3_API AssetId GetAssetId(const std::string& name);
+STRANGEENGINEMK3_API AssetId GetAssetId(const std::wstring& name);
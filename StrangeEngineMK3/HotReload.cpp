@@ -0,0 +1,151 @@
+#include "pch.h"
+#include "HotReload.h"
+#include "Log.h"
+#include "AssetStreamer.h"
+#include <algorithm>
+
+// gives the singleton an initial value to clear up any unresolved externals
+HotReloader* HotReloader::singleton = nullptr;
+
+static std::once_flag gHotReloaderOnce;
+
+HotReloader* HotReloader::Get()
+{
+	// never deleted, same as the job system. StrangeEngine::StopEngine calls Stop() instead
+	std::call_once(gHotReloaderOnce, []()
+	{
+		singleton = new HotReloader();
+	});
+	return singleton;
+}
+
+HotReloader::HotReloader()
+{
+	mCookDone = false;
+	mCooking = false;
+	mBatchRescan = false;
+	mRescan = false;
+	mNextListenerId = 1;
+}
+
+HotReloader::~HotReloader()
+{
+	Stop();
+}
+
+bool HotReloader::Start(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const AssetCookSettings& settings)
+{
+	Stop();
+
+	mSourceFolder = sourceFolder;
+	mCookedFolder = cookedFolder;
+	mSettings = settings;
+	CreateDirectoryW(cookedFolder.c_str(), nullptr);
+
+	// a cook that fails here is reported but doesn't stop the watcher, saving a fixed source cooks it again
+	mDatabase.Load(cookedFolder + L"\\cook.db");
+	mDatabase.CookFolder(sourceFolder, cookedFolder, settings, &mLastReport);
+	mDatabase.Save(cookedFolder + L"\\cook.db");
+
+	LOG_INFO(LogCategory_Assets, "hot reload: {} cooked, {} up to date, {} failed", mLastReport.cooked, mLastReport.upToDate, mLastReport.failed);
+
+	return mWatcher.Start(sourceFolder);
+}
+
+void HotReloader::Stop()
+{
+	if (!IsRunning())
+		return;
+
+	mWatcher.Stop();
+	if (mCooking)
+	{
+		mCookThread.join();
+		FinishBatch();
+	}
+	mWaiting.clear();
+	mRescan = false;
+}
+
+void HotReloader::Update()
+{
+	if (!IsRunning())
+		return;
+
+	if (mCooking)
+	{
+		if (!mCookDone.load())
+			return;
+		mCookThread.join();
+		FinishBatch();
+	}
+
+	std::vector<std::wstring> changes;
+	bool rescan = false;
+	mWatcher.GetChanges(&changes, &rescan);
+	mRescan |= rescan;
+	for (const std::wstring& change : changes)
+	{
+		if (GetCookAssetKind(change) != CookAssetKind_None)
+			mWaiting.push_back(change);
+	}
+
+	if (mWaiting.empty() && !mRescan)
+		return;
+
+	std::sort(mWaiting.begin(), mWaiting.end());
+	mWaiting.erase(std::unique(mWaiting.begin(), mWaiting.end()), mWaiting.end());
+
+	mBatch.swap(mWaiting);
+	mWaiting.clear();
+	mBatchRescan = mRescan;
+	mRescan = false;
+	mCooking = true;
+	mCookDone = false;
+
+	mCookThread = std::thread([this]()
+	{
+		// the watcher lost track of what changed, the database still only cooks what needs it
+		if (mBatchRescan)
+			mDatabase.CookFolder(mSourceFolder, mCookedFolder, mSettings, &mBatchReport);
+		else
+			mDatabase.CookFiles(mSourceFolder, mCookedFolder, mBatch, mSettings, &mBatchReport);
+		mDatabase.Save(mCookedFolder + L"\\cook.db");
+		mCookDone = true;
+	});
+}
+
+UINT HotReloader::AddListener(std::function<void(const std::wstring& cookedPath)> listener)
+{
+	UINT id = mNextListenerId++;
+	mListeners.push_back(std::make_pair(id, listener));
+	return id;
+}
+
+void HotReloader::RemoveListener(UINT id)
+{
+	mListeners.erase(std::remove_if(mListeners.begin(), mListeners.end(),
+		[id](const std::pair<UINT, std::function<void(const std::wstring&)>>& listener) { return listener.first == id; }),
+		mListeners.end());
+}
+
+void HotReloader::FinishBatch()
+{
+	mCooking = false;
+	mLastReport = mBatchReport;
+	mBatch.clear();
+
+	for (const std::wstring& source : mLastReport.failedSources)
+		LOG_WARNING(LogCategory_Assets, "hot reload: failed to cook {}", source);
+
+	for (const std::wstring& cookedPath : mLastReport.cookedOutputs)
+	{
+		LOG_INFO(LogCategory_Assets, "hot reload: {}", cookedPath);
+		AssetStreamer::Get()->Reload(cookedPath);
+
+		// a listener may remove itself
+		std::vector<std::pair<UINT, std::function<void(const std::wstring&)>>> listeners = mListeners;
+		for (const auto& listener : listeners)
+			listener.second(cookedPath);
+	}
+}
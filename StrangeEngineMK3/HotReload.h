@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Common.h"
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CookDatabase.h"
+#include "FileWatcher.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// cooks source assets as they are saved and swaps the results into the running game between frames
+// StrangeEngine::Run calls Update() once a frame, nothing happens until Start() has been called
+// every function here is meant to be called from the main thread
+class STRANGEENGINEMK3_API HotReloader
+{
+public:
+	static HotReloader* Get();
+
+	// cooks anything that is out of date straight away, then watches 'sourceFolder' for changes
+	bool Start(const std::wstring& sourceFolder, const std::wstring& cookedFolder, const AssetCookSettings& settings);
+	void Stop();
+
+	bool IsRunning() const { return mWatcher.IsRunning(); }
+
+	// hands a finished cook over and starts the next one if sources have changed since
+	// only one batch cooks at a time, on a thread of its own rather than the job system: a frame that waits on its jobs
+	// helps run whatever is queued, and would end up running the whole cook itself
+	void Update();
+
+	// called from Update() with the full path of every cooked file once it has been replaced on disk
+	// assets loaded through the AssetStreamer from that path reload by themselves, this is for whatever
+	// the game built out of them (vertex buffers, textures...). returns an id for RemoveListener()
+	UINT AddListener(std::function<void(const std::wstring& cookedPath)> listener);
+	void RemoveListener(UINT id);
+
+	// the last batch that finished, e.g. to show cook errors on screen
+	const IncrementalCookReport& GetLastReport() const { return mLastReport; }
+
+private:
+	HotReloader();
+	~HotReloader();
+
+	void FinishBatch();
+
+	static HotReloader* singleton;
+
+	FileWatcher		  mWatcher;
+	CookDatabase	  mDatabase;
+	std::wstring	  mSourceFolder;
+	std::wstring	  mCookedFolder;
+	AssetCookSettings mSettings;
+
+	// the batch being cooked, only touched by mCookThread until mCookDone is set
+	std::thread				  mCookThread;
+	std::atomic<bool>		  mCookDone;
+	bool					  mCooking;
+	std::vector<std::wstring> mBatch;
+	bool					  mBatchRescan;
+	IncrementalCookReport	  mBatchReport;
+
+	std::vector<std::wstring> mWaiting; // changed while a batch was cooking
+	bool					  mRescan;
+	IncrementalCookReport	  mLastReport;
+
+	std::vector<std::pair<UINT, std::function<void(const std::wstring&)>>> mListeners;
+	UINT																	 mNextListenerId;
+};
@@ -0,0 +1,541 @@
+#include "pch.h"
+#include "ImageImport.h"
+#include "Log.h"
+#include "JobSystem.h"
+#include <objbase.h>
+#include <wincodec.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ==============================================================
+//		decoding
+// ==============================================================
+
+// COM has to be initialised once on every thread that talks to WIC, job system workers included
+// we never uninitialise, the workers live until the engine shuts down anyway
+static thread_local bool tComInitialized = false;
+
+static bool InitComForThread()
+{
+	if (tComInitialized)
+		return true;
+
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	// RPC_E_CHANGED_MODE means someone already made this thread single threaded, COM still works
+	if (FAILED(hr) && hr != RPC_E_CHANGED_MODE)
+		return false;
+
+	tComInitialized = true;
+	return true;
+}
+
+template<typename T> static void SafeRelease(T*& object)
+{
+	if (object)
+	{
+		object->Release();
+		object = nullptr;
+	}
+}
+
+// 'openDecoder' makes the decoder, from a file or from memory, the rest is shared
+template<typename OpenDecoder> static HRESULT DecodeWithWIC(OpenDecoder openDecoder, UINT* width, UINT* height, std::vector<BYTE>* rgba)
+{
+	IWICImagingFactory*	   factory = nullptr;
+	IWICBitmapDecoder*	   decoder = nullptr;
+	IWICBitmapFrameDecode* frame = nullptr;
+	IWICFormatConverter*   converter = nullptr;
+
+	// the factory is free threaded, but making one per image keeps the workers from sharing anything
+	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+	if (SUCCEEDED(hr))
+		hr = openDecoder(factory, &decoder);
+	if (SUCCEEDED(hr))
+		hr = decoder->GetFrame(0, &frame);
+	if (SUCCEEDED(hr))
+		hr = factory->CreateFormatConverter(&converter);
+	// whatever the file holds (palette, grey + alpha, 24 bit jpg...) comes out as straight RGBA8
+	if (SUCCEEDED(hr))
+		hr = converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
+	if (SUCCEEDED(hr))
+		hr = converter->GetSize(width, height);
+	if (SUCCEEDED(hr))
+	{
+		rgba->resize((size_t)*width * *height * 4);
+		hr = converter->CopyPixels(nullptr, *width * 4, (UINT)rgba->size(), rgba->data());
+	}
+
+	SafeRelease(converter);
+	SafeRelease(frame);
+	SafeRelease(decoder);
+	SafeRelease(factory);
+	return hr;
+}
+
+static bool ReportComFailure()
+{
+	ReportError(LogCategory_Assets, "Failed to initialise COM for image decoding");
+	return false;
+}
+
+bool DecodeImage(const std::wstring& path, UINT* width, UINT* height, std::vector<BYTE>* rgba)
+{
+	if (!InitComForThread())
+		return ReportComFailure();
+
+	HRESULT hr = DecodeWithWIC([&path](IWICImagingFactory* factory, IWICBitmapDecoder** decoder)
+	{
+		return factory->CreateDecoderFromFilename(path.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, decoder);
+	}, width, height, rgba);
+
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Assets, "Failed to decode image {}", path);
+		return false;
+	}
+	return true;
+}
+
+bool DecodeImageFromMemory(const BYTE* fileData, size_t size, UINT* width, UINT* height, std::vector<BYTE>* rgba)
+{
+	if (!InitComForThread())
+		return ReportComFailure();
+
+	IWICStream* stream = nullptr;
+	HRESULT hr = DecodeWithWIC([&](IWICImagingFactory* factory, IWICBitmapDecoder** decoder)
+	{
+		HRESULT result = factory->CreateStream(&stream);
+		if (SUCCEEDED(result))
+			result = stream->InitializeFromMemory(const_cast<BYTE*>(fileData), (DWORD)size);
+		if (SUCCEEDED(result))
+			result = factory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, decoder);
+		return result;
+	}, width, height, rgba);
+	SafeRelease(stream);
+
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Assets, "Failed to decode image from memory");
+		return false;
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		sRGB <-> linear
+// ==============================================================
+
+// log2 of a positive float. exponent from the bits, polynomial fit for the mantissa, error under 3e-6
+static inline __m128 Log2SSE(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF))), _mm_set1_ps(1.0f));
+
+	__m128 p = _mm_set1_ps(-0.0250461388f);
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(0.269342282f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.24537847f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.24440251f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-5.29619242f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(6.08672905f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-3.03385465f));
+	return _mm_add_ps(exponent, p);
+}
+
+// 2^x. integer part goes straight into the exponent bits, polynomial for the fraction, error under 2e-7
+static inline __m128 Exp2SSE(__m128 x)
+{
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(126.0f)), _mm_set1_ps(-126.0f));
+
+	// floor, truncation rounds the wrong way for negatives
+	__m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, x), _mm_set1_ps(1.0f)));
+	__m128 f = _mm_sub_ps(x, whole);
+
+	__m128 p = _mm_set1_ps(0.00189510752f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.00894621407f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0558632832f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.240140770f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.693154620f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.999999896f));
+
+	__m128i scale = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+
+static inline __m128 PowSSE(__m128 x, float power)
+{
+	return Exp2SSE(_mm_mul_ps(Log2SSE(x), _mm_set1_ps(power)));
+}
+
+// lanes are r, g, b, a. alpha takes the 'keep' side of every select below
+static inline __m128 AlphaLaneMask()
+{
+	return _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+}
+
+static inline __m128 Select(__m128 mask, __m128 ifTrue, __m128 ifFalse)
+{
+	return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+}
+
+static inline __m128 SRGBToLinearSSE(__m128 c)
+{
+	__m128 low = _mm_mul_ps(c, _mm_set1_ps(1.0f / 12.92f));
+	__m128 high = PowSSE(_mm_mul_ps(_mm_add_ps(c, _mm_set1_ps(0.055f)), _mm_set1_ps(1.0f / 1.055f)), 2.4f);
+	__m128 linear = Select(_mm_cmple_ps(c, _mm_set1_ps(0.04045f)), low, high);
+	return Select(AlphaLaneMask(), c, linear);
+}
+
+static inline __m128 LinearToSRGBSSE(__m128 c)
+{
+	__m128 low = _mm_mul_ps(c, _mm_set1_ps(12.92f));
+	__m128 high = _mm_sub_ps(_mm_mul_ps(PowSSE(c, 1.0f / 2.4f), _mm_set1_ps(1.055f)), _mm_set1_ps(0.055f));
+	__m128 srgb = Select(_mm_cmple_ps(c, _mm_set1_ps(0.0031308f)), low, high);
+	return Select(AlphaLaneMask(), c, srgb);
+}
+
+void ConvertToLinear(const BYTE* rgba, size_t pixelCount, bool srgb, float* linearOut)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 toUnit = _mm_set1_ps(1.0f / 255.0f);
+
+	// 4 pixels per pass, the last few go through a padded copy
+	for (size_t i = 0; i < pixelCount; i += 4)
+	{
+		size_t count = std::min<size_t>(4, pixelCount - i);
+		__m128i packed;
+		if (count == 4)
+			packed = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+		else
+		{
+			BYTE padded[16] = {};
+			memcpy(padded, rgba + i * 4, count * 4);
+			packed = _mm_loadu_si128((const __m128i*)padded);
+		}
+
+		__m128i low = _mm_unpacklo_epi8(packed, zero);
+		__m128i high = _mm_unpackhi_epi8(packed, zero);
+		__m128 pixels[4] =
+		{
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), toUnit),
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), toUnit),
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), toUnit),
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), toUnit),
+		};
+
+		for (size_t p = 0; p < count; p++)
+			_mm_storeu_ps(linearOut + (i + p) * 4, srgb ? SRGBToLinearSSE(pixels[p]) : pixels[p]);
+	}
+}
+
+void ConvertFromLinear(const float* linear, size_t pixelCount, bool srgb, BYTE* rgbaOut)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 toByte = _mm_set1_ps(255.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+
+	for (size_t i = 0; i < pixelCount; i += 4)
+	{
+		size_t count = std::min<size_t>(4, pixelCount - i);
+		__m128i converted[4];
+		for (size_t p = 0; p < 4; p++)
+		{
+			__m128 c = (p < count) ? _mm_loadu_ps(linear + (i + p) * 4) : zero;
+			c = _mm_min_ps(_mm_max_ps(c, zero), one);
+			if (srgb)
+				c = LinearToSRGBSSE(c);
+			converted[p] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, toByte), half));
+		}
+
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(converted[0], converted[1]), _mm_packs_epi32(converted[2], converted[3]));
+		if (count == 4)
+			_mm_storeu_si128((__m128i*)(rgbaOut + i * 4), packed);
+		else
+		{
+			BYTE padded[16];
+			_mm_storeu_si128((__m128i*)padded, packed);
+			memcpy(rgbaOut + i * 4, padded, count * 4);
+		}
+	}
+}
+
+
+// ==============================================================
+//		mip generation
+// ==============================================================
+
+// one destination texel's taps along one axis
+struct FilterTaps
+{
+	int	  first; // first source texel, taps past the edges clamp
+	int	  count;
+	float weights[12]; // 6 when halving, up to 10 for odd sizes like 3 -> 1
+};
+
+static double BesselI0(double x)
+{
+	// power series, converges quickly for the alphas we use
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static double KaiserSinc(double x)
+{
+	// support of 1.5 destination texels either side, alpha 4
+	const double width = 1.5, alpha = 4.0;
+	if (fabs(x) >= width)
+		return 0.0;
+
+	const double pi = 3.14159265358979323846;
+	double sinc = (x == 0.0) ? 1.0 : sin(pi * x) / (pi * x);
+	double t = x / width;
+	return sinc * BesselI0(alpha * sqrt(1.0 - t * t)) / BesselI0(alpha);
+}
+
+static std::vector<FilterTaps> BuildKaiserTaps(UINT sourceSize, UINT destSize)
+{
+	std::vector<FilterTaps> taps(destSize);
+	double scale = (double)sourceSize / (double)destSize; // 2 unless the source size is odd
+
+	for (UINT i = 0; i < destSize; i++)
+	{
+		FilterTaps& tap = taps[i];
+		double center = (i + 0.5) * scale; // in source texels
+		int first = (int)ceil(center - 1.5 * scale - 0.5);
+		int last = (int)floor(center + 1.5 * scale - 0.5);
+
+		tap.first = first;
+		tap.count = std::min(last - first + 1, 12);
+
+		double total = 0.0;
+		for (int k = 0; k < tap.count; k++)
+		{
+			double weight = KaiserSinc((first + k + 0.5 - center) / scale);
+			tap.weights[k] = (float)weight;
+			total += weight;
+		}
+		for (int k = 0; k < tap.count; k++)
+			tap.weights[k] = (float)(tap.weights[k] / total);
+	}
+	return taps;
+}
+
+static void DownsampleBox(const float* src, UINT srcWidth, UINT srcHeight, float* dst, UINT dstWidth, UINT dstHeight)
+{
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	// odd sizes just drop the last row/column, that's what box filters do
+	JobSystem::Get()->ParallelFor(dstHeight, 16, [&](unsigned int begin, unsigned int end)
+	{
+		for (UINT y = begin; y < end; y++)
+		{
+			const float* row0 = src + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+			const float* row1 = src + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+			float* out = dst + (size_t)y * dstWidth * 4;
+
+			for (UINT x = 0; x < dstWidth; x++)
+			{
+				UINT x0 = std::min(x * 2, srcWidth - 1) * 4;
+				UINT x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+					_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+				_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+			}
+		}
+	});
+}
+
+static void DownsampleKaiser(const float* src, UINT srcWidth, UINT srcHeight, float* dst, UINT dstWidth, UINT dstHeight)
+{
+	std::vector<FilterTaps> horizontal = BuildKaiserTaps(srcWidth, dstWidth);
+	std::vector<FilterTaps> vertical = BuildKaiserTaps(srcHeight, dstHeight);
+
+	// separable, horizontal pass into a srcHeight x dstWidth scratch image first
+	std::vector<float> scratch((size_t)dstWidth * srcHeight * 4);
+
+	JobSystem::Get()->ParallelFor(srcHeight, 16, [&](unsigned int begin, unsigned int end)
+	{
+		for (UINT y = begin; y < end; y++)
+		{
+			const float* row = src + (size_t)y * srcWidth * 4;
+			float* out = &scratch[(size_t)y * dstWidth * 4];
+
+			for (UINT x = 0; x < dstWidth; x++)
+			{
+				const FilterTaps& tap = horizontal[x];
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < tap.count; k++)
+				{
+					int sx = std::min(std::max(tap.first + k, 0), (int)srcWidth - 1);
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + sx * 4), _mm_set1_ps(tap.weights[k])));
+				}
+				_mm_storeu_ps(out + x * 4, sum);
+			}
+		}
+	});
+
+	// the negative lobes can ring past the input range, clamp on the way out
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	JobSystem::Get()->ParallelFor(dstHeight, 16, [&](unsigned int begin, unsigned int end)
+	{
+		for (UINT y = begin; y < end; y++)
+		{
+			const FilterTaps& tap = vertical[y];
+			float* out = dst + (size_t)y * dstWidth * 4;
+
+			for (UINT x = 0; x < dstWidth; x++)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int k = 0; k < tap.count; k++)
+				{
+					int sy = std::min(std::max(tap.first + k, 0), (int)srcHeight - 1);
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&scratch[((size_t)sy * dstWidth + x) * 4]), _mm_set1_ps(tap.weights[k])));
+				}
+				_mm_storeu_ps(out + x * 4, _mm_min_ps(_mm_max_ps(sum, zero), one));
+			}
+		}
+	});
+}
+
+void GenerateMipChain(LinearImage* image, MipFilter filter)
+{
+	image->mips.resize(1);
+
+	UINT width = image->width, height = image->height;
+	while (width > 1 || height > 1)
+	{
+		UINT nextWidth = std::max(1u, width / 2);
+		UINT nextHeight = std::max(1u, height / 2);
+
+		std::vector<float> next((size_t)nextWidth * nextHeight * 4);
+		const std::vector<float>& previous = image->mips.back();
+		if (filter == MipFilter_Kaiser)
+			DownsampleKaiser(previous.data(), width, height, next.data(), nextWidth, nextHeight);
+		else
+			DownsampleBox(previous.data(), width, height, next.data(), nextWidth, nextHeight);
+
+		image->mips.push_back(std::move(next));
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+
+// ==============================================================
+//		alpha coverage
+// ==============================================================
+
+static float CoverageWithScale(const std::vector<float>& pixels, float cutoff, float scale)
+{
+	size_t pixelCount = pixels.size() / 4, covered = 0;
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		if (pixels[i * 4 + 3] * scale > cutoff)
+			covered++;
+	}
+	return pixelCount ? (float)covered / (float)pixelCount : 0.0f;
+}
+
+float GetAlphaCoverage(const LinearImage& image, UINT level, float cutoff)
+{
+	if (level >= image.mips.size())
+		return 0.0f;
+	return CoverageWithScale(image.mips[level], cutoff, 1.0f);
+}
+
+void PreserveAlphaCoverage(LinearImage* image, float cutoff)
+{
+	if (image->mips.size() < 2)
+		return;
+
+	float target = GetAlphaCoverage(*image, 0, cutoff);
+
+	JobSystem::Get()->ParallelFor((unsigned int)image->mips.size() - 1, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int level = begin + 1; level < end + 1; level++)
+		{
+			std::vector<float>& pixels = image->mips[level];
+
+			// coverage only goes up as the scale does, so binary search for the scale that hits the target
+			float low = 0.0f, high = 4.0f;
+			for (int step = 0; step < 16; step++)
+			{
+				float middle = (low + high) * 0.5f;
+				if (CoverageWithScale(pixels, cutoff, middle) < target)
+					low = middle;
+				else
+					high = middle;
+			}
+
+			// coverage moves in steps on small mips, take whichever side of the step lands closer
+			float lowError = fabsf(CoverageWithScale(pixels, cutoff, low) - target);
+			float highError = fabsf(CoverageWithScale(pixels, cutoff, high) - target);
+			float scale = (lowError < highError) ? low : high;
+
+			for (size_t i = 3; i < pixels.size(); i += 4)
+				pixels[i] = std::min(1.0f, pixels[i] * scale);
+		}
+	});
+}
+
+
+// ==============================================================
+//		import
+// ==============================================================
+
+bool ImportImage(const std::wstring& path, const ImageImportSettings& settings, LinearImage* image)
+{
+	std::vector<BYTE> rgba;
+	if (!DecodeImage(path, &image->width, &image->height, &rgba))
+		return false;
+
+	image->mips.resize(1);
+	image->mips[0].resize((size_t)image->width * image->height * 4);
+	ConvertToLinear(rgba.data(), (size_t)image->width * image->height, settings.srgb, image->mips[0].data());
+
+	GenerateMipChain(image, settings.filter);
+	if (settings.preserveAlphaCoverage)
+		PreserveAlphaCoverage(image, settings.alphaCutoff);
+	return true;
+}
+
+void ImportImages(const std::vector<std::wstring>& paths, const ImageImportSettings& settings,
+	std::vector<LinearImage>* images, std::vector<bool>* succeeded)
+{
+	images->assign(paths.size(), LinearImage());
+	succeeded->assign(paths.size(), false);
+
+	// std::vector<bool> packs bits, so every job writes its own byte and we copy over at the end
+	std::vector<BYTE> results(paths.size(), 0);
+
+	JobCounter counter;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		JobSystem::Get()->Run([&, i]()
+		{
+			results[i] = ImportImage(paths[i], settings, &(*images)[i]) ? 1 : 0;
+		}, &counter);
+	}
+	JobSystem::Get()->Wait(&counter);
+
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		(*succeeded)[i] = (results[i] != 0);
+		if (!results[i])
+			(*images)[i] = LinearImage();
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+enum MipFilter
+{
+	MipFilter_Box,	  // 2x2 average, fast but blurs and aliases a little
+	MipFilter_Kaiser, // windowed sinc over 6x6 texels, keeps the mips sharper
+};
+
+struct ImageImportSettings
+{
+	MipFilter filter;
+	bool	  srgb;					 // colour channels are sRGB encoded, alpha is always treated as linear
+	bool	  preserveAlphaCoverage; // keep the share of pixels that pass the alpha test the same on every mip
+	float	  alphaCutoff;			 // the alpha test reference the material uses, usually 0.5
+};
+
+// a mip chain of linear float RGBA, 4 floats per pixel, mips[0] is the largest
+struct LinearImage
+{
+	UINT width;
+	UINT height;
+	std::vector<std::vector<float>> mips;
+};
+
+// decodes a PNG/JPG/BMP/TIFF/... (anything WIC understands) to tightly packed RGBA8
+STRANGEENGINEMK3_API bool DecodeImage(const std::wstring& path, UINT* width, UINT* height, std::vector<BYTE>* rgba);
+
+// same as above for a file that has already been read into memory (e.g. by the asset streamer)
+STRANGEENGINEMK3_API bool DecodeImageFromMemory(const BYTE* fileData, size_t size, UINT* width, UINT* height, std::vector<BYTE>* rgba);
+
+// RGBA8 <-> linear float RGBA, 4 pixels at a time with SSE. alpha is never curved
+STRANGEENGINEMK3_API void ConvertToLinear(const BYTE* rgba, size_t pixelCount, bool srgb, float* linearOut);
+STRANGEENGINEMK3_API void ConvertFromLinear(const float* linear, size_t pixelCount, bool srgb, BYTE* rgbaOut);
+
+// fills mips[1..] from mips[0] down to 1x1
+STRANGEENGINEMK3_API void GenerateMipChain(LinearImage* image, MipFilter filter);
+
+// the fraction of pixels in a mip whose alpha is above 'cutoff'
+STRANGEENGINEMK3_API float GetAlphaCoverage(const LinearImage& image, UINT level, float cutoff);
+
+// rescales the alpha of every mip below the top so its coverage matches the top mip
+// without this, alpha tested foliage/fences/glass thin out and vanish in the distance
+STRANGEENGINEMK3_API void PreserveAlphaCoverage(LinearImage* image, float cutoff);
+
+// decode + convert + mip chain for one file
+STRANGEENGINEMK3_API bool ImportImage(const std::wstring& path, const ImageImportSettings& settings, LinearImage* image);
+
+// imports a batch of files, one job per file on the job system
+// 'succeeded' gets one entry per path, the failed images are left empty
+STRANGEENGINEMK3_API void ImportImages(const std::vector<std::wstring>& paths, const ImageImportSettings& settings,
+	std::vector<LinearImage>* images, std::vector<bool>* succeeded);
@@ -1,6 +1,9 @@
 #include "pch.h"
 #include "InitDirect3D.h"
+#include "Log.h"
+#include "DebugDraw.h"
 #include "Input.h"
+#include "MemoryTracking.h"
 
 // gives the singleton an initial value to clear up any unresolved externals
 InitDirect3D* InitDirect3D::singleton = nullptr;
@@ -200,19 +203,10 @@ InitDirect3D::InitDirect3D(HINSTANCE hInstance, StrangeEngine* strangeEngine_Ins
 {
 	if (singleton != nullptr)
 	{
-		std::cout << "[WARN] multiple instances of InitDirect3D were created, releasing previous instance to avoid memory leaks" << std::endl;
 		delete singleton;
 		singleton = nullptr;
 
-		gLastError = "[WARN] multiple instances of InitDirect3D were created, releasing previous instance to avoid memory leaks";
-	}
-	if (parentEngine != nullptr)
-	{
-		std::cout << "[WARN] multiple instances of StrangeEngine were created, releasing previous instance to avoid memory leaks" << std::endl;
-		delete parentEngine;
-		parentEngine = nullptr;
-
-		gLastError = "[WARN] multiple instances of StrangeEngine were created, releasing previous instance to avoid memory leaks";
+		ReportError(LogCategory_Render, "multiple instances of InitDirect3D were created, releasing previous instance to avoid memory leaks");
 	}
 
 
@@ -236,33 +230,41 @@ InitDirect3D::InitDirect3D(HINSTANCE hInstance, StrangeEngine* strangeEngine_Ins
 	mDepthStencilBuffer = 0;
 	mRenderTargetView = 0;
 	mDepthStencilView = 0;
+	mBackBufferBytes = 0;
+	mDepthBufferBytes = 0;
 
 	singleton = this;
 	parentEngine = strangeEngine_Instance;
 	
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "InitDirect3D instance created: Defaults Set" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "InitDirect3D instance created: Defaults Set");
 }
 
 InitDirect3D::~InitDirect3D()
 {
-	mRenderTargetView->Release();	mRenderTargetView = nullptr;
-	mDepthStencilView->Release();	mDepthStencilView = nullptr;
-	mSwapChain->Release();			mSwapChain = nullptr;
-	mDepthStencilBuffer->Release(); mDepthStencilBuffer = nullptr;
+	// a headless engine (or one whose startup failed) never made some of these
+	if (mRenderTargetView)	 { mRenderTargetView->Release();	mRenderTargetView = nullptr; }
+	if (mDepthStencilView)	 { mDepthStencilView->Release();	mDepthStencilView = nullptr; }
+	if (mSwapChain)			 { mSwapChain->Release();			mSwapChain = nullptr; }
+	if (mDepthStencilBuffer) { mDepthStencilBuffer->Release();	mDepthStencilBuffer = nullptr; }
+
+	// a capture that is still running is written out while its objects are still alive
+	mRenderContext.Release();
 
 	// Restore all default settings.
 	if (md3dImmediateContext)
+	{
 		md3dImmediateContext->ClearState();
+		md3dImmediateContext->Release(); md3dImmediateContext = nullptr;
+	}
+	if (md3dDevice) { md3dDevice->Release(); md3dDevice = nullptr; }
 
-	md3dImmediateContext->Release(); md3dImmediateContext = nullptr;
-	md3dDevice->Release(); md3dDevice = nullptr;
+	TrackRenderBuffer(&mBackBufferBytes, 0);
+	TrackRenderBuffer(&mDepthBufferBytes, 0);
 
+	if (singleton == this)
+		singleton = nullptr;
 	
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "InitDirect3D instance deleted" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "InitDirect3D instance deleted");
 }
 
 bool InitDirect3D::InitMainWindow()
@@ -338,33 +340,19 @@ bool InitDirect3D::CreateDeviceAndContext()
 	// if the above function was unsuccessful
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Error creating Direct3D device" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Error creating Direct3D device";
+		ReportError(LogCategory_Render, "Error creating Direct3D device");
 		return false;
 	}
 
 	// make sure that feature level 11 (directx 11) is supported
 	if (featureLevel != D3D_FEATURE_LEVEL_11_0)
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Direct3D Feature Level 11 Unsupported" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Direct3D Feature Level 11 Unsupported";
+		ReportError(LogCategory_Render, "Direct3D Feature Level 11 Unsupported");
 		return false;
 	}
-	// Debug Logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "Direct3D device successfully created!" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "Direct3D device successfully created!");
 
+	mRenderContext.Create(md3dDevice, md3dImmediateContext);
 	return true;
 }
 
@@ -376,30 +364,22 @@ bool InitDirect3D::Check4xMSAAQualitySupport()
 	// if the above function was unsuccessful
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[WARN]: 4x MSAA Unsupported, disabling 4xMSAA" << std::endl;
-		#endif
+		LOG_WARNING(LogCategory_Render, "4x MSAA Unsupported, disabling 4xMSAA");
 
 		mEnable4xMsaa = false;
 		return false;
 	}
 
 	if (m4xMsaaQuality <= 0)
-	{// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[WARN]: 4x MSAA cannot  be negative, disabling 4xMSAA" << std::endl;
-		#endif
+	{
+		LOG_WARNING(LogCategory_Render, "4x MSAA cannot be negative, disabling 4xMSAA");
 
 		mEnable4xMsaa = false;
 		return false;
 	}
 
 	
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "4x MSAA supported, enabling 4xMSAA" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "4x MSAA supported, enabling 4xMSAA");
 	mEnable4xMsaa = true;
 	return true;
 }
@@ -445,13 +425,7 @@ bool InitDirect3D::DescribeSwapChain()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not obtain DXGIDevice" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not obtain DXGIDevice";
+		ReportError(LogCategory_Render, "Could not obtain DXGIDevice");
 		dxgiDevice->Release();  dxgiDevice = nullptr;
 		return false;
 	}
@@ -461,13 +435,7 @@ bool InitDirect3D::DescribeSwapChain()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not obtain DXGIAdapter" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not obtain DXGIAdapter";
+		ReportError(LogCategory_Render, "Could not obtain DXGIAdapter");
 		dxgiDevice->Release();  dxgiDevice = nullptr;
 		dxgiAdapter->Release(); dxgiAdapter = nullptr;
 		return false;
@@ -478,13 +446,7 @@ bool InitDirect3D::DescribeSwapChain()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not obtain DXGIFactory" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not obtain DXGIFactory";
+		ReportError(LogCategory_Render, "Could not obtain DXGIFactory");
 		dxgiDevice->Release();  dxgiDevice = nullptr;
 		dxgiAdapter->Release(); dxgiAdapter = nullptr;
 		dxgiFactory->Release(); dxgiFactory = nullptr;
@@ -500,13 +462,7 @@ bool InitDirect3D::DescribeSwapChain()
 	// check the swap chain has been made sucessfully
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not create swap chain" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error creating swap chain";
+		ReportError(LogCategory_Render, "Could not create swap chain");
 		dxgiDevice->Release();  dxgiDevice = nullptr;
 		dxgiAdapter->Release(); dxgiAdapter = nullptr;
 		dxgiFactory->Release(); dxgiFactory = nullptr;
@@ -519,12 +475,10 @@ bool InitDirect3D::DescribeSwapChain()
 	dxgiAdapter->Release(); dxgiAdapter = nullptr;
 	dxgiFactory->Release(); dxgiFactory = nullptr;
 
+	TrackRenderBuffer(&mBackBufferBytes, GetRenderBufferBytes());
 
 	
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "swap chain successfully created" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "swap chain successfully created");
 	return true;
 }
 
@@ -539,10 +493,7 @@ void InitDirect3D::CreateRenderTargetView()
 	backBuffer->Release(); backBuffer = nullptr;
 
 	
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "Render target view created " << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "Render target view created");
 }
 
 bool InitDirect3D::CreateDepthBuffer()
@@ -581,13 +532,7 @@ bool InitDirect3D::CreateDepthBuffer()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not create septh stencil buffer" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not create septh stencil buffer";
+		ReportError(LogCategory_Render, "Could not create septh stencil buffer");
 		return false;
 	}
 
@@ -599,20 +544,12 @@ bool InitDirect3D::CreateDepthBuffer()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not create septh stencil view" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not create septh stencil view";
+		ReportError(LogCategory_Render, "Could not create septh stencil view");
 		return false;
 	}
+	TrackRenderBuffer(&mDepthBufferBytes, GetRenderBufferBytes());
 
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "depth buffer created" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "depth buffer created");
 	return true;
 }
 
@@ -622,10 +559,7 @@ void InitDirect3D::BindViewsToOutputMergerStage()
 		1, &mRenderTargetView, mDepthStencilView
 	);
 
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "views bound to output merger stage" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "views bound to output merger stage");
 }
 
 void InitDirect3D::SetViewport()
@@ -641,10 +575,7 @@ void InitDirect3D::SetViewport()
 
 	md3dImmediateContext->RSSetViewports(1, &vp);
 
-	// Debug logs
-	#if defined(DEBUG)||defined(_DEBUG)
-	std::cout << "viewport set" << std::endl;
-	#endif
+	LOG_DEBUG(LogCategory_Render, "viewport set");
 }
 
 
@@ -679,7 +610,7 @@ int InitDirect3D::Run()
 				if (KeyHit(Key_A))
 				{
 
-					std::cout << "A hit" << std::endl;
+					LOG_TRACE(LogCategory_Render, "A hit");
 				}
 				DrawScene();
 			}
@@ -729,9 +660,17 @@ void InitDirect3D::DrawScene()
 		return;
 
 
+	mRenderContext.BeginFrame();
+
 	XMVECTORF32 Blue = { 0.0f, 0.0f, 1.0f, 1.0f };
-	md3dImmediateContext->ClearRenderTargetView(mRenderTargetView, reinterpret_cast<const float*>(&Blue));
-	md3dImmediateContext->ClearDepthStencilView(mDepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+	mRenderContext.ClearRenderTargetView(mRenderTargetView, reinterpret_cast<const float*>(&Blue));
+	mRenderContext.ClearDepthStencilView(mDepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+
+	// last, on top of the scene
+	DebugDraw::Get()->Render(&mRenderContext, mViewportWidth, mViewportHeight);
+
+	// before Present, a capture has everything that was drawn but not the swap chain
+	mRenderContext.EndFrame();
 
 	HRESULT hr;
 	hr = mSwapChain->Present(0, 0);
@@ -740,13 +679,7 @@ void InitDirect3D::DrawScene()
 	// check for failure
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: Could not draw scene" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "Could not draw scene";
+		ReportError(LogCategory_Render, "Could not draw scene");
 		return;
 	}
 
@@ -773,38 +706,20 @@ void InitDirect3D::OnResize()
 	// check that the buffer has successfully been resized
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: error resizing swap chain depth buffers" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error resizing swap chain depth buffers";
+		ReportError(LogCategory_Render, "error resizing swap chain depth buffers");
 	}
 
 	ID3D11Texture2D* backBuffer;
 	hr = mSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&backBuffer));
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: error accessing depth buffer after resizing" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error accessing depth buffer after resizing";
+		ReportError(LogCategory_Render, "error accessing depth buffer after resizing");
 	}
 
 	hr = md3dDevice->CreateRenderTargetView(backBuffer, 0, &mRenderTargetView);
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: error creating render target view after resizing" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error creating render target view after resizing";
+		ReportError(LogCategory_Render, "error creating render target view after resizing");
 	}
 	backBuffer->Release(); backBuffer = nullptr;
 
@@ -839,27 +754,19 @@ void InitDirect3D::OnResize()
 	hr = md3dDevice->CreateTexture2D(&depthStencilDesc, 0, &mDepthStencilBuffer);
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: error creating new depth buffer after resizing" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error creating new depth buffer after resizing";
+		ReportError(LogCategory_Render, "error creating new depth buffer after resizing");
 	}
 
 	hr = md3dDevice->CreateDepthStencilView(mDepthStencilBuffer, 0, &mDepthStencilView);
 	if (FAILED(hr))
 	{
-		// Debug logs
-		#if defined(DEBUG)||defined(_DEBUG)
-		std::cout << "[ERROR]: error creating new depth stencil view after resizing" << std::endl;
-		#endif
-
-		// return an error message to the engine
-		gLastError = "error creating new depth stencil view after resizing";
+		ReportError(LogCategory_Render, "error creating new depth stencil view after resizing");
 	}
 
+	// both buffers are the new size now
+	TrackRenderBuffer(&mBackBufferBytes, GetRenderBufferBytes());
+	TrackRenderBuffer(&mDepthBufferBytes, GetRenderBufferBytes());
+
 
 	// Bind the render target view and depth/stencil view to the pipeline.
 
@@ -877,3 +784,19 @@ void InitDirect3D::OnResize()
 	
 	md3dImmediateContext->RSSetViewports(1, &mScreenViewport);
 }
+
+size_t InitDirect3D::GetRenderBufferBytes() const
+{
+	// R8G8B8A8 and D24S8 are both 4 bytes a pixel, every MSAA sample has its own
+	size_t samples = mEnable4xMsaa ? 4 : 1;
+	return (size_t)mViewportWidth * (size_t)mViewportHeight * 4 * samples;
+}
+
+void InitDirect3D::TrackRenderBuffer(size_t* tracked, size_t bytes)
+{
+	if (*tracked)
+		MemoryTracker::Get()->TrackGpuFree(MemoryTag_Rendering, *tracked);
+	if (bytes)
+		MemoryTracker::Get()->TrackGpuAllocation(MemoryTag_Rendering, bytes);
+	*tracked = bytes;
+}
@@ -7,6 +7,7 @@
 #include <windowsx.h>
 #include <sstream>
 #include <xnamath.h>
+#include "RenderCapture.h"
 #include "StrangeEngine.h"
 
 // message handler for windows
@@ -44,6 +45,11 @@ public:
 	ID3D11RenderTargetView* mRenderTargetView;	  // (4.2.5)
 	ID3D11DepthStencilView* mDepthStencilView;	  // (4.2.6)
 	D3D11_VIEWPORT			mScreenViewport;	  // (4.2.8)
+	RenderContext			mRenderContext;		  // the immediate context as DrawScene and the renderers use it
+
+	// what the back and depth buffers are counted as in the MemoryTracker (rendering, GPU)
+	size_t mBackBufferBytes;
+	size_t mDepthBufferBytes;
 
 
 
@@ -73,6 +79,11 @@ public:
 
 
 	void OnResize();
+
+	// the size of a 4 byte per pixel buffer the size of the viewport, with MSAA if it is on
+	size_t GetRenderBufferBytes() const;
+	// replaces what '*tracked' was counting with 'bytes'
+	void TrackRenderBuffer(size_t* tracked, size_t bytes);
 };
 
 
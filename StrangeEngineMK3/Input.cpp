@@ -1,7 +1,7 @@
 
 #include "pch.h"
 #include "Input.h"
-#include <iostream>
+#include "Log.h"
 
 
 // Current state of all keys (and mouse buttons)
@@ -32,7 +32,7 @@ void InitInput()
 void KeyDownEvent(KeyCode Key)
 {
 
-    std::cout << "key " << Key << " pressed" << std::endl;
+    LOG_TRACE(LogCategory_Input, "key {} pressed", Key);
     if (gKeyStates[Key] == NotPressed)
     {
         gKeyStates[Key] = Pressed;
@@ -161,20 +161,22 @@ enum KeyCode
 // Initialisation
 
 // Initialise the input system
-void InitInput();
+STRANGEENGINEMK3_API void InitInput();
 
 
 //////////////////////////////////
 // Events
 
+// the window's message handler calls these, they are exported so tools and benchmarks can feed input without one
+
 // Event called to indicate that a key has been pressed down
-void KeyDownEvent(KeyCode Key);
+STRANGEENGINEMK3_API void KeyDownEvent(KeyCode Key);
 
 // Event called to indicate that a key has been lifted up
-void KeyUpEvent(KeyCode Key);
+STRANGEENGINEMK3_API void KeyUpEvent(KeyCode Key);
 
 // Event called to indicate that the mouse has been moved
-void MouseMoveEvent(int X, int Y);
+STRANGEENGINEMK3_API void MouseMoveEvent(int X, int Y);
 
 
 //////////////////////////////////
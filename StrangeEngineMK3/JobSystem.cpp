@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "JobSystem.h"
+#include "Log.h"
+#include <algorithm>
+
+// gives the singleton an initial value to clear up any unresolved externals
+JobSystem* JobSystem::singleton = nullptr;
+
+static std::once_flag gJobSystemOnce;
+static thread_local unsigned int tThreadIndex = 0;
+
+JobSystem* JobSystem::Get()
+{
+	// never deleted on purpose, joining threads while the DLL is being unloaded deadlocks on the loader lock
+	// StrangeEngine::StopEngine calls Shutdown() instead
+	std::call_once(gJobSystemOnce, []()
+	{
+		singleton = new JobSystem();
+		singleton->Init();
+	});
+	return singleton;
+}
+
+JobSystem::JobSystem()
+{
+	mQuit = false;
+}
+
+JobSystem::~JobSystem()
+{
+	Shutdown();
+}
+
+void JobSystem::Init(unsigned int numThreads)
+{
+	Shutdown();
+
+	if (numThreads == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		numThreads = (hardwareThreads > 1) ? hardwareThreads - 1 : 1;
+	}
+
+	mQuit = false;
+	for (unsigned int i = 0; i < numThreads; i++)
+		mWorkers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+
+	LOG_DEBUG(LogCategory_Jobs, "job system started with {} worker threads", numThreads);
+}
+
+void JobSystem::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+
+	for (std::thread& worker : mWorkers)
+		worker.join();
+	mWorkers.clear();
+
+	// anything left over still has to run, someone may be waiting on it
+	while (TryRunOne()) {}
+}
+
+void JobSystem::Run(std::function<void()> job, JobCounter* counter)
+{
+	if (counter)
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+	// no workers (not started or shut down), just run it here
+	if (mWorkers.empty())
+	{
+		job();
+		if (counter)
+			counter->pending.fetch_sub(1, std::memory_order_release);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.push_back({ std::move(job), counter });
+	}
+	mWake.notify_one();
+}
+
+void JobSystem::Wait(JobCounter* counter)
+{
+	while (!counter->IsDone())
+	{
+		if (!TryRunOne())
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)>& fn)
+{
+	if (count == 0)
+		return;
+	grainSize = std::max(1u, grainSize);
+
+	// small enough to not be worth waking anyone up
+	if (count <= grainSize || mWorkers.empty())
+	{
+		fn(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (unsigned int begin = grainSize; begin < count; begin += grainSize)
+	{
+		unsigned int end = std::min(count, begin + grainSize);
+		Run([&fn, begin, end]() { fn(begin, end); }, &counter);
+	}
+
+	// the calling thread takes the first chunk itself
+	fn(0, std::min(count, grainSize));
+	Wait(&counter);
+}
+
+unsigned int JobSystem::GetThreadIndex()
+{
+	return tThreadIndex;
+}
+
+size_t JobSystem::GetQueueDepth()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mQueue.size();
+}
+
+bool JobSystem::TryRunOne()
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mQueue.empty())
+			return false;
+		job = std::move(mQueue.front());
+		mQueue.pop_front();
+	}
+
+	job.function();
+	if (job.counter)
+		job.counter->pending.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void JobSystem::WorkerLoop(unsigned int index)
+{
+	tThreadIndex = index;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+			if (mQuit)
+				return;
+		}
+		TryRunOne();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// counts the jobs in a group that haven't finished yet
+struct JobCounter
+{
+	std::atomic<int> pending;
+
+	JobCounter() : pending(0) {}
+	bool IsDone() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// a pool of worker threads shared by the whole engine
+// anything that waits on jobs helps run queued jobs while it waits, so jobs may safely spawn and wait on other jobs
+class STRANGEENGINEMK3_API JobSystem
+{
+public:
+	// the pool is started the first time it is asked for
+	static JobSystem* Get();
+
+	// starts 'numThreads' workers, 0 uses one per hardware thread minus the calling thread
+	void Init(unsigned int numThreads = 0);
+	void Shutdown();
+
+	unsigned int GetWorkerCount() const { return (unsigned int)mWorkers.size(); }
+	// jobs queued and not picked up yet
+	size_t GetQueueDepth();
+
+	// queue a job, 'counter' (optional) is incremented now and decremented when the job finishes
+	void Run(std::function<void()> job, JobCounter* counter = nullptr);
+
+	// block until every job in the counter's group has finished, running jobs while waiting
+	void Wait(JobCounter* counter);
+
+	// calls fn(begin, end) over [0, count) in chunks of at most 'grainSize', the calling thread joins in
+	void ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int begin, unsigned int end)>& fn);
+
+	// runs one queued job on the calling thread, false if the queue was empty
+	// for loops that wait on something other than a JobCounter but still want to help out
+	bool TryRunOne();
+
+	// the index of the calling worker, 0 for any thread that isn't a worker (e.g. the main thread)
+	static unsigned int GetThreadIndex();
+
+private:
+	JobSystem();
+	~JobSystem();
+
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter*			  counter;
+	};
+
+	void WorkerLoop(unsigned int index);
+
+	static JobSystem* singleton;
+
+	std::vector<std::thread> mWorkers;
+	std::deque<Job>			 mQueue;
+	std::mutex				 mMutex;
+	std::condition_variable	 mWake;
+	bool					 mQuit;
+};
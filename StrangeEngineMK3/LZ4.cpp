@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "LZ4.h"
+#include <cstring>
+#include <vector>
+
+// the block format's rules: matches are at least 4 bytes, the last 5 bytes are always literals
+// and no match may start in the last 12 bytes
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;
+static const size_t kMatchStartLimit = 12;
+static const size_t kMaxOffset = 65535;
+static const int	kHashBits = 14;
+
+static inline UINT Read32(const BYTE* p)
+{
+	UINT value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT HashSequence(UINT sequence)
+{
+	return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+size_t LZ4CompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+// writes a length that didn't fit in a token nibble: runs of 255 then the remainder
+static inline BYTE* WriteLength(BYTE* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (BYTE)length;
+	return op;
+}
+
+size_t LZ4Compress(const BYTE* source, size_t sourceSize, BYTE* dest, size_t destCapacity)
+{
+	// positions + 1 of the last time each 4 byte sequence was seen, 0 means never
+	std::vector<UINT> table((size_t)1 << kHashBits, 0);
+
+	const BYTE* ip = source;
+	const BYTE* anchor = source;
+	const BYTE* end = source + sourceSize;
+	BYTE* op = dest;
+	BYTE* opEnd = dest + destCapacity;
+
+	if (sourceSize > kMatchStartLimit)
+	{
+		const BYTE* matchStartLimit = end - kMatchStartLimit;
+		const BYTE* matchEndLimit = end - kLastLiterals;
+
+		size_t misses = 0;
+		while (ip < matchStartLimit)
+		{
+			UINT sequence = Read32(ip);
+			UINT hash = HashSequence(sequence);
+			const BYTE* candidate = table[hash] ? source + table[hash] - 1 : nullptr;
+			table[hash] = (UINT)(ip - source) + 1;
+
+			if (candidate == nullptr || (size_t)(ip - candidate) > kMaxOffset || Read32(candidate) != sequence)
+			{
+				// skip ahead faster the longer we go without a match, incompressible data gets through quickly
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			// grow the match backwards over literals that also match
+			while (ip > anchor && candidate > source && ip[-1] == candidate[-1])
+			{
+				ip--;
+				candidate--;
+			}
+
+			size_t matchLength = kMinMatch;
+			while (ip + matchLength < matchEndLimit && ip[matchLength] == candidate[matchLength])
+				matchLength++;
+
+			size_t literalLength = (size_t)(ip - anchor);
+			size_t worstCase = 1 + literalLength / 255 + 1 + literalLength + 2 + (matchLength - kMinMatch) / 255 + 1;
+			if ((size_t)(opEnd - op) < worstCase)
+				return 0;
+
+			// token: literal length in the high nibble, match length - 4 in the low nibble
+			BYTE* token = op++;
+			*token = (BYTE)((literalLength >= 15 ? 15 : literalLength) << 4);
+			if (literalLength >= 15)
+				op = WriteLength(op, literalLength - 15);
+			memcpy(op, anchor, literalLength);
+			op += literalLength;
+
+			size_t offset = (size_t)(ip - candidate);
+			*op++ = (BYTE)(offset & 0xFF);
+			*op++ = (BYTE)(offset >> 8);
+
+			size_t extraMatch = matchLength - kMinMatch;
+			*token |= (BYTE)(extraMatch >= 15 ? 15 : extraMatch);
+			if (extraMatch >= 15)
+				op = WriteLength(op, extraMatch - 15);
+
+			ip += matchLength;
+			anchor = ip;
+
+			// remember a position inside the match too, it helps runs of repeated structs
+			if (ip - 2 > source && ip < matchStartLimit)
+				table[HashSequence(Read32(ip - 2))] = (UINT)(ip - 2 - source) + 1;
+		}
+	}
+
+	// whatever is left goes out as literals in a final sequence with no match
+	size_t literalLength = (size_t)(end - anchor);
+	if ((size_t)(opEnd - op) < 1 + literalLength / 255 + 1 + literalLength)
+		return 0;
+
+	BYTE* token = op++;
+	*token = (BYTE)((literalLength >= 15 ? 15 : literalLength) << 4);
+	if (literalLength >= 15)
+		op = WriteLength(op, literalLength - 15);
+	memcpy(op, anchor, literalLength);
+	op += literalLength;
+
+	return (size_t)(op - dest);
+}
+
+bool LZ4Decompress(const BYTE* source, size_t sourceSize, BYTE* dest, size_t destSize)
+{
+	const BYTE* ip = source;
+	const BYTE* ipEnd = source + sourceSize;
+	BYTE* op = dest;
+	BYTE* opEnd = dest + destSize;
+
+	while (ip < ipEnd)
+	{
+		BYTE token = *ip++;
+
+		// literals
+		size_t literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			BYTE extra;
+			do
+			{
+				if (ip >= ipEnd)
+					return false;
+				extra = *ip++;
+				literalLength += extra;
+			} while (extra == 255);
+		}
+		if ((size_t)(ipEnd - ip) < literalLength || (size_t)(opEnd - op) < literalLength)
+			return false;
+		// short runs are the common case, one fixed 16 byte copy is quicker than a sized one when there's room
+		if (literalLength <= 16 && ipEnd - ip >= 16 && opEnd - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// the last sequence has no match
+		if (ip == ipEnd)
+			break;
+
+		// match
+		if (ipEnd - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dest))
+			return false;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			BYTE extra;
+			do
+			{
+				if (ip >= ipEnd)
+					return false;
+				extra = *ip++;
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		matchLength += kMinMatch;
+		if ((size_t)(opEnd - op) < matchLength)
+			return false;
+
+		const BYTE* match = op - offset;
+		if (offset >= 8 && (size_t)(opEnd - op) >= matchLength + 8)
+		{
+			// 8 bytes at a time, may write a little past the match but that gets overwritten by what follows
+			BYTE* copyEnd = op + matchLength;
+			do
+			{
+				memcpy(op, match, 8);
+				op += 8;
+				match += 8;
+			} while (op < copyEnd);
+			op = copyEnd;
+		}
+		else if (offset >= matchLength)
+		{
+			memcpy(op, match, matchLength);
+			op += matchLength;
+		}
+		else
+		{
+			// overlapping copy, this is how runs get encoded so it has to go a byte at a time
+			for (size_t i = 0; i < matchLength; i++)
+				*op++ = match[i];
+		}
+	}
+
+	return op == opEnd;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Common.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// LZ4 block format (no frame header), compatible with the reference lz4 library's LZ4_compress_default/LZ4_decompress_safe
+// fast to compress and very fast to decompress, which is what we want for data read at load time
+
+// the most a 'size' byte input can grow to when it doesn't compress
+STRANGEENGINEMK3_API size_t LZ4CompressBound(size_t size);
+
+// returns the compressed size, or 0 if it didn't fit in 'destCapacity'
+STRANGEENGINEMK3_API size_t LZ4Compress(const BYTE* source, size_t sourceSize, BYTE* dest, size_t destCapacity);
+
+// 'destSize' must be the exact decompressed size. returns false on corrupt input instead of overrunning either buffer
+STRANGEENGINEMK3_API bool LZ4Decompress(const BYTE* source, size_t sourceSize, BYTE* dest, size_t destSize);
@@ -0,0 +1,389 @@
+#include "pch.h"
+#include "LightCulling.h"
+#include "Log.h"
+#include "JobSystem.h"
+#include "MemoryTracking.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// below this many lights every slice is culled on the calling thread, handing out jobs would cost more
+static const UINT kParallelThreshold = 32;
+
+// the arrays the cluster data is split into
+static const int kArrayCount = 10;
+
+LightDesc::LightDesc()
+{
+	type = LightType_Point;
+	position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	range = 10.0f;
+	direction = XMFLOAT3(0.0f, 0.0f, 1.0f);
+	outerAngle = XM_PIDIV4;
+	color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	intensity = 1.0f;
+}
+
+LightDesc MakePointLight(const XMFLOAT3& position, float range, const XMFLOAT3& color)
+{
+	LightDesc light;
+	light.type = LightType_Point;
+	light.position = position;
+	light.range = range;
+	light.color = color;
+	return light;
+}
+
+LightDesc MakeSpotLight(const XMFLOAT3& position, const XMFLOAT3& direction, float range, float outerAngle, const XMFLOAT3& color)
+{
+	LightDesc light;
+	light.type = LightType_Spot;
+	light.position = position;
+	light.direction = direction;
+	light.range = range;
+	light.outerAngle = outerAngle;
+	light.color = color;
+	return light;
+}
+
+ClusterGridDesc::ClusterGridDesc()
+{
+	width = 1920;
+	height = 1080;
+	tileSize = 64;
+	depthSlices = 24;
+	fovY = 0.25f * XM_PI;
+	nearZ = 1.0f;
+	farZ = 1000.0f;
+}
+
+ClusteredLightCuller::ClusteredLightCuller()
+{
+	memset(&mConstants, 0, sizeof(mConstants));
+	mTilesX = 0;
+	mTilesY = 0;
+	mRowStride = 0;
+	mClusterCount = 0;
+	mMemory = nullptr;
+	mMemoryFloats = 0;
+	mMinX = mMinY = mMinZ = mMaxX = mMaxY = mMaxZ = nullptr;
+	mCenterX = mCenterY = mCenterZ = mRadius = nullptr;
+}
+
+ClusteredLightCuller::~ClusteredLightCuller()
+{
+	FreeClusters();
+}
+
+void ClusteredLightCuller::FreeClusters()
+{
+	if (mMemory)
+	{
+		_aligned_free(mMemory);
+		MemoryTracker::Get()->TrackFree(MemoryTag_Rendering, sizeof(float) * mMemoryFloats);
+	}
+	mMemory = nullptr;
+	mMemoryFloats = 0;
+	mClusterCount = 0;
+}
+
+bool ClusteredLightCuller::SetGrid(const ClusterGridDesc& desc)
+{
+	FreeClusters();
+	mRanges.clear();
+	mIndices.clear();
+
+	if (desc.width == 0 || desc.height == 0 || desc.tileSize == 0 || desc.depthSlices == 0
+		|| desc.nearZ <= 0.0f || desc.farZ <= desc.nearZ || desc.fovY <= 0.0f || desc.fovY >= XM_PI)
+	{
+		ReportError(LogCategory_Render, "Cluster grid {} x {} with {} pixel tiles and {} slices from {} to {} isn't usable",
+			desc.width, desc.height, desc.tileSize, desc.depthSlices, desc.nearZ, desc.farZ);
+		return false;
+	}
+
+	mGrid = desc;
+	mTilesX = (desc.width + desc.tileSize - 1) / desc.tileSize;
+	mTilesY = (desc.height + desc.tileSize - 1) / desc.tileSize;
+	mRowStride = (mTilesX + 3) & ~3u;
+	mClusterCount = mTilesX * mTilesY * desc.depthSlices;
+
+	float logDepth = logf(desc.farZ / desc.nearZ);
+	mConstants.tilesX = mTilesX;
+	mConstants.tilesY = mTilesY;
+	mConstants.depthSlices = desc.depthSlices;
+	mConstants.tileSize = desc.tileSize;
+	mConstants.sliceScale = desc.depthSlices / logDepth;
+	mConstants.sliceBias = -(float)desc.depthSlices * logf(desc.nearZ) / logDepth;
+
+	mSliceDepths.resize(desc.depthSlices + 1);
+	for (UINT slice = 0; slice <= desc.depthSlices; slice++)
+		mSliceDepths[slice] = desc.nearZ * expf(logDepth * slice / desc.depthSlices);
+	mSliceDepths[desc.depthSlices] = desc.farZ;
+
+	size_t rows = (size_t)desc.depthSlices * mTilesY;
+	mMemoryFloats = rows * mRowStride * kArrayCount;
+	mMemory = (float*)_aligned_malloc(sizeof(float) * mMemoryFloats, 16);
+	if (!mMemory)
+	{
+		ReportError(LogCategory_Render, "Could not allocate memory for {} light clusters", mClusterCount);
+		mMemoryFloats = 0;
+		mClusterCount = 0;
+		return false;
+	}
+	MemoryTracker::Get()->TrackAllocation(MemoryTag_Rendering, sizeof(float) * mMemoryFloats);
+
+	float** arrays[kArrayCount] = { &mMinX, &mMinY, &mMinZ, &mMaxX, &mMaxY, &mMaxZ, &mCenterX, &mCenterY, &mCenterZ, &mRadius };
+	for (int i = 0; i < kArrayCount; i++)
+		*arrays[i] = mMemory + rows * mRowStride * i;
+
+	mColumnMinX.resize((size_t)desc.depthSlices * mTilesX);
+	mColumnMaxX.resize((size_t)desc.depthSlices * mTilesX);
+	mRowMinY.resize(rows);
+	mRowMaxY.resize(rows);
+
+	// a tile's edges at a view depth of 1, the frustum piece a cluster covers is these scaled by its near and far depth
+	float tanY = tanf(desc.fovY * 0.5f);
+	float tanX = tanY * desc.width / (float)desc.height;
+	for (UINT slice = 0; slice < desc.depthSlices; slice++)
+	{
+		float nearDepth = mSliceDepths[slice];
+		float farDepth = mSliceDepths[slice + 1];
+		for (UINT ty = 0; ty < mTilesY; ty++)
+		{
+			// pixel rows go down the screen, view space y goes up
+			float top = (1.0f - 2.0f * (ty * desc.tileSize) / (float)desc.height) * tanY;
+			float bottom = (1.0f - 2.0f * std::min((ty + 1) * desc.tileSize, desc.height) / (float)desc.height) * tanY;
+			float minY = std::min(bottom * nearDepth, bottom * farDepth);
+			float maxY = std::max(top * nearDepth, top * farDepth);
+
+			size_t row = (size_t)slice * mTilesY + ty;
+			mRowMinY[row] = minY;
+			mRowMaxY[row] = maxY;
+
+			for (UINT tx = 0; tx < mRowStride; tx++)
+			{
+				size_t i = row * mRowStride + tx;
+				if (tx >= mTilesX)
+				{
+					// an inside out box is never reached and a negative radius is outside every cone
+					mMinX[i] = mMinY[i] = mMinZ[i] = FLT_MAX;
+					mMaxX[i] = mMaxY[i] = mMaxZ[i] = -FLT_MAX;
+					mCenterX[i] = mCenterY[i] = mCenterZ[i] = 0.0f;
+					mRadius[i] = -1.0f;
+					continue;
+				}
+
+				float left = (2.0f * (tx * desc.tileSize) / (float)desc.width - 1.0f) * tanX;
+				float right = (2.0f * std::min((tx + 1) * desc.tileSize, desc.width) / (float)desc.width - 1.0f) * tanX;
+				mMinX[i] = std::min(left * nearDepth, left * farDepth);
+				mMaxX[i] = std::max(right * nearDepth, right * farDepth);
+				mColumnMinX[(size_t)slice * mTilesX + tx] = mMinX[i];
+				mColumnMaxX[(size_t)slice * mTilesX + tx] = mMaxX[i];
+				mMinY[i] = minY;
+				mMaxY[i] = maxY;
+				mMinZ[i] = nearDepth;
+				mMaxZ[i] = farDepth;
+
+				float halfX = (mMaxX[i] - mMinX[i]) * 0.5f;
+				float halfY = (mMaxY[i] - mMinY[i]) * 0.5f;
+				float halfZ = (farDepth - nearDepth) * 0.5f;
+				mCenterX[i] = mMinX[i] + halfX;
+				mCenterY[i] = mMinY[i] + halfY;
+				mCenterZ[i] = nearDepth + halfZ;
+				mRadius[i] = sqrtf(halfX * halfX + halfY * halfY + halfZ * halfZ);
+			}
+		}
+	}
+
+	mSlices.resize(desc.depthSlices);
+	mRanges.resize(mClusterCount);
+	return true;
+}
+
+UINT ClusteredLightCuller::GetSlice(float viewZ) const
+{
+	if (mGrid.depthSlices == 0 || viewZ <= mGrid.nearZ)
+		return 0;
+	float slice = logf(viewZ) * mConstants.sliceScale + mConstants.sliceBias;
+	return std::min((UINT)slice, mGrid.depthSlices - 1);
+}
+
+void ClusteredLightCuller::Cull(const LightDesc* lights, UINT count, const XMFLOAT4X4& view)
+{
+	if (mClusterCount == 0)
+		return;
+
+	// into view space once, every slice reads them
+	mLights.resize(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		const LightDesc& light = lights[i];
+		const XMFLOAT3& p = light.position;
+		const XMFLOAT3& d = light.direction;
+		ViewLight& out = mLights[i];
+		out.position.x = p.x * view._11 + p.y * view._21 + p.z * view._31 + view._41;
+		out.position.y = p.x * view._12 + p.y * view._22 + p.z * view._32 + view._42;
+		out.position.z = p.x * view._13 + p.y * view._23 + p.z * view._33 + view._43;
+		out.direction.x = d.x * view._11 + d.y * view._21 + d.z * view._31;
+		out.direction.y = d.x * view._12 + d.y * view._22 + d.z * view._32;
+		out.direction.z = d.x * view._13 + d.y * view._23 + d.z * view._33;
+		out.range = light.range;
+
+		// cones from a right angle up are culled as the sphere they sit in, the cone test below only holds under that
+		out.spot = light.type == LightType_Spot && light.outerAngle < XM_PIDIV2;
+		out.cosAngle = cosf(light.outerAngle);
+		out.sinAngle = sinf(light.outerAngle);
+	}
+
+	UINT slices = mGrid.depthSlices;
+	if (count < kParallelThreshold)
+	{
+		for (UINT slice = 0; slice < slices; slice++)
+			CullSlice(slice);
+	}
+	else
+	{
+		JobSystem::Get()->ParallelFor(slices, 1, [this](UINT begin, UINT end)
+		{
+			for (UINT slice = begin; slice < end; slice++)
+				CullSlice(slice);
+		});
+	}
+
+	// the slices' lists one after the other, a few hundred KB at most so one thread copying them is fine
+	size_t total = 0;
+	for (const SliceOutput& slice : mSlices)
+		total += slice.indices.size();
+	mIndices.resize(total);
+
+	UINT base = 0;
+	UINT clustersPerSlice = mTilesX * mTilesY;
+	for (UINT slice = 0; slice < slices; slice++)
+	{
+		const SliceOutput& output = mSlices[slice];
+		ClusterRange* ranges = &mRanges[(size_t)slice * clustersPerSlice];
+		for (UINT i = 0; i < clustersPerSlice; i++)
+			ranges[i].offset += base;
+		if (!output.indices.empty())
+			memcpy(&mIndices[base], output.indices.data(), sizeof(UINT) * output.indices.size());
+		base += (UINT)output.indices.size();
+	}
+}
+
+void ClusteredLightCuller::CullSlice(UINT slice)
+{
+	SliceOutput& output = mSlices[slice];
+	output.hits.clear();
+
+	const float nearDepth = mSliceDepths[slice];
+	const float farDepth = mSliceDepths[slice + 1];
+	const __m128 zero = _mm_setzero_ps();
+	const UINT lightCount = (UINT)mLights.size();
+
+	for (UINT light = 0; light < lightCount; light++)
+	{
+		const ViewLight& l = mLights[light];
+		if (l.position.z + l.range < nearDepth || l.position.z - l.range > farDepth)
+			continue;
+
+		const __m128 px = _mm_set1_ps(l.position.x);
+		const __m128 py = _mm_set1_ps(l.position.y);
+		const __m128 pz = _mm_set1_ps(l.position.z);
+		const __m128 rangeSquared = _mm_set1_ps(l.range * l.range);
+		const __m128 range = _mm_set1_ps(l.range);
+		const __m128 dx = _mm_set1_ps(l.direction.x);
+		const __m128 dy = _mm_set1_ps(l.direction.y);
+		const __m128 dz = _mm_set1_ps(l.direction.z);
+		const __m128 cosAngle = _mm_set1_ps(l.cosAngle);
+		const __m128 sinAngle = _mm_set1_ps(l.sinAngle);
+
+		// the slice's depth is already known to overlap, what's left of the sphere test on a row or column is x and y
+		float cz = std::max(nearDepth, std::min(l.position.z, farDepth)) - l.position.z;
+		float sliceRangeSquared = l.range * l.range - cz * cz;
+		float sliceRange = sqrtf(std::max(sliceRangeSquared, 0.0f));
+
+		// the columns' extents only grow left to right, the ones the light reaches are a run of them
+		const float* columnMinX = &mColumnMinX[(size_t)slice * mTilesX];
+		const float* columnMaxX = &mColumnMaxX[(size_t)slice * mTilesX];
+		UINT firstColumn = (UINT)(std::lower_bound(columnMaxX, columnMaxX + mTilesX, l.position.x - sliceRange) - columnMaxX);
+		UINT endColumn = (UINT)(std::upper_bound(columnMinX, columnMinX + mTilesX, l.position.x + sliceRange) - columnMinX);
+		if (firstColumn >= endColumn)
+			continue;
+		firstColumn &= ~3u;
+
+		for (UINT ty = 0; ty < mTilesY; ty++)
+		{
+			size_t row = (size_t)slice * mTilesY + ty;
+			float cy = l.position.y - std::max(mRowMinY[row], std::min(l.position.y, mRowMaxY[row]));
+			if (cy * cy > sliceRangeSquared)
+				continue;
+
+			size_t first = row * mRowStride;
+			for (UINT tx = firstColumn; tx < endColumn; tx += 4)
+			{
+				size_t i = first + tx;
+
+				// sphere against four boxes, the distance from the centre to the closest point in each
+				__m128 ox = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(mMinX + i), px), zero), _mm_max_ps(_mm_sub_ps(px, _mm_load_ps(mMaxX + i)), zero));
+				__m128 oy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(mMinY + i), py), zero), _mm_max_ps(_mm_sub_ps(py, _mm_load_ps(mMaxY + i)), zero));
+				__m128 oz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(mMinZ + i), pz), zero), _mm_max_ps(_mm_sub_ps(pz, _mm_load_ps(mMaxZ + i)), zero));
+				__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz));
+				int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, rangeSquared));
+				if (mask == 0)
+					continue;
+
+				if (l.spot)
+				{
+					// cone against the sphere around each box: out if it is past the end, behind the light,
+					// or further from the cone's side than its radius
+					__m128 radius = _mm_load_ps(mRadius + i);
+					__m128 vx = _mm_sub_ps(_mm_load_ps(mCenterX + i), px);
+					__m128 vy = _mm_sub_ps(_mm_load_ps(mCenterY + i), py);
+					__m128 vz = _mm_sub_ps(_mm_load_ps(mCenterZ + i), pz);
+					__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+					__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+					__m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSquared, _mm_mul_ps(along, along)), zero));
+					__m128 sideDistance = _mm_sub_ps(_mm_mul_ps(cosAngle, across), _mm_mul_ps(along, sinAngle));
+					__m128 outside = _mm_or_ps(_mm_cmpgt_ps(sideDistance, radius),
+						_mm_or_ps(_mm_cmpgt_ps(along, _mm_add_ps(radius, range)), _mm_cmplt_ps(along, _mm_sub_ps(zero, radius))));
+					mask &= ~_mm_movemask_ps(outside);
+				}
+
+				while (mask)
+				{
+					UINT lane = 0;
+					while (!(mask & (1 << lane)))
+						lane++;
+					mask &= mask - 1;
+
+					Hit hit;
+					hit.cluster = ty * mTilesX + tx + lane;
+					hit.light = light;
+					output.hits.push_back(hit);
+				}
+			}
+		}
+	}
+
+	// grouped by cluster, the hits are in light order so each cluster's lights stay in the order they were given
+	UINT clustersPerSlice = mTilesX * mTilesY;
+	output.counts.assign(clustersPerSlice, 0);
+	for (const Hit& hit : output.hits)
+		output.counts[hit.cluster]++;
+
+	ClusterRange* ranges = &mRanges[(size_t)slice * clustersPerSlice];
+	UINT offset = 0;
+	for (UINT i = 0; i < clustersPerSlice; i++)
+	{
+		ranges[i].offset = offset;
+		ranges[i].count = output.counts[i];
+		output.counts[i] = offset; // from here on where the next light for the cluster goes
+		offset += ranges[i].count;
+	}
+
+	output.indices.resize(output.hits.size());
+	for (const Hit& hit : output.hits)
+		output.indices[output.counts[hit.cluster]++] = hit.light;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include <xnamath.h>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+enum LightType
+{
+	LightType_Point,
+	LightType_Spot,
+};
+
+// in world space, the culler only looks at where a light reaches, colour and intensity are for the renderer
+struct LightDesc
+{
+	LightType type;
+	XMFLOAT3  position;
+	float	  range;	  // nothing is lit past this
+	XMFLOAT3  direction;  // spot lights only, unit length
+	float	  outerAngle; // spot lights only, radians from the direction to the edge of the cone
+	XMFLOAT3  color;
+	float	  intensity;
+
+	LightDesc();
+};
+
+STRANGEENGINEMK3_API LightDesc MakePointLight(const XMFLOAT3& position, float range, const XMFLOAT3& color);
+STRANGEENGINEMK3_API LightDesc MakeSpotLight(const XMFLOAT3& position, const XMFLOAT3& direction, float range, float outerAngle, const XMFLOAT3& color);
+
+// how the view frustum is cut up, screen tiles by depth slices spaced evenly in log(depth)
+struct ClusterGridDesc
+{
+	UINT  width;	   // of the render target in pixels
+	UINT  height;
+	UINT  tileSize;	   // pixels along each side of a cluster's screen tile
+	UINT  depthSlices;
+	float fovY;		   // radians, the same as the projection matrix was made with
+	float nearZ;
+	float farZ;
+
+	ClusterGridDesc();
+};
+
+// where one cluster's lights are in the index list, for a R32G32_UINT buffer
+struct ClusterRange
+{
+	UINT offset;
+	UINT count;
+};
+
+// what a pixel shader needs to find its cluster, lay it out the same in a constant buffer
+// tile = SV_Position.xy / tileSize, slice = log(view z) * sliceScale + sliceBias
+// cluster = (slice * tilesY + tile.y) * tilesX + tile.x
+struct ClusterConstants
+{
+	UINT  tilesX;
+	UINT  tilesY;
+	UINT  depthSlices;
+	UINT  tileSize;
+	float sliceScale;
+	float sliceBias;
+	float padding[2];
+};
+
+// assigns lights to the clusters of a view frustum on the CPU, so a forward pixel shader only loops over the lights that
+// can reach its cluster. the clusters' boxes are kept as structure of arrays and each light is tested against four of
+// them at a time with SSE, depth slices are split across the job system
+class STRANGEENGINEMK3_API ClusteredLightCuller
+{
+public:
+	ClusteredLightCuller();
+	~ClusteredLightCuller();
+
+	// rebuilds the cluster boxes, call it again when the window is resized or the projection changes
+	bool SetGrid(const ClusterGridDesc& desc);
+	const ClusterGridDesc& GetGrid() const { return mGrid; }
+	const ClusterConstants& GetConstants() const { return mConstants; }
+	UINT GetClusterCount() const { return mClusterCount; }
+
+	// view is the camera's view matrix in the xnamath convention (left handed, +z into the screen)
+	void Cull(const LightDesc* lights, UINT count, const XMFLOAT4X4& view);
+
+	// one range per cluster in the order of ClusterConstants, the indices are into the array given to Cull()
+	const std::vector<ClusterRange>& GetClusterRanges() const { return mRanges; }
+	const std::vector<UINT>& GetLightIndices() const { return mIndices; }
+
+	UINT GetClusterIndex(UINT tileX, UINT tileY, UINT slice) const { return (slice * mTilesY + tileY) * mTilesX + tileX; }
+	// the slice a view space depth falls in, clamped to the grid
+	UINT GetSlice(float viewZ) const;
+
+private:
+	ClusteredLightCuller(const ClusteredLightCuller&);
+	ClusteredLightCuller& operator=(const ClusteredLightCuller&);
+
+	// a light moved into view space, with the cosine and sine of its cone worked out once
+	struct ViewLight
+	{
+		XMFLOAT3 position;
+		float	 range;
+		XMFLOAT3 direction;
+		float	 cosAngle;
+		float	 sinAngle;
+		bool	 spot;
+	};
+
+	// one light reaching one cluster of a slice, before they are grouped by cluster
+	struct Hit
+	{
+		UINT cluster; // within the slice
+		UINT light;
+	};
+
+	// what a slice job writes, kept between frames so culling doesn't allocate once it has warmed up
+	struct SliceOutput
+	{
+		std::vector<Hit>  hits;
+		std::vector<UINT> counts;
+		std::vector<UINT> indices;
+	};
+
+	void FreeClusters();
+	void CullSlice(UINT slice);
+
+	ClusterGridDesc	 mGrid;
+	ClusterConstants mConstants;
+	UINT			 mTilesX;
+	UINT			 mTilesY;
+	UINT			 mRowStride;   // mTilesX rounded up to a multiple of 4, the lanes past mTilesX never hit
+	UINT			 mClusterCount;
+	std::vector<float> mSliceDepths; // depthSlices + 1 boundaries, view space
+
+	// one 16 byte aligned block cut into arrays of depthSlices * mTilesY * mRowStride floats each
+	// a box per cluster, and a sphere around it for the spot light cone test
+	float* mMemory;
+	size_t mMemoryFloats;
+	float* mMinX;
+	float* mMinY;
+	float* mMinZ;
+	float* mMaxX;
+	float* mMaxY;
+	float* mMaxZ;
+	float* mCenterX;
+	float* mCenterY;
+	float* mCenterZ;
+	float* mRadius;
+	// a slice's x extent of each column of tiles and y extent of each row, lights only run the SSE test over the
+	// columns and rows they reach
+	std::vector<float> mColumnMinX;
+	std::vector<float> mColumnMaxX;
+	std::vector<float> mRowMinY;
+	std::vector<float> mRowMaxY;
+
+	std::vector<ViewLight>	 mLights;
+	std::vector<SliceOutput> mSlices;
+	std::vector<ClusterRange> mRanges;
+	std::vector<UINT>		 mIndices;
+};
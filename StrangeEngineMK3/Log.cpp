@@ -0,0 +1,748 @@
+#include "pch.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <new>
+
+// gives the singleton an initial value to clear up any unresolved externals
+Logger* Logger::singleton = nullptr;
+
+static std::once_flag gLoggerOnce;
+
+static const char* kLogLevelNames[LogLevel_Count] =
+{
+	"TRACE",
+	"DEBUG",
+	"INFO",
+	"WARNING",
+	"ERROR",
+};
+
+static const char* kLogCategoryNames[LogCategory_Count] =
+{
+	"engine",
+	"render",
+	"assets",
+	"input",
+	"jobs",
+	"physics",
+	"memory",
+	"game",
+};
+
+const char* GetLogLevelName(LogLevel level)
+{
+	return (level >= 0 && level < LogLevel_Count) ? kLogLevelNames[level] : "UNKNOWN";
+}
+
+const char* GetLogCategoryName(LogCategory category)
+{
+	return (category >= 0 && category < LogCategory_Count) ? kLogCategoryNames[category] : "unknown";
+}
+
+// the level byte of the filler a producer leaves when a record doesn't fit before the end of its ring
+static const BYTE kLogFiller = 0xFF;
+
+// numbers the threads in the order they first log, the numbers are what the console and .slog files show
+static UINT GetLogThreadId()
+{
+	static std::atomic<UINT> sNextThread(0);
+	static thread_local UINT tThread = sNextThread.fetch_add(1);
+	return tThread;
+}
+
+// ==============================================================
+//		formatting
+// ==============================================================
+
+// UTF-16 to UTF-8, done by hand so it works the same in the engine and the tools
+static void AppendWide(const wchar_t* text, UINT count, std::string* out)
+{
+	for (UINT i = 0; i < count; i++)
+	{
+		UINT c = (UINT)text[i];
+		if (c >= 0xD800 && c < 0xDC00 && i + 1 < count && (UINT)text[i + 1] >= 0xDC00 && (UINT)text[i + 1] < 0xE000)
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + ((UINT)text[i + 1] - 0xDC00);
+			i++;
+		}
+
+		if (c < 0x80)
+		{
+			out->push_back((char)c);
+		}
+		else if (c < 0x800)
+		{
+			out->push_back((char)(0xC0 | (c >> 6)));
+			out->push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000)
+		{
+			out->push_back((char)(0xE0 | (c >> 12)));
+			out->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			out->push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else
+		{
+			out->push_back((char)(0xF0 | (c >> 18)));
+			out->push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+			out->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			out->push_back((char)(0x80 | (c & 0x3F)));
+		}
+	}
+}
+
+// appends one encoded argument and returns where the next one starts, or nullptr when it isn't all there before 'end'
+static const BYTE* AppendArg(const BYTE* arg, const BYTE* end, std::string* out)
+{
+	char buffer[32];
+	if (arg >= end)
+		return nullptr;
+	LogArgType type = (LogArgType)arg[0];
+	arg++;
+	size_t left = (size_t)(end - arg);
+
+	switch (type)
+	{
+	case LogArg_Int:
+	{
+		INT64 value;
+		if (left < sizeof(value))
+			return nullptr;
+		memcpy(&value, arg, sizeof(value));
+		out->append(std::to_string(value));
+		return arg + sizeof(value);
+	}
+	case LogArg_UInt:
+	{
+		UINT64 value;
+		if (left < sizeof(value))
+			return nullptr;
+		memcpy(&value, arg, sizeof(value));
+		out->append(std::to_string(value));
+		return arg + sizeof(value);
+	}
+	case LogArg_Double:
+	{
+		double value;
+		if (left < sizeof(value))
+			return nullptr;
+		memcpy(&value, arg, sizeof(value));
+		snprintf(buffer, sizeof(buffer), "%g", value);
+		out->append(buffer);
+		return arg + sizeof(value);
+	}
+	case LogArg_Bool:
+		if (left < 1)
+			return nullptr;
+		out->append(arg[0] ? "true" : "false");
+		return arg + 1;
+	case LogArg_String:
+	case LogArg_WideString:
+	{
+		UINT count;
+		if (left < sizeof(count))
+			return nullptr;
+		memcpy(&count, arg, sizeof(count));
+		arg += sizeof(count);
+		left -= sizeof(count);
+		if (type == LogArg_String)
+		{
+			if (left < count)
+				return nullptr;
+			out->append((const char*)arg, count);
+			return arg + count;
+		}
+
+		if (left / sizeof(wchar_t) < count)
+			return nullptr;
+
+		// copied out, the record only guarantees 8 byte alignment for the record itself
+		std::wstring text(count, L'\0');
+		if (count)
+			memcpy(&text[0], arg, count * sizeof(wchar_t));
+		AppendWide(text.data(), count, out);
+		return arg + count * sizeof(wchar_t);
+	}
+	case LogArg_Pointer:
+	{
+		UINT64 value;
+		if (left < sizeof(value))
+			return nullptr;
+		memcpy(&value, arg, sizeof(value));
+		snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)value);
+		out->append(buffer);
+		return arg + sizeof(value);
+	}
+	}
+
+	// a record from a newer build, or garbage. there is no way to find the next argument
+	return nullptr;
+}
+
+bool FormatLogMessage(const char* format, const BYTE* args, const BYTE* argsEnd, UINT argCount, std::string* out)
+{
+	UINT used = 0;
+	for (const char* c = format; *c; c++)
+	{
+		if (c[0] == '{' && c[1] == '}' && used < argCount && args)
+		{
+			args = AppendArg(args, argsEnd, out);
+			if (!args)
+				out->append("<?>");
+			used++;
+			c++;
+		}
+		else
+		{
+			out->push_back(*c);
+		}
+	}
+	return args != nullptr;
+}
+
+// ==============================================================
+//		logger
+// ==============================================================
+
+LogSettings::LogSettings()
+{
+	console = true;
+	#if defined(DEBUG)||defined(_DEBUG)
+	consoleLevel = LogLevel_Debug;
+	#else
+	consoleLevel = LogLevel_Info;
+	#endif
+	ringBytes = 64 * 1024;
+}
+
+// one per thread that logs. the owning thread moves head forward, the writer thread moves tail after it
+// positions only ever grow, the offset in the ring is the position & mask
+struct alignas(64) Logger::Ring
+{
+	BYTE* data;
+	UINT  mask;
+	UINT  thread;
+
+	alignas(64) std::atomic<UINT64> head;
+	UINT64							reserved; // where the record being written starts
+
+	alignas(64) std::atomic<UINT64> tail;
+};
+
+// a record copied out of a ring, waiting to be sorted and written
+struct Logger::Pending
+{
+	INT64  time;
+	UINT   thread;
+	size_t offset; // into mDrainBuffer
+};
+
+Logger* Logger::Get()
+{
+	// never deleted on purpose, the engine logs while the DLL unloads
+	// the default settings don't open a file, so this Init can't report an error (and call back into Get)
+	std::call_once(gLoggerOnce, []()
+	{
+		singleton = new Logger();
+		singleton->Init(LogSettings());
+	});
+	return singleton;
+}
+
+Logger::Logger()
+{
+	for (UINT i = 0; i < LogCategory_Count; i++)
+	{
+		#if defined(DEBUG)||defined(_DEBUG)
+		mMinLevels[i] = LogLevel_Debug;
+		#else
+		mMinLevels[i] = LogLevel_Info;
+		#endif
+	}
+
+	mDropped = 0;
+	mDroppedReported = 0;
+	mRunning = false;
+	mQuit = false;
+	mFlushRequests = 0;
+	mFlushesDone = 0;
+
+	INT64 ticksPerSecond;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&ticksPerSecond);
+	QueryPerformanceCounter((LARGE_INTEGER*)&mStartTime);
+	mSecondsPerTick = 1.0 / (double)ticksPerSecond;
+}
+
+Logger::~Logger()
+{
+	Shutdown();
+}
+
+template<typename T> static void WriteValue(std::ostream& out, const T& value)
+{
+	out.write((const char*)&value, sizeof(T));
+}
+
+template<typename T> static bool ReadValue(std::istream& in, T* value)
+{
+	return (bool)in.read((char*)value, sizeof(T));
+}
+
+// .slog layout: 'SLOG', version, ticks per second, start ticks, then records that each start with a kind byte
+static const char kLogFileMagic[4] = { 'S', 'L', 'O', 'G' };
+static const UINT kLogFileVersion = 1;
+
+// far more than a message's arguments can take up in a ring, a record claiming more is garbage
+static const UINT kLogFileMaxArgBytes = 16 * 1024 * 1024;
+
+enum LogFileRecord
+{
+	LogFileRecord_Format = 1,  // UINT id, UINT length, the format string
+	LogFileRecord_Message = 2, // INT64 ticks, UINT thread, BYTE level, BYTE category, WORD argCount, UINT formatId, UINT argBytes, the args
+};
+
+void Logger::Init(const LogSettings& settings)
+{
+	Shutdown();
+
+	mSettings = settings;
+	// a power of 2 so the offset in the ring is a mask, and big enough for a few full length strings
+	UINT ringBytes = 8 * 1024;
+	while (ringBytes < mSettings.ringBytes)
+		ringBytes *= 2;
+	mSettings.ringBytes = ringBytes;
+
+	bool fileFailed = false;
+	mFormatIds.clear();
+	if (!mSettings.binaryPath.empty())
+	{
+		mBinary.open(mSettings.binaryPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (mBinary)
+		{
+			INT64 ticksPerSecond = (INT64)(1.0 / mSecondsPerTick + 0.5);
+			mBinary.write(kLogFileMagic, sizeof(kLogFileMagic));
+			WriteValue(mBinary, kLogFileVersion);
+			WriteValue(mBinary, ticksPerSecond);
+			WriteValue(mBinary, mStartTime);
+		}
+		else
+		{
+			fileFailed = true;
+		}
+	}
+
+	mQuit = false;
+	mRunning = true;
+	mWriter = std::thread(&Logger::WriterLoop, this);
+
+	if (fileFailed)
+		ReportError(LogCategory_Engine, "Could not open {} for the binary log", mSettings.binaryPath);
+}
+
+void Logger::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWriterMutex);
+		if (!mRunning)
+			return;
+		mQuit = true;
+	}
+	mWake.notify_one();
+	mWriter.join();
+
+	// only now, errors waiting for room in a full ring are still drained up to the join
+	mRunning = false;
+	if (mBinary.is_open())
+		mBinary.close();
+}
+
+void Logger::SetLevel(LogCategory category, LogLevel level)
+{
+	mMinLevels[category].store(level, std::memory_order_relaxed);
+}
+
+void Logger::SetLevel(LogLevel level)
+{
+	for (UINT i = 0; i < LogCategory_Count; i++)
+		mMinLevels[i].store(level, std::memory_order_relaxed);
+}
+
+Logger::Ring* Logger::GetRing()
+{
+	static thread_local Ring* tRing = nullptr;
+	if (tRing)
+		return tRing;
+
+	// new doesn't honour alignas(64) before C++17
+	void* memory = _aligned_malloc(sizeof(Ring), 64);
+	Ring* ring = new (memory) Ring();
+	ring->data = (BYTE*)_aligned_malloc(mSettings.ringBytes, 64);
+	ring->mask = mSettings.ringBytes - 1;
+	ring->thread = GetLogThreadId();
+	ring->head = 0;
+	ring->reserved = 0;
+	ring->tail = 0;
+	{
+		std::lock_guard<std::mutex> lock(mRingsMutex);
+		mRings.push_back(ring);
+	}
+	tRing = ring;
+	return ring;
+}
+
+BYTE* Logger::BeginRecord(UINT* size, LogLevel level)
+{
+	Ring* ring = GetRing();
+	UINT capacity = ring->mask + 1;
+	UINT recordSize = (*size + 7) & ~7u;
+	if (recordSize > capacity / 2)
+	{
+		mDropped.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	// a record is never split, if it doesn't fit before the end of the ring the rest of the ring is skipped
+	UINT64 head = ring->head.load(std::memory_order_relaxed);
+	UINT offset = (UINT)(head & ring->mask);
+	UINT filler = (capacity - offset < recordSize) ? capacity - offset : 0;
+
+	while (head + filler + recordSize - ring->tail.load(std::memory_order_acquire) > capacity)
+	{
+		// errors are worth waiting for, everything else is dropped rather than slow the thread down
+		if (level < LogLevel_Error || !mRunning)
+		{
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		mWake.notify_one();
+		std::this_thread::yield();
+	}
+
+	if (filler)
+	{
+		LogRecordHeader* header = (LogRecordHeader*)(ring->data + offset);
+		header->size = filler;
+		header->level = kLogFiller;
+		head += filler;
+		offset = 0;
+	}
+
+	ring->reserved = head;
+	LogRecordHeader* header = (LogRecordHeader*)(ring->data + offset);
+	header->size = recordSize;
+	QueryPerformanceCounter((LARGE_INTEGER*)&header->time);
+	*size = recordSize;
+	return ring->data + offset;
+}
+
+void Logger::CommitRecord(UINT size)
+{
+	Ring* ring = GetRing();
+	ring->head.store(ring->reserved + size, std::memory_order_release);
+}
+
+void Logger::Flush()
+{
+	std::unique_lock<std::mutex> lock(mWriterMutex);
+	if (!mRunning)
+		return;
+
+	UINT64 request = ++mFlushRequests;
+	mWake.notify_one();
+	mFlushed.wait(lock, [&]() { return mFlushesDone >= request; });
+}
+
+void Logger::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock(mWriterMutex);
+	for (;;)
+	{
+		// anything logged before these were read is drained below
+		UINT64 flushRequests = mFlushRequests;
+		bool quit = mQuit;
+
+		lock.unlock();
+		while (Drain())
+		{
+		}
+		lock.lock();
+
+		mFlushesDone = flushRequests;
+		mFlushed.notify_all();
+		if (quit)
+			break;
+
+		// woken early by Flush, Shutdown and errors waiting for room
+		if (mFlushRequests == mFlushesDone && !mQuit)
+			mWake.wait_for(lock, std::chrono::milliseconds(5));
+	}
+}
+
+bool Logger::Drain()
+{
+	std::vector<Ring*> rings;
+	{
+		std::lock_guard<std::mutex> lock(mRingsMutex);
+		rings = mRings;
+	}
+
+	// copied out first so the rings are free again as soon as possible
+	mDrainBuffer.clear();
+	mPending.clear();
+	for (Ring* ring : rings)
+	{
+		UINT64 tail = ring->tail.load(std::memory_order_relaxed);
+		UINT64 head = ring->head.load(std::memory_order_acquire);
+		while (tail < head)
+		{
+			const LogRecordHeader* header = (const LogRecordHeader*)(ring->data + (tail & ring->mask));
+			if (header->level != kLogFiller)
+			{
+				Pending pending;
+				pending.time = header->time;
+				pending.thread = ring->thread;
+				pending.offset = mDrainBuffer.size();
+				mDrainBuffer.insert(mDrainBuffer.end(), (const BYTE*)header, (const BYTE*)header + header->size);
+				mPending.push_back(pending);
+			}
+			tail += header->size;
+		}
+		ring->tail.store(tail, std::memory_order_release);
+	}
+
+	// the count goes in the log as a warning of its own
+	UINT64 dropped = mDropped.load(std::memory_order_relaxed);
+	if (dropped != mDroppedReported)
+	{
+		UINT64 count = dropped - mDroppedReported;
+		mDroppedReported = dropped;
+
+		UINT size = sizeof(LogRecordHeader) + LogEncodeArgs(nullptr, count);
+		size = (size + 7) & ~7u;
+		Pending pending;
+		QueryPerformanceCounter((LARGE_INTEGER*)&pending.time);
+		pending.thread = GetLogThreadId();
+		pending.offset = mDrainBuffer.size();
+		mDrainBuffer.resize(mDrainBuffer.size() + size);
+
+		LogRecordHeader* header = (LogRecordHeader*)&mDrainBuffer[pending.offset];
+		header->size = size;
+		header->level = LogLevel_Warning;
+		header->category = LogCategory_Engine;
+		header->argCount = 1;
+		header->time = pending.time;
+		header->format = "{} log messages were dropped, a ring buffer was full";
+		LogEncodeArgs((BYTE*)(header + 1), count);
+		mPending.push_back(pending);
+	}
+
+	if (mPending.empty())
+		return false;
+
+	// each ring is in order already, this interleaves the threads
+	std::stable_sort(mPending.begin(), mPending.end(), [](const Pending& a, const Pending& b) { return a.time < b.time; });
+	for (const Pending& pending : mPending)
+		WriteMessage(pending);
+
+	if (mSettings.console)
+		std::cout.flush();
+	if (mBinary.is_open())
+		mBinary.flush();
+	return true;
+}
+
+void Logger::WriteMessage(const Pending& message)
+{
+	const LogRecordHeader* header = (const LogRecordHeader*)&mDrainBuffer[message.offset];
+	const BYTE* args = (const BYTE*)(header + 1);
+
+	if (mSettings.console && header->level >= mSettings.consoleLevel)
+	{
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "[%9.3f][%s][%s]: ", (header->time - mStartTime) * mSecondsPerTick,
+			GetLogCategoryName((LogCategory)header->category), GetLogLevelName((LogLevel)header->level));
+
+		mLine = prefix;
+		FormatLogMessage(header->format, args, (const BYTE*)header + header->size, header->argCount, &mLine);
+		mLine.push_back('\n');
+		std::cout << mLine;
+	}
+
+	if (mBinary.is_open())
+	{
+		// each format string is written once, the first time it is used, and referred to by id after that
+		auto found = std::lower_bound(mFormatIds.begin(), mFormatIds.end(), header->format,
+			[](const std::pair<const char*, UINT>& entry, const char* format) { return entry.first < format; });
+		UINT formatId;
+		if (found != mFormatIds.end() && found->first == header->format)
+		{
+			formatId = found->second;
+		}
+		else
+		{
+			formatId = (UINT)mFormatIds.size();
+			mFormatIds.insert(found, std::make_pair(header->format, formatId));
+
+			UINT length = (UINT)strlen(header->format);
+			WriteValue(mBinary, (BYTE)LogFileRecord_Format);
+			WriteValue(mBinary, formatId);
+			WriteValue(mBinary, length);
+			mBinary.write(header->format, length);
+		}
+
+		UINT argBytes = header->size - sizeof(LogRecordHeader);
+		WriteValue(mBinary, (BYTE)LogFileRecord_Message);
+		WriteValue(mBinary, header->time);
+		WriteValue(mBinary, message.thread);
+		WriteValue(mBinary, header->level);
+		WriteValue(mBinary, header->category);
+		WriteValue(mBinary, header->argCount);
+		WriteValue(mBinary, formatId);
+		WriteValue(mBinary, argBytes);
+		mBinary.write((const char*)args, argBytes);
+	}
+}
+
+// ==============================================================
+//		.slog reader
+// ==============================================================
+
+LogFileReader::LogFileReader()
+{
+	mSecondsPerTick = 0.0;
+	mStartTime = 0;
+}
+
+LogFileReader::~LogFileReader()
+{
+	Close();
+}
+
+bool LogFileReader::Open(const char* path)
+{
+	Close();
+	mFile.open(path, std::ios::binary);
+	if (!mFile)
+	{
+		ReportError(LogCategory_Engine, "Could not open {}", path);
+		return false;
+	}
+
+	char magic[4];
+	UINT version = 0;
+	INT64 ticksPerSecond = 0;
+	if (!mFile.read(magic, sizeof(magic)) || memcmp(magic, kLogFileMagic, sizeof(magic)) != 0 ||
+		!ReadValue(mFile, &version) || version != kLogFileVersion ||
+		!ReadValue(mFile, &ticksPerSecond) || ticksPerSecond <= 0 || !ReadValue(mFile, &mStartTime))
+	{
+		ReportError(LogCategory_Engine, "{} is not a version {} StrangeEngine log", path, kLogFileVersion);
+		Close();
+		return false;
+	}
+
+	mSecondsPerTick = 1.0 / (double)ticksPerSecond;
+	return true;
+}
+
+void LogFileReader::Close()
+{
+	if (mFile.is_open())
+		mFile.close();
+	mFile.clear();
+	mFormats.clear();
+}
+
+bool LogFileReader::Next(LogMessage* message)
+{
+	for (;;)
+	{
+		BYTE kind;
+		if (!ReadValue(mFile, &kind))
+			return false;
+
+		if (kind == LogFileRecord_Format)
+		{
+			UINT id, length;
+			if (!ReadValue(mFile, &id) || !ReadValue(mFile, &length) || id > mFormats.size() + 1024)
+				return false;
+			if (id >= mFormats.size())
+				mFormats.resize(id + 1);
+			mFormats[id].resize(length);
+			if (length && !mFile.read(&mFormats[id][0], length))
+				return false;
+		}
+		else if (kind == LogFileRecord_Message)
+		{
+			INT64 time;
+			UINT thread, formatId, argBytes;
+			BYTE level, category;
+			WORD argCount;
+			if (!ReadValue(mFile, &time) || !ReadValue(mFile, &thread) || !ReadValue(mFile, &level) ||
+				!ReadValue(mFile, &category) || !ReadValue(mFile, &argCount) || !ReadValue(mFile, &formatId) ||
+				!ReadValue(mFile, &argBytes) || formatId >= mFormats.size() || argBytes > kLogFileMaxArgBytes)
+			{
+				return false;
+			}
+
+			// one spare byte so a message without arguments still has a valid pointer
+			mArgs.resize(argBytes + 1);
+			if (argBytes && !mFile.read((char*)mArgs.data(), argBytes))
+				return false;
+
+			message->seconds = (time - mStartTime) * mSecondsPerTick;
+			message->thread = thread;
+			message->level = (LogLevel)level;
+			message->category = (LogCategory)category;
+			message->text.clear();
+			if (FormatLogMessage(mFormats[formatId].c_str(), mArgs.data(), mArgs.data() + argBytes, argCount, &message->text))
+				return true;
+
+			// the arguments don't add up to what the record says it holds, the next record still starts after them
+			LOG_WARNING(LogCategory_Engine, "skipped a corrupt log record");
+		}
+		else
+		{
+			// not something this version wrote, nothing after it can be trusted
+			return false;
+		}
+	}
+}
+
+// ==============================================================
+//		errors
+// ==============================================================
+
+static std::mutex gEngineErrorMutex;
+static EngineError gEngineError;
+static bool gHasEngineError = false;
+
+void SetEngineError(LogCategory category, const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(gEngineErrorMutex);
+	gEngineError.category = category;
+	gEngineError.message = message;
+	gEngineError.thread = GetLogThreadId();
+	gHasEngineError = true;
+}
+
+bool HasEngineError()
+{
+	std::lock_guard<std::mutex> lock(gEngineErrorMutex);
+	return gHasEngineError;
+}
+
+EngineError GetEngineError()
+{
+	std::lock_guard<std::mutex> lock(gEngineErrorMutex);
+	return gEngineError;
+}
+
+void ClearEngineError()
+{
+	std::lock_guard<std::mutex> lock(gEngineErrorMutex);
+	gEngineError = EngineError();
+	gHasEngineError = false;
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		logging
+// ==============================================================
+//
+// LOG_INFO(LogCategory_Render, "swap chain is {} x {}", width, height);
+// a log call copies the format string's address and its arguments into the calling thread's own ring buffer and
+// returns, that is all the hot path does: no locks, no formatting, no I/O. a background thread picks the messages
+// up, puts them in time order, formats them and writes them to the console and/or a binary .slog file
+// (StrangeEngineMK3_Tools decode turns one back into text). the format string has to outlive the logger,
+// in practice it must be a string literal. every {} is replaced by the next argument
+
+enum LogLevel
+{
+	LogLevel_Trace,
+	LogLevel_Debug,
+	LogLevel_Info,
+	LogLevel_Warning,
+	LogLevel_Error,
+
+	LogLevel_Count
+};
+
+enum LogCategory
+{
+	LogCategory_Engine,
+	LogCategory_Render,
+	LogCategory_Assets,
+	LogCategory_Input,
+	LogCategory_Jobs,
+	LogCategory_Physics,
+	LogCategory_Memory,
+	LogCategory_Game,
+
+	LogCategory_Count
+};
+
+// anything below this level is compiled out completely, define it before including Log.h to change it
+#ifndef LOG_COMPILE_LEVEL
+#if defined(DEBUG)||defined(_DEBUG)
+#define LOG_COMPILE_LEVEL LogLevel_Trace
+#else
+#define LOG_COMPILE_LEVEL LogLevel_Info
+#endif
+#endif
+
+// one bit per LogCategory, categories left out are compiled out
+#ifndef LOG_COMPILE_CATEGORIES
+#define LOG_COMPILE_CATEGORIES 0xFFFFFFFFu
+#endif
+
+#define LOG(level, category, ...) \
+	do \
+	{ \
+		if ((level) >= LOG_COMPILE_LEVEL && ((LOG_COMPILE_CATEGORIES >> (category)) & 1u) && Logger::Get()->IsEnabled(level, category)) \
+			Logger::Get()->Write(level, category, __VA_ARGS__); \
+	} while (0)
+
+#define LOG_TRACE(category, ...)   LOG(LogLevel_Trace, category, __VA_ARGS__)
+#define LOG_DEBUG(category, ...)   LOG(LogLevel_Debug, category, __VA_ARGS__)
+#define LOG_INFO(category, ...)	   LOG(LogLevel_Info, category, __VA_ARGS__)
+#define LOG_WARNING(category, ...) LOG(LogLevel_Warning, category, __VA_ARGS__)
+#define LOG_ERROR(category, ...)   LOG(LogLevel_Error, category, __VA_ARGS__)
+
+STRANGEENGINEMK3_API const char* GetLogLevelName(LogLevel level);
+STRANGEENGINEMK3_API const char* GetLogCategoryName(LogCategory category);
+
+// ==== arguments ====
+// each argument is stored as a type byte and its value, strings are copied (up to kLogMaxString characters)
+// so they can change or go away as soon as the call returns
+
+enum LogArgType
+{
+	LogArg_Int,
+	LogArg_UInt,
+	LogArg_Double,
+	LogArg_Bool,
+	LogArg_String,	   // UINT length, then the chars
+	LogArg_WideString, // UINT length, then UTF-16, turned into UTF-8 when formatted
+	LogArg_Pointer,
+};
+
+static const UINT kLogMaxString = 1024;
+
+// the Put functions measure when 'out' is nullptr and write when it isn't
+inline UINT LogPutValue(BYTE* out, LogArgType type, const void* value, UINT size)
+{
+	if (out)
+	{
+		out[0] = (BYTE)type;
+		memcpy(out + 1, value, size);
+	}
+	return 1 + size;
+}
+
+inline UINT LogPutText(BYTE* out, LogArgType type, const void* text, size_t length, UINT charSize)
+{
+	UINT count = (UINT)(length < kLogMaxString ? length : kLogMaxString);
+	if (out)
+	{
+		out[0] = (BYTE)type;
+		memcpy(out + 1, &count, sizeof(count));
+		memcpy(out + 1 + sizeof(count), text, count * charSize);
+	}
+	return 1 + sizeof(count) + count * charSize;
+}
+
+inline UINT LogEncodeInt(BYTE* out, INT64 value)   { return LogPutValue(out, LogArg_Int, &value, sizeof(value)); }
+inline UINT LogEncodeUInt(BYTE* out, UINT64 value) { return LogPutValue(out, LogArg_UInt, &value, sizeof(value)); }
+
+inline UINT LogEncodeArg(BYTE* out, bool value)				  { BYTE b = value ? 1 : 0; return LogPutValue(out, LogArg_Bool, &b, 1); }
+inline UINT LogEncodeArg(BYTE* out, char value)				  { return LogPutText(out, LogArg_String, &value, 1, 1); }
+inline UINT LogEncodeArg(BYTE* out, signed char value)		  { return LogEncodeInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, short value)			  { return LogEncodeInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, int value)				  { return LogEncodeInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, long value)				  { return LogEncodeInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, long long value)		  { return LogEncodeInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, unsigned char value)	  { return LogEncodeUInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, unsigned short value)	  { return LogEncodeUInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, unsigned int value)		  { return LogEncodeUInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, unsigned long value)	  { return LogEncodeUInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, unsigned long long value) { return LogEncodeUInt(out, value); }
+inline UINT LogEncodeArg(BYTE* out, double value)			  { return LogPutValue(out, LogArg_Double, &value, sizeof(value)); }
+inline UINT LogEncodeArg(BYTE* out, float value)			  { return LogEncodeArg(out, (double)value); }
+inline UINT LogEncodeArg(BYTE* out, const void* value)		  { UINT64 address = (UINT64)(size_t)value; return LogPutValue(out, LogArg_Pointer, &address, sizeof(address)); }
+inline UINT LogEncodeArg(BYTE* out, const char* value)		  { return value ? LogPutText(out, LogArg_String, value, strlen(value), 1) : LogPutText(out, LogArg_String, "(null)", 6, 1); }
+inline UINT LogEncodeArg(BYTE* out, const std::string& value) { return LogPutText(out, LogArg_String, value.data(), value.size(), 1); }
+inline UINT LogEncodeArg(BYTE* out, const wchar_t* value)	  { return value ? LogPutText(out, LogArg_WideString, value, wcslen(value), sizeof(wchar_t)) : LogEncodeArg(out, "(null)"); }
+inline UINT LogEncodeArg(BYTE* out, const std::wstring& value) { return LogPutText(out, LogArg_WideString, value.data(), value.size(), sizeof(wchar_t)); }
+
+// enums are logged as their number
+template<typename T> inline typename std::enable_if<std::is_enum<T>::value, UINT>::type LogEncodeArg(BYTE* out, T value)
+{
+	return LogEncodeInt(out, (INT64)value);
+}
+
+inline UINT LogEncodeArgs(BYTE*) { return 0; }
+
+template<typename T, typename... Rest> inline UINT LogEncodeArgs(BYTE* out, const T& first, const Rest&... rest)
+{
+	UINT size = LogEncodeArg(out, first);
+	return size + LogEncodeArgs(out ? out + size : nullptr, rest...);
+}
+
+// replaces each {} in 'format' with the next of the 'argCount' encoded arguments, which all have to be before 'argsEnd'.
+// false when they aren't, or aren't arguments at all, the rest come out as <?>
+STRANGEENGINEMK3_API bool FormatLogMessage(const char* format, const BYTE* args, const BYTE* argsEnd, UINT argCount, std::string* out);
+
+// ==== logger ====
+
+struct LogSettings
+{
+	bool		console;	  // formatted lines on stdout
+	LogLevel	consoleLevel; // the console can be quieter than the file
+	std::string binaryPath;	  // empty for no .slog file
+	UINT		ringBytes;	  // per thread, a power of 2. a thread that fills it faster than it is emptied drops messages
+
+	LogSettings();
+};
+
+// what is in the ring buffers ahead of the arguments
+struct LogRecordHeader
+{
+	UINT		size;	   // of the whole record, header included, a multiple of 8
+	BYTE		level;	   // 0xFF for the filler before the ring wraps
+	BYTE		category;
+	WORD		argCount;
+	INT64		time;	   // QueryPerformanceCounter ticks
+	const char* format;
+};
+
+class STRANGEENGINEMK3_API Logger
+{
+public:
+	// started with the default LogSettings the first time it is asked for
+	static Logger* Get();
+
+	void Init(const LogSettings& settings);
+	// everything logged so far is written out before it returns
+	void Shutdown();
+
+	bool IsEnabled(LogLevel level, LogCategory category) const
+	{
+		return (int)level >= mMinLevels[category].load(std::memory_order_relaxed);
+	}
+	// turn a category down (or up) while running, LOG_COMPILE_LEVEL still wins
+	void SetLevel(LogCategory category, LogLevel level);
+	void SetLevel(LogLevel level); // every category
+
+	template<typename... Args> void Write(LogLevel level, LogCategory category, const char* format, const Args&... args)
+	{
+		UINT size = sizeof(LogRecordHeader) + LogEncodeArgs(nullptr, args...);
+		BYTE* record = BeginRecord(&size, level);
+		if (!record)
+			return;
+
+		LogRecordHeader* header = (LogRecordHeader*)record;
+		header->level = (BYTE)level;
+		header->category = (BYTE)category;
+		header->argCount = (WORD)sizeof...(Args);
+		header->format = format;
+		LogEncodeArgs(record + sizeof(LogRecordHeader), args...);
+		CommitRecord(size);
+	}
+
+	// blocks until everything logged before the call has been written
+	void Flush();
+
+	// messages thrown away because a thread's ring buffer was full
+	UINT64 GetDroppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+	Logger();
+	~Logger();
+
+	struct Ring;
+	struct Pending;
+
+	// reserves room for a record of '*size' bytes (rounded up to 8) and fills in its size and time,
+	// nullptr if there is no room. errors wait for room instead of being dropped
+	BYTE* BeginRecord(UINT* size, LogLevel level);
+	void CommitRecord(UINT size);
+	Ring* GetRing();
+
+	void WriterLoop();
+	// moves every complete record out of the rings and writes them in time order, false if there were none
+	bool Drain();
+	void WriteMessage(const Pending& message);
+
+	static Logger* singleton;
+
+	std::atomic<int>	mMinLevels[LogCategory_Count];
+	LogSettings			mSettings;
+	std::atomic<UINT64> mDropped;
+	UINT64				mDroppedReported;
+	INT64				mStartTime;
+	double				mSecondsPerTick;
+
+	std::mutex		   mRingsMutex;
+	std::vector<Ring*> mRings; // never freed, a thread can still be logging while the logger shuts down
+
+	std::thread				mWriter;
+	std::mutex				mWriterMutex;
+	std::condition_variable mWake;
+	std::condition_variable mFlushed;
+	bool					mQuit;
+	std::atomic<bool>		mRunning; // read by threads waiting for room
+	UINT64					mFlushRequests; // Flush() bumps it and waits for mFlushesDone to catch up
+	UINT64					mFlushesDone;
+
+	// writer thread only
+	std::vector<BYTE>	 mDrainBuffer;
+	std::vector<Pending> mPending;
+	std::string			 mLine;
+	std::ofstream		 mBinary;
+	std::vector<std::pair<const char*, UINT>> mFormatIds; // sorted by address
+};
+
+// ==== .slog files ====
+
+struct LogMessage
+{
+	double		seconds; // since the logger started
+	UINT		thread;	 // 0 is the first thread that logged
+	LogLevel	level;
+	LogCategory category;
+	std::string text;
+};
+
+// reads a binary log back, e.g. for StrangeEngineMK3_Tools decode
+class STRANGEENGINEMK3_API LogFileReader
+{
+public:
+	LogFileReader();
+	~LogFileReader();
+
+	// false (and an error reported) if it isn't a .slog file
+	bool Open(const char* path);
+	void Close();
+
+	// false at the end of the file (or where a crash cut it off)
+	bool Next(LogMessage* message);
+
+private:
+	LogFileReader(const LogFileReader&);
+	LogFileReader& operator=(const LogFileReader&);
+
+	std::ifstream			 mFile;
+	double					 mSecondsPerTick;
+	INT64					 mStartTime;
+	std::vector<std::string> mFormats; // by id
+	std::vector<BYTE>		 mArgs;
+};
+
+// ==== errors ====
+// replaces the old gLastError string: the engine reports what went wrong with its category, it is logged as an error
+// and kept as the last error until cleared. safe from any thread
+
+struct EngineError
+{
+	LogCategory category;
+	std::string message;
+	UINT		thread;	 // the id the logger gave the reporting thread
+};
+
+STRANGEENGINEMK3_API void SetEngineError(LogCategory category, const std::string& message);
+STRANGEENGINEMK3_API bool HasEngineError();
+STRANGEENGINEMK3_API EngineError GetEngineError();
+STRANGEENGINEMK3_API void ClearEngineError();
+
+// logs it at LogLevel_Error and makes it the last error, formatted like a log message
+template<typename... Args> void ReportError(LogCategory category, const char* format, const Args&... args)
+{
+	LOG_ERROR(category, format, args...);
+
+	std::vector<BYTE> encoded(LogEncodeArgs(nullptr, args...) + 1);
+	LogEncodeArgs(encoded.data(), args...);
+	std::string message;
+	FormatLogMessage(format, encoded.data(), encoded.data() + encoded.size(), (UINT)sizeof...(Args), &message);
+	SetEngineError(category, message);
+}
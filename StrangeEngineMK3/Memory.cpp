@@ -0,0 +1,691 @@
+#include "pch.h"
+#include "Memory.h"
+#include "Log.h"
+#include <intrin.h>
+#include <algorithm>
+#include <cstring>
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// ==============================================================
+//		LinearAllocator
+// ==============================================================
+
+LinearAllocator::LinearAllocator()
+{
+	mMemory = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+	mPeak = 0;
+}
+
+LinearAllocator::~LinearAllocator()
+{
+	Release();
+}
+
+bool LinearAllocator::Init(size_t capacity)
+{
+	Release();
+
+	mMemory = (BYTE*)_aligned_malloc(std::max<size_t>(capacity, 64), 64);
+	if (!mMemory)
+	{
+		ReportError(LogCategory_Memory, "Could not allocate {} bytes for a linear allocator", capacity);
+		return false;
+	}
+	mCapacity = capacity;
+	return true;
+}
+
+void LinearAllocator::Release()
+{
+	_aligned_free(mMemory);
+	mMemory = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+	mPeak = 0;
+}
+
+void* LinearAllocator::Allocate(size_t size, size_t alignment)
+{
+	// aligned by address rather than offset so alignments above the block's own 64 work too
+	size_t base = (size_t)mMemory;
+	size_t used = mUsed.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		size_t start = AlignUp(base + used, alignment) - base;
+		if (start > mCapacity || size > mCapacity - start)
+			return nullptr;
+		if (mUsed.compare_exchange_weak(used, start + size, std::memory_order_relaxed))
+			return mMemory + start;
+	}
+}
+
+void LinearAllocator::Rewind(size_t marker)
+{
+	size_t used = mUsed.load(std::memory_order_relaxed);
+	mPeak = std::max(mPeak, used);
+	if (marker < used)
+		mUsed.store(marker, std::memory_order_relaxed);
+}
+
+// ==============================================================
+//		PoolAllocator
+// ==============================================================
+
+PoolAllocator::PoolAllocator()
+{
+	mFreeList = nullptr;
+	mBlockSize = 0;
+	mBlocksPerPage = 0;
+	mAlignment = 16;
+	mAllocatedCount = 0;
+}
+
+PoolAllocator::~PoolAllocator()
+{
+	Release();
+}
+
+void PoolAllocator::Init(size_t blockSize, size_t blocksPerPage, size_t alignment)
+{
+	Release();
+	mAlignment = std::max<size_t>(alignment, sizeof(void*));
+	mBlockSize = AlignUp(std::max(blockSize, sizeof(void*)), mAlignment);
+	mBlocksPerPage = std::max<size_t>(blocksPerPage, 1);
+}
+
+void PoolAllocator::Release()
+{
+	for (BYTE* page : mPages)
+		_aligned_free(page);
+	mPages.clear();
+	mFreeList = nullptr;
+	mAllocatedCount = 0;
+}
+
+bool PoolAllocator::AddPage()
+{
+	BYTE* page = (BYTE*)_aligned_malloc(mBlockSize * mBlocksPerPage, mAlignment);
+	if (!page)
+	{
+		ReportError(LogCategory_Memory, "Could not allocate a page of {} pool blocks", mBlocksPerPage);
+		return false;
+	}
+	mPages.push_back(page);
+
+	// threaded back to front so the blocks are handed out in address order
+	for (size_t i = mBlocksPerPage; i-- > 0;)
+	{
+		void* block = page + i * mBlockSize;
+		*(void**)block = mFreeList;
+		mFreeList = block;
+	}
+	return true;
+}
+
+void* PoolAllocator::Allocate()
+{
+	if (!mFreeList && !AddPage())
+		return nullptr;
+
+	void* block = mFreeList;
+	mFreeList = *(void**)block;
+	mAllocatedCount++;
+	return block;
+}
+
+void PoolAllocator::Free(void* p)
+{
+	if (!p)
+		return;
+
+	*(void**)p = mFreeList;
+	mFreeList = p;
+	mAllocatedCount--;
+}
+
+// ==============================================================
+//		TlsfAllocator
+// ==============================================================
+//
+// every block starts with a 16 byte header holding the block physically before it and its own payload size.
+// a free block also keeps its free list links in the first bytes of its payload. the last 16 bytes of the
+// memory are an empty block that is never free, so walking to the next block never runs off the end
+
+struct TlsfAllocator::Block
+{
+	Block* prevPhysical; // nullptr for the first block
+	size_t size;		 // of the payload, bit 0 is set while the block is free
+#if !defined(_WIN64)
+	UINT   padding[2];	 // the header is 16 bytes on 32 bit builds too, so every payload stays 16 byte aligned
+#endif
+	// only while the block is free
+	Block* nextFree;
+	Block* prevFree;
+};
+
+static const size_t kTlsfHeaderSize = 16;
+static const size_t kTlsfMinPayload = 16; // room for the free list links
+static const size_t kTlsfFreeBit = 1;
+
+static UINT HighestBit(size_t value)
+{
+	unsigned long index;
+#if defined(_WIN64)
+	_BitScanReverse64(&index, (unsigned __int64)value); // unsigned long is 32 bits on Windows
+#else
+	_BitScanReverse(&index, (unsigned long)value);
+#endif
+	return (UINT)index;
+}
+
+static UINT LowestBit(UINT value)
+{
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (UINT)index;
+}
+
+size_t TlsfAllocator::BlockSize(const Block* block)
+{
+	return block->size & ~kTlsfFreeBit;
+}
+
+bool TlsfAllocator::IsFree(const Block* block)
+{
+	return (block->size & kTlsfFreeBit) != 0;
+}
+
+BYTE* TlsfAllocator::Payload(Block* block)
+{
+	return (BYTE*)block + kTlsfHeaderSize;
+}
+
+TlsfAllocator::Block* TlsfAllocator::NextPhysical(Block* block)
+{
+	return (Block*)(Payload(block) + BlockSize(block));
+}
+
+TlsfAllocator::TlsfAllocator()
+{
+	mMemory = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+	mFlBitmap = 0;
+	memset(mSlBitmap, 0, sizeof(mSlBitmap));
+	memset(mFreeLists, 0, sizeof(mFreeLists));
+}
+
+TlsfAllocator::~TlsfAllocator()
+{
+	Release();
+}
+
+bool TlsfAllocator::Init(size_t capacity)
+{
+	Release();
+	static_assert(offsetof(Block, nextFree) == kTlsfHeaderSize, "the free list links have to start the payload");
+
+	// the size classes stop at 4GB
+	capacity = std::min<size_t>(capacity, 0xFFFFFFF0u) & ~(size_t)15;
+	if (capacity < 4 * kTlsfHeaderSize)
+	{
+		ReportError(LogCategory_Memory, "A TLSF allocator needs at least {} bytes", 4 * kTlsfHeaderSize);
+		return false;
+	}
+
+	mMemory = (BYTE*)_aligned_malloc(capacity, 64);
+	if (!mMemory)
+	{
+		ReportError(LogCategory_Memory, "Could not allocate {} bytes for a TLSF allocator", capacity);
+		return false;
+	}
+	mCapacity = capacity;
+
+	// one free block over everything, then the sentinel
+	Block* first = (Block*)mMemory;
+	first->prevPhysical = nullptr;
+	first->size = capacity - 2 * kTlsfHeaderSize;
+	Block* sentinel = NextPhysical(first);
+	sentinel->prevPhysical = first;
+	sentinel->size = 0;
+	InsertFree(first);
+	return true;
+}
+
+void TlsfAllocator::Release()
+{
+	_aligned_free(mMemory);
+	mMemory = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+	mFlBitmap = 0;
+	memset(mSlBitmap, 0, sizeof(mSlBitmap));
+	memset(mFreeLists, 0, sizeof(mFreeLists));
+}
+
+void TlsfAllocator::MapSize(size_t size, UINT* fl, UINT* sl) const
+{
+	if (size < ((size_t)1 << kFlShift))
+	{
+		*fl = 0;
+		*sl = (UINT)(size >> kAlignShift);
+		return;
+	}
+
+	// the top bit picks the first level, the kSlBits under it the second
+	UINT top = HighestBit(size);
+	*fl = top - (kFlShift - 1);
+	*sl = (UINT)(size >> (top - kSlBits)) ^ kSlCount;
+}
+
+TlsfAllocator::Block* TlsfAllocator::FindFree(size_t size)
+{
+	// rounded up to the next size class, so any block in the list found is big enough. too big is checked first so
+	// the rounding can't overflow
+	if (size >= mCapacity)
+		return nullptr;
+	if (size >= ((size_t)1 << kFlShift))
+		size += ((size_t)1 << (HighestBit(size) - kSlBits)) - 1;
+	if (size >= mCapacity)
+		return nullptr;
+
+	UINT fl, sl;
+	MapSize(size, &fl, &sl);
+
+	UINT slMap = mSlBitmap[fl] & (~0u << sl);
+	if (!slMap)
+	{
+		// nothing in this power of two, take the smallest list of any bigger one
+		UINT flMap = mFlBitmap & (~0u << (fl + 1));
+		if (!flMap)
+			return nullptr;
+		fl = LowestBit(flMap);
+		slMap = mSlBitmap[fl];
+	}
+	sl = LowestBit(slMap);
+	return mFreeLists[fl][sl];
+}
+
+void TlsfAllocator::InsertFree(Block* block)
+{
+	UINT fl, sl;
+	MapSize(BlockSize(block), &fl, &sl);
+
+	block->size |= kTlsfFreeBit;
+	block->prevFree = nullptr;
+	block->nextFree = mFreeLists[fl][sl];
+	if (block->nextFree)
+		block->nextFree->prevFree = block;
+	mFreeLists[fl][sl] = block;
+
+	mFlBitmap |= 1u << fl;
+	mSlBitmap[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::RemoveFree(Block* block)
+{
+	UINT fl, sl;
+	MapSize(BlockSize(block), &fl, &sl);
+
+	if (block->prevFree)
+		block->prevFree->nextFree = block->nextFree;
+	else
+		mFreeLists[fl][sl] = block->nextFree;
+	if (block->nextFree)
+		block->nextFree->prevFree = block->prevFree;
+
+	if (!mFreeLists[fl][sl])
+	{
+		mSlBitmap[fl] &= ~(1u << sl);
+		if (!mSlBitmap[fl])
+			mFlBitmap &= ~(1u << fl);
+	}
+	block->size &= ~kTlsfFreeBit;
+}
+
+TlsfAllocator::Block* TlsfAllocator::SplitBlock(Block* block, size_t size)
+{
+	// only worth it if what's left can be a block of its own
+	size_t total = BlockSize(block);
+	if (total < size + kTlsfHeaderSize + kTlsfMinPayload)
+		return nullptr;
+
+	Block* rest = (Block*)(Payload(block) + size);
+	rest->prevPhysical = block;
+	rest->size = total - size - kTlsfHeaderSize;
+	block->size = size | (block->size & kTlsfFreeBit);
+	NextPhysical(rest)->prevPhysical = rest;
+	return rest;
+}
+
+TlsfAllocator::Block* TlsfAllocator::MergeWithNeighbours(Block* block)
+{
+	Block* next = NextPhysical(block);
+	if (IsFree(next))
+	{
+		RemoveFree(next);
+		block->size = (BlockSize(block) + kTlsfHeaderSize + BlockSize(next)) | (block->size & kTlsfFreeBit);
+		NextPhysical(block)->prevPhysical = block;
+	}
+
+	Block* prev = block->prevPhysical;
+	if (prev && IsFree(prev))
+	{
+		RemoveFree(prev);
+		prev->size = BlockSize(prev) + kTlsfHeaderSize + BlockSize(block);
+		NextPhysical(prev)->prevPhysical = prev;
+		block = prev;
+	}
+	return block;
+}
+
+void* TlsfAllocator::Allocate(size_t size, size_t alignment)
+{
+	if (!mMemory)
+		return nullptr;
+	size = AlignUp(std::max(size, kTlsfMinPayload), (size_t)1 << kAlignShift);
+
+	Block* block;
+	if (alignment <= ((size_t)1 << kAlignShift))
+	{
+		block = FindFree(size);
+		if (!block)
+			return nullptr;
+		RemoveFree(block);
+	}
+	else
+	{
+		// enough extra to slide the payload up to the alignment and leave a free block of its own in front
+		block = FindFree(size + alignment + kTlsfHeaderSize + kTlsfMinPayload);
+		if (!block)
+			return nullptr;
+		RemoveFree(block);
+
+		size_t payload = (size_t)Payload(block);
+		size_t aligned = AlignUp(payload, alignment);
+		if (aligned != payload && aligned - payload < kTlsfHeaderSize + kTlsfMinPayload)
+			aligned = AlignUp(payload + kTlsfHeaderSize + kTlsfMinPayload, alignment);
+
+		if (aligned != payload)
+		{
+			Block* front = block;
+			block = (Block*)(aligned - kTlsfHeaderSize);
+			block->prevPhysical = front;
+			block->size = BlockSize(front) - (aligned - payload);
+			front->size = aligned - payload - kTlsfHeaderSize;
+			NextPhysical(block)->prevPhysical = block;
+			InsertFree(front);
+		}
+	}
+
+	Block* rest = SplitBlock(block, size);
+	if (rest)
+		InsertFree(rest);
+
+	mUsed += BlockSize(block) + kTlsfHeaderSize;
+	return Payload(block);
+}
+
+void TlsfAllocator::Free(void* p)
+{
+	if (!p)
+		return;
+
+	Block* block = (Block*)((BYTE*)p - kTlsfHeaderSize);
+	mUsed -= BlockSize(block) + kTlsfHeaderSize;
+	InsertFree(MergeWithNeighbours(block));
+}
+
+size_t TlsfAllocator::GetAllocationSize(const void* p)
+{
+	return p ? BlockSize((const Block*)((const BYTE*)p - kTlsfHeaderSize)) : 0;
+}
+
+bool TlsfAllocator::Validate() const
+{
+	if (!mMemory)
+		return true;
+
+	// every block links back to the one before it, no two free blocks touch, and each free one is in its list
+	size_t freeBlocks = 0;
+	Block* prev = nullptr;
+	Block* block = (Block*)mMemory;
+	while ((BYTE*)block < mMemory + mCapacity - kTlsfHeaderSize)
+	{
+		if (block->prevPhysical != prev)
+			return false;
+		if (IsFree(block))
+		{
+			if (prev && IsFree(prev))
+				return false;
+
+			UINT fl, sl;
+			MapSize(BlockSize(block), &fl, &sl);
+			Block* listed = mFreeLists[fl][sl];
+			while (listed && listed != block)
+				listed = listed->nextFree;
+			if (!listed)
+				return false;
+			freeBlocks++;
+		}
+		prev = block;
+		block = NextPhysical(block);
+	}
+	if ((BYTE*)block != mMemory + mCapacity - kTlsfHeaderSize || BlockSize(block) != 0 || block->prevPhysical != prev)
+		return false;
+
+	// and the lists hold nothing else, with the bitmaps saying which are in use
+	size_t listedBlocks = 0;
+	for (UINT fl = 0; fl < kFlCount; fl++)
+	{
+		for (UINT sl = 0; sl < kSlCount; sl++)
+		{
+			bool used = (mSlBitmap[fl] & (1u << sl)) != 0;
+			if (used != (mFreeLists[fl][sl] != nullptr))
+				return false;
+			for (Block* listed = mFreeLists[fl][sl]; listed; listed = listed->nextFree)
+				listedBlocks++;
+		}
+		if (((mFlBitmap & (1u << fl)) != 0) != (mSlBitmap[fl] != 0))
+			return false;
+	}
+	return listedBlocks == freeBlocks;
+}
+
+// ==============================================================
+//		EngineMemory
+// ==============================================================
+
+// gives the singleton an initial value to clear up any unresolved externals
+EngineMemory* EngineMemory::singleton = nullptr;
+
+static std::once_flag gEngineMemoryOnce;
+
+// the calling thread's scratch arena, only good while its generation matches the engine's
+static thread_local LinearAllocator* tScratch = nullptr;
+static thread_local UINT tScratchGeneration = 0;
+
+EngineMemory* EngineMemory::Get()
+{
+	// never deleted on purpose, the game may still give memory back while the DLL unloads
+	std::call_once(gEngineMemoryOnce, []()
+	{
+		singleton = new EngineMemory();
+		singleton->Init();
+	});
+	return singleton;
+}
+
+EngineMemory::EngineMemory()
+{
+	mFrameIndex = 0;
+	mFramePeak = 0;
+	mScratchBytes = 0;
+	mScratchGeneration = 1;
+	mHeapFallbacks = 0;
+}
+
+EngineMemory::~EngineMemory()
+{
+	Shutdown();
+}
+
+bool EngineMemory::Init(size_t frameBytes, size_t scratchBytes, size_t heapBytes)
+{
+	Shutdown();
+
+	if (!mFrames[0].Init(frameBytes) || !mFrames[1].Init(frameBytes))
+		return false;
+	mScratchBytes = scratchBytes;
+	{
+		// a heap Shutdown() had to keep, because memory from it was still out, carries on as it is
+		std::lock_guard<std::mutex> lock(mHeapMutex);
+		if (mHeap.GetCapacity() == 0 && !mHeap.Init(heapBytes))
+			return false;
+	}
+
+	LOG_DEBUG(LogCategory_Memory, "engine memory: {}KB a frame, {}KB scratch a thread, {}KB heap", frameBytes / 1024, scratchBytes / 1024, heapBytes / 1024);
+	return true;
+}
+
+void EngineMemory::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mScratchMutex);
+		for (LinearAllocator* arena : mScratchArenas)
+			delete arena;
+		mScratchArenas.clear();
+		mScratchGeneration.fetch_add(1, std::memory_order_release);
+	}
+	{
+		// containers the game keeps in globals can outlive the engine and free into the heap later, so a heap that
+		// still has anything allocated stays until the process ends rather than being handed back under them
+		std::lock_guard<std::mutex> lock(mHeapMutex);
+		size_t used = mHeap.GetUsed();
+		if (used == 0)
+			mHeap.Release();
+		else
+			LOG_WARNING(LogCategory_Memory, "engine memory: {}KB of the heap is still allocated at shutdown, the heap is kept", (used + 1023) / 1024);
+		mHeapFallbacks = 0;
+	}
+	mFrames[0].Release();
+	mFrames[1].Release();
+	mFramePeak = 0;
+}
+
+void* EngineMemory::FrameAllocate(size_t size, size_t alignment)
+{
+	return mFrames[mFrameIndex & 1].Allocate(size, alignment);
+}
+
+void EngineMemory::NewFrame()
+{
+	// the frame before last is done with, this one gets its memory
+	mFrameIndex++;
+	LinearAllocator& frame = mFrames[mFrameIndex & 1];
+	mFramePeak = std::max(mFramePeak, frame.GetUsed());
+	frame.Reset();
+}
+
+LinearAllocator* EngineMemory::GetScratch()
+{
+	UINT generation = mScratchGeneration.load(std::memory_order_acquire);
+	if (tScratch && tScratchGeneration == generation)
+		return tScratch;
+
+	// first time on this thread (or since Init), an arena that failed to allocate just hands out nullptr
+	LinearAllocator* arena = new LinearAllocator();
+	arena->Init(mScratchBytes);
+	{
+		std::lock_guard<std::mutex> lock(mScratchMutex);
+		mScratchArenas.push_back(arena);
+	}
+	tScratch = arena;
+	tScratchGeneration = generation;
+	return arena;
+}
+
+// in front of every heap allocation, so Free() knows what to take off the tracker and where the block really starts
+struct HeapPrefix
+{
+	size_t size;
+	UINT   tag;
+	UINT   offset; // from the start of the block to the allocation
+};
+
+static const size_t kHeapPrefixSpace = 16;
+
+void* EngineMemory::Allocate(size_t size, size_t alignment, MemoryTag tag)
+{
+	static_assert(sizeof(HeapPrefix) <= kHeapPrefixSpace, "the heap prefix has to fit in front of a 16 byte aligned allocation");
+	alignment = std::max(alignment, kHeapPrefixSpace);
+
+	BYTE* block;
+	{
+		std::lock_guard<std::mutex> lock(mHeapMutex);
+		block = (BYTE*)mHeap.Allocate(size + alignment, alignment);
+		if (!block)
+			mHeapFallbacks++;
+	}
+	if (!block)
+	{
+		block = (BYTE*)_aligned_malloc(size + alignment, alignment);
+		if (!block)
+			return nullptr;
+	}
+
+	BYTE* p = block + alignment;
+	HeapPrefix* prefix = (HeapPrefix*)(p - kHeapPrefixSpace);
+	prefix->size = size;
+	prefix->tag = tag;
+	prefix->offset = (UINT)alignment;
+	MemoryTracker::Get()->TrackAllocation(tag, size);
+	return p;
+}
+
+void EngineMemory::Free(void* p)
+{
+	if (!p)
+		return;
+
+	const HeapPrefix* prefix = (const HeapPrefix*)((BYTE*)p - kHeapPrefixSpace);
+	MemoryTracker::Get()->TrackFree((MemoryTag)prefix->tag, prefix->size);
+	BYTE* block = (BYTE*)p - prefix->offset;
+
+	{
+		std::lock_guard<std::mutex> lock(mHeapMutex);
+		if (mHeap.Owns(block))
+		{
+			mHeap.Free(block);
+			return;
+		}
+	}
+	_aligned_free(block);
+}
+
+MemoryStats EngineMemory::GetStats()
+{
+	MemoryStats stats;
+	const LinearAllocator& frame = mFrames[mFrameIndex & 1];
+	stats.frameUsed = frame.GetUsed();
+	stats.framePeak = std::max(mFramePeak, frame.GetUsed());
+	stats.frameCapacity = frame.GetCapacity();
+	{
+		std::lock_guard<std::mutex> lock(mHeapMutex);
+		stats.heapUsed = mHeap.GetUsed();
+		stats.heapCapacity = mHeap.GetCapacity();
+		stats.heapFallbacks = mHeapFallbacks;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mScratchMutex);
+		stats.scratchArenas = (UINT)mScratchArenas.size();
+	}
+	stats.scratchCapacity = mScratchBytes;
+	return stats;
+}
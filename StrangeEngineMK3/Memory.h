@@ -0,0 +1,359 @@
+#pragma once
+
+#include "Common.h"
+#include "MemoryTracking.h"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		engine memory
+// ==============================================================
+//
+// three kinds of allocator over memory grabbed once up front, so hot paths stop going to the global heap:
+// linear (bump a pointer, free everything at once), pool (fixed size blocks on a free list) and TLSF
+// (general purpose, any size, constant time). EngineMemory puts one of each behind the engine: a frame allocator
+// that StrangeEngine::Run resets every frame, a scratch arena per thread and a shared heap
+
+// bump allocator over one block, nothing is freed on its own, only everything after a marker at once
+// Allocate() is safe from several threads at the same time, GetMarker()/Rewind()/Reset() are not
+class STRANGEENGINEMK3_API LinearAllocator
+{
+public:
+	LinearAllocator();
+	~LinearAllocator();
+
+	// false (and an engine error reported) if the memory couldn't be had. calling it again throws away everything allocated
+	bool Init(size_t capacity);
+	void Release();
+
+	// 'alignment' is a power of 2, nullptr when there is no room left
+	void* Allocate(size_t size, size_t alignment = 16);
+
+	// everything allocated after GetMarker() is given back by Rewind()
+	size_t GetMarker() const { return mUsed.load(std::memory_order_relaxed); }
+	void Rewind(size_t marker);
+	void Reset() { Rewind(0); }
+
+	bool Owns(const void* p) const { return (const BYTE*)p >= mMemory && (const BYTE*)p < mMemory + mCapacity; }
+	size_t GetUsed() const { return mUsed.load(std::memory_order_relaxed); }
+	size_t GetCapacity() const { return mCapacity; }
+	size_t GetPeak() const { return mPeak; } // the most that was ever in use at a Rewind()/Reset()
+
+private:
+	LinearAllocator(const LinearAllocator&);
+	LinearAllocator& operator=(const LinearAllocator&);
+
+	BYTE*				mMemory;
+	size_t				mCapacity;
+	std::atomic<size_t> mUsed;
+	size_t				mPeak;
+};
+
+// gives back everything the arena handed out inside the scope, e.g. a job's temporaries in its scratch arena
+class ScratchScope
+{
+public:
+	explicit ScratchScope(LinearAllocator* arena) : mArena(arena), mMarker(arena->GetMarker()) {}
+	~ScratchScope() { mArena->Rewind(mMarker); }
+
+	LinearAllocator* GetArena() const { return mArena; }
+
+private:
+	ScratchScope(const ScratchScope&);
+	ScratchScope& operator=(const ScratchScope&);
+
+	LinearAllocator* mArena;
+	size_t			 mMarker;
+};
+
+// blocks of one size on a free list, for objects that are created and destroyed all the time
+// grows a page of blocks at a time and never shrinks until Release(). not thread safe, give each owner its own
+class STRANGEENGINEMK3_API PoolAllocator
+{
+public:
+	PoolAllocator();
+	~PoolAllocator();
+
+	// 'blockSize' is rounded up to a multiple of 'alignment' (a power of 2) and to at least a pointer
+	void Init(size_t blockSize, size_t blocksPerPage = 256, size_t alignment = 16);
+	void Release();
+
+	// nullptr only when a new page can't be allocated
+	void* Allocate();
+	void Free(void* p);
+
+	size_t GetBlockSize() const { return mBlockSize; }
+	size_t GetAllocatedCount() const { return mAllocatedCount; }
+	size_t GetPageCount() const { return mPages.size(); }
+
+private:
+	PoolAllocator(const PoolAllocator&);
+	PoolAllocator& operator=(const PoolAllocator&);
+
+	bool AddPage();
+
+	std::vector<BYTE*> mPages;
+	void*			   mFreeList; // each free block starts with a pointer to the next one
+	size_t			   mBlockSize;
+	size_t			   mBlocksPerPage;
+	size_t			   mAlignment;
+	size_t			   mAllocatedCount;
+};
+
+// a PoolAllocator that constructs and destroys T, e.g. ObjectPool<Projectile> projectiles; projectiles.Create(...)
+template<typename T> class ObjectPool
+{
+public:
+	explicit ObjectPool(size_t objectsPerPage = 256) { mPool.Init(sizeof(T), objectsPerPage, alignof(T) > 16 ? alignof(T) : 16); }
+
+	template<typename... Args> T* Create(Args&&... args)
+	{
+		void* memory = mPool.Allocate();
+		return memory ? new (memory) T(std::forward<Args>(args)...) : nullptr;
+	}
+
+	void Destroy(T* object)
+	{
+		if (!object)
+			return;
+		object->~T();
+		mPool.Free(object);
+	}
+
+	size_t GetAliveCount() const { return mPool.GetAllocatedCount(); }
+
+private:
+	PoolAllocator mPool;
+};
+
+// two level segregated fit: free blocks are kept in lists by size class, found through two levels of bitmaps,
+// so allocating and freeing take the same short time however full or fragmented the memory is.
+// neighbouring free blocks are merged straight away. not thread safe, EngineMemory locks around its heap
+// one block of memory up to 4GB, every allocation costs a 16 byte header
+class STRANGEENGINEMK3_API TlsfAllocator
+{
+public:
+	TlsfAllocator();
+	~TlsfAllocator();
+
+	bool Init(size_t capacity);
+	void Release();
+
+	// 'alignment' is a power of 2, nullptr when no free block is big enough
+	void* Allocate(size_t size, size_t alignment = 16);
+	// 'p' must have come from this allocator (or be nullptr)
+	void Free(void* p);
+
+	bool Owns(const void* p) const { return (const BYTE*)p >= mMemory && (const BYTE*)p < mMemory + mCapacity; }
+	// what the allocation can actually hold, at least what was asked for
+	static size_t GetAllocationSize(const void* p);
+
+	size_t GetUsed() const { return mUsed; } // including headers
+	size_t GetCapacity() const { return mCapacity; }
+
+	// walks every block and checks the free lists agree with them, for tests and debugging
+	bool Validate() const;
+
+private:
+	TlsfAllocator(const TlsfAllocator&);
+	TlsfAllocator& operator=(const TlsfAllocator&);
+
+	enum
+	{
+		kAlignShift	   = 4, // 16 byte granularity
+		kSlBits		   = 5, // 32 lists per power of two
+		kSlCount	   = 1 << kSlBits,
+		kFlShift	   = kSlBits + kAlignShift, // sizes below 512 all go in the first level, 16 bytes apart
+		kFlMax		   = 32,
+		kFlCount	   = kFlMax - kFlShift + 1,
+	};
+
+	struct Block;
+
+	static size_t BlockSize(const Block* block);
+	static bool IsFree(const Block* block);
+	static BYTE* Payload(Block* block);
+	static Block* NextPhysical(Block* block);
+
+	void MapSize(size_t size, UINT* fl, UINT* sl) const;
+	Block* FindFree(size_t size);
+	void InsertFree(Block* block);
+	void RemoveFree(Block* block);
+	Block* SplitBlock(Block* block, size_t size);
+	Block* MergeWithNeighbours(Block* block);
+
+	BYTE*  mMemory;
+	size_t mCapacity;
+	size_t mUsed;
+
+	UINT   mFlBitmap;
+	UINT   mSlBitmap[kFlCount];
+	Block* mFreeLists[kFlCount][kSlCount];
+};
+
+struct MemoryStats
+{
+	size_t frameUsed;	   // by the current frame
+	size_t framePeak;	   // the most any frame used
+	size_t frameCapacity;  // each frame's share
+	size_t heapUsed;
+	size_t heapCapacity;
+	size_t heapFallbacks;  // heap allocations that didn't fit and went to the system heap instead
+	UINT   scratchArenas;  // one for each thread that ever asked for scratch memory
+	size_t scratchCapacity;
+};
+
+static const size_t kDefaultFrameBytes = 8 * 1024 * 1024;
+static const size_t kDefaultScratchBytes = 1024 * 1024;
+static const size_t kDefaultHeapBytes = 32 * 1024 * 1024;
+
+// the engine's memory, started with default sizes the first time it is asked for
+class STRANGEENGINEMK3_API EngineMemory
+{
+public:
+	static EngineMemory* Get();
+
+	// each frame gets 'frameBytes', each thread 'scratchBytes' of scratch and everything shares 'heapBytes'
+	// only call it when nothing is holding memory from here, e.g. before the engine starts
+	bool Init(size_t frameBytes = kDefaultFrameBytes, size_t scratchBytes = kDefaultScratchBytes, size_t heapBytes = kDefaultHeapBytes);
+	void Shutdown();
+	// false after Shutdown() until the next Init(). the heap can outlive Shutdown(), the frame arenas never do
+	bool IsInitialized() const { return mFrames[0].GetCapacity() != 0; }
+
+	// ==== frame ====
+	// memory that is only needed for a frame or so: it stays valid until the end of the frame after the one
+	// it was allocated in, so the frame being rendered can still read it. thread safe, never freed on its own
+	// nullptr when the frame has run out, every frame's peak is in GetStats()
+	void* FrameAllocate(size_t size, size_t alignment = 16);
+	// starts the next frame, StrangeEngine::Run calls it before anything else in the frame
+	void NewFrame();
+	UINT64 GetFrameIndex() const { return mFrameIndex; }
+
+	// ==== scratch ====
+	// the calling thread's own arena, no locking. put a ScratchScope around what you use it for
+	LinearAllocator* GetScratch();
+
+	// ==== heap ====
+	// thread safe general purpose memory, counted against 'tag' in the MemoryTracker
+	// when the heap is full it falls back to the system heap rather than fail
+	void* Allocate(size_t size, size_t alignment = 16, MemoryTag tag = MemoryTag_Engine);
+	void Free(void* p);
+
+	MemoryStats GetStats();
+
+private:
+	EngineMemory();
+	~EngineMemory();
+
+	static EngineMemory* singleton;
+
+	LinearAllocator mFrames[2]; // this frame and the last one
+	UINT64			mFrameIndex;
+	size_t			mFramePeak;
+
+	size_t						  mScratchBytes;
+	std::atomic<UINT>			  mScratchGeneration; // bumped by Init/Shutdown so threads drop arenas that are gone
+	std::vector<LinearAllocator*> mScratchArenas;
+	std::mutex					  mScratchMutex;
+
+	TlsfAllocator mHeap;
+	size_t		  mHeapFallbacks;
+	std::mutex	  mHeapMutex;
+};
+
+// ==============================================================
+//		STL adapters
+// ==============================================================
+//
+// e.g. FrameVector<Aabb> visible; or std::vector<int, ArenaStlAllocator<int>> ids(ArenaStlAllocator<int>(scratch));
+// out of memory throws std::bad_alloc like std::allocator does
+
+// frame memory, deallocate does nothing, the memory goes when the frame does
+template<typename T> class FrameStlAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameStlAllocator() {}
+	template<typename U> FrameStlAllocator(const FrameStlAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		void* p = EngineMemory::Get()->FrameAllocate(count * sizeof(T), alignof(T));
+		if (!p)
+			throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T*, size_t) {}
+
+	template<typename U> bool operator==(const FrameStlAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const FrameStlAllocator<U>&) const { return false; }
+};
+
+// the engine heap, counted against 'tag'
+template<typename T, MemoryTag tag = MemoryTag_Engine> class HeapStlAllocator
+{
+public:
+	typedef T value_type;
+
+	// the tag isn't a type, so std::allocator_traits can't work this out by itself
+	template<typename U> struct rebind
+	{
+		typedef HeapStlAllocator<U, tag> other;
+	};
+
+	HeapStlAllocator() {}
+	template<typename U> HeapStlAllocator(const HeapStlAllocator<U, tag>&) {}
+
+	T* allocate(size_t count)
+	{
+		void* p = EngineMemory::Get()->Allocate(count * sizeof(T), alignof(T), tag);
+		if (!p)
+			throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t) { EngineMemory::Get()->Free(p); }
+
+	template<typename U> bool operator==(const HeapStlAllocator<U, tag>&) const { return true; }
+	template<typename U> bool operator!=(const HeapStlAllocator<U, tag>&) const { return false; }
+};
+
+// any LinearAllocator, usually a thread's scratch arena. the container must not outlive the arena's next rewind
+template<typename T> class ArenaStlAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaStlAllocator(LinearAllocator* arena) : mArena(arena) {}
+	template<typename U> ArenaStlAllocator(const ArenaStlAllocator<U>& other) : mArena(other.GetArena()) {}
+
+	T* allocate(size_t count)
+	{
+		void* p = mArena->Allocate(count * sizeof(T), alignof(T));
+		if (!p)
+			throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T*, size_t) {}
+
+	LinearAllocator* GetArena() const { return mArena; }
+
+	template<typename U> bool operator==(const ArenaStlAllocator<U>& other) const { return mArena == other.GetArena(); }
+	template<typename U> bool operator!=(const ArenaStlAllocator<U>& other) const { return mArena != other.GetArena(); }
+
+private:
+	LinearAllocator* mArena;
+};
+
+template<typename T> using FrameVector = std::vector<T, FrameStlAllocator<T>>;
+template<typename T, MemoryTag tag = MemoryTag_Engine> using HeapVector = std::vector<T, HeapStlAllocator<T, tag>>;
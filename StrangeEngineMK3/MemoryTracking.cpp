@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "MemoryTracking.h"
+#include "Log.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <new>
+
+// gives the singleton an initial value to clear up any unresolved externals
+MemoryTracker* MemoryTracker::singleton = nullptr;
+
+static std::once_flag gMemoryTrackerOnce;
+
+static const char* kMemoryTagNames[MemoryTag_Count] =
+{
+	"engine",
+	"rendering",
+	"assets",
+	"input",
+	"game",
+};
+
+const char* GetMemoryTagName(MemoryTag tag)
+{
+	return (tag >= 0 && tag < MemoryTag_Count) ? kMemoryTagNames[tag] : "unknown";
+}
+
+MemoryTracker* MemoryTracker::Get()
+{
+	// never deleted on purpose, things are still freed (and tracked) while the DLL unloads
+	std::call_once(gMemoryTrackerOnce, []()
+	{
+		singleton = new MemoryTracker();
+	});
+	return singleton;
+}
+
+MemoryTracker::MemoryTracker()
+{
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		mPeakBytes[i] = 0;
+		mGpuPeakBytes[i] = 0;
+		mFrameStartAllocations[i] = 0;
+		mFrameAllocations[i] = 0;
+		mBudgets[i] = 0;
+		mBudgetViolations[i] = 0;
+		mOverBudget[i] = false;
+	}
+}
+
+MemoryTracker::ThreadCounters* MemoryTracker::GetThreadCounters()
+{
+	static thread_local ThreadCounters* tCounters = nullptr;
+	if (tCounters)
+		return tCounters;
+
+	// new doesn't honour alignas(64) before C++17
+	void* memory = _aligned_malloc(sizeof(ThreadCounters), 64);
+	ThreadCounters* counters = new (memory) ThreadCounters();
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		counters->bytes[i] = 0;
+		counters->gpuBytes[i] = 0;
+		counters->allocations[i] = 0;
+		counters->frees[i] = 0;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mThreads.push_back(counters);
+	}
+	tCounters = counters;
+	return counters;
+}
+
+// only the owning thread writes, so a load and a store do instead of a locked add
+template<typename T> static void AddRelaxed(std::atomic<T>& counter, T amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void MemoryTracker::TrackAllocation(MemoryTag tag, size_t bytes)
+{
+	ThreadCounters* counters = GetThreadCounters();
+	AddRelaxed(counters->bytes[tag], (INT64)bytes);
+	AddRelaxed(counters->allocations[tag], (UINT64)1);
+}
+
+void MemoryTracker::TrackFree(MemoryTag tag, size_t bytes)
+{
+	ThreadCounters* counters = GetThreadCounters();
+	AddRelaxed(counters->bytes[tag], -(INT64)bytes);
+	AddRelaxed(counters->frees[tag], (UINT64)1);
+}
+
+void MemoryTracker::TrackGpuAllocation(MemoryTag tag, size_t bytes)
+{
+	ThreadCounters* counters = GetThreadCounters();
+	AddRelaxed(counters->gpuBytes[tag], (INT64)bytes);
+	AddRelaxed(counters->allocations[tag], (UINT64)1);
+}
+
+void MemoryTracker::TrackGpuFree(MemoryTag tag, size_t bytes)
+{
+	ThreadCounters* counters = GetThreadCounters();
+	AddRelaxed(counters->gpuBytes[tag], -(INT64)bytes);
+	AddRelaxed(counters->frees[tag], (UINT64)1);
+}
+
+void MemoryTracker::SetBudget(MemoryTag tag, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mBudgets[tag] = (INT64)bytes;
+	mOverBudget[tag] = false;
+}
+
+void MemoryTracker::Gather(MemoryTagStats* totals)
+{
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		MemoryTagStats& stats = totals[i];
+		stats = MemoryTagStats();
+		for (ThreadCounters* counters : mThreads)
+		{
+			stats.liveBytes += counters->bytes[i].load(std::memory_order_relaxed);
+			stats.gpuLiveBytes += counters->gpuBytes[i].load(std::memory_order_relaxed);
+			stats.allocations += counters->allocations[i].load(std::memory_order_relaxed);
+			stats.frees += counters->frees[i].load(std::memory_order_relaxed);
+		}
+
+		mPeakBytes[i] = std::max(mPeakBytes[i], stats.liveBytes);
+		mGpuPeakBytes[i] = std::max(mGpuPeakBytes[i], stats.gpuLiveBytes);
+		stats.peakBytes = mPeakBytes[i];
+		stats.gpuPeakBytes = mGpuPeakBytes[i];
+		stats.frameAllocations = mFrameAllocations[i];
+		stats.budgetBytes = mBudgets[i];
+		stats.budgetViolations = mBudgetViolations[i];
+		stats.overBudget = mOverBudget[i];
+	}
+}
+
+void MemoryTracker::NewFrame()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	MemoryTagStats totals[MemoryTag_Count];
+	Gather(totals);
+
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		mFrameAllocations[i] = totals[i].allocations - mFrameStartAllocations[i];
+		mFrameStartAllocations[i] = totals[i].allocations;
+
+		// only the frame it goes over is reported, not every frame it stays over
+		bool over = mBudgets[i] > 0 && totals[i].liveBytes + totals[i].gpuLiveBytes > mBudgets[i];
+		if (over && !mOverBudget[i])
+		{
+			mBudgetViolations[i]++;
+
+			LOG_WARNING(LogCategory_Memory, "{} memory is over budget, {} bytes of {}", kMemoryTagNames[i], totals[i].liveBytes + totals[i].gpuLiveBytes, mBudgets[i]);
+		}
+		mOverBudget[i] = over;
+	}
+}
+
+MemoryTagStats MemoryTracker::GetStats(MemoryTag tag)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	MemoryTagStats totals[MemoryTag_Count];
+	Gather(totals);
+	return totals[tag];
+}
+
+bool MemoryTracker::WriteReport(std::ostream& out)
+{
+	MemoryTagStats totals[MemoryTag_Count];
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		Gather(totals);
+	}
+
+	out << "memory by tag (KB)\n";
+	out << std::left << std::setw(12) << "tag" << std::right << std::setw(12) << "live" << std::setw(12) << "peak"
+		<< std::setw(12) << "gpu live" << std::setw(12) << "gpu peak" << std::setw(14) << "allocations" << std::setw(12) << "frees"
+		<< std::setw(12) << "budget" << "\n";
+
+	bool leaked = false;
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		const MemoryTagStats& stats = totals[i];
+		out << std::left << std::setw(12) << kMemoryTagNames[i] << std::right
+			<< std::setw(12) << stats.liveBytes / 1024 << std::setw(12) << stats.peakBytes / 1024
+			<< std::setw(12) << stats.gpuLiveBytes / 1024 << std::setw(12) << stats.gpuPeakBytes / 1024
+			<< std::setw(14) << stats.allocations << std::setw(12) << stats.frees
+			<< std::setw(12) << stats.budgetBytes / 1024 << "\n";
+		leaked |= stats.liveBytes != 0 || stats.gpuLiveBytes != 0;
+	}
+
+	for (UINT i = 0; i < MemoryTag_Count; i++)
+	{
+		const MemoryTagStats& stats = totals[i];
+		if (stats.liveBytes != 0 || stats.gpuLiveBytes != 0)
+		{
+			out << "[LEAK]: " << kMemoryTagNames[i] << " still has " << stats.liveBytes << " bytes and " << stats.gpuLiveBytes
+				<< " GPU bytes in " << (INT64)(stats.allocations - stats.frees) << " allocations\n";
+		}
+		if (stats.budgetViolations > 0)
+			out << "[WARNING]: " << kMemoryTagNames[i] << " went over budget " << stats.budgetViolations << " times\n";
+	}
+	return !leaked;
+}
+
+bool MemoryTracker::WriteReport(const char* path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		ReportError(LogCategory_Memory, "Could not write the memory report to {}", path);
+		return false;
+	}
+	return WriteReport(file);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// who memory is being used for
+enum MemoryTag
+{
+	MemoryTag_Engine,	 // anything not tagged more precisely
+	MemoryTag_Rendering, // swap chain, depth buffer, vertex buffers, particles
+	MemoryTag_Assets,	 // streamed and loaded asset data
+	MemoryTag_Input,
+	MemoryTag_Game,		 // for the game's own allocations
+
+	MemoryTag_Count
+};
+
+STRANGEENGINEMK3_API const char* GetMemoryTagName(MemoryTag tag);
+
+struct MemoryTagStats
+{
+	INT64  liveBytes;		 // system memory in use right now
+	INT64  peakBytes;		 // high-water mark, sampled once a frame and on every GetStats()
+	INT64  gpuLiveBytes;	 // D3D resources
+	INT64  gpuPeakBytes;
+	UINT64 allocations;		 // running totals
+	UINT64 frees;
+	UINT64 frameAllocations; // during the last full frame
+	INT64  budgetBytes;		 // 0 for no budget, covers system and GPU memory together
+	UINT   budgetViolations; // frames that went over the budget after being under it
+	bool   overBudget;
+};
+
+// counts the memory each subsystem is using
+// every thread counts into its own block of counters with plain stores, so tracking an allocation costs a few
+// nanoseconds and never waits on another thread. the blocks are summed when somebody asks, or once a frame
+class STRANGEENGINEMK3_API MemoryTracker
+{
+public:
+	static MemoryTracker* Get();
+
+	// from any thread. the free doesn't have to be on the thread that did the allocation
+	void TrackAllocation(MemoryTag tag, size_t bytes);
+	void TrackFree(MemoryTag tag, size_t bytes);
+	void TrackGpuAllocation(MemoryTag tag, size_t bytes);
+	void TrackGpuFree(MemoryTag tag, size_t bytes);
+
+	// warns (in debug builds) the first frame a tag goes over it, 0 turns it off
+	void SetBudget(MemoryTag tag, size_t bytes);
+
+	// sums everything up, updates the peaks, counts the last frame's allocations and checks the budgets
+	// StrangeEngine::Run calls it once a frame
+	void NewFrame();
+
+	MemoryTagStats GetStats(MemoryTag tag);
+
+	// a table of every tag. called after everything has shut down, whatever is still live is a leak
+	// returns false if anything is (or the file couldn't be written)
+	bool WriteReport(std::ostream& out);
+	bool WriteReport(const char* path);
+
+private:
+	MemoryTracker();
+
+	// one per thread, only ever written by its thread. on its own cache lines so threads don't slow each other down
+	struct alignas(64) ThreadCounters
+	{
+		std::atomic<INT64>	bytes[MemoryTag_Count];
+		std::atomic<INT64>	gpuBytes[MemoryTag_Count];
+		std::atomic<UINT64> allocations[MemoryTag_Count];
+		std::atomic<UINT64> frees[MemoryTag_Count];
+	};
+
+	ThreadCounters* GetThreadCounters();
+	// sums every thread's counters into 'totals' and moves the peaks up, mMutex held
+	void Gather(MemoryTagStats* totals);
+
+	static MemoryTracker* singleton;
+
+	std::mutex					 mMutex;
+	std::vector<ThreadCounters*> mThreads; // never freed, a thread that exits still owns what it allocated
+	INT64						 mPeakBytes[MemoryTag_Count];
+	INT64						 mGpuPeakBytes[MemoryTag_Count];
+	UINT64						 mFrameStartAllocations[MemoryTag_Count];
+	UINT64						 mFrameAllocations[MemoryTag_Count];
+	INT64						 mBudgets[MemoryTag_Count];
+	UINT						 mBudgetViolations[MemoryTag_Count];
+	bool						 mOverBudget[MemoryTag_Count];
+};
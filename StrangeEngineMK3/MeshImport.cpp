@@ -0,0 +1,597 @@
+#include "pch.h"
+#include "MeshImport.h"
+#include "FileUtils.h"
+#include "Log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+// ==============================================================
+//		.x tokenizer
+// ==============================================================
+
+enum XTokenType
+{
+	XToken_End,
+	XToken_Name,
+	XToken_Number,
+	XToken_String,
+	XToken_Open,
+	XToken_Close,
+	XToken_Other,
+};
+
+struct XToken
+{
+	XTokenType	type;
+	const char* start;
+	size_t		length;
+
+	bool Is(const char* name) const { return type == XToken_Name && strlen(name) == length && memcmp(start, name, length) == 0; }
+};
+
+// the text has to be null terminated, numbers are read with strtof
+// ',' and ';' only separate values, so they are skipped like whitespace
+class XTokenizer
+{
+public:
+	XTokenizer(const char* text, size_t size) : mPos(text), mEnd(text + size) {}
+
+	XToken Next()
+	{
+		SkipSeparators();
+		XToken token = { XToken_End, mPos, 0 };
+		if (mPos >= mEnd)
+			return token;
+
+		char c = *mPos;
+		if (c == '{' || c == '}')
+		{
+			token.type = (c == '{') ? XToken_Open : XToken_Close;
+			token.length = 1;
+			mPos++;
+		}
+		else if (c == '"')
+		{
+			const char* close = (const char*)memchr(mPos + 1, '"', mEnd - mPos - 1);
+			const char* end = close ? close + 1 : mEnd;
+			token.type = XToken_String;
+			token.length = end - mPos;
+			mPos = end;
+		}
+		else if (IsNumberChar(c))
+		{
+			while (mPos < mEnd && IsNumberChar(*mPos))
+				mPos++;
+			token.type = XToken_Number;
+			token.length = mPos - token.start;
+		}
+		else if (IsNameChar(c))
+		{
+			while (mPos < mEnd && (IsNameChar(*mPos) || (*mPos >= '0' && *mPos <= '9')))
+				mPos++;
+			token.type = XToken_Name;
+			token.length = mPos - token.start;
+		}
+		else
+		{
+			token.type = XToken_Other;
+			token.length = 1;
+			mPos++;
+		}
+		return token;
+	}
+
+	XToken Peek()
+	{
+		const char* saved = mPos;
+		XToken token = Next();
+		mPos = saved;
+		return token;
+	}
+
+	bool ReadFloat(float* value)
+	{
+		SkipSeparators();
+		char* end = nullptr;
+		*value = strtof(mPos, &end);
+		if (end == mPos || end > mEnd)
+			return false;
+		mPos = end;
+		return true;
+	}
+
+	bool ReadUInt(UINT* value)
+	{
+		SkipSeparators();
+		char* end = nullptr;
+		unsigned long parsed = strtoul(mPos, &end, 10);
+		if (end == mPos || end > mEnd || *mPos == '-')
+			return false;
+		*value = (UINT)parsed;
+		mPos = end;
+		return true;
+	}
+
+	size_t GetRemaining() const { return mEnd - mPos; }
+
+private:
+	static bool IsNumberChar(char c) { return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'; }
+	static bool IsNameChar(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+	void SkipSeparators()
+	{
+		while (mPos < mEnd)
+		{
+			char c = *mPos;
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ';')
+				mPos++;
+			else if (c == '#' || (c == '/' && mPos + 1 < mEnd && mPos[1] == '/'))
+			{
+				while (mPos < mEnd && *mPos != '\n')
+					mPos++;
+			}
+			else
+				break;
+		}
+	}
+
+	const char* mPos;
+	const char* mEnd;
+};
+
+
+// ==============================================================
+//		.x parser
+// ==============================================================
+
+// 4x4 matrices are row major and used with row vectors, the same as D3D and the .x format
+static void MultiplyMatrix(const float* a, const float* b, float* out)
+{
+	for (int row = 0; row < 4; row++)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			out[row * 4 + column] = a[row * 4 + 0] * b[0 * 4 + column] + a[row * 4 + 1] * b[1 * 4 + column]
+				+ a[row * 4 + 2] * b[2 * 4 + column] + a[row * 4 + 3] * b[3 * 4 + column];
+		}
+	}
+}
+
+static const float kIdentity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+class XMeshParser
+{
+public:
+	XMeshParser(const char* text, size_t size, MeshData* mesh) : mTokens(text, size), mMesh(mesh) {}
+
+	bool Parse()
+	{
+		for (;;)
+		{
+			XToken token = mTokens.Next();
+			if (token.type == XToken_End)
+				return true;
+
+			bool ok;
+			if (token.Is("Frame"))
+				ok = ParseFrame(kIdentity);
+			else if (token.Is("Mesh"))
+				ok = ParseMesh(kIdentity);
+			else if (token.type == XToken_Name)
+				ok = OpenObject() && SkipObjectBody(); // templates, Header, Material, AnimationSet...
+			else
+				ok = Fail("Unexpected token at the top level of the .x file");
+
+			if (!ok)
+				return false;
+		}
+	}
+
+private:
+	// the optional instance name, then '{'
+	bool OpenObject()
+	{
+		XToken token = mTokens.Next();
+		if (token.type == XToken_Name || token.type == XToken_Number)
+			token = mTokens.Next();
+		if (token.type == XToken_Open)
+			return true;
+
+		// templates have a <GUID> before their body, skip anything up to the '{'
+		while (token.type != XToken_Open && token.type != XToken_End)
+			token = mTokens.Next();
+		return token.type == XToken_Open || Fail("Expected '{' in the .x file");
+	}
+
+	// the caller has read the '{'
+	bool SkipObjectBody()
+	{
+		int depth = 1;
+		while (depth > 0)
+		{
+			XToken token = mTokens.Next();
+			if (token.type == XToken_End)
+				return Fail("Unexpected end of the .x file");
+			if (token.type == XToken_Open)
+				depth++;
+			else if (token.type == XToken_Close)
+				depth--;
+		}
+		return true;
+	}
+
+	bool ParseFrame(const float* parentWorld)
+	{
+		if (!OpenObject())
+			return false;
+
+		float world[16];
+		memcpy(world, parentWorld, sizeof(world));
+		for (;;)
+		{
+			XToken token = mTokens.Next();
+			bool ok = true;
+			if (token.type == XToken_Close)
+				return true;
+			else if (token.type == XToken_Open)
+				ok = SkipObjectBody(); // a { reference } to an object defined elsewhere
+			else if (token.Is("FrameTransformMatrix"))
+			{
+				float local[16];
+				ok = OpenObject();
+				for (int i = 0; i < 16 && ok; i++)
+					ok = mTokens.ReadFloat(&local[i]);
+				ok = ok && mTokens.Next().type == XToken_Close;
+				if (!ok)
+					return Fail("Bad FrameTransformMatrix in the .x file");
+
+				// the frame's children are in its space, which is placed by 'local' inside the parent's
+				MultiplyMatrix(local, parentWorld, world);
+			}
+			else if (token.Is("Frame"))
+				ok = ParseFrame(world);
+			else if (token.Is("Mesh"))
+				ok = ParseMesh(world);
+			else if (token.type == XToken_Name)
+				ok = OpenObject() && SkipObjectBody();
+			else
+				ok = Fail("Unexpected token in a .x Frame");
+
+			if (!ok)
+				return false;
+		}
+	}
+
+	// a count can't be more than the characters left, which stops a corrupt count from allocating gigabytes
+	bool ReadCount(UINT* count)
+	{
+		return mTokens.ReadUInt(count) && *count <= mTokens.GetRemaining();
+	}
+
+	bool ReadVectors(UINT count, UINT components, std::vector<float>* values)
+	{
+		values->resize((size_t)count * components);
+		for (float& value : *values)
+		{
+			if (!mTokens.ReadFloat(&value))
+				return false;
+		}
+		return true;
+	}
+
+	// polygons as a count followed by that many indices, all into 'indexLimit' elements
+	bool ReadFaces(UINT faceCount, UINT indexLimit, std::vector<UINT>* faceSizes, std::vector<UINT>* indices)
+	{
+		faceSizes->resize(faceCount);
+		indices->clear();
+		for (UINT face = 0; face < faceCount; face++)
+		{
+			UINT size;
+			if (!ReadCount(&size))
+				return false;
+			(*faceSizes)[face] = size;
+			for (UINT i = 0; i < size; i++)
+			{
+				UINT index;
+				if (!mTokens.ReadUInt(&index) || index >= indexLimit)
+					return false;
+				indices->push_back(index);
+			}
+		}
+		return true;
+	}
+
+	bool ParseMesh(const float* world)
+	{
+		if (!OpenObject())
+			return false;
+
+		UINT positionCount, faceCount;
+		std::vector<float> positions;
+		std::vector<UINT> faceSizes, faceIndices;
+		if (!ReadCount(&positionCount) || !ReadVectors(positionCount, 3, &positions)
+			|| !ReadCount(&faceCount) || !ReadFaces(faceCount, positionCount, &faceSizes, &faceIndices))
+			return Fail("Bad vertex or face list in a .x Mesh");
+
+		std::vector<float> normals, uvs;
+		std::vector<UINT> normalFaceSizes, normalIndices;
+		for (;;)
+		{
+			XToken token = mTokens.Next();
+			bool ok = true;
+			if (token.type == XToken_Close)
+				break;
+			else if (token.type == XToken_Open)
+				ok = SkipObjectBody();
+			else if (token.Is("MeshNormals"))
+			{
+				UINT normalCount, normalFaceCount;
+				ok = OpenObject() && ReadCount(&normalCount) && ReadVectors(normalCount, 3, &normals)
+					&& ReadCount(&normalFaceCount) && ReadFaces(normalFaceCount, normalCount, &normalFaceSizes, &normalIndices)
+					&& SkipObjectBody();
+
+				// the normals have to line up with the faces corner for corner, otherwise we make our own
+				if (ok && normalFaceSizes != faceSizes)
+				{
+					normals.clear();
+					normalIndices.clear();
+				}
+			}
+			else if (token.Is("MeshTextureCoords"))
+			{
+				UINT uvCount;
+				ok = OpenObject() && ReadCount(&uvCount) && ReadVectors(uvCount, 2, &uvs) && SkipObjectBody();
+				if (ok && uvCount != positionCount)
+					uvs.clear();
+			}
+			else if (token.type == XToken_Name)
+				ok = OpenObject() && SkipObjectBody(); // MeshMaterialList, VertexDuplicationIndices, SkinWeights...
+			else
+				ok = Fail("Unexpected token in a .x Mesh");
+
+			if (!ok)
+				return Fail("Bad child object in a .x Mesh");
+		}
+
+		AppendMesh(world, positions, faceSizes, faceIndices, normals, normalIndices, uvs);
+		return true;
+	}
+
+	void AppendMesh(const float* world, const std::vector<float>& positions, const std::vector<UINT>& faceSizes,
+		const std::vector<UINT>& faceIndices, const std::vector<float>& normals, const std::vector<UINT>& normalIndices,
+		const std::vector<float>& uvs)
+	{
+		std::vector<MeshVertex>& vertices = mMesh->vertices;
+		std::vector<UINT>& indices = mMesh->indices;
+		UINT firstVertex = (UINT)vertices.size();
+		UINT firstIndex = (UINT)indices.size();
+		bool hasNormals = !normalIndices.empty();
+
+		// a mirrored frame turns the triangles inside out, swap two corners to keep them facing the same way
+		float determinant = world[0] * (world[5] * world[10] - world[6] * world[9])
+			- world[1] * (world[4] * world[10] - world[6] * world[8])
+			+ world[2] * (world[4] * world[9] - world[5] * world[8]);
+		bool mirrored = determinant < 0.0f;
+
+		// one vertex per distinct position + normal pair
+		std::unordered_map<UINT64, UINT> lookup;
+		std::vector<UINT> corners;
+		size_t cursor = 0;
+		for (UINT size : faceSizes)
+		{
+			corners.clear();
+			for (UINT corner = 0; corner < size; corner++, cursor++)
+			{
+				UINT position = faceIndices[cursor];
+				UINT normal = hasNormals ? normalIndices[cursor] : 0;
+				UINT64 key = ((UINT64)position << 32) | normal;
+
+				auto found = lookup.find(key);
+				if (found != lookup.end())
+				{
+					corners.push_back(found->second);
+					continue;
+				}
+
+				MeshVertex vertex;
+				const float* p = &positions[(size_t)position * 3];
+				vertex.position.x = p[0] * world[0] + p[1] * world[4] + p[2] * world[8] + world[12];
+				vertex.position.y = p[0] * world[1] + p[1] * world[5] + p[2] * world[9] + world[13];
+				vertex.position.z = p[0] * world[2] + p[1] * world[6] + p[2] * world[10] + world[14];
+				vertex.normal = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				if (hasNormals)
+				{
+					// frames only rotate, translate and scale uniformly, so the upper 3x3 works for normals once renormalised
+					const float* n = &normals[(size_t)normal * 3];
+					vertex.normal.x = n[0] * world[0] + n[1] * world[4] + n[2] * world[8];
+					vertex.normal.y = n[0] * world[1] + n[1] * world[5] + n[2] * world[9];
+					vertex.normal.z = n[0] * world[2] + n[1] * world[6] + n[2] * world[10];
+				}
+				vertex.uv = uvs.empty() ? XMFLOAT2(0.0f, 0.0f) : XMFLOAT2(uvs[(size_t)position * 2], uvs[(size_t)position * 2 + 1]);
+
+				lookup[key] = (UINT)vertices.size();
+				corners.push_back((UINT)vertices.size());
+				vertices.push_back(vertex);
+			}
+
+			for (UINT i = 2; i < size; i++)
+			{
+				indices.push_back(corners[0]);
+				indices.push_back(corners[mirrored ? i : i - 1]);
+				indices.push_back(corners[mirrored ? i - 1 : i]);
+			}
+		}
+
+		// smooth normals from the area weighted face normals. clockwise front faces, like D3D
+		if (!hasNormals)
+		{
+			for (size_t i = firstIndex; i + 2 < indices.size(); i += 3)
+			{
+				XMFLOAT3& a = vertices[indices[i]].position;
+				XMFLOAT3& b = vertices[indices[i + 1]].position;
+				XMFLOAT3& c = vertices[indices[i + 2]].position;
+				float e1[3] = { b.x - a.x, b.y - a.y, b.z - a.z };
+				float e2[3] = { c.x - a.x, c.y - a.y, c.z - a.z };
+				float face[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				for (int corner = 0; corner < 3; corner++)
+				{
+					XMFLOAT3& normal = vertices[indices[i + corner]].normal;
+					normal.x += face[0];
+					normal.y += face[1];
+					normal.z += face[2];
+				}
+			}
+		}
+
+		for (size_t i = firstVertex; i < vertices.size(); i++)
+		{
+			XMFLOAT3& normal = vertices[i].normal;
+			float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+			if (length > 0.0f)
+			{
+				normal.x /= length;
+				normal.y /= length;
+				normal.z /= length;
+			}
+			else
+				normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	bool Fail(const char* message)
+	{
+		ReportError(LogCategory_Assets, "{}", message);
+		return false;
+	}
+
+	XTokenizer mTokens;
+	MeshData*  mMesh;
+};
+
+bool ImportXMesh(const BYTE* text, size_t size, MeshData* mesh)
+{
+	mesh->vertices.clear();
+	mesh->indices.clear();
+	mesh->boundsMin = mesh->boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	// "xof 0303txt 0032", binary and compressed .x files aren't supported
+	if (size < 16 || memcmp(text, "xof ", 4) != 0 || memcmp(text + 8, "txt ", 4) != 0)
+	{
+		ReportError(LogCategory_Assets, "Not a text .x file");
+		return false;
+	}
+
+	// a null terminated copy for strtof
+	std::string copy((const char*)text + 16, size - 16);
+	XMeshParser parser(copy.c_str(), copy.size(), mesh);
+	if (!parser.Parse())
+		return false;
+
+	if (mesh->indices.empty())
+	{
+		ReportError(LogCategory_Assets, "The .x file has no triangles");
+		return false;
+	}
+
+	mesh->boundsMin = mesh->boundsMax = mesh->vertices[0].position;
+	for (const MeshVertex& vertex : mesh->vertices)
+	{
+		mesh->boundsMin.x = std::min(mesh->boundsMin.x, vertex.position.x);
+		mesh->boundsMin.y = std::min(mesh->boundsMin.y, vertex.position.y);
+		mesh->boundsMin.z = std::min(mesh->boundsMin.z, vertex.position.z);
+		mesh->boundsMax.x = std::max(mesh->boundsMax.x, vertex.position.x);
+		mesh->boundsMax.y = std::max(mesh->boundsMax.y, vertex.position.y);
+		mesh->boundsMax.z = std::max(mesh->boundsMax.z, vertex.position.z);
+	}
+	return true;
+}
+
+bool ImportXMeshFile(const std::wstring& path, MeshData* mesh)
+{
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart > 0x7FFFFFFF)
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		ReportError(LogCategory_Assets, "Could not read {}", path);
+		return false;
+	}
+
+	std::vector<BYTE> text((size_t)size.QuadPart);
+	DWORD read = 0;
+	bool ok = text.empty() || (ReadFile(file, text.data(), (DWORD)text.size(), &read, nullptr) && read == text.size());
+	CloseHandle(file);
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Could not read .x file");
+		return false;
+	}
+	return ImportXMesh(text.data(), text.size(), mesh);
+}
+
+
+// ==============================================================
+//		cooked .mesh files
+// ==============================================================
+
+bool SaveCookedMesh(const std::wstring& path, const MeshData& mesh)
+{
+	MeshFileHeader header;
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.vertexCount = (UINT)mesh.vertices.size();
+	header.indexCount = (UINT)mesh.indices.size();
+	header.boundsMin[0] = mesh.boundsMin.x;
+	header.boundsMin[1] = mesh.boundsMin.y;
+	header.boundsMin[2] = mesh.boundsMin.z;
+	header.boundsMax[0] = mesh.boundsMax.x;
+	header.boundsMax[1] = mesh.boundsMax.y;
+	header.boundsMax[2] = mesh.boundsMax.z;
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not create {}", path);
+		return false;
+	}
+
+	bool ok = WriteFileBytes(file, &header, sizeof(header));
+	ok = ok && WriteFileBytes(file, mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex));
+	ok = ok && WriteFileBytes(file, mesh.indices.data(), mesh.indices.size() * sizeof(UINT));
+	CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Could not write cooked mesh file");
+		return false;
+	}
+	return true;
+}
+
+bool ParseCookedMesh(const BYTE* data, size_t size, CookedMeshView* view)
+{
+	const MeshFileHeader* header = (const MeshFileHeader*)data;
+	bool ok = size >= sizeof(MeshFileHeader) && header->magic == MESH_MAGIC && header->version == MESH_VERSION
+		&& size - sizeof(MeshFileHeader) == (UINT64)header->vertexCount * sizeof(MeshVertex) + (UINT64)header->indexCount * sizeof(UINT);
+	if (ok)
+	{
+		view->header = header;
+		view->vertices = (const MeshVertex*)(data + sizeof(MeshFileHeader));
+		view->indices = (const UINT*)(data + sizeof(MeshFileHeader) + (size_t)header->vertexCount * sizeof(MeshVertex));
+		for (UINT i = 0; i < header->indexCount && ok; i++)
+			ok = view->indices[i] < header->vertexCount;
+	}
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Cooked mesh is corrupt or from an older cooker");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include <xnamath.h>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+struct MeshVertex
+{
+	XMFLOAT3 position;
+	XMFLOAT3 normal;
+	XMFLOAT2 uv;
+};
+
+// one triangle list, every frame of the source already baked into the positions
+struct MeshData
+{
+	std::vector<MeshVertex> vertices;
+	std::vector<UINT>		indices;
+	XMFLOAT3				boundsMin;
+	XMFLOAT3				boundsMax;
+};
+
+// parses a text .x file (xof 0303txt) into one mesh
+// every Mesh block in the frame hierarchy is transformed by its frames and merged, polygons are fanned into triangles,
+// meshes without normals get smooth ones. materials, skinning and animation are skipped
+STRANGEENGINEMK3_API bool ImportXMesh(const BYTE* text, size_t size, MeshData* mesh);
+STRANGEENGINEMK3_API bool ImportXMeshFile(const std::wstring& path, MeshData* mesh);
+
+
+// ==============================================================
+//		cooked .mesh files
+// ==============================================================
+//
+// header | vertices | indices, loaded with one read and no parsing
+
+#define MESH_MAGIC 0x48534D53 // "SMSH"
+#define MESH_VERSION 1
+
+#pragma pack(push, 1)
+struct MeshFileHeader
+{
+	UINT  magic;
+	UINT  version;
+	UINT  vertexCount;
+	UINT  indexCount;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+#pragma pack(pop)
+
+// points into a cooked file that is already in memory (e.g. a raw asset from the AssetStreamer), nothing is copied
+struct CookedMeshView
+{
+	const MeshFileHeader* header;
+	const MeshVertex*	  vertices;
+	const UINT*			  indices;
+};
+
+STRANGEENGINEMK3_API bool SaveCookedMesh(const std::wstring& path, const MeshData& mesh);
+
+// checks the header and that every index is in range
+STRANGEENGINEMK3_API bool ParseCookedMesh(const BYTE* data, size_t size, CookedMeshView* view);
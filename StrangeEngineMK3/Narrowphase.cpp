@@ -0,0 +1,952 @@
+#include "pch.h"
+#include "Narrowphase.h"
+#include "Log.h"
+#include "PhysicsMath.h"
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+// contacts further apart than this are different contacts, closer ones are the same one moved a little
+static const float kContactMatchDistance = 0.05f;
+
+// how far a kept contact may separate or slide before it is dropped from a persistent manifold
+static const float kContactBreakDistance = 0.02f;
+
+// ==============================================================
+//		convex hulls
+// ==============================================================
+
+bool BuildConvexHull(const MeshData& mesh, ConvexHull* hull, UINT maxPoints)
+{
+	if (mesh.vertices.empty())
+	{
+		ReportError(LogCategory_Physics, "Can't build a convex hull from a mesh with no vertices");
+		return false;
+	}
+
+	// the 26 directions to the faces, edges and corners of a cube first so the obvious extremes are never dropped,
+	// then a few hundred spread evenly over the sphere (a Fibonacci spiral)
+	std::vector<XMFLOAT3> directions;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int z = -1; z <= 1; z++)
+			{
+				if (x != 0 || y != 0 || z != 0)
+					directions.push_back(Vec3Normalize(XMFLOAT3((float)x, (float)y, (float)z)));
+			}
+		}
+	}
+	const int spiralCount = 256;
+	for (int i = 0; i < spiralCount; i++)
+	{
+		float y = 1.0f - (i + 0.5f) * 2.0f / spiralCount;
+		float radius = sqrtf(std::max(0.0f, 1.0f - y * y));
+		float angle = i * 2.39996323f; // the golden angle
+		directions.push_back(XMFLOAT3(cosf(angle) * radius, y, sinf(angle) * radius));
+	}
+
+	std::vector<bool> taken(mesh.vertices.size(), false);
+	std::vector<XMFLOAT3> points;
+	for (const XMFLOAT3& direction : directions)
+	{
+		size_t best = 0;
+		float bestDistance = -FLT_MAX;
+		for (size_t i = 0; i < mesh.vertices.size(); i++)
+		{
+			float distance = Vec3Dot(mesh.vertices[i].position, direction);
+			if (distance > bestDistance)
+			{
+				bestDistance = distance;
+				best = i;
+			}
+		}
+
+		if (taken[best])
+			continue;
+		taken[best] = true;
+
+		// the same position can be on several vertices (different normals or uvs)
+		bool duplicate = false;
+		for (const XMFLOAT3& point : points)
+			duplicate |= Vec3LengthSq(Vec3Sub(point, mesh.vertices[best].position)) < 1e-10f;
+		if (!duplicate)
+			points.push_back(mesh.vertices[best].position);
+		if (points.size() >= maxPoints)
+			break;
+	}
+
+	XMFLOAT3 center(0.0f, 0.0f, 0.0f);
+	for (const XMFLOAT3& point : points)
+		center = Vec3Add(center, point);
+	center = Vec3Scale(center, 1.0f / points.size());
+
+	hull->center = center;
+	hull->halfExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	hull->points.resize(points.size());
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		hull->points[i] = Vec3Sub(points[i], center);
+		hull->halfExtents.x = std::max(hull->halfExtents.x, fabsf(hull->points[i].x));
+		hull->halfExtents.y = std::max(hull->halfExtents.y, fabsf(hull->points[i].y));
+		hull->halfExtents.z = std::max(hull->halfExtents.z, fabsf(hull->points[i].z));
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		shapes
+// ==============================================================
+
+CollisionShape MakeSphereShape(float radius)
+{
+	CollisionShape shape;
+	shape.type = Shape_Sphere;
+	shape.radius = radius;
+	shape.halfExtents = XMFLOAT3(radius, radius, radius);
+	shape.hull = nullptr;
+	return shape;
+}
+
+CollisionShape MakeBoxShape(const XMFLOAT3& halfExtents)
+{
+	CollisionShape shape;
+	shape.type = Shape_Box;
+	shape.radius = 0.0f;
+	shape.halfExtents = halfExtents;
+	shape.hull = nullptr;
+	return shape;
+}
+
+CollisionShape MakeHullShape(const ConvexHull* hull)
+{
+	CollisionShape shape;
+	shape.type = Shape_Hull;
+	shape.radius = 0.0f;
+	shape.halfExtents = hull->halfExtents;
+	shape.hull = hull;
+	return shape;
+}
+
+Aabb GetShapeBounds(const CollisionShape& shape, const RigidTransform& transform)
+{
+	if (shape.type == Shape_Sphere)
+		return MakeAabb(transform.position, XMFLOAT3(shape.radius, shape.radius, shape.radius));
+
+	// boxes and hulls, the local box turned to world space
+	XMFLOAT3 x = QuatRotate(transform.rotation, XMFLOAT3(1.0f, 0.0f, 0.0f));
+	XMFLOAT3 y = QuatRotate(transform.rotation, XMFLOAT3(0.0f, 1.0f, 0.0f));
+	XMFLOAT3 z = QuatRotate(transform.rotation, XMFLOAT3(0.0f, 0.0f, 1.0f));
+	const XMFLOAT3& h = shape.halfExtents;
+	XMFLOAT3 half(fabsf(x.x) * h.x + fabsf(y.x) * h.y + fabsf(z.x) * h.z,
+		fabsf(x.y) * h.x + fabsf(y.y) * h.y + fabsf(z.y) * h.z,
+		fabsf(x.z) * h.x + fabsf(y.z) * h.y + fabsf(z.z) * h.z);
+	return MakeAabb(transform.position, half);
+}
+
+
+// ==============================================================
+//		manifold helpers
+// ==============================================================
+
+static void AddContact(ContactManifold* manifold, const RigidTransform& a, const RigidTransform& b,
+	const XMFLOAT3& pointA, const XMFLOAT3& pointB, float depth)
+{
+	if (manifold->pointCount >= MAX_MANIFOLD_POINTS)
+		return;
+
+	ContactPoint& contact = manifold->points[manifold->pointCount++];
+	contact.localA = QuatRotateInverse(a.rotation, Vec3Sub(pointA, a.position));
+	contact.localB = QuatRotateInverse(b.rotation, Vec3Sub(pointB, b.position));
+	contact.position = Vec3Scale(Vec3Add(pointA, pointB), 0.5f);
+	contact.depth = depth;
+	contact.normalImpulse = 0.0f;
+	contact.tangentImpulse[0] = 0.0f;
+	contact.tangentImpulse[1] = 0.0f;
+}
+
+// twice the area of the quad the four points make, whichever order they are in
+static float QuadArea(const XMFLOAT3& p0, const XMFLOAT3& p1, const XMFLOAT3& p2, const XMFLOAT3& p3)
+{
+	float a = Vec3LengthSq(Vec3Cross(Vec3Sub(p0, p1), Vec3Sub(p2, p3)));
+	float b = Vec3LengthSq(Vec3Cross(Vec3Sub(p0, p2), Vec3Sub(p1, p3)));
+	float c = Vec3LengthSq(Vec3Cross(Vec3Sub(p0, p3), Vec3Sub(p1, p2)));
+	return sqrtf(std::max(a, std::max(b, c)));
+}
+
+// cuts a list of candidate points down to the four that cover the most area, always keeping the deepest
+// (the deepest is what stops things sinking, the spread is what stops them rocking)
+static void ReduceContacts(std::vector<ContactPoint>* points, ContactManifold* manifold)
+{
+	while (points->size() > MAX_MANIFOLD_POINTS)
+	{
+		size_t deepest = 0;
+		for (size_t i = 1; i < points->size(); i++)
+		{
+			if ((*points)[i].depth > (*points)[deepest].depth)
+				deepest = i;
+		}
+
+		size_t drop = SIZE_MAX;
+		float bestArea = -1.0f;
+		for (size_t candidate = 0; candidate < points->size(); candidate++)
+		{
+			if (candidate == deepest)
+				continue;
+
+			// the area without the candidate, only the first four others count if there are more
+			const XMFLOAT3* rest[MAX_MANIFOLD_POINTS];
+			UINT restCount = 0;
+			for (size_t i = 0; i < points->size() && restCount < MAX_MANIFOLD_POINTS; i++)
+			{
+				if (i != candidate)
+					rest[restCount++] = &(*points)[i].position;
+			}
+			float area = QuadArea(*rest[0], *rest[1], *rest[2], *rest[3]);
+			if (area > bestArea)
+			{
+				bestArea = area;
+				drop = candidate;
+			}
+		}
+		points->erase(points->begin() + drop);
+	}
+
+	manifold->pointCount = (UINT)points->size();
+	for (size_t i = 0; i < points->size(); i++)
+		manifold->points[i] = (*points)[i];
+}
+
+static void FlipManifold(ContactManifold* manifold)
+{
+	manifold->normal = Vec3Negate(manifold->normal);
+	for (UINT i = 0; i < manifold->pointCount; i++)
+		std::swap(manifold->points[i].localA, manifold->points[i].localB);
+}
+
+// contacts that were there last step keep what the solver worked out for them, so stacks settle instead of jittering
+static void CarryImpulses(const ContactManifold& previous, ContactManifold* manifold)
+{
+	for (UINT i = 0; i < manifold->pointCount; i++)
+	{
+		ContactPoint& contact = manifold->points[i];
+		float bestDistance = kContactMatchDistance * kContactMatchDistance;
+		const ContactPoint* match = nullptr;
+		for (UINT j = 0; j < previous.pointCount; j++)
+		{
+			float distance = Vec3LengthSq(Vec3Sub(previous.points[j].localA, contact.localA));
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				match = &previous.points[j];
+			}
+		}
+
+		if (match)
+		{
+			contact.normalImpulse = match->normalImpulse;
+			contact.tangentImpulse[0] = match->tangentImpulse[0];
+			contact.tangentImpulse[1] = match->tangentImpulse[1];
+		}
+	}
+}
+
+
+// ==============================================================
+//		spheres and boxes
+// ==============================================================
+
+static bool CollideSpheres(const CollisionShape& shapeA, const RigidTransform& a, const CollisionShape& shapeB,
+	const RigidTransform& b, ContactManifold* manifold)
+{
+	XMFLOAT3 offset = Vec3Sub(b.position, a.position);
+	float distanceSq = Vec3LengthSq(offset);
+	float radii = shapeA.radius + shapeB.radius;
+	if (distanceSq > radii * radii)
+		return false;
+
+	float distance = sqrtf(distanceSq);
+	manifold->normal = (distance > 1e-6f) ? Vec3Scale(offset, 1.0f / distance) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+	AddContact(manifold, a, b, Vec3MultiplyAdd(a.position, manifold->normal, shapeA.radius),
+		Vec3MultiplyAdd(b.position, manifold->normal, -shapeB.radius), radii - distance);
+	return true;
+}
+
+static bool CollideSphereBox(const CollisionShape& sphere, const RigidTransform& a, const CollisionShape& box,
+	const RigidTransform& b, ContactManifold* manifold)
+{
+	const XMFLOAT3& h = box.halfExtents;
+	XMFLOAT3 local = QuatRotateInverse(b.rotation, Vec3Sub(a.position, b.position));
+	XMFLOAT3 closest(std::max(-h.x, std::min(local.x, h.x)), std::max(-h.y, std::min(local.y, h.y)), std::max(-h.z, std::min(local.z, h.z)));
+
+	XMFLOAT3 outward; // box to sphere, box space
+	float depth;
+	XMFLOAT3 offset = Vec3Sub(local, closest);
+	float distanceSq = Vec3LengthSq(offset);
+	if (distanceSq > 1e-12f)
+	{
+		if (distanceSq > sphere.radius * sphere.radius)
+			return false;
+		float distance = sqrtf(distanceSq);
+		outward = Vec3Scale(offset, 1.0f / distance);
+		depth = sphere.radius - distance;
+	}
+	else
+	{
+		// the centre is inside the box, push out through the nearest face
+		float gaps[3] = { h.x - fabsf(local.x), h.y - fabsf(local.y), h.z - fabsf(local.z) };
+		int axis = (gaps[0] <= gaps[1] && gaps[0] <= gaps[2]) ? 0 : (gaps[1] <= gaps[2] ? 1 : 2);
+		float values[3] = { 0.0f, 0.0f, 0.0f };
+		values[axis] = ((&local.x)[axis] >= 0.0f) ? 1.0f : -1.0f;
+		outward = XMFLOAT3(values[0], values[1], values[2]);
+		(&closest.x)[axis] = values[axis] * (&h.x)[axis];
+		depth = sphere.radius + gaps[axis];
+	}
+
+	manifold->normal = Vec3Negate(QuatRotate(b.rotation, outward));
+	XMFLOAT3 pointB = Vec3Add(b.position, QuatRotate(b.rotation, closest));
+	XMFLOAT3 pointA = Vec3MultiplyAdd(a.position, manifold->normal, sphere.radius);
+	AddContact(manifold, a, b, pointA, pointB, depth);
+	return true;
+}
+
+// keeps the part of 'polygon' where dot(normal, p) <= offset
+static void ClipPolygon(std::vector<XMFLOAT3>* polygon, const XMFLOAT3& normal, float offset)
+{
+	std::vector<XMFLOAT3> clipped;
+	size_t count = polygon->size();
+	for (size_t i = 0; i < count; i++)
+	{
+		const XMFLOAT3& from = (*polygon)[i];
+		const XMFLOAT3& to = (*polygon)[(i + 1) % count];
+		float fromDistance = Vec3Dot(normal, from) - offset;
+		float toDistance = Vec3Dot(normal, to) - offset;
+		if (fromDistance <= 0.0f)
+			clipped.push_back(from);
+		if ((fromDistance < 0.0f) != (toDistance < 0.0f))
+		{
+			float t = fromDistance / (fromDistance - toDistance);
+			clipped.push_back(Vec3Add(from, Vec3Scale(Vec3Sub(to, from), t)));
+		}
+	}
+	polygon->swap(clipped);
+}
+
+// separating axis test over the 15 axes, then the incident face clipped against the reference face for up to 4 points
+static bool CollideBoxes(const CollisionShape& shapeA, const RigidTransform& a, const CollisionShape& shapeB,
+	const RigidTransform& b, ContactManifold* manifold)
+{
+	XMFLOAT3 axesA[3] = { QuatRotate(a.rotation, XMFLOAT3(1, 0, 0)), QuatRotate(a.rotation, XMFLOAT3(0, 1, 0)), QuatRotate(a.rotation, XMFLOAT3(0, 0, 1)) };
+	XMFLOAT3 axesB[3] = { QuatRotate(b.rotation, XMFLOAT3(1, 0, 0)), QuatRotate(b.rotation, XMFLOAT3(0, 1, 0)), QuatRotate(b.rotation, XMFLOAT3(0, 0, 1)) };
+	const float* halfA = &shapeA.halfExtents.x;
+	const float* halfB = &shapeB.halfExtents.x;
+	XMFLOAT3 offset = Vec3Sub(b.position, a.position);
+
+	auto project = [](const XMFLOAT3* axes, const float* half, const XMFLOAT3& axis)
+	{
+		return half[0] * fabsf(Vec3Dot(axes[0], axis)) + half[1] * fabsf(Vec3Dot(axes[1], axis)) + half[2] * fabsf(Vec3Dot(axes[2], axis));
+	};
+
+	// separation along each face axis, the least negative wins. faces are preferred to edges and A to B when it is
+	// close, flipping between near equal axes from one step to the next makes stacks jitter
+	float faceA = -FLT_MAX, faceB = -FLT_MAX;
+	int faceAIndex = 0, faceBIndex = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		float separation = fabsf(Vec3Dot(offset, axesA[i])) - (halfA[i] + project(axesB, halfB, axesA[i]));
+		if (separation > 0.0f)
+			return false;
+		if (separation > faceA)
+		{
+			faceA = separation;
+			faceAIndex = i;
+		}
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		float separation = fabsf(Vec3Dot(offset, axesB[i])) - (project(axesA, halfA, axesB[i]) + halfB[i]);
+		if (separation > 0.0f)
+			return false;
+		if (separation > faceB)
+		{
+			faceB = separation;
+			faceBIndex = i;
+		}
+	}
+
+	float edge = -FLT_MAX;
+	int edgeA = 0, edgeB = 0;
+	XMFLOAT3 edgeAxis(0.0f, 0.0f, 0.0f);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			XMFLOAT3 axis = Vec3Cross(axesA[i], axesB[j]);
+			float length = Vec3Length(axis);
+			if (length < 1e-5f)
+				continue; // parallel edges, the face axes cover it
+			axis = Vec3Scale(axis, 1.0f / length);
+			float separation = fabsf(Vec3Dot(offset, axis)) - (project(axesA, halfA, axis) + project(axesB, halfB, axis));
+			if (separation > 0.0f)
+				return false;
+			if (separation > edge)
+			{
+				edge = separation;
+				edgeA = i;
+				edgeB = j;
+				edgeAxis = axis;
+			}
+		}
+	}
+
+	const float relativeTolerance = 0.95f, absoluteTolerance = 0.01f;
+	bool useB = faceB > relativeTolerance * faceA + absoluteTolerance * 0.1f;
+	float face = useB ? faceB : faceA;
+	if (edge > relativeTolerance * face + absoluteTolerance)
+	{
+		// edge against edge, one point between the closest points of the two edges
+		if (Vec3Dot(edgeAxis, offset) < 0.0f)
+			edgeAxis = Vec3Negate(edgeAxis);
+
+		XMFLOAT3 centerA = a.position, centerB = b.position;
+		for (int k = 0; k < 3; k++)
+		{
+			if (k != edgeA)
+				centerA = Vec3MultiplyAdd(centerA, axesA[k], (Vec3Dot(axesA[k], edgeAxis) >= 0.0f) ? halfA[k] : -halfA[k]);
+			if (k != edgeB)
+				centerB = Vec3MultiplyAdd(centerB, axesB[k], (Vec3Dot(axesB[k], edgeAxis) <= 0.0f) ? halfB[k] : -halfB[k]);
+		}
+
+		// closest points of two lines, clamped to the edges
+		const XMFLOAT3& directionA = axesA[edgeA];
+		const XMFLOAT3& directionB = axesB[edgeB];
+		XMFLOAT3 between = Vec3Sub(centerA, centerB);
+		float ab = Vec3Dot(directionA, directionB);
+		float da = Vec3Dot(directionA, between);
+		float db = Vec3Dot(directionB, between);
+		float denominator = 1.0f - ab * ab;
+		float s = (denominator > 1e-6f) ? (ab * db - da) / denominator : 0.0f;
+		s = std::max(-halfA[edgeA], std::min(s, halfA[edgeA]));
+		float t = std::max(-halfB[edgeB], std::min(db + s * ab, halfB[edgeB]));
+
+		manifold->normal = edgeAxis;
+		AddContact(manifold, a, b, Vec3MultiplyAdd(centerA, directionA, s), Vec3MultiplyAdd(centerB, directionB, t), -edge);
+		return true;
+	}
+
+	// face contact, 'reference' owns the face and its normal points at 'incident'
+	const RigidTransform& reference = useB ? b : a;
+	const XMFLOAT3* referenceAxes = useB ? axesB : axesA;
+	const float* referenceHalf = useB ? halfB : halfA;
+	const RigidTransform& incident = useB ? a : b;
+	const XMFLOAT3* incidentAxes = useB ? axesA : axesB;
+	const float* incidentHalf = useB ? halfA : halfB;
+	int referenceIndex = useB ? faceBIndex : faceAIndex;
+
+	XMFLOAT3 normal = referenceAxes[referenceIndex];
+	if (Vec3Dot(normal, Vec3Sub(incident.position, reference.position)) < 0.0f)
+		normal = Vec3Negate(normal);
+
+	// the incident face is the one facing most against the normal
+	int incidentIndex = 0;
+	float mostAgainst = -FLT_MAX;
+	for (int k = 0; k < 3; k++)
+	{
+		float against = fabsf(Vec3Dot(incidentAxes[k], normal));
+		if (against > mostAgainst)
+		{
+			mostAgainst = against;
+			incidentIndex = k;
+		}
+	}
+	XMFLOAT3 incidentNormal = incidentAxes[incidentIndex];
+	if (Vec3Dot(incidentNormal, normal) > 0.0f)
+		incidentNormal = Vec3Negate(incidentNormal);
+
+	XMFLOAT3 incidentCenter = Vec3MultiplyAdd(incident.position, incidentNormal, incidentHalf[incidentIndex]);
+	const XMFLOAT3& u = incidentAxes[(incidentIndex + 1) % 3];
+	const XMFLOAT3& v = incidentAxes[(incidentIndex + 2) % 3];
+	float uHalf = incidentHalf[(incidentIndex + 1) % 3];
+	float vHalf = incidentHalf[(incidentIndex + 2) % 3];
+	std::vector<XMFLOAT3> polygon;
+	polygon.push_back(Vec3MultiplyAdd(Vec3MultiplyAdd(incidentCenter, u, uHalf), v, vHalf));
+	polygon.push_back(Vec3MultiplyAdd(Vec3MultiplyAdd(incidentCenter, u, -uHalf), v, vHalf));
+	polygon.push_back(Vec3MultiplyAdd(Vec3MultiplyAdd(incidentCenter, u, -uHalf), v, -vHalf));
+	polygon.push_back(Vec3MultiplyAdd(Vec3MultiplyAdd(incidentCenter, u, uHalf), v, -vHalf));
+
+	// clip to the sides of the reference face
+	for (int k = 1; k <= 2; k++)
+	{
+		int side = (referenceIndex + k) % 3;
+		const XMFLOAT3& axis = referenceAxes[side];
+		float center = Vec3Dot(axis, reference.position);
+		ClipPolygon(&polygon, axis, center + referenceHalf[side]);
+		ClipPolygon(&polygon, Vec3Negate(axis), -center + referenceHalf[side]);
+	}
+
+	XMFLOAT3 facePoint = Vec3MultiplyAdd(reference.position, normal, referenceHalf[referenceIndex]);
+	float faceOffset = Vec3Dot(normal, facePoint);
+	std::vector<ContactPoint> candidates;
+	manifold->normal = useB ? Vec3Negate(normal) : normal;
+	for (const XMFLOAT3& point : polygon)
+	{
+		float depth = faceOffset - Vec3Dot(normal, point);
+		if (depth < 0.0f)
+			continue;
+
+		XMFLOAT3 onReference = Vec3MultiplyAdd(point, normal, depth);
+		manifold->pointCount = 0;
+		if (useB)
+			AddContact(manifold, a, b, point, onReference, depth);
+		else
+			AddContact(manifold, a, b, onReference, point, depth);
+		candidates.push_back(manifold->points[0]);
+	}
+
+	ReduceContacts(&candidates, manifold);
+	return manifold->pointCount > 0;
+}
+
+
+// ==============================================================
+//		GJK / EPA
+// ==============================================================
+
+namespace
+{
+	// a point on the Minkowski difference A - B and the two shape points it came from
+	struct SupportPoint
+	{
+		XMFLOAT3 v;
+		XMFLOAT3 a;
+		XMFLOAT3 b;
+	};
+
+	struct ShapePair
+	{
+		const CollisionShape* shapeA;
+		const RigidTransform* a;
+		const CollisionShape* shapeB;
+		const RigidTransform* b;
+	};
+}
+
+static XMFLOAT3 SupportLocal(const CollisionShape& shape, const XMFLOAT3& direction)
+{
+	switch (shape.type)
+	{
+	case Shape_Sphere:
+	{
+		XMFLOAT3 unit = Vec3Normalize(direction);
+		return (Vec3LengthSq(unit) > 0.0f) ? Vec3Scale(unit, shape.radius) : XMFLOAT3(shape.radius, 0.0f, 0.0f);
+	}
+	case Shape_Box:
+		return XMFLOAT3(direction.x >= 0.0f ? shape.halfExtents.x : -shape.halfExtents.x,
+			direction.y >= 0.0f ? shape.halfExtents.y : -shape.halfExtents.y,
+			direction.z >= 0.0f ? shape.halfExtents.z : -shape.halfExtents.z);
+	default:
+	{
+		const std::vector<XMFLOAT3>& points = shape.hull->points;
+		size_t best = 0;
+		float bestDistance = -FLT_MAX;
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			float distance = Vec3Dot(points[i], direction);
+			if (distance > bestDistance)
+			{
+				bestDistance = distance;
+				best = i;
+			}
+		}
+		return points[best];
+	}
+	}
+}
+
+static XMFLOAT3 SupportWorld(const CollisionShape& shape, const RigidTransform& transform, const XMFLOAT3& direction)
+{
+	XMFLOAT3 local = SupportLocal(shape, QuatRotateInverse(transform.rotation, direction));
+	return Vec3Add(transform.position, QuatRotate(transform.rotation, local));
+}
+
+static SupportPoint Support(const ShapePair& pair, const XMFLOAT3& direction)
+{
+	SupportPoint point;
+	point.a = SupportWorld(*pair.shapeA, *pair.a, direction);
+	point.b = SupportWorld(*pair.shapeB, *pair.b, Vec3Negate(direction));
+	point.v = Vec3Sub(point.a, point.b);
+	return point;
+}
+
+// the simplex functions keep the newest point in simplex[0] and point 'direction' at the origin from the part
+// of the simplex closest to it. they return true once the simplex holds the origin
+
+static bool DoLine(SupportPoint* simplex, int* count, XMFLOAT3* direction)
+{
+	XMFLOAT3 ab = Vec3Sub(simplex[1].v, simplex[0].v);
+	XMFLOAT3 ao = Vec3Negate(simplex[0].v);
+	if (Vec3Dot(ab, ao) > 0.0f)
+	{
+		*direction = Vec3Cross(Vec3Cross(ab, ao), ab);
+		*count = 2;
+		return Vec3LengthSq(*direction) < 1e-20f; // the origin is on the line
+	}
+	*direction = ao;
+	*count = 1;
+	return false;
+}
+
+static bool DoTriangle(SupportPoint* simplex, int* count, XMFLOAT3* direction)
+{
+	SupportPoint a = simplex[0], b = simplex[1], c = simplex[2];
+	XMFLOAT3 ab = Vec3Sub(b.v, a.v);
+	XMFLOAT3 ac = Vec3Sub(c.v, a.v);
+	XMFLOAT3 ao = Vec3Negate(a.v);
+	XMFLOAT3 abc = Vec3Cross(ab, ac);
+
+	if (Vec3Dot(Vec3Cross(abc, ac), ao) > 0.0f)
+	{
+		if (Vec3Dot(ac, ao) > 0.0f)
+		{
+			simplex[1] = c;
+			*count = 2;
+			*direction = Vec3Cross(Vec3Cross(ac, ao), ac);
+			return Vec3LengthSq(*direction) < 1e-20f;
+		}
+		*count = 2;
+		return DoLine(simplex, count, direction);
+	}
+	if (Vec3Dot(Vec3Cross(ab, abc), ao) > 0.0f)
+	{
+		*count = 2;
+		return DoLine(simplex, count, direction);
+	}
+
+	float side = Vec3Dot(abc, ao);
+	*count = 3;
+	if (side > 0.0f)
+		*direction = abc;
+	else
+	{
+		simplex[1] = c;
+		simplex[2] = b;
+		*direction = Vec3Negate(abc);
+	}
+	return fabsf(side) < 1e-12f; // the origin is on the triangle
+}
+
+static bool DoTetrahedron(SupportPoint* simplex, int* count, XMFLOAT3* direction)
+{
+	SupportPoint a = simplex[0], b = simplex[1], c = simplex[2], d = simplex[3];
+	XMFLOAT3 ao = Vec3Negate(a.v);
+
+	// each face's normal turned away from the vertex it doesn't use
+	const SupportPoint faces[3][3] = { { a, b, c }, { a, c, d }, { a, d, b } };
+	const SupportPoint* opposite[3] = { &d, &b, &c };
+	for (int i = 0; i < 3; i++)
+	{
+		XMFLOAT3 normal = Vec3Cross(Vec3Sub(faces[i][1].v, a.v), Vec3Sub(faces[i][2].v, a.v));
+		if (Vec3Dot(normal, Vec3Sub(opposite[i]->v, a.v)) > 0.0f)
+			normal = Vec3Negate(normal);
+		if (Vec3Dot(normal, ao) > 0.0f)
+		{
+			simplex[0] = faces[i][0];
+			simplex[1] = faces[i][1];
+			simplex[2] = faces[i][2];
+			*count = 3;
+			return DoTriangle(simplex, count, direction);
+		}
+	}
+	return true;
+}
+
+static bool Gjk(const ShapePair& pair, SupportPoint* simplex, int* count)
+{
+	XMFLOAT3 direction = Vec3Sub(pair.b->position, pair.a->position);
+	if (Vec3LengthSq(direction) < 1e-12f)
+		direction = XMFLOAT3(1.0f, 0.0f, 0.0f);
+
+	simplex[0] = Support(pair, direction);
+	*count = 1;
+	direction = Vec3Negate(simplex[0].v);
+
+	for (int iteration = 0; iteration < 64; iteration++)
+	{
+		if (Vec3LengthSq(direction) < 1e-20f)
+			return true; // touching exactly
+
+		SupportPoint point = Support(pair, direction);
+		if (Vec3Dot(point.v, direction) < 0.0f)
+			return false;
+
+		for (int i = *count; i > 0; i--)
+			simplex[i] = simplex[i - 1];
+		simplex[0] = point;
+		(*count)++;
+
+		bool contains;
+		if (*count == 2)
+			contains = DoLine(simplex, count, &direction);
+		else if (*count == 3)
+			contains = DoTriangle(simplex, count, &direction);
+		else
+			contains = DoTetrahedron(simplex, count, &direction);
+		if (contains)
+			return true;
+	}
+	return false;
+}
+
+// GJK can stop on a point, line or triangle if the origin is exactly on it, EPA needs a tetrahedron to start from
+static bool CompleteTetrahedron(const ShapePair& pair, std::vector<SupportPoint>* vertices)
+{
+	const XMFLOAT3 axes[6] = { XMFLOAT3(1, 0, 0), XMFLOAT3(-1, 0, 0), XMFLOAT3(0, 1, 0), XMFLOAT3(0, -1, 0), XMFLOAT3(0, 0, 1), XMFLOAT3(0, 0, -1) };
+	while (vertices->size() < 4)
+	{
+		std::vector<XMFLOAT3> directions;
+		if (vertices->size() == 3)
+		{
+			XMFLOAT3 normal = Vec3Cross(Vec3Sub((*vertices)[1].v, (*vertices)[0].v), Vec3Sub((*vertices)[2].v, (*vertices)[0].v));
+			directions.push_back(normal);
+			directions.push_back(Vec3Negate(normal));
+		}
+		directions.insert(directions.end(), axes, axes + 6);
+
+		bool added = false;
+		for (const XMFLOAT3& direction : directions)
+		{
+			SupportPoint point = Support(pair, direction);
+			const std::vector<SupportPoint>& v = *vertices;
+			bool usable;
+			if (v.size() == 1)
+				usable = Vec3LengthSq(Vec3Sub(point.v, v[0].v)) > 1e-10f;
+			else if (v.size() == 2)
+				usable = Vec3LengthSq(Vec3Cross(Vec3Sub(v[1].v, v[0].v), Vec3Sub(point.v, v[0].v))) > 1e-10f;
+			else
+			{
+				XMFLOAT3 normal = Vec3Normalize(Vec3Cross(Vec3Sub(v[1].v, v[0].v), Vec3Sub(v[2].v, v[0].v)));
+				usable = fabsf(Vec3Dot(normal, Vec3Sub(point.v, v[0].v))) > 1e-5f;
+			}
+			if (usable)
+			{
+				vertices->push_back(point);
+				added = true;
+				break;
+			}
+		}
+		if (!added)
+			return false; // flat, there is nothing to push apart
+	}
+	return true;
+}
+
+namespace
+{
+	struct EpaFace
+	{
+		int		 a, b, c;
+		XMFLOAT3 normal; // unit, pointing out of the polytope
+		float	 distance; // from the origin to the face's plane
+	};
+}
+
+static bool MakeEpaFace(const std::vector<SupportPoint>& vertices, int a, int b, int c, EpaFace* face)
+{
+	XMFLOAT3 normal = Vec3Cross(Vec3Sub(vertices[b].v, vertices[a].v), Vec3Sub(vertices[c].v, vertices[a].v));
+	float length = Vec3Length(normal);
+	if (length < 1e-12f)
+		return false;
+	face->a = a;
+	face->b = b;
+	face->c = c;
+	face->normal = Vec3Scale(normal, 1.0f / length);
+	face->distance = Vec3Dot(face->normal, vertices[a].v);
+	return true;
+}
+
+// barycentric coordinates of 'p' in the triangle
+static void Barycentric(const XMFLOAT3& p, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, float* u, float* v, float* w)
+{
+	XMFLOAT3 v0 = Vec3Sub(b, a), v1 = Vec3Sub(c, a), v2 = Vec3Sub(p, a);
+	float d00 = Vec3Dot(v0, v0), d01 = Vec3Dot(v0, v1), d11 = Vec3Dot(v1, v1);
+	float d20 = Vec3Dot(v2, v0), d21 = Vec3Dot(v2, v1);
+	float denominator = d00 * d11 - d01 * d01;
+	if (fabsf(denominator) < 1e-20f)
+	{
+		*u = 1.0f;
+		*v = 0.0f;
+		*w = 0.0f;
+		return;
+	}
+	*v = (d11 * d20 - d01 * d21) / denominator;
+	*w = (d00 * d21 - d01 * d20) / denominator;
+	*u = 1.0f - *v - *w;
+}
+
+// grows the polytope towards the face of A - B closest to the origin, that face gives the normal and depth
+static bool Epa(const ShapePair& pair, const SupportPoint* simplex, int count, XMFLOAT3* normal, float* depth,
+	XMFLOAT3* pointA, XMFLOAT3* pointB)
+{
+	std::vector<SupportPoint> vertices(simplex, simplex + count);
+	if (!CompleteTetrahedron(pair, &vertices))
+		return false;
+
+	XMFLOAT3 centroid = Vec3Scale(Vec3Add(Vec3Add(vertices[0].v, vertices[1].v), Vec3Add(vertices[2].v, vertices[3].v)), 0.25f);
+	std::vector<EpaFace> faces;
+	const int start[4][3] = { { 0, 1, 2 }, { 0, 3, 1 }, { 0, 2, 3 }, { 1, 3, 2 } };
+	for (int i = 0; i < 4; i++)
+	{
+		EpaFace face;
+		if (!MakeEpaFace(vertices, start[i][0], start[i][1], start[i][2], &face))
+			return false;
+		if (Vec3Dot(face.normal, Vec3Sub(vertices[face.a].v, centroid)) < 0.0f)
+			MakeEpaFace(vertices, start[i][0], start[i][2], start[i][1], &face);
+		faces.push_back(face);
+	}
+
+	size_t closest = 0;
+	for (int iteration = 0; iteration < 64; iteration++)
+	{
+		closest = 0;
+		for (size_t i = 1; i < faces.size(); i++)
+		{
+			if (faces[i].distance < faces[closest].distance)
+				closest = i;
+		}
+
+		EpaFace face = faces[closest];
+		SupportPoint point = Support(pair, face.normal);
+		if (Vec3Dot(point.v, face.normal) - face.distance < 1e-4f)
+			break;
+
+		int index = (int)vertices.size();
+		vertices.push_back(point);
+
+		// remove every face the new point can see, the edges left open form the horizon
+		std::vector<std::pair<int, int>> horizon;
+		for (size_t i = 0; i < faces.size();)
+		{
+			if (Vec3Dot(faces[i].normal, Vec3Sub(point.v, vertices[faces[i].a].v)) > 0.0f)
+			{
+				const int edges[3][2] = { { faces[i].a, faces[i].b }, { faces[i].b, faces[i].c }, { faces[i].c, faces[i].a } };
+				for (int e = 0; e < 3; e++)
+				{
+					auto shared = std::find(horizon.begin(), horizon.end(), std::make_pair(edges[e][1], edges[e][0]));
+					if (shared != horizon.end())
+						horizon.erase(shared);
+					else
+						horizon.push_back(std::make_pair(edges[e][0], edges[e][1]));
+				}
+				faces[i] = faces.back();
+				faces.pop_back();
+			}
+			else
+				i++;
+		}
+
+		for (const std::pair<int, int>& edge : horizon)
+		{
+			EpaFace added;
+			if (MakeEpaFace(vertices, edge.first, edge.second, index, &added))
+				faces.push_back(added);
+		}
+		if (faces.empty())
+			return false;
+	}
+
+	closest = 0;
+	for (size_t i = 1; i < faces.size(); i++)
+	{
+		if (faces[i].distance < faces[closest].distance)
+			closest = i;
+	}
+	const EpaFace& face = faces[closest];
+
+	float u, v, w;
+	Barycentric(Vec3Scale(face.normal, face.distance), vertices[face.a].v, vertices[face.b].v, vertices[face.c].v, &u, &v, &w);
+	*pointA = Vec3Add(Vec3Add(Vec3Scale(vertices[face.a].a, u), Vec3Scale(vertices[face.b].a, v)), Vec3Scale(vertices[face.c].a, w));
+	*pointB = Vec3Add(Vec3Add(Vec3Scale(vertices[face.a].b, u), Vec3Scale(vertices[face.b].b, v)), Vec3Scale(vertices[face.c].b, w));
+	*normal = face.normal;
+	*depth = face.distance;
+	return true;
+}
+
+// one new point from GJK/EPA, added to what is still valid of last step's manifold
+static bool CollideConvex(const CollisionShape& shapeA, const RigidTransform& a, const CollisionShape& shapeB,
+	const RigidTransform& b, const ContactManifold* previous, ContactManifold* manifold)
+{
+	ShapePair pair = { &shapeA, &a, &shapeB, &b };
+	SupportPoint simplex[4];
+	int count = 0;
+	if (!Gjk(pair, simplex, &count))
+		return false;
+
+	XMFLOAT3 normal, pointA, pointB;
+	float depth;
+	if (!Epa(pair, simplex, count, &normal, &depth, &pointA, &pointB))
+		return false;
+
+	manifold->normal = normal;
+	manifold->pointCount = 0;
+	AddContact(manifold, a, b, pointA, pointB, depth);
+	std::vector<ContactPoint> candidates(1, manifold->points[0]);
+
+	if (previous)
+	{
+		for (UINT i = 0; i < previous->pointCount; i++)
+		{
+			ContactPoint contact = previous->points[i];
+			XMFLOAT3 worldA = Vec3Add(a.position, QuatRotate(a.rotation, contact.localA));
+			XMFLOAT3 worldB = Vec3Add(b.position, QuatRotate(b.rotation, contact.localB));
+			XMFLOAT3 gap = Vec3Sub(worldA, worldB);
+			contact.depth = Vec3Dot(gap, normal);
+			XMFLOAT3 slide = Vec3MultiplyAdd(gap, normal, -contact.depth);
+
+			// separated, slid apart, or the same place as the new point
+			if (contact.depth < -kContactBreakDistance || Vec3LengthSq(slide) > kContactBreakDistance * kContactBreakDistance)
+				continue;
+			if (Vec3LengthSq(Vec3Sub(contact.localA, candidates[0].localA)) < kContactMatchDistance * kContactMatchDistance)
+				continue;
+
+			contact.position = Vec3Scale(Vec3Add(worldA, worldB), 0.5f);
+			candidates.push_back(contact);
+		}
+	}
+
+	ReduceContacts(&candidates, manifold);
+	return true;
+}
+
+bool CollideShapes(const CollisionShape& shapeA, const RigidTransform& transformA, const CollisionShape& shapeB,
+	const RigidTransform& transformB, const ContactManifold* previous, ContactManifold* manifold)
+{
+	manifold->pointCount = 0;
+
+	bool touching;
+	if (shapeA.type == Shape_Sphere && shapeB.type == Shape_Sphere)
+		touching = CollideSpheres(shapeA, transformA, shapeB, transformB, manifold);
+	else if (shapeA.type == Shape_Sphere && shapeB.type == Shape_Box)
+		touching = CollideSphereBox(shapeA, transformA, shapeB, transformB, manifold);
+	else if (shapeA.type == Shape_Box && shapeB.type == Shape_Sphere)
+	{
+		touching = CollideSphereBox(shapeB, transformB, shapeA, transformA, manifold);
+		if (touching)
+			FlipManifold(manifold);
+	}
+	else if (shapeA.type == Shape_Box && shapeB.type == Shape_Box)
+		touching = CollideBoxes(shapeA, transformA, shapeB, transformB, manifold);
+	else
+		touching = CollideConvex(shapeA, transformA, shapeB, transformB, previous, manifold);
+
+	if (!touching || manifold->pointCount == 0)
+	{
+		manifold->pointCount = 0;
+		return false;
+	}
+
+	if (previous)
+		CarryImpulses(*previous, manifold);
+	return true;
+}
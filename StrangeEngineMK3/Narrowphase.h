@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include "Geometry.h"
+#include "MeshImport.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		collision shapes
+// ==============================================================
+
+// a convex shape made from a mesh's outermost points, for GJK/EPA
+struct ConvexHull
+{
+	std::vector<XMFLOAT3> points; // moved so their average is at the origin
+	XMFLOAT3			  center; // where that average was in the mesh, a body using the hull sits there
+	XMFLOAT3			  halfExtents; // of the points' bounding box, also used for the inertia
+};
+
+// keeps the mesh points that are furthest out in any of a few hundred directions, at most 'maxPoints' of them
+// every point kept is a real hull corner, so the result sits just inside the true hull and is cheap to collide
+STRANGEENGINEMK3_API bool BuildConvexHull(const MeshData& mesh, ConvexHull* hull, UINT maxPoints = 64);
+
+enum ShapeType
+{
+	Shape_Sphere,
+	Shape_Box,
+	Shape_Hull,
+};
+
+struct CollisionShape
+{
+	ShapeType		  type;
+	float			  radius;	   // spheres
+	XMFLOAT3		  halfExtents; // boxes
+	const ConvexHull* hull;		   // not owned, has to outlive every body using it
+};
+
+STRANGEENGINEMK3_API CollisionShape MakeSphereShape(float radius);
+STRANGEENGINEMK3_API CollisionShape MakeBoxShape(const XMFLOAT3& halfExtents);
+STRANGEENGINEMK3_API CollisionShape MakeHullShape(const ConvexHull* hull);
+
+struct RigidTransform
+{
+	XMFLOAT3 position;
+	XMFLOAT4 rotation; // unit quaternion
+};
+
+// world space bounds of a shape at a transform
+STRANGEENGINEMK3_API Aabb GetShapeBounds(const CollisionShape& shape, const RigidTransform& transform);
+
+
+// ==============================================================
+//		contacts
+// ==============================================================
+
+#define MAX_MANIFOLD_POINTS 4
+
+struct ContactPoint
+{
+	XMFLOAT3 localA;	 // the contact on each body, in that body's space, so a manifold can be kept from frame to frame
+	XMFLOAT3 localB;
+	XMFLOAT3 position;	 // world, halfway between the two
+	float	 depth;		 // how far the shapes overlap here, negative if they've separated since
+	float	 normalImpulse;	 // what the solver applied last step, to warm start the next
+	float	 tangentImpulse[2];
+};
+
+struct ContactManifold
+{
+	XMFLOAT3	 normal; // from A to B
+	ContactPoint points[MAX_MANIFOLD_POINTS];
+	UINT		 pointCount;
+};
+
+// fills 'manifold' with where A and B touch, false if they don't
+// sphere/sphere, sphere/box and box/box have their own tests and give a full manifold every time. anything with a hull
+// goes through GJK and EPA, which give one point a step, so pass last step's manifold in 'previous' to build on
+STRANGEENGINEMK3_API bool CollideShapes(const CollisionShape& shapeA, const RigidTransform& transformA,
+	const CollisionShape& shapeB, const RigidTransform& transformB, const ContactManifold* previous, ContactManifold* manifold);
@@ -0,0 +1,486 @@
+#include "pch.h"
+#include "PackFile.h"
+#include "Log.h"
+#include "FileUtils.h"
+#include "Hash.h"
+#include "LZ4.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+std::string NormalizePackName(const std::string& name)
+{
+	std::string normalized = name;
+	for (char& c : normalized)
+	{
+		if (c == '\\')
+			c = '/';
+		else if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+	}
+	return normalized;
+}
+
+UINT64 HashPackName(const std::string& name)
+{
+	std::string normalized = NormalizePackName(name);
+	return HashBytes(normalized.data(), normalized.size());
+}
+
+
+// ==============================================================
+//		PackFile
+// ==============================================================
+
+PackFile::PackFile()
+{
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mData = nullptr;
+	mSize = 0;
+	mHeader = nullptr;
+	mEntries = nullptr;
+	mBlobs = nullptr;
+	mNames = nullptr;
+}
+
+PackFile::~PackFile()
+{
+	Close();
+}
+
+// is [offset, offset + size) inside a file of 'fileSize' bytes, without overflowing
+static bool InRange(UINT64 offset, UINT64 size, UINT64 fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+bool PackFile::Open(const std::wstring& path)
+{
+	Close();
+
+	mFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not open pack {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(PackHeader))
+	{
+		ReportError(LogCategory_Assets, "File is too small to be a pack {}", path);
+		Close();
+		return false;
+	}
+	mSize = (UINT64)fileSize.QuadPart;
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != nullptr)
+		mData = (const BYTE*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mData == nullptr)
+	{
+		ReportError(LogCategory_Assets, "Could not map pack {}", path);
+		Close();
+		return false;
+	}
+
+	// ==============================================================
+	//		validate the tables, everything after this trusts them
+	// ==============================================================
+
+	const PackHeader* header = (const PackHeader*)mData;
+	bool valid = header->magic == PACK_MAGIC && header->version == PACK_VERSION && header->fileSize == mSize
+		&& InRange(header->entriesOffset, (UINT64)header->entryCount * sizeof(PackEntry), mSize)
+		&& InRange(header->blobsOffset, (UINT64)header->blobCount * sizeof(PackBlob), mSize)
+		&& InRange(header->namesOffset, header->namesSize, mSize)
+		&& (header->namesSize == 0 || mData[header->namesOffset + header->namesSize - 1] == '\0');
+
+	if (valid)
+	{
+		const PackEntry* entries = (const PackEntry*)(mData + header->entriesOffset);
+		const PackBlob* blobs = (const PackBlob*)(mData + header->blobsOffset);
+		for (UINT i = 0; i < header->entryCount && valid; i++)
+		{
+			valid = entries[i].blob < header->blobCount && entries[i].nameOffset < header->namesSize
+				&& (i == 0 || entries[i - 1].nameHash < entries[i].nameHash);
+		}
+		for (UINT i = 0; i < header->blobCount && valid; i++)
+		{
+			valid = InRange(blobs[i].offset, blobs[i].storedSize, mSize) && blobs[i].compression <= PackCompression_LZ4
+				&& (blobs[i].compression != PackCompression_None || blobs[i].storedSize == blobs[i].size);
+		}
+	}
+
+	if (!valid)
+	{
+		ReportError(LogCategory_Assets, "Pack is corrupt or from a different version {}", path);
+		Close();
+		return false;
+	}
+
+	mHeader = header;
+	mEntries = (const PackEntry*)(mData + header->entriesOffset);
+	mBlobs = (const PackBlob*)(mData + header->blobsOffset);
+	mNames = (const char*)(mData + header->namesOffset);
+	return true;
+}
+
+void PackFile::Close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mData = nullptr;
+	mSize = 0;
+	mHeader = nullptr;
+	mEntries = nullptr;
+	mBlobs = nullptr;
+	mNames = nullptr;
+}
+
+int PackFile::FindEntry(const std::string& name) const
+{
+	if (mHeader == nullptr)
+		return -1;
+
+	UINT64 hash = HashPackName(name);
+	const PackEntry* end = mEntries + mHeader->entryCount;
+	const PackEntry* found = std::lower_bound(mEntries, end, hash, [](const PackEntry& entry, UINT64 value)
+	{
+		return entry.nameHash < value;
+	});
+	if (found == end || found->nameHash != hash)
+		return -1;
+	return (int)(found - mEntries);
+}
+
+const char* PackFile::GetEntryName(UINT entry) const
+{
+	return mNames + mEntries[entry].nameOffset;
+}
+
+UINT64 PackFile::GetEntrySize(UINT entry) const
+{
+	return mBlobs[mEntries[entry].blob].size;
+}
+
+UINT64 PackFile::GetStoredSize(UINT entry) const
+{
+	return mBlobs[mEntries[entry].blob].storedSize;
+}
+
+PackCompression PackFile::GetCompression(UINT entry) const
+{
+	return (PackCompression)mBlobs[mEntries[entry].blob].compression;
+}
+
+bool PackFile::ReadEntry(UINT entry, void* dest, UINT64 destSize) const
+{
+	const PackBlob& blob = mBlobs[mEntries[entry].blob];
+	if (destSize < blob.size)
+	{
+		ReportError(LogCategory_Assets, "Buffer is too small for the pack entry");
+		return false;
+	}
+
+	const BYTE* stored = mData + blob.offset;
+	if (blob.compression == PackCompression_None)
+	{
+		memcpy(dest, stored, (size_t)blob.size);
+		return true;
+	}
+
+	if (!LZ4Decompress(stored, (size_t)blob.storedSize, (BYTE*)dest, (size_t)blob.size))
+	{
+		ReportError(LogCategory_Assets, "Pack entry failed to decompress {}", GetEntryName(entry));
+		return false;
+	}
+	return true;
+}
+
+const BYTE* PackFile::GetUncompressedData(UINT entry) const
+{
+	const PackBlob& blob = mBlobs[mEntries[entry].blob];
+	return (blob.compression == PackCompression_None) ? mData + blob.offset : nullptr;
+}
+
+
+// ==============================================================
+//		PackWriter
+// ==============================================================
+
+PackWriter::PackWriter()
+{
+	mCompression = PackCompression_LZ4;
+	mSourceBytes = 0;
+}
+
+bool PackWriter::AddData(const std::string& name, const BYTE* data, size_t size)
+{
+	std::string normalized = NormalizePackName(name);
+	UINT64 nameHash = HashBytes(normalized.data(), normalized.size());
+	if (mNameLookup.count(nameHash))
+	{
+		ReportError(LogCategory_Assets, "Pack already has an entry called (or hashing the same as) {}", normalized);
+		return false;
+	}
+
+	// the same bytes under another name just point at the existing blob
+	UINT64 contentHash = HashBytes(data, size);
+	UINT blob = UINT_MAX;
+	auto range = mBlobLookup.equal_range(contentHash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		const std::vector<BYTE>& existing = mBlobs[it->second].data;
+		if (existing.size() == size && (size == 0 || memcmp(existing.data(), data, size) == 0))
+		{
+			blob = it->second;
+			break;
+		}
+	}
+
+	if (blob == UINT_MAX)
+	{
+		blob = (UINT)mBlobs.size();
+		mBlobs.push_back(PendingBlob());
+		mBlobs.back().data.assign(data, data + size);
+		mBlobs.back().hash = contentHash;
+		mBlobLookup.insert(std::make_pair(contentHash, blob));
+	}
+
+	mNameLookup[nameHash] = (UINT)mEntries.size();
+	mEntries.push_back({ normalized, nameHash, blob });
+	mSourceBytes += size;
+	return true;
+}
+
+bool PackWriter::AddFile(const std::string& name, const std::wstring& path)
+{
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart > 0x7FFFFFFF)
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		ReportError(LogCategory_Assets, "Could not read {}", path);
+		return false;
+	}
+
+	std::vector<BYTE> data((size_t)size.QuadPart);
+	DWORD read = 0;
+	bool ok = data.empty() || (ReadFile(file, data.data(), (DWORD)data.size(), &read, nullptr) && read == data.size());
+	CloseHandle(file);
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Could not read file for the pack");
+		return false;
+	}
+	return AddData(name, data.data(), data.size());
+}
+
+static std::string ToUTF8(const std::wstring& text)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, nullptr, 0, nullptr, nullptr);
+	std::string result(length > 0 ? length - 1 : 0, '\0');
+	if (length > 1)
+		WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, &result[0], length, nullptr, nullptr);
+	return result;
+}
+
+bool PackWriter::AddFolder(const std::wstring& folder)
+{
+	return AddFolderRecursive(folder, "");
+}
+
+bool PackWriter::AddFolderRecursive(const std::wstring& folder, const std::string& prefix)
+{
+	WIN32_FIND_DATAW data;
+	HANDLE find = FindFirstFileW((folder + L"\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not list folder {}", folder);
+		return false;
+	}
+
+	bool ok = true;
+	do
+	{
+		std::wstring name = data.cFileName;
+		if (name == L"." || name == L"..")
+			continue;
+
+		std::wstring path = folder + L"\\" + name;
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			ok &= AddFolderRecursive(path, prefix + ToUTF8(name) + "/");
+		else
+			ok &= AddFile(prefix + ToUTF8(name), path);
+	} while (FindNextFileW(find, &data));
+
+	FindClose(find);
+	return ok;
+}
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+bool PackWriter::Write(const std::wstring& path, PackWriteStats* stats)
+{
+	// ==============================================================
+	//		compress every blob over the job system
+	// ==============================================================
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	if (mCompression == PackCompression_LZ4)
+	{
+		JobSystem::Get()->ParallelFor((unsigned int)mBlobs.size(), 1, [this](unsigned int begin, unsigned int blobEnd)
+		{
+			for (unsigned int i = begin; i < blobEnd; i++)
+			{
+				PendingBlob& blob = mBlobs[i];
+				blob.stored.resize(LZ4CompressBound(blob.data.size()));
+				size_t compressed = LZ4Compress(blob.data.data(), blob.data.size(), blob.stored.data(), blob.stored.size());
+
+				// not worth paying to decompress for a tiny saving (jpgs, pngs, already compressed textures)
+				if (compressed == 0 || compressed > blob.data.size() - blob.data.size() / 16)
+					blob.stored.clear();
+				else
+					blob.stored.resize(compressed);
+				blob.stored.shrink_to_fit();
+			}
+		});
+	}
+	else
+	{
+		for (PendingBlob& blob : mBlobs)
+			blob.stored.clear();
+	}
+
+	QueryPerformanceCounter(&end);
+
+	// ==============================================================
+	//		lay the file out
+	// ==============================================================
+
+	std::vector<PackBlob> blobTable(mBlobs.size());
+	UINT64 offset = AlignUp(sizeof(PackHeader), 16);
+	UINT64 storedBytes = 0;
+	for (size_t i = 0; i < mBlobs.size(); i++)
+	{
+		const PendingBlob& pending = mBlobs[i];
+		PackBlob& blob = blobTable[i];
+		blob.size = pending.data.size();
+		blob.compression = pending.stored.empty() ? PackCompression_None : PackCompression_LZ4;
+		blob.storedSize = pending.stored.empty() ? pending.data.size() : pending.stored.size();
+		blob.contentHash = pending.hash;
+		blob.reserved = 0;
+
+		offset = AlignUp(offset, blob.storedSize >= PACK_BLOCK_ALIGNMENT ? PACK_BLOCK_ALIGNMENT : 16);
+		blob.offset = offset;
+		offset += blob.storedSize;
+		storedBytes += blob.storedSize;
+	}
+
+	std::vector<PendingEntry> entries = mEntries;
+	std::sort(entries.begin(), entries.end(), [](const PendingEntry& a, const PendingEntry& b) { return a.nameHash < b.nameHash; });
+
+	std::vector<PackEntry> entryTable(entries.size());
+	std::string names;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entryTable[i].nameHash = entries[i].nameHash;
+		entryTable[i].blob = entries[i].blob;
+		entryTable[i].nameOffset = (UINT)names.size();
+		names += entries[i].name;
+		names += '\0';
+	}
+
+	PackHeader header = {};
+	header.magic = PACK_MAGIC;
+	header.version = PACK_VERSION;
+	header.entryCount = (UINT)entryTable.size();
+	header.blobCount = (UINT)blobTable.size();
+	header.entriesOffset = AlignUp(offset, 16);
+	header.blobsOffset = header.entriesOffset + entryTable.size() * sizeof(PackEntry);
+	header.namesOffset = header.blobsOffset + blobTable.size() * sizeof(PackBlob);
+	header.namesSize = names.size();
+	header.fileSize = header.namesOffset + header.namesSize;
+
+	// ==============================================================
+	//		write it
+	// ==============================================================
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not create {}", path);
+		return false;
+	}
+
+	bool ok = true;
+	UINT64 position = 0;
+	auto write = [&](const void* data, UINT64 size)
+	{
+		ok = ok && WriteFileBytes(file, data, (size_t)size);
+		position += size;
+	};
+	static const BYTE zeros[PACK_BLOCK_ALIGNMENT] = {};
+	auto padTo = [&](UINT64 target)
+	{
+		if (target > position)
+			write(zeros, target - position);
+	};
+
+	write(&header, sizeof(header));
+	for (size_t i = 0; i < mBlobs.size(); i++)
+	{
+		padTo(blobTable[i].offset);
+		const std::vector<BYTE>& bytes = mBlobs[i].stored.empty() ? mBlobs[i].data : mBlobs[i].stored;
+		if (!bytes.empty())
+			write(bytes.data(), bytes.size());
+	}
+	padTo(header.entriesOffset);
+	if (!entryTable.empty())
+		write(entryTable.data(), entryTable.size() * sizeof(PackEntry));
+	if (!blobTable.empty())
+		write(blobTable.data(), blobTable.size() * sizeof(PackBlob));
+	if (!names.empty())
+		write(names.data(), names.size());
+
+	CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Error writing pack file");
+		return false;
+	}
+
+	if (stats)
+	{
+		UINT64 uniqueBytes = 0;
+		for (const PendingBlob& blob : mBlobs)
+			uniqueBytes += blob.data.size();
+
+		stats->entries = header.entryCount;
+		stats->blobs = header.blobCount;
+		stats->sourceBytes = mSourceBytes;
+		stats->dedupedBytes = mSourceBytes - uniqueBytes;
+		stats->storedBytes = storedBytes;
+		stats->fileSize = header.fileSize;
+		stats->compressSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	}
+	return true;
+}
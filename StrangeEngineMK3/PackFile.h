@@ -0,0 +1,169 @@
+#pragma once
+
+#include "Common.h"
+#include <unordered_map>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+
+// ==============================================================
+//		.pak file layout
+// ==============================================================
+//
+// header | blob data ... | entry table | blob table | names
+//
+// entries are sorted by name hash so a lookup is a binary search, several entries can share
+// one blob when their contents are identical. blobs of 64KB or more start on a 64KB boundary
+// (the allocation granularity) so they can be mapped on their own, small ones are packed 16 byte aligned
+
+#define PACK_MAGIC 0x4B415053 // "SPAK"
+#define PACK_VERSION 1
+#define PACK_BLOCK_ALIGNMENT 65536
+
+enum PackCompression
+{
+	PackCompression_None,
+	PackCompression_LZ4,
+};
+
+#pragma pack(push, 1)
+struct PackHeader
+{
+	UINT   magic;
+	UINT   version;
+	UINT   entryCount;
+	UINT   blobCount;
+	UINT64 entriesOffset;
+	UINT64 blobsOffset;
+	UINT64 namesOffset;
+	UINT64 namesSize;
+	UINT64 fileSize; // catches truncated files
+};
+
+struct PackEntry
+{
+	UINT64 nameHash;   // HashPackName() of the name
+	UINT   blob;
+	UINT   nameOffset; // into the names block, null terminated
+};
+
+struct PackBlob
+{
+	UINT64 offset;
+	UINT64 size;		// decompressed
+	UINT64 storedSize;	// in the file
+	UINT64 contentHash; // HashBytes() of the decompressed bytes
+	UINT   compression; // PackCompression
+	UINT   reserved;
+};
+#pragma pack(pop)
+
+// names are relative paths, case and slash direction don't matter ("Textures\Brick.png" == "textures/brick.png")
+STRANGEENGINEMK3_API std::string NormalizePackName(const std::string& name);
+STRANGEENGINEMK3_API UINT64		 HashPackName(const std::string& name);
+
+
+// ==============================================================
+//		reading
+// ==============================================================
+
+// a memory-mapped pack, entries are decompressed straight from the mapping into the caller's buffer
+class STRANGEENGINEMK3_API PackFile
+{
+public:
+	PackFile();
+	~PackFile();
+
+	bool Open(const std::wstring& path);
+	void Close();
+
+	bool IsOpen() const { return mData != nullptr; }
+
+	// -1 if the pack doesn't have it
+	int FindEntry(const std::string& name) const;
+
+	UINT			GetEntryCount() const { return mHeader ? mHeader->entryCount : 0; }
+	const char*		GetEntryName(UINT entry) const;
+	UINT64			GetEntrySize(UINT entry) const;	  // decompressed size
+	UINT64			GetStoredSize(UINT entry) const;  // size in the file
+	PackCompression GetCompression(UINT entry) const;
+
+	// decompresses (or copies) the entry into 'dest', which must be at least GetEntrySize() bytes
+	bool ReadEntry(UINT entry, void* dest, UINT64 destSize) const;
+
+	// zero copy pointer into the mapping for entries that are stored uncompressed, nullptr otherwise
+	const BYTE* GetUncompressedData(UINT entry) const;
+
+private:
+	HANDLE			  mFile;
+	HANDLE			  mMapping;
+	const BYTE*		  mData;
+	UINT64			  mSize;
+	const PackHeader* mHeader;
+	const PackEntry*  mEntries;
+	const PackBlob*	  mBlobs;
+	const char*		  mNames;
+};
+
+
+// ==============================================================
+//		writing
+// ==============================================================
+
+struct PackWriteStats
+{
+	UINT   entries;
+	UINT   blobs;		   // unique contents
+	UINT64 sourceBytes;	   // every entry added, duplicates included
+	UINT64 dedupedBytes;   // saved by sharing blobs
+	UINT64 storedBytes;	   // blob data after compression
+	UINT64 fileSize;
+	double compressSeconds;
+};
+
+// collects files in memory and writes them out as one pack
+class STRANGEENGINEMK3_API PackWriter
+{
+public:
+	PackWriter();
+
+	// LZ4 by default. a blob is only kept compressed if that saves at least 1/16 of its size
+	void SetCompression(PackCompression compression) { mCompression = compression; }
+
+	bool AddData(const std::string& name, const BYTE* data, size_t size);
+	bool AddFile(const std::string& name, const std::wstring& path);
+
+	// every file under 'folder', named by its path relative to the folder
+	bool AddFolder(const std::wstring& folder);
+
+	bool Write(const std::wstring& path, PackWriteStats* stats = nullptr);
+
+private:
+	struct PendingBlob
+	{
+		std::vector<BYTE> data;
+		std::vector<BYTE> stored; // compressed copy, empty if it's stored as is
+		UINT64			  hash;
+	};
+
+	struct PendingEntry
+	{
+		std::string name;
+		UINT64		nameHash;
+		UINT		blob;
+	};
+
+	bool AddFolderRecursive(const std::wstring& folder, const std::string& prefix);
+
+	PackCompression						  mCompression;
+	std::vector<PendingBlob>			  mBlobs;
+	std::vector<PendingEntry>			  mEntries;
+	std::unordered_multimap<UINT64, UINT> mBlobLookup; // content hash -> blob
+	std::unordered_map<UINT64, UINT>	  mNameLookup; // name hash -> entry
+	UINT64								  mSourceBytes;
+};
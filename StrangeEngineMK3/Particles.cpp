@@ -0,0 +1,473 @@
+#include "pch.h"
+#include "Particles.h"
+#include "Log.h"
+#include "JobSystem.h"
+#include "MemoryTracking.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+// below this many particles an emitter does everything on the calling thread, handing out jobs would cost more
+static const UINT kParallelThreshold = 16384;
+// particles per job, a multiple of 4 so every job starts on a whole SSE group
+static const UINT kParticlesPerJob = 8192;
+
+// the arrays the particle data is split into
+static const int kArrayCount = 8;
+
+ParticleEmitterDesc::ParticleEmitterDesc()
+{
+	position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	spawnExtents = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	spawnRate = 100.0f;
+	maxParticles = 1000;
+	minLife = 1.0f;
+	maxLife = 2.0f;
+	velocity = XMFLOAT3(0.0f, 1.0f, 0.0f);
+	velocityJitter = XMFLOAT3(0.5f, 0.5f, 0.5f);
+	acceleration = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	drag = 0.0f;
+	startSize = 1.0f;
+	endSize = 1.0f;
+	startColor = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+	endColor = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	blend = ParticleBlend_Additive;
+	seed = 1;
+}
+
+ParticleEmitterDesc MakeSmokeEmitterDesc(const XMFLOAT3& position)
+{
+	ParticleEmitterDesc desc;
+	desc.position = position;
+	desc.spawnExtents = XMFLOAT3(0.3f, 0.1f, 0.3f);
+	desc.spawnRate = 40.0f;
+	desc.maxParticles = 400;
+	desc.minLife = 3.0f;
+	desc.maxLife = 6.0f;
+	desc.velocity = XMFLOAT3(0.0f, 0.8f, 0.0f);
+	desc.velocityJitter = XMFLOAT3(0.3f, 0.2f, 0.3f);
+	desc.acceleration = XMFLOAT3(0.1f, 0.3f, 0.0f); // a slight breeze and the heat rising
+	desc.drag = 0.4f;
+	desc.startSize = 0.5f;
+	desc.endSize = 3.0f;
+	desc.startColor = XMFLOAT4(0.5f, 0.5f, 0.5f, 0.6f);
+	desc.endColor = XMFLOAT4(0.8f, 0.8f, 0.8f, 0.0f);
+	desc.blend = ParticleBlend_Alpha;
+	return desc;
+}
+
+ParticleEmitterDesc MakeFlareEmitterDesc(const XMFLOAT3& position)
+{
+	ParticleEmitterDesc desc;
+	desc.position = position;
+	desc.spawnRate = 200.0f;
+	desc.maxParticles = 1000;
+	desc.minLife = 0.5f;
+	desc.maxLife = 1.5f;
+	desc.velocity = XMFLOAT3(0.0f, 4.0f, 0.0f);
+	desc.velocityJitter = XMFLOAT3(3.0f, 2.0f, 3.0f);
+	desc.acceleration = XMFLOAT3(0.0f, -9.81f, 0.0f);
+	desc.drag = 0.1f;
+	desc.startSize = 0.3f;
+	desc.endSize = 0.05f;
+	desc.startColor = XMFLOAT4(1.0f, 0.9f, 0.5f, 1.0f);
+	desc.endColor = XMFLOAT4(1.0f, 0.3f, 0.1f, 0.0f);
+	desc.blend = ParticleBlend_Additive;
+	return desc;
+}
+
+ParticleEmitter::ParticleEmitter(const ParticleEmitterDesc& desc)
+{
+	mDesc = desc;
+	mCount = 0;
+	mCapacity = (desc.maxParticles + 3) & ~3u;
+	mSpawnDebt = 0.0f;
+	mRandomState = desc.seed ? desc.seed : 1;
+
+	mMemory = (float*)_aligned_malloc(sizeof(float) * mCapacity * kArrayCount, 16);
+	if (!mMemory)
+	{
+		ReportError(LogCategory_Render, "Could not allocate memory for {} particles", desc.maxParticles);
+		mCapacity = 0;
+	}
+
+	float** arrays[kArrayCount] = { &mPositionX, &mPositionY, &mPositionZ, &mVelocityX, &mVelocityY, &mVelocityZ, &mAge, &mInverseLife };
+	for (int i = 0; i < kArrayCount; i++)
+		*arrays[i] = mMemory ? mMemory + (size_t)mCapacity * i : nullptr;
+
+	// the tail of each array past the live particles is run through the SSE loops too, keep it harmless
+	if (mMemory)
+	{
+		memset(mMemory, 0, sizeof(float) * mCapacity * kArrayCount);
+		MemoryTracker::Get()->TrackAllocation(MemoryTag_Rendering, sizeof(float) * mCapacity * kArrayCount);
+	}
+
+	BuildLookup();
+}
+
+ParticleEmitter::~ParticleEmitter()
+{
+	if (mMemory)
+	{
+		_aligned_free(mMemory);
+		MemoryTracker::Get()->TrackFree(MemoryTag_Rendering, sizeof(float) * mCapacity * kArrayCount);
+	}
+}
+
+// xorshift, 0 to 1
+float ParticleEmitter::Random()
+{
+	mRandomState ^= mRandomState << 13;
+	mRandomState ^= mRandomState >> 17;
+	mRandomState ^= mRandomState << 5;
+	return (mRandomState >> 8) * (1.0f / 16777216.0f);
+}
+
+void ParticleEmitter::Spawn(UINT count)
+{
+	count = std::min(count, std::min(mDesc.maxParticles, mCapacity) - mCount);
+	const ParticleEmitterDesc& d = mDesc;
+	for (UINT i = mCount; i < mCount + count; i++)
+	{
+		mPositionX[i] = d.position.x + (Random() * 2.0f - 1.0f) * d.spawnExtents.x;
+		mPositionY[i] = d.position.y + (Random() * 2.0f - 1.0f) * d.spawnExtents.y;
+		mPositionZ[i] = d.position.z + (Random() * 2.0f - 1.0f) * d.spawnExtents.z;
+		mVelocityX[i] = d.velocity.x + (Random() * 2.0f - 1.0f) * d.velocityJitter.x;
+		mVelocityY[i] = d.velocity.y + (Random() * 2.0f - 1.0f) * d.velocityJitter.y;
+		mVelocityZ[i] = d.velocity.z + (Random() * 2.0f - 1.0f) * d.velocityJitter.z;
+		mAge[i] = 0.0f;
+		mInverseLife[i] = 1.0f / std::max(d.minLife + (d.maxLife - d.minLife) * Random(), 0.001f);
+	}
+	mCount += count;
+}
+
+void ParticleEmitter::Burst(UINT count)
+{
+	Spawn(count);
+}
+
+void ParticleEmitter::Integrate(UINT begin, UINT end, float deltaTime)
+{
+	// the last group runs over into the padding, which is never read as a live particle
+	end = (end + 3) & ~3u;
+
+	const __m128 dt = _mm_set1_ps(deltaTime);
+	const __m128 damping = _mm_set1_ps(std::max(0.0f, 1.0f - mDesc.drag * deltaTime));
+	const __m128 accelerationX = _mm_set1_ps(mDesc.acceleration.x * deltaTime);
+	const __m128 accelerationY = _mm_set1_ps(mDesc.acceleration.y * deltaTime);
+	const __m128 accelerationZ = _mm_set1_ps(mDesc.acceleration.z * deltaTime);
+
+	for (UINT i = begin; i < end; i += 4)
+	{
+		__m128 velocityX = _mm_add_ps(_mm_mul_ps(_mm_load_ps(mVelocityX + i), damping), accelerationX);
+		__m128 velocityY = _mm_add_ps(_mm_mul_ps(_mm_load_ps(mVelocityY + i), damping), accelerationY);
+		__m128 velocityZ = _mm_add_ps(_mm_mul_ps(_mm_load_ps(mVelocityZ + i), damping), accelerationZ);
+		_mm_store_ps(mVelocityX + i, velocityX);
+		_mm_store_ps(mVelocityY + i, velocityY);
+		_mm_store_ps(mVelocityZ + i, velocityZ);
+		_mm_store_ps(mPositionX + i, _mm_add_ps(_mm_load_ps(mPositionX + i), _mm_mul_ps(velocityX, dt)));
+		_mm_store_ps(mPositionY + i, _mm_add_ps(_mm_load_ps(mPositionY + i), _mm_mul_ps(velocityY, dt)));
+		_mm_store_ps(mPositionZ + i, _mm_add_ps(_mm_load_ps(mPositionZ + i), _mm_mul_ps(velocityZ, dt)));
+		_mm_store_ps(mAge + i, _mm_add_ps(_mm_load_ps(mAge + i), dt));
+	}
+}
+
+// swap-remove, the last live particle moves into each dead one's place. four at a time are checked with one compare
+// and skipped when all of them are alive, which is nearly always
+void ParticleEmitter::RemoveDead()
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	float* arrays[kArrayCount] = { mPositionX, mPositionY, mPositionZ, mVelocityX, mVelocityY, mVelocityZ, mAge, mInverseLife };
+
+	UINT i = 0;
+	while (i < mCount)
+	{
+		if ((i & 3) == 0 && i + 4 <= mCount)
+		{
+			__m128 progress = _mm_mul_ps(_mm_load_ps(mAge + i), _mm_load_ps(mInverseLife + i));
+			if (_mm_movemask_ps(_mm_cmpge_ps(progress, one)) == 0)
+			{
+				i += 4;
+				continue;
+			}
+		}
+
+		if (mAge[i] * mInverseLife[i] >= 1.0f)
+		{
+			// check the particle moved in here on the next pass round
+			mCount--;
+			for (int a = 0; a < kArrayCount; a++)
+				arrays[a][i] = arrays[a][mCount];
+		}
+		else
+			i++;
+	}
+}
+
+void ParticleEmitter::Update(float deltaTime)
+{
+	if (mCount >= kParallelThreshold)
+	{
+		JobSystem::Get()->ParallelFor(mCount, kParticlesPerJob, [this, deltaTime](unsigned int begin, unsigned int end)
+		{
+			Integrate(begin, end, deltaTime);
+		});
+	}
+	else
+		Integrate(0, mCount, deltaTime);
+
+	RemoveDead();
+
+	mSpawnDebt += mDesc.spawnRate * deltaTime;
+	UINT spawn = (UINT)mSpawnDebt;
+	mSpawnDebt -= spawn;
+	Spawn(spawn);
+}
+
+static UINT PackColor(float r, float g, float b, float a)
+{
+	auto channel = [](float value) { return (UINT)(std::max(0.0f, std::min(value, 1.0f)) * 255.0f + 0.5f); };
+	return channel(r) | (channel(g) << 8) | (channel(b) << 16) | (channel(a) << 24);
+}
+
+// size and colour only depend on how far through its life a particle is, so they are worked out once for 256 steps
+// instead of once per particle per frame
+void ParticleEmitter::BuildLookup()
+{
+	const ParticleEmitterDesc& d = mDesc;
+	for (int i = 0; i < 256; i++)
+	{
+		float t = i / 255.0f;
+		mLookupHalfSize[i] = (d.startSize + (d.endSize - d.startSize) * t) * 0.5f;
+		mLookupColor[i] = PackColor(d.startColor.x + (d.endColor.x - d.startColor.x) * t, d.startColor.y + (d.endColor.y - d.startColor.y) * t,
+			d.startColor.z + (d.endColor.z - d.startColor.z) * t, d.startColor.w + (d.endColor.w - d.startColor.w) * t);
+	}
+}
+
+// the lookup step for four particles
+static inline __m128i LifeSteps(const float* age, const float* inverseLife)
+{
+	__m128 t = _mm_min_ps(_mm_mul_ps(_mm_load_ps(age), _mm_load_ps(inverseLife)), _mm_set1_ps(1.0f));
+	return _mm_cvttps_epi32(_mm_mul_ps(t, _mm_set1_ps(255.0f)));
+}
+
+// the camera's right and up scaled by a particle's half size, w is 0 so it stays free for the colour
+static inline void CameraAxes(const ParticleCamera& camera, __m128* right, __m128* up)
+{
+	*right = _mm_setr_ps(camera.right.x, camera.right.y, camera.right.z, 0.0f);
+	*up = _mm_setr_ps(camera.up.x, camera.up.y, camera.up.z, 0.0f);
+}
+
+// four corners, each one 16 byte store that goes straight to memory without reading the destination into the cache first
+// (mapped vertex buffers are write-combined, reading them back is very slow). the colour goes into w after the corners
+// are worked out, as float maths would quieten a colour whose bits happen to be a signalling NaN
+static inline void StreamQuad(float* quad, __m128 center, __m128 right, __m128 up, float half, UINT color)
+{
+	__m128 scale = _mm_set1_ps(half);
+	right = _mm_mul_ps(right, scale);
+	up = _mm_mul_ps(up, scale);
+	__m128 top = _mm_add_ps(center, up);
+	__m128 bottom = _mm_sub_ps(center, up);
+	__m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128 rgba = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, (int)color));
+	_mm_stream_ps(quad, _mm_or_ps(_mm_and_ps(_mm_sub_ps(top, right), xyz), rgba));
+	_mm_stream_ps(quad + 4, _mm_or_ps(_mm_and_ps(_mm_add_ps(top, right), xyz), rgba));
+	_mm_stream_ps(quad + 8, _mm_or_ps(_mm_and_ps(_mm_sub_ps(bottom, right), xyz), rgba));
+	_mm_stream_ps(quad + 12, _mm_or_ps(_mm_and_ps(_mm_add_ps(bottom, right), xyz), rgba));
+}
+
+// additive, straight from the arrays in the order the particles are in
+void ParticleEmitter::WriteQuads(UINT begin, UINT end, const ParticleCamera& camera, ParticleVertex* vertices) const
+{
+	__m128 right, up;
+	CameraAxes(camera, &right, &up);
+	for (UINT i = begin; i < end; i += 4)
+	{
+		alignas(16) int steps[4];
+		_mm_store_si128((__m128i*)steps, LifeSteps(mAge + i, mInverseLife + i));
+		for (UINT lane = 0; lane < 4 && i + lane < end; lane++)
+		{
+			UINT p = i + lane;
+			__m128 center = _mm_setr_ps(mPositionX[p], mPositionY[p], mPositionZ[p], 0.0f);
+			StreamQuad(&vertices[(size_t)p * 4].position.x, center, right, up, mLookupHalfSize[steps[lane]], mLookupColor[steps[lane]]);
+		}
+	}
+	_mm_sfence();
+}
+
+// each particle boiled down to the 16 bytes its quad needs, and its depth along the view direction
+void ParticleEmitter::GatherBillboards(UINT begin, UINT end, const ParticleCamera& camera, float* nearest, float* furthest)
+{
+	end = (end + 3) & ~3u;
+	__m128 forwardX = _mm_set1_ps(camera.forward.x);
+	__m128 forwardY = _mm_set1_ps(camera.forward.y);
+	__m128 forwardZ = _mm_set1_ps(camera.forward.z);
+	__m128 offset = _mm_set1_ps(camera.position.x * camera.forward.x + camera.position.y * camera.forward.y + camera.position.z * camera.forward.z);
+	__m128 low = _mm_set1_ps(FLT_MAX), high = _mm_set1_ps(-FLT_MAX);
+
+	for (UINT i = begin; i < end; i += 4)
+	{
+		__m128 x = _mm_load_ps(mPositionX + i);
+		__m128 y = _mm_load_ps(mPositionY + i);
+		__m128 z = _mm_load_ps(mPositionZ + i);
+		__m128 depth = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, forwardX), _mm_mul_ps(y, forwardY)), _mm_mul_ps(z, forwardZ)), offset);
+		_mm_storeu_ps(&mDepths[i], depth);
+
+		// the padding past the last particle mustn't stretch the depth range
+		if (i + 4 > mCount)
+		{
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, depth);
+			for (UINT lane = mCount - i; lane < 4; lane++)
+				lanes[lane] = lanes[0];
+			depth = _mm_load_ps(lanes);
+		}
+		low = _mm_min_ps(low, depth);
+		high = _mm_max_ps(high, depth);
+
+		// x, y, z and the lookup step of four particles transposed into four Billboards
+		__m128 step = _mm_castsi128_ps(LifeSteps(mAge + i, mInverseLife + i));
+		_MM_TRANSPOSE4_PS(x, y, z, step);
+		_mm_storeu_ps(&mBillboards[i].x, x);
+		_mm_storeu_ps(&mBillboards[i + 1].x, y);
+		_mm_storeu_ps(&mBillboards[i + 2].x, z);
+		_mm_storeu_ps(&mBillboards[i + 3].x, step);
+	}
+
+	alignas(16) float lows[4], highs[4];
+	_mm_store_ps(lows, low);
+	_mm_store_ps(highs, high);
+	*nearest = std::min(std::min(lows[0], lows[1]), std::min(lows[2], lows[3]));
+	*furthest = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+}
+
+// LSD radix sort on a 16 bit depth, two passes of 8 bits. 65536 depth steps between the nearest and furthest particle
+// is far finer than anyone can see in blended smoke, and half the passes of sorting the float itself.
+// the key and the particle index share one 64 bit entry so each pass moves one array, not two
+void ParticleEmitter::SortBackToFront(float nearest, float furthest)
+{
+	mSortEntries.resize(mCount);
+	mSortScratch.resize(mCount);
+
+	// furthest first, so the key counts up from the far end
+	float scale = (furthest > nearest) ? 65535.0f / (furthest - nearest) : 0.0f;
+	UINT histogram[2][256] = {};
+	for (UINT i = 0; i < mCount; i++)
+	{
+		UINT key = (UINT)((furthest - mDepths[i]) * scale);
+		mSortEntries[i] = ((UINT64)key << 32) | i;
+		histogram[0][key & 0xFF]++;
+		histogram[1][key >> 8]++;
+	}
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int shift = 32 + pass * 8;
+
+		// everything in one bucket, this pass wouldn't move anything
+		if (histogram[pass][(mSortEntries[0] >> shift) & 0xFF] == mCount)
+			continue;
+
+		UINT offsets[256];
+		UINT total = 0;
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			offsets[bucket] = total;
+			total += histogram[pass][bucket];
+		}
+
+		for (UINT i = 0; i < mCount; i++)
+		{
+			UINT64 entry = mSortEntries[i];
+			mSortScratch[offsets[(entry >> shift) & 0xFF]++] = entry;
+		}
+		mSortEntries.swap(mSortScratch);
+	}
+}
+
+// alpha blended, in sorted order. one 16 byte read per particle instead of five scattered ones
+void ParticleEmitter::WriteSortedQuads(UINT begin, UINT end, const ParticleCamera& camera, ParticleVertex* vertices) const
+{
+	__m128 right, up;
+	CameraAxes(camera, &right, &up);
+	for (UINT k = begin; k < end; k++)
+	{
+		const Billboard& billboard = mBillboards[(UINT)mSortEntries[k]];
+		__m128 center = _mm_setr_ps(billboard.x, billboard.y, billboard.z, 0.0f);
+		StreamQuad(&vertices[(size_t)k * 4].position.x, center, right, up, mLookupHalfSize[billboard.step], mLookupColor[billboard.step]);
+	}
+	_mm_sfence();
+}
+
+UINT ParticleEmitter::WriteBillboards(const ParticleCamera& camera, TransientVertexBuffer* buffer, UINT* firstVertex)
+{
+	if (mCount == 0)
+		return 0;
+
+	ParticleVertex* vertices = (ParticleVertex*)buffer->Allocate(mCount * 4, sizeof(ParticleVertex), firstVertex);
+	if (!vertices)
+		return 0;
+
+	bool parallel = mCount >= kParallelThreshold;
+	if (mDesc.blend == ParticleBlend_Additive)
+	{
+		if (parallel)
+		{
+			JobSystem::Get()->ParallelFor(mCount, kParticlesPerJob, [this, &camera, vertices](unsigned int begin, unsigned int end)
+			{
+				WriteQuads(begin, end, camera, vertices);
+			});
+		}
+		else
+			WriteQuads(0, mCount, camera, vertices);
+		return mCount;
+	}
+
+	mBillboards.resize(mCapacity);
+	mDepths.resize(mCapacity);
+	UINT jobCount = (mCount + kParticlesPerJob - 1) / kParticlesPerJob;
+	std::vector<float> nearest(jobCount), furthest(jobCount);
+	if (parallel)
+	{
+		JobSystem::Get()->ParallelFor(mCount, kParticlesPerJob, [&](unsigned int begin, unsigned int end)
+		{
+			GatherBillboards(begin, end, camera, &nearest[begin / kParticlesPerJob], &furthest[begin / kParticlesPerJob]);
+		});
+	}
+	else
+	{
+		for (UINT job = 0; job < jobCount; job++)
+			GatherBillboards(job * kParticlesPerJob, std::min(mCount, (job + 1) * kParticlesPerJob), camera, &nearest[job], &furthest[job]);
+	}
+
+	SortBackToFront(*std::min_element(nearest.begin(), nearest.end()), *std::max_element(furthest.begin(), furthest.end()));
+
+	if (parallel)
+	{
+		JobSystem::Get()->ParallelFor(mCount, kParticlesPerJob, [this, &camera, vertices](unsigned int begin, unsigned int end)
+		{
+			WriteSortedQuads(begin, end, camera, vertices);
+		});
+	}
+	else
+		WriteSortedQuads(0, mCount, camera, vertices);
+	return mCount;
+}
+
+std::vector<UINT> MakeQuadIndices(UINT quadCount)
+{
+	std::vector<UINT> indices(quadCount * 6);
+	for (UINT quad = 0; quad < quadCount; quad++)
+	{
+		UINT corner = quad * 4;
+		UINT* out = &indices[quad * 6];
+		out[0] = corner;
+		out[1] = corner + 1;
+		out[2] = corner + 2;
+		out[3] = corner + 2;
+		out[4] = corner + 1;
+		out[5] = corner + 3;
+	}
+	return indices;
+}
@@ -0,0 +1,561 @@
+#include "pch.h"
+#include "Physics.h"
+#include "PhysicsMath.h"
+#include "JobSystem.h"
+#include "SystemScheduler.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+static const float kFixedStep = 1.0f / 60.0f;
+static const UINT kMaxStepsPerUpdate = 4;
+
+// bodies' bounds are grown by this in the broadphase, so pairs are found a step before they touch
+static const float kBoundsMargin = 0.05f;
+
+// overlap the solver leaves alone, pushing out every last bit makes resting contacts flicker on and off
+static const float kPenetrationSlop = 0.01f;
+// fraction of the remaining overlap pushed out per step
+static const float kBaumgarte = 0.2f;
+// slower impacts than this don't bounce, otherwise things resting on the ground never quite settle
+static const float kBounceThreshold = 1.0f;
+
+RigidBodyDesc::RigidBodyDesc()
+{
+	shape = MakeSphereShape(0.5f);
+	position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	rotation = QuatIdentity();
+	linearVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	angularVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	mass = 1.0f;
+	friction = 0.5f;
+	restitution = 0.0f;
+	userData = 0;
+}
+
+static Aabb ExpandAabb(const Aabb& box, float margin)
+{
+	Aabb expanded;
+	expanded.min = XMFLOAT3(box.min.x - margin, box.min.y - margin, box.min.z - margin);
+	expanded.max = XMFLOAT3(box.max.x + margin, box.max.y + margin, box.max.z + margin);
+	return expanded;
+}
+
+static UINT64 ContactKey(UINT a, UINT b)
+{
+	return ((UINT64)a << 32) | b;
+}
+
+PhysicsWorld::PhysicsWorld()
+{
+	mBodyCount = 0;
+	mGravity = XMFLOAT3(0.0f, -9.81f, 0.0f);
+	mIterations = 10;
+	mAccumulator = 0.0f;
+	mStats = PhysicsStats();
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mSecondsPerCount = 1.0 / (double)frequency.QuadPart;
+}
+
+UINT PhysicsWorld::AddBody(const RigidBodyDesc& desc)
+{
+	UINT id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (UINT)mBodies.size();
+		mBodies.push_back(Body());
+	}
+
+	Body& body = mBodies[id];
+	body.shape = desc.shape;
+	body.transform.position = desc.position;
+	body.transform.rotation = QuatNormalize(desc.rotation);
+	body.linearVelocity = desc.linearVelocity;
+	body.angularVelocity = desc.angularVelocity;
+	body.friction = desc.friction;
+	body.restitution = desc.restitution;
+	body.userData = desc.userData;
+	body.alive = true;
+
+	if (desc.mass > 0.0f)
+	{
+		// solid sphere, or solid box for boxes and hulls (a hull by its bounding box, close enough for rocks and crates)
+		float m = desc.mass;
+		XMFLOAT3 inertia;
+		if (desc.shape.type == Shape_Sphere)
+		{
+			float i = 0.4f * m * desc.shape.radius * desc.shape.radius;
+			inertia = XMFLOAT3(i, i, i);
+		}
+		else
+		{
+			const XMFLOAT3& h = desc.shape.halfExtents;
+			inertia = XMFLOAT3(m / 3.0f * (h.y * h.y + h.z * h.z), m / 3.0f * (h.x * h.x + h.z * h.z), m / 3.0f * (h.x * h.x + h.y * h.y));
+		}
+		body.inverseMass = 1.0f / m;
+		body.inverseInertia = XMFLOAT3(1.0f / inertia.x, 1.0f / inertia.y, 1.0f / inertia.z);
+	}
+	else
+	{
+		body.inverseMass = 0.0f;
+		body.inverseInertia = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		body.linearVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		body.angularVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+
+	body.proxy = mBroadphase.AddProxy(ExpandAabb(GetShapeBounds(body.shape, body.transform), kBoundsMargin), id);
+	mBodyCount++;
+	return id;
+}
+
+void PhysicsWorld::RemoveBody(UINT id)
+{
+	mBroadphase.RemoveProxy(mBodies[id].proxy);
+	mBodies[id].alive = false;
+	mFreeIds.push_back(id);
+	mBodyCount--;
+
+	// the id can be handed out again before the next step, the new body mustn't pick up these contacts' impulses
+	size_t kept = 0;
+	for (size_t i = 0; i < mContacts.size(); i++)
+	{
+		if (mContacts[i].a == id || mContacts[i].b == id)
+			continue;
+		mContactKeys[kept] = mContactKeys[i];
+		mContacts[kept] = mContacts[i];
+		kept++;
+	}
+	mContactKeys.resize(kept);
+	mContacts.resize(kept);
+}
+
+void PhysicsWorld::SetTransform(UINT id, const RigidTransform& transform)
+{
+	Body& body = mBodies[id];
+	body.transform.position = transform.position;
+	body.transform.rotation = QuatNormalize(transform.rotation);
+	mBroadphase.UpdateProxy(body.proxy, ExpandAabb(GetShapeBounds(body.shape, body.transform), kBoundsMargin));
+}
+
+void PhysicsWorld::SetVelocity(UINT id, const XMFLOAT3& linear, const XMFLOAT3& angular)
+{
+	Body& body = mBodies[id];
+	if (body.inverseMass == 0.0f)
+		return;
+	body.linearVelocity = linear;
+	body.angularVelocity = angular;
+}
+
+void PhysicsWorld::ApplyImpulse(UINT id, const XMFLOAT3& impulse, const XMFLOAT3& point)
+{
+	Body& body = mBodies[id];
+	if (body.inverseMass == 0.0f)
+		return;
+	body.linearVelocity = Vec3MultiplyAdd(body.linearVelocity, impulse, body.inverseMass);
+	XMFLOAT3 arm = Vec3Sub(point, body.transform.position);
+	body.angularVelocity = Vec3Add(body.angularVelocity, ApplyInverseInertia(body, Vec3Cross(arm, impulse)));
+}
+
+// the world space inverse inertia tensor times 'v', turned into body space and back
+XMFLOAT3 PhysicsWorld::ApplyInverseInertia(const Body& body, const XMFLOAT3& v) const
+{
+	XMFLOAT3 local = QuatRotateInverse(body.transform.rotation, v);
+	return QuatRotate(body.transform.rotation, Vec3Multiply(local, body.inverseInertia));
+}
+
+void PhysicsWorld::Update(float frameTime)
+{
+	mAccumulator += frameTime;
+	UINT steps = 0;
+	while (mAccumulator >= kFixedStep && steps < kMaxStepsPerUpdate)
+	{
+		Step(kFixedStep);
+		mAccumulator -= kFixedStep;
+		steps++;
+	}
+	mAccumulator = std::min(mAccumulator, kFixedStep);
+}
+
+UINT PhysicsWorld::AddSystem()
+{
+	SystemDesc desc("Physics", FramePhase_Simulation, [this](float deltaTime) { Update(deltaTime); });
+	return SystemScheduler::Get()->AddSystem(desc.Writes("Physics"));
+}
+
+
+// ==============================================================
+//		stepping
+// ==============================================================
+
+void PhysicsWorld::Step(float dt)
+{
+	LARGE_INTEGER start, broadphaseEnd, narrowphaseEnd, end;
+	QueryPerformanceCounter(&start);
+
+	UpdateBroadphase();
+	QueryPerformanceCounter(&broadphaseEnd);
+
+	FindContacts();
+	QueryPerformanceCounter(&narrowphaseEnd);
+
+	BuildIslands();
+	JobSystem::Get()->ParallelFor((unsigned int)mIslands.size(), 1, [this, dt](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+			SolveIsland(mIslands[i], dt);
+	});
+	QueryPerformanceCounter(&end);
+
+	mStats.bodyCount = mBodyCount;
+	mStats.pairCount = (UINT)mBroadphase.GetPairs().size();
+	mStats.manifoldCount = (UINT)mContacts.size();
+	mStats.contactCount = 0;
+	for (const Contact& contact : mContacts)
+		mStats.contactCount += contact.manifold.pointCount;
+	mStats.islandCount = (UINT)mIslands.size();
+	mStats.largestIsland = 0;
+	for (const Island& island : mIslands)
+		mStats.largestIsland = std::max(mStats.largestIsland, island.bodyCount);
+	mStats.broadphaseMs = (broadphaseEnd.QuadPart - start.QuadPart) * mSecondsPerCount * 1000.0;
+	mStats.narrowphaseMs = (narrowphaseEnd.QuadPart - broadphaseEnd.QuadPart) * mSecondsPerCount * 1000.0;
+	mStats.solverMs = (end.QuadPart - narrowphaseEnd.QuadPart) * mSecondsPerCount * 1000.0;
+}
+
+void PhysicsWorld::UpdateBroadphase()
+{
+	// static bodies only move through SetTransform(), which updates their proxy itself
+	for (Body& body : mBodies)
+	{
+		if (body.alive && body.inverseMass > 0.0f)
+			mBroadphase.UpdateProxy(body.proxy, ExpandAabb(GetShapeBounds(body.shape, body.transform), kBoundsMargin));
+	}
+	mBroadphase.UpdatePairs();
+}
+
+void PhysicsWorld::FindContacts()
+{
+	const std::vector<BroadphasePair>& pairs = mBroadphase.GetPairs();
+	std::vector<Contact> found(pairs.size());
+	std::vector<char> touching(pairs.size(), 0);
+
+	// every pair writes only its own slot, so it doesn't matter which thread tests which
+	JobSystem::Get()->ParallelFor((unsigned int)pairs.size(), 64, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			UINT a = (UINT)mBroadphase.GetUserData(pairs[i].a);
+			UINT b = (UINT)mBroadphase.GetUserData(pairs[i].b);
+			if (a > b)
+				std::swap(a, b);
+			const Body& bodyA = mBodies[a];
+			const Body& bodyB = mBodies[b];
+			if (bodyA.inverseMass == 0.0f && bodyB.inverseMass == 0.0f)
+				continue;
+
+			const ContactManifold* previous = nullptr;
+			UINT64 key = ContactKey(a, b);
+			auto match = std::lower_bound(mContactKeys.begin(), mContactKeys.end(), key);
+			if (match != mContactKeys.end() && *match == key)
+				previous = &mContacts[match - mContactKeys.begin()].manifold;
+
+			found[i].a = a;
+			found[i].b = b;
+			touching[i] = CollideShapes(bodyA.shape, bodyA.transform, bodyB.shape, bodyB.transform, previous, &found[i].manifold);
+		}
+	});
+
+	// keep the touching ones, sorted by body ids so the solver sees them in the same order every time
+	std::vector<UINT> order;
+	for (UINT i = 0; i < (UINT)pairs.size(); i++)
+	{
+		if (touching[i])
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&found](UINT x, UINT y)
+	{
+		return ContactKey(found[x].a, found[x].b) < ContactKey(found[y].a, found[y].b);
+	});
+
+	mContactKeys.resize(order.size());
+	mContacts.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		mContacts[i] = found[order[i]];
+		mContactKeys[i] = ContactKey(mContacts[i].a, mContacts[i].b);
+	}
+}
+
+UINT PhysicsWorld::FindRoot(UINT id)
+{
+	while (mParents[id] != id)
+	{
+		mParents[id] = mParents[mParents[id]];
+		id = mParents[id];
+	}
+	return id;
+}
+
+// dynamic bodies joined by contacts, static bodies don't join islands together since nothing can push them
+void PhysicsWorld::BuildIslands()
+{
+	UINT bodyCount = (UINT)mBodies.size();
+	mParents.resize(bodyCount);
+	mSolverIndices.resize(bodyCount);
+	for (UINT i = 0; i < bodyCount; i++)
+		mParents[i] = i;
+
+	for (const Contact& contact : mContacts)
+	{
+		if (mBodies[contact.a].inverseMass == 0.0f || mBodies[contact.b].inverseMass == 0.0f)
+			continue;
+		UINT rootA = FindRoot(contact.a);
+		UINT rootB = FindRoot(contact.b);
+		if (rootA != rootB)
+		{
+			// the lower id is always the root, so the islands come out the same whatever order contacts join them
+			if (rootA < rootB)
+				mParents[rootB] = rootA;
+			else
+				mParents[rootA] = rootB;
+		}
+	}
+
+	// count, then hand out ranges, then fill
+	std::vector<UINT> islandOfRoot(bodyCount, UINT_MAX);
+	mIslands.clear();
+	for (UINT id = 0; id < bodyCount; id++)
+	{
+		if (!mBodies[id].alive || mBodies[id].inverseMass == 0.0f)
+			continue;
+		UINT root = FindRoot(id);
+		if (islandOfRoot[root] == UINT_MAX)
+		{
+			islandOfRoot[root] = (UINT)mIslands.size();
+			Island island = { 0, 0, 0, 0 };
+			mIslands.push_back(island);
+		}
+		mIslands[islandOfRoot[root]].bodyCount++;
+	}
+
+	std::vector<UINT> contactIsland(mContacts.size());
+	for (size_t i = 0; i < mContacts.size(); i++)
+	{
+		UINT dynamicBody = (mBodies[mContacts[i].a].inverseMass > 0.0f) ? mContacts[i].a : mContacts[i].b;
+		contactIsland[i] = islandOfRoot[FindRoot(dynamicBody)];
+		mIslands[contactIsland[i]].contactCount++;
+	}
+
+	UINT bodyOffset = 0, contactOffset = 0;
+	for (Island& island : mIslands)
+	{
+		island.firstBody = bodyOffset;
+		island.firstContact = contactOffset;
+		bodyOffset += island.bodyCount;
+		contactOffset += island.contactCount;
+		island.bodyCount = 0;
+		island.contactCount = 0;
+	}
+
+	mIslandBodies.resize(bodyOffset);
+	mIslandContacts.resize(contactOffset);
+	for (UINT id = 0; id < bodyCount; id++)
+	{
+		if (!mBodies[id].alive || mBodies[id].inverseMass == 0.0f)
+			continue;
+		Island& island = mIslands[islandOfRoot[FindRoot(id)]];
+		mIslandBodies[island.firstBody + island.bodyCount++] = id;
+	}
+	for (UINT i = 0; i < (UINT)mContacts.size(); i++)
+	{
+		Island& island = mIslands[contactIsland[i]];
+		mIslandContacts[island.firstContact + island.contactCount++] = i;
+	}
+}
+
+
+// ==============================================================
+//		the solver
+// ==============================================================
+
+namespace
+{
+	// an island's copy of a body's velocity, the solver touches these thousands of times a step
+	struct SolverBody
+	{
+		XMFLOAT3 linearVelocity;
+		XMFLOAT3 angularVelocity;
+		float	 inverseMass;
+	};
+
+	struct SolverPoint
+	{
+		// the three directions are the normal and the two tangents
+		XMFLOAT3 angularA[3]; // the angular velocity change of each body per unit impulse in that direction
+		XMFLOAT3 angularB[3];
+		XMFLOAT3 armA;		  // from each body's centre to the contact
+		XMFLOAT3 armB;
+		float	 mass[3];	  // effective mass in each direction
+		float	 targetVelocity; // separating speed along the normal, for bounce and pushing out overlap
+	};
+
+	struct SolverContact
+	{
+		ContactManifold* manifold;
+		UINT			 a; // SolverBody indices
+		UINT			 b;
+		XMFLOAT3		 directions[3];
+		float			 friction;
+		SolverPoint		 points[MAX_MANIFOLD_POINTS];
+	};
+}
+
+// one island: gravity, warm start from last step's impulses, a fixed number of passes over every contact point
+// (friction first, then the normal so non penetration wins), then move the bodies. static bodies are only ever
+// read, an island writes nothing but its own bodies and contacts
+void PhysicsWorld::SolveIsland(const Island& island, float dt)
+{
+	const UINT* bodies = &mIslandBodies[island.firstBody];
+	if (island.contactCount == 0)
+	{
+		for (UINT i = 0; i < island.bodyCount; i++)
+		{
+			Body& body = mBodies[bodies[i]];
+			body.linearVelocity = Vec3MultiplyAdd(body.linearVelocity, mGravity, dt);
+			body.transform.position = Vec3MultiplyAdd(body.transform.position, body.linearVelocity, dt);
+			body.transform.rotation = QuatIntegrate(body.transform.rotation, body.angularVelocity, dt);
+		}
+		return;
+	}
+
+	// the island's bodies, then one slot standing in for every static body
+	std::vector<SolverBody> solverBodies(island.bodyCount + 1);
+	for (UINT i = 0; i < island.bodyCount; i++)
+	{
+		Body& body = mBodies[bodies[i]];
+		solverBodies[i].linearVelocity = Vec3MultiplyAdd(body.linearVelocity, mGravity, dt);
+		solverBodies[i].angularVelocity = body.angularVelocity;
+		solverBodies[i].inverseMass = body.inverseMass;
+		mSolverIndices[bodies[i]] = i;
+	}
+	UINT staticSlot = island.bodyCount;
+	solverBodies[staticSlot].linearVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	solverBodies[staticSlot].angularVelocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	solverBodies[staticSlot].inverseMass = 0.0f;
+
+	std::vector<SolverContact> contacts(island.contactCount);
+	for (UINT c = 0; c < island.contactCount; c++)
+	{
+		Contact& contact = mContacts[mIslandContacts[island.firstContact + c]];
+		SolverContact& solver = contacts[c];
+		const Body& a = mBodies[contact.a];
+		const Body& b = mBodies[contact.b];
+
+		solver.manifold = &contact.manifold;
+		solver.a = (a.inverseMass > 0.0f) ? mSolverIndices[contact.a] : staticSlot;
+		solver.b = (b.inverseMass > 0.0f) ? mSolverIndices[contact.b] : staticSlot;
+		solver.friction = sqrtf(a.friction * b.friction);
+		solver.directions[0] = contact.manifold.normal;
+		Vec3Basis(contact.manifold.normal, &solver.directions[1], &solver.directions[2]);
+		float restitution = std::max(a.restitution, b.restitution);
+
+		const SolverBody& velocityA = solverBodies[solver.a];
+		const SolverBody& velocityB = solverBodies[solver.b];
+		for (UINT p = 0; p < contact.manifold.pointCount; p++)
+		{
+			const ContactPoint& point = contact.manifold.points[p];
+			SolverPoint& sp = solver.points[p];
+			sp.armA = Vec3Sub(point.position, a.transform.position);
+			sp.armB = Vec3Sub(point.position, b.transform.position);
+			for (int d = 0; d < 3; d++)
+			{
+				sp.angularA[d] = ApplyInverseInertia(a, Vec3Cross(sp.armA, solver.directions[d]));
+				sp.angularB[d] = ApplyInverseInertia(b, Vec3Cross(sp.armB, solver.directions[d]));
+				float k = a.inverseMass + b.inverseMass
+					+ Vec3Dot(solver.directions[d], Vec3Add(Vec3Cross(sp.angularA[d], sp.armA), Vec3Cross(sp.angularB[d], sp.armB)));
+				sp.mass[d] = (k > 0.0f) ? 1.0f / k : 0.0f;
+			}
+
+			XMFLOAT3 pointA = Vec3Add(velocityA.linearVelocity, Vec3Cross(velocityA.angularVelocity, sp.armA));
+			XMFLOAT3 pointB = Vec3Add(velocityB.linearVelocity, Vec3Cross(velocityB.angularVelocity, sp.armB));
+			float approach = Vec3Dot(Vec3Sub(pointB, pointA), contact.manifold.normal);
+			float bounce = (approach < -kBounceThreshold) ? -restitution * approach : 0.0f;
+			float pushOut = kBaumgarte / dt * std::max(point.depth - kPenetrationSlop, 0.0f);
+			sp.targetVelocity = std::max(bounce, pushOut);
+		}
+	}
+
+	// A gets -impulse, B gets +impulse. the static slot has no mass, so whatever lands on it stays zero
+	auto apply = [&solverBodies](const SolverContact& solver, const SolverPoint& sp, int d, float impulse)
+	{
+		SolverBody& a = solverBodies[solver.a];
+		SolverBody& b = solverBodies[solver.b];
+		a.linearVelocity = Vec3MultiplyAdd(a.linearVelocity, solver.directions[d], -impulse * a.inverseMass);
+		a.angularVelocity = Vec3MultiplyAdd(a.angularVelocity, sp.angularA[d], -impulse);
+		b.linearVelocity = Vec3MultiplyAdd(b.linearVelocity, solver.directions[d], impulse * b.inverseMass);
+		b.angularVelocity = Vec3MultiplyAdd(b.angularVelocity, sp.angularB[d], impulse);
+	};
+
+	auto speed = [&solverBodies](const SolverContact& solver, const SolverPoint& sp, int d)
+	{
+		const SolverBody& a = solverBodies[solver.a];
+		const SolverBody& b = solverBodies[solver.b];
+		XMFLOAT3 pointA = Vec3Add(a.linearVelocity, Vec3Cross(a.angularVelocity, sp.armA));
+		XMFLOAT3 pointB = Vec3Add(b.linearVelocity, Vec3Cross(b.angularVelocity, sp.armB));
+		return Vec3Dot(Vec3Sub(pointB, pointA), solver.directions[d]);
+	};
+
+	for (const SolverContact& solver : contacts)
+	{
+		for (UINT p = 0; p < solver.manifold->pointCount; p++)
+		{
+			const ContactPoint& point = solver.manifold->points[p];
+			apply(solver, solver.points[p], 0, point.normalImpulse);
+			apply(solver, solver.points[p], 1, point.tangentImpulse[0]);
+			apply(solver, solver.points[p], 2, point.tangentImpulse[1]);
+		}
+	}
+
+	for (UINT iteration = 0; iteration < mIterations; iteration++)
+	{
+		for (const SolverContact& solver : contacts)
+		{
+			for (UINT p = 0; p < solver.manifold->pointCount; p++)
+			{
+				ContactPoint& point = solver.manifold->points[p];
+				const SolverPoint& sp = solver.points[p];
+
+				// friction, limited by how hard the contact is being pressed together
+				float limit = solver.friction * point.normalImpulse;
+				for (int t = 0; t < 2; t++)
+				{
+					float total = point.tangentImpulse[t] - speed(solver, sp, t + 1) * sp.mass[t + 1];
+					total = std::max(-limit, std::min(total, limit));
+					apply(solver, sp, t + 1, total - point.tangentImpulse[t]);
+					point.tangentImpulse[t] = total;
+				}
+
+				// contacts can push but never pull, the total is clamped rather than each change so earlier
+				// iterations can be undone by later ones
+				float total = std::max(point.normalImpulse + (sp.targetVelocity - speed(solver, sp, 0)) * sp.mass[0], 0.0f);
+				apply(solver, sp, 0, total - point.normalImpulse);
+				point.normalImpulse = total;
+			}
+		}
+	}
+
+	for (UINT i = 0; i < island.bodyCount; i++)
+	{
+		Body& body = mBodies[bodies[i]];
+		body.linearVelocity = solverBodies[i].linearVelocity;
+		body.angularVelocity = solverBodies[i].angularVelocity;
+		body.transform.position = Vec3MultiplyAdd(body.transform.position, body.linearVelocity, dt);
+		body.transform.rotation = QuatIntegrate(body.transform.rotation, body.angularVelocity, dt);
+	}
+}
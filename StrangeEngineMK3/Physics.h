@@ -0,0 +1,149 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include "Broadphase.h"
+#include "Narrowphase.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+struct RigidBodyDesc
+{
+	CollisionShape shape;
+	XMFLOAT3	   position;
+	XMFLOAT4	   rotation;
+	XMFLOAT3	   linearVelocity;
+	XMFLOAT3	   angularVelocity; // world space, radians/s
+	float		   mass;			// 0 for static bodies, they never move and only collide with dynamic ones
+	float		   friction;
+	float		   restitution;		// 0 for no bounce, 1 for bouncing back at the speed it hit
+	UINT64		   userData;
+
+	RigidBodyDesc();
+};
+
+struct PhysicsStats
+{
+	UINT   bodyCount;
+	UINT   pairCount;	   // from the broadphase
+	UINT   manifoldCount;  // pairs actually touching
+	UINT   contactCount;   // points over all manifolds
+	UINT   islandCount;
+	UINT   largestIsland;  // in bodies
+	double broadphaseMs;
+	double narrowphaseMs;
+	double solverMs;	   // islands solved and moved
+};
+
+// rigid bodies, their contacts and the solver, stepped at a fixed rate
+// each step the broadphase finds candidate pairs, the narrowphase turns them into contact manifolds on the job system,
+// and bodies that touch (directly or through other bodies) are grouped into islands. every island is solved on its own
+// with sequential impulses, so islands run in parallel with no locking. everything is processed in body id order and
+// never depends on which thread did what, so a step gives bit for bit the same result whatever the thread count
+class STRANGEENGINEMK3_API PhysicsWorld
+{
+public:
+	PhysicsWorld();
+
+	// ids of removed bodies are reused
+	UINT AddBody(const RigidBodyDesc& desc);
+	void RemoveBody(UINT id);
+
+	const RigidTransform& GetTransform(UINT id) const { return mBodies[id].transform; }
+	const XMFLOAT3& GetLinearVelocity(UINT id) const { return mBodies[id].linearVelocity; }
+	const XMFLOAT3& GetAngularVelocity(UINT id) const { return mBodies[id].angularVelocity; }
+	UINT64 GetUserData(UINT id) const { return mBodies[id].userData; }
+	UINT GetBodyCount() const { return mBodyCount; }
+
+	void SetTransform(UINT id, const RigidTransform& transform);
+	void SetVelocity(UINT id, const XMFLOAT3& linear, const XMFLOAT3& angular);
+	// 'point' in world space, does nothing to static bodies
+	void ApplyImpulse(UINT id, const XMFLOAT3& impulse, const XMFLOAT3& point);
+
+	void SetGravity(const XMFLOAT3& gravity) { mGravity = gravity; }
+	// more settles tall stacks better, each one is another pass over every contact point (10 by default)
+	void SetIterations(UINT iterations) { mIterations = iterations; }
+
+	// one fixed step
+	void Step(float dt);
+
+	// as many 60Hz steps as 'frameTime' covers, the remainder carries over to the next call
+	// at most 4 steps a frame, so a long hitch slows the simulation down instead of making the next frame longer still
+	void Update(float frameTime);
+
+	// runs Update() every frame in the simulation phase, the system writes "Physics". returns the system id
+	UINT AddSystem();
+
+	// from the last Step()
+	const PhysicsStats& GetStats() const { return mStats; }
+
+private:
+	PhysicsWorld(const PhysicsWorld&);
+	PhysicsWorld& operator=(const PhysicsWorld&);
+
+	struct Body
+	{
+		CollisionShape shape;
+		RigidTransform transform;
+		XMFLOAT3	   linearVelocity;
+		XMFLOAT3	   angularVelocity;
+		float		   inverseMass;
+		XMFLOAT3	   inverseInertia; // body space, the shapes are all symmetric enough that the diagonal does
+		float		   friction;
+		float		   restitution;
+		UINT64		   userData;
+		UINT		   proxy;
+		bool		   alive;
+	};
+
+	// a touching pair, a < b
+	struct Contact
+	{
+		UINT			a;
+		UINT			b;
+		ContactManifold manifold;
+	};
+
+	struct Island
+	{
+		UINT firstBody; // into mIslandBodies
+		UINT bodyCount;
+		UINT firstContact; // into mIslandContacts
+		UINT contactCount;
+	};
+
+	void UpdateBroadphase();
+	void FindContacts();
+	void BuildIslands();
+	void SolveIsland(const Island& island, float dt);
+
+	XMFLOAT3 ApplyInverseInertia(const Body& body, const XMFLOAT3& v) const;
+	UINT FindRoot(UINT id);
+
+	std::vector<Body> mBodies; // by id
+	std::vector<UINT> mFreeIds;
+	UINT			  mBodyCount;
+
+	Broadphase mBroadphase;
+
+	// touching pairs from the last step, sorted by key (a << 32 | b), kept for the manifolds' warm start impulses
+	std::vector<UINT64>	 mContactKeys;
+	std::vector<Contact> mContacts;
+
+	// rebuilt every step
+	std::vector<UINT>	mParents;		 // union-find over body ids
+	std::vector<Island> mIslands;		 // ordered by their lowest body id
+	std::vector<UINT>	mIslandBodies;	 // body ids, ascending within each island
+	std::vector<UINT>	mIslandContacts; // indices into mContacts, ascending within each island
+	std::vector<UINT>	mSolverIndices;	 // body id to its place in its island, each island only writes its own bodies'
+
+	XMFLOAT3	 mGravity;
+	UINT		 mIterations;
+	float		 mAccumulator;
+	PhysicsStats mStats;
+	double		 mSecondsPerCount;
+};
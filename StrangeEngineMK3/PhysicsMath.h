@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cmath>
+#include <xnamath.h>
+
+// ==============================================================
+//		small vector and quaternion helpers for the physics code
+// ==============================================================
+//
+// plain scalar code on XMFLOAT3/XMFLOAT4 so results don't depend on which SIMD path the compiler picks,
+// the solver has to give the same answer on every machine and thread count
+
+inline XMFLOAT3 Vec3Add(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline XMFLOAT3 Vec3Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline XMFLOAT3 Vec3Scale(const XMFLOAT3& a, float s) { return XMFLOAT3(a.x * s, a.y * s, a.z * s); }
+inline XMFLOAT3 Vec3Negate(const XMFLOAT3& a) { return XMFLOAT3(-a.x, -a.y, -a.z); }
+inline XMFLOAT3 Vec3Multiply(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline float	Vec3Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float	Vec3LengthSq(const XMFLOAT3& a) { return Vec3Dot(a, a); }
+inline float	Vec3Length(const XMFLOAT3& a) { return sqrtf(Vec3Dot(a, a)); }
+
+inline XMFLOAT3 Vec3Cross(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+// zero stays zero
+inline XMFLOAT3 Vec3Normalize(const XMFLOAT3& a)
+{
+	float length = Vec3Length(a);
+	return (length > 1e-12f) ? Vec3Scale(a, 1.0f / length) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+}
+
+// a + b * s
+inline XMFLOAT3 Vec3MultiplyAdd(const XMFLOAT3& a, const XMFLOAT3& b, float s)
+{
+	return XMFLOAT3(a.x + b.x * s, a.y + b.y * s, a.z + b.z * s);
+}
+
+// two unit vectors at right angles to 'n' and each other
+inline void Vec3Basis(const XMFLOAT3& n, XMFLOAT3* t1, XMFLOAT3* t2)
+{
+	if (fabsf(n.x) >= 0.57735f)
+		*t1 = Vec3Normalize(XMFLOAT3(n.y, -n.x, 0.0f));
+	else
+		*t1 = Vec3Normalize(XMFLOAT3(0.0f, n.z, -n.y));
+	*t2 = Vec3Cross(n, *t1);
+}
+
+inline XMFLOAT4 QuatIdentity() { return XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f); }
+inline XMFLOAT4 QuatConjugate(const XMFLOAT4& q) { return XMFLOAT4(-q.x, -q.y, -q.z, q.w); }
+
+// a then b, i.e. b * a with quaternions
+inline XMFLOAT4 QuatMultiply(const XMFLOAT4& b, const XMFLOAT4& a)
+{
+	return XMFLOAT4(b.w * a.x + b.x * a.w + b.y * a.z - b.z * a.y,
+		b.w * a.y - b.x * a.z + b.y * a.w + b.z * a.x,
+		b.w * a.z + b.x * a.y - b.y * a.x + b.z * a.w,
+		b.w * a.w - b.x * a.x - b.y * a.y - b.z * a.z);
+}
+
+inline XMFLOAT4 QuatNormalize(const XMFLOAT4& q)
+{
+	float length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	return (length > 1e-12f) ? XMFLOAT4(q.x / length, q.y / length, q.z / length, q.w / length) : QuatIdentity();
+}
+
+inline XMFLOAT4 QuatFromAxisAngle(const XMFLOAT3& axis, float angle)
+{
+	XMFLOAT3 unit = Vec3Normalize(axis);
+	float s = sinf(angle * 0.5f);
+	return XMFLOAT4(unit.x * s, unit.y * s, unit.z * s, cosf(angle * 0.5f));
+}
+
+inline XMFLOAT3 QuatRotate(const XMFLOAT4& q, const XMFLOAT3& v)
+{
+	// v + 2w(u x v) + 2u x (u x v)
+	XMFLOAT3 u(q.x, q.y, q.z);
+	XMFLOAT3 t = Vec3Scale(Vec3Cross(u, v), 2.0f);
+	return Vec3Add(Vec3MultiplyAdd(v, t, q.w), Vec3Cross(u, t));
+}
+
+inline XMFLOAT3 QuatRotateInverse(const XMFLOAT4& q, const XMFLOAT3& v)
+{
+	return QuatRotate(QuatConjugate(q), v);
+}
+
+// the orientation after spinning at 'angularVelocity' (world space, radians/s) for 'dt'
+inline XMFLOAT4 QuatIntegrate(const XMFLOAT4& q, const XMFLOAT3& angularVelocity, float dt)
+{
+	XMFLOAT4 spin(angularVelocity.x * dt * 0.5f, angularVelocity.y * dt * 0.5f, angularVelocity.z * dt * 0.5f, 0.0f);
+	XMFLOAT4 delta = QuatMultiply(spin, q);
+	return QuatNormalize(XMFLOAT4(q.x + delta.x, q.y + delta.y, q.z + delta.z, q.w + delta.w));
+}
@@ -0,0 +1,825 @@
+#include "pch.h"
+#include "Picking.h"
+#include "Log.h"
+#include "JobSystem.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// bins along each axis the SAH build tries boundaries between
+static const UINT kBinCount = 16;
+
+// a node with this many primitives or fewer is a leaf, a triangle packet holds this many
+static const UINT kLeafSize = 4;
+
+// past this depth nodes are split at their median instead, so a mesh the SAH splits badly can't get deep enough to
+// overflow the traversal stack
+static const UINT kSahDepth = 40;
+
+// a node with more primitives than this builds one half as a job while the other is built here
+static const UINT kParallelCount = 8192;
+
+// the deepest tree the build can make is about kSahDepth + 32 levels, and every node taken off pushes at most four
+static const int kStackSize = 256;
+
+static Aabb EmptyAabb()
+{
+	Aabb box;
+	box.min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return box;
+}
+
+static void GrowAabb(Aabb* box, const XMFLOAT3& point)
+{
+	box->min = XMFLOAT3(std::min(box->min.x, point.x), std::min(box->min.y, point.y), std::min(box->min.z, point.z));
+	box->max = XMFLOAT3(std::max(box->max.x, point.x), std::max(box->max.y, point.y), std::max(box->max.z, point.z));
+}
+
+// half the surface area, the SAH only compares them
+static float HalfArea(const Aabb& box)
+{
+	float x = box.max.x - box.min.x;
+	float y = box.max.y - box.min.y;
+	float z = box.max.z - box.min.z;
+	return x * y + y * z + z * x;
+}
+
+
+// ==============================================================
+//		build
+// ==============================================================
+
+// the binary tree the SAH build makes, collapsed into BvhNodes once it is finished
+struct BuildNode
+{
+	Aabb bounds;
+	UINT left;	// inner nodes, the right child is left + 1
+	UINT first; // leaves, into the build's order
+	UINT count; // 0 for inner nodes
+};
+
+// a primitive's box and centre padded out to four floats, so the build can load them straight into SSE registers
+struct BuildPrimitive
+{
+	float min[4];
+	float max[4];
+	float center[4];
+};
+
+// builds over any primitives that have a box and a centre: a mesh's triangles or a scene's instances
+class BvhBuilder
+{
+public:
+	// 'boxes' and 'centers' have one entry per primitive
+	BvhBuilder(const Aabb* boxes, const XMFLOAT3* centers, UINT count);
+
+	// the primitives in leaf order, a leaf's range of them is what Collapse() hands its callback
+	const std::vector<UINT>& GetOrder() const { return mOrder; }
+	const Aabb& GetBounds() const { return mNodes[0].bounds; }
+
+	// 'leaf(first, count)' is called for every leaf and returns the index the leaf is stored under
+	template<typename LeafFn> void Collapse(std::vector<BvhNode>* nodes, LeafFn leaf) const
+	{
+		nodes->clear();
+		nodes->reserve(mNodeCount.load() / 2 + 1);
+		CollapseNode(0, nodes, leaf);
+	}
+
+private:
+	void Split(UINT index, UINT first, UINT count, UINT depth);
+	template<typename LeafFn> UINT CollapseNode(UINT index, std::vector<BvhNode>* nodes, LeafFn& leaf) const;
+
+	std::vector<BuildPrimitive> mPrimitives;
+	std::vector<UINT>			mOrder;
+	std::vector<BuildNode>		mNodes;		// room for the most nodes a tree over the primitives can have
+	std::atomic<UINT>			mNodeCount; // handed out two at a time, from every job building a part of the tree
+};
+
+BvhBuilder::BvhBuilder(const Aabb* boxes, const XMFLOAT3* centers, UINT count)
+	: mNodeCount(1)
+{
+	mPrimitives.resize(count);
+	mOrder.resize(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		BuildPrimitive& primitive = mPrimitives[i];
+		primitive.min[0] = boxes[i].min.x;
+		primitive.min[1] = boxes[i].min.y;
+		primitive.min[2] = boxes[i].min.z;
+		primitive.min[3] = 0.0f;
+		primitive.max[0] = boxes[i].max.x;
+		primitive.max[1] = boxes[i].max.y;
+		primitive.max[2] = boxes[i].max.z;
+		primitive.max[3] = 0.0f;
+		primitive.center[0] = centers[i].x;
+		primitive.center[1] = centers[i].y;
+		primitive.center[2] = centers[i].z;
+		primitive.center[3] = 0.0f;
+		mOrder[i] = i;
+	}
+	mNodes.resize(count > 0 ? count * 2 - 1 : 1);
+	Split(0, 0, count, 0);
+}
+
+// half the surface area of a box in the first three lanes
+static float HalfArea(__m128 min, __m128 max)
+{
+	float size[4];
+	_mm_storeu_ps(size, _mm_sub_ps(max, min));
+	return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+// a centre's bin along every axis at once. the binning and the partition after it both go through here, so every
+// primitive lands on the side its bin was counted on
+static __m128i BinIndices(__m128 center, __m128 low, __m128 scale)
+{
+	__m128i bins = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(center, low), scale));
+	bins = _mm_and_si128(bins, _mm_cmpgt_epi32(bins, _mm_setzero_si128()));
+	__m128i last = _mm_set1_epi32(kBinCount - 1);
+	__m128i over = _mm_cmpgt_epi32(bins, last);
+	return _mm_or_si128(_mm_andnot_si128(over, bins), _mm_and_si128(over, last));
+}
+
+void BvhBuilder::Split(UINT index, UINT first, UINT count, UINT depth)
+{
+	BuildNode& node = mNodes[index];
+	UINT* order = mOrder.data() + first;
+	__m128 boundsMin = _mm_set1_ps(FLT_MAX);
+	__m128 boundsMax = _mm_set1_ps(-FLT_MAX);
+	__m128 centersMin = boundsMin;
+	__m128 centersMax = boundsMax;
+	for (UINT i = 0; i < count; i++)
+	{
+		const BuildPrimitive& primitive = mPrimitives[order[i]];
+		__m128 center = _mm_loadu_ps(primitive.center);
+		boundsMin = _mm_min_ps(boundsMin, _mm_loadu_ps(primitive.min));
+		boundsMax = _mm_max_ps(boundsMax, _mm_loadu_ps(primitive.max));
+		centersMin = _mm_min_ps(centersMin, center);
+		centersMax = _mm_max_ps(centersMax, center);
+	}
+	float boundsFloats[8];
+	_mm_storeu_ps(boundsFloats, boundsMin);
+	_mm_storeu_ps(boundsFloats + 4, boundsMax);
+	node.bounds.min = XMFLOAT3(boundsFloats[0], boundsFloats[1], boundsFloats[2]);
+	node.bounds.max = XMFLOAT3(boundsFloats[4], boundsFloats[5], boundsFloats[6]);
+	if (count <= kLeafSize)
+	{
+		node.left = 0;
+		node.first = first;
+		node.count = count;
+		return;
+	}
+
+	float centersLow[4];
+	float centersExtent[4];
+	_mm_storeu_ps(centersLow, centersMin);
+	_mm_storeu_ps(centersExtent, _mm_sub_ps(centersMax, centersMin));
+
+	// the cheapest boundary between bins on any axis, each side's area times how many primitives are in it. all
+	// three axes are binned in the same pass over the primitives
+	UINT middle = 0;
+	if (depth < kSahDepth)
+	{
+		float scales[4] = {};
+		for (int axis = 0; axis < 3; axis++)
+			scales[axis] = (centersExtent[axis] > 0.0f) ? kBinCount / centersExtent[axis] : 0.0f;
+		__m128 scale = _mm_loadu_ps(scales);
+
+		__m128 binMin[3][kBinCount];
+		__m128 binMax[3][kBinCount];
+		UINT binCounts[3][kBinCount] = {};
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (UINT bin = 0; bin < kBinCount; bin++)
+			{
+				binMin[axis][bin] = _mm_set1_ps(FLT_MAX);
+				binMax[axis][bin] = _mm_set1_ps(-FLT_MAX);
+			}
+		}
+		for (UINT i = 0; i < count; i++)
+		{
+			const BuildPrimitive& primitive = mPrimitives[order[i]];
+			__m128 min = _mm_loadu_ps(primitive.min);
+			__m128 max = _mm_loadu_ps(primitive.max);
+			int bins[4];
+			_mm_storeu_si128((__m128i*)bins, BinIndices(_mm_loadu_ps(primitive.center), centersMin, scale));
+			for (int axis = 0; axis < 3; axis++)
+			{
+				binCounts[axis][bins[axis]]++;
+				binMin[axis][bins[axis]] = _mm_min_ps(binMin[axis][bins[axis]], min);
+				binMax[axis][bins[axis]] = _mm_max_ps(binMax[axis][bins[axis]], max);
+			}
+		}
+
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		int bestBin = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (centersExtent[axis] <= 0.0f)
+				continue;
+
+			// boundary b has bins [0, b) on the left
+			float rightAreas[kBinCount];
+			UINT rightCounts[kBinCount];
+			__m128 rightMin = _mm_set1_ps(FLT_MAX);
+			__m128 rightMax = _mm_set1_ps(-FLT_MAX);
+			UINT rightCount = 0;
+			for (UINT bin = kBinCount - 1; bin > 0; bin--)
+			{
+				rightMin = _mm_min_ps(rightMin, binMin[axis][bin]);
+				rightMax = _mm_max_ps(rightMax, binMax[axis][bin]);
+				rightCount += binCounts[axis][bin];
+				rightAreas[bin] = rightCount ? HalfArea(rightMin, rightMax) : 0.0f;
+				rightCounts[bin] = rightCount;
+			}
+			__m128 leftMin = _mm_set1_ps(FLT_MAX);
+			__m128 leftMax = _mm_set1_ps(-FLT_MAX);
+			UINT leftCount = 0;
+			for (UINT bin = 1; bin < kBinCount; bin++)
+			{
+				leftMin = _mm_min_ps(leftMin, binMin[axis][bin - 1]);
+				leftMax = _mm_max_ps(leftMax, binMax[axis][bin - 1]);
+				leftCount += binCounts[axis][bin - 1];
+				if (leftCount == 0 || rightCounts[bin] == 0)
+					continue;
+				float cost = HalfArea(leftMin, leftMax) * leftCount + rightAreas[bin] * rightCounts[bin];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = (int)bin;
+				}
+			}
+		}
+
+		if (bestAxis >= 0)
+		{
+			UINT* split = std::partition(order, order + count, [&](UINT primitive)
+			{
+				int bins[4];
+				_mm_storeu_si128((__m128i*)bins, BinIndices(_mm_loadu_ps(mPrimitives[primitive].center), centersMin, scale));
+				return bins[bestAxis] < bestBin;
+			});
+			middle = (UINT)(split - order);
+		}
+	}
+
+	// too deep, or every centre in the same place: half on each side, along the widest spread of centres
+	if (middle == 0 || middle == count)
+	{
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (centersExtent[i] > centersExtent[axis])
+				axis = i;
+		}
+		middle = count / 2;
+		std::nth_element(order, order + middle, order + count, [&](UINT a, UINT b)
+		{
+			return mPrimitives[a].center[axis] < mPrimitives[b].center[axis];
+		});
+	}
+
+	UINT left = mNodeCount.fetch_add(2, std::memory_order_relaxed);
+	node.left = left;
+	node.first = 0;
+	node.count = 0;
+	if (count > kParallelCount)
+	{
+		JobCounter counter;
+		JobSystem::Get()->Run([=]()
+		{
+			Split(left, first, middle, depth + 1);
+		}, &counter);
+		Split(left + 1, first + middle, count - middle, depth + 1);
+		JobSystem::Get()->Wait(&counter);
+	}
+	else
+	{
+		Split(left, first, middle, depth + 1);
+		Split(left + 1, first + middle, count - middle, depth + 1);
+	}
+}
+
+template<typename LeafFn> UINT BvhBuilder::CollapseNode(UINT index, std::vector<BvhNode>* nodes, LeafFn& leaf) const
+{
+	// the node's children, then the biggest inner one is opened up for its children until there are four
+	UINT children[4];
+	UINT count = 0;
+	const BuildNode& node = mNodes[index];
+	if (node.count > 0)
+	{
+		// only a root with a few primitives
+		children[count++] = index;
+	}
+	else
+	{
+		children[count++] = node.left;
+		children[count++] = node.left + 1;
+	}
+	while (count < 4)
+	{
+		int biggest = -1;
+		float biggestArea = -1.0f;
+		for (UINT i = 0; i < count; i++)
+		{
+			const BuildNode& child = mNodes[children[i]];
+			if (child.count == 0 && HalfArea(child.bounds) > biggestArea)
+			{
+				biggest = (int)i;
+				biggestArea = HalfArea(child.bounds);
+			}
+		}
+		if (biggest < 0)
+			break;
+		UINT opened = mNodes[children[biggest]].left;
+		children[biggest] = opened;
+		children[count++] = opened + 1;
+	}
+
+	// its children are added after it, so it is filled in once they have their indices
+	UINT result = (UINT)nodes->size();
+	nodes->push_back(BvhNode());
+	BvhNode collapsed;
+	memset(&collapsed, 0, sizeof(collapsed));
+	for (UINT lane = 0; lane < 4; lane++)
+	{
+		if (lane >= count)
+		{
+			collapsed.children[lane] = BVH_EMPTY;
+			continue;
+		}
+		const BuildNode& child = mNodes[children[lane]];
+		collapsed.minX[lane] = child.bounds.min.x;
+		collapsed.minY[lane] = child.bounds.min.y;
+		collapsed.minZ[lane] = child.bounds.min.z;
+		collapsed.maxX[lane] = child.bounds.max.x;
+		collapsed.maxY[lane] = child.bounds.max.y;
+		collapsed.maxZ[lane] = child.bounds.max.z;
+		collapsed.children[lane] = (child.count > 0) ? (BVH_LEAF | leaf(child.first, child.count)) : CollapseNode(children[lane], nodes, leaf);
+	}
+	(*nodes)[result] = collapsed;
+	return result;
+}
+
+
+// ==============================================================
+//		traversal
+// ==============================================================
+
+// the ray across all four lanes, to test four boxes or four triangles at once
+struct SimdRay
+{
+	__m128 originX;
+	__m128 originY;
+	__m128 originZ;
+	__m128 directionX;
+	__m128 directionY;
+	__m128 directionZ;
+	__m128 inverseX;
+	__m128 inverseY;
+	__m128 inverseZ;
+};
+
+static float SafeInverse(float d)
+{
+	// 0 would make 0 * infinity in the slab test, a tiny direction with the same sign misses the same boxes
+	if (fabsf(d) < 1e-12f)
+		d = (d < 0.0f) ? -1e-12f : 1e-12f;
+	return 1.0f / d;
+}
+
+static SimdRay MakeSimdRay(const XMFLOAT3& origin, const XMFLOAT3& direction)
+{
+	SimdRay ray;
+	ray.originX = _mm_set1_ps(origin.x);
+	ray.originY = _mm_set1_ps(origin.y);
+	ray.originZ = _mm_set1_ps(origin.z);
+	ray.directionX = _mm_set1_ps(direction.x);
+	ray.directionY = _mm_set1_ps(direction.y);
+	ray.directionZ = _mm_set1_ps(direction.z);
+	ray.inverseX = _mm_set1_ps(SafeInverse(direction.x));
+	ray.inverseY = _mm_set1_ps(SafeInverse(direction.y));
+	ray.inverseZ = _mm_set1_ps(SafeInverse(direction.z));
+	return ray;
+}
+
+// walks the tree nearest child first. 'leaf(index, &closest)' tests what is in a leaf, pulls closest in and returns
+// true on a hit, anything that starts past closest is skipped
+template<typename LeafFn> static bool Traverse(const BvhNode* nodes, const SimdRay& ray, float* closest, LeafFn leaf)
+{
+	struct Entry
+	{
+		UINT  child;
+		float enter;
+	};
+	Entry stack[kStackSize];
+	int top = 0;
+	stack[top].child = 0;
+	stack[top++].enter = 0.0f;
+
+	const __m128 zero = _mm_setzero_ps();
+	bool found = false;
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		if (entry.enter > *closest)
+			continue;
+		if (entry.child & BVH_LEAF)
+		{
+			if (leaf(entry.child & ~BVH_LEAF, closest))
+				found = true;
+			continue;
+		}
+
+		// the slabs of all four children at once
+		const BvhNode& node = nodes[entry.child];
+		__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ray.originX), ray.inverseX);
+		__m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ray.originX), ray.inverseX);
+		__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), ray.originY), ray.inverseY);
+		__m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), ray.originY), ray.inverseY);
+		__m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), ray.originZ), ray.inverseZ);
+		__m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), ray.originZ), ray.inverseZ);
+		__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), zero));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(*closest)));
+		int mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+		if (mask == 0)
+			continue;
+
+		// pushed furthest first, so the nearest comes off next
+		float enters[4];
+		_mm_storeu_ps(enters, enter);
+		Entry hits[4];
+		UINT count = 0;
+		for (UINT lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)) || node.children[lane] == BVH_EMPTY)
+				continue;
+			Entry hit = { node.children[lane], enters[lane] };
+			UINT i = count++;
+			for (; i > 0 && hits[i - 1].enter < hit.enter; i--)
+				hits[i] = hits[i - 1];
+			hits[i] = hit;
+		}
+		for (UINT i = 0; i < count; i++)
+			stack[top++] = hits[i];
+	}
+	return found;
+}
+
+
+// ==============================================================
+//		mesh bvh
+// ==============================================================
+
+MeshBvh::MeshBvh()
+{
+	Clear();
+}
+
+void MeshBvh::Clear()
+{
+	mNodes.clear();
+	mPackets.clear();
+	mBounds.min = mBounds.max = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	mTriangleCount = 0;
+}
+
+bool MeshBvh::Build(const MeshVertex* vertices, UINT vertexCount, const UINT* indices, UINT indexCount)
+{
+	Clear();
+	if (indexCount % 3 != 0)
+	{
+		ReportError(LogCategory_Assets, "A mesh with {} indices isn't a triangle list", indexCount);
+		return false;
+	}
+	for (UINT i = 0; i < indexCount; i++)
+	{
+		if (indices[i] >= vertexCount)
+		{
+			ReportError(LogCategory_Assets, "Mesh index {} is past the mesh's {} vertices", indices[i], vertexCount);
+			return false;
+		}
+	}
+
+	UINT count = indexCount / 3;
+	if (count == 0)
+		return true;
+
+	std::vector<Aabb> boxes(count);
+	std::vector<XMFLOAT3> centers(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		boxes[i] = EmptyAabb();
+		for (UINT corner = 0; corner < 3; corner++)
+			GrowAabb(&boxes[i], vertices[indices[i * 3 + corner]].position);
+		centers[i] = XMFLOAT3((boxes[i].min.x + boxes[i].max.x) * 0.5f, (boxes[i].min.y + boxes[i].max.y) * 0.5f, (boxes[i].min.z + boxes[i].max.z) * 0.5f);
+	}
+
+	BvhBuilder builder(boxes.data(), centers.data(), count);
+	const std::vector<UINT>& order = builder.GetOrder();
+	mPackets.reserve((count + kLeafSize - 1) / kLeafSize * 2);
+	builder.Collapse(&mNodes, [&](UINT first, UINT leafCount) -> UINT
+	{
+		TrianglePacket packet;
+		memset(&packet, 0, sizeof(packet));
+		for (UINT lane = 0; lane < leafCount; lane++)
+		{
+			UINT triangle = order[first + lane];
+			const XMFLOAT3& p0 = vertices[indices[triangle * 3]].position;
+			const XMFLOAT3& p1 = vertices[indices[triangle * 3 + 1]].position;
+			const XMFLOAT3& p2 = vertices[indices[triangle * 3 + 2]].position;
+			packet.v0x[lane] = p0.x;
+			packet.v0y[lane] = p0.y;
+			packet.v0z[lane] = p0.z;
+			packet.e1x[lane] = p1.x - p0.x;
+			packet.e1y[lane] = p1.y - p0.y;
+			packet.e1z[lane] = p1.z - p0.z;
+			packet.e2x[lane] = p2.x - p0.x;
+			packet.e2y[lane] = p2.y - p0.y;
+			packet.e2z[lane] = p2.z - p0.z;
+			packet.triangles[lane] = triangle;
+		}
+		mPackets.push_back(packet);
+		return (UINT)mPackets.size() - 1;
+	});
+	mBounds = builder.GetBounds();
+	mTriangleCount = count;
+	return true;
+}
+
+bool MeshBvh::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, PickHit* hit) const
+{
+	if (mNodes.empty())
+		return false;
+
+	SimdRay ray = MakeSimdRay(origin, direction);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	float closest = maxDistance;
+	bool found = Traverse(mNodes.data(), ray, &closest, [&](UINT leaf, float* closest) -> bool
+	{
+		// Moller-Trumbore on four triangles at once, from either side
+		const TrianglePacket& packet = mPackets[leaf];
+		__m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+		__m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+		__m128 px = _mm_sub_ps(_mm_mul_ps(ray.directionY, e2z), _mm_mul_ps(ray.directionZ, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(ray.directionZ, e2x), _mm_mul_ps(ray.directionX, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(ray.directionX, e2y), _mm_mul_ps(ray.directionY, e2x));
+		__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inverse = _mm_div_ps(one, determinant);
+
+		__m128 sx = _mm_sub_ps(ray.originX, _mm_loadu_ps(packet.v0x));
+		__m128 sy = _mm_sub_ps(ray.originY, _mm_loadu_ps(packet.v0y));
+		__m128 sz = _mm_sub_ps(ray.originZ, _mm_loadu_ps(packet.v0z));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverse);
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ray.directionX, qx), _mm_mul_ps(ray.directionY, qy)), _mm_mul_ps(ray.directionZ, qz)), inverse);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+		// the empty lanes and edge-on triangles have a 0 determinant, every compare against their NaNs fails anyway
+		__m128 inside = _mm_and_ps(_mm_cmpneq_ps(determinant, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+		inside = _mm_and_ps(inside, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(*closest))));
+		int mask = _mm_movemask_ps(inside);
+		if (mask == 0)
+			return false;
+
+		float distances[4], us[4], vs[4];
+		_mm_storeu_ps(distances, t);
+		_mm_storeu_ps(us, u);
+		_mm_storeu_ps(vs, v);
+		int best = -1;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if ((mask & (1 << lane)) && distances[lane] < *closest)
+			{
+				*closest = distances[lane];
+				best = lane;
+			}
+		}
+		hit->triangle = packet.triangles[best];
+		hit->u = us[best];
+		hit->v = vs[best];
+		return true;
+	});
+	if (!found)
+		return false;
+
+	hit->distance = closest;
+	hit->position = XMFLOAT3(origin.x + direction.x * closest, origin.y + direction.y * closest, origin.z + direction.z * closest);
+	return true;
+}
+
+
+// ==============================================================
+//		pick scene
+// ==============================================================
+
+// world matrices are affine (row vectors, translation in the bottom row), the inverse is the 3x3 part's inverse and the
+// translation taken back through it
+static XMFLOAT4X4 InverseAffine(const XMFLOAT4X4& m)
+{
+	float determinant = m._11 * (m._22 * m._33 - m._23 * m._32) - m._12 * (m._21 * m._33 - m._23 * m._31) + m._13 * (m._21 * m._32 - m._22 * m._31);
+	float scale = (determinant != 0.0f) ? 1.0f / determinant : 0.0f;
+	XMFLOAT4X4 r;
+	r._11 = (m._22 * m._33 - m._23 * m._32) * scale;
+	r._12 = (m._13 * m._32 - m._12 * m._33) * scale;
+	r._13 = (m._12 * m._23 - m._13 * m._22) * scale;
+	r._21 = (m._23 * m._31 - m._21 * m._33) * scale;
+	r._22 = (m._11 * m._33 - m._13 * m._31) * scale;
+	r._23 = (m._13 * m._21 - m._11 * m._23) * scale;
+	r._31 = (m._21 * m._32 - m._22 * m._31) * scale;
+	r._32 = (m._12 * m._31 - m._11 * m._32) * scale;
+	r._33 = (m._11 * m._22 - m._12 * m._21) * scale;
+	r._41 = -(m._41 * r._11 + m._42 * r._21 + m._43 * r._31);
+	r._42 = -(m._41 * r._12 + m._42 * r._22 + m._43 * r._32);
+	r._43 = -(m._41 * r._13 + m._42 * r._23 + m._43 * r._33);
+	r._14 = r._24 = r._34 = 0.0f;
+	r._44 = 1.0f;
+	return r;
+}
+
+static XMFLOAT3 TransformPoint(const XMFLOAT3& p, const XMFLOAT4X4& m)
+{
+	return XMFLOAT3(p.x * m._11 + p.y * m._21 + p.z * m._31 + m._41,
+		p.x * m._12 + p.y * m._22 + p.z * m._32 + m._42,
+		p.x * m._13 + p.y * m._23 + p.z * m._33 + m._43);
+}
+
+static XMFLOAT3 TransformVector(const XMFLOAT3& v, const XMFLOAT4X4& m)
+{
+	return XMFLOAT3(v.x * m._11 + v.y * m._21 + v.z * m._31,
+		v.x * m._12 + v.y * m._22 + v.z * m._32,
+		v.x * m._13 + v.y * m._23 + v.z * m._33);
+}
+
+PickScene::PickScene()
+{
+	mCount = 0;
+	mDirty = false;
+}
+
+UINT PickScene::AddMeshes(const MeshData* meshes, UINT count)
+{
+	UINT first = (UINT)mMeshes.size();
+	mMeshes.resize(first + count);
+	JobSystem::Get()->ParallelFor(count, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+			mMeshes[first + i].Build(meshes[i]);
+	});
+	return first;
+}
+
+void PickScene::SetWorld(Instance* instance, const XMFLOAT4X4& world)
+{
+	instance->world = world;
+	instance->inverse = InverseAffine(world);
+
+	// the mesh's box around its moved centre, each axis as far as the rotated extents reach (Arvo)
+	const Aabb& local = mMeshes[instance->mesh].GetBounds();
+	XMFLOAT3 center((local.min.x + local.max.x) * 0.5f, (local.min.y + local.max.y) * 0.5f, (local.min.z + local.max.z) * 0.5f);
+	XMFLOAT3 extent((local.max.x - local.min.x) * 0.5f, (local.max.y - local.min.y) * 0.5f, (local.max.z - local.min.z) * 0.5f);
+	XMFLOAT3 moved = TransformPoint(center, world);
+	XMFLOAT3 reach(extent.x * fabsf(world._11) + extent.y * fabsf(world._21) + extent.z * fabsf(world._31),
+		extent.x * fabsf(world._12) + extent.y * fabsf(world._22) + extent.z * fabsf(world._32),
+		extent.x * fabsf(world._13) + extent.y * fabsf(world._23) + extent.z * fabsf(world._33));
+	instance->bounds = MakeAabb(moved, reach);
+}
+
+UINT PickScene::AddInstance(UINT mesh, const XMFLOAT4X4& world)
+{
+	UINT id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (UINT)mInstances.size();
+		mInstances.push_back(Instance());
+	}
+
+	Instance& instance = mInstances[id];
+	instance.mesh = mesh;
+	instance.alive = true;
+	SetWorld(&instance, world);
+	mCount++;
+	mDirty = true;
+	return id;
+}
+
+void PickScene::SetTransform(UINT instance, const XMFLOAT4X4& world)
+{
+	SetWorld(&mInstances[instance], world);
+	mDirty = true;
+}
+
+void PickScene::RemoveInstance(UINT instance)
+{
+	if (!mInstances[instance].alive)
+		return;
+	mInstances[instance].alive = false;
+	mFreeIds.push_back(instance);
+	mCount--;
+	mDirty = true;
+}
+
+void PickScene::Update()
+{
+	if (!mDirty)
+		return;
+	mDirty = false;
+	mNodes.clear();
+	mLeaves.clear();
+	mInstanceOrder.clear();
+	if (mCount == 0)
+		return;
+
+	// a full rebuild, the instances are few next to the triangles under them
+	std::vector<UINT> ids;
+	std::vector<Aabb> boxes;
+	std::vector<XMFLOAT3> centers;
+	ids.reserve(mCount);
+	boxes.reserve(mCount);
+	centers.reserve(mCount);
+	for (UINT id = 0; id < (UINT)mInstances.size(); id++)
+	{
+		const Instance& instance = mInstances[id];
+		if (!instance.alive)
+			continue;
+		ids.push_back(id);
+		boxes.push_back(instance.bounds);
+		centers.push_back(XMFLOAT3((instance.bounds.min.x + instance.bounds.max.x) * 0.5f,
+			(instance.bounds.min.y + instance.bounds.max.y) * 0.5f, (instance.bounds.min.z + instance.bounds.max.z) * 0.5f));
+	}
+
+	BvhBuilder builder(boxes.data(), centers.data(), (UINT)ids.size());
+	const std::vector<UINT>& order = builder.GetOrder();
+	mInstanceOrder.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+		mInstanceOrder[i] = ids[order[i]];
+	builder.Collapse(&mNodes, [&](UINT first, UINT count) -> UINT
+	{
+		Leaf leaf = { first, count };
+		mLeaves.push_back(leaf);
+		return (UINT)mLeaves.size() - 1;
+	});
+}
+
+bool PickScene::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, PickHit* hit) const
+{
+	if (mNodes.empty())
+		return false;
+
+	SimdRay ray = MakeSimdRay(origin, direction);
+	float closest = maxDistance;
+	bool found = Traverse(mNodes.data(), ray, &closest, [&](UINT index, float* closest) -> bool
+	{
+		const Leaf& leaf = mLeaves[index];
+		bool any = false;
+		for (UINT i = leaf.first; i < leaf.first + leaf.count; i++)
+		{
+			UINT id = mInstanceOrder[i];
+			const Instance& instance = mInstances[id];
+			if (!instance.alive)
+				continue;
+
+			// the direction is moved without normalizing it, so a distance along it is the same in both spaces
+			PickHit meshHit;
+			if (mMeshes[instance.mesh].Raycast(TransformPoint(origin, instance.inverse), TransformVector(direction, instance.inverse), *closest, &meshHit))
+			{
+				*closest = meshHit.distance;
+				*hit = meshHit;
+				hit->instance = id;
+				any = true;
+			}
+		}
+		return any;
+	});
+	if (!found)
+		return false;
+
+	hit->distance = closest;
+	hit->position = XMFLOAT3(origin.x + direction.x * closest, origin.y + direction.y * closest, origin.z + direction.z * closest);
+	return true;
+}
+
+bool PickScene::Pick(int x, int y, UINT width, UINT height, const XMFLOAT4X4& viewProjection, PickHit* hit) const
+{
+	if (width == 0 || height == 0)
+		return false;
+
+	XMFLOAT3 origin, direction;
+	MakePickRay((float)x, (float)y, (float)width, (float)height, viewProjection, &origin, &direction);
+	return Raycast(origin, direction, FLT_MAX, hit);
+}
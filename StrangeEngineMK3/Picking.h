@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include "Geometry.h"
+#include "MeshImport.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		bounding volume hierarchies
+// ==============================================================
+//
+// built as a binary tree with the binned surface area heuristic, then collapsed so every node holds the boxes of up to
+// four children side by side and one SSE slab test covers them all. a mesh's leaves are packets of up to four
+// triangles, tested together with SSE the same way
+
+#define BVH_LEAF  0x80000000 // a child with this set is a leaf, the rest is the leaf's index
+#define BVH_EMPTY 0xFFFFFFFF // a child lane with nothing in it
+
+struct BvhNode
+{
+	float minX[4];
+	float minY[4];
+	float minZ[4];
+	float maxX[4];
+	float maxY[4];
+	float maxZ[4];
+	UINT  children[4]; // another node's index, BVH_LEAF | leaf, or BVH_EMPTY
+};
+
+struct PickHit
+{
+	float	 distance; // along the ray, in units of the direction's length
+	UINT	 instance; // PickScene only
+	UINT	 triangle; // the mesh's indices [triangle * 3] to [triangle * 3 + 2]
+	float	 u;		   // barycentrics, the hit is at v0 + (v1 - v0) * u + (v2 - v0) * v
+	float	 v;
+	XMFLOAT3 position; // world space from PickScene, the mesh's own from MeshBvh
+};
+
+// one mesh's triangles in a BVH, the mesh itself isn't needed once it is built
+class STRANGEENGINEMK3_API MeshBvh
+{
+public:
+	MeshBvh();
+
+	// big meshes split their top nodes across the job system, building many at once is PickScene::AddMeshes()
+	bool Build(const MeshVertex* vertices, UINT vertexCount, const UINT* indices, UINT indexCount);
+	bool Build(const MeshData& mesh) { return Build(mesh.vertices.data(), (UINT)mesh.vertices.size(), mesh.indices.data(), (UINT)mesh.indices.size()); }
+	void Clear();
+
+	// the closest triangle the ray hits within 'maxDistance', from either side
+	bool Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, PickHit* hit) const;
+
+	const Aabb& GetBounds() const { return mBounds; }
+	UINT		GetTriangleCount() const { return mTriangleCount; }
+	UINT		GetNodeCount() const { return (UINT)mNodes.size(); }
+	size_t		GetMemoryUsage() const { return mNodes.size() * sizeof(BvhNode) + mPackets.size() * sizeof(TrianglePacket); }
+
+private:
+	// a leaf's triangles as a corner and two edges each, the lanes past the last triangle have zero edges and never hit
+	struct TrianglePacket
+	{
+		float v0x[4];
+		float v0y[4];
+		float v0z[4];
+		float e1x[4];
+		float e1y[4];
+		float e1z[4];
+		float e2x[4];
+		float e2y[4];
+		float e2z[4];
+		UINT  triangles[4];
+	};
+
+	std::vector<BvhNode>		mNodes;	  // [0] is the root
+	std::vector<TrianglePacket> mPackets; // by leaf
+	Aabb						mBounds;
+	UINT						mTriangleCount;
+};
+
+
+// ==============================================================
+//		pick scene
+// ==============================================================
+
+// instances of meshes placed around the world, with a BVH over their world boxes on top of the meshes' own
+// what's under the mouse is Pick(GetMouseX(), GetMouseY(), ...). raycasts can run from any number of threads at once,
+// but not while meshes or instances are added, moved or removed, or during Update()
+class STRANGEENGINEMK3_API PickScene
+{
+public:
+	PickScene();
+
+	// builds every mesh's BVH at once across the job system, they get consecutive ids from the one returned. the
+	// meshes can go once it returns. a mesh that can't be built stays empty and is never hit
+	UINT AddMeshes(const MeshData* meshes, UINT count);
+	UINT AddMesh(const MeshData& mesh) { return AddMeshes(&mesh, 1); }
+	const MeshBvh& GetMesh(UINT mesh) const { return mMeshes[mesh]; }
+	UINT GetMeshCount() const { return (UINT)mMeshes.size(); }
+
+	// returns the instance's id, ids of removed instances are reused
+	UINT AddInstance(UINT mesh, const XMFLOAT4X4& world);
+	void SetTransform(UINT instance, const XMFLOAT4X4& world);
+	void RemoveInstance(UINT instance);
+	UINT GetInstanceCount() const { return mCount; }
+
+	// rebuilds the BVH over the instances if any were added, moved or removed since the last time, once a frame
+	// before picking. until then raycasts still see the old boxes
+	void Update();
+
+	// the closest instance triangle within 'maxDistance'
+	bool Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, PickHit* hit) const;
+
+	// the closest hit under a pixel of a width x height view, see MakePickRay()
+	bool Pick(int x, int y, UINT width, UINT height, const XMFLOAT4X4& viewProjection, PickHit* hit) const;
+
+private:
+	struct Instance
+	{
+		UINT	   mesh;
+		XMFLOAT4X4 world;
+		XMFLOAT4X4 inverse; // rays are moved into the mesh's space
+		Aabb	   bounds;	// world space
+		bool	   alive;
+	};
+
+	// up to four instances, from mInstanceOrder
+	struct Leaf
+	{
+		UINT first;
+		UINT count;
+	};
+
+	void SetWorld(Instance* instance, const XMFLOAT4X4& world);
+
+	std::vector<MeshBvh>  mMeshes;
+	std::vector<Instance> mInstances; // by id
+	std::vector<UINT>	  mFreeIds;
+	UINT				  mCount;
+	bool				  mDirty;
+	std::vector<BvhNode>  mNodes;
+	std::vector<Leaf>	  mLeaves;
+	std::vector<UINT>	  mInstanceOrder;
+};
@@ -0,0 +1,1620 @@
+#include "pch.h"
+#include "RenderCapture.h"
+#include "DDSTexture.h"
+#include "FileUtils.h"
+#include "Log.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+// what shader bytecode and input layout descs are kept under as private data
+static const GUID kRenderCaptureCodeGuid = { 0x6b1f3c52, 0x93d4, 0x4e0a, { 0x8f, 0x61, 0x2c, 0x7a, 0x15, 0xd9, 0x40, 0xbe } };
+
+template<typename T> static void SafeRelease(T*& object)
+{
+	if (object)
+	{
+		object->Release();
+		object = nullptr;
+	}
+}
+
+// one byte at the start of every command in a stream
+enum RenderCommand
+{
+	RenderCommand_ClearRenderTargetView,	// view, 4 floats
+	RenderCommand_ClearDepthStencilView,	// view, flags, depth, stencil (1 byte)
+	RenderCommand_OMSetRenderTargets,		// count, views, depth view
+	RenderCommand_RSSetViewports,			// count, D3D11_VIEWPORTs
+	RenderCommand_IASetInputLayout,			// layout
+	RenderCommand_IASetPrimitiveTopology,	// topology
+	RenderCommand_IASetVertexBuffers,		// start, count, then buffer, stride, offset for each
+	RenderCommand_IASetIndexBuffer,			// buffer, format, offset
+	RenderCommand_VSSetShader,				// shader
+	RenderCommand_VSSetConstantBuffers,		// start, count, objects
+	RenderCommand_VSSetShaderResources,		// "
+	RenderCommand_VSSetSamplers,			// "
+	RenderCommand_PSSetShader,				// shader
+	RenderCommand_PSSetConstantBuffers,		// start, count, objects
+	RenderCommand_PSSetShaderResources,		// "
+	RenderCommand_PSSetSamplers,			// "
+	RenderCommand_OMSetBlendState,			// state, 4 floats, sample mask
+	RenderCommand_OMSetDepthStencilState,	// state, stencil ref
+	RenderCommand_UpdateSubresource,		// resource, subresource, has box (1 byte), box if it has, row pitch, depth pitch, size, bytes
+	RenderCommand_Map,						// resource, subresource, map type, row pitch, size, bytes. replayed as map, copy, unmap
+	RenderCommand_Draw,						// vertex count, start vertex
+	RenderCommand_DrawIndexed,				// index count, start index, base vertex
+	RenderCommand_DrawInstanced,			// vertex count, instance count, start vertex, start instance
+	RenderCommand_DrawIndexedInstanced,		// index count, instance count, start index, base vertex, start instance
+	RenderCommand_Count
+};
+
+// the size of a 2D texture's subresource the way the capture stores it, rows tightly packed
+static bool GetSubresourceSize(const D3D11_TEXTURE2D_DESC& desc, UINT subresource, UINT* rowBytes, UINT* rows)
+{
+	UINT mip = subresource % std::max(desc.MipLevels, 1u);
+	return GetSurfaceInfo(desc.Format, std::max(desc.Width >> mip, 1u), std::max(desc.Height >> mip, 1u), rowBytes, rows);
+}
+
+
+// ==============================================================
+//		capture state
+// ==============================================================
+
+struct CapturedObject
+{
+	RenderCaptureObject entry; // the offsets are filled in when the file is written
+	std::vector<BYTE>	desc;
+	std::vector<BYTE>	data;
+};
+
+// a Map() that writes, its bytes are captured when it is unmapped
+struct CapturedMap
+{
+	ID3D11Resource*			 resource;
+	UINT					 subresource;
+	D3D11_MAP				 mapType;
+	D3D11_MAPPED_SUBRESOURCE mapped;
+};
+
+struct RenderCaptureState
+{
+	std::wstring								 path;
+	UINT										 framesLeft;
+	std::unordered_map<ID3D11DeviceChild*, UINT> ids;
+	// every captured object is held until the file is written, so none of them is freed and its address reused
+	std::vector<ID3D11DeviceChild*>				 held;
+	std::vector<CapturedObject>					 objects;
+	std::vector<RenderCaptureFrame>				 frames;
+	std::vector<BYTE>							 commands; // every frame's, one after the other
+	RenderCaptureFrame							 frame;	   // the one being captured
+	std::vector<CapturedMap>					 maps;
+	bool										 warned;   // about something that can't be captured, once is enough
+};
+
+template<typename T> static void Put(std::vector<BYTE>& out, const T& value)
+{
+	const BYTE* bytes = (const BYTE*)&value;
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void PutBytes(std::vector<BYTE>& out, const void* data, size_t size)
+{
+	const BYTE* bytes = (const BYTE*)data;
+	out.insert(out.end(), bytes, bytes + size);
+}
+
+static void PutCommand(RenderCaptureState* capture, RenderCommand command)
+{
+	capture->commands.push_back((BYTE)command);
+	capture->frame.commandCount++;
+}
+
+static bool ReadBackBuffer(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Buffer* buffer, const D3D11_BUFFER_DESC& desc, std::vector<BYTE>* data)
+{
+	D3D11_BUFFER_DESC stagingDesc;
+	stagingDesc.ByteWidth = desc.ByteWidth;
+	stagingDesc.Usage = D3D11_USAGE_STAGING;
+	stagingDesc.BindFlags = 0;
+	stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDesc.MiscFlags = 0;
+	stagingDesc.StructureByteStride = 0;
+
+	ID3D11Buffer* staging = nullptr;
+	HRESULT hr = device->CreateBuffer(&stagingDesc, nullptr, &staging);
+	if (FAILED(hr))
+		return false;
+
+	context->CopyResource(staging, buffer);
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	hr = context->Map(staging, 0, D3D11_MAP_READ, 0, &mapped);
+	if (SUCCEEDED(hr))
+	{
+		data->assign((const BYTE*)mapped.pData, (const BYTE*)mapped.pData + desc.ByteWidth);
+		context->Unmap(staging, 0);
+	}
+	staging->Release();
+	return SUCCEEDED(hr);
+}
+
+static bool ReadBackTexture(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Texture2D* texture, const D3D11_TEXTURE2D_DESC& desc, std::vector<BYTE>* data)
+{
+	D3D11_TEXTURE2D_DESC stagingDesc = desc;
+	stagingDesc.Usage = D3D11_USAGE_STAGING;
+	stagingDesc.BindFlags = 0;
+	stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDesc.MiscFlags = 0;
+
+	ID3D11Texture2D* staging = nullptr;
+	HRESULT hr = device->CreateTexture2D(&stagingDesc, nullptr, &staging);
+	if (FAILED(hr))
+		return false;
+
+	context->CopyResource(staging, texture);
+	UINT subresources = desc.MipLevels * desc.ArraySize;
+	for (UINT i = 0; i < subresources && SUCCEEDED(hr); i++)
+	{
+		UINT rowBytes, rows;
+		GetSubresourceSize(desc, i, &rowBytes, &rows);
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		hr = context->Map(staging, i, D3D11_MAP_READ, 0, &mapped);
+		if (FAILED(hr))
+			break;
+		// the driver's rows can be padded, the file's aren't
+		for (UINT row = 0; row < rows; row++)
+			PutBytes(*data, (const BYTE*)mapped.pData + (size_t)row * mapped.RowPitch, rowBytes);
+		context->Unmap(staging, i);
+	}
+	staging->Release();
+	return SUCCEEDED(hr);
+}
+
+template<typename Desc> static void PutDesc(std::vector<BYTE>* out, const Desc& desc)
+{
+	out->assign((const BYTE*)&desc, (const BYTE*)&desc + sizeof(Desc));
+}
+
+static void WarnOnce(RenderCaptureState* capture, const char* message)
+{
+	if (capture->warned)
+		return;
+	capture->warned = true;
+	LOG_WARNING(LogCategory_Render, "{}", message);
+}
+
+static UINT CaptureResource(RenderCaptureState* capture, ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Resource* resource);
+
+// the object's number, capturing it the first time it is seen. this is called before the call that uses it is passed
+// on, so what is read back is what the call saw
+static UINT CaptureObject(RenderCaptureState* capture, ID3D11Device* device, ID3D11DeviceContext* context, ID3D11DeviceChild* object, RenderObjectType type)
+{
+	if (!object)
+		return 0;
+	auto found = capture->ids.find(object);
+	if (found != capture->ids.end())
+		return found->second;
+
+	CapturedObject captured;
+	ZeroMemory(&captured.entry, sizeof(captured.entry));
+	captured.entry.type = type;
+
+	switch (type)
+	{
+	case RenderObject_Buffer:
+	{
+		ID3D11Buffer* buffer = static_cast<ID3D11Buffer*>(object);
+		D3D11_BUFFER_DESC desc;
+		buffer->GetDesc(&desc);
+		PutDesc(&captured.desc, desc);
+		if (desc.Usage != D3D11_USAGE_STAGING && !ReadBackBuffer(device, context, buffer, desc, &captured.data))
+			WarnOnce(capture, "A buffer couldn't be read back, it is replayed empty");
+		break;
+	}
+	case RenderObject_Texture2D:
+	{
+		ID3D11Texture2D* texture = static_cast<ID3D11Texture2D*>(object);
+		D3D11_TEXTURE2D_DESC desc;
+		texture->GetDesc(&desc);
+		PutDesc(&captured.desc, desc);
+
+		// render targets are drawn over every frame, and multisampled ones can't be copied out anyway
+		UINT rowBytes, rows;
+		bool rendered = (desc.BindFlags & (D3D11_BIND_RENDER_TARGET | D3D11_BIND_DEPTH_STENCIL)) != 0 || desc.SampleDesc.Count > 1;
+		if (!rendered && desc.Usage != D3D11_USAGE_STAGING)
+		{
+			if (!GetSubresourceSize(desc, 0, &rowBytes, &rows))
+				WarnOnce(capture, "A texture's format can't be read back, it is replayed empty");
+			else if (!ReadBackTexture(device, context, texture, desc, &captured.data))
+			{
+				captured.data.clear();
+				WarnOnce(capture, "A texture couldn't be read back, it is replayed empty");
+			}
+		}
+		break;
+	}
+	case RenderObject_ShaderResourceView:
+	case RenderObject_RenderTargetView:
+	case RenderObject_DepthStencilView:
+	{
+		// what it is a view of goes first, the replay makes objects in order
+		ID3D11View* view = static_cast<ID3D11View*>(object);
+		ID3D11Resource* resource = nullptr;
+		view->GetResource(&resource);
+		captured.entry.resource = CaptureResource(capture, device, context, resource);
+		SafeRelease(resource);
+		if (captured.entry.resource == 0)
+			return 0;
+
+		if (type == RenderObject_ShaderResourceView)
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+			static_cast<ID3D11ShaderResourceView*>(object)->GetDesc(&desc);
+			PutDesc(&captured.desc, desc);
+		}
+		else if (type == RenderObject_RenderTargetView)
+		{
+			D3D11_RENDER_TARGET_VIEW_DESC desc;
+			static_cast<ID3D11RenderTargetView*>(object)->GetDesc(&desc);
+			PutDesc(&captured.desc, desc);
+		}
+		else
+		{
+			D3D11_DEPTH_STENCIL_VIEW_DESC desc;
+			static_cast<ID3D11DepthStencilView*>(object)->GetDesc(&desc);
+			PutDesc(&captured.desc, desc);
+		}
+		break;
+	}
+	case RenderObject_VertexShader:
+	case RenderObject_PixelShader:
+	case RenderObject_InputLayout:
+	{
+		UINT size = 0;
+		if (FAILED(object->GetPrivateData(kRenderCaptureCodeGuid, &size, nullptr)) || size == 0)
+		{
+			WarnOnce(capture, "A shader or input layout has no bytecode registered with RenderContext, it is replayed as null");
+			break;
+		}
+		captured.desc.resize(size);
+		if (FAILED(object->GetPrivateData(kRenderCaptureCodeGuid, &size, captured.desc.data())))
+			captured.desc.clear();
+		break;
+	}
+	case RenderObject_SamplerState:
+	{
+		D3D11_SAMPLER_DESC desc;
+		static_cast<ID3D11SamplerState*>(object)->GetDesc(&desc);
+		PutDesc(&captured.desc, desc);
+		break;
+	}
+	case RenderObject_BlendState:
+	{
+		D3D11_BLEND_DESC desc;
+		static_cast<ID3D11BlendState*>(object)->GetDesc(&desc);
+		PutDesc(&captured.desc, desc);
+		break;
+	}
+	case RenderObject_DepthStencilState:
+	{
+		D3D11_DEPTH_STENCIL_DESC desc;
+		static_cast<ID3D11DepthStencilState*>(object)->GetDesc(&desc);
+		PutDesc(&captured.desc, desc);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	captured.entry.descSize = (UINT)captured.desc.size();
+	captured.entry.dataSize = captured.data.size();
+	capture->objects.push_back(std::move(captured));
+
+	UINT id = (UINT)capture->objects.size();
+	capture->ids[object] = id;
+	object->AddRef();
+	capture->held.push_back(object);
+	return id;
+}
+
+static UINT CaptureResource(RenderCaptureState* capture, ID3D11Device* device, ID3D11DeviceContext* context, ID3D11Resource* resource)
+{
+	if (!resource)
+		return 0;
+
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType(&dimension);
+	if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+		return CaptureObject(capture, device, context, resource, RenderObject_Buffer);
+	if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+		return CaptureObject(capture, device, context, resource, RenderObject_Texture2D);
+
+	WarnOnce(capture, "Only buffers and 2D textures can be captured, calls on anything else are replayed on null");
+	return 0;
+}
+
+static const CapturedObject* GetCaptured(RenderCaptureState* capture, UINT id)
+{
+	return id == 0 ? nullptr : &capture->objects[id - 1];
+}
+
+
+// ==============================================================
+//		RenderContext
+// ==============================================================
+
+RenderContext::RenderContext()
+{
+	mDevice = nullptr;
+	mContext = nullptr;
+	mCapture = nullptr;
+	mPendingFrames = 0;
+	mDrawCalls = 0;
+	mLastDrawCalls = 0;
+}
+
+RenderContext::~RenderContext()
+{
+	Release();
+}
+
+void RenderContext::Create(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	Release();
+	mDevice = device;
+	mContext = context;
+}
+
+void RenderContext::Release()
+{
+	if (mCapture)
+	{
+		// whatever frames it has are still worth something
+		if (!mCapture->frames.empty())
+			FinishCapture();
+		else
+		{
+			for (ID3D11DeviceChild* object : mCapture->held)
+				object->Release();
+			delete mCapture;
+			mCapture = nullptr;
+		}
+	}
+	mPendingFrames = 0;
+	mDevice = nullptr;
+	mContext = nullptr;
+}
+
+void RenderContext::RegisterShader(ID3D11DeviceChild* shader, const void* bytecode, size_t size)
+{
+	if (shader)
+		shader->SetPrivateData(kRenderCaptureCodeGuid, (UINT)size, bytecode);
+}
+
+void RenderContext::RegisterInputLayout(ID3D11InputLayout* layout, const D3D11_INPUT_ELEMENT_DESC* elements, UINT count, const void* bytecode, size_t size)
+{
+	if (!layout)
+		return;
+
+	// already in the file's layout, a capture copies it as it is
+	std::vector<BYTE> desc;
+	RenderCaptureLayout header = { count, (UINT)size };
+	Put(desc, header);
+
+	std::vector<BYTE> names;
+	for (UINT i = 0; i < count; i++)
+	{
+		RenderCaptureElement element;
+		element.nameOffset = (UINT)names.size();
+		element.semanticIndex = elements[i].SemanticIndex;
+		element.format = elements[i].Format;
+		element.inputSlot = elements[i].InputSlot;
+		element.alignedByteOffset = elements[i].AlignedByteOffset;
+		element.inputSlotClass = elements[i].InputSlotClass;
+		element.instanceDataStepRate = elements[i].InstanceDataStepRate;
+		Put(desc, element);
+		PutBytes(names, elements[i].SemanticName, strlen(elements[i].SemanticName) + 1);
+	}
+	PutBytes(desc, bytecode, size);
+	PutBytes(desc, names.data(), names.size());
+	layout->SetPrivateData(kRenderCaptureCodeGuid, (UINT)desc.size(), desc.data());
+}
+
+bool RenderContext::StartCapture(const std::wstring& path, UINT frames)
+{
+	if (!mContext || frames == 0)
+	{
+		ReportError(LogCategory_Render, "There is nothing to capture frames from");
+		return false;
+	}
+	if (mCapture)
+	{
+		ReportError(LogCategory_Render, "A capture is already running");
+		return false;
+	}
+
+	// it starts with the next frame, a frame is never captured from the middle
+	mPendingPath = path;
+	mPendingFrames = frames;
+	return true;
+}
+
+void RenderContext::BeginFrame()
+{
+	mDrawCalls = 0;
+	if (!mCapture && mPendingFrames > 0)
+	{
+		mCapture = new RenderCaptureState();
+		mCapture->path = mPendingPath;
+		mCapture->framesLeft = mPendingFrames;
+		mCapture->warned = false;
+		mPendingFrames = 0;
+		LOG_INFO(LogCategory_Render, "capturing {} frames to {}", mCapture->framesLeft, mCapture->path);
+	}
+	if (!mCapture)
+		return;
+
+	ZeroMemory(&mCapture->frame, sizeof(mCapture->frame));
+	mCapture->frame.commandsOffset = mCapture->commands.size();
+	CaptureFrameState();
+}
+
+void RenderContext::EndFrame()
+{
+	mLastDrawCalls = mDrawCalls;
+	if (!mCapture)
+		return;
+
+	mCapture->frame.commandsSize = mCapture->commands.size() - mCapture->frame.commandsOffset;
+	mCapture->frames.push_back(mCapture->frame);
+	if (--mCapture->framesLeft == 0)
+		FinishCapture();
+}
+
+void RenderContext::CaptureFrameState()
+{
+	ID3D11RenderTargetView* views[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	ID3D11DepthStencilView* depthView = nullptr;
+	mContext->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, views, &depthView);
+
+	UINT count = 0;
+	UINT ids[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+	for (UINT i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; i++)
+	{
+		ids[i] = CaptureObject(mCapture, mDevice, mContext, views[i], RenderObject_RenderTargetView);
+		if (views[i])
+			count = i + 1;
+		// OMGetRenderTargets adds a reference to each
+		SafeRelease(views[i]);
+	}
+	UINT depthId = CaptureObject(mCapture, mDevice, mContext, depthView, RenderObject_DepthStencilView);
+	SafeRelease(depthView);
+
+	PutCommand(mCapture, RenderCommand_OMSetRenderTargets);
+	Put(mCapture->commands, count);
+	PutBytes(mCapture->commands, ids, count * sizeof(UINT));
+	Put(mCapture->commands, depthId);
+
+	D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+	UINT viewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+	mContext->RSGetViewports(&viewportCount, viewports);
+	PutCommand(mCapture, RenderCommand_RSSetViewports);
+	Put(mCapture->commands, viewportCount);
+	PutBytes(mCapture->commands, viewports, viewportCount * sizeof(D3D11_VIEWPORT));
+}
+
+void RenderContext::FinishCapture()
+{
+	RenderCaptureState* capture = mCapture;
+	mCapture = nullptr;
+
+	// header | objects | descs and contents | frames | commands
+	RenderCaptureHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.magic = RENDER_CAPTURE_MAGIC;
+	header.version = RENDER_CAPTURE_VERSION;
+	header.objectCount = (UINT)capture->objects.size();
+	header.frameCount = (UINT)capture->frames.size();
+	header.objectsOffset = sizeof(RenderCaptureHeader);
+
+	// every blob starts on 16 bytes, the replay hands texture contents straight to the device
+	UINT64 offset = header.objectsOffset + capture->objects.size() * sizeof(RenderCaptureObject);
+	for (CapturedObject& object : capture->objects)
+	{
+		offset = (offset + 15) & ~15ull;
+		object.entry.descOffset = offset;
+		offset += object.desc.size();
+		offset = (offset + 15) & ~15ull;
+		object.entry.dataOffset = offset;
+		offset += object.data.size();
+	}
+	header.framesOffset = (offset + 15) & ~15ull;
+	UINT64 commandsOffset = header.framesOffset + capture->frames.size() * sizeof(RenderCaptureFrame);
+	for (RenderCaptureFrame& frame : capture->frames)
+		frame.commandsOffset += commandsOffset;
+	header.fileSize = commandsOffset + capture->commands.size();
+
+	std::vector<BYTE> file((size_t)header.fileSize, 0);
+	memcpy(file.data(), &header, sizeof(header));
+	for (size_t i = 0; i < capture->objects.size(); i++)
+	{
+		const CapturedObject& object = capture->objects[i];
+		memcpy(file.data() + header.objectsOffset + i * sizeof(RenderCaptureObject), &object.entry, sizeof(RenderCaptureObject));
+		if (!object.desc.empty())
+			memcpy(file.data() + object.entry.descOffset, object.desc.data(), object.desc.size());
+		if (!object.data.empty())
+			memcpy(file.data() + object.entry.dataOffset, object.data.data(), object.data.size());
+	}
+	if (!capture->frames.empty())
+		memcpy(file.data() + header.framesOffset, capture->frames.data(), capture->frames.size() * sizeof(RenderCaptureFrame));
+	if (!capture->commands.empty())
+		memcpy(file.data() + commandsOffset, capture->commands.data(), capture->commands.size());
+
+	for (ID3D11DeviceChild* object : capture->held)
+		object->Release();
+
+	HANDLE handle = CreateFile(capture->path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Render, "Could not create {}", capture->path);
+		delete capture;
+		return;
+	}
+
+	bool ok = WriteFileBytes(handle, file.data(), file.size());
+	CloseHandle(handle);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Render, "Could not write render capture {}", capture->path);
+		DeleteFileW(capture->path.c_str());
+	}
+	else
+	{
+		LOG_INFO(LogCategory_Render, "captured {} frames, {} objects, {} KB to {}", header.frameCount, header.objectCount,
+			header.fileSize / 1024, capture->path);
+	}
+	delete capture;
+}
+
+void RenderContext::ClearRenderTargetView(ID3D11RenderTargetView* view, const FLOAT color[4])
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, view, RenderObject_RenderTargetView);
+		PutCommand(mCapture, RenderCommand_ClearRenderTargetView);
+		Put(mCapture->commands, id);
+		PutBytes(mCapture->commands, color, 4 * sizeof(FLOAT));
+	}
+	mContext->ClearRenderTargetView(view, color);
+}
+
+void RenderContext::ClearDepthStencilView(ID3D11DepthStencilView* view, UINT flags, FLOAT depth, UINT8 stencil)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, view, RenderObject_DepthStencilView);
+		PutCommand(mCapture, RenderCommand_ClearDepthStencilView);
+		Put(mCapture->commands, id);
+		Put(mCapture->commands, flags);
+		Put(mCapture->commands, depth);
+		Put(mCapture->commands, stencil);
+	}
+	mContext->ClearDepthStencilView(view, flags, depth, stencil);
+}
+
+void RenderContext::OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView)
+{
+	if (mCapture)
+	{
+		std::vector<UINT> ids(count);
+		for (UINT i = 0; i < count; i++)
+			ids[i] = CaptureObject(mCapture, mDevice, mContext, views[i], RenderObject_RenderTargetView);
+		UINT depthId = CaptureObject(mCapture, mDevice, mContext, depthView, RenderObject_DepthStencilView);
+		PutCommand(mCapture, RenderCommand_OMSetRenderTargets);
+		Put(mCapture->commands, count);
+		PutBytes(mCapture->commands, ids.data(), count * sizeof(UINT));
+		Put(mCapture->commands, depthId);
+	}
+	mContext->OMSetRenderTargets(count, views, depthView);
+}
+
+void RenderContext::RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_RSSetViewports);
+		Put(mCapture->commands, count);
+		PutBytes(mCapture->commands, viewports, count * sizeof(D3D11_VIEWPORT));
+	}
+	mContext->RSSetViewports(count, viewports);
+}
+
+void RenderContext::IASetInputLayout(ID3D11InputLayout* layout)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, layout, RenderObject_InputLayout);
+		PutCommand(mCapture, RenderCommand_IASetInputLayout);
+		Put(mCapture->commands, id);
+	}
+	mContext->IASetInputLayout(layout);
+}
+
+void RenderContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_IASetPrimitiveTopology);
+		Put(mCapture->commands, (UINT)topology);
+	}
+	mContext->IASetPrimitiveTopology(topology);
+}
+
+void RenderContext::IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	if (mCapture)
+	{
+		std::vector<UINT> ids(count);
+		for (UINT i = 0; i < count; i++)
+			ids[i] = CaptureObject(mCapture, mDevice, mContext, buffers[i], RenderObject_Buffer);
+		PutCommand(mCapture, RenderCommand_IASetVertexBuffers);
+		Put(mCapture->commands, startSlot);
+		Put(mCapture->commands, count);
+		for (UINT i = 0; i < count; i++)
+		{
+			Put(mCapture->commands, ids[i]);
+			Put(mCapture->commands, strides[i]);
+			Put(mCapture->commands, offsets[i]);
+		}
+	}
+	mContext->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+}
+
+void RenderContext::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, buffer, RenderObject_Buffer);
+		PutCommand(mCapture, RenderCommand_IASetIndexBuffer);
+		Put(mCapture->commands, id);
+		Put(mCapture->commands, (UINT)format);
+		Put(mCapture->commands, offset);
+	}
+	mContext->IASetIndexBuffer(buffer, format, offset);
+}
+
+// the Set*s that take a run of slots all look the same in a stream
+static void PutSlots(RenderCaptureState* capture, ID3D11Device* device, ID3D11DeviceContext* context, RenderCommand command,
+	UINT startSlot, UINT count, ID3D11DeviceChild* const* objects, RenderObjectType type)
+{
+	std::vector<UINT> ids(count);
+	for (UINT i = 0; i < count; i++)
+		ids[i] = CaptureObject(capture, device, context, objects[i], type);
+	PutCommand(capture, command);
+	Put(capture->commands, startSlot);
+	Put(capture->commands, count);
+	PutBytes(capture->commands, ids.data(), count * sizeof(UINT));
+}
+
+void RenderContext::VSSetShader(ID3D11VertexShader* shader)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, shader, RenderObject_VertexShader);
+		PutCommand(mCapture, RenderCommand_VSSetShader);
+		Put(mCapture->commands, id);
+	}
+	mContext->VSSetShader(shader, nullptr, 0);
+}
+
+void RenderContext::VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_VSSetConstantBuffers, startSlot, count, (ID3D11DeviceChild* const*)buffers, RenderObject_Buffer);
+	mContext->VSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void RenderContext::VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_VSSetShaderResources, startSlot, count, (ID3D11DeviceChild* const*)views, RenderObject_ShaderResourceView);
+	mContext->VSSetShaderResources(startSlot, count, views);
+}
+
+void RenderContext::VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_VSSetSamplers, startSlot, count, (ID3D11DeviceChild* const*)samplers, RenderObject_SamplerState);
+	mContext->VSSetSamplers(startSlot, count, samplers);
+}
+
+void RenderContext::PSSetShader(ID3D11PixelShader* shader)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, shader, RenderObject_PixelShader);
+		PutCommand(mCapture, RenderCommand_PSSetShader);
+		Put(mCapture->commands, id);
+	}
+	mContext->PSSetShader(shader, nullptr, 0);
+}
+
+void RenderContext::PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_PSSetConstantBuffers, startSlot, count, (ID3D11DeviceChild* const*)buffers, RenderObject_Buffer);
+	mContext->PSSetConstantBuffers(startSlot, count, buffers);
+}
+
+void RenderContext::PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_PSSetShaderResources, startSlot, count, (ID3D11DeviceChild* const*)views, RenderObject_ShaderResourceView);
+	mContext->PSSetShaderResources(startSlot, count, views);
+}
+
+void RenderContext::PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	if (mCapture)
+		PutSlots(mCapture, mDevice, mContext, RenderCommand_PSSetSamplers, startSlot, count, (ID3D11DeviceChild* const*)samplers, RenderObject_SamplerState);
+	mContext->PSSetSamplers(startSlot, count, samplers);
+}
+
+void RenderContext::OMSetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask)
+{
+	if (mCapture)
+	{
+		// a null factor is the same as all ones
+		static const FLOAT kOnes[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		UINT id = CaptureObject(mCapture, mDevice, mContext, state, RenderObject_BlendState);
+		PutCommand(mCapture, RenderCommand_OMSetBlendState);
+		Put(mCapture->commands, id);
+		PutBytes(mCapture->commands, blendFactor ? blendFactor : kOnes, 4 * sizeof(FLOAT));
+		Put(mCapture->commands, sampleMask);
+	}
+	mContext->OMSetBlendState(state, blendFactor, sampleMask);
+}
+
+void RenderContext::OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureObject(mCapture, mDevice, mContext, state, RenderObject_DepthStencilState);
+		PutCommand(mCapture, RenderCommand_OMSetDepthStencilState);
+		Put(mCapture->commands, id);
+		Put(mCapture->commands, stencilRef);
+	}
+	mContext->OMSetDepthStencilState(state, stencilRef);
+}
+
+void RenderContext::UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch)
+{
+	if (mCapture)
+	{
+		UINT id = CaptureResource(mCapture, mDevice, mContext, resource);
+		const CapturedObject* captured = GetCaptured(mCapture, id);
+
+		// how many bytes the call reads from 'data'
+		UINT size = 0;
+		if (captured && captured->entry.type == RenderObject_Buffer)
+		{
+			const D3D11_BUFFER_DESC* desc = (const D3D11_BUFFER_DESC*)captured->desc.data();
+			size = box ? box->right - box->left : desc->ByteWidth;
+		}
+		else if (captured)
+		{
+			const D3D11_TEXTURE2D_DESC* desc = (const D3D11_TEXTURE2D_DESC*)captured->desc.data();
+			UINT mip = subresource % std::max(desc->MipLevels, 1u);
+			UINT width = box ? box->right - box->left : std::max(desc->Width >> mip, 1u);
+			UINT height = box ? box->bottom - box->top : std::max(desc->Height >> mip, 1u);
+			UINT rowBytes, rows;
+			if (GetSurfaceInfo(desc->Format, width, height, &rowBytes, &rows) && rows > 0)
+				size = rowPitch * (rows - 1) + rowBytes;
+			else
+				WarnOnce(mCapture, "A texture update's format can't be captured, it is replayed without its bytes");
+		}
+
+		PutCommand(mCapture, RenderCommand_UpdateSubresource);
+		Put(mCapture->commands, id);
+		Put(mCapture->commands, subresource);
+		Put(mCapture->commands, (BYTE)(box != nullptr));
+		if (box)
+			Put(mCapture->commands, *box);
+		Put(mCapture->commands, rowPitch);
+		Put(mCapture->commands, depthPitch);
+		Put(mCapture->commands, size);
+		PutBytes(mCapture->commands, data, size);
+	}
+	mContext->UpdateSubresource(resource, subresource, box, data, rowPitch, depthPitch);
+}
+
+HRESULT RenderContext::Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped)
+{
+	// read first, a discard mustn't lose what the replay starts with
+	if (mCapture && mapType != D3D11_MAP_READ)
+		CaptureResource(mCapture, mDevice, mContext, resource);
+
+	HRESULT hr = mContext->Map(resource, subresource, mapType, flags, mapped);
+	if (mCapture && mapType != D3D11_MAP_READ && SUCCEEDED(hr))
+		mCapture->maps.push_back({ resource, subresource, mapType, *mapped });
+	return hr;
+}
+
+void RenderContext::Unmap(ID3D11Resource* resource, UINT subresource, UINT writtenBytes)
+{
+	if (mCapture)
+	{
+		auto found = std::find_if(mCapture->maps.begin(), mCapture->maps.end(), [resource, subresource](const CapturedMap& map)
+		{
+			return map.resource == resource && map.subresource == subresource;
+		});
+		if (found != mCapture->maps.end())
+		{
+			UINT id = CaptureResource(mCapture, mDevice, mContext, resource);
+			const CapturedObject* captured = GetCaptured(mCapture, id);
+
+			UINT size = writtenBytes;
+			if (captured && captured->entry.type == RenderObject_Buffer)
+			{
+				const D3D11_BUFFER_DESC* desc = (const D3D11_BUFFER_DESC*)captured->desc.data();
+				size = size ? std::min(size, desc->ByteWidth) : desc->ByteWidth;
+			}
+			else if (captured && size == 0)
+			{
+				UINT rowBytes, rows;
+				const D3D11_TEXTURE2D_DESC* desc = (const D3D11_TEXTURE2D_DESC*)captured->desc.data();
+				if (GetSubresourceSize(*desc, subresource, &rowBytes, &rows))
+					size = found->mapped.RowPitch * rows;
+			}
+
+			// this reads back the mapped memory, which is slow (write combined), but only while capturing
+			PutCommand(mCapture, RenderCommand_Map);
+			Put(mCapture->commands, id);
+			Put(mCapture->commands, subresource);
+			Put(mCapture->commands, (UINT)found->mapType);
+			Put(mCapture->commands, captured && captured->entry.type == RenderObject_Buffer ? 0u : found->mapped.RowPitch);
+			Put(mCapture->commands, size);
+			PutBytes(mCapture->commands, found->mapped.pData, size);
+			mCapture->maps.erase(found);
+		}
+	}
+	mContext->Unmap(resource, subresource);
+}
+
+void RenderContext::Draw(UINT vertexCount, UINT startVertex)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_Draw);
+		Put(mCapture->commands, vertexCount);
+		Put(mCapture->commands, startVertex);
+		mCapture->frame.drawCount++;
+	}
+	mDrawCalls++;
+	mContext->Draw(vertexCount, startVertex);
+}
+
+void RenderContext::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_DrawIndexed);
+		Put(mCapture->commands, indexCount);
+		Put(mCapture->commands, startIndex);
+		Put(mCapture->commands, baseVertex);
+		mCapture->frame.drawCount++;
+	}
+	mDrawCalls++;
+	mContext->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void RenderContext::DrawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_DrawInstanced);
+		Put(mCapture->commands, vertexCount);
+		Put(mCapture->commands, instanceCount);
+		Put(mCapture->commands, startVertex);
+		Put(mCapture->commands, startInstance);
+		mCapture->frame.drawCount++;
+	}
+	mDrawCalls++;
+	mContext->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+}
+
+void RenderContext::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	if (mCapture)
+	{
+		PutCommand(mCapture, RenderCommand_DrawIndexedInstanced);
+		Put(mCapture->commands, indexCount);
+		Put(mCapture->commands, instanceCount);
+		Put(mCapture->commands, startIndex);
+		Put(mCapture->commands, baseVertex);
+		Put(mCapture->commands, startInstance);
+		mCapture->frame.drawCount++;
+	}
+	mDrawCalls++;
+	mContext->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+
+// ==============================================================
+//		RenderReplay
+// ==============================================================
+
+// reads a command's arguments, any read past the end of the frame's stream fails the frame
+struct CommandReader
+{
+	const BYTE* at;
+	const BYTE* end;
+	bool		ok;
+
+	template<typename T> T Get()
+	{
+		T value;
+		if (end - at < (ptrdiff_t)sizeof(T))
+		{
+			ok = false;
+			ZeroMemory(&value, sizeof(T));
+			return value;
+		}
+		memcpy(&value, at, sizeof(T));
+		at += sizeof(T);
+		return value;
+	}
+
+	const BYTE* GetBytes(size_t size)
+	{
+		if ((size_t)(end - at) < size)
+		{
+			ok = false;
+			return nullptr;
+		}
+		const BYTE* bytes = at;
+		at += size;
+		return bytes;
+	}
+};
+
+// the size of what a replayed UpdateSubresource or Map writes into, from the object the replay made rather than the
+// capture, so a corrupt capture can't make it write past the end. a buffer is one row of ByteWidth bytes
+struct ReplayTarget
+{
+	DXGI_FORMAT format; // DXGI_FORMAT_UNKNOWN for buffers
+	UINT		width;
+	UINT		height;
+	UINT		rowBytes;
+	UINT		rows;
+};
+
+static bool GetReplayTarget(ID3D11Resource* resource, UINT subresource, ReplayTarget* target)
+{
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType(&dimension);
+	if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		D3D11_BUFFER_DESC desc;
+		static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+		target->format = DXGI_FORMAT_UNKNOWN;
+		target->width = target->rowBytes = desc.ByteWidth;
+		target->height = target->rows = 1;
+		return subresource == 0;
+	}
+	if (dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+	UINT mips = std::max(desc.MipLevels, 1u);
+	if (subresource >= mips * std::max(desc.ArraySize, 1u))
+		return false;
+	UINT mip = subresource % mips;
+	target->format = desc.Format;
+	target->width = std::max(desc.Width >> mip, 1u);
+	target->height = std::max(desc.Height >> mip, 1u);
+	return GetSurfaceInfo(desc.Format, target->width, target->height, &target->rowBytes, &target->rows);
+}
+
+// whether 'size' bytes at 'rowPitch' cover everything UpdateSubresource reads for the box, and the box is inside
+static bool UpdateFits(const ReplayTarget& target, const D3D11_BOX* box, UINT rowPitch, UINT size)
+{
+	if (box && (box->left >= box->right || box->right > target.width || box->top >= box->bottom || box->bottom > target.height ||
+		box->back - box->front != 1))
+	{
+		return false;
+	}
+	if (target.format == DXGI_FORMAT_UNKNOWN)
+		return size >= (box ? box->right - box->left : target.width);
+
+	UINT rowBytes = target.rowBytes;
+	UINT rows = target.rows;
+	if (box && !GetSurfaceInfo(target.format, box->right - box->left, box->bottom - box->top, &rowBytes, &rows))
+		return false;
+	return rows > 0 && (rows == 1 || rowPitch >= rowBytes) && size >= (UINT64)rowPitch * (rows - 1) + rowBytes;
+}
+
+RenderReplay::RenderReplay()
+{
+}
+
+RenderReplay::~RenderReplay()
+{
+	ReleaseObjects();
+}
+
+bool RenderReplay::Load(const std::wstring& path)
+{
+	ReleaseObjects();
+	mFile.clear();
+	mObjects.clear();
+	mFrames.clear();
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Render, "Could not open render capture {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	const BYTE* data = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(RenderCaptureHeader))
+	{
+		mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+			data = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	// a copy, the commands are replayed over and over and shouldn't fault pages in while they are timed
+	if (data)
+		mFile.assign(data, data + fileSize.QuadPart);
+
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+
+	if (mFile.empty())
+	{
+		ReportError(LogCategory_Render, "Could not map render capture {}", path);
+		return false;
+	}
+
+	// everything is checked here, ReplayFrame() only has to check the commands
+	RenderCaptureHeader header;
+	memcpy(&header, mFile.data(), sizeof(header));
+	UINT64 size = mFile.size();
+	bool valid = header.magic == RENDER_CAPTURE_MAGIC && header.version == RENDER_CAPTURE_VERSION && header.fileSize == size &&
+		header.objectsOffset <= size && (size - header.objectsOffset) / sizeof(RenderCaptureObject) >= header.objectCount &&
+		header.framesOffset <= size && (size - header.framesOffset) / sizeof(RenderCaptureFrame) >= header.frameCount;
+	if (valid)
+	{
+		mObjects.resize(header.objectCount);
+		if (header.objectCount)
+			memcpy(mObjects.data(), mFile.data() + header.objectsOffset, header.objectCount * sizeof(RenderCaptureObject));
+		mFrames.resize(header.frameCount);
+		if (header.frameCount)
+			memcpy(mFrames.data(), mFile.data() + header.framesOffset, header.frameCount * sizeof(RenderCaptureFrame));
+	}
+	for (UINT i = 0; valid && i < mObjects.size(); i++)
+	{
+		const RenderCaptureObject& object = mObjects[i];
+		valid = object.type < RenderObject_Count && object.resource <= i &&
+			object.descOffset <= size && object.descSize <= size - object.descOffset &&
+			object.dataOffset <= size && object.dataSize <= size - object.dataOffset;
+	}
+	for (UINT i = 0; valid && i < mFrames.size(); i++)
+		valid = mFrames[i].commandsOffset <= size && mFrames[i].commandsSize <= size - mFrames[i].commandsOffset;
+
+	if (!valid)
+	{
+		ReportError(LogCategory_Render, "{} isn't a render capture this version can replay", path);
+		mFile.clear();
+		mObjects.clear();
+		mFrames.clear();
+		return false;
+	}
+	return true;
+}
+
+bool RenderReplay::CreateObjects(ID3D11Device* device)
+{
+	ReleaseObjects();
+	mCreated.assign(mObjects.size() + 1, nullptr);
+	if (!device)
+		return true;
+
+	for (UINT i = 0; i < mObjects.size(); i++)
+	{
+		if (!CreateObject(device, i))
+		{
+			ReleaseObjects();
+			return false;
+		}
+	}
+	return true;
+}
+
+void RenderReplay::ReleaseObjects()
+{
+	for (ID3D11DeviceChild*& object : mCreated)
+		SafeRelease(object);
+	mCreated.clear();
+}
+
+bool RenderReplay::CreateObject(ID3D11Device* device, UINT index)
+{
+	const RenderCaptureObject& object = mObjects[index];
+	const BYTE* desc = mFile.data() + object.descOffset;
+	const BYTE* data = object.dataSize ? mFile.data() + object.dataOffset : nullptr;
+	ID3D11DeviceChild** created = &mCreated[index + 1];
+
+	// a view's resource has a lower number, it was made already
+	const RenderCaptureObject* viewed = object.resource ? &mObjects[object.resource - 1] : nullptr;
+	ID3D11Resource* resource = object.resource ? static_cast<ID3D11Resource*>(mCreated[object.resource]) : nullptr;
+	bool viewable = resource && (viewed->type == RenderObject_Buffer || viewed->type == RenderObject_Texture2D);
+
+	HRESULT hr = E_FAIL;
+	switch (object.type)
+	{
+	case RenderObject_Buffer:
+	{
+		if (object.descSize != sizeof(D3D11_BUFFER_DESC))
+			break;
+		D3D11_BUFFER_DESC bufferDesc;
+		memcpy(&bufferDesc, desc, sizeof(bufferDesc));
+		D3D11_SUBRESOURCE_DATA initial = { data, 0, 0 };
+		bool hasData = data && object.dataSize == bufferDesc.ByteWidth;
+		if (!hasData && bufferDesc.Usage == D3D11_USAGE_IMMUTABLE)
+			bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		hr = device->CreateBuffer(&bufferDesc, hasData ? &initial : nullptr, (ID3D11Buffer**)created);
+		break;
+	}
+	case RenderObject_Texture2D:
+	{
+		if (object.descSize != sizeof(D3D11_TEXTURE2D_DESC))
+			break;
+		D3D11_TEXTURE2D_DESC textureDesc;
+		memcpy(&textureDesc, desc, sizeof(textureDesc));
+		// a swap chain's back buffer comes back as a plain render target
+		textureDesc.MiscFlags &= ~(UINT)(D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_GDI_COMPATIBLE);
+
+		std::vector<D3D11_SUBRESOURCE_DATA> initial;
+		UINT64 used = 0;
+		for (UINT i = 0; data && i < textureDesc.MipLevels * textureDesc.ArraySize; i++)
+		{
+			UINT rowBytes, rows;
+			if (!GetSubresourceSize(textureDesc, i, &rowBytes, &rows) || used + (UINT64)rowBytes * rows > object.dataSize)
+				break;
+			initial.push_back({ data + used, rowBytes, rowBytes * rows });
+			used += (UINT64)rowBytes * rows;
+		}
+		bool hasData = used == object.dataSize && initial.size() == textureDesc.MipLevels * textureDesc.ArraySize;
+		if (!hasData && textureDesc.Usage == D3D11_USAGE_IMMUTABLE)
+			textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		hr = device->CreateTexture2D(&textureDesc, hasData ? initial.data() : nullptr, (ID3D11Texture2D**)created);
+		break;
+	}
+	case RenderObject_ShaderResourceView:
+		if (viewable && object.descSize == sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC))
+			hr = device->CreateShaderResourceView(resource, (const D3D11_SHADER_RESOURCE_VIEW_DESC*)desc, (ID3D11ShaderResourceView**)created);
+		break;
+	case RenderObject_RenderTargetView:
+		if (viewable && object.descSize == sizeof(D3D11_RENDER_TARGET_VIEW_DESC))
+			hr = device->CreateRenderTargetView(resource, (const D3D11_RENDER_TARGET_VIEW_DESC*)desc, (ID3D11RenderTargetView**)created);
+		break;
+	case RenderObject_DepthStencilView:
+		if (viewable && object.descSize == sizeof(D3D11_DEPTH_STENCIL_VIEW_DESC))
+			hr = device->CreateDepthStencilView(resource, (const D3D11_DEPTH_STENCIL_VIEW_DESC*)desc, (ID3D11DepthStencilView**)created);
+		break;
+	case RenderObject_VertexShader:
+		hr = object.descSize == 0 ? S_OK : device->CreateVertexShader(desc, object.descSize, nullptr, (ID3D11VertexShader**)created);
+		break;
+	case RenderObject_PixelShader:
+		hr = object.descSize == 0 ? S_OK : device->CreatePixelShader(desc, object.descSize, nullptr, (ID3D11PixelShader**)created);
+		break;
+	case RenderObject_InputLayout:
+	{
+		if (object.descSize == 0)
+		{
+			hr = S_OK;
+			break;
+		}
+		RenderCaptureLayout layout;
+		if (object.descSize < sizeof(layout))
+			break;
+		memcpy(&layout, desc, sizeof(layout));
+		UINT64 namesStart = sizeof(layout) + (UINT64)layout.elementCount * sizeof(RenderCaptureElement) + layout.codeSize;
+		if (namesStart > object.descSize)
+			break;
+		const char* names = (const char*)desc + namesStart;
+		UINT namesSize = object.descSize - (UINT)namesStart;
+
+		std::vector<D3D11_INPUT_ELEMENT_DESC> elements(layout.elementCount);
+		bool valid = true;
+		for (UINT i = 0; i < layout.elementCount && valid; i++)
+		{
+			RenderCaptureElement element;
+			memcpy(&element, desc + sizeof(layout) + i * sizeof(element), sizeof(element));
+			// the name has to end inside the desc
+			valid = element.nameOffset < namesSize && memchr(names + element.nameOffset, 0, namesSize - element.nameOffset) != nullptr;
+			elements[i].SemanticName = names + element.nameOffset;
+			elements[i].SemanticIndex = element.semanticIndex;
+			elements[i].Format = (DXGI_FORMAT)element.format;
+			elements[i].InputSlot = element.inputSlot;
+			elements[i].AlignedByteOffset = element.alignedByteOffset;
+			elements[i].InputSlotClass = (D3D11_INPUT_CLASSIFICATION)element.inputSlotClass;
+			elements[i].InstanceDataStepRate = element.instanceDataStepRate;
+		}
+		if (valid)
+		{
+			const BYTE* code = desc + sizeof(layout) + layout.elementCount * sizeof(RenderCaptureElement);
+			hr = device->CreateInputLayout(elements.data(), layout.elementCount, code, layout.codeSize, (ID3D11InputLayout**)created);
+		}
+		break;
+	}
+	case RenderObject_SamplerState:
+		if (object.descSize == sizeof(D3D11_SAMPLER_DESC))
+			hr = device->CreateSamplerState((const D3D11_SAMPLER_DESC*)desc, (ID3D11SamplerState**)created);
+		break;
+	case RenderObject_BlendState:
+		if (object.descSize == sizeof(D3D11_BLEND_DESC))
+			hr = device->CreateBlendState((const D3D11_BLEND_DESC*)desc, (ID3D11BlendState**)created);
+		break;
+	case RenderObject_DepthStencilState:
+		if (object.descSize == sizeof(D3D11_DEPTH_STENCIL_DESC))
+			hr = device->CreateDepthStencilState((const D3D11_DEPTH_STENCIL_DESC*)desc, (ID3D11DepthStencilState**)created);
+		break;
+	}
+
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not make object {} of the render capture", index + 1);
+		return false;
+	}
+	return true;
+}
+
+bool RenderReplay::ReplayFrame(UINT frame, ID3D11DeviceContext* context, RenderReplayStats* stats)
+{
+	if (frame >= mFrames.size() || mCreated.empty())
+		return false;
+
+	const RenderCaptureFrame& captured = mFrames[frame];
+	CommandReader reader = { mFile.data() + captured.commandsOffset, mFile.data() + captured.commandsOffset + captured.commandsSize, true };
+	RenderReplayStats counted = {};
+
+	// an object by number, checked against the type the command wants. a wrong one fails the frame rather than
+	// handing D3D the wrong interface
+	auto object = [this, &reader](RenderObjectType type) -> ID3D11DeviceChild*
+	{
+		UINT id = reader.Get<UINT>();
+		if (id == 0)
+			return nullptr;
+		if (id > mObjects.size() || mObjects[id - 1].type != (UINT)type)
+		{
+			reader.ok = false;
+			return nullptr;
+		}
+		return mCreated[id];
+	};
+	// UpdateSubresource and Map take either kind
+	auto resource = [this, &reader]() -> ID3D11Resource*
+	{
+		UINT id = reader.Get<UINT>();
+		if (id == 0)
+			return nullptr;
+		if (id > mObjects.size() || (mObjects[id - 1].type != RenderObject_Buffer && mObjects[id - 1].type != RenderObject_Texture2D))
+		{
+			reader.ok = false;
+			return nullptr;
+		}
+		return static_cast<ID3D11Resource*>(mCreated[id]);
+	};
+
+	// slot runs go through these, the most any stage can take
+	ID3D11DeviceChild* slots[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	UINT strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	UINT offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	auto readSlots = [&](RenderObjectType type, UINT limit, UINT* start, UINT* count)
+	{
+		*start = reader.Get<UINT>();
+		*count = reader.Get<UINT>();
+		if (*start > limit || *count > limit - *start)
+		{
+			reader.ok = false;
+			return;
+		}
+		for (UINT i = 0; i < *count && reader.ok; i++)
+			slots[i] = object(type);
+	};
+
+	if (context)
+		context->ClearState();
+
+	while (reader.ok && reader.at < reader.end)
+	{
+		BYTE command = *reader.at++;
+		UINT start = 0, count = 0;
+		counted.commands++;
+
+		switch (command)
+		{
+		case RenderCommand_ClearRenderTargetView:
+		{
+			ID3D11RenderTargetView* view = (ID3D11RenderTargetView*)object(RenderObject_RenderTargetView);
+			const FLOAT* color = (const FLOAT*)reader.GetBytes(4 * sizeof(FLOAT));
+			if (reader.ok && context && view)
+			{
+				FLOAT aligned[4];
+				memcpy(aligned, color, sizeof(aligned));
+				context->ClearRenderTargetView(view, aligned);
+			}
+			break;
+		}
+		case RenderCommand_ClearDepthStencilView:
+		{
+			ID3D11DepthStencilView* view = (ID3D11DepthStencilView*)object(RenderObject_DepthStencilView);
+			UINT flags = reader.Get<UINT>();
+			FLOAT depth = reader.Get<FLOAT>();
+			UINT8 stencil = reader.Get<UINT8>();
+			if (reader.ok && context && view)
+				context->ClearDepthStencilView(view, flags, depth, stencil);
+			break;
+		}
+		case RenderCommand_OMSetRenderTargets:
+		{
+			count = reader.Get<UINT>();
+			if (count > D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT)
+				reader.ok = false;
+			for (UINT i = 0; i < count && reader.ok; i++)
+				slots[i] = object(RenderObject_RenderTargetView);
+			ID3D11DepthStencilView* depthView = (ID3D11DepthStencilView*)object(RenderObject_DepthStencilView);
+			if (reader.ok && context)
+				context->OMSetRenderTargets(count, (ID3D11RenderTargetView* const*)slots, depthView);
+			break;
+		}
+		case RenderCommand_RSSetViewports:
+		{
+			count = reader.Get<UINT>();
+			if (count > D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE)
+				reader.ok = false;
+			D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+			const BYTE* bytes = reader.ok ? reader.GetBytes(count * sizeof(D3D11_VIEWPORT)) : nullptr;
+			if (reader.ok && context)
+			{
+				memcpy(viewports, bytes, count * sizeof(D3D11_VIEWPORT));
+				context->RSSetViewports(count, viewports);
+			}
+			break;
+		}
+		case RenderCommand_IASetInputLayout:
+		{
+			ID3D11InputLayout* layout = (ID3D11InputLayout*)object(RenderObject_InputLayout);
+			if (reader.ok && context)
+				context->IASetInputLayout(layout);
+			break;
+		}
+		case RenderCommand_IASetPrimitiveTopology:
+		{
+			UINT topology = reader.Get<UINT>();
+			if (reader.ok && context)
+				context->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)topology);
+			break;
+		}
+		case RenderCommand_IASetVertexBuffers:
+		{
+			start = reader.Get<UINT>();
+			count = reader.Get<UINT>();
+			if (start > D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT || count > D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT - start)
+				reader.ok = false;
+			for (UINT i = 0; i < count && reader.ok; i++)
+			{
+				slots[i] = object(RenderObject_Buffer);
+				strides[i] = reader.Get<UINT>();
+				offsets[i] = reader.Get<UINT>();
+			}
+			if (reader.ok && context)
+				context->IASetVertexBuffers(start, count, (ID3D11Buffer* const*)slots, strides, offsets);
+			break;
+		}
+		case RenderCommand_IASetIndexBuffer:
+		{
+			ID3D11Buffer* buffer = (ID3D11Buffer*)object(RenderObject_Buffer);
+			UINT format = reader.Get<UINT>();
+			UINT offset = reader.Get<UINT>();
+			if (reader.ok && context)
+				context->IASetIndexBuffer(buffer, (DXGI_FORMAT)format, offset);
+			break;
+		}
+		case RenderCommand_VSSetShader:
+		{
+			ID3D11VertexShader* shader = (ID3D11VertexShader*)object(RenderObject_VertexShader);
+			if (reader.ok && context)
+				context->VSSetShader(shader, nullptr, 0);
+			break;
+		}
+		case RenderCommand_PSSetShader:
+		{
+			ID3D11PixelShader* shader = (ID3D11PixelShader*)object(RenderObject_PixelShader);
+			if (reader.ok && context)
+				context->PSSetShader(shader, nullptr, 0);
+			break;
+		}
+		case RenderCommand_VSSetConstantBuffers:
+			readSlots(RenderObject_Buffer, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->VSSetConstantBuffers(start, count, (ID3D11Buffer* const*)slots);
+			break;
+		case RenderCommand_PSSetConstantBuffers:
+			readSlots(RenderObject_Buffer, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->PSSetConstantBuffers(start, count, (ID3D11Buffer* const*)slots);
+			break;
+		case RenderCommand_VSSetShaderResources:
+			readSlots(RenderObject_ShaderResourceView, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->VSSetShaderResources(start, count, (ID3D11ShaderResourceView* const*)slots);
+			break;
+		case RenderCommand_PSSetShaderResources:
+			readSlots(RenderObject_ShaderResourceView, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->PSSetShaderResources(start, count, (ID3D11ShaderResourceView* const*)slots);
+			break;
+		case RenderCommand_VSSetSamplers:
+			readSlots(RenderObject_SamplerState, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->VSSetSamplers(start, count, (ID3D11SamplerState* const*)slots);
+			break;
+		case RenderCommand_PSSetSamplers:
+			readSlots(RenderObject_SamplerState, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, &start, &count);
+			if (reader.ok && context)
+				context->PSSetSamplers(start, count, (ID3D11SamplerState* const*)slots);
+			break;
+		case RenderCommand_OMSetBlendState:
+		{
+			ID3D11BlendState* state = (ID3D11BlendState*)object(RenderObject_BlendState);
+			FLOAT factor[4];
+			const BYTE* bytes = reader.GetBytes(sizeof(factor));
+			UINT mask = reader.Get<UINT>();
+			if (reader.ok && context)
+			{
+				memcpy(factor, bytes, sizeof(factor));
+				context->OMSetBlendState(state, factor, mask);
+			}
+			break;
+		}
+		case RenderCommand_OMSetDepthStencilState:
+		{
+			ID3D11DepthStencilState* state = (ID3D11DepthStencilState*)object(RenderObject_DepthStencilState);
+			UINT stencilRef = reader.Get<UINT>();
+			if (reader.ok && context)
+				context->OMSetDepthStencilState(state, stencilRef);
+			break;
+		}
+		case RenderCommand_UpdateSubresource:
+		{
+			ID3D11Resource* target = resource();
+			UINT subresource = reader.Get<UINT>();
+			D3D11_BOX box;
+			bool hasBox = reader.Get<BYTE>() != 0;
+			if (hasBox)
+				box = reader.Get<D3D11_BOX>();
+			UINT rowPitch = reader.Get<UINT>();
+			UINT depthPitch = reader.Get<UINT>();
+			UINT size = reader.Get<UINT>();
+			const BYTE* bytes = reader.GetBytes(size);
+			counted.uploadBytes += size;
+			// nothing to copy from when the capture couldn't size it
+			if (!reader.ok || !context || !target || !size)
+				break;
+			ReplayTarget fit;
+			if (!GetReplayTarget(target, subresource, &fit) || !UpdateFits(fit, hasBox ? &box : nullptr, rowPitch, size))
+			{
+				LOG_WARNING(LogCategory_Render, "frame {}: an UpdateSubresource of {} bytes doesn't fit its resource, skipped", frame, size);
+				break;
+			}
+			context->UpdateSubresource(target, subresource, hasBox ? &box : nullptr, bytes, rowPitch, depthPitch);
+			break;
+		}
+		case RenderCommand_Map:
+		{
+			ID3D11Resource* target = resource();
+			UINT subresource = reader.Get<UINT>();
+			UINT mapType = reader.Get<UINT>();
+			UINT rowPitch = reader.Get<UINT>();
+			UINT size = reader.Get<UINT>();
+			const BYTE* bytes = reader.GetBytes(size);
+			counted.uploadBytes += size;
+			if (!reader.ok || !context || !target)
+				break;
+
+			ReplayTarget fit;
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			if (!GetReplayTarget(target, subresource, &fit) || FAILED(context->Map(target, subresource, (D3D11_MAP)mapType, 0, &mapped)))
+				break;
+
+			// another driver can pad a texture's rows differently, buffers are captured with no pitch
+			bool samePitch = mapped.RowPitch == rowPitch || rowPitch == 0;
+			UINT64 rowsWritten = samePitch ? 0 : ((UINT64)size + rowPitch - 1) / rowPitch;
+			bool fits = (fit.format == DXGI_FORMAT_UNKNOWN) ? size <= fit.rowBytes
+				: samePitch ? size <= (UINT64)mapped.RowPitch * fit.rows : rowsWritten <= fit.rows;
+			if (!fits)
+			{
+				LOG_WARNING(LogCategory_Render, "frame {}: a Map of {} bytes doesn't fit its resource, skipped", frame, size);
+				context->Unmap(target, subresource);
+				break;
+			}
+			if (samePitch)
+				memcpy(mapped.pData, bytes, size);
+			else
+			{
+				UINT rowBytes = std::min(rowPitch, mapped.RowPitch);
+				for (UINT offset = 0, row = 0; offset < size; offset += rowPitch, row++)
+					memcpy((BYTE*)mapped.pData + (size_t)row * mapped.RowPitch, bytes + offset, std::min(rowBytes, size - offset));
+			}
+			context->Unmap(target, subresource);
+			break;
+		}
+		case RenderCommand_Draw:
+		{
+			UINT vertexCount = reader.Get<UINT>();
+			UINT startVertex = reader.Get<UINT>();
+			counted.draws++;
+			if (reader.ok && context)
+				context->Draw(vertexCount, startVertex);
+			break;
+		}
+		case RenderCommand_DrawIndexed:
+		{
+			UINT indexCount = reader.Get<UINT>();
+			UINT startIndex = reader.Get<UINT>();
+			INT baseVertex = reader.Get<INT>();
+			counted.draws++;
+			if (reader.ok && context)
+				context->DrawIndexed(indexCount, startIndex, baseVertex);
+			break;
+		}
+		case RenderCommand_DrawInstanced:
+		{
+			UINT vertexCount = reader.Get<UINT>();
+			UINT instanceCount = reader.Get<UINT>();
+			UINT startVertex = reader.Get<UINT>();
+			UINT startInstance = reader.Get<UINT>();
+			counted.draws++;
+			if (reader.ok && context)
+				context->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+			break;
+		}
+		case RenderCommand_DrawIndexedInstanced:
+		{
+			UINT indexCount = reader.Get<UINT>();
+			UINT instanceCount = reader.Get<UINT>();
+			UINT startIndex = reader.Get<UINT>();
+			INT baseVertex = reader.Get<INT>();
+			UINT startInstance = reader.Get<UINT>();
+			counted.draws++;
+			if (reader.ok && context)
+				context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+			break;
+		}
+		default:
+			reader.ok = false;
+			break;
+		}
+	}
+
+	if (stats)
+		*stats = counted;
+	if (!reader.ok)
+	{
+		ReportError(LogCategory_Render, "Frame {} of the render capture is corrupt", frame);
+		return false;
+	}
+	return true;
+}
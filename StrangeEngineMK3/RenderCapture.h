@@ -0,0 +1,230 @@
+#pragma once
+
+#include "Common.h"
+#include <d3d11.h>
+#include <string>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		capture files
+// ==============================================================
+//
+// header | object table | object descs and contents | frame table | command streams
+// every D3D object a captured frame touches is in the object table, numbered from 1 in the order it was first used (0
+// is null), with what is needed to make it again: its desc, shader bytecode, and for buffers and textures that aren't
+// render targets, their contents when it was first used. a frame's commands are one byte for
+// the call followed by its arguments, objects by number, and the bytes of every UpdateSubresource and Map
+
+#define RENDER_CAPTURE_MAGIC 0x50435253 // "SRCP"
+#define RENDER_CAPTURE_VERSION 1
+
+enum RenderObjectType
+{
+	RenderObject_Buffer,
+	RenderObject_Texture2D,
+	RenderObject_ShaderResourceView,
+	RenderObject_RenderTargetView,
+	RenderObject_DepthStencilView,
+	RenderObject_VertexShader,
+	RenderObject_PixelShader,
+	RenderObject_InputLayout,
+	RenderObject_SamplerState,
+	RenderObject_BlendState,
+	RenderObject_DepthStencilState,
+	RenderObject_Count
+};
+
+#pragma pack(push, 1)
+struct RenderCaptureHeader
+{
+	UINT   magic;
+	UINT   version;
+	UINT   objectCount;
+	UINT   frameCount;
+	UINT64 objectsOffset;
+	UINT64 framesOffset;
+	UINT64 fileSize;
+};
+
+struct RenderCaptureObject
+{
+	UINT   type;	   // RenderObjectType
+	UINT   resource;   // what a view is of, always numbered before the view
+	UINT64 descOffset; // the D3D11_*_DESC, the bytecode for shaders, a RenderCaptureLayout for input layouts
+	UINT   descSize;	   // 0 for a shader whose bytecode wasn't registered, it is replayed as null
+	UINT64 dataOffset; // every subresource in order, each row tightly packed
+	UINT64 dataSize;   // 0 when the contents weren't captured
+};
+
+// an input layout's desc: this, the elements, the vertex shader bytecode it was made against, then the semantic names
+// zero terminated, an element's nameOffset is from the first of them
+struct RenderCaptureLayout
+{
+	UINT elementCount;
+	UINT codeSize;
+};
+
+struct RenderCaptureElement
+{
+	UINT nameOffset;
+	UINT semanticIndex;
+	UINT format;
+	UINT inputSlot;
+	UINT alignedByteOffset;
+	UINT inputSlotClass;
+	UINT instanceDataStepRate;
+};
+
+struct RenderCaptureFrame
+{
+	UINT64 commandsOffset;
+	UINT64 commandsSize;
+	UINT   commandCount;
+	UINT   drawCount;
+};
+#pragma pack(pop)
+
+
+// ==============================================================
+//		render context
+// ==============================================================
+
+struct RenderCaptureState;
+
+// what the engine's renderers draw through instead of the immediate context: the calls they make, with the same
+// arguments, passed straight on. while a capture is running each call is also written into the frame's command stream,
+// otherwise the only cost is a branch. InitDirect3D owns the one DrawScene uses
+class STRANGEENGINEMK3_API RenderContext
+{
+public:
+	RenderContext();
+	~RenderContext();
+
+	void Create(ID3D11Device* device, ID3D11DeviceContext* context);
+	// a capture that is still running is written with the frames it has
+	void Release();
+
+	ID3D11Device*		 GetDevice() const { return mDevice; }
+	// for anything the calls below don't cover, it isn't captured
+	ID3D11DeviceContext* GetD3DContext() const { return mContext; }
+
+	// DrawScene puts every frame between these, a capture starts and ends on them
+	void BeginFrame();
+	void EndFrame();
+	// in the last frame EndFrame() finished
+	UINT GetDrawCalls() const { return mLastDrawCalls; }
+
+	// the next 'frames' frames are written to 'path' once the last one has ended. capturing is slow (a new buffer or
+	// texture is read back the first time it is used) so captured frames shouldn't be timed, the replay is for that
+	bool StartCapture(const std::wstring& path, UINT frames);
+	bool IsCapturing() const { return mCapture != nullptr; }
+
+	// shaders and input layouts don't keep their bytecode, renderers hand it over here after creating them so a
+	// capture can make them again. it is kept on the object itself (private data), so it goes when the object does
+	static void RegisterShader(ID3D11DeviceChild* shader, const void* bytecode, size_t size);
+	static void RegisterInputLayout(ID3D11InputLayout* layout, const D3D11_INPUT_ELEMENT_DESC* elements, UINT count, const void* bytecode, size_t size);
+
+	void ClearRenderTargetView(ID3D11RenderTargetView* view, const FLOAT color[4]);
+	void ClearDepthStencilView(ID3D11DepthStencilView* view, UINT flags, FLOAT depth, UINT8 stencil);
+	void OMSetRenderTargets(UINT count, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthView);
+	void RSSetViewports(UINT count, const D3D11_VIEWPORT* viewports);
+
+	void IASetInputLayout(ID3D11InputLayout* layout);
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void IASetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets);
+	void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+
+	// no class instances, the engine's shaders don't use interfaces
+	void VSSetShader(ID3D11VertexShader* shader);
+	void VSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+	void VSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views);
+	void VSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers);
+	void PSSetShader(ID3D11PixelShader* shader);
+	void PSSetConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+	void PSSetShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views);
+	void PSSetSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers);
+
+	void OMSetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask);
+	void OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef);
+
+	// buffers and 2D textures
+	void UpdateSubresource(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, const void* data, UINT rowPitch, UINT depthPitch);
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped);
+	// 'writtenBytes' is how much of a written map was filled in from the start, only that much is captured. 0 is all of it
+	void Unmap(ID3D11Resource* resource, UINT subresource, UINT writtenBytes = 0);
+
+	void Draw(UINT vertexCount, UINT startVertex);
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex);
+	void DrawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance);
+	void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance);
+
+private:
+	RenderContext(const RenderContext&);
+	RenderContext& operator=(const RenderContext&);
+
+	// the render targets and viewport the frame starts with, so every frame can be replayed on its own
+	void CaptureFrameState();
+	void FinishCapture();
+
+	ID3D11Device*		 mDevice;
+	ID3D11DeviceContext* mContext;
+	RenderCaptureState*	 mCapture; // only while capturing
+	std::wstring		 mPendingPath;
+	UINT				 mPendingFrames;
+	UINT				 mDrawCalls;
+	UINT				 mLastDrawCalls;
+};
+
+
+// ==============================================================
+//		replay
+// ==============================================================
+
+struct RenderReplayStats
+{
+	UINT   commands;
+	UINT   draws;
+	UINT64 uploadBytes; // through UpdateSubresource and Map
+};
+
+// plays a capture back on any device, with no window and none of the game. the commands are submitted exactly as they
+// were captured, so timing ReplayFrame() is the CPU cost of the submission alone: the driver's and the runtime's,
+// without the engine deciding what to draw. with no device at all it only decodes, which is the replay's own cost
+class STRANGEENGINEMK3_API RenderReplay
+{
+public:
+	RenderReplay();
+	~RenderReplay();
+
+	bool Load(const std::wstring& path);
+
+	// makes every object in the capture on 'device' (hardware, WARP, anything). null makes nothing and ReplayFrame()
+	// only walks the commands
+	bool CreateObjects(ID3D11Device* device);
+	void ReleaseObjects();
+
+	UINT					  GetFrameCount() const { return (UINT)mFrames.size(); }
+	UINT					  GetObjectCount() const { return (UINT)mObjects.size(); }
+	const RenderCaptureFrame& GetFrame(UINT frame) const { return mFrames[frame]; }
+
+	// starts from a cleared state, then every command the frame was captured with. 'context' is null when the objects
+	// were made without a device
+	bool ReplayFrame(UINT frame, ID3D11DeviceContext* context, RenderReplayStats* stats = nullptr);
+
+private:
+	RenderReplay(const RenderReplay&);
+	RenderReplay& operator=(const RenderReplay&);
+
+	bool CreateObject(ID3D11Device* device, UINT index);
+
+	std::vector<BYTE>				 mFile;
+	std::vector<RenderCaptureObject> mObjects;
+	std::vector<RenderCaptureFrame>	 mFrames;
+	std::vector<ID3D11DeviceChild*>	 mCreated; // by object number, [0] is null
+};
@@ -0,0 +1,712 @@
+#include "pch.h"
+#include "Snapshot.h"
+#include "FileUtils.h"
+#include "Hash.h"
+#include "Log.h"
+#include "LZ4.h"
+#include "MemoryTracking.h"
+#include <algorithm>
+#include <cstring>
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// 'bytes' from 'offset' are inside a 'size' byte snapshot
+static bool Fits(UINT64 offset, UINT64 bytes, UINT64 size)
+{
+	return offset <= size && bytes <= size - offset;
+}
+
+
+// ==============================================================
+//		WorldState
+// ==============================================================
+
+WorldState::WorldState()
+{
+	mWorld = nullptr;
+}
+
+void WorldState::AddBlock(const char* name, void* data, size_t size)
+{
+	Block block;
+	block.name = name;
+	block.nameHash = HashBytes(name, strlen(name));
+	block.data = data;
+	block.size = size;
+	mBlocks.push_back(block);
+}
+
+bool WorldState::Capture(std::vector<BYTE>* snapshot) const
+{
+	// the components of every archetype that has entities, in the order they are first seen
+	std::vector<const Archetype*> archetypes;
+	std::vector<int>			  componentIndex(ECS_MAX_COMPONENTS, -1);
+	std::vector<ComponentId>	  components;
+	UINT64 nameBytes = 0;
+	UINT columnCount = 0, chunkCount = 0;
+	if (mWorld)
+	{
+		for (const Archetype* archetype : mWorld->mArchetypes)
+		{
+			if (archetype->entityCount == 0)
+				continue;
+			for (ComponentId id : archetype->components)
+			{
+				const ComponentInfo& info = GetComponentInfo(id);
+				if (!info.trivial)
+				{
+					ReportError(LogCategory_Engine, "Component {} can't go in a snapshot, it isn't trivially copyable", info.name);
+					return false;
+				}
+				if (componentIndex[id] < 0)
+				{
+					componentIndex[id] = (int)components.size();
+					components.push_back(id);
+					nameBytes += strlen(info.name) + 1;
+				}
+			}
+			archetypes.push_back(archetype);
+			columnCount += (UINT)archetype->components.size();
+			chunkCount += (UINT)archetype->chunks.size();
+		}
+	}
+	UINT entityRecords = mWorld ? (UINT)mWorld->mEntities.size() : 0;
+	UINT freeCount = mWorld ? (UINT)mWorld->mFreeEntities.size() : 0;
+
+	SnapshotHeader header;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.componentCount = (UINT)components.size();
+	header.archetypeCount = (UINT)archetypes.size();
+	header.columnCount = columnCount;
+	header.chunkCount = chunkCount;
+	header.entityRecords = entityRecords;
+	header.freeCount = freeCount;
+	header.blockCount = (UINT)mBlocks.size();
+	header.entityCount = mWorld ? mWorld->mEntityCount : 0;
+
+	UINT64 offset = sizeof(SnapshotHeader);
+	header.componentsOffset = offset;
+	offset += sizeof(SnapshotComponent) * components.size();
+	header.namesOffset = offset;
+	offset += nameBytes;
+	header.archetypesOffset = offset;
+	offset += sizeof(SnapshotArchetype) * archetypes.size();
+	header.columnsOffset = offset;
+	offset += sizeof(SnapshotColumn) * columnCount;
+	header.chunksOffset = offset;
+	offset += sizeof(SnapshotChunk) * chunkCount;
+	header.entitiesOffset = offset;
+	offset += sizeof(SnapshotEntity) * entityRecords;
+	header.freeOffset = offset;
+	offset += sizeof(UINT) * freeCount;
+	header.blocksOffset = offset;
+	offset += sizeof(SnapshotBlock) * mBlocks.size();
+
+	// every chunk is a multiple of 64 bytes, so they all stay aligned once the first one is
+	UINT64 tablesEnd = offset;
+	offset = AlignUp(offset, SNAPSHOT_CHUNK_ALIGNMENT);
+	UINT64 chunkData = offset;
+	for (const Archetype* archetype : archetypes)
+		offset += (UINT64)archetype->chunkBytes * archetype->chunks.size();
+	UINT64 blockData = offset;
+	for (const Block& block : mBlocks)
+		offset = AlignUp(offset, 16) + block.size;
+	header.fileSize = offset;
+
+	// resize keeps what was there before, the padding is cleared so the same state always gives the same bytes
+	snapshot->resize((size_t)header.fileSize);
+	BYTE* out = snapshot->data();
+	memcpy(out, &header, sizeof(header));
+	memset(out + tablesEnd, 0, (size_t)(chunkData - tablesEnd));
+
+	SnapshotComponent* componentTable = (SnapshotComponent*)(out + header.componentsOffset);
+	char* names = (char*)(out + header.namesOffset);
+	UINT nameOffset = 0;
+	for (UINT i = 0; i < components.size(); i++)
+	{
+		const ComponentInfo& info = GetComponentInfo(components[i]);
+		size_t length = strlen(info.name) + 1;
+		memcpy(names + nameOffset, info.name, length);
+		componentTable[i] = { nameOffset, info.size, info.alignment, components[i] };
+		nameOffset += (UINT)length;
+	}
+
+	SnapshotArchetype* archetypeTable = (SnapshotArchetype*)(out + header.archetypesOffset);
+	SnapshotColumn* columnTable = (SnapshotColumn*)(out + header.columnsOffset);
+	SnapshotChunk* chunkTable = (SnapshotChunk*)(out + header.chunksOffset);
+	UINT column = 0, chunk = 0;
+	for (UINT i = 0; i < archetypes.size(); i++)
+	{
+		const Archetype* archetype = archetypes[i];
+		archetypeTable[i] = { column, (UINT)archetype->components.size(), chunk, (UINT)archetype->chunks.size(),
+			archetype->entityCount, archetype->capacity, archetype->chunkBytes };
+
+		for (UINT c = 0; c < archetype->components.size(); c++)
+			columnTable[column++] = { (UINT)componentIndex[archetype->components[c]], archetype->offsets[c] };
+
+		for (const EntityChunk& source : archetype->chunks)
+		{
+			chunkTable[chunk++] = { chunkData, source.count, archetype->chunkBytes };
+			memcpy(out + chunkData, source.data, archetype->chunkBytes);
+			chunkData += archetype->chunkBytes;
+		}
+	}
+
+	SnapshotEntity* entityTable = (SnapshotEntity*)(out + header.entitiesOffset);
+	for (UINT i = 0; i < entityRecords; i++)
+		entityTable[i] = { mWorld->mEntities[i].generation, mWorld->mEntities[i].alive ? 1u : 0u };
+	if (freeCount > 0)
+		memcpy(out + header.freeOffset, mWorld->mFreeEntities.data(), sizeof(UINT) * freeCount);
+
+	SnapshotBlock* blockTable = (SnapshotBlock*)(out + header.blocksOffset);
+	for (UINT i = 0; i < mBlocks.size(); i++)
+	{
+		UINT64 aligned = AlignUp(blockData, 16);
+		memset(out + blockData, 0, (size_t)(aligned - blockData));
+		blockTable[i] = { mBlocks[i].nameHash, aligned, mBlocks[i].size };
+		memcpy(out + aligned, mBlocks[i].data, mBlocks[i].size);
+		blockData = aligned + mBlocks[i].size;
+	}
+	return true;
+}
+
+bool WorldState::Restore(const BYTE* snapshot, size_t size)
+{
+	const SnapshotHeader* header = (const SnapshotHeader*)snapshot;
+	if (size < sizeof(SnapshotHeader) || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->fileSize > size)
+	{
+		ReportError(LogCategory_Engine, "Not a snapshot, or one from another version");
+		return false;
+	}
+
+	UINT64 fileSize = header->fileSize;
+	if (!Fits(header->componentsOffset, sizeof(SnapshotComponent) * (UINT64)header->componentCount, fileSize)
+		|| !Fits(header->archetypesOffset, sizeof(SnapshotArchetype) * (UINT64)header->archetypeCount, fileSize)
+		|| !Fits(header->columnsOffset, sizeof(SnapshotColumn) * (UINT64)header->columnCount, fileSize)
+		|| !Fits(header->chunksOffset, sizeof(SnapshotChunk) * (UINT64)header->chunkCount, fileSize)
+		|| !Fits(header->entitiesOffset, sizeof(SnapshotEntity) * (UINT64)header->entityRecords, fileSize)
+		|| !Fits(header->freeOffset, sizeof(UINT) * (UINT64)header->freeCount, fileSize)
+		|| !Fits(header->blocksOffset, sizeof(SnapshotBlock) * (UINT64)header->blockCount, fileSize)
+		|| header->namesOffset > header->archetypesOffset)
+	{
+		ReportError(LogCategory_Engine, "Snapshot is corrupt");
+		return false;
+	}
+	if (header->archetypeCount > 0 && mWorld == nullptr)
+	{
+		ReportError(LogCategory_Engine, "Snapshot has entities but there is no world to put them in");
+		return false;
+	}
+
+	const SnapshotComponent* componentTable = (const SnapshotComponent*)(snapshot + header->componentsOffset);
+	const char* names = (const char*)(snapshot + header->namesOffset);
+	UINT64 namesSize = header->archetypesOffset - header->namesOffset;
+	const SnapshotArchetype* archetypeTable = (const SnapshotArchetype*)(snapshot + header->archetypesOffset);
+	const SnapshotColumn* columnTable = (const SnapshotColumn*)(snapshot + header->columnsOffset);
+	const SnapshotChunk* chunkTable = (const SnapshotChunk*)(snapshot + header->chunksOffset);
+	const SnapshotEntity* entityTable = (const SnapshotEntity*)(snapshot + header->entitiesOffset);
+	const UINT* freeTable = (const UINT*)(snapshot + header->freeOffset);
+	const SnapshotBlock* blockTable = (const SnapshotBlock*)(snapshot + header->blocksOffset);
+
+	// ==============================================================
+	//		check everything fits before anything is changed
+	// ==============================================================
+
+	// component ids are whatever this run handed out, found again by name
+	std::vector<ComponentId> ids(header->componentCount);
+	for (UINT i = 0; i < header->componentCount; i++)
+	{
+		const SnapshotComponent& component = componentTable[i];
+		if (component.nameOffset >= namesSize || memchr(names + component.nameOffset, 0, (size_t)(namesSize - component.nameOffset)) == nullptr)
+		{
+			ReportError(LogCategory_Engine, "Snapshot is corrupt");
+			return false;
+		}
+
+		const char* name = names + component.nameOffset;
+		if (!FindComponent(name, &ids[i]))
+		{
+			ReportError(LogCategory_Engine, "Snapshot has component {}, which hasn't been registered", name);
+			return false;
+		}
+		const ComponentInfo& info = GetComponentInfo(ids[i]);
+		if (info.size != component.size || info.alignment != component.alignment || !info.trivial)
+		{
+			ReportError(LogCategory_Engine, "Component {} has changed since the snapshot was taken", name);
+			return false;
+		}
+	}
+
+	for (UINT i = 0; i < header->archetypeCount; i++)
+	{
+		const SnapshotArchetype& archetype = archetypeTable[i];
+		bool valid = (UINT64)archetype.firstColumn + archetype.columnCount <= header->columnCount
+			&& (UINT64)archetype.firstChunk + archetype.chunkCount <= header->chunkCount && archetype.capacity > 0;
+		for (UINT c = 0; valid && c < archetype.columnCount; c++)
+		{
+			const SnapshotColumn& column = columnTable[archetype.firstColumn + c];
+			valid = column.component < header->componentCount
+				&& (UINT64)column.offset + (UINT64)componentTable[column.component].size * archetype.capacity <= archetype.chunkBytes;
+		}
+		for (UINT c = 0; valid && c < archetype.chunkCount; c++)
+		{
+			const SnapshotChunk& chunk = chunkTable[archetype.firstChunk + c];
+			valid = chunk.bytes == archetype.chunkBytes && chunk.count <= archetype.capacity && Fits(chunk.dataOffset, chunk.bytes, fileSize)
+				&& sizeof(Entity) * (UINT64)archetype.capacity <= chunk.bytes;
+		}
+		if (!valid)
+		{
+			ReportError(LogCategory_Engine, "Snapshot is corrupt");
+			return false;
+		}
+	}
+
+	for (UINT i = 0; i < header->freeCount; i++)
+	{
+		if (freeTable[i] >= header->entityRecords || entityTable[freeTable[i]].alive)
+		{
+			ReportError(LogCategory_Engine, "Snapshot is corrupt");
+			return false;
+		}
+	}
+
+	std::vector<const SnapshotBlock*> blocks(mBlocks.size(), nullptr);
+	for (UINT i = 0; i < mBlocks.size(); i++)
+	{
+		for (UINT b = 0; b < header->blockCount && blocks[i] == nullptr; b++)
+		{
+			if (blockTable[b].nameHash == mBlocks[i].nameHash)
+				blocks[i] = &blockTable[b];
+		}
+
+		// a block added since the snapshot was saved keeps what it has
+		if (blocks[i] == nullptr)
+			LOG_WARNING(LogCategory_Engine, "Snapshot has no block {}, it is left as it is", mBlocks[i].name);
+		else if (blocks[i]->size != mBlocks[i].size || !Fits(blocks[i]->dataOffset, blocks[i]->size, fileSize))
+		{
+			ReportError(LogCategory_Engine, "Block {} has changed size since the snapshot was taken", mBlocks[i].name);
+			return false;
+		}
+	}
+
+	// ==============================================================
+	//		chunks
+	// ==============================================================
+
+	if (mWorld)
+	{
+		EntityWorld& world = *mWorld;
+		world.Clear();
+
+		for (UINT i = 0; i < header->archetypeCount; i++)
+		{
+			const SnapshotArchetype& saved = archetypeTable[i];
+			const SnapshotColumn* columns = columnTable + saved.firstColumn;
+
+			ComponentMask mask;
+			for (UINT c = 0; c < saved.columnCount; c++)
+				mask.Set(ids[columns[c].component]);
+			UINT archetypeIndex = world.GetArchetype(mask);
+			Archetype* archetype = world.mArchetypes[archetypeIndex];
+
+			// the same build registering its components in the same order lays chunks out the same, they go in whole
+			std::vector<UINT> offsets(saved.columnCount);
+			bool sameLayout = archetype->capacity == saved.capacity && archetype->chunkBytes == saved.chunkBytes;
+			for (UINT c = 0; c < saved.columnCount; c++)
+			{
+				offsets[c] = archetype->offsets[archetype->GetColumn(ids[columns[c].component])];
+				sameLayout = sameLayout && offsets[c] == columns[c].offset;
+			}
+
+			for (UINT c = 0; c < saved.chunkCount; c++)
+			{
+				const SnapshotChunk& chunk = chunkTable[saved.firstChunk + c];
+				const BYTE* source = snapshot + chunk.dataOffset;
+				if (chunk.count == 0)
+					continue;
+
+				if (sameLayout)
+				{
+					EntityChunk copy = { world.AllocateChunk(archetype->chunkBytes), chunk.count };
+					memcpy(copy.data, source, chunk.bytes);
+					archetype->chunks.push_back(copy);
+					archetype->entityCount += chunk.count;
+					continue;
+				}
+
+				// otherwise array by array, filling this run's chunks up as they come
+				for (UINT row = 0; row < chunk.count;)
+				{
+					if (archetype->chunks.empty() || archetype->chunks.back().count == archetype->capacity)
+					{
+						EntityChunk fresh = { world.AllocateChunk(archetype->chunkBytes), 0 };
+						archetype->chunks.push_back(fresh);
+					}
+					EntityChunk& target = archetype->chunks.back();
+					UINT rows = std::min(archetype->capacity - target.count, chunk.count - row);
+
+					memcpy(target.data + sizeof(Entity) * target.count, source + sizeof(Entity) * row, sizeof(Entity) * rows);
+					for (UINT column = 0; column < saved.columnCount; column++)
+					{
+						UINT componentSize = componentTable[columns[column].component].size;
+						memcpy(target.data + offsets[column] + (size_t)componentSize * target.count,
+							source + columns[column].offset + (size_t)componentSize * row, (size_t)componentSize * rows);
+					}
+					target.count += rows;
+					archetype->entityCount += rows;
+					row += rows;
+				}
+			}
+		}
+
+		// ==============================================================
+		//		entity records
+		// ==============================================================
+
+		world.mEntities.resize(header->entityRecords);
+		for (UINT i = 0; i < header->entityRecords; i++)
+		{
+			EntityWorld::EntityRecord& record = world.mEntities[i];
+			record.archetype = record.chunk = record.row = 0;
+			record.generation = entityTable[i].generation;
+			record.alive = false;
+		}
+		world.mFreeEntities.assign(freeTable, freeTable + header->freeCount);
+
+		// every live entity is in exactly one row, the rows say where
+		UINT live = 0;
+		bool valid = true;
+		for (UINT a = 0; a < world.mArchetypes.size() && valid; a++)
+		{
+			Archetype* archetype = world.mArchetypes[a];
+			for (UINT c = 0; c < archetype->chunks.size() && valid; c++)
+			{
+				const EntityChunk& chunk = archetype->chunks[c];
+				const Entity* entities = (const Entity*)chunk.data;
+				for (UINT row = 0; row < chunk.count; row++)
+				{
+					Entity entity = entities[row];
+					if (entity.index >= header->entityRecords || !entityTable[entity.index].alive
+						|| world.mEntities[entity.index].alive || entity.generation != entityTable[entity.index].generation)
+					{
+						valid = false;
+						break;
+					}
+					EntityWorld::EntityRecord& record = world.mEntities[entity.index];
+					record.archetype = a;
+					record.chunk = c;
+					record.row = row;
+					record.alive = true;
+					live++;
+				}
+			}
+		}
+		world.mEntityCount = live;
+
+		if (!valid || live != header->entityCount)
+		{
+			// too late to leave the world as it was, at least leave it consistent
+			world.Clear();
+			ReportError(LogCategory_Engine, "Snapshot is corrupt, its entities don't match their records");
+			return false;
+		}
+	}
+
+	for (UINT i = 0; i < mBlocks.size(); i++)
+	{
+		if (blocks[i])
+			memcpy(mBlocks[i].data, snapshot + blocks[i]->dataOffset, mBlocks[i].size);
+	}
+	return true;
+}
+
+bool WorldState::Save(const std::wstring& path) const
+{
+	std::vector<BYTE> snapshot;
+	if (!Capture(&snapshot))
+		return false;
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Engine, "Could not create {}", path);
+		return false;
+	}
+
+	bool ok = WriteFileBytes(file, snapshot.data(), snapshot.size());
+	CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Engine, "Could not write snapshot {}", path);
+		DeleteFileW(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool WorldState::Load(const std::wstring& path)
+{
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Engine, "Could not open snapshot {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	const BYTE* data = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(SnapshotHeader))
+	{
+		mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+			data = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	bool ok = false;
+	if (data == nullptr)
+		ReportError(LogCategory_Engine, "Could not map snapshot {}", path);
+	else
+		ok = Restore(data, (size_t)fileSize.QuadPart);
+
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return ok;
+}
+
+
+// ==============================================================
+//		RewindBuffer
+// ==============================================================
+
+// deltas keep the pages that differ from their keyframe, a page of the snapshot nothing wrote to since costs nothing
+static const size_t kDeltaPageSize = 4096;
+
+// 'out' = 'a' ^ 'b'
+static void XorBytes(BYTE* out, const BYTE* a, const BYTE* b, size_t size)
+{
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		UINT64 x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		memcpy(out + i, &x, 8);
+	}
+	for (; i < size; i++)
+		out[i] = a[i] ^ b[i];
+}
+
+static double MillisecondsSince(const LARGE_INTEGER& start)
+{
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	return (double)(now.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+RewindBuffer::RewindBuffer(WorldState* state, UINT frames, UINT keyframeInterval)
+{
+	mState = state;
+	mCapacity = std::max(1u, frames);
+	mKeyframeInterval = std::max(1u, keyframeInterval);
+	mSinceKeyframe = 0;
+	mStoredBytes = 0;
+	mCapturedBytes = 0;
+	mKeyframes = 0;
+	mRecordMs = 0.0;
+	mRewindMs = 0.0;
+}
+
+RewindBuffer::~RewindBuffer()
+{
+	Clear();
+}
+
+bool RewindBuffer::Record()
+{
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	if (!mState->Capture(&mCapture))
+		return false;
+
+	Frame frame;
+	frame.size = mCapture.size();
+	frame.keyframe = mFrames.empty() || mSinceKeyframe >= mKeyframeInterval || mCapture.size() != mKeyframe.size();
+	if (frame.keyframe)
+	{
+		mKeyframe.swap(mCapture);
+		Compress(mKeyframe.data(), mKeyframe.size(), &frame);
+		mSinceKeyframe = 1;
+		mKeyframes++;
+	}
+	else
+	{
+		// the changed pages' numbers, then the pages XORed with the keyframe one after another and compressed
+		// mostly zeros, whatever changed was usually a few fields of each entity
+		std::vector<UINT> changed;
+		mDelta.clear();
+		for (size_t offset = 0; offset < frame.size; offset += kDeltaPageSize)
+		{
+			size_t bytes = std::min(kDeltaPageSize, frame.size - offset);
+			if (memcmp(mCapture.data() + offset, mKeyframe.data() + offset, bytes) == 0)
+				continue;
+			changed.push_back((UINT)(offset / kDeltaPageSize));
+			mDelta.resize(mDelta.size() + bytes);
+			XorBytes(mDelta.data() + mDelta.size() - bytes, mCapture.data() + offset, mKeyframe.data() + offset, bytes);
+		}
+
+		UINT changedCount = (UINT)changed.size();
+		frame.data.resize(sizeof(UINT) * (1 + changed.size()));
+		memcpy(frame.data.data(), &changedCount, sizeof(UINT));
+		if (changedCount > 0)
+			memcpy(frame.data.data() + sizeof(UINT), changed.data(), sizeof(UINT) * changed.size());
+		Compress(mDelta.data(), mDelta.size(), &frame);
+		mSinceKeyframe++;
+	}
+
+	mStoredBytes += frame.data.size();
+	mCapturedBytes += frame.size;
+	MemoryTracker::Get()->TrackAllocation(MemoryTag_Engine, frame.data.size());
+	mFrames.push_back(std::move(frame));
+
+	// a delta is no use without its keyframe, the oldest keyframe goes together with its deltas once the rest cover
+	// what has to be kept
+	while (mFrames.size() > mCapacity)
+	{
+		size_t group = 1;
+		while (group < mFrames.size() && !mFrames[group].keyframe)
+			group++;
+		if (mFrames.size() - group < mCapacity)
+			break;
+		for (size_t i = 0; i < group; i++)
+		{
+			Forget(mFrames.front());
+			mFrames.pop_front();
+		}
+	}
+
+	mRecordMs = MillisecondsSince(start);
+	return true;
+}
+
+bool RewindBuffer::Rewind(UINT frames)
+{
+	if (frames >= mFrames.size())
+	{
+		ReportError(LogCategory_Engine, "Can't rewind {} frames, only {} are recorded", frames, mFrames.size());
+		return false;
+	}
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	size_t target = mFrames.size() - 1 - frames;
+	size_t keyframe = target;
+	while (!mFrames[keyframe].keyframe)
+		keyframe--;
+
+	// the keyframe, then the delta's pages on top of it
+	const Frame& key = mFrames[keyframe];
+	mKeyframe.resize(key.size);
+	bool ok = LZ4Decompress(key.data.data(), key.data.size(), mKeyframe.data(), key.size);
+	const std::vector<BYTE>* state = &mKeyframe;
+	if (ok && target != keyframe)
+	{
+		const Frame& delta = mFrames[target];
+		UINT changedCount;
+		memcpy(&changedCount, delta.data.data(), sizeof(UINT));
+		const UINT* changed = (const UINT*)(delta.data.data() + sizeof(UINT));
+		size_t prefix = sizeof(UINT) * (1 + (size_t)changedCount);
+
+		size_t deltaBytes = 0;
+		for (UINT i = 0; i < changedCount; i++)
+			deltaBytes += std::min(kDeltaPageSize, delta.size - changed[i] * kDeltaPageSize);
+		mDelta.resize(deltaBytes);
+		ok = LZ4Decompress(delta.data.data() + prefix, delta.data.size() - prefix, mDelta.data(), deltaBytes);
+
+		mCapture = mKeyframe;
+		const BYTE* page = mDelta.data();
+		for (UINT i = 0; ok && i < changedCount; i++)
+		{
+			size_t offset = changed[i] * kDeltaPageSize;
+			size_t bytes = std::min(kDeltaPageSize, delta.size - offset);
+			XorBytes(mCapture.data() + offset, mCapture.data() + offset, page, bytes);
+			page += bytes;
+		}
+		state = &mCapture;
+	}
+	if (!ok)
+	{
+		ReportError(LogCategory_Engine, "Rewind buffer is corrupt");
+		Clear();
+		return false;
+	}
+	if (!mState->Restore(state->data(), state->size()))
+	{
+		// mKeyframe isn't the newest keyframe any more, the next recording has to be one
+		mSinceKeyframe = mKeyframeInterval;
+		return false;
+	}
+
+	// recording carries on from here, mKeyframe is already the keyframe the next delta is against
+	while (mFrames.size() > target + 1)
+	{
+		Forget(mFrames.back());
+		mFrames.pop_back();
+	}
+	mSinceKeyframe = (UINT)(target - keyframe + 1);
+
+	mRewindMs = MillisecondsSince(start);
+	return true;
+}
+
+void RewindBuffer::Clear()
+{
+	for (const Frame& frame : mFrames)
+		Forget(frame);
+	mFrames.clear();
+	mKeyframe.clear();
+	mSinceKeyframe = 0;
+}
+
+RewindStats RewindBuffer::GetStats() const
+{
+	RewindStats stats;
+	stats.frames = (UINT)mFrames.size();
+	stats.keyframes = mKeyframes;
+	stats.storedBytes = mStoredBytes;
+	stats.capturedBytes = mCapturedBytes;
+	stats.recordMs = mRecordMs;
+	stats.rewindMs = mRewindMs;
+	return stats;
+}
+
+// appended to whatever 'frame' already has
+void RewindBuffer::Compress(const BYTE* raw, size_t size, Frame* frame)
+{
+	size_t prefix = frame->data.size();
+	frame->data.resize(prefix + LZ4CompressBound(size));
+	size_t compressed = LZ4Compress(raw, size, frame->data.data() + prefix, frame->data.size() - prefix);
+	frame->data.resize(prefix + compressed);
+	frame->data.shrink_to_fit();
+}
+
+void RewindBuffer::Forget(const Frame& frame)
+{
+	mStoredBytes -= frame.data.size();
+	mCapturedBytes -= frame.size;
+	if (frame.keyframe)
+		mKeyframes--;
+	MemoryTracker::Get()->TrackFree(MemoryTag_Engine, frame.data.size());
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "Common.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include "ECS.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		snapshot files
+// ==============================================================
+//
+// header | component table | names | archetypes + their columns | chunk table | entity records | free list |
+// block table | chunks | blocks
+// the entity world's chunks are written exactly as they are in memory, 64 byte aligned, so loading one is a memcpy per
+// chunk and a pass over the entities to point their records at their rows. every reference in the file is an offset
+// from its start, there is nothing to parse field by field. only trivially copyable components can be saved
+
+#define SNAPSHOT_MAGIC 0x50414E53 // "SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CHUNK_ALIGNMENT 64
+
+#pragma pack(push, 1)
+struct SnapshotHeader
+{
+	UINT   magic;
+	UINT   version;
+	UINT   componentCount;
+	UINT   archetypeCount;
+	UINT   columnCount;	 // over every archetype
+	UINT   chunkCount;
+	UINT   entityRecords; // live and dead, a handle's index goes into them
+	UINT   freeCount;
+	UINT   blockCount;
+	UINT   entityCount;	 // live ones
+	UINT64 componentsOffset;
+	UINT64 namesOffset;
+	UINT64 archetypesOffset;
+	UINT64 columnsOffset;
+	UINT64 chunksOffset;
+	UINT64 entitiesOffset;
+	UINT64 freeOffset;
+	UINT64 blocksOffset;
+	UINT64 fileSize;
+};
+
+// a component type by name, ids are handed out in whatever order types are first used so they can differ between runs
+struct SnapshotComponent
+{
+	UINT nameOffset; // from namesOffset, zero terminated
+	UINT size;
+	UINT alignment;
+	UINT id;		 // when it was saved
+};
+
+struct SnapshotArchetype
+{
+	UINT firstColumn;
+	UINT columnCount;
+	UINT firstChunk;
+	UINT chunkCount;
+	UINT entityCount;
+	UINT capacity;
+	UINT chunkBytes;
+};
+
+struct SnapshotColumn
+{
+	UINT component; // into the component table
+	UINT offset;	// where its array starts in a chunk
+};
+
+struct SnapshotChunk
+{
+	UINT64 dataOffset;
+	UINT   count;
+	UINT   bytes;
+};
+
+struct SnapshotEntity
+{
+	UINT generation;
+	UINT alive;
+};
+
+struct SnapshotBlock
+{
+	UINT64 nameHash;
+	UINT64 dataOffset;
+	UINT64 size;
+};
+#pragma pack(pop)
+
+
+// ==============================================================
+//		world state
+// ==============================================================
+
+// what a snapshot is taken of: an entity world and any blocks of the game's own state
+// blocks are saved and restored as raw bytes, so they have to be plain data. a pointer in one would point at
+// whatever is there when the snapshot is loaded, refer to entities by their handle instead
+class STRANGEENGINEMK3_API WorldState
+{
+public:
+	WorldState();
+
+	void SetWorld(EntityWorld* world) { mWorld = world; }
+
+	// 'name' has to be the same when saving and loading, 'data' has to stay where it is
+	void AddBlock(const char* name, void* data, size_t size);
+	template<typename T> void AddBlock(const char* name, T* data)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot blocks are copied as raw bytes");
+		AddBlock(name, data, sizeof(T));
+	}
+
+	// the whole state in the file layout above
+	bool Capture(std::vector<BYTE>* snapshot) const;
+
+	// replaces the world's entities and every block with the snapshot's. nothing is changed if the snapshot doesn't
+	// fit, e.g. a component it has isn't registered or a block has changed size. one whose entities turn out not to
+	// match their records leaves the world empty
+	bool Restore(const BYTE* snapshot, size_t size);
+
+	bool Save(const std::wstring& path) const;
+	// restores straight out of the memory mapped file
+	bool Load(const std::wstring& path);
+
+private:
+	struct Block
+	{
+		std::string name;
+		UINT64		nameHash;
+		void*		data;
+		size_t		size;
+	};
+
+	EntityWorld*	   mWorld;
+	std::vector<Block> mBlocks;
+};
+
+
+// ==============================================================
+//		rewind
+// ==============================================================
+
+struct RewindStats
+{
+	UINT   frames;
+	UINT   keyframes;
+	UINT64 storedBytes;	 // compressed, what the buffer is really using
+	UINT64 capturedBytes; // the same frames as full snapshots
+	double recordMs;	 // the last Record(), capture and compression
+	double rewindMs;	 // the last Rewind()
+};
+
+// the last few seconds of snapshots, to step a test or a bug back and play it again
+// every 'keyframeInterval' recordings one is kept whole (LZ4 compressed), the ones in between keep just the 4KB pages
+// that differ from it, XORed with it and compressed, so whatever didn't change since the keyframe costs nothing. any
+// frame is one keyframe and at most one delta away. a world that changes shape (chunks come and go) starts a new
+// keyframe, the sizes have to match
+class STRANGEENGINEMK3_API RewindBuffer
+{
+public:
+	// keeps at least 'frames' recordings, 600 is 10 seconds of 60Hz steps
+	RewindBuffer(WorldState* state, UINT frames = 600, UINT keyframeInterval = 60);
+	~RewindBuffer();
+
+	// once a frame, or once a fixed step
+	bool Record();
+
+	// restores the state 'frames' recordings back, 0 is the newest, and forgets every recording after it so recording
+	// carries on from there
+	bool Rewind(UINT frames);
+
+	void Clear();
+
+	UINT		GetFrameCount() const { return (UINT)mFrames.size(); }
+	RewindStats GetStats() const;
+
+private:
+	RewindBuffer(const RewindBuffer&);
+	RewindBuffer& operator=(const RewindBuffer&);
+
+	struct Frame
+	{
+		std::vector<BYTE> data; // LZ4 of the snapshot for keyframes, the changed pages for deltas
+		size_t			  size; // uncompressed
+		bool			  keyframe;
+	};
+
+	void Compress(const BYTE* raw, size_t size, Frame* frame);
+	void Forget(const Frame& frame);
+
+	WorldState*		  mState;
+	UINT			  mCapacity;
+	UINT			  mKeyframeInterval;
+	std::deque<Frame> mFrames;
+	std::vector<BYTE> mKeyframe;	 // the newest keyframe uncompressed, what the next delta is against
+	UINT			  mSinceKeyframe; // recordings since it, itself included
+	std::vector<BYTE> mCapture;
+	std::vector<BYTE> mDelta; // the changed pages XORed with the keyframe
+	UINT64			  mStoredBytes;
+	UINT64			  mCapturedBytes;
+	UINT			  mKeyframes;
+	double			  mRecordMs;
+	double			  mRewindMs;
+};
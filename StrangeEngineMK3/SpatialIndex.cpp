@@ -0,0 +1,464 @@
+#include "pch.h"
+#include "SpatialIndex.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// queries per job for the batched versions
+static const unsigned int kQueryGrain = 16;
+
+// ==============================================================
+//		SpatialIndex
+// ==============================================================
+
+SpatialIndex::SpatialIndex()
+{
+	mCount = 0;
+}
+
+SpatialIndex::~SpatialIndex()
+{
+}
+
+UINT SpatialIndex::AllocateObject(const Aabb& bounds, UINT64 userData)
+{
+	UINT id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (UINT)mObjects.size();
+		mObjects.push_back(SpatialObject());
+	}
+
+	mObjects[id].bounds = bounds;
+	mObjects[id].userData = userData;
+	mObjects[id].alive = true;
+	mCount++;
+	return id;
+}
+
+void SpatialIndex::FreeObject(UINT id)
+{
+	mObjects[id].alive = false;
+	mFreeIds.push_back(id);
+	mCount--;
+}
+
+void SpatialIndex::QueryBoxes(const Aabb* boxes, UINT count, std::vector<UINT>* results) const
+{
+	JobSystem::Get()->ParallelFor(count, kQueryGrain, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			results[i].clear();
+			QueryBox(boxes[i], &results[i]);
+		}
+	});
+}
+
+void SpatialIndex::QuerySpheres(const Sphere* spheres, UINT count, std::vector<UINT>* results) const
+{
+	JobSystem::Get()->ParallelFor(count, kQueryGrain, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			results[i].clear();
+			QuerySphere(spheres[i], &results[i]);
+		}
+	});
+}
+
+void SpatialIndex::QueryFrustums(const Frustum* frustums, UINT count, std::vector<UINT>* results) const
+{
+	// one frustum is a lot of work already, so one per job
+	JobSystem::Get()->ParallelFor(count, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			results[i].clear();
+			QueryFrustum(frustums[i], &results[i]);
+		}
+	});
+}
+
+
+// ==============================================================
+//		LooseOctree
+// ==============================================================
+
+LooseOctree::LooseOctree(const XMFLOAT3& center, float halfSize, UINT maxDepth)
+{
+	mMaxDepth = std::min(maxDepth, 16u);
+
+	Node root;
+	root.center = center;
+	root.halfSize = halfSize;
+	root.depth = 0;
+	root.parent = UINT_MAX;
+	std::fill(root.children, root.children + 8, -1);
+	root.subtreeCount = 0;
+	mNodes.push_back(root);
+}
+
+// the deepest node whose loose bounds hold the object, made if it doesn't exist yet
+UINT LooseOctree::FindNode(const Aabb& bounds)
+{
+	XMFLOAT3 center((bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f, (bounds.min.z + bounds.max.z) * 0.5f);
+	float extent = std::max(bounds.max.x - bounds.min.x, std::max(bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z)) * 0.5f;
+
+	// outside the world, the root takes it and queries always look at the root's objects
+	const Node& root = mNodes[0];
+	if (fabsf(center.x - root.center.x) > root.halfSize || fabsf(center.y - root.center.y) > root.halfSize
+		|| fabsf(center.z - root.center.z) > root.halfSize)
+		return 0;
+
+	UINT node = 0;
+	while (mNodes[node].depth < mMaxDepth)
+	{
+		// a child's loose bounds reach its half size past its own edges,
+		// so anything centred in the child that is no bigger than that fits
+		float childHalf = mNodes[node].halfSize * 0.5f;
+		if (extent > childHalf)
+			break;
+
+		const Node& parent = mNodes[node];
+		UINT octant = (center.x >= parent.center.x ? 1 : 0) | (center.y >= parent.center.y ? 2 : 0) | (center.z >= parent.center.z ? 4 : 0);
+		if (parent.children[octant] < 0)
+		{
+			Node child;
+			child.center = XMFLOAT3(parent.center.x + ((octant & 1) ? childHalf : -childHalf),
+				parent.center.y + ((octant & 2) ? childHalf : -childHalf),
+				parent.center.z + ((octant & 4) ? childHalf : -childHalf));
+			child.halfSize = childHalf;
+			child.depth = parent.depth + 1;
+			child.parent = node;
+			std::fill(child.children, child.children + 8, -1);
+			child.subtreeCount = 0;
+			mNodes.push_back(child);
+			mNodes[node].children[octant] = (int)mNodes.size() - 1;
+		}
+		node = mNodes[node].children[octant];
+	}
+	return node;
+}
+
+void LooseOctree::AddToNode(UINT node, UINT id)
+{
+	mObjectNode[id] = node;
+	mObjectSlot[id] = (UINT)mNodes[node].ids.size();
+	mNodes[node].ids.push_back(id);
+	mNodes[node].bounds.push_back(mObjects[id].bounds);
+
+	for (UINT i = node; i != UINT_MAX; i = mNodes[i].parent)
+		mNodes[i].subtreeCount++;
+}
+
+void LooseOctree::RemoveFromNode(UINT id)
+{
+	UINT node = mObjectNode[id];
+	UINT slot = mObjectSlot[id];
+	Node& owner = mNodes[node];
+
+	// the node's last object takes the slot
+	UINT moved = owner.ids.back();
+	owner.ids[slot] = moved;
+	owner.bounds[slot] = owner.bounds.back();
+	mObjectSlot[moved] = slot;
+	owner.ids.pop_back();
+	owner.bounds.pop_back();
+
+	for (UINT i = node; i != UINT_MAX; i = mNodes[i].parent)
+		mNodes[i].subtreeCount--;
+}
+
+UINT LooseOctree::Insert(const Aabb& bounds, UINT64 userData)
+{
+	UINT id = AllocateObject(bounds, userData);
+	if (mObjectNode.size() < mObjects.size())
+	{
+		mObjectNode.resize(mObjects.size());
+		mObjectSlot.resize(mObjects.size());
+	}
+	AddToNode(FindNode(bounds), id);
+	return id;
+}
+
+void LooseOctree::Update(UINT id, const Aabb& bounds)
+{
+	mObjects[id].bounds = bounds;
+
+	UINT node = FindNode(bounds);
+	if (node == mObjectNode[id])
+	{
+		mNodes[node].bounds[mObjectSlot[id]] = bounds;
+		return;
+	}
+
+	RemoveFromNode(id);
+	AddToNode(node, id);
+}
+
+void LooseOctree::Remove(UINT id)
+{
+	RemoveFromNode(id);
+	FreeObject(id);
+}
+
+template<typename NodeTest, typename ObjectTest>
+void LooseOctree::Query(NodeTest nodeTest, ObjectTest objectTest, std::vector<UINT>* results) const
+{
+	// depth first, at most 7 siblings wait at each level
+	UINT stack[8 * 17];
+	UINT stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const Node& node = mNodes[stack[--stackSize]];
+		if (node.subtreeCount == 0)
+			continue;
+
+		// the root also holds everything outside the world, so it is always looked at
+		if (node.depth > 0)
+		{
+			float loose = node.halfSize * 2.0f;
+			Aabb looseBounds = MakeAabb(node.center, XMFLOAT3(loose, loose, loose));
+			if (!nodeTest(looseBounds))
+				continue;
+		}
+
+		for (size_t i = 0; i < node.ids.size(); i++)
+		{
+			if (objectTest(node.bounds[i]))
+				results->push_back(node.ids[i]);
+		}
+
+		for (int octant = 0; octant < 8; octant++)
+		{
+			if (node.children[octant] >= 0)
+				stack[stackSize++] = (UINT)node.children[octant];
+		}
+	}
+}
+
+void LooseOctree::QueryBox(const Aabb& box, std::vector<UINT>* results) const
+{
+	auto test = [&box](const Aabb& bounds) { return AabbOverlaps(box, bounds); };
+	Query(test, test, results);
+}
+
+void LooseOctree::QuerySphere(const Sphere& sphere, std::vector<UINT>* results) const
+{
+	auto test = [&sphere](const Aabb& bounds) { return SphereOverlapsAabb(sphere, bounds); };
+	Query(test, test, results);
+}
+
+void LooseOctree::QueryFrustum(const Frustum& frustum, std::vector<UINT>* results) const
+{
+	auto test = [&frustum](const Aabb& bounds) { return FrustumOverlapsAabb(frustum, bounds); };
+	Query(test, test, results);
+}
+
+
+// ==============================================================
+//		SpatialHash
+// ==============================================================
+
+SpatialHash::SpatialHash(float cellSize, UINT bucketCount, UINT maxCellsPerObject)
+{
+	mCellSize = cellSize;
+	mInverseCellSize = 1.0f / cellSize;
+	mMaxCellsPerObject = std::max(1u, maxCellsPerObject);
+
+	UINT buckets = 1;
+	while (buckets < bucketCount)
+		buckets <<= 1;
+	mBuckets.resize(buckets);
+}
+
+SpatialHash::CellRange SpatialHash::GetCellRange(const Aabb& bounds) const
+{
+	CellRange cells;
+	cells.minX = (int)floorf(bounds.min.x * mInverseCellSize);
+	cells.minY = (int)floorf(bounds.min.y * mInverseCellSize);
+	cells.minZ = (int)floorf(bounds.min.z * mInverseCellSize);
+	cells.maxX = (int)floorf(bounds.max.x * mInverseCellSize);
+	cells.maxY = (int)floorf(bounds.max.y * mInverseCellSize);
+	cells.maxZ = (int)floorf(bounds.max.z * mInverseCellSize);
+	return cells;
+}
+
+UINT SpatialHash::GetBucket(int x, int y, int z) const
+{
+	UINT hash = ((UINT)x * 73856093u) ^ ((UINT)y * 19349663u) ^ ((UINT)z * 83492791u);
+	return hash & (UINT)(mBuckets.size() - 1);
+}
+
+bool SpatialHash::IsLarge(const CellRange& cells) const
+{
+	UINT64 count = (UINT64)(cells.maxX - cells.minX + 1) * (cells.maxY - cells.minY + 1) * (cells.maxZ - cells.minZ + 1);
+	return count > mMaxCellsPerObject;
+}
+
+void SpatialHash::AddCells(UINT id)
+{
+	const CellRange& cells = mObjectCells[id];
+	if (IsLarge(cells))
+	{
+		mLargeSlot[id] = (UINT)mLarge.size();
+		mLarge.push_back(id);
+		return;
+	}
+
+	mLargeSlot[id] = UINT_MAX;
+	for (int z = cells.minZ; z <= cells.maxZ; z++)
+	{
+		for (int y = cells.minY; y <= cells.maxY; y++)
+		{
+			for (int x = cells.minX; x <= cells.maxX; x++)
+			{
+				CellEntry entry = { x, y, z, id };
+				mBuckets[GetBucket(x, y, z)].push_back(entry);
+			}
+		}
+	}
+}
+
+void SpatialHash::RemoveCells(UINT id)
+{
+	if (mLargeSlot[id] != UINT_MAX)
+	{
+		UINT moved = mLarge.back();
+		mLarge[mLargeSlot[id]] = moved;
+		mLargeSlot[moved] = mLargeSlot[id];
+		mLarge.pop_back();
+		return;
+	}
+
+	const CellRange& cells = mObjectCells[id];
+	for (int z = cells.minZ; z <= cells.maxZ; z++)
+	{
+		for (int y = cells.minY; y <= cells.maxY; y++)
+		{
+			for (int x = cells.minX; x <= cells.maxX; x++)
+			{
+				std::vector<CellEntry>& bucket = mBuckets[GetBucket(x, y, z)];
+				for (size_t i = 0; i < bucket.size(); i++)
+				{
+					if (bucket[i].id == id && bucket[i].x == x && bucket[i].y == y && bucket[i].z == z)
+					{
+						bucket[i] = bucket.back();
+						bucket.pop_back();
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+UINT SpatialHash::Insert(const Aabb& bounds, UINT64 userData)
+{
+	UINT id = AllocateObject(bounds, userData);
+	if (mObjectCells.size() < mObjects.size())
+	{
+		mObjectCells.resize(mObjects.size());
+		mLargeSlot.resize(mObjects.size());
+	}
+	mObjectCells[id] = GetCellRange(bounds);
+	AddCells(id);
+	return id;
+}
+
+void SpatialHash::Update(UINT id, const Aabb& bounds)
+{
+	mObjects[id].bounds = bounds;
+
+	// most moves stay inside the same cells
+	CellRange cells = GetCellRange(bounds);
+	if (cells == mObjectCells[id])
+		return;
+
+	RemoveCells(id);
+	mObjectCells[id] = cells;
+	AddCells(id);
+}
+
+void SpatialHash::Remove(UINT id)
+{
+	RemoveCells(id);
+	FreeObject(id);
+}
+
+template<typename ObjectTest>
+void SpatialHash::Query(const Aabb& area, ObjectTest objectTest, std::vector<UINT>* results) const
+{
+	for (UINT id : mLarge)
+	{
+		if (objectTest(mObjects[id].bounds))
+			results->push_back(id);
+	}
+
+	// an object in several cells is only reported from the first cell it shares with the query
+	CellRange query = GetCellRange(area);
+	auto visit = [&](const CellEntry& entry)
+	{
+		const CellRange& cells = mObjectCells[entry.id];
+		if (entry.x != std::max(cells.minX, query.minX) || entry.y != std::max(cells.minY, query.minY)
+			|| entry.z != std::max(cells.minZ, query.minZ))
+			return;
+		if (objectTest(mObjects[entry.id].bounds))
+			results->push_back(entry.id);
+	};
+
+	// a query covering more cells than there are buckets is quicker to answer by going through every bucket once
+	UINT64 queryCells = (UINT64)(query.maxX - query.minX + 1) * (query.maxY - query.minY + 1) * (query.maxZ - query.minZ + 1);
+	if (queryCells > mBuckets.size())
+	{
+		for (const std::vector<CellEntry>& bucket : mBuckets)
+		{
+			for (const CellEntry& entry : bucket)
+			{
+				if (entry.x >= query.minX && entry.x <= query.maxX && entry.y >= query.minY && entry.y <= query.maxY
+					&& entry.z >= query.minZ && entry.z <= query.maxZ)
+					visit(entry);
+			}
+		}
+		return;
+	}
+
+	for (int z = query.minZ; z <= query.maxZ; z++)
+	{
+		for (int y = query.minY; y <= query.maxY; y++)
+		{
+			for (int x = query.minX; x <= query.maxX; x++)
+			{
+				for (const CellEntry& entry : mBuckets[GetBucket(x, y, z)])
+				{
+					if (entry.x == x && entry.y == y && entry.z == z)
+						visit(entry);
+				}
+			}
+		}
+	}
+}
+
+void SpatialHash::QueryBox(const Aabb& box, std::vector<UINT>* results) const
+{
+	Query(box, [&box](const Aabb& bounds) { return AabbOverlaps(box, bounds); }, results);
+}
+
+void SpatialHash::QuerySphere(const Sphere& sphere, std::vector<UINT>* results) const
+{
+	Query(SphereBounds(sphere), [&sphere](const Aabb& bounds) { return SphereOverlapsAabb(sphere, bounds); }, results);
+}
+
+void SpatialHash::QueryFrustum(const Frustum& frustum, std::vector<UINT>* results) const
+{
+	Query(frustum.bounds, [&frustum](const Aabb& bounds) { return FrustumOverlapsAabb(frustum, bounds); }, results);
+}
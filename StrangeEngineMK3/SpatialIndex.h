@@ -0,0 +1,167 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+#include "Geometry.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		spatial index
+// ==============================================================
+//
+// "what's near here" for game code. both kinds below take the same calls:
+//  LooseOctree - scenes where objects range from pebbles to buildings
+//  SpatialHash - lots of small things moving every frame (debris, projectiles, crowds)
+// queries can run from any number of threads at once, but not while anything is inserted, moved or removed
+
+class STRANGEENGINEMK3_API SpatialIndex
+{
+public:
+	SpatialIndex();
+	virtual ~SpatialIndex();
+
+	// returns the object's id, ids of removed objects are reused
+	virtual UINT Insert(const Aabb& bounds, UINT64 userData) = 0;
+	// call whenever the object moves or changes size, cheap if it stays in the same place in the structure
+	virtual void Update(UINT id, const Aabb& bounds) = 0;
+	virtual void Remove(UINT id) = 0;
+
+	// the ids of objects overlapping the shape are added to 'results', each once
+	virtual void QueryBox(const Aabb& box, std::vector<UINT>* results) const = 0;
+	virtual void QuerySphere(const Sphere& sphere, std::vector<UINT>* results) const = 0;
+	virtual void QueryFrustum(const Frustum& frustum, std::vector<UINT>* results) const = 0;
+
+	// many queries spread over the job system, results[i] is replaced with the answer to query i
+	void QueryBoxes(const Aabb* boxes, UINT count, std::vector<UINT>* results) const;
+	void QuerySpheres(const Sphere* spheres, UINT count, std::vector<UINT>* results) const;
+	void QueryFrustums(const Frustum* frustums, UINT count, std::vector<UINT>* results) const;
+
+	const Aabb& GetBounds(UINT id) const { return mObjects[id].bounds; }
+	UINT64 GetUserData(UINT id) const { return mObjects[id].userData; }
+	UINT GetCount() const { return mCount; }
+
+protected:
+	struct SpatialObject
+	{
+		Aabb   bounds;
+		UINT64 userData;
+		bool   alive;
+	};
+
+	UINT AllocateObject(const Aabb& bounds, UINT64 userData);
+	void FreeObject(UINT id);
+
+	std::vector<SpatialObject> mObjects; // by id
+	std::vector<UINT>		   mFreeIds;
+	UINT					   mCount;
+
+private:
+	SpatialIndex(const SpatialIndex&);
+	SpatialIndex& operator=(const SpatialIndex&);
+};
+
+// an octree whose nodes overlap their neighbours by half their size each way, so every object lives in exactly one node
+// chosen from its size and centre, and moving an object never has to touch more than two nodes
+class STRANGEENGINEMK3_API LooseOctree : public SpatialIndex
+{
+public:
+	// 'center' and 'halfSize' should cover the world, objects outside it still work but every query tests them
+	LooseOctree(const XMFLOAT3& center, float halfSize, UINT maxDepth = 8);
+
+	UINT Insert(const Aabb& bounds, UINT64 userData) override;
+	void Update(UINT id, const Aabb& bounds) override;
+	void Remove(UINT id) override;
+
+	void QueryBox(const Aabb& box, std::vector<UINT>* results) const override;
+	void QuerySphere(const Sphere& sphere, std::vector<UINT>* results) const override;
+	void QueryFrustum(const Frustum& frustum, std::vector<UINT>* results) const override;
+
+	UINT GetNodeCount() const { return (UINT)mNodes.size(); }
+
+private:
+	struct Node
+	{
+		XMFLOAT3		  center;
+		float			  halfSize;		// of the node itself, its loose bounds are twice this
+		UINT			  depth;
+		UINT			  parent;
+		int				  children[8];	// -1 until something goes in that octant
+		UINT			  subtreeCount; // objects in this node and everything under it, queries skip empty branches
+		std::vector<UINT> ids;
+		std::vector<Aabb> bounds;		// next to the ids so a query doesn't have to jump out to mObjects
+	};
+
+	UINT FindNode(const Aabb& bounds);
+	void AddToNode(UINT node, UINT id);
+	void RemoveFromNode(UINT id);
+
+	template<typename NodeTest, typename ObjectTest>
+	void Query(NodeTest nodeTest, ObjectTest objectTest, std::vector<UINT>* results) const;
+
+	std::vector<Node> mNodes; // 0 is the root
+	UINT			  mMaxDepth;
+
+	// by object id
+	std::vector<UINT> mObjectNode;
+	std::vector<UINT> mObjectSlot;
+};
+
+// a uniform grid hashed into a fixed number of buckets, so the world needs no bounds and memory follows the objects
+// objects are listed in every cell they touch, anything spanning more than 'maxCellsPerObject' cells is kept aside
+class STRANGEENGINEMK3_API SpatialHash : public SpatialIndex
+{
+public:
+	// 'cellSize' around the size of a typical object works best, 'bucketCount' is rounded up to a power of two
+	SpatialHash(float cellSize, UINT bucketCount = 65536, UINT maxCellsPerObject = 64);
+
+	UINT Insert(const Aabb& bounds, UINT64 userData) override;
+	void Update(UINT id, const Aabb& bounds) override;
+	void Remove(UINT id) override;
+
+	void QueryBox(const Aabb& box, std::vector<UINT>* results) const override;
+	void QuerySphere(const Sphere& sphere, std::vector<UINT>* results) const override;
+	void QueryFrustum(const Frustum& frustum, std::vector<UINT>* results) const override;
+
+private:
+	struct CellRange
+	{
+		int minX, minY, minZ;
+		int maxX, maxY, maxZ;
+
+		bool operator==(const CellRange& other) const
+		{
+			return minX == other.minX && minY == other.minY && minZ == other.minZ
+				&& maxX == other.maxX && maxY == other.maxY && maxZ == other.maxZ;
+		}
+	};
+
+	struct CellEntry
+	{
+		int	 x, y, z; // buckets are shared by every cell that hashes to them
+		UINT id;
+	};
+
+	CellRange GetCellRange(const Aabb& bounds) const;
+	UINT	  GetBucket(int x, int y, int z) const;
+	bool	  IsLarge(const CellRange& cells) const;
+	void	  AddCells(UINT id);
+	void	  RemoveCells(UINT id);
+
+	template<typename ObjectTest>
+	void Query(const Aabb& area, ObjectTest objectTest, std::vector<UINT>* results) const;
+
+	float								mCellSize;
+	float								mInverseCellSize;
+	UINT								mMaxCellsPerObject;
+	std::vector<std::vector<CellEntry>> mBuckets;
+	std::vector<UINT>					mLarge; // objects too big for the grid, tested by every query
+
+	// by object id
+	std::vector<CellRange> mObjectCells;
+	std::vector<UINT>	   mLargeSlot; // index in mLarge, UINT_MAX if the object is in the grid
+};
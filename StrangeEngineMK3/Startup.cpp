@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "Startup.h"
+#include "GraphReport.h"
+#include "JobSystem.h"
+#include "Log.h"
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <climits>
+#include <thread>
+#include <unordered_map>
+
+StartupGraph::StartupGraph()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mSecondsPerCount = 1.0 / (double)frequency.QuadPart;
+	mFinished = 0;
+	mParallel = true;
+
+	mReport.totalMs = 0.0;
+	mReport.serialMs = 0.0;
+	mReport.criticalPathMs = 0.0;
+	mReport.succeeded = false;
+}
+
+StartupGraph::~StartupGraph()
+{
+}
+
+void StartupGraph::AddTask(const StartupTaskDesc& desc)
+{
+	mTasks.push_back(desc);
+}
+
+void StartupGraph::Clear()
+{
+	mTasks.clear();
+	mOrder.clear();
+	mNodes.reset();
+}
+
+bool StartupGraph::HasTask(const std::string& name) const
+{
+	for (const StartupTaskDesc& task : mTasks)
+	{
+		if (task.name == name)
+			return true;
+	}
+	return false;
+}
+
+bool StartupGraph::BuildGraph()
+{
+	UINT count = (UINT)mTasks.size();
+	mNodes.reset(new Node[count]);
+	mOrder.clear();
+
+	std::unordered_map<std::string, UINT> indices;
+	for (UINT i = 0; i < count; i++)
+	{
+		if (!indices.insert(std::make_pair(mTasks[i].name, i)).second)
+		{
+			ReportError(LogCategory_Engine, "There are two startup tasks called {}", mTasks[i].name);
+			return false;
+		}
+	}
+
+	for (UINT i = 0; i < count; i++)
+	{
+		for (const std::string& after : mTasks[i].after)
+		{
+			auto found = indices.find(after);
+			if (found == indices.end())
+			{
+				ReportError(LogCategory_Engine, "Startup task {} comes after {}, which doesn't exist", mTasks[i].name, after);
+				return false;
+			}
+			mNodes[i].predecessors.push_back(found->second);
+			mNodes[found->second].successors.push_back(i);
+		}
+	}
+
+	// dependency order, anything left over is part of a cycle
+	std::vector<UINT> waiting(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		waiting[i] = (UINT)mNodes[i].predecessors.size();
+		if (waiting[i] == 0)
+			mOrder.push_back(i);
+	}
+	for (size_t i = 0; i < mOrder.size(); i++)
+	{
+		for (UINT successor : mNodes[mOrder[i]].successors)
+		{
+			if (--waiting[successor] == 0)
+				mOrder.push_back(successor);
+		}
+	}
+	if (mOrder.size() != count)
+	{
+		for (UINT i = 0; i < count; i++)
+		{
+			if (waiting[i] != 0)
+			{
+				ReportError(LogCategory_Engine, "Startup task {} ends up coming after itself", mTasks[i].name);
+				break;
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+bool StartupGraph::Run(bool parallel)
+{
+	mReport = StartupReport();
+	mParallel = parallel;
+	if (!BuildGraph())
+		return false;
+
+	LARGE_INTEGER runStart;
+	QueryPerformanceCounter(&runStart);
+
+	UINT count = (UINT)mTasks.size();
+	for (UINT i = 0; i < count; i++)
+	{
+		Node& node = mNodes[i];
+		node.remaining.store((int)node.predecessors.size(), std::memory_order_relaxed);
+		node.blocked.store(false, std::memory_order_relaxed);
+		node.start = runStart.QuadPart;
+		node.end = runStart.QuadPart;
+		node.thread = 0;
+		node.ran = false;
+		node.succeeded = false;
+	}
+	mFinished.store(0, std::memory_order_relaxed);
+	mMainThreadReady.clear();
+
+	if (parallel)
+	{
+		for (UINT i = 0; i < count; i++)
+		{
+			if (mNodes[i].predecessors.empty())
+				Dispatch(i);
+		}
+
+		// this thread runs the main thread tasks as they become ready and helps with everything else in between
+		while (mFinished.load(std::memory_order_acquire) < count)
+		{
+			UINT node = UINT_MAX;
+			{
+				std::lock_guard<std::mutex> lock(mMainThreadMutex);
+				if (!mMainThreadReady.empty())
+				{
+					node = mMainThreadReady.back();
+					mMainThreadReady.pop_back();
+				}
+			}
+
+			if (node != UINT_MAX)
+				RunNode(node);
+			else if (!JobSystem::Get()->TryRunOne())
+				std::this_thread::yield();
+		}
+	}
+	else
+	{
+		// everything on this thread, one after the other, RunNode doesn't dispatch anything
+		for (UINT node : mOrder)
+			RunNode(node);
+	}
+
+	LARGE_INTEGER runEnd;
+	QueryPerformanceCounter(&runEnd);
+	BuildReport(runStart.QuadPart, runEnd.QuadPart);
+
+	if (!mReport.succeeded)
+		LOG_ERROR(LogCategory_Engine, "startup failed at {}", mReport.failedTask);
+	return mReport.succeeded;
+}
+
+void StartupGraph::Dispatch(UINT node)
+{
+	if (mTasks[node].mainThread)
+	{
+		std::lock_guard<std::mutex> lock(mMainThreadMutex);
+		mMainThreadReady.push_back(node);
+		return;
+	}
+
+	JobSystem::Get()->Run([this, node]() { RunNode(node); });
+}
+
+void StartupGraph::RunNode(UINT index)
+{
+	Node& node = mNodes[index];
+	node.thread = JobSystem::GetThreadIndex();
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	if (!node.blocked.load(std::memory_order_acquire))
+	{
+		node.ran = true;
+		node.succeeded = mTasks[index].run ? mTasks[index].run() : true;
+	}
+	QueryPerformanceCounter(&end);
+	node.start = start.QuadPart;
+	node.end = end.QuadPart;
+
+	for (UINT successor : node.successors)
+	{
+		if (!node.succeeded)
+			mNodes[successor].blocked.store(true, std::memory_order_release);
+		if (mNodes[successor].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 && mParallel)
+			Dispatch(successor);
+	}
+
+	// last, Run may return as soon as this lands
+	mFinished.fetch_add(1, std::memory_order_release);
+}
+
+void StartupGraph::BuildReport(LONGLONG runStart, LONGLONG runEnd)
+{
+	UINT count = (UINT)mTasks.size();
+	mReport.totalMs = (runEnd - runStart) * mSecondsPerCount * 1000.0;
+	mReport.succeeded = true;
+	mReport.tasks.resize(count);
+
+	std::vector<double> taskMs(count, 0.0);
+	for (UINT i : mOrder)
+	{
+		const Node& node = mNodes[i];
+		double ms = (node.end - node.start) * mSecondsPerCount * 1000.0;
+		mReport.serialMs += ms;
+		taskMs[i] = ms;
+
+		StartupTaskTiming& timing = mReport.tasks[i];
+		timing.name = mTasks[i].name;
+		timing.startMs = (node.start - runStart) * mSecondsPerCount * 1000.0;
+		timing.ms = ms;
+		timing.thread = node.thread;
+		timing.ran = node.ran;
+		timing.succeeded = node.succeeded;
+		timing.critical = false;
+
+		// the first to fail in dependency order, the ones after it were only skipped
+		if (node.ran && !node.succeeded && mReport.succeeded)
+		{
+			mReport.succeeded = false;
+			mReport.failedTask = mTasks[i].name;
+		}
+	}
+
+	// the longest chain through the graph by this run's costs, what startup would take with unlimited threads
+	std::vector<UINT> criticalPath;
+	mReport.criticalPathMs = FindCriticalPath(mNodes.get(), mOrder.data(), (UINT)mOrder.size(), taskMs, &criticalPath);
+	for (UINT i : criticalPath)
+		mReport.tasks[i].critical = true;
+}
+
+void StartupGraph::LogReport() const
+{
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(3)
+		<< "startup took " << mReport.totalMs << " ms, " << mReport.serialMs << " ms of work, critical path "
+		<< mReport.criticalPathMs << " ms (* below)";
+	LOG_INFO(LogCategory_Engine, "{}", line.str());
+
+	static const ReportColumn columns[] =
+	{
+		{ "task", 20, true },
+		{ "start ms", 10, false },
+		{ "ms", 10, false },
+		{ "thread", 8, false },
+	};
+	ReportTable table(LogCategory_Engine, columns, sizeof(columns) / sizeof(columns[0]));
+	table.LogTitles();
+	for (const StartupTaskTiming& timing : mReport.tasks)
+	{
+		table << timing.name << timing.startMs << timing.ms << timing.thread;
+		if (!timing.ran)
+			table.LogRow(timing.critical ? " * skipped" : " skipped");
+		else if (!timing.succeeded)
+			table.LogRow(timing.critical ? " * failed" : " failed");
+		else
+			table.LogRow(timing.critical ? " *" : "");
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// one step of getting the engine (or the game) ready to run
+struct StartupTaskDesc
+{
+	std::string				 name;
+	std::function<bool()>	 run;		 // false means it failed, nothing after it runs
+	std::vector<std::string> after;		 // names of the tasks that have to finish first
+	bool					 mainThread; // window and swap chain work has to happen on the thread that pumps messages
+
+	StartupTaskDesc() : mainThread(false) {}
+	StartupTaskDesc(const std::string& name, std::function<bool()> run) : name(name), run(run), mainThread(false) {}
+
+	StartupTaskDesc& After(const std::string& task) { after.push_back(task); return *this; }
+	StartupTaskDesc& OnMainThread() { mainThread = true; return *this; }
+};
+
+struct StartupTaskTiming
+{
+	std::string	 name;
+	double		 startMs;	// from the start of Run()
+	double		 ms;
+	unsigned int thread;	// JobSystem::GetThreadIndex() of the thread it ran on, 0 is the main thread
+	bool		 ran;		// false if something it comes after failed
+	bool		 succeeded;
+	bool		 critical;	// on the critical path
+};
+
+struct StartupReport
+{
+	double						   totalMs;		   // Run() start to finish
+	double						   serialMs;	   // every task's time added up, what one thread would have taken
+	double						   criticalPathMs; // the longest chain of tasks that had to wait for each other
+	bool						   succeeded;
+	std::string					   failedTask;	   // the first one that failed
+	std::vector<StartupTaskTiming> tasks;		   // in the order they were added
+};
+
+// runs startup tasks as soon as everything they come after has finished, tasks that don't depend on each other
+// run at the same time on the job system. main thread tasks run on the thread calling Run(), in between it helps
+// with the rest. StrangeEngine::StartEngine builds one of these for the window, device and swap chain
+class STRANGEENGINEMK3_API StartupGraph
+{
+public:
+	StartupGraph();
+	~StartupGraph();
+
+	void AddTask(const StartupTaskDesc& desc);
+	void Clear();
+	bool HasTask(const std::string& name) const;
+
+	// false (and an engine error) if a task failed or one comes after a task that doesn't exist or after itself.
+	// tasks that don't need the failed one still run. 'parallel' false runs them one at a time, for comparison
+	bool Run(bool parallel = true);
+
+	const StartupReport& GetReport() const { return mReport; }
+	// the per task table, through the logger
+	void LogReport() const;
+
+private:
+	StartupGraph(const StartupGraph&);
+	StartupGraph& operator=(const StartupGraph&);
+
+	struct Node
+	{
+		std::vector<UINT> successors;
+		std::vector<UINT> predecessors;
+		std::atomic<int>  remaining; // predecessors that haven't finished
+		std::atomic<bool> blocked;	 // a predecessor failed or was skipped
+		LONGLONG		  start;
+		LONGLONG		  end;
+		unsigned int	  thread;
+		bool			  ran;
+		bool			  succeeded;
+	};
+
+	// resolves the 'after' names into a graph and puts mOrder in dependency order, false on a missing or circular dependency
+	bool BuildGraph();
+	void Dispatch(UINT node);
+	void RunNode(UINT node);
+	void BuildReport(LONGLONG runStart, LONGLONG runEnd);
+
+	std::vector<StartupTaskDesc> mTasks;
+	std::unique_ptr<Node[]>		 mNodes;
+	std::vector<UINT>			 mOrder;
+	bool						 mParallel;
+	std::atomic<UINT>			 mFinished;
+	std::mutex					 mMainThreadMutex;
+	std::vector<UINT>			 mMainThreadReady;
+	StartupReport				 mReport;
+	double						 mSecondsPerCount;
+};
@@ -1,51 +1,171 @@
 #include "pch.h"
 #include "StrangeEngine.h"
+#include "Log.h"
 #include "Input.h"
+#include "AssetStreamer.h"
+#include "DebugDraw.h"
+#include "HotReload.h"
+#include "JobSystem.h"
+#include "Memory.h"
+#include "MemoryTracking.h"
+#include "SystemScheduler.h"
+#include "Telemetry.h"
+#include <sstream>
 
-std::string gLastError = "no error set";
 GameTimer gTimer;
 
+// the engine's own telemetry counters, registered when it starts up
+struct EngineTelemetry
+{
+	UINT frameMs;
+	UINT drawCalls;
+	UINT memoryKB;
+	UINT gpuMemoryKB;
+	UINT allocations;
+	UINT frameMemoryKB;
+	UINT jobQueue;
+	UINT assetQueue;
+	UINT assetsInFlight;
+	UINT logDropped;
+};
+static EngineTelemetry gTelemetry;
 
 
 
-STRANGEENGINEMK3_API void StrangeEngine::StartEngine(void (*start)(), void (*update)(), void (*end)())
+
+STRANGEENGINEMK3_API void StrangeEngine::AddStartupTask(const StartupTaskDesc& task)
 {
-	std::cout << "StrangeEngineMK3 starting up\n";
+	mGameStartupTasks.push_back(task);
+}
+
+bool StrangeEngine::Startup(bool headless, bool parallel)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	mStartTicks = now.QuadPart;
+	mFirstFrameMs = 0.0;
+
+	// everything the engine logs this run ends up in StrangeEngine.slog too, StrangeEngineMK3_Tools decode reads it
+	LogSettings logSettings;
+	if (!headless)
+		logSettings.binaryPath = "StrangeEngine.slog";
+	else
+		logSettings.consoleLevel = LogLevel_Warning; // benchmarks and tools start headless over and over, only problems matter
+	Logger::Get()->Init(logSettings);
+	ClearEngineError();
+
+	LOG_INFO(LogCategory_Engine, "StrangeEngineMK3 starting up{}", headless ? " headless" : "");
+
+	// live counters for StrangeEngineMK3_Tools tail, headless runs publish them too
+	Telemetry* telemetry = Telemetry::Get();
+	gTelemetry.frameMs = telemetry->RegisterHistogram("frame.ms", 0.0f, 50.0f);
+	gTelemetry.drawCalls = telemetry->RegisterCounter("render.drawCalls", TelemetryCounter_PerFrame);
+	gTelemetry.memoryKB = telemetry->RegisterCounter("memory.liveKB", TelemetryCounter_Value);
+	gTelemetry.gpuMemoryKB = telemetry->RegisterCounter("memory.gpuKB", TelemetryCounter_Value);
+	gTelemetry.allocations = telemetry->RegisterCounter("memory.allocations", TelemetryCounter_Value);
+	gTelemetry.frameMemoryKB = telemetry->RegisterCounter("memory.frameKB", TelemetryCounter_Value);
+	gTelemetry.jobQueue = telemetry->RegisterCounter("jobs.queued", TelemetryCounter_Value);
+	gTelemetry.assetQueue = telemetry->RegisterCounter("assets.queued", TelemetryCounter_Value);
+	gTelemetry.assetsInFlight = telemetry->RegisterCounter("assets.inFlight", TelemetryCounter_Value);
+	gTelemetry.logDropped = telemetry->RegisterCounter("log.dropped", TelemetryCounter_Value);
+	telemetry->Open(L"StrangeEngine.telemetry");
+
+	// the startup tasks run on the job system, a headless run before this one will have shut it down
+	if (JobSystem::Get()->GetWorkerCount() == 0)
+		JobSystem::Get()->Init();
+
+	// and so will the streamer have been, it starts again with the same budget
+	AssetStreamer* streamer = AssetStreamer::Get();
+	if (!streamer->IsRunning())
+		streamer->Init(streamer->GetBudget(), streamer->GetMaxInFlight());
+
 	// Direct X 11 initialization
 	DirectX = new InitDirect3D(GetModuleHandle(0), this);
-	if (gLastError != "no error set")
+	if (HasEngineError())
+		return false;
+
+	// the device is made on a worker while the window opens, everything that touches the window or the immediate
+	// context stays on this thread. headless keeps the task names so the game's tasks can still come after them
+	InitDirect3D* d3d = DirectX;
+	mStartup.Clear();
+	mStartup.AddTask(StartupTaskDesc("memory", []() { return EngineMemory::Get()->IsInitialized() || EngineMemory::Get()->Init(); }));
+	mStartup.AddTask(StartupTaskDesc("window", [d3d, headless]() { return headless || d3d->InitMainWindow(); }).OnMainThread());
+	mStartup.AddTask(StartupTaskDesc("device", [d3d]() { return d3d->CreateDeviceAndContext(); }));
+	mStartup.AddTask(StartupTaskDesc("msaa", [d3d]() { d3d->Check4xMSAAQualitySupport(); return true; }).After("device"));
+	mStartup.AddTask(StartupTaskDesc("debug draw", [d3d]() { return DebugDraw::Get()->CreateRenderer(d3d->md3dDevice); }).After("device"));
+	mStartup.AddTask(StartupTaskDesc("swap chain", [d3d, headless]() { return headless || d3d->DescribeSwapChain(); })
+		.After("window").After("msaa").OnMainThread());
+	mStartup.AddTask(StartupTaskDesc("render target", [d3d, headless]()
 	{
-		MessageBoxA(DirectX->mHMainWindow, gLastError.c_str(), NULL, MB_OK);
-		return;
-	}
-	DirectX->InitMainWindow();
-	if (!DirectX->CreateDeviceAndContext())
+		if (!headless)
+			d3d->CreateRenderTargetView();
+		return true;
+	}).After("swap chain").OnMainThread());
+	// after the window, its first WM_SIZE sets the size the depth buffer is made at
+	mStartup.AddTask(StartupTaskDesc("depth buffer", [d3d]() { return d3d->CreateDepthBuffer(); }).After("window").After("msaa"));
+	mStartup.AddTask(StartupTaskDesc("output merger", [d3d, headless]()
 	{
-		MessageBoxA(DirectX->mHMainWindow, gLastError.c_str(), NULL, MB_OK);
-		return;
-	}
-	DirectX->Check4xMSAAQualitySupport();
-	if (!DirectX->DescribeSwapChain())
+		if (!headless)
+			d3d->BindViewsToOutputMergerStage();
+		return true;
+	}).After("render target").After("depth buffer").OnMainThread());
+	mStartup.AddTask(StartupTaskDesc("viewport", [d3d, headless]()
 	{
-		MessageBoxA(DirectX->mHMainWindow, gLastError.c_str(), NULL, MB_OK);
-		return;
-	}
-	DirectX->CreateRenderTargetView();
-	if (!DirectX->CreateDepthBuffer())
+		if (!headless)
+			d3d->SetViewport();
+		return true;
+	}).After("output merger").OnMainThread());
+
+	for (const StartupTaskDesc& task : mGameStartupTasks)
+		mStartup.AddTask(task);
+
+	bool succeeded = mStartup.Run(parallel);
+	mStartup.LogReport();
+	return succeeded;
+}
+
+STRANGEENGINEMK3_API void StrangeEngine::StartEngine(void (*start)(), void (*update)(), void (*end)())
+{
+	if (!Startup(false, true))
 	{
-		MessageBoxA(DirectX->mHMainWindow, gLastError.c_str(), NULL, MB_OK);
+		MessageBoxA(DirectX ? DirectX->mHMainWindow : NULL, HasEngineError() ? GetEngineError().message.c_str() : "StrangeEngine failed to start", NULL, MB_OK);
+		// whatever did come up still gets taken down, and the log gets its last lines
+		StopEngine();
 		return;
 	}
-	DirectX->BindViewsToOutputMergerStage();
-	DirectX->SetViewport();
 
-	std::cout << "StrangeEngineMK3 startup complete\n====================\n";
+	LOG_INFO(LogCategory_Engine, "StrangeEngineMK3 startup complete");
 
 	// runtime
 	Run(start,update,end);
 
 }
 
+STRANGEENGINEMK3_API bool StrangeEngine::StartHeadless(void (*start)(), void (*update)(), bool parallel, UINT frames)
+{
+	bool succeeded = Startup(true, parallel);
+	if (succeeded)
+	{
+		gTimer.Reset();
+		if (start)
+			start();
+		for (UINT i = 0; i < frames; i++)
+		{
+			Frame(update);
+
+			// nothing draws it, but it still starts over every frame
+			DebugDraw::Get()->Render(nullptr, 0, 0);
+
+			// there is nothing to present, the frame is done once the GPU has been handed everything
+			DirectX->md3dImmediateContext->Flush();
+			FirstFrameDone();
+		}
+	}
+
+	StopEngine();
+	return succeeded;
+}
+
 int StrangeEngine::Run(void (*start)(), void (*update)(), void (*end)())
 {
 	MSG msg = { 0 };
@@ -63,9 +183,7 @@ int StrangeEngine::Run(void (*start)(), void (*update)(), void (*end)())
 		// Otherwise, do animation/game stuff.
 		else
 		{
-			gTimer.Tick();
-
-			update();
+			Frame(update);
 
 			if (!DirectX->mAppPaused)
 			{
@@ -76,9 +194,12 @@ int StrangeEngine::Run(void (*start)(), void (*update)(), void (*end)())
 				
 
 				DirectX->DrawScene();
+				FirstFrameDone();
 			}
 			else
 			{
+				// nothing is drawn while paused, what was recorded mustn't pile up
+				DebugDraw::Get()->Render(nullptr, 0, 0);
 				Sleep(100);
 			}
 		}
@@ -87,9 +208,117 @@ int StrangeEngine::Run(void (*start)(), void (*update)(), void (*end)())
 	return (int)msg.wParam;
 }
 
+void StrangeEngine::Frame(void (*update)())
+{
+	gTimer.Tick();
+
+	// the frame that just ended, before anything in this one changes the numbers
+	PublishTelemetry();
+
+	// frame memory from the frame before last is given back, everything after this can allocate from it
+	EngineMemory::Get()->NewFrame();
+	MemoryTracker::Get()->NewFrame();
+
+	// re-cooked assets are swapped in here, between frames, never while the game is using them
+	HotReloader::Get()->Update();
+
+	// loads that finished since last frame become ready before the game looks at them
+	AssetStreamer::Get()->Update();
+
+	// registered systems, input through render prep, then the game's own update
+	SystemScheduler::Get()->RunFrame(gTimer.DeltaTime());
+
+	if (update)
+		update();
+
+	// after the game, so the overlay has this frame's timings. it is drawn at the end of DrawScene
+	DebugDraw* debugDraw = DebugDraw::Get();
+	if (debugDraw->IsStatsVisible())
+		debugDraw->AddStatsOverlay(10.0f, 10.0f);
+}
+
+void StrangeEngine::PublishTelemetry()
+{
+	Telemetry* telemetry = Telemetry::Get();
+	telemetry->Record(gTelemetry.frameMs, gTimer.DeltaTime() * 1000.0f);
+
+	INT64 liveBytes = 0, gpuBytes = 0, allocations = 0;
+	for (UINT tag = 0; tag < MemoryTag_Count; tag++)
+	{
+		MemoryTagStats stats = MemoryTracker::Get()->GetStats((MemoryTag)tag);
+		liveBytes += stats.liveBytes;
+		gpuBytes += stats.gpuLiveBytes;
+		allocations += (INT64)stats.frameAllocations;
+	}
+	telemetry->Set(gTelemetry.memoryKB, liveBytes / 1024);
+	telemetry->Set(gTelemetry.gpuMemoryKB, gpuBytes / 1024);
+	telemetry->Set(gTelemetry.allocations, allocations);
+	telemetry->Set(gTelemetry.frameMemoryKB, (INT64)(EngineMemory::Get()->GetStats().frameUsed / 1024));
+
+	AssetStreamingStats assets = AssetStreamer::Get()->GetStats();
+	telemetry->Set(gTelemetry.jobQueue, (INT64)JobSystem::Get()->GetQueueDepth());
+	telemetry->Set(gTelemetry.assetQueue, assets.queueDepth);
+	telemetry->Set(gTelemetry.assetsInFlight, assets.inFlight);
+	telemetry->Set(gTelemetry.logDropped, (INT64)Logger::Get()->GetDroppedCount());
+	if (DirectX)
+		telemetry->Add(gTelemetry.drawCalls, DirectX->mRenderContext.GetDrawCalls());
+
+	telemetry->Publish();
+}
+
+void StrangeEngine::FirstFrameDone()
+{
+	if (mFirstFrameMs != 0.0)
+		return;
+
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	mFirstFrameMs = (now.QuadPart - mStartTicks) * 1000.0 / (double)frequency.QuadPart;
+	LOG_INFO(LogCategory_Engine, "first frame done {} ms after starting up", mFirstFrameMs);
+}
+
+STRANGEENGINEMK3_API bool StrangeEngine::CaptureFrames(const std::wstring& path, UINT frames)
+{
+	// headless runs never get to DrawScene, nothing would ever be captured
+	if (!DirectX || !DirectX->mSwapChain)
+	{
+		ReportError(LogCategory_Render, "There is no window to capture frames from");
+		return false;
+	}
+	return DirectX->mRenderContext.StartCapture(path, frames);
+}
+
 void StrangeEngine::StopEngine()
 {
-	std::cout << "\n====================\nApplication closed, shutting down engine\n";
+	LOG_INFO(LogCategory_Engine, "Application closed, shutting down engine");
+	// the streamer hands its last decodes to the job system, so it has to stop first
+	// and the hot reloader cooks on the job system and reloads through the streamer, so it goes before both
+	HotReloader::Get()->Stop();
+	AssetStreamer::Get()->Shutdown();
+	JobSystem::Get()->Shutdown();
+	// a tail still running keeps showing the last frame
+	Telemetry::Get()->Close();
+	// nothing is running that could still hold frame, scratch or heap memory
+	EngineMemory::Get()->Shutdown();
+	DebugDraw::Get()->ReleaseRenderer();
 	delete DirectX;
 	DirectX = nullptr;
+
+	// everything has been given back by now, whatever the tracker still counts is a leak
+	#if defined(DEBUG)||defined(_DEBUG)
+	std::ostringstream report;
+	bool clean = MemoryTracker::Get()->WriteReport(report);
+	std::istringstream lines(report.str());
+	for (std::string line; std::getline(lines, line);)
+	{
+		if (clean)
+			LOG_INFO(LogCategory_Memory, "{}", line);
+		else
+			LOG_WARNING(LogCategory_Memory, "{}", line);
+	}
+	#endif
+
+	// last, so everything above still gets logged
+	Logger::Get()->Shutdown();
 }
@@ -3,6 +3,8 @@
 #include "Common.h"
 #include <iostream>
 #include "InitDirect3D.h"
+#include "Startup.h"
+#include <vector>
 
 #ifdef STRANGEENGINEMK3_EXPORTS
 #define STRANGEENGINEMK3_API __declspec(dllexport)
@@ -16,8 +18,40 @@ class StrangeEngine
 public:
 	InitDirect3D* DirectX;
 
+	StrangeEngine() : DirectX(nullptr), mStartTicks(0), mFirstFrameMs(0.0) {}
+
+	// extra work for startup (preloading, indexing assets...), run alongside the engine's own tasks
+	// 'after' can name engine tasks: "memory", "window", "device", "msaa", "debug draw", "swap chain", "render target",
+	// "depth buffer", "output merger" and "viewport". call it before StartEngine
+	STRANGEENGINEMK3_API void AddStartupTask(const StartupTaskDesc& task);
+
 	STRANGEENGINEMK3_API void StartEngine(void (*start)(), void (*update)(), void (*end)());
+	// starts everything except the window and what draws to it, runs start() and 'frames' frames of update(), then
+	// shuts down again. for benchmarks and tools, false if startup failed
+	STRANGEENGINEMK3_API bool StartHeadless(void (*start)(), void (*update)(), bool parallel = true, UINT frames = 1);
 	int Run(void (*start)(), void (*update)(), void (*end)());
 	void StopEngine();
+
+	// how the last startup went, and the time from StartEngine/StartHeadless to the end of the first frame
+	const StartupReport& GetStartupReport() const { return mStartup.GetReport(); }
+	double GetTimeToFirstFrameMs() const { return mFirstFrameMs; }
+
+	// writes everything the next 'frames' frames submit to 'path', for StrangeEngineMK3_Tools replay. false when
+	// there is no device to capture from (headless runs draw nothing) or a capture is already running
+	STRANGEENGINEMK3_API bool CaptureFrames(const std::wstring& path, UINT frames);
+
+private:
+	// the engine's startup tasks plus the game's. headless leaves out the window and swap chain work
+	bool Startup(bool headless, bool parallel);
+	// everything Run does once a frame besides the message pump
+	void Frame(void (*update)());
+	// samples the engine's counters for the frame that just ended and publishes them
+	void PublishTelemetry();
+	void FirstFrameDone();
+
+	std::vector<StartupTaskDesc> mGameStartupTasks;
+	StartupGraph				 mStartup;
+	LONGLONG					 mStartTicks;
+	double						 mFirstFrameMs; // 0 until the first frame is done
 };
 
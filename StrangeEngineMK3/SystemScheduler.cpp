@@ -0,0 +1,313 @@
+#include "pch.h"
+#include "SystemScheduler.h"
+#include "GraphReport.h"
+#include "Log.h"
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <climits>
+
+// gives the singleton an initial value to clear up any unresolved externals
+SystemScheduler* SystemScheduler::singleton = nullptr;
+
+static std::once_flag gSystemSchedulerOnce;
+
+const char* GetFramePhaseName(FramePhase phase)
+{
+	static const char* names[FramePhase_Count] = { "input", "simulation", "animation", "culling", "render prep" };
+	return (phase >= 0 && phase < FramePhase_Count) ? names[phase] : "unknown";
+}
+
+SystemScheduler* SystemScheduler::Get()
+{
+	// never deleted, same as the job system
+	std::call_once(gSystemSchedulerOnce, []()
+	{
+		singleton = new SystemScheduler();
+	});
+	return singleton;
+}
+
+SystemScheduler::SystemScheduler()
+{
+	mNextSystemId = 1;
+	mGraphDirty = true;
+	mNodeCount = 0;
+	mDeltaTime = 0.0f;
+	mFinished = 0;
+
+	mReport.frameMs = 0.0;
+	mReport.totalSystemMs = 0.0;
+	mReport.criticalPathMs = 0.0;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mSecondsPerCount = 1.0 / (double)frequency.QuadPart;
+}
+
+SystemScheduler::~SystemScheduler()
+{
+	for (System* system : mSystems)
+		delete system;
+}
+
+UINT SystemScheduler::AddSystem(const SystemDesc& desc)
+{
+	System* system = new System();
+	system->id = mNextSystemId++;
+	system->desc = desc;
+	system->enabled = true;
+	system->averageMs = 0.0;
+
+	for (const std::string& resource : desc.reads)
+		system->reads.push_back(GetResourceId(resource));
+	for (const std::string& resource : desc.writes)
+		system->writes.push_back(GetResourceId(resource));
+
+	// writing something covers reading it too
+	std::sort(system->writes.begin(), system->writes.end());
+	system->writes.erase(std::unique(system->writes.begin(), system->writes.end()), system->writes.end());
+	std::sort(system->reads.begin(), system->reads.end());
+	system->reads.erase(std::unique(system->reads.begin(), system->reads.end()), system->reads.end());
+	system->reads.erase(std::remove_if(system->reads.begin(), system->reads.end(), [system](UINT resource)
+	{
+		return std::binary_search(system->writes.begin(), system->writes.end(), resource);
+	}), system->reads.end());
+
+	mSystems.push_back(system);
+	mGraphDirty = true;
+	return system->id;
+}
+
+void SystemScheduler::RemoveSystem(UINT id)
+{
+	for (size_t i = 0; i < mSystems.size(); i++)
+	{
+		if (mSystems[i]->id != id)
+			continue;
+		delete mSystems[i];
+		mSystems.erase(mSystems.begin() + i);
+		mGraphDirty = true;
+		return;
+	}
+}
+
+void SystemScheduler::SetEnabled(UINT id, bool enabled)
+{
+	for (System* system : mSystems)
+	{
+		if (system->id == id && system->enabled != enabled)
+		{
+			system->enabled = enabled;
+			mGraphDirty = true;
+		}
+	}
+}
+
+UINT SystemScheduler::GetResourceId(const std::string& name)
+{
+	auto found = mResourceIds.find(name);
+	if (found != mResourceIds.end())
+		return found->second;
+
+	UINT id = (UINT)mResourceIds.size();
+	mResourceIds[name] = id;
+	return id;
+}
+
+// both lists are sorted
+static bool SharesResource(const std::vector<UINT>& first, const std::vector<UINT>& second)
+{
+	size_t i = 0, j = 0;
+	while (i < first.size() && j < second.size())
+	{
+		if (first[i] == second[j])
+			return true;
+		if (first[i] < second[j])
+			i++;
+		else
+			j++;
+	}
+	return false;
+}
+
+bool SystemScheduler::Conflicts(const System& first, const System& second)
+{
+	return SharesResource(first.writes, second.writes) || SharesResource(first.writes, second.reads)
+		|| SharesResource(first.reads, second.writes);
+}
+
+void SystemScheduler::BuildGraph()
+{
+	std::vector<System*> order;
+	for (int phase = 0; phase < FramePhase_Count; phase++)
+	{
+		for (System* system : mSystems)
+		{
+			if (system->enabled && system->desc.phase == phase)
+				order.push_back(system);
+		}
+	}
+
+	// every system waits on each earlier one it conflicts with, so the order in 'order' is always a valid one
+	mNodeCount = (UINT)order.size();
+	mNodes.reset(mNodeCount > 0 ? new Node[mNodeCount] : nullptr);
+	for (UINT i = 0; i < mNodeCount; i++)
+	{
+		mNodes[i].system = order[i];
+		for (UINT j = 0; j < i; j++)
+		{
+			if (Conflicts(*order[j], *order[i]))
+			{
+				mNodes[j].successors.push_back(i);
+				mNodes[i].predecessors.push_back(j);
+			}
+		}
+	}
+
+	mGraphDirty = false;
+}
+
+void SystemScheduler::RunFrame(float deltaTime)
+{
+	if (mGraphDirty)
+		BuildGraph();
+
+	LARGE_INTEGER frameStart;
+	QueryPerformanceCounter(&frameStart);
+
+	mDeltaTime = deltaTime;
+	mFinished.store(0, std::memory_order_relaxed);
+	for (UINT i = 0; i < mNodeCount; i++)
+		mNodes[i].remaining.store((int)mNodes[i].predecessors.size(), std::memory_order_relaxed);
+
+	for (UINT i = 0; i < mNodeCount; i++)
+	{
+		if (mNodes[i].predecessors.empty())
+			Dispatch(i);
+	}
+
+	// this thread runs the main thread systems as they become ready and helps with everything else in between
+	while (mFinished.load(std::memory_order_acquire) < mNodeCount)
+	{
+		UINT node = UINT_MAX;
+		{
+			std::lock_guard<std::mutex> lock(mMainThreadMutex);
+			if (!mMainThreadReady.empty())
+			{
+				node = mMainThreadReady.back();
+				mMainThreadReady.pop_back();
+			}
+		}
+
+		if (node != UINT_MAX)
+			RunNode(node);
+		else if (!JobSystem::Get()->TryRunOne())
+			std::this_thread::yield();
+	}
+
+	LARGE_INTEGER frameEnd;
+	QueryPerformanceCounter(&frameEnd);
+	BuildReport(frameStart.QuadPart, frameEnd.QuadPart);
+}
+
+void SystemScheduler::Dispatch(UINT node)
+{
+	if (mNodes[node].system->desc.mainThread)
+	{
+		std::lock_guard<std::mutex> lock(mMainThreadMutex);
+		mMainThreadReady.push_back(node);
+		return;
+	}
+
+	JobSystem::Get()->Run([this, node]() { RunNode(node); });
+}
+
+void SystemScheduler::RunNode(UINT index)
+{
+	Node& node = mNodes[index];
+	node.thread = JobSystem::GetThreadIndex();
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	node.system->desc.run(mDeltaTime);
+	QueryPerformanceCounter(&end);
+	node.start = start.QuadPart;
+	node.end = end.QuadPart;
+
+	for (UINT successor : node.successors)
+	{
+		if (mNodes[successor].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			Dispatch(successor);
+	}
+
+	// last, RunFrame may return as soon as this lands
+	mFinished.fetch_add(1, std::memory_order_release);
+}
+
+void SystemScheduler::BuildReport(LONGLONG frameStart, LONGLONG frameEnd)
+{
+	mReport.frameMs = (frameEnd - frameStart) * mSecondsPerCount * 1000.0;
+	mReport.totalSystemMs = 0.0;
+	mReport.criticalPathMs = 0.0;
+	mReport.criticalPath.clear();
+	mReport.systems.resize(mNodeCount);
+
+	std::vector<double> systemMs(mNodeCount);
+	for (UINT i = 0; i < mNodeCount; i++)
+	{
+		Node& node = mNodes[i];
+		System* system = node.system;
+		double ms = (node.end - node.start) * mSecondsPerCount * 1000.0;
+		system->averageMs = (system->averageMs == 0.0) ? ms : system->averageMs * 0.95 + ms * 0.05;
+		mReport.totalSystemMs += ms;
+		systemMs[i] = ms;
+
+		SystemTiming& timing = mReport.systems[i];
+		timing.id = system->id;
+		timing.name = system->desc.name;
+		timing.phase = system->desc.phase;
+		timing.startMs = (node.start - frameStart) * mSecondsPerCount * 1000.0;
+		timing.lastMs = ms;
+		timing.averageMs = system->averageMs;
+		timing.thread = node.thread;
+		timing.critical = false;
+	}
+
+	// the longest chain through the graph by this frame's costs, what the frame would take with unlimited threads
+	// predecessors always come earlier in mNodes, so they are already in order
+	std::vector<UINT> chain;
+	mReport.criticalPathMs = FindCriticalPath(mNodes.get(), nullptr, mNodeCount, systemMs, &chain);
+	for (UINT i : chain)
+	{
+		mReport.systems[i].critical = true;
+		mReport.criticalPath.push_back(mReport.systems[i].id);
+	}
+}
+
+void SystemScheduler::PrintReport() const
+{
+	// a line at a time through the logger, so the table lands in the .slog with everything else
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(3)
+		<< "frame " << mReport.frameMs << " ms, systems " << mReport.totalSystemMs << " ms, critical path "
+		<< mReport.criticalPathMs << " ms (* below)";
+	LOG_INFO(LogCategory_Engine, "{}", line.str());
+
+	static const ReportColumn columns[] =
+	{
+		{ "phase", 13, true },
+		{ "system", 24, true },
+		{ "start", 10, false },
+		{ "ms", 10, false },
+		{ "avg ms", 10, false },
+		{ "thread", 8, false },
+	};
+	ReportTable table(LogCategory_Engine, columns, sizeof(columns) / sizeof(columns[0]));
+	table.LogTitles();
+	for (const SystemTiming& timing : mReport.systems)
+	{
+		table << GetFramePhaseName(timing.phase) << timing.name << timing.startMs << timing.lastMs << timing.averageMs << timing.thread;
+		table.LogRow(timing.critical ? " *" : "");
+	}
+}
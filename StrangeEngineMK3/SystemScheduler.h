@@ -0,0 +1,153 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include "JobSystem.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// the parts of a frame, in order. a system only waits for the systems before it that it actually conflicts with,
+// so something in a later phase that touches nothing earlier systems write can start straight away
+enum FramePhase
+{
+	FramePhase_Input,
+	FramePhase_Simulation,
+	FramePhase_Animation,
+	FramePhase_Culling,
+	FramePhase_RenderPrep,
+	FramePhase_Count,
+};
+
+STRANGEENGINEMK3_API const char* GetFramePhaseName(FramePhase phase);
+
+// what a system is and which resources it touches
+// a resource is just a name ("Transforms", "PhysicsWorld"...), two systems conflict when one writes something the
+// other reads or writes. anything a system touches and doesn't declare is a data race waiting to happen
+struct SystemDesc
+{
+	std::string				   name;
+	FramePhase				   phase;
+	std::function<void(float)> run; // called with the frame's delta time
+	std::vector<std::string>   reads;
+	std::vector<std::string>   writes;
+	bool					   mainThread; // e.g. anything using the immediate context, always runs on the thread calling RunFrame
+
+	SystemDesc() : phase(FramePhase_Simulation), mainThread(false) {}
+	SystemDesc(const std::string& name, FramePhase phase, std::function<void(float)> run)
+		: name(name), phase(phase), run(run), mainThread(false) {}
+
+	SystemDesc& Reads(const std::string& resource) { reads.push_back(resource); return *this; }
+	SystemDesc& Writes(const std::string& resource) { writes.push_back(resource); return *this; }
+	SystemDesc& OnMainThread() { mainThread = true; return *this; }
+
+	// ECS components as resources, const T and T are the same component
+	template<typename T> SystemDesc& ReadsComponent() { return Reads(typeid(typename std::remove_const<T>::type).name()); }
+	template<typename T> SystemDesc& WritesComponent() { return Writes(typeid(typename std::remove_const<T>::type).name()); }
+};
+
+struct SystemTiming
+{
+	UINT		 id;
+	std::string	 name;
+	FramePhase	 phase;
+	double		 startMs;	// from the start of the frame
+	double		 lastMs;
+	double		 averageMs; // smoothed over the last few dozen frames
+	unsigned int thread;	// JobSystem::GetThreadIndex() of the thread it ran on, 0 is the main thread
+	bool		 critical;	// on the critical path this frame
+};
+
+struct SchedulerReport
+{
+	double					  frameMs;		  // RunFrame start to finish
+	double					  totalSystemMs;  // every system's time added up, what one thread would have taken
+	double					  criticalPathMs; // the longest chain of systems that had to wait for each other
+	std::vector<UINT>		  criticalPath;	  // system ids along that chain, first to last
+	std::vector<SystemTiming> systems;		  // in phase order
+};
+
+// runs the game's systems once a frame, with systems that don't conflict running at the same time on the job system
+// StrangeEngine::Run calls RunFrame() before the game's update(), the rest is meant to be called from the main thread
+class STRANGEENGINEMK3_API SystemScheduler
+{
+public:
+	static SystemScheduler* Get();
+
+	// returns an id for RemoveSystem()/SetEnabled(). systems in the same phase that conflict run in the order they were added
+	UINT AddSystem(const SystemDesc& desc);
+	void RemoveSystem(UINT id);
+	void SetEnabled(UINT id, bool enabled);
+
+	// runs every enabled system and returns once they have all finished
+	void RunFrame(float deltaTime);
+
+	// timings from the last RunFrame()
+	const SchedulerReport& GetReport() const { return mReport; }
+	void PrintReport() const;
+
+private:
+	SystemScheduler();
+	~SystemScheduler();
+
+	struct System
+	{
+		UINT					   id;
+		SystemDesc				   desc;
+		std::vector<UINT>		   reads; // resource ids, sorted
+		std::vector<UINT>		   writes;
+		bool					   enabled;
+		double					   averageMs;
+	};
+
+	// one per enabled system while a frame runs, indices into mNodes
+	struct Node
+	{
+		System*			  system;
+		std::vector<UINT> successors;
+		std::vector<UINT> predecessors;
+		std::atomic<int>  remaining; // predecessors that haven't finished this frame
+		LONGLONG		  start;
+		LONGLONG		  end;
+		unsigned int	  thread;
+	};
+
+	UINT GetResourceId(const std::string& name);
+	static bool Conflicts(const System& first, const System& second);
+
+	void BuildGraph();
+	void Dispatch(UINT node);
+	void RunNode(UINT node);
+	void BuildReport(LONGLONG frameStart, LONGLONG frameEnd);
+
+	static SystemScheduler* singleton;
+
+	std::vector<System*>				  mSystems; // in the order they were added
+	std::unordered_map<std::string, UINT> mResourceIds;
+	UINT								  mNextSystemId;
+
+	// rebuilt whenever a system is added, removed, enabled or disabled
+	bool					 mGraphDirty;
+	std::unique_ptr<Node[]>	 mNodes;
+	UINT					 mNodeCount;
+
+	// the frame being run
+	float				 mDeltaTime;
+	std::atomic<UINT>	 mFinished;
+	std::mutex			 mMainThreadMutex;
+	std::vector<UINT>	 mMainThreadReady;
+
+	SchedulerReport mReport;
+	double			mSecondsPerCount;
+};
@@ -0,0 +1,488 @@
+#include "pch.h"
+#include "Telemetry.h"
+#include "Log.h"
+#include <climits>
+#include <cstring>
+
+Telemetry* Telemetry::singleton = nullptr;
+
+static std::once_flag gTelemetryOnce;
+
+// ==============================================================
+//		file layout
+// ==============================================================
+
+// the header, then kTelemetryRingFrames slots. the engine and the reader are built from the same source, so both
+// sides just cast the mapped memory to these
+static const char kTelemetryMagic[4] = { 'S', 'T', 'E', 'L' };
+static const UINT kTelemetryVersion = 1;
+
+struct TelemetryFileHeader
+{
+	char			  magic[4];
+	UINT			  version;
+	UINT			  slotBytes;
+	UINT			  ringFrames;
+	UINT			  session;		   // one more every Open(), a reader still mapping the file sees the engine restart
+	std::atomic<UINT> counterCount;	   // names up to here are filled in
+	std::atomic<UINT> histogramCount;
+	std::atomic<UINT> framesPublished;
+	UINT			  kinds[kTelemetryMaxCounters];
+	char			  counterNames[kTelemetryMaxCounters][kTelemetryNameLength];
+	char			  histogramNames[kTelemetryMaxHistograms][kTelemetryNameLength];
+	float			  histogramRanges[kTelemetryMaxHistograms][2];
+};
+
+// a seqlock: the sequence is odd while the engine writes the slot and 2 * frame + 2 once it is done, a reader copies
+// the slot and keeps the copy only if the sequence was the same (and even) before and after
+struct TelemetrySlot
+{
+	std::atomic<UINT> sequence;
+	TelemetryFrame	  frame;
+};
+
+static_assert(sizeof(std::atomic<UINT>) == sizeof(UINT), "the sequence numbers are shared with another process");
+
+static const size_t kTelemetryFileBytes = sizeof(TelemetryFileHeader) + sizeof(TelemetrySlot) * kTelemetryRingFrames;
+
+static TelemetrySlot* GetSlot(BYTE* view, UINT frame)
+{
+	return (TelemetrySlot*)(view + sizeof(TelemetryFileHeader)) + frame % kTelemetryRingFrames;
+}
+
+float GetTelemetryPercentile(const TelemetryHistogram& histogram, float rangeMin, float rangeMax, float fraction)
+{
+	if (histogram.count == 0)
+		return 0.0f;
+
+	// the bucket the sample lands in, then how far into it by assuming its samples are spread evenly
+	float target = fraction * histogram.count;
+	float bucketWidth = (rangeMax - rangeMin) / kTelemetryBuckets;
+	UINT below = 0;
+	for (UINT i = 0; i < kTelemetryBuckets; i++)
+	{
+		UINT inBucket = histogram.buckets[i];
+		if (inBucket > 0 && below + inBucket >= target)
+		{
+			float value = rangeMin + (i + (target - below) / inBucket) * bucketWidth;
+			return value < histogram.minValue ? histogram.minValue : value > histogram.maxValue ? histogram.maxValue : value;
+		}
+		below += inBucket;
+	}
+	return histogram.maxValue;
+}
+
+
+// ==============================================================
+//		writing
+// ==============================================================
+
+Telemetry* Telemetry::Get()
+{
+	// gives the singleton an initial value, never deleted so counters can be touched while the DLL unloads
+	std::call_once(gTelemetryOnce, []()
+	{
+		singleton = new Telemetry();
+	});
+	return singleton;
+}
+
+Telemetry::Telemetry()
+{
+	mCounterCount = 0;
+	mHistogramCount = 0;
+	memset(mCounterNames, 0, sizeof(mCounterNames));
+	memset(mHistogramNames, 0, sizeof(mHistogramNames));
+	memset(mHistograms, 0, sizeof(mHistograms));
+	memset(&mLastFrame, 0, sizeof(mLastFrame));
+	for (UINT i = 0; i < kTelemetryMaxCounters; i++)
+	{
+		mKinds[i] = TelemetryCounter_Value;
+		mValues[i] = 0;
+	}
+	for (UINT i = 0; i < kTelemetryMaxHistograms; i++)
+	{
+		mRanges[i].rangeMin = 0.0f;
+		mRanges[i].rangeMax = 1.0f;
+	}
+
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mView = nullptr;
+	mFrame = 0;
+	mOpenTicks = 0;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	mSecondsPerCount = 1.0 / (double)frequency.QuadPart;
+}
+
+Telemetry::~Telemetry()
+{
+	Close();
+}
+
+bool Telemetry::Open(const std::wstring& path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mView)
+		return true;
+
+	// a tail left running from the last session still has the file mapped, which stops it being truncated or
+	// replaced, so the file is reused as it is and the new session written over it
+	mFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Engine, "Could not open telemetry file {}", path);
+		return false;
+	}
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READWRITE, 0, (DWORD)kTelemetryFileBytes, nullptr);
+	if (mMapping != nullptr)
+		mView = (BYTE*)MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, kTelemetryFileBytes);
+	if (mView == nullptr)
+	{
+		ReportError(LogCategory_Engine, "Could not map telemetry file {}", path);
+		if (mMapping)
+			CloseHandle(mMapping);
+		CloseHandle(mFile);
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	TelemetryFileHeader* header = (TelemetryFileHeader*)mView;
+	UINT session = (memcmp(header->magic, kTelemetryMagic, sizeof(kTelemetryMagic)) == 0) ? header->session + 1 : 1;
+
+	// readers see no frames and no names while the header is rewritten, then the new session
+	header->framesPublished.store(0, std::memory_order_release);
+	header->counterCount.store(0, std::memory_order_release);
+	header->histogramCount.store(0, std::memory_order_release);
+	for (UINT i = 0; i < kTelemetryRingFrames; i++)
+		GetSlot(mView, i)->sequence.store(0, std::memory_order_relaxed);
+
+	memcpy(header->magic, kTelemetryMagic, sizeof(kTelemetryMagic));
+	header->version = kTelemetryVersion;
+	header->slotBytes = sizeof(TelemetrySlot);
+	header->ringFrames = kTelemetryRingFrames;
+	header->session = session;
+	WriteNames();
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	mOpenTicks = now.QuadPart;
+	mFrame = 0;
+
+	LOG_INFO(LogCategory_Engine, "telemetry is being published to {}", path);
+	return true;
+}
+
+void Telemetry::Close()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mView)
+	{
+		FlushViewOfFile(mView, 0);
+		UnmapViewOfFile(mView);
+		mView = nullptr;
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void Telemetry::WriteNames()
+{
+	if (!mView)
+		return;
+
+	TelemetryFileHeader* header = (TelemetryFileHeader*)mView;
+	UINT counters = mCounterCount.load(std::memory_order_relaxed);
+	for (UINT i = 0; i < counters; i++)
+	{
+		memcpy(header->counterNames[i], mCounterNames[i], kTelemetryNameLength);
+		header->kinds[i] = (UINT)mKinds[i];
+	}
+	for (UINT i = 0; i < mHistogramCount; i++)
+	{
+		memcpy(header->histogramNames[i], mHistogramNames[i], kTelemetryNameLength);
+		header->histogramRanges[i][0] = mRanges[i].rangeMin;
+		header->histogramRanges[i][1] = mRanges[i].rangeMax;
+	}
+
+	// the counts last, a reader never sees a name that isn't all there
+	header->counterCount.store(counters, std::memory_order_release);
+	header->histogramCount.store(mHistogramCount, std::memory_order_release);
+}
+
+UINT Telemetry::RegisterCounter(const char* name, TelemetryCounterKind kind)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	UINT count = mCounterCount.load(std::memory_order_relaxed);
+	for (UINT i = 0; i < count; i++)
+	{
+		if (strncmp(mCounterNames[i], name, kTelemetryNameLength - 1) == 0)
+			return i;
+	}
+	if (count == kTelemetryMaxCounters)
+	{
+		LOG_WARNING(LogCategory_Engine, "no room for telemetry counter {}, there are already {}", name, count);
+		return UINT_MAX;
+	}
+
+	strncpy(mCounterNames[count], name, kTelemetryNameLength - 1);
+	mKinds[count] = kind;
+	mValues[count].store(0, std::memory_order_relaxed);
+	mCounterCount.store(count + 1, std::memory_order_release);
+	WriteNames();
+	return count;
+}
+
+UINT Telemetry::RegisterHistogram(const char* name, float rangeMin, float rangeMax)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (UINT i = 0; i < mHistogramCount; i++)
+	{
+		if (strncmp(mHistogramNames[i], name, kTelemetryNameLength - 1) == 0)
+			return i;
+	}
+	if (mHistogramCount == kTelemetryMaxHistograms)
+	{
+		LOG_WARNING(LogCategory_Engine, "no room for telemetry histogram {}, there are already {}", name, mHistogramCount);
+		return UINT_MAX;
+	}
+
+	UINT id = mHistogramCount++;
+	strncpy(mHistogramNames[id], name, kTelemetryNameLength - 1);
+	mRanges[id].rangeMin = rangeMin;
+	mRanges[id].rangeMax = rangeMax > rangeMin ? rangeMax : rangeMin + 1.0f;
+	memset(&mHistograms[id], 0, sizeof(TelemetryHistogram));
+	WriteNames();
+	return id;
+}
+
+void Telemetry::Set(UINT counter, INT64 value)
+{
+	if (counter < mCounterCount.load(std::memory_order_acquire))
+		mValues[counter].store(value, std::memory_order_relaxed);
+}
+
+void Telemetry::Add(UINT counter, INT64 value)
+{
+	if (counter < mCounterCount.load(std::memory_order_acquire))
+		mValues[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Telemetry::Record(UINT histogram, float value)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (histogram >= mHistogramCount)
+		return;
+
+	TelemetryHistogram& target = mHistograms[histogram];
+	const HistogramRange& range = mRanges[histogram];
+	int bucket = (int)((value - range.rangeMin) / (range.rangeMax - range.rangeMin) * kTelemetryBuckets);
+	bucket = bucket < 0 ? 0 : bucket >= (int)kTelemetryBuckets ? kTelemetryBuckets - 1 : bucket;
+	target.buckets[bucket]++;
+
+	if (target.count == 0 || value < target.minValue)
+		target.minValue = value;
+	if (target.count == 0 || value > target.maxValue)
+		target.maxValue = value;
+	target.sum += value;
+	target.count++;
+}
+
+void Telemetry::Publish()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	UINT counters = mCounterCount.load(std::memory_order_relaxed);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	mLastFrame.frame = mFrame;
+	mLastFrame.seconds = mView ? (now.QuadPart - mOpenTicks) * mSecondsPerCount : 0.0;
+	for (UINT i = 0; i < counters; i++)
+	{
+		mLastFrame.counters[i] = (mKinds[i] == TelemetryCounter_PerFrame) ? mValues[i].exchange(0, std::memory_order_relaxed)
+			: mValues[i].load(std::memory_order_relaxed);
+	}
+	memcpy(mLastFrame.histograms, mHistograms, sizeof(TelemetryHistogram) * mHistogramCount);
+	memset(mHistograms, 0, sizeof(mHistograms));
+
+	// nobody is reading, the frame still ends
+	if (!mView)
+		return;
+
+	TelemetrySlot* slot = GetSlot(mView, mFrame);
+	slot->sequence.store(2 * mFrame + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	TelemetryFrame& frame = slot->frame;
+	frame.frame = mLastFrame.frame;
+	frame.seconds = mLastFrame.seconds;
+	memcpy(frame.counters, mLastFrame.counters, sizeof(INT64) * counters);
+	memcpy(frame.histograms, mLastFrame.histograms, sizeof(TelemetryHistogram) * mHistogramCount);
+
+	slot->sequence.store(2 * mFrame + 2, std::memory_order_release);
+	mFrame++;
+	((TelemetryFileHeader*)mView)->framesPublished.store(mFrame, std::memory_order_release);
+}
+
+const char* Telemetry::GetCounterName(UINT counter) const
+{
+	return counter < GetCounterCount() ? mCounterNames[counter] : "";
+}
+
+void Telemetry::GetLastFrame(TelemetryFrame* out)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	*out = mLastFrame;
+}
+
+
+// ==============================================================
+//		reading
+// ==============================================================
+
+TelemetryReader::TelemetryReader()
+{
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mView = nullptr;
+}
+
+TelemetryReader::~TelemetryReader()
+{
+	Close();
+}
+
+bool TelemetryReader::Open(const std::wstring& path)
+{
+	Close();
+
+	// shared for writing, the engine has it open the whole time
+	mFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Engine, "Could not open telemetry file {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart < (LONGLONG)kTelemetryFileBytes)
+	{
+		ReportError(LogCategory_Engine, "{} is too small to be a telemetry file", path);
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != nullptr)
+		mView = (const BYTE*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, kTelemetryFileBytes);
+	if (mView == nullptr)
+	{
+		ReportError(LogCategory_Engine, "Could not map telemetry file {}", path);
+		Close();
+		return false;
+	}
+
+	const TelemetryFileHeader* header = (const TelemetryFileHeader*)mView;
+	if (memcmp(header->magic, kTelemetryMagic, sizeof(kTelemetryMagic)) != 0 || header->version != kTelemetryVersion ||
+		header->slotBytes != sizeof(TelemetrySlot) || header->ringFrames != kTelemetryRingFrames)
+	{
+		ReportError(LogCategory_Engine, "{} isn't a telemetry file from this version of the engine", path);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void TelemetryReader::Close()
+{
+	if (mView)
+	{
+		UnmapViewOfFile(mView);
+		mView = nullptr;
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+UINT TelemetryReader::GetSession() const
+{
+	return mView ? ((const TelemetryFileHeader*)mView)->session : 0;
+}
+
+UINT TelemetryReader::GetFramesPublished() const
+{
+	return mView ? ((const TelemetryFileHeader*)mView)->framesPublished.load(std::memory_order_acquire) : 0;
+}
+
+UINT TelemetryReader::GetCounterCount() const
+{
+	return mView ? ((const TelemetryFileHeader*)mView)->counterCount.load(std::memory_order_acquire) : 0;
+}
+
+const char* TelemetryReader::GetCounterName(UINT counter) const
+{
+	return counter < GetCounterCount() ? ((const TelemetryFileHeader*)mView)->counterNames[counter] : "";
+}
+
+TelemetryCounterKind TelemetryReader::GetCounterKind(UINT counter) const
+{
+	return counter < GetCounterCount() ? (TelemetryCounterKind)((const TelemetryFileHeader*)mView)->kinds[counter] : TelemetryCounter_Value;
+}
+
+UINT TelemetryReader::GetHistogramCount() const
+{
+	return mView ? ((const TelemetryFileHeader*)mView)->histogramCount.load(std::memory_order_acquire) : 0;
+}
+
+const char* TelemetryReader::GetHistogramName(UINT histogram) const
+{
+	return histogram < GetHistogramCount() ? ((const TelemetryFileHeader*)mView)->histogramNames[histogram] : "";
+}
+
+void TelemetryReader::GetHistogramRange(UINT histogram, float* rangeMin, float* rangeMax) const
+{
+	*rangeMin = 0.0f;
+	*rangeMax = 1.0f;
+	if (histogram < GetHistogramCount())
+	{
+		*rangeMin = ((const TelemetryFileHeader*)mView)->histogramRanges[histogram][0];
+		*rangeMax = ((const TelemetryFileHeader*)mView)->histogramRanges[histogram][1];
+	}
+}
+
+bool TelemetryReader::ReadFrame(UINT frame, TelemetryFrame* out) const
+{
+	if (!mView || frame >= GetFramesPublished())
+		return false;
+
+	const TelemetrySlot* slot = GetSlot((BYTE*)mView, frame);
+	UINT before = slot->sequence.load(std::memory_order_acquire);
+	if (before != 2 * frame + 2)
+		return false;
+
+	memcpy(out, &slot->frame, sizeof(TelemetryFrame));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot->sequence.load(std::memory_order_relaxed) == before;
+}
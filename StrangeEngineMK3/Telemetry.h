@@ -0,0 +1,156 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+static const UINT kTelemetryMaxCounters = 64;
+static const UINT kTelemetryMaxHistograms = 16;
+static const UINT kTelemetryBuckets = 32;
+static const UINT kTelemetryNameLength = 48;
+static const UINT kTelemetryRingFrames = 256; // a bit over 4 seconds at 60Hz for a reader to fall behind by
+
+enum TelemetryCounterKind
+{
+	TelemetryCounter_Value,	   // keeps whatever it was last set to, e.g. bytes in use or a queue's depth
+	TelemetryCounter_PerFrame  // goes back to 0 once a frame has been published, e.g. draw calls
+};
+
+struct TelemetryHistogram
+{
+	UINT  count;
+	float minValue;
+	float maxValue;
+	float sum;
+	UINT  buckets[kTelemetryBuckets]; // evenly over the range it was registered with, anything outside lands in the end ones
+};
+
+// one published frame
+struct TelemetryFrame
+{
+	UINT			   frame;
+	double			   seconds; // since the engine opened the file
+	INT64			   counters[kTelemetryMaxCounters];
+	TelemetryHistogram histograms[kTelemetryMaxHistograms];
+};
+
+// an estimate of the value 'fraction' (0.95 for the 95th percentile) of the samples are under, from the buckets
+STRANGEENGINEMK3_API float GetTelemetryPercentile(const TelemetryHistogram& histogram, float rangeMin, float rangeMax, float fraction);
+
+
+// ==============================================================
+//		writing
+// ==============================================================
+
+// live counters and histograms, published once a frame into a memory mapped file that another process can read while
+// the engine runs (StrangeEngineMK3_Tools tail). no network, no service, the reader never makes the engine wait
+class STRANGEENGINEMK3_API Telemetry
+{
+public:
+	static Telemetry* Get();
+
+	// StrangeEngine opens StrangeEngine.telemetry while it runs. counters registered before Open() are written in then
+	bool Open(const std::wstring& path);
+	void Close();
+	bool IsOpen() const { return mView != nullptr; }
+
+	// registering a name that is already there returns the same id, so code can look a counter up by registering it
+	// again. UINT_MAX once they have all been taken, the calls below ignore it
+	UINT RegisterCounter(const char* name, TelemetryCounterKind kind);
+	UINT RegisterHistogram(const char* name, float rangeMin, float rangeMax);
+
+	// counters from any thread, without a lock
+	void Set(UINT counter, INT64 value);
+	void Add(UINT counter, INT64 value);
+	// histograms take a lock, they are meant for a handful of samples a frame (not one per particle)
+	void Record(UINT histogram, float value);
+
+	// copies this frame's values into the next slot of the ring and starts the next frame
+	// StrangeEngine calls it once a frame
+	void Publish();
+
+	// for the engine's own overlay, the frame last published whether or not the file is open
+	UINT GetCounterCount() const { return mCounterCount.load(std::memory_order_acquire); }
+	const char* GetCounterName(UINT counter) const;
+	void GetLastFrame(TelemetryFrame* out);
+
+private:
+	Telemetry();
+	~Telemetry();
+
+	struct HistogramRange
+	{
+		float rangeMin;
+		float rangeMax;
+	};
+
+	// names, kinds and ranges into the mapped header, mMutex held
+	void WriteNames();
+
+	static Telemetry* singleton;
+
+	std::mutex			mMutex;
+	std::atomic<UINT>	mCounterCount;
+	UINT				mHistogramCount;
+	char				mCounterNames[kTelemetryMaxCounters][kTelemetryNameLength];
+	char				mHistogramNames[kTelemetryMaxHistograms][kTelemetryNameLength];
+	TelemetryCounterKind mKinds[kTelemetryMaxCounters];
+	std::atomic<INT64>	mValues[kTelemetryMaxCounters];
+	HistogramRange		mRanges[kTelemetryMaxHistograms];
+	TelemetryHistogram	mHistograms[kTelemetryMaxHistograms];
+	TelemetryFrame		mLastFrame;
+
+	HANDLE		mFile;
+	HANDLE		mMapping;
+	BYTE*		mView;
+	UINT		mFrame;
+	LONGLONG	mOpenTicks;
+	double		mSecondsPerCount;
+};
+
+
+// ==============================================================
+//		reading
+// ==============================================================
+
+// maps a telemetry file another process is writing, every call only reads
+class STRANGEENGINEMK3_API TelemetryReader
+{
+public:
+	TelemetryReader();
+	~TelemetryReader();
+
+	// false (and an engine error) if the file isn't there or isn't a telemetry file
+	bool Open(const std::wstring& path);
+	void Close();
+
+	// changes whenever the engine restarts and opens the file again, counters may have changed with it
+	UINT GetSession() const;
+	// frames published so far this session, the newest one is GetFramesPublished() - 1
+	UINT GetFramesPublished() const;
+
+	UINT				 GetCounterCount() const;
+	const char*			 GetCounterName(UINT counter) const;
+	TelemetryCounterKind GetCounterKind(UINT counter) const;
+	UINT				 GetHistogramCount() const;
+	const char*			 GetHistogramName(UINT histogram) const;
+	void				 GetHistogramRange(UINT histogram, float* rangeMin, float* rangeMax) const;
+
+	// false if the frame hasn't been published yet or the engine has already written over it
+	bool ReadFrame(UINT frame, TelemetryFrame* out) const;
+
+private:
+	TelemetryReader(const TelemetryReader&);
+	TelemetryReader& operator=(const TelemetryReader&);
+
+	HANDLE		mFile;
+	HANDLE		mMapping;
+	const BYTE* mView;
+};
@@ -0,0 +1,1499 @@
+#include "pch.h"
+#include "Terrain.h"
+#include "FileUtils.h"
+#include "ImageImport.h"
+#include "Log.h"
+#include "MemoryTracking.h"
+#include <d3dcompiler.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static const UINT kPatchVertices = TERRAIN_PATCH_CELLS + 1;
+static const UINT kPatchIndices = TERRAIN_PATCH_CELLS * TERRAIN_PATCH_CELLS * 6;
+static const UINT kTileSamples = TERRAIN_TILE_CELLS + 1;
+static const UINT kTileLod = 2;		  // TERRAIN_PATCH_CELLS << kTileLod == TERRAIN_TILE_CELLS, the biggest level drawn from tiles
+static const UINT kCoarseStride = 8;  // the vertex spacing of the first level after it, in samples
+static const UINT kMinLodCount = 4;	  // at least one level past the tiles, so the coarse texture is what a missing tile falls back on
+static const UINT kMaxLodCount = 16;
+static const UINT kCreateLodCount = 8;
+static const UINT kMaxPatches = 8192;
+static const UINT kMaxTileSlots = 2048; // D3D11's limit on array slices
+
+// every patch is the same grid, the instance moves it into place and picks the texture its heights come from
+static const char kTerrainShaders[] =
+	"cbuffer TerrainConstants : register(b0)\n"
+	"{\n"
+	"	row_major float4x4 viewProjection;\n"
+	"	float3 camera;\n"
+	"	float heightMin;\n"
+	"	float2 mapMax;\n"
+	"	float heightRange;\n"
+	"	float gridCells;\n"
+	"	float4 morph[16];\n"
+	"};\n"
+	"Texture2DArray tiles : register(t0);\n"
+	"Texture2D coarse : register(t1);\n"
+	"SamplerState heightSampler : register(s0);\n"
+	"struct PatchVertex\n"
+	"{\n"
+	"	float2 grid : POSITION;\n"
+	"	float2 origin : TEXCOORD0;\n"
+	"	float size : TEXCOORD1;\n"
+	"	uint lod : TEXCOORD2;\n"
+	"	float2 uvOffset : TEXCOORD3;\n"
+	"	float2 uvScale : TEXCOORD4;\n"
+	"	uint tile : TEXCOORD5;\n"
+	"};\n"
+	"struct TerrainPixel { float4 position : SV_Position; float3 world : TEXCOORD0; };\n"
+	"float3 PatchPosition(PatchVertex input, float2 grid)\n"
+	"{\n"
+	"	float cellSize = input.size / gridCells;\n"
+	"	grid = min(grid, (mapMax - input.origin) / cellSize);\n"
+	"	float2 uv = input.uvOffset + grid * input.uvScale;\n"
+	"	float height;\n"
+	"	if (input.tile == 0xffffffff)\n"
+	"		height = coarse.SampleLevel(heightSampler, uv, 0).r;\n"
+	"	else\n"
+	"		height = tiles.SampleLevel(heightSampler, float3(uv, input.tile), 0).r;\n"
+	"	float2 xz = input.origin + grid * cellSize;\n"
+	"	return float3(xz.x, heightMin + height * heightRange, xz.y);\n"
+	"}\n"
+	"TerrainPixel TerrainVS(PatchVertex input)\n"
+	"{\n"
+	"	float3 position = PatchPosition(input, input.grid);\n"
+	"	float morphK = saturate((distance(position, camera) - morph[input.lod].x) * morph[input.lod].y);\n"
+	"	float2 grid = input.grid - frac(input.grid * 0.5f) * 2.0f * morphK;\n"
+	"	position = PatchPosition(input, grid);\n"
+	"	TerrainPixel output;\n"
+	"	output.position = mul(float4(position, 1.0f), viewProjection);\n"
+	"	output.world = position;\n"
+	"	return output;\n"
+	"}\n"
+	"float4 TerrainPS(TerrainPixel input) : SV_Target\n"
+	"{\n"
+	"	float3 normal = normalize(cross(ddx(input.world), ddy(input.world)));\n"
+	"	float3 color = lerp(float3(0.45f, 0.4f, 0.35f), float3(0.3f, 0.5f, 0.2f), saturate((normal.y - 0.75f) * 5.0f));\n"
+	"	float light = saturate(dot(normal, normalize(float3(0.4f, 0.8f, 0.3f)))) * 0.8f + 0.2f;\n"
+	"	return float4(color * light, 1.0f);\n"
+	"}\n";
+
+// the layout of TerrainConstants
+struct TerrainConstants
+{
+	XMFLOAT4X4 viewProjection;
+	XMFLOAT3   camera;
+	float	   heightMin;
+	XMFLOAT2   mapMax;
+	float	   heightRange;
+	float	   gridCells;
+	XMFLOAT4   morph[16];
+};
+
+template<typename T> static void SafeRelease(T*& object)
+{
+	if (object)
+	{
+		object->Release();
+		object = nullptr;
+	}
+}
+
+static float DistanceToAabb(const XMFLOAT3& point, const Aabb& box)
+{
+	float dx = point.x - std::max(box.min.x, std::min(point.x, box.max.x));
+	float dy = point.y - std::max(box.min.y, std::min(point.y, box.max.y));
+	float dz = point.z - std::max(box.min.z, std::min(point.z, box.max.z));
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+// where the ray is inside the box, clipped to [0, maxDistance]
+static bool RayOverlapsAabb(const XMFLOAT3& origin, const XMFLOAT3& direction, const Aabb& box, float maxDistance, float* enter, float* exit)
+{
+	const float* o = &origin.x;
+	const float* d = &direction.x;
+	const float* lo = &box.min.x;
+	const float* hi = &box.max.x;
+	float t0 = 0.0f, t1 = maxDistance;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (fabsf(d[axis]) < 1e-12f)
+		{
+			if (o[axis] < lo[axis] || o[axis] > hi[axis])
+				return false;
+			continue;
+		}
+		float inverse = 1.0f / d[axis];
+		float slabEnter = (lo[axis] - o[axis]) * inverse;
+		float slabExit = (hi[axis] - o[axis]) * inverse;
+		if (slabEnter > slabExit)
+			std::swap(slabEnter, slabExit);
+		t0 = std::max(t0, slabEnter);
+		t1 = std::min(t1, slabExit);
+		if (t0 > t1)
+			return false;
+	}
+	*enter = t0;
+	*exit = t1;
+	return true;
+}
+
+// Moller-Trumbore, from either side
+static bool RayTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, float* t)
+{
+	XMFLOAT3 e1(b.x - a.x, b.y - a.y, b.z - a.z);
+	XMFLOAT3 e2(c.x - a.x, c.y - a.y, c.z - a.z);
+	XMFLOAT3 p(direction.y * e2.z - direction.z * e2.y, direction.z * e2.x - direction.x * e2.z, direction.x * e2.y - direction.y * e2.x);
+	float determinant = e1.x * p.x + e1.y * p.y + e1.z * p.z;
+	if (fabsf(determinant) < 1e-12f)
+		return false;
+
+	float inverse = 1.0f / determinant;
+	XMFLOAT3 s(origin.x - a.x, origin.y - a.y, origin.z - a.z);
+	float u = (s.x * p.x + s.y * p.y + s.z * p.z) * inverse;
+	if (u < -1e-5f || u > 1.0f + 1e-5f)
+		return false;
+
+	XMFLOAT3 q(s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x);
+	float v = (direction.x * q.x + direction.y * q.y + direction.z * q.z) * inverse;
+	if (v < -1e-5f || u + v > 1.0f + 1e-5f)
+		return false;
+
+	*t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * inverse;
+	return *t >= 0.0f;
+}
+
+
+// ==============================================================
+//		heightmaps
+// ==============================================================
+
+// twice the signed area of u, v, p seen from above
+static float EdgeXZ(const XMFLOAT3& u, const XMFLOAT3& v, float x, float z)
+{
+	return (v.x - u.x) * (z - u.z) - (x - u.x) * (v.z - u.z);
+}
+
+bool HeightmapFromMesh(const MeshData& mesh, float spacing, Heightmap* heightmap)
+{
+	size_t triangles = mesh.indices.size() / 3;
+	if (triangles == 0)
+	{
+		ReportError(LogCategory_Assets, "Mesh has no triangles to make a heightmap from");
+		return false;
+	}
+
+	if (spacing <= 0.0f)
+	{
+		// the median of every triangle's shortest edge across the ground, a regular grid's cell size
+		std::vector<float> edges;
+		edges.reserve(triangles);
+		for (size_t i = 0; i < triangles; i++)
+		{
+			float shortest = FLT_MAX;
+			for (int edge = 0; edge < 3; edge++)
+			{
+				const XMFLOAT3& a = mesh.vertices[mesh.indices[i * 3 + edge]].position;
+				const XMFLOAT3& b = mesh.vertices[mesh.indices[i * 3 + (edge + 1) % 3]].position;
+				shortest = std::min(shortest, sqrtf((b.x - a.x) * (b.x - a.x) + (b.z - a.z) * (b.z - a.z)));
+			}
+			if (shortest > 1e-6f)
+				edges.push_back(shortest);
+		}
+		if (edges.empty())
+		{
+			ReportError(LogCategory_Assets, "Mesh has no area seen from above to make a heightmap from");
+			return false;
+		}
+		std::nth_element(edges.begin(), edges.begin() + edges.size() / 2, edges.end());
+		spacing = edges[edges.size() / 2];
+	}
+
+	float sizeX = mesh.boundsMax.x - mesh.boundsMin.x;
+	float sizeZ = mesh.boundsMax.z - mesh.boundsMin.z;
+	double samples = (floor(sizeX / spacing + 0.5) + 1.0) * (floor(sizeZ / spacing + 0.5) + 1.0);
+	if (samples > (double)(1 << 28))
+	{
+		ReportError(LogCategory_Assets, "A heightmap of {} samples is too big, use a wider spacing", samples);
+		return false;
+	}
+
+	heightmap->width = (UINT)(sizeX / spacing + 0.5f) + 1;
+	heightmap->depth = (UINT)(sizeZ / spacing + 0.5f) + 1;
+	heightmap->originX = mesh.boundsMin.x;
+	heightmap->originZ = mesh.boundsMin.z;
+	heightmap->spacing = spacing;
+	heightmap->heights.assign((size_t)heightmap->width * heightmap->depth, -FLT_MAX);
+
+	const UINT width = heightmap->width;
+	const UINT depth = heightmap->depth;
+	std::vector<float>& heights = heightmap->heights;
+	for (size_t i = 0; i < triangles; i++)
+	{
+		const XMFLOAT3& a = mesh.vertices[mesh.indices[i * 3 + 0]].position;
+		const XMFLOAT3& b = mesh.vertices[mesh.indices[i * 3 + 1]].position;
+		const XMFLOAT3& c = mesh.vertices[mesh.indices[i * 3 + 2]].position;
+		float area = EdgeXZ(a, b, c.x, c.z);
+		// on its side, edge on from above
+		if (fabsf(area) < 1e-12f)
+			continue;
+
+		float minX = (std::min(a.x, std::min(b.x, c.x)) - heightmap->originX) / spacing;
+		float maxX = (std::max(a.x, std::max(b.x, c.x)) - heightmap->originX) / spacing;
+		float minZ = (std::min(a.z, std::min(b.z, c.z)) - heightmap->originZ) / spacing;
+		float maxZ = (std::max(a.z, std::max(b.z, c.z)) - heightmap->originZ) / spacing;
+		int x0 = std::max(0, (int)ceilf(minX - 1e-4f));
+		int x1 = std::min((int)width - 1, (int)floorf(maxX + 1e-4f));
+		int z0 = std::max(0, (int)ceilf(minZ - 1e-4f));
+		int z1 = std::min((int)depth - 1, (int)floorf(maxZ + 1e-4f));
+
+		float inverseArea = 1.0f / area;
+		for (int z = z0; z <= z1; z++)
+		{
+			float pz = heightmap->originZ + z * spacing;
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = heightmap->originX + x * spacing;
+				float wa = EdgeXZ(b, c, px, pz) * inverseArea;
+				float wb = EdgeXZ(c, a, px, pz) * inverseArea;
+				float wc = 1.0f - wa - wb;
+				if (wa < -1e-4f || wb < -1e-4f || wc < -1e-4f)
+					continue;
+
+				float& height = heights[(size_t)z * width + x];
+				height = std::max(height, wa * a.y + wb * b.y + wc * c.y);
+			}
+		}
+	}
+
+	// holes take the average of the neighbours that have a height, a ring at a time
+	size_t missing = std::count(heights.begin(), heights.end(), -FLT_MAX);
+	while (missing > 0)
+	{
+		std::vector<float> next = heights;
+		size_t filled = 0;
+		for (UINT z = 0; z < depth; z++)
+		{
+			for (UINT x = 0; x < width; x++)
+			{
+				size_t i = (size_t)z * width + x;
+				if (heights[i] != -FLT_MAX)
+					continue;
+
+				float sum = 0.0f;
+				int count = 0;
+				if (x > 0 && heights[i - 1] != -FLT_MAX) { sum += heights[i - 1]; count++; }
+				if (x + 1 < width && heights[i + 1] != -FLT_MAX) { sum += heights[i + 1]; count++; }
+				if (z > 0 && heights[i - width] != -FLT_MAX) { sum += heights[i - width]; count++; }
+				if (z + 1 < depth && heights[i + width] != -FLT_MAX) { sum += heights[i + width]; count++; }
+				if (count > 0)
+				{
+					next[i] = sum / count;
+					filled++;
+				}
+			}
+		}
+		if (filled == 0)
+		{
+			ReportError(LogCategory_Assets, "Mesh didn't cover any heightmap sample");
+			return false;
+		}
+		heights.swap(next);
+		missing -= filled;
+	}
+	return true;
+}
+
+bool HeightmapFromImage(const std::wstring& path, float spacing, float heightScale, Heightmap* heightmap)
+{
+	UINT width = 0, height = 0;
+	std::vector<BYTE> rgba;
+	if (!DecodeImage(path, &width, &height, &rgba))
+		return false;
+	if (width < 2 || height < 2 || spacing <= 0.0f)
+	{
+		ReportError(LogCategory_Assets, "Can't make a heightmap from {}, it needs 2x2 pixels and a spacing", path);
+		return false;
+	}
+
+	heightmap->width = width;
+	heightmap->depth = height;
+	heightmap->originX = -0.5f * (width - 1) * spacing;
+	heightmap->originZ = -0.5f * (height - 1) * spacing;
+	heightmap->spacing = spacing;
+	heightmap->heights.resize((size_t)width * height);
+
+	// the top row of the image is the far edge, so the map reads the same way from above
+	float scale = heightScale / 255.0f;
+	for (UINT y = 0; y < height; y++)
+	{
+		const BYTE* row = rgba.data() + (size_t)y * width * 4;
+		float* heights = heightmap->heights.data() + (size_t)(height - 1 - y) * width;
+		for (UINT x = 0; x < width; x++)
+			heights[x] = (0.299f * row[x * 4 + 0] + 0.587f * row[x * 4 + 1] + 0.114f * row[x * 4 + 2]) * scale;
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		cooking
+// ==============================================================
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool CookTerrain(const Heightmap& heightmap, UINT maxLodCount, std::vector<BYTE>* file)
+{
+	if (heightmap.width < 2 || heightmap.depth < 2 || heightmap.spacing <= 0.0f
+		|| heightmap.heights.size() != (size_t)heightmap.width * heightmap.depth)
+	{
+		ReportError(LogCategory_Assets, "Heightmap is empty or its size doesn't match its heights");
+		return false;
+	}
+
+	// as few levels as it takes for a root node to cover the map, past the cap the map is split into several roots
+	maxLodCount = std::max(kMinLodCount, std::min(maxLodCount, kMaxLodCount));
+	UINT cells = std::max(heightmap.width, heightmap.depth) - 1;
+	UINT lodCount = kMinLodCount;
+	while (lodCount < maxLodCount && ((UINT)TERRAIN_PATCH_CELLS << (lodCount - 1)) < cells)
+		lodCount++;
+	UINT rootCells = TERRAIN_PATCH_CELLS << (lodCount - 1);
+
+	TerrainFileHeader header;
+	ZeroMemory(&header, sizeof(header));
+	header.magic = TERRAIN_MAGIC;
+	header.version = TERRAIN_VERSION;
+	header.lodCount = lodCount;
+	header.rootsX = (heightmap.width - 1 + rootCells - 1) / rootCells;
+	header.rootsZ = (heightmap.depth - 1 + rootCells - 1) / rootCells;
+	header.samplesX = header.rootsX * rootCells + 1;
+	header.samplesZ = header.rootsZ * rootCells + 1;
+	header.sourceSamplesX = heightmap.width;
+	header.sourceSamplesZ = heightmap.depth;
+	header.tilesX = header.rootsX * rootCells / TERRAIN_TILE_CELLS;
+	header.tilesZ = header.rootsZ * rootCells / TERRAIN_TILE_CELLS;
+	header.originX = heightmap.originX;
+	header.originZ = heightmap.originZ;
+	header.spacing = heightmap.spacing;
+
+	header.heightMin = FLT_MAX;
+	header.heightMax = -FLT_MAX;
+	for (float height : heightmap.heights)
+	{
+		header.heightMin = std::min(header.heightMin, height);
+		header.heightMax = std::max(header.heightMax, height);
+	}
+	if (header.heightMax - header.heightMin < 1e-6f)
+		header.heightMax = header.heightMin + 1.0f;
+
+	// the whole padded map quantized first, the edge repeats into the padding
+	const UINT samplesX = header.samplesX;
+	const UINT samplesZ = header.samplesZ;
+	std::vector<WORD> samples((size_t)samplesX * samplesZ);
+	float scale = 65535.0f / (header.heightMax - header.heightMin);
+	for (UINT z = 0; z < samplesZ; z++)
+	{
+		const float* row = heightmap.heights.data() + (size_t)std::min(z, heightmap.depth - 1) * heightmap.width;
+		for (UINT x = 0; x < samplesX; x++)
+		{
+			float value = (row[std::min(x, heightmap.width - 1)] - header.heightMin) * scale + 0.5f;
+			samples[(size_t)z * samplesX + x] = (WORD)std::max(0.0f, std::min(value, 65535.0f));
+		}
+	}
+
+	// the finest level's bounds come from the samples, each coarser one from the four nodes under it
+	std::vector<std::vector<WORD>> bounds(lodCount);
+	UINT nodesX = header.rootsX << (lodCount - 1);
+	UINT nodesZ = header.rootsZ << (lodCount - 1);
+	bounds[0].resize((size_t)nodesX * nodesZ * 2);
+	for (UINT nz = 0; nz < nodesZ; nz++)
+	{
+		for (UINT nx = 0; nx < nodesX; nx++)
+		{
+			WORD lowest = 0xffff, highest = 0;
+			for (UINT z = nz * TERRAIN_PATCH_CELLS; z <= (nz + 1) * TERRAIN_PATCH_CELLS; z++)
+			{
+				const WORD* row = samples.data() + (size_t)z * samplesX;
+				for (UINT x = nx * TERRAIN_PATCH_CELLS; x <= (nx + 1) * TERRAIN_PATCH_CELLS; x++)
+				{
+					lowest = std::min(lowest, row[x]);
+					highest = std::max(highest, row[x]);
+				}
+			}
+			bounds[0][((size_t)nz * nodesX + nx) * 2 + 0] = lowest;
+			bounds[0][((size_t)nz * nodesX + nx) * 2 + 1] = highest;
+		}
+	}
+	for (UINT lod = 1; lod < lodCount; lod++)
+	{
+		UINT childNodesX = nodesX;
+		nodesX /= 2;
+		nodesZ /= 2;
+		bounds[lod].resize((size_t)nodesX * nodesZ * 2);
+		for (UINT nz = 0; nz < nodesZ; nz++)
+		{
+			for (UINT nx = 0; nx < nodesX; nx++)
+			{
+				WORD lowest = 0xffff, highest = 0;
+				for (UINT child = 0; child < 4; child++)
+				{
+					const WORD* node = bounds[lod - 1].data() + ((size_t)(nz * 2 + (child >> 1)) * childNodesX + nx * 2 + (child & 1)) * 2;
+					lowest = std::min(lowest, node[0]);
+					highest = std::max(highest, node[1]);
+				}
+				bounds[lod][((size_t)nz * nodesX + nx) * 2 + 0] = lowest;
+				bounds[lod][((size_t)nz * nodesX + nx) * 2 + 1] = highest;
+			}
+		}
+	}
+
+	UINT64 boundsBytes = 0;
+	for (const std::vector<WORD>& level : bounds)
+		boundsBytes += level.size() * sizeof(WORD);
+	UINT coarseX = (samplesX - 1) / kCoarseStride + 1;
+	UINT coarseZ = (samplesZ - 1) / kCoarseStride + 1;
+	UINT64 tileBytes = (UINT64)kTileSamples * kTileSamples * sizeof(WORD);
+
+	header.boundsOffset = sizeof(TerrainFileHeader);
+	header.coarseOffset = AlignUp(header.boundsOffset + boundsBytes, 16);
+	header.tilesOffset = AlignUp(header.coarseOffset + (UINT64)coarseX * coarseZ * sizeof(WORD), 16);
+	header.fileSize = header.tilesOffset + tileBytes * header.tilesX * header.tilesZ;
+	if (header.fileSize > (UINT64)SIZE_MAX)
+	{
+		ReportError(LogCategory_Assets, "Cooked terrain would be {} bytes, too big to cook in memory", header.fileSize);
+		return false;
+	}
+
+	file->assign((size_t)header.fileSize, 0);
+	BYTE* data = file->data();
+	memcpy(data, &header, sizeof(header));
+
+	BYTE* boundsData = data + header.boundsOffset;
+	for (const std::vector<WORD>& level : bounds)
+	{
+		memcpy(boundsData, level.data(), level.size() * sizeof(WORD));
+		boundsData += level.size() * sizeof(WORD);
+	}
+
+	WORD* coarse = (WORD*)(data + header.coarseOffset);
+	for (UINT z = 0; z < coarseZ; z++)
+	{
+		for (UINT x = 0; x < coarseX; x++)
+			coarse[(size_t)z * coarseX + x] = samples[(size_t)z * kCoarseStride * samplesX + x * kCoarseStride];
+	}
+
+	// every tile carries the row and column it shares with the next one, so a tile is drawn from on its own
+	WORD* tiles = (WORD*)(data + header.tilesOffset);
+	for (UINT tileZ = 0; tileZ < header.tilesZ; tileZ++)
+	{
+		for (UINT tileX = 0; tileX < header.tilesX; tileX++)
+		{
+			WORD* tile = tiles + ((size_t)tileZ * header.tilesX + tileX) * kTileSamples * kTileSamples;
+			for (UINT z = 0; z < kTileSamples; z++)
+			{
+				const WORD* row = samples.data() + (size_t)(tileZ * TERRAIN_TILE_CELLS + z) * samplesX + tileX * TERRAIN_TILE_CELLS;
+				memcpy(tile + z * kTileSamples, row, kTileSamples * sizeof(WORD));
+			}
+		}
+	}
+	return true;
+}
+
+bool SaveTerrain(const std::wstring& path, const Heightmap& heightmap, UINT maxLodCount)
+{
+	std::vector<BYTE> cooked;
+	if (!CookTerrain(heightmap, maxLodCount, &cooked))
+		return false;
+
+	HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not create {}", path);
+		return false;
+	}
+
+	bool ok = WriteFileBytes(file, cooked.data(), cooked.size());
+	CloseHandle(file);
+
+	if (!ok)
+	{
+		ReportError(LogCategory_Assets, "Could not write cooked terrain file");
+		return false;
+	}
+	return true;
+}
+
+
+// ==============================================================
+//		terrain
+// ==============================================================
+
+TerrainDesc::TerrainDesc()
+	: detailDistance(0.0f), morphStart(0.7f), tileBudgetBytes(16 * 1024 * 1024), maxTileLoadsPerFrame(4), prefetchScale(1.5f)
+{
+}
+
+Terrain::Terrain()
+	: mFile(INVALID_HANDLE_VALUE), mMapping(nullptr), mData(nullptr), mHeader(nullptr), mCoarse(nullptr), mTiles(nullptr),
+	mCoarseX(0), mCoarseZ(0), mHeightStep(0.0f), mCellsX(0.0f), mCellsZ(0.0f), mCamera(0.0f, 0.0f, 0.0f), mFrame(0),
+	mPatchVertices(nullptr), mPatchIndices(nullptr), mConstants(nullptr), mVertexShader(nullptr), mPixelShader(nullptr),
+	mLayout(nullptr), mTileArray(nullptr), mTileView(nullptr), mCoarseTexture(nullptr), mCoarseView(nullptr), mSampler(nullptr),
+	mGpuBytes(0)
+{
+	ZeroMemory(&mStats, sizeof(mStats));
+	ZeroMemory(mLodRanges, sizeof(mLodRanges));
+	ZeroMemory(mMorphStart, sizeof(mMorphStart));
+}
+
+Terrain::~Terrain()
+{
+	Close();
+}
+
+bool Terrain::Open(const std::wstring& path, const TerrainDesc& desc)
+{
+	Close();
+	mDesc = desc;
+
+	mFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		ReportError(LogCategory_Assets, "Could not open terrain {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(TerrainFileHeader))
+	{
+		ReportError(LogCategory_Assets, "File is too small to be a terrain {}", path);
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != nullptr)
+		mData = (const BYTE*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mData == nullptr)
+	{
+		ReportError(LogCategory_Assets, "Could not map terrain {}", path);
+		Close();
+		return false;
+	}
+
+	if (!Attach(mData, (UINT64)fileSize.QuadPart))
+	{
+		ReportError(LogCategory_Assets, "Terrain {} is corrupt or from another version", path);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool Terrain::Create(const Heightmap& heightmap, const TerrainDesc& desc)
+{
+	Close();
+	mDesc = desc;
+
+	if (!CookTerrain(heightmap, kCreateLodCount, &mCooked))
+		return false;
+	MemoryTracker::Get()->TrackAllocation(MemoryTag_Assets, mCooked.size());
+
+	if (!Attach(mCooked.data(), mCooked.size()))
+	{
+		ReportError(LogCategory_Assets, "Cooked terrain failed its own checks");
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool Terrain::Attach(const BYTE* data, UINT64 size)
+{
+	// ==============================================================
+	//		validate the layout, everything after this trusts it
+	// ==============================================================
+
+	const TerrainFileHeader* header = (const TerrainFileHeader*)data;
+	if (header->magic != TERRAIN_MAGIC || header->version != TERRAIN_VERSION || header->fileSize != size
+		|| header->lodCount < kMinLodCount || header->lodCount > kMaxLodCount || header->rootsX == 0 || header->rootsZ == 0
+		|| header->spacing <= 0.0f || !(header->heightMax > header->heightMin))
+		return false;
+
+	UINT rootCells = TERRAIN_PATCH_CELLS << (header->lodCount - 1);
+	UINT64 samplesX = (UINT64)header->rootsX * rootCells + 1;
+	UINT64 samplesZ = (UINT64)header->rootsZ * rootCells + 1;
+	if (header->samplesX != samplesX || header->samplesZ != samplesZ
+		|| header->tilesX != (samplesX - 1) / TERRAIN_TILE_CELLS || header->tilesZ != (samplesZ - 1) / TERRAIN_TILE_CELLS
+		|| header->sourceSamplesX < 2 || header->sourceSamplesX > samplesX || header->sourceSamplesZ < 2 || header->sourceSamplesZ > samplesZ)
+		return false;
+
+	UINT64 boundsBytes = 0;
+	for (UINT lod = 0; lod < header->lodCount; lod++)
+		boundsBytes += ((UINT64)header->rootsX << (header->lodCount - 1 - lod)) * ((UINT64)header->rootsZ << (header->lodCount - 1 - lod)) * 2 * sizeof(WORD);
+	UINT64 coarseBytes = ((samplesX - 1) / kCoarseStride + 1) * ((samplesZ - 1) / kCoarseStride + 1) * sizeof(WORD);
+	UINT64 tilesBytes = (UINT64)header->tilesX * header->tilesZ * kTileSamples * kTileSamples * sizeof(WORD);
+	if (header->boundsOffset < sizeof(TerrainFileHeader) || header->boundsOffset + boundsBytes > header->coarseOffset
+		|| header->coarseOffset + coarseBytes > header->tilesOffset || header->tilesOffset + tilesBytes > size
+		|| (header->boundsOffset | header->coarseOffset | header->tilesOffset) % sizeof(WORD) != 0)
+		return false;
+
+	mHeader = header;
+	mCoarse = (const WORD*)(data + header->coarseOffset);
+	mTiles = (const WORD*)(data + header->tilesOffset);
+	mCoarseX = (header->samplesX - 1) / kCoarseStride + 1;
+	mCoarseZ = (header->samplesZ - 1) / kCoarseStride + 1;
+	mHeightStep = (header->heightMax - header->heightMin) / 65535.0f;
+	mCellsX = (float)(header->sourceSamplesX - 1);
+	mCellsZ = (float)(header->sourceSamplesZ - 1);
+
+	const WORD* bounds = (const WORD*)(data + header->boundsOffset);
+	mBounds.resize(header->lodCount);
+	mLevelNodesX.resize(header->lodCount);
+	for (UINT lod = 0; lod < header->lodCount; lod++)
+	{
+		UINT nodesX = header->rootsX << (header->lodCount - 1 - lod);
+		UINT nodesZ = header->rootsZ << (header->lodCount - 1 - lod);
+		mBounds[lod] = bounds;
+		mLevelNodesX[lod] = nodesX;
+		bounds += (size_t)nodesX * nodesZ * 2;
+	}
+
+	// the budget is a whole number of slices, without a renderer they are only bookkeeping
+	UINT tiles = header->tilesX * header->tilesZ;
+	UINT64 tileBytes = (UINT64)kTileSamples * kTileSamples * sizeof(WORD);
+	UINT capacity = (UINT)std::max((UINT64)1, std::min(mDesc.tileBudgetBytes / tileBytes, (UINT64)std::min(tiles, kMaxTileSlots)));
+	TileSlot empty = { -1, 0, false };
+	mSlots.assign(capacity, empty);
+	mTileSlots.assign(tiles, -1);
+	mRequestedFrame.assign(tiles, 0);
+	mFrame = 0;
+	ZeroMemory(&mStats, sizeof(mStats));
+	mStats.tileCapacity = capacity;
+
+	SetupLods();
+	return true;
+}
+
+void Terrain::SetupLods()
+{
+	// a level reaches twice as far as the one under it and morphs into the next over the last part of its range
+	float range = mDesc.detailDistance > 0.0f ? mDesc.detailDistance : 2.0f * TERRAIN_PATCH_CELLS * mHeader->spacing;
+	float previous = 0.0f;
+	for (UINT lod = 0; lod < 16; lod++)
+	{
+		mLodRanges[lod] = range;
+		mMorphStart[lod] = previous + (range - previous) * mDesc.morphStart;
+		previous = range;
+		range *= 2.0f;
+	}
+}
+
+void Terrain::Close()
+{
+	ReleaseRenderer();
+
+	if (mData && mMapping)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+	if (!mCooked.empty())
+		MemoryTracker::Get()->TrackFree(MemoryTag_Assets, mCooked.size());
+
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+	mData = nullptr;
+	std::vector<BYTE>().swap(mCooked);
+	mHeader = nullptr;
+	mCoarse = nullptr;
+	mTiles = nullptr;
+	mBounds.clear();
+	mLevelNodesX.clear();
+	mPatches.clear();
+	mRequests.clear();
+	mRequestedFrame.clear();
+	mTileSlots.clear();
+	mSlots.clear();
+	ZeroMemory(&mStats, sizeof(mStats));
+}
+
+Aabb Terrain::GetBounds() const
+{
+	Aabb bounds;
+	bounds.min = XMFLOAT3(mHeader->originX, mHeader->heightMin, mHeader->originZ);
+	bounds.max = XMFLOAT3(mHeader->originX + mCellsX * mHeader->spacing, mHeader->heightMax, mHeader->originZ + mCellsZ * mHeader->spacing);
+	return bounds;
+}
+
+
+// ==============================================================
+//		selection and streaming
+// ==============================================================
+
+bool Terrain::NodeInMap(UINT lod, UINT x, UINT z) const
+{
+	// nodes that are only padding are never drawn or hit
+	UINT cells = TERRAIN_PATCH_CELLS << lod;
+	return x * cells < mHeader->sourceSamplesX - 1 && z * cells < mHeader->sourceSamplesZ - 1;
+}
+
+Aabb Terrain::NodeBounds(UINT lod, UINT x, UINT z) const
+{
+	const WORD* bounds = mBounds[lod] + ((size_t)z * mLevelNodesX[lod] + x) * 2;
+	float size = (float)(TERRAIN_PATCH_CELLS << lod) * mHeader->spacing;
+	float mapMaxX = mHeader->originX + mCellsX * mHeader->spacing;
+	float mapMaxZ = mHeader->originZ + mCellsZ * mHeader->spacing;
+
+	Aabb box;
+	box.min = XMFLOAT3(mHeader->originX + x * size, mHeader->heightMin + bounds[0] * mHeightStep, mHeader->originZ + z * size);
+	box.max = XMFLOAT3(std::min(box.min.x + size, mapMaxX), mHeader->heightMin + bounds[1] * mHeightStep, std::min(box.min.z + size, mapMaxZ));
+	return box;
+}
+
+UINT Terrain::TileOfNode(UINT lod, UINT x, UINT z) const
+{
+	UINT cells = TERRAIN_PATCH_CELLS << lod;
+	return (z * cells / TERRAIN_TILE_CELLS) * mHeader->tilesX + x * cells / TERRAIN_TILE_CELLS;
+}
+
+void Terrain::Update(const XMFLOAT3& camera, const Frustum& frustum)
+{
+	if (!mHeader)
+		return;
+
+	mFrame++;
+	mCamera = camera;
+	mFrustum = frustum;
+	mPatches.clear();
+	mRequests.clear();
+	mStats.patches = 0;
+	mStats.nodesVisited = 0;
+	mStats.tilesMissing = 0;
+
+	// a root out of range is still drawn, at its own level
+	UINT rootLod = mHeader->lodCount - 1;
+	for (UINT z = 0; z < mHeader->rootsZ; z++)
+	{
+		for (UINT x = 0; x < mHeader->rootsX; x++)
+		{
+			if (!SelectNode(rootLod, x, z))
+				AddPatch(rootLod, x, z);
+		}
+	}
+
+	// tiles the camera is about to need, whether they are in view or not, so turning around doesn't wait on them
+	float radius = mDesc.prefetchScale * mLodRanges[kTileLod];
+	float tileSize = TERRAIN_TILE_CELLS * mHeader->spacing;
+	int firstX = std::max(0, (int)floorf((camera.x - radius - mHeader->originX) / tileSize));
+	int lastX = std::min((int)mHeader->tilesX - 1, (int)floorf((camera.x + radius - mHeader->originX) / tileSize));
+	int firstZ = std::max(0, (int)floorf((camera.z - radius - mHeader->originZ) / tileSize));
+	int lastZ = std::min((int)mHeader->tilesZ - 1, (int)floorf((camera.z + radius - mHeader->originZ) / tileSize));
+	for (int z = firstZ; z <= lastZ; z++)
+	{
+		for (int x = firstX; x <= lastX; x++)
+		{
+			if (!NodeInMap(kTileLod, x, z))
+				continue;
+
+			float distance = DistanceToAabb(camera, NodeBounds(kTileLod, x, z));
+			if (distance <= radius)
+				RequestTile(z * mHeader->tilesX + x, distance);
+		}
+	}
+
+	LoadTiles();
+	mStats.patches = (UINT)mPatches.size();
+}
+
+bool Terrain::SelectNode(UINT lod, UINT x, UINT z)
+{
+	// true when the node's area has been dealt with, false when it is out of this level's range and the level above
+	// has to draw it
+	if (!NodeInMap(lod, x, z))
+		return true;
+
+	Aabb bounds = NodeBounds(lod, x, z);
+	Sphere range = { mCamera, mLodRanges[lod] };
+	if (!SphereOverlapsAabb(range, bounds))
+		return false;
+
+	mStats.nodesVisited++;
+	if (!FrustumOverlapsAabb(mFrustum, bounds))
+		return true;
+
+	Sphere finer = { mCamera, lod > 0 ? mLodRanges[lod - 1] : 0.0f };
+	if (lod == 0 || !SphereOverlapsAabb(finer, bounds))
+	{
+		AddPatch(lod, x, z);
+		return true;
+	}
+
+	// the children are drawn from tiles, until all of them are in this node stays at its own level. its neighbours
+	// can be finer for those frames, the prefetch radius keeps that to when the camera jumps
+	if (lod - 1 == kTileLod)
+	{
+		bool ready = true;
+		for (UINT child = 0; child < 4; child++)
+		{
+			UINT childX = x * 2 + (child & 1), childZ = z * 2 + (child >> 1);
+			if (!NodeInMap(lod - 1, childX, childZ))
+				continue;
+
+			UINT tile = TileOfNode(lod - 1, childX, childZ);
+			if (!RequestTile(tile, DistanceToAabb(mCamera, NodeBounds(lod - 1, childX, childZ))))
+			{
+				mStats.tilesMissing++;
+				ready = false;
+			}
+		}
+		if (!ready)
+		{
+			AddPatch(lod, x, z);
+			return true;
+		}
+	}
+
+	// a child out of its own range is drawn at its size, fully morphed its vertices land on this level's grid
+	for (UINT child = 0; child < 4; child++)
+	{
+		UINT childX = x * 2 + (child & 1), childZ = z * 2 + (child >> 1);
+		if (!SelectNode(lod - 1, childX, childZ))
+			AddPatch(lod - 1, childX, childZ);
+	}
+	return true;
+}
+
+void Terrain::AddPatch(UINT lod, UINT x, UINT z)
+{
+	if (mPatches.size() >= kMaxPatches)
+		return;
+
+	UINT cells = TERRAIN_PATCH_CELLS << lod;
+	UINT step = 1 << lod; // samples between the patch's vertices
+
+	TerrainPatch patch;
+	patch.origin = XMFLOAT2(mHeader->originX + x * cells * mHeader->spacing, mHeader->originZ + z * cells * mHeader->spacing);
+	patch.size = cells * mHeader->spacing;
+	patch.lod = lod;
+	if (lod <= kTileLod)
+	{
+		UINT tile = TileOfNode(lod, x, z);
+		UINT startX = x * cells % TERRAIN_TILE_CELLS;
+		UINT startZ = z * cells % TERRAIN_TILE_CELLS;
+		patch.uvOffset = XMFLOAT2((startX + 0.5f) / kTileSamples, (startZ + 0.5f) / kTileSamples);
+		patch.uvScale = XMFLOAT2((float)step / kTileSamples, (float)step / kTileSamples);
+		patch.tile = (UINT)mTileSlots[tile];
+	}
+	else
+	{
+		UINT startX = x * cells / kCoarseStride;
+		UINT startZ = z * cells / kCoarseStride;
+		patch.uvOffset = XMFLOAT2((startX + 0.5f) / mCoarseX, (startZ + 0.5f) / mCoarseZ);
+		patch.uvScale = XMFLOAT2((float)(step / kCoarseStride) / mCoarseX, (float)(step / kCoarseStride) / mCoarseZ);
+		patch.tile = TERRAIN_COARSE_TILE;
+	}
+	mPatches.push_back(patch);
+}
+
+bool Terrain::RequestTile(UINT tile, float distance)
+{
+	// resident tiles are touched for the LRU, missing ones are asked for once a frame
+	int slot = mTileSlots[tile];
+	if (slot >= 0)
+	{
+		mSlots[slot].lastUsedFrame = mFrame;
+		return mSlots[slot].uploaded || !mTileArray;
+	}
+
+	if (mRequestedFrame[tile] != mFrame)
+	{
+		mRequestedFrame[tile] = mFrame;
+		TileRequest request = { tile, distance };
+		mRequests.push_back(request);
+	}
+	return false;
+}
+
+void Terrain::LoadTiles()
+{
+	// closest first, into a free slot or the one used longest ago. a slot something wanted this frame is never taken
+	std::sort(mRequests.begin(), mRequests.end(), [](const TileRequest& a, const TileRequest& b) { return a.distance < b.distance; });
+
+	UINT loads = 0;
+	for (const TileRequest& request : mRequests)
+	{
+		if (loads >= mDesc.maxTileLoadsPerFrame)
+			break;
+
+		int best = -1;
+		UINT64 oldest = mFrame;
+		for (UINT i = 0; i < (UINT)mSlots.size(); i++)
+		{
+			if (mSlots[i].tile < 0)
+			{
+				best = (int)i;
+				break;
+			}
+			if (mSlots[i].lastUsedFrame < oldest)
+			{
+				oldest = mSlots[i].lastUsedFrame;
+				best = (int)i;
+			}
+		}
+		// everything resident is in use, the budget is too small for the view
+		if (best < 0)
+			break;
+
+		TileSlot& slot = mSlots[best];
+		if (slot.tile >= 0)
+		{
+			mTileSlots[slot.tile] = -1;
+			mStats.tileEvictions++;
+		}
+		else
+		{
+			mStats.tilesResident++;
+		}
+		slot.tile = (int)request.tile;
+		slot.lastUsedFrame = mFrame;
+		slot.uploaded = false;
+		mTileSlots[request.tile] = best;
+		mStats.tileLoads++;
+		loads++;
+	}
+
+	mStats.pendingUploads = 0;
+	if (mTileArray)
+	{
+		for (const TileSlot& slot : mSlots)
+		{
+			if (slot.tile >= 0 && !slot.uploaded)
+				mStats.pendingUploads++;
+		}
+	}
+}
+
+
+// ==============================================================
+//		height queries
+// ==============================================================
+
+float Terrain::Sample(UINT x, UINT z) const
+{
+	UINT tileX = std::min(x / TERRAIN_TILE_CELLS, mHeader->tilesX - 1);
+	UINT tileZ = std::min(z / TERRAIN_TILE_CELLS, mHeader->tilesZ - 1);
+	const WORD* tile = mTiles + ((size_t)tileZ * mHeader->tilesX + tileX) * kTileSamples * kTileSamples;
+	return mHeader->heightMin + tile[(z - tileZ * TERRAIN_TILE_CELLS) * kTileSamples + x - tileX * TERRAIN_TILE_CELLS] * mHeightStep;
+}
+
+void Terrain::CellHeights(float x, float z, UINT* cellX, UINT* cellZ, float* fractionX, float* fractionZ, float corners[4]) const
+{
+	// corners are (x, z), (x + 1, z), (x, z + 1), (x + 1, z + 1)
+	float gridX = std::max(0.0f, std::min((x - mHeader->originX) / mHeader->spacing, mCellsX));
+	float gridZ = std::max(0.0f, std::min((z - mHeader->originZ) / mHeader->spacing, mCellsZ));
+	*cellX = std::min((UINT)gridX, mHeader->sourceSamplesX - 2);
+	*cellZ = std::min((UINT)gridZ, mHeader->sourceSamplesZ - 2);
+	*fractionX = gridX - *cellX;
+	*fractionZ = gridZ - *cellZ;
+	corners[0] = Sample(*cellX, *cellZ);
+	corners[1] = Sample(*cellX + 1, *cellZ);
+	corners[2] = Sample(*cellX, *cellZ + 1);
+	corners[3] = Sample(*cellX + 1, *cellZ + 1);
+}
+
+bool Terrain::GetHeight(float x, float z, float* height) const
+{
+	if (!mHeader)
+		return false;
+
+	// a little slack, so a point on the edge isn't lost to rounding
+	float gridX = (x - mHeader->originX) / mHeader->spacing;
+	float gridZ = (z - mHeader->originZ) / mHeader->spacing;
+	if (!(gridX >= -1e-3f && gridX <= mCellsX + 1e-3f && gridZ >= -1e-3f && gridZ <= mCellsZ + 1e-3f))
+		return false;
+
+	// a cell is split from its first corner to its last, the same way the patch's indices split it
+	UINT cellX, cellZ;
+	float fx, fz, h[4];
+	CellHeights(x, z, &cellX, &cellZ, &fx, &fz, h);
+	if (fz > fx)
+		*height = h[0] + fz * (h[2] - h[0]) + fx * (h[3] - h[2]);
+	else
+		*height = h[0] + fx * (h[1] - h[0]) + fz * (h[3] - h[1]);
+	return true;
+}
+
+bool Terrain::GetNormal(float x, float z, XMFLOAT3* normal) const
+{
+	if (!mHeader)
+		return false;
+
+	float gridX = (x - mHeader->originX) / mHeader->spacing;
+	float gridZ = (z - mHeader->originZ) / mHeader->spacing;
+	if (!(gridX >= -1e-3f && gridX <= mCellsX + 1e-3f && gridZ >= -1e-3f && gridZ <= mCellsZ + 1e-3f))
+		return false;
+
+	UINT cellX, cellZ;
+	float fx, fz, h[4];
+	CellHeights(x, z, &cellX, &cellZ, &fx, &fz, h);
+	float slopeX = (fz > fx) ? h[3] - h[2] : h[1] - h[0];
+	float slopeZ = (fz > fx) ? h[2] - h[0] : h[3] - h[1];
+	XMFLOAT3 n(-slopeX / mHeader->spacing, 1.0f, -slopeZ / mHeader->spacing);
+	float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+	*normal = XMFLOAT3(n.x / length, n.y / length, n.z / length);
+	return true;
+}
+
+bool Terrain::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, TerrainHit* hit) const
+{
+	if (!mHeader)
+		return false;
+
+	// hit->distance is how far a hit still counts, every hit found pulls it in
+	hit->distance = maxDistance;
+	bool found = false;
+	UINT rootLod = mHeader->lodCount - 1;
+	for (UINT z = 0; z < mHeader->rootsZ; z++)
+	{
+		for (UINT x = 0; x < mHeader->rootsX; x++)
+		{
+			if (RaycastNode(rootLod, x, z, origin, direction, hit->distance, hit))
+				found = true;
+		}
+	}
+	return found;
+}
+
+bool Terrain::RaycastNode(UINT lod, UINT x, UINT z, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, TerrainHit* hit) const
+{
+	if (!NodeInMap(lod, x, z))
+		return false;
+
+	float enter, exit;
+	if (!RayOverlapsAabb(origin, direction, NodeBounds(lod, x, z), maxDistance, &enter, &exit))
+		return false;
+	if (lod == 0)
+		return RaycastCells(x, z, enter, exit, origin, direction, hit);
+
+	// the children the ray passes through, nearest first, a hit closer than the next one's entry ends the walk
+	struct Child
+	{
+		float enter;
+		UINT  x;
+		UINT  z;
+	};
+	Child children[4];
+	UINT count = 0;
+	for (UINT child = 0; child < 4; child++)
+	{
+		UINT childX = x * 2 + (child & 1), childZ = z * 2 + (child >> 1);
+		float childEnter, childExit;
+		if (NodeInMap(lod - 1, childX, childZ)
+			&& RayOverlapsAabb(origin, direction, NodeBounds(lod - 1, childX, childZ), hit->distance, &childEnter, &childExit))
+		{
+			Child entry = { childEnter, childX, childZ };
+			UINT i = count++;
+			for (; i > 0 && children[i - 1].enter > entry.enter; i--)
+				children[i] = children[i - 1];
+			children[i] = entry;
+		}
+	}
+
+	bool found = false;
+	for (UINT i = 0; i < count; i++)
+	{
+		if (children[i].enter > hit->distance)
+			break;
+		if (RaycastNode(lod - 1, children[i].x, children[i].z, origin, direction, hit->distance, hit))
+			found = true;
+	}
+	return found;
+}
+
+bool Terrain::RaycastCells(UINT nodeX, UINT nodeZ, float enter, float exit, const XMFLOAT3& origin, const XMFLOAT3& direction, TerrainHit* hit) const
+{
+	// the node's cells in the order the ray crosses them, the first with a hit has the nearest one
+	int firstX = (int)(nodeX * TERRAIN_PATCH_CELLS), firstZ = (int)(nodeZ * TERRAIN_PATCH_CELLS);
+	int lastX = std::min(firstX + TERRAIN_PATCH_CELLS, (int)mHeader->sourceSamplesX - 1) - 1;
+	int lastZ = std::min(firstZ + TERRAIN_PATCH_CELLS, (int)mHeader->sourceSamplesZ - 1) - 1;
+	const float spacing = mHeader->spacing;
+
+	float gridX = (origin.x + direction.x * enter - mHeader->originX) / spacing;
+	float gridZ = (origin.z + direction.z * enter - mHeader->originZ) / spacing;
+	int cellX = std::max(firstX, std::min((int)floorf(gridX), lastX));
+	int cellZ = std::max(firstZ, std::min((int)floorf(gridZ), lastZ));
+
+	int stepX = direction.x > 0.0f ? 1 : -1;
+	int stepZ = direction.z > 0.0f ? 1 : -1;
+	float nextX = FLT_MAX, deltaX = FLT_MAX, nextZ = FLT_MAX, deltaZ = FLT_MAX;
+	if (fabsf(direction.x) > 1e-12f)
+	{
+		nextX = (mHeader->originX + (cellX + (stepX > 0 ? 1 : 0)) * spacing - origin.x) / direction.x;
+		deltaX = spacing / fabsf(direction.x);
+	}
+	if (fabsf(direction.z) > 1e-12f)
+	{
+		nextZ = (mHeader->originZ + (cellZ + (stepZ > 0 ? 1 : 0)) * spacing - origin.z) / direction.z;
+		deltaZ = spacing / fabsf(direction.z);
+	}
+
+	for (;;)
+	{
+		float x0 = mHeader->originX + cellX * spacing, z0 = mHeader->originZ + cellZ * spacing;
+		XMFLOAT3 corners[4] =
+		{
+			XMFLOAT3(x0, Sample(cellX, cellZ), z0),
+			XMFLOAT3(x0 + spacing, Sample(cellX + 1, cellZ), z0),
+			XMFLOAT3(x0, Sample(cellX, cellZ + 1), z0 + spacing),
+			XMFLOAT3(x0 + spacing, Sample(cellX + 1, cellZ + 1), z0 + spacing),
+		};
+		// (0, 2, 3) and (0, 3, 1), the same split as GetHeight()
+		static const int kTriangles[2][3] = { { 0, 2, 3 }, { 0, 3, 1 } };
+		bool found = false;
+		for (int i = 0; i < 2; i++)
+		{
+			const XMFLOAT3& a = corners[kTriangles[i][0]];
+			const XMFLOAT3& b = corners[kTriangles[i][1]];
+			const XMFLOAT3& c = corners[kTriangles[i][2]];
+			float t;
+			if (RayTriangle(origin, direction, a, b, c, &t) && t <= hit->distance)
+			{
+				XMFLOAT3 e1(b.x - a.x, b.y - a.y, b.z - a.z), e2(c.x - a.x, c.y - a.y, c.z - a.z);
+				XMFLOAT3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+				float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+				if (n.y < 0.0f)
+					length = -length;
+
+				hit->distance = t;
+				hit->position = XMFLOAT3(origin.x + direction.x * t, origin.y + direction.y * t, origin.z + direction.z * t);
+				hit->normal = XMFLOAT3(n.x / length, n.y / length, n.z / length);
+				found = true;
+			}
+		}
+		if (found)
+			return true;
+
+		if (nextX < nextZ)
+		{
+			if (nextX > exit)
+				return false;
+			cellX += stepX;
+			nextX += deltaX;
+			if (cellX < firstX || cellX > lastX)
+				return false;
+		}
+		else
+		{
+			if (nextZ > exit)
+				return false;
+			cellZ += stepZ;
+			nextZ += deltaZ;
+			if (cellZ < firstZ || cellZ > lastZ)
+				return false;
+		}
+	}
+}
+
+
+// ==============================================================
+//		rendering
+// ==============================================================
+
+bool Terrain::CreateRenderer(ID3D11Device* device)
+{
+	ReleaseRenderer();
+
+	if (!mHeader)
+	{
+		ReportError(LogCategory_Render, "Terrain has to be opened before its renderer is created");
+		return false;
+	}
+	if (!mInstances.Create(device, kMaxPatches * sizeof(TerrainPatch)))
+		return false;
+	if (!device)
+		return true;
+
+	if (!CreateShaders(device) || !CreatePatch(device) || !CreateTextures(device))
+	{
+		ReleaseRenderer();
+		return false;
+	}
+
+	D3D11_BUFFER_DESC constantsDesc;
+	constantsDesc.ByteWidth = sizeof(TerrainConstants);
+	constantsDesc.Usage = D3D11_USAGE_DEFAULT;
+	constantsDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	constantsDesc.CPUAccessFlags = 0;
+	constantsDesc.MiscFlags = 0;
+	constantsDesc.StructureByteStride = 0;
+
+	HRESULT hr = device->CreateBuffer(&constantsDesc, 0, &mConstants);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the terrain constant buffer");
+		ReleaseRenderer();
+		return false;
+	}
+	return true;
+}
+
+bool Terrain::CreateShaders(ID3D11Device* device)
+{
+	const char* entryPoints[2] = { "TerrainVS", "TerrainPS" };
+	const char* targets[2] = { "vs_4_0", "ps_4_0" };
+	ID3DBlob* code[2] = { nullptr, nullptr };
+
+	bool succeeded = true;
+	for (int i = 0; i < 2 && succeeded; i++)
+	{
+		ID3DBlob* errors = nullptr;
+		HRESULT hr = D3DCompile(kTerrainShaders, sizeof(kTerrainShaders) - 1, "Terrain", nullptr, nullptr, entryPoints[i], targets[i],
+			D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &code[i], &errors);
+		// check for failure
+		if (FAILED(hr))
+		{
+			ReportError(LogCategory_Render, "Could not compile the terrain shader {}: {}", entryPoints[i],
+				errors ? (const char*)errors->GetBufferPointer() : "no compiler output");
+			succeeded = false;
+		}
+		SafeRelease(errors);
+	}
+
+	// the grid per vertex, where to put it per instance
+	D3D11_INPUT_ELEMENT_DESC layout[7] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 1, DXGI_FORMAT_R32_FLOAT, 1, 8, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 2, DXGI_FORMAT_R32_UINT, 1, 12, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 3, DXGI_FORMAT_R32G32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 4, DXGI_FORMAT_R32G32_FLOAT, 1, 24, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "TEXCOORD", 5, DXGI_FORMAT_R32_UINT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	};
+
+	if (succeeded)
+	{
+		HRESULT hr = device->CreateVertexShader(code[0]->GetBufferPointer(), code[0]->GetBufferSize(), nullptr, &mVertexShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreatePixelShader(code[1]->GetBufferPointer(), code[1]->GetBufferSize(), nullptr, &mPixelShader);
+		if (SUCCEEDED(hr))
+			hr = device->CreateInputLayout(layout, 7, code[0]->GetBufferPointer(), code[0]->GetBufferSize(), &mLayout);
+		// check for failure
+		if (FAILED(hr))
+		{
+			ReportError(LogCategory_Render, "Could not create the terrain shaders");
+			succeeded = false;
+		}
+	}
+
+	// so a render capture can make them again
+	if (succeeded)
+	{
+		RenderContext::RegisterShader(mVertexShader, code[0]->GetBufferPointer(), code[0]->GetBufferSize());
+		RenderContext::RegisterShader(mPixelShader, code[1]->GetBufferPointer(), code[1]->GetBufferSize());
+		RenderContext::RegisterInputLayout(mLayout, layout, 7, code[0]->GetBufferPointer(), code[0]->GetBufferSize());
+	}
+
+	for (int i = 0; i < 2; i++)
+		SafeRelease(code[i]);
+	return succeeded;
+}
+
+bool Terrain::CreatePatch(ID3D11Device* device)
+{
+	// vertices are grid positions, the shader scales them to the instance
+	std::vector<XMFLOAT2> vertices;
+	vertices.reserve(kPatchVertices * kPatchVertices);
+	for (UINT z = 0; z < kPatchVertices; z++)
+	{
+		for (UINT x = 0; x < kPatchVertices; x++)
+			vertices.push_back(XMFLOAT2((float)x, (float)z));
+	}
+
+	// clockwise seen from above, each cell split from its first corner to its last
+	std::vector<WORD> indices;
+	indices.reserve(kPatchIndices);
+	for (UINT z = 0; z < TERRAIN_PATCH_CELLS; z++)
+	{
+		for (UINT x = 0; x < TERRAIN_PATCH_CELLS; x++)
+		{
+			WORD corner = (WORD)(z * kPatchVertices + x);
+			WORD right = corner + 1;
+			WORD up = corner + kPatchVertices;
+			WORD across = up + 1;
+			WORD cell[6] = { corner, up, across, corner, across, right };
+			indices.insert(indices.end(), cell, cell + 6);
+		}
+	}
+
+	D3D11_BUFFER_DESC vertexDesc;
+	vertexDesc.ByteWidth = (UINT)(vertices.size() * sizeof(XMFLOAT2));
+	vertexDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	vertexDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vertexDesc.CPUAccessFlags = 0;
+	vertexDesc.MiscFlags = 0;
+	vertexDesc.StructureByteStride = 0;
+	D3D11_SUBRESOURCE_DATA vertexData = { vertices.data(), 0, 0 };
+
+	D3D11_BUFFER_DESC indexDesc = vertexDesc;
+	indexDesc.ByteWidth = (UINT)(indices.size() * sizeof(WORD));
+	indexDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA indexData = { indices.data(), 0, 0 };
+
+	HRESULT hr = device->CreateBuffer(&vertexDesc, &vertexData, &mPatchVertices);
+	if (SUCCEEDED(hr))
+		hr = device->CreateBuffer(&indexDesc, &indexData, &mPatchIndices);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the terrain patch");
+		return false;
+	}
+	mGpuBytes += vertexDesc.ByteWidth + indexDesc.ByteWidth;
+	MemoryTracker::Get()->TrackGpuAllocation(MemoryTag_Rendering, vertexDesc.ByteWidth + indexDesc.ByteWidth);
+	return true;
+}
+
+bool Terrain::CreateTextures(ID3D11Device* device)
+{
+	// 16 bit heights as they are in the file, the shader scales them back. tiles are filled in as they stream in
+	D3D11_TEXTURE2D_DESC tileDesc;
+	tileDesc.Width = kTileSamples;
+	tileDesc.Height = kTileSamples;
+	tileDesc.MipLevels = 1;
+	tileDesc.ArraySize = (UINT)mSlots.size();
+	tileDesc.Format = DXGI_FORMAT_R16_UNORM;
+	tileDesc.SampleDesc.Count = 1;
+	tileDesc.SampleDesc.Quality = 0;
+	tileDesc.Usage = D3D11_USAGE_DEFAULT;
+	tileDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	tileDesc.CPUAccessFlags = 0;
+	tileDesc.MiscFlags = 0;
+
+	D3D11_TEXTURE2D_DESC coarseDesc = tileDesc;
+	coarseDesc.Width = mCoarseX;
+	coarseDesc.Height = mCoarseZ;
+	coarseDesc.ArraySize = 1;
+	coarseDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	D3D11_SUBRESOURCE_DATA coarseData = { mCoarse, mCoarseX * (UINT)sizeof(WORD), 0 };
+
+	// bilinear, morphed vertices land between samples
+	D3D11_SAMPLER_DESC samplerDesc;
+	ZeroMemory(&samplerDesc, sizeof(samplerDesc));
+	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	HRESULT hr = device->CreateTexture2D(&tileDesc, nullptr, &mTileArray);
+	if (SUCCEEDED(hr))
+		hr = device->CreateShaderResourceView(mTileArray, nullptr, &mTileView);
+	if (SUCCEEDED(hr))
+		hr = device->CreateTexture2D(&coarseDesc, &coarseData, &mCoarseTexture);
+	if (SUCCEEDED(hr))
+		hr = device->CreateShaderResourceView(mCoarseTexture, nullptr, &mCoarseView);
+	if (SUCCEEDED(hr))
+		hr = device->CreateSamplerState(&samplerDesc, &mSampler);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the terrain height textures");
+		return false;
+	}
+
+	// anything resident before has to go up again
+	for (TileSlot& slot : mSlots)
+		slot.uploaded = false;
+
+	size_t bytes = (size_t)kTileSamples * kTileSamples * sizeof(WORD) * mSlots.size() + (size_t)mCoarseX * mCoarseZ * sizeof(WORD);
+	mGpuBytes += bytes;
+	MemoryTracker::Get()->TrackGpuAllocation(MemoryTag_Rendering, bytes);
+	return true;
+}
+
+void Terrain::ReleaseRenderer()
+{
+	mInstances.Release();
+	SafeRelease(mPatchVertices);
+	SafeRelease(mPatchIndices);
+	SafeRelease(mConstants);
+	SafeRelease(mVertexShader);
+	SafeRelease(mPixelShader);
+	SafeRelease(mLayout);
+	SafeRelease(mTileView);
+	SafeRelease(mTileArray);
+	SafeRelease(mCoarseView);
+	SafeRelease(mCoarseTexture);
+	SafeRelease(mSampler);
+
+	if (mGpuBytes)
+		MemoryTracker::Get()->TrackGpuFree(MemoryTag_Rendering, mGpuBytes);
+	mGpuBytes = 0;
+}
+
+void Terrain::Render(RenderContext* context, const XMFLOAT4X4& viewProjection, const XMFLOAT3& camera)
+{
+	if (!context || !mVertexShader || mPatches.empty())
+		return;
+
+	// tiles Update() has put in a slot since last frame, straight from the file
+	for (UINT i = 0; i < (UINT)mSlots.size(); i++)
+	{
+		TileSlot& slot = mSlots[i];
+		if (slot.tile < 0 || slot.uploaded)
+			continue;
+
+		const WORD* tile = mTiles + (size_t)slot.tile * kTileSamples * kTileSamples;
+		context->UpdateSubresource(mTileArray, D3D11CalcSubresource(0, i, 1), nullptr, tile, kTileSamples * sizeof(WORD), 0);
+		slot.uploaded = true;
+	}
+	mStats.pendingUploads = 0;
+
+	UINT count = (UINT)mPatches.size();
+	UINT firstInstance = 0;
+	if (!mInstances.Begin(context))
+		return;
+	void* instances = mInstances.Allocate(count, sizeof(TerrainPatch), &firstInstance);
+	if (instances)
+		memcpy(instances, mPatches.data(), count * sizeof(TerrainPatch));
+	mInstances.End(context);
+	if (!instances)
+		return;
+
+	TerrainConstants constants;
+	constants.viewProjection = viewProjection;
+	constants.camera = camera;
+	constants.heightMin = mHeader->heightMin;
+	constants.mapMax = XMFLOAT2(mHeader->originX + mCellsX * mHeader->spacing, mHeader->originZ + mCellsZ * mHeader->spacing);
+	constants.heightRange = mHeader->heightMax - mHeader->heightMin;
+	constants.gridCells = (float)TERRAIN_PATCH_CELLS;
+	for (UINT lod = 0; lod < 16; lod++)
+	{
+		float morphLength = std::max(mLodRanges[lod] - mMorphStart[lod], 1e-4f);
+		constants.morph[lod] = XMFLOAT4(mMorphStart[lod], 1.0f / morphLength, 0.0f, 0.0f);
+	}
+	context->UpdateSubresource(mConstants, 0, nullptr, &constants, 0, 0);
+
+	ID3D11Buffer* buffers[2] = { mPatchVertices, mInstances.GetBuffer() };
+	UINT strides[2] = { sizeof(XMFLOAT2), sizeof(TerrainPatch) };
+	UINT offsets[2] = { 0, 0 };
+	ID3D11ShaderResourceView* views[2] = { mTileView, mCoarseView };
+	context->IASetInputLayout(mLayout);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+	context->IASetIndexBuffer(mPatchIndices, DXGI_FORMAT_R16_UINT, 0);
+	context->VSSetShader(mVertexShader);
+	context->VSSetConstantBuffers(0, 1, &mConstants);
+	context->VSSetShaderResources(0, 2, views);
+	context->VSSetSamplers(0, 1, &mSampler);
+	context->PSSetShader(mPixelShader);
+	context->DrawIndexedInstanced(kPatchIndices, count, 0, 0, firstInstance);
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "Common.h"
+#include <d3d11.h>
+#include <vector>
+#include <xnamath.h>
+#include "Geometry.h"
+#include "MeshImport.h"
+#include "RenderCapture.h"
+#include "TransientBuffer.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// ==============================================================
+//		heightmaps
+// ==============================================================
+
+// a regular grid of heights over the xz plane, y is up
+struct Heightmap
+{
+	UINT			   width;	// samples along x
+	UINT			   depth;	// samples along z
+	float			   originX; // world position of the first sample
+	float			   originZ;
+	float			   spacing; // world units between neighbouring samples
+	std::vector<float> heights; // width * depth, a row of x at a time going up z
+};
+
+// samples the top surface of a mesh that is really a heightfield (Hills.x), the highest triangle over a sample wins
+// and samples no triangle covers take their neighbours' height. 'spacing' 0 uses the mesh's own vertex spacing
+STRANGEENGINEMK3_API bool HeightmapFromMesh(const MeshData& mesh, float spacing, Heightmap* heightmap);
+
+// one sample per pixel from the image's brightness, black at 0 and white at 'heightScale', centred on the origin
+STRANGEENGINEMK3_API bool HeightmapFromImage(const std::wstring& path, float spacing, float heightScale, Heightmap* heightmap);
+
+
+// ==============================================================
+//		cooked .terrain files
+// ==============================================================
+//
+// header | node bounds | coarse heights | tiles, every height a 16 bit step between heightMin and heightMax
+// the map is padded out to whole root nodes by repeating its edge. opened memory mapped, so the OS pages in the
+// parts that are read and a tile only costs GPU memory while it is resident
+
+#define TERRAIN_MAGIC 0x4E525453 // "STRN"
+#define TERRAIN_VERSION 1
+#define TERRAIN_PATCH_CELLS 32	// cells along each side of the one grid patch every node is drawn with
+#define TERRAIN_TILE_CELLS 128	// cells along each side of a streamed tile, its samples include the edge it shares
+#define TERRAIN_COARSE_TILE 0xffffffff
+
+#pragma pack(push, 1)
+struct TerrainFileHeader
+{
+	UINT   magic;
+	UINT   version;
+	UINT   samplesX;	   // padded, a multiple of TERRAIN_TILE_CELLS plus one
+	UINT   samplesZ;
+	UINT   sourceSamplesX; // the heightmap's own size, queries past it miss
+	UINT   sourceSamplesZ;
+	UINT   tilesX;
+	UINT   tilesZ;
+	UINT   lodCount;	   // quadtree levels, root nodes are TERRAIN_PATCH_CELLS << (lodCount - 1) cells across
+	UINT   rootsX;
+	UINT   rootsZ;
+	float  originX;
+	float  originZ;
+	float  spacing;
+	float  heightMin;
+	float  heightMax;
+	UINT64 boundsOffset; // the lowest and highest sample of every quadtree node, level 0 first, WORD pairs
+	UINT64 coarseOffset; // every 8th sample of the map, what nodes bigger than a tile are drawn from
+	UINT64 tilesOffset;	 // tilesX * tilesZ tiles of (TERRAIN_TILE_CELLS + 1)^2 samples, a row of tiles at a time
+	UINT64 fileSize;
+};
+#pragma pack(pop)
+
+// 'maxLodCount' caps the quadtree's depth, the cooker uses as few levels as cover the map (4 at least)
+STRANGEENGINEMK3_API bool CookTerrain(const Heightmap& heightmap, UINT maxLodCount, std::vector<BYTE>* file);
+STRANGEENGINEMK3_API bool SaveTerrain(const std::wstring& path, const Heightmap& heightmap, UINT maxLodCount = 8);
+
+
+// ==============================================================
+//		terrain
+// ==============================================================
+
+struct TerrainDesc
+{
+	float  detailDistance;		 // how far the finest level reaches, every coarser level twice as far. 0 is two finest patches
+	float  morphStart;			 // part of a level's range it is drawn unmorphed for, it morphs into the next level after
+	UINT64 tileBudgetBytes;		 // GPU memory for resident tiles, the least recently used are evicted past it
+	UINT   maxTileLoadsPerFrame; // tiles Update() starts loading a frame at most, the rest wait their turn
+	float  prefetchScale;		 // tiles within this times the finest tiled level's range are loaded before they are needed
+
+	TerrainDesc();
+};
+
+// one instance of the shared grid patch, also the layout of the instance buffer
+struct TerrainPatch
+{
+	XMFLOAT2 origin;   // world xz of the patch's first corner
+	float	 size;	   // world units across
+	UINT	 lod;	   // which morph range it uses, 0 is the finest
+	XMFLOAT2 uvOffset; // the first vertex's texel centre in its height texture
+	XMFLOAT2 uvScale;  // texture space between neighbouring vertices
+	UINT	 tile;	   // slice of the tile array, TERRAIN_COARSE_TILE for the coarse texture
+};
+
+struct TerrainHit
+{
+	float	 distance; // along the ray, in units of the direction's length
+	XMFLOAT3 position;
+	XMFLOAT3 normal;
+};
+
+struct TerrainStats
+{
+	UINT   patches;		  // selected by the last Update()
+	UINT   nodesVisited;
+	UINT   tilesResident;
+	UINT   tileCapacity;  // what the budget holds
+	UINT   tilesMissing;  // wanted by the last Update() but not in yet, their area was drawn coarser
+	UINT   pendingUploads;
+	UINT64 tileLoads;	  // running totals
+	UINT64 tileEvictions;
+};
+
+// a heightfield drawn with continuous distance based LOD (CDLOD): a quadtree over the map is walked every frame and
+// each selected node is drawn as the same 33x33 vertex patch scaled to its size, the vertex shader takes the height
+// from a texture and morphs each level into the next so there are no pops or cracks between them
+// nodes up to a tile big are drawn from streamed tiles that are kept in a texture array, everything bigger from a
+// coarse copy of the whole map that is always resident. height queries and raycasts read the file directly
+class STRANGEENGINEMK3_API Terrain
+{
+public:
+	Terrain();
+	~Terrain();
+
+	// a cooked .terrain file, or a heightmap cooked in memory
+	bool Open(const std::wstring& path, const TerrainDesc& desc = TerrainDesc());
+	bool Create(const Heightmap& heightmap, const TerrainDesc& desc = TerrainDesc());
+	void Close();
+	bool IsOpen() const { return mHeader != nullptr; }
+
+	// null 'device' keeps the tile bookkeeping without any textures (tools, benchmarks, headless runs)
+	bool CreateRenderer(ID3D11Device* device);
+	void ReleaseRenderer();
+
+	// selects the patches to draw from where the camera is and what it can see, and decides which tiles to load
+	void Update(const XMFLOAT3& camera, const Frustum& frustum);
+	const std::vector<TerrainPatch>& GetPatches() const { return mPatches; }
+
+	// uploads the tiles Update() asked for and draws every patch in one call. the game calls it while drawing its
+	// scene, with the engine's RenderContext and the same camera Update() was given
+	void Render(RenderContext* context, const XMFLOAT4X4& viewProjection, const XMFLOAT3& camera);
+
+	// false outside the map. between samples the surface is the same two triangles a cell is drawn with
+	bool GetHeight(float x, float z, float* height) const;
+	bool GetNormal(float x, float z, XMFLOAT3* normal) const;
+	// the first point within 'maxDistance' the ray hits the surface, walking only the quadtree nodes whose bounds it
+	// passes through. 'direction' doesn't have to be unit length
+	bool Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, TerrainHit* hit) const;
+
+	Aabb  GetBounds() const;
+	UINT  GetLodCount() const { return mHeader ? mHeader->lodCount : 0; }
+	float GetLodRange(UINT lod) const { return mLodRanges[lod]; }
+	TerrainStats GetStats() const { return mStats; }
+
+private:
+	Terrain(const Terrain&);
+	Terrain& operator=(const Terrain&);
+
+	// a slice of the tile array
+	struct TileSlot
+	{
+		int	   tile;		  // -1 when free
+		UINT64 lastUsedFrame;
+		bool   uploaded;
+	};
+
+	// a tile the selection wanted this frame that isn't in a slot yet
+	struct TileRequest
+	{
+		UINT  tile;
+		float distance;
+	};
+
+	bool Attach(const BYTE* data, UINT64 size);
+	void SetupLods();
+
+	Aabb  NodeBounds(UINT lod, UINT x, UINT z) const;
+	bool  NodeInMap(UINT lod, UINT x, UINT z) const;
+	bool  SelectNode(UINT lod, UINT x, UINT z);
+	void  AddPatch(UINT lod, UINT x, UINT z);
+	bool  RequestTile(UINT tile, float distance);
+	void  LoadTiles();
+	UINT  TileOfNode(UINT lod, UINT x, UINT z) const;
+
+	float Sample(UINT x, UINT z) const;
+	void  CellHeights(float x, float z, UINT* cellX, UINT* cellZ, float* fractionX, float* fractionZ, float corners[4]) const;
+	bool  RaycastNode(UINT lod, UINT x, UINT z, const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, TerrainHit* hit) const;
+	bool  RaycastCells(UINT x, UINT z, float enter, float exit, const XMFLOAT3& origin, const XMFLOAT3& direction, TerrainHit* hit) const;
+
+	bool CreateShaders(ID3D11Device* device);
+	bool CreatePatch(ID3D11Device* device);
+	bool CreateTextures(ID3D11Device* device);
+
+	// the file, mapped or cooked in memory
+	HANDLE					 mFile;
+	HANDLE					 mMapping;
+	const BYTE*				 mData;
+	std::vector<BYTE>		 mCooked;
+	const TerrainFileHeader* mHeader;
+	const WORD*				 mCoarse;
+	const WORD*				 mTiles;
+	std::vector<const WORD*> mBounds;		 // per level, a min and max per node
+	std::vector<UINT>		 mLevelNodesX;	 // nodes along x per level
+	UINT					 mCoarseX;
+	UINT					 mCoarseZ;
+	float					 mHeightStep;	 // (heightMax - heightMin) / 65535
+	float					 mCellsX;		 // the source map's extent in cells
+	float					 mCellsZ;
+
+	TerrainDesc	 mDesc;
+	float		 mLodRanges[16];
+	float		 mMorphStart[16];
+
+	// selection
+	XMFLOAT3				  mCamera;
+	Frustum					  mFrustum;
+	std::vector<TerrainPatch> mPatches;
+	std::vector<TileRequest>  mRequests;
+	std::vector<UINT64>		  mRequestedFrame; // per tile, so a tile is only asked for once a frame
+	UINT64					  mFrame;
+
+	// streaming
+	std::vector<int>	  mTileSlots; // per tile, its slot or -1
+	std::vector<TileSlot> mSlots;
+	TerrainStats		  mStats;
+
+	// rendering
+	ID3D11Buffer*			  mPatchVertices;
+	ID3D11Buffer*			  mPatchIndices;
+	TransientVertexBuffer	  mInstances;
+	ID3D11Buffer*			  mConstants;
+	ID3D11VertexShader*		  mVertexShader;
+	ID3D11PixelShader*		  mPixelShader;
+	ID3D11InputLayout*		  mLayout;
+	ID3D11Texture2D*		  mTileArray;
+	ID3D11ShaderResourceView* mTileView;
+	ID3D11Texture2D*		  mCoarseTexture;
+	ID3D11ShaderResourceView* mCoarseView;
+	ID3D11SamplerState*		  mSampler;
+	size_t					  mGpuBytes;
+};
@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "TextureCooker.h"
+#include "Log.h"
+#include "DDSTexture.h"
+#include "JobSystem.h"
+#include <algorithm>
+
+bool LoadDDSAsRGBA(const std::wstring& path, RGBAMipChain* chain)
+{
+	DDSTexture texture;
+	if (!texture.Open(path))
+		return false;
+
+	DXGI_FORMAT format = texture.GetFormat();
+	bool swapRedBlue = (format == DXGI_FORMAT_B8G8R8A8_UNORM || format == DXGI_FORMAT_B8G8R8X8_UNORM || format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
+	bool forceOpaque = (format == DXGI_FORMAT_B8G8R8X8_UNORM);
+	if (!swapRedBlue && format != DXGI_FORMAT_R8G8B8A8_UNORM && format != DXGI_FORMAT_R8G8B8A8_UNORM_SRGB)
+	{
+		ReportError(LogCategory_Assets, "Only 32 bit RGBA/BGRA textures can be cooked {}", path);
+		return false;
+	}
+
+	chain->width = texture.GetWidth();
+	chain->height = texture.GetHeight();
+	chain->mips.resize(texture.GetMipCount());
+
+	for (UINT level = 0; level < texture.GetMipCount(); level++)
+	{
+		DDSMipView mip = texture.GetMip(level);
+		std::vector<BYTE>& pixels = chain->mips[level];
+		pixels.resize(mip.width * mip.height * 4);
+
+		for (UINT y = 0; y < mip.height; y++)
+		{
+			const BYTE* src = mip.data + y * mip.rowPitch;
+			BYTE* dst = &pixels[y * mip.width * 4];
+			for (UINT x = 0; x < mip.width * 4; x += 4)
+			{
+				dst[x + 0] = swapRedBlue ? src[x + 2] : src[x + 0];
+				dst[x + 1] = src[x + 1];
+				dst[x + 2] = swapRedBlue ? src[x + 0] : src[x + 2];
+				dst[x + 3] = forceOpaque ? 255 : src[x + 3];
+			}
+		}
+	}
+	return true;
+}
+
+bool LoadImageAsRGBA(const std::wstring& path, const TextureCookSettings& settings, RGBAMipChain* chain)
+{
+	ImageImportSettings importSettings = { settings.mipFilter, settings.srgb, settings.preserveAlphaCoverage, settings.alphaCutoff };
+	LinearImage image;
+	if (!ImportImage(path, importSettings, &image))
+		return false;
+
+	chain->width = image.width;
+	chain->height = image.height;
+	chain->mips.resize(image.mips.size());
+	for (size_t level = 0; level < image.mips.size(); level++)
+	{
+		size_t pixelCount = image.mips[level].size() / 4;
+		chain->mips[level].resize(pixelCount * 4);
+		ConvertFromLinear(image.mips[level].data(), pixelCount, settings.srgb, chain->mips[level].data());
+	}
+	return true;
+}
+
+static bool IsDDSPath(const std::wstring& path)
+{
+	size_t dot = path.find_last_of(L'.');
+	return dot != std::wstring::npos && _wcsicmp(path.c_str() + dot, L".dds") == 0;
+}
+
+bool LoadTextureSource(const std::wstring& path, const TextureCookSettings& settings, RGBAMipChain* chain)
+{
+	if (IsDDSPath(path))
+		return LoadDDSAsRGBA(path, chain);
+	return LoadImageAsRGBA(path, settings, chain);
+}
+
+void CompressMipChain(const RGBAMipChain& chain, const TextureCookSettings& settings,
+	std::vector<std::vector<BYTE>>* compressedMips, TextureCookReport* report)
+{
+	// one task per 4 block rows of any mip, so the small mips don't sit on one thread at the end
+	struct Task
+	{
+		UINT mip;
+		UINT firstBlockRow;
+		UINT numBlockRows;
+	};
+	const UINT rowsPerTask = 4;
+
+	std::vector<Task> tasks;
+	std::vector<UINT> mipWidths, mipHeights;
+	compressedMips->resize(chain.mips.size());
+
+	UINT width = chain.width, height = chain.height;
+	UINT64 pixels = 0;
+	for (UINT level = 0; level < chain.mips.size(); level++)
+	{
+		mipWidths.push_back(width);
+		mipHeights.push_back(height);
+		(*compressedMips)[level].resize(GetBCSurfaceSize(settings.format, width, height));
+		pixels += (UINT64)width * height;
+
+		UINT blockRows = std::max(1u, (height + 3) / 4);
+		for (UINT row = 0; row < blockRows; row += rowsPerTask)
+			tasks.push_back({ level, row, std::min(rowsPerTask, blockRows - row) });
+
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	JobSystem::Get()->ParallelFor((unsigned int)tasks.size(), 1, [&](unsigned int begin, unsigned int taskEnd)
+	{
+		for (unsigned int i = begin; i < taskEnd; i++)
+		{
+			const Task& task = tasks[i];
+			CompressBCBlockRows(chain.mips[task.mip].data(), mipWidths[task.mip], mipHeights[task.mip], mipWidths[task.mip] * 4,
+				settings.format, settings.quality, (*compressedMips)[task.mip].data(), task.firstBlockRow, task.numBlockRows);
+		}
+	});
+
+	QueryPerformanceCounter(&end);
+
+	if (report == nullptr)
+		return;
+
+	report->width = chain.width;
+	report->height = chain.height;
+	report->mipCount = (UINT)chain.mips.size();
+	report->sourceBytes = pixels * 4;
+	report->cookedBytes = 0;
+	for (const std::vector<BYTE>& mip : *compressedMips)
+		report->cookedBytes += mip.size();
+	report->compressSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	report->megapixelsPerSecond = (report->compressSeconds > 0.0) ? (pixels / 1000000.0) / report->compressSeconds : 0.0;
+	report->importSeconds = 0.0;
+
+	std::vector<BYTE> decoded(chain.width * chain.height * 4);
+	DecompressBC((*compressedMips)[0].data(), chain.width, chain.height, settings.format, decoded.data());
+	report->error = MeasureBCError(chain.mips[0].data(), chain.width * 4, decoded.data(), chain.width * 4, chain.width, chain.height, settings.format);
+}
+
+bool CookTexture(const std::wstring& sourcePath, const std::wstring& destPath, const TextureCookSettings& settings, TextureCookReport* report)
+{
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	RGBAMipChain chain;
+	if (!LoadTextureSource(sourcePath, settings, &chain))
+		return false;
+
+	QueryPerformanceCounter(&end);
+
+	std::vector<std::vector<BYTE>> compressed;
+	TextureCookReport localReport;
+	if (report == nullptr)
+		report = &localReport;
+	CompressMipChain(chain, settings, &compressed, report);
+
+	// .dds sources are only mapped and copied, not worth reporting
+	if (!IsDDSPath(sourcePath))
+		report->importSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+	return SaveDDS(destPath, GetBCDXGIFormat(settings.format, settings.srgb), chain.width, chain.height, compressed);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Common.h"
+#include "BlockCompression.h"
+#include "ImageImport.h"
+#include <vector>
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+struct TextureCookSettings
+{
+	BCFormat  format;
+	BCQuality quality;
+	bool	  srgb; // only changes the DXGI format written to the header, the blocks are identical
+
+	// only used for PNG/JPG/... sources, .dds sources already carry their mips
+	// 'srgb' above also decides whether the mips are filtered in linear space
+	MipFilter mipFilter;
+	bool	  preserveAlphaCoverage;
+	float	  alphaCutoff;
+};
+
+struct TextureCookReport
+{
+	UINT		  width;
+	UINT		  height;
+	UINT		  mipCount;
+	UINT64		  sourceBytes;		   // uncompressed RGBA8 size of every mip
+	UINT64		  cookedBytes;		   // compressed size of every mip
+	double		  compressSeconds;	   // wall clock time spent in the encoder
+	double		  megapixelsPerSecond; // every mip's pixels / compressSeconds
+	double		  importSeconds;	   // decode + mip generation for image sources, 0 for .dds
+	BCErrorReport error;			   // measured on the top mip
+};
+
+// an uncompressed RGBA8 mip chain, mips[0] is the largest
+struct RGBAMipChain
+{
+	UINT width;
+	UINT height;
+	std::vector<std::vector<BYTE>> mips;
+};
+
+// reads every mip of an uncompressed 8 bit per channel .dds file as RGBA8
+STRANGEENGINEMK3_API bool LoadDDSAsRGBA(const std::wstring& path, RGBAMipChain* chain);
+
+// decodes an image and builds its mip chain with the cook settings' filter
+STRANGEENGINEMK3_API bool LoadImageAsRGBA(const std::wstring& path, const TextureCookSettings& settings, RGBAMipChain* chain);
+
+// picks LoadDDSAsRGBA or LoadImageAsRGBA from the file extension
+STRANGEENGINEMK3_API bool LoadTextureSource(const std::wstring& path, const TextureCookSettings& settings, RGBAMipChain* chain);
+
+// compresses every mip of 'chain', blocks of every mip are spread over the job system together
+STRANGEENGINEMK3_API void CompressMipChain(const RGBAMipChain& chain, const TextureCookSettings& settings,
+	std::vector<std::vector<BYTE>>* compressedMips, TextureCookReport* report);
+
+// source .dds/.png/.jpg -> block compressed .dds, 'report' is optional
+STRANGEENGINEMK3_API bool CookTexture(const std::wstring& sourcePath, const std::wstring& destPath,
+	const TextureCookSettings& settings, TextureCookReport* report);
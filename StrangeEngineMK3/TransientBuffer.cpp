@@ -0,0 +1,122 @@
+#include "pch.h"
+#include "TransientBuffer.h"
+#include "Log.h"
+#include "MemoryTracking.h"
+
+TransientVertexBuffer::TransientVertexBuffer()
+{
+	mBuffer = nullptr;
+	mSystemMemory = nullptr;
+	mData = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+}
+
+TransientVertexBuffer::~TransientVertexBuffer()
+{
+	Release();
+}
+
+bool TransientVertexBuffer::Create(ID3D11Device* device, UINT capacityBytes)
+{
+	Release();
+
+	if (!device)
+	{
+		mSystemMemory = (BYTE*)_aligned_malloc(capacityBytes, 64);
+		if (!mSystemMemory)
+		{
+			ReportError(LogCategory_Render, "Could not allocate the transient vertex buffer");
+			return false;
+		}
+		mCapacity = capacityBytes;
+		MemoryTracker::Get()->TrackAllocation(MemoryTag_Rendering, mCapacity);
+		return true;
+	}
+
+	D3D11_BUFFER_DESC desc;
+	desc.ByteWidth = capacityBytes;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	HRESULT hr = device->CreateBuffer(&desc, 0, &mBuffer);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not create the transient vertex buffer");
+		return false;
+	}
+	mCapacity = capacityBytes;
+	MemoryTracker::Get()->TrackGpuAllocation(MemoryTag_Rendering, mCapacity);
+	return true;
+}
+
+void TransientVertexBuffer::Release()
+{
+	if (mBuffer)
+	{
+		mBuffer->Release(); mBuffer = nullptr;
+		MemoryTracker::Get()->TrackGpuFree(MemoryTag_Rendering, mCapacity);
+	}
+	if (mSystemMemory)
+	{
+		_aligned_free(mSystemMemory); mSystemMemory = nullptr;
+		MemoryTracker::Get()->TrackFree(MemoryTag_Rendering, mCapacity);
+	}
+	mData = nullptr;
+	mCapacity = 0;
+	mUsed = 0;
+}
+
+bool TransientVertexBuffer::Begin(RenderContext* context)
+{
+	mUsed.store(0, std::memory_order_relaxed);
+	if (!mBuffer)
+	{
+		mData = mSystemMemory;
+		return mData != nullptr;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	HRESULT hr = context->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	// check for failure
+	if (FAILED(hr))
+	{
+		ReportError(LogCategory_Render, "Could not map the transient vertex buffer");
+		mData = nullptr;
+		return false;
+	}
+	mData = (BYTE*)mapped.pData;
+	return true;
+}
+
+void* TransientVertexBuffer::Allocate(UINT count, UINT stride, UINT* firstVertex)
+{
+	if (!mData)
+		return nullptr;
+
+	// a compare and swap rather than an add, the start has to be rounded up to the stride first
+	UINT used = mUsed.load(std::memory_order_relaxed);
+	UINT start, end;
+	do
+	{
+		start = (used + stride - 1) / stride * stride;
+		if ((UINT64)start + (UINT64)count * stride > mCapacity)
+			return nullptr;
+		end = start + count * stride;
+	} while (!mUsed.compare_exchange_weak(used, end, std::memory_order_relaxed));
+
+	if (firstVertex)
+		*firstVertex = start / stride;
+	return mData + start;
+}
+
+void TransientVertexBuffer::End(RenderContext* context)
+{
+	if (mBuffer && mData)
+		context->Unmap(mBuffer, 0, mUsed.load(std::memory_order_relaxed));
+	mData = nullptr;
+}
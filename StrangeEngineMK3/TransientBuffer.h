@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <d3d11.h>
+#include "RenderCapture.h"
+
+#ifdef STRANGEENGINEMK3_EXPORTS
+#define STRANGEENGINEMK3_API __declspec(dllexport)
+#else
+#define STRANGEENGINEMK3_API __declspec(dllimport)
+#endif // STRANGEENGINE_EXPORTS
+
+// a vertex buffer that is refilled from scratch every frame, for geometry the CPU builds each frame (particles, debug lines)
+// Begin() maps the whole buffer with WRITE_DISCARD, so the driver hands back fresh memory without waiting for the GPU
+// to finish last frame's draws. Allocate() claims its space with a compare and swap loop on the used size (the start is
+// rounded up to the stride first), so jobs can allocate and write their parts at the same time without a lock
+class STRANGEENGINEMK3_API TransientVertexBuffer
+{
+public:
+	TransientVertexBuffer();
+	~TransientVertexBuffer();
+
+	// 'device' can be null, then it is plain system memory and Begin()/End() ignore the context (tools and benchmarks)
+	bool Create(ID3D11Device* device, UINT capacityBytes);
+	void Release();
+
+	// everything allocated before is thrown away
+	bool Begin(RenderContext* context);
+	// room for 'count' vertices of 'stride' bytes, null if the frame's space has run out
+	// the space starts on a multiple of 'stride', 'firstVertex' is where it starts as a vertex index to draw from
+	void* Allocate(UINT count, UINT stride, UINT* firstVertex);
+	// unmaps, the buffer can be drawn from after this. a capture only keeps the part that was allocated
+	void End(RenderContext* context);
+
+	ID3D11Buffer* GetBuffer() const { return mBuffer; }
+	UINT GetCapacity() const { return mCapacity; }
+	UINT GetUsedBytes() const { return mUsed.load(std::memory_order_relaxed); }
+
+private:
+	TransientVertexBuffer(const TransientVertexBuffer&);
+	TransientVertexBuffer& operator=(const TransientVertexBuffer&);
+
+	ID3D11Buffer*	  mBuffer;
+	BYTE*			  mSystemMemory; // instead of mBuffer when there is no device
+	BYTE*			  mData;		 // mapped memory between Begin() and End()
+	UINT			  mCapacity;
+	std::atomic<UINT> mUsed;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+// a small timing harness: warm up once, time every iteration, keep the min/median/mean
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult
+{
+    std::string name;
+    int iterations;
+    double minMs;
+    double medianMs;
+    double meanMs;
+};
+
+// every result is kept as "group/name" (or "group/name/variant" when a benchmark runs once per size, file...),
+// so a whole run can be written out as json and compared against an earlier one
+struct BenchmarkRecord
+{
+    std::string key;
+    BenchmarkResult result;
+};
+
+inline std::vector<BenchmarkRecord>& GetBenchmarkRecords()
+{
+    static std::vector<BenchmarkRecord> records;
+    return records;
+}
+
+inline std::string& CurrentBenchmarkGroup()
+{
+    static std::string group;
+    return group;
+}
+
+inline std::string& CurrentBenchmarkVariant()
+{
+    static std::string variant;
+    return variant;
+}
+
+inline void BeginBenchmarkGroup(const std::string& group)
+{
+    CurrentBenchmarkGroup() = group;
+    CurrentBenchmarkVariant().clear();
+}
+
+inline void SetBenchmarkVariant(const std::string& variant)
+{
+    CurrentBenchmarkVariant() = variant;
+}
+
+inline void RecordBenchmark(const BenchmarkResult& result)
+{
+    BenchmarkRecord record;
+    record.key = CurrentBenchmarkGroup() + "/" + result.name;
+    if (!CurrentBenchmarkVariant().empty())
+        record.key += "/" + CurrentBenchmarkVariant();
+    record.result = result;
+    GetBenchmarkRecords().push_back(record);
+}
+
+// min/median/mean of times measured some other way (e.g. by the engine itself), recorded like RunBenchmark's
+inline BenchmarkResult SummarizeBenchmark(const std::string& name, std::vector<double> times)
+{
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = (int)times.size();
+    result.minMs = 0.0;
+    result.medianMs = 0.0;
+    result.meanMs = 0.0;
+    if (times.empty())
+        return result;
+
+    std::sort(times.begin(), times.end());
+    result.minMs = times.front();
+    result.medianMs = times[times.size() / 2];
+    for (double time : times)
+        result.meanMs += time;
+    result.meanMs /= times.size();
+
+    RecordBenchmark(result);
+    return result;
+}
+
+template<typename Fn> BenchmarkResult RunBenchmark(const std::string& name, int iterations, Fn fn)
+{
+    // first run pays for page faults and the job system waking up, don't count it
+    fn();
+
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return SummarizeBenchmark(name, times);
+}
+
+// megapixels per second from a pixel count and a time in milliseconds
+inline double MegapixelsPerSecond(double pixels, double ms)
+{
+    return (ms > 0.0) ? (pixels / 1000000.0) / (ms / 1000.0) : 0.0;
+}
@@ -0,0 +1,2395 @@
+// benchmarks for the engine's asset pipeline, run from the repository root (or pass the media folder)
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <thread>
+#include <functional>
+#include <random>
+#include <fstream>
+#include <chrono>
+#include <Windows.h>
+#include "AssetRegistry.h"
+#include "Broadphase.h"
+#include "DDSTexture.h"
+#include "DebugDraw.h"
+#include "ECS.h"
+#include "Hash.h"
+#include "ImageImport.h"
+#include "Input.h"
+#include "JobSystem.h"
+#include "Log.h"
+#include "LightCulling.h"
+#include "LZ4.h"
+#include "MeshImport.h"
+#include "Memory.h"
+#include "PackFile.h"
+#include "Particles.h"
+#include "Physics.h"
+#include "PhysicsMath.h"
+#include "Picking.h"
+#include "Snapshot.h"
+#include "SpatialIndex.h"
+#include "SystemScheduler.h"
+#include "StrangeEngine.h"
+#include "Terrain.h"
+#include "Benchmark.h"
+
+static std::wstring Widen(const char* text)
+{
+    int length = MultiByteToWideChar(CP_ACP, 0, text, -1, nullptr, 0);
+    std::wstring result(length > 0 ? length - 1 : 0, L'\0');
+    if (length > 1)
+        MultiByteToWideChar(CP_ACP, 0, text, -1, &result[0], length);
+    return result;
+}
+
+// the file name without its folder, as UTF-8 for benchmark keys
+static std::string FileName(const std::wstring& path)
+{
+    std::wstring file = path.substr(path.find_last_of(L"\\/") + 1);
+    int length = WideCharToMultiByte(CP_UTF8, 0, file.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    std::string result(length > 0 ? length - 1 : 0, '\0');
+    if (length > 1)
+        WideCharToMultiByte(CP_UTF8, 0, file.c_str(), -1, &result[0], length, nullptr, nullptr);
+    return result;
+}
+
+static std::vector<std::wstring> FindImages(const std::wstring& folder)
+{
+    std::vector<std::wstring> paths;
+    const wchar_t* patterns[] = { L"*.png", L"*.jpg" };
+    for (const wchar_t* pattern : patterns)
+    {
+        WIN32_FIND_DATAW data;
+        HANDLE find = FindFirstFileW((folder + L"\\" + pattern).c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE)
+            continue;
+        do
+        {
+            paths.push_back(folder + L"\\" + data.cFileName);
+        } while (FindNextFileW(find, &data));
+        FindClose(find);
+    }
+    return paths;
+}
+
+static std::vector<std::wstring> FindFiles(const std::wstring& folder)
+{
+    std::vector<std::wstring> paths;
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileW((folder + L"\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return paths;
+    do
+    {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            paths.push_back(folder + L"\\" + data.cFileName);
+    } while (FindNextFileW(find, &data));
+    FindClose(find);
+    return paths;
+}
+
+static bool ReadWholeFile(const std::wstring& path, std::vector<BYTE>* bytes)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    bool ok = GetFileSizeEx(file, &size) != 0;
+    if (ok)
+    {
+        bytes->resize((size_t)size.QuadPart);
+        DWORD read = 0;
+        ok = bytes->empty() || (ReadFile(file, bytes->data(), (DWORD)bytes->size(), &read, nullptr) && read == bytes->size());
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+// random noise, alpha included so the coverage pass has something to do
+static std::vector<BYTE> MakeTestImage(UINT size)
+{
+    std::vector<BYTE> rgba((size_t)size * size * 4);
+    unsigned int state = 12345;
+    for (size_t i = 0; i < rgba.size(); i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        rgba[i] = (BYTE)(state >> 24);
+    }
+    return rgba;
+}
+
+static void ImageSizeBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("imagesize");
+    std::cout << "image pipeline per size (median of " << iterations << " runs, ms)\n";
+    std::cout << std::left << std::setw(11) << "size"
+        << std::right << std::setw(10) << "toLinear" << std::setw(10) << "box" << std::setw(10) << "kaiser"
+        << std::setw(10) << "coverage" << std::setw(10) << "toSRGB" << std::setw(12) << "kaiser MP/s" << "\n";
+
+    const UINT sizes[] = { 64, 128, 256, 512, 1024, 2048 };
+    for (UINT size : sizes)
+    {
+        SetBenchmarkVariant(std::to_string(size));
+        std::vector<BYTE> rgba = MakeTestImage(size);
+        size_t pixelCount = (size_t)size * size;
+
+        LinearImage image;
+        image.width = size;
+        image.height = size;
+        image.mips.resize(1);
+        image.mips[0].resize(pixelCount * 4);
+
+        BenchmarkResult toLinear = RunBenchmark("toLinear", iterations, [&]()
+        {
+            ConvertToLinear(rgba.data(), pixelCount, true, image.mips[0].data());
+        });
+        BenchmarkResult box = RunBenchmark("box", iterations, [&]()
+        {
+            GenerateMipChain(&image, MipFilter_Box);
+        });
+        BenchmarkResult kaiser = RunBenchmark("kaiser", iterations, [&]()
+        {
+            GenerateMipChain(&image, MipFilter_Kaiser);
+        });
+
+        // coverage rescales in place, so every run works on a fresh copy of the chain
+        LinearImage scratch;
+        BenchmarkResult coverage = RunBenchmark("coverage", iterations, [&]()
+        {
+            scratch = image;
+            PreserveAlphaCoverage(&scratch, 0.5f);
+        });
+        BenchmarkResult copy = RunBenchmark("copy", iterations, [&]()
+        {
+            scratch = image;
+        });
+
+        std::vector<BYTE> back(pixelCount * 4);
+        BenchmarkResult toSRGB = RunBenchmark("toSRGB", iterations, [&]()
+        {
+            ConvertFromLinear(image.mips[0].data(), pixelCount, true, back.data());
+        });
+
+        std::string label = std::to_string(size) + "x" + std::to_string(size);
+        std::cout << std::left << std::setw(11) << label << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << toLinear.medianMs << std::setw(10) << box.medianMs << std::setw(10) << kaiser.medianMs
+            << std::setw(10) << std::max(0.0, coverage.medianMs - copy.medianMs) << std::setw(10) << toSRGB.medianMs
+            << std::setw(12) << std::setprecision(1) << MegapixelsPerSecond((double)pixelCount, kaiser.medianMs) << "\n";
+    }
+    std::cout << "\n";
+}
+
+static void DecodeBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("decode");
+    std::vector<std::wstring> paths = FindImages(folder);
+    if (paths.empty())
+    {
+        std::wcout << L"no .png/.jpg files in " << folder << L", skipping the decode benchmarks\n";
+        return;
+    }
+
+    std::cout << "decode per file (median of " << iterations << " runs, ms)\n";
+    std::cout << std::left << std::setw(20) << "file" << std::setw(11) << "size"
+        << std::right << std::setw(10) << "decode" << std::setw(10) << "MP/s" << "\n";
+
+    for (const std::wstring& path : paths)
+    {
+        UINT width = 0, height = 0;
+        std::vector<BYTE> rgba;
+        if (!DecodeImage(path, &width, &height, &rgba))
+            continue;
+        SetBenchmarkVariant(FileName(path));
+
+        BenchmarkResult decode = RunBenchmark("decode", iterations, [&]()
+        {
+            DecodeImage(path, &width, &height, &rgba);
+        });
+
+        std::wstring file = path.substr(path.find_last_of(L"\\/") + 1);
+        std::string label = std::to_string(width) + "x" + std::to_string(height);
+        std::wcout << std::left << std::setw(20) << file;
+        std::cout << std::left << std::setw(11) << label << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << decode.medianMs
+            << std::setw(10) << std::setprecision(1) << MegapixelsPerSecond((double)width * height, decode.medianMs) << "\n";
+    }
+
+    // the whole folder one file after another on this thread, then as one batch over the job system
+    SetBenchmarkVariant("");
+    ImageImportSettings settings = { MipFilter_Kaiser, true, false, 0.5f };
+    BenchmarkResult serial = RunBenchmark("serial", iterations, [&]()
+    {
+        for (const std::wstring& path : paths)
+        {
+            LinearImage image;
+            ImportImage(path, settings, &image);
+        }
+    });
+    BenchmarkResult parallel = RunBenchmark("parallel", iterations, [&]()
+    {
+        std::vector<LinearImage> images;
+        std::vector<bool> succeeded;
+        ImportImages(paths, settings, &images, &succeeded);
+    });
+
+    std::cout << "\nimport all " << paths.size() << " files (decode + linear + kaiser mips)\n"
+        << std::fixed << std::setprecision(3)
+        << "  one at a time: " << serial.medianMs << " ms\n"
+        << "  batched:       " << parallel.medianMs << " ms (" << std::setprecision(2)
+        << (parallel.medianMs > 0.0 ? serial.medianMs / parallel.medianMs : 0.0) << "x on "
+        << std::thread::hardware_concurrency() << " hardware threads)\n\n";
+}
+
+static void PackBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("pack");
+    std::vector<std::wstring> paths = FindFiles(folder);
+    if (paths.empty())
+    {
+        std::wcout << L"no files in " << folder << L", skipping the pack benchmarks\n";
+        return;
+    }
+
+    // LZ4 on its own, file by file
+    std::cout << "LZ4 per file (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(28) << "file" << std::right << std::setw(12) << "size" << std::setw(8) << "ratio"
+        << std::setw(14) << "compress MB/s" << std::setw(16) << "decompress MB/s" << "\n";
+
+    for (const std::wstring& path : paths)
+    {
+        std::vector<BYTE> source;
+        if (!ReadWholeFile(path, &source) || source.empty())
+            continue;
+        SetBenchmarkVariant(FileName(path));
+
+        std::vector<BYTE> compressed(LZ4CompressBound(source.size()));
+        std::vector<BYTE> back(source.size());
+        size_t compressedSize = 0;
+        BenchmarkResult compress = RunBenchmark("compress", iterations, [&]()
+        {
+            compressedSize = LZ4Compress(source.data(), source.size(), compressed.data(), compressed.size());
+        });
+        BenchmarkResult decompress = RunBenchmark("decompress", iterations, [&]()
+        {
+            LZ4Decompress(compressed.data(), compressedSize, back.data(), back.size());
+        });
+
+        double megabytes = (double)source.size() / (1024.0 * 1024.0);
+        std::wstring file = path.substr(path.find_last_of(L"\\/") + 1);
+        std::wcout << std::left << std::setw(28) << file;
+        std::cout << std::right << std::setw(12) << source.size() << std::fixed << std::setprecision(2)
+            << std::setw(7) << (compressedSize > 0 ? (double)source.size() / compressedSize : 0.0) << "x"
+            << std::setprecision(1)
+            << std::setw(14) << (compress.medianMs > 0.0 ? megabytes / (compress.medianMs / 1000.0) : 0.0)
+            << std::setw(16) << (decompress.medianMs > 0.0 ? megabytes / (decompress.medianMs / 1000.0) : 0.0) << "\n";
+    }
+
+    SetBenchmarkVariant("");
+
+    // the same folder loaded as loose files, then out of a pack. the OS file cache is warm for both after the first run,
+    // so this measures the per file open/read cost and decompression rather than the disk
+    const std::wstring packPath = L"Benchmark.pak";
+    PackWriter writer;
+    PackWriteStats stats;
+    if (!writer.AddFolder(folder) || !writer.Write(packPath, &stats))
+    {
+        std::cout << "failed to write Benchmark.pak, skipping the pack load benchmark\n\n";
+        return;
+    }
+
+    std::vector<BYTE> buffer;
+    BenchmarkResult loose = RunBenchmark("loose", iterations, [&]()
+    {
+        for (const std::wstring& path : paths)
+            ReadWholeFile(path, &buffer);
+    });
+
+    PackFile pack;
+    BenchmarkResult packed = RunBenchmark("pack", iterations, [&]()
+    {
+        pack.Open(packPath);
+        for (UINT i = 0; i < pack.GetEntryCount(); i++)
+        {
+            buffer.resize((size_t)pack.GetEntrySize(i));
+            pack.ReadEntry(i, buffer.data(), buffer.size());
+        }
+        pack.Close();
+    });
+    DeleteFileW(packPath.c_str());
+
+    std::cout << "\nload all " << paths.size() << " files\n"
+        << std::fixed << std::setprecision(3)
+        << "  loose files: " << loose.medianMs << " ms (" << stats.sourceBytes << " bytes)\n"
+        << "  pack:        " << packed.medianMs << " ms (" << stats.fileSize << " bytes, "
+        << std::setprecision(2) << (stats.fileSize > 0 ? (double)stats.sourceBytes / stats.fileSize : 0.0) << "x smaller)\n\n";
+}
+
+// ==============================================================
+//		entities
+// ==============================================================
+
+struct BenchPosition { float x, y, z; };
+struct BenchVelocity { float x, y, z; };
+struct BenchHealth { float current, maximum; };
+struct BenchTag { UINT frame; };
+
+// what the same data looks like as one heap allocation per object, visited in allocation order after the heap has been churned
+struct BenchGameObject
+{
+    BenchPosition position;
+    BenchVelocity velocity;
+    BenchHealth health;
+    char other[96]; // the rest of a typical object that an update doesn't touch
+};
+
+static void EntityBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("ecs");
+    const UINT count = 1000000;
+    const float dt = 1.0f / 60.0f;
+
+    std::cout << "entities (" << count << ", median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(28) << "test" << std::right << std::setw(12) << "ms" << std::setw(14) << "ns/entity" << "\n";
+    auto report = [&](const char* name, const BenchmarkResult& result, double operations)
+    {
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << result.medianMs << std::setw(14) << std::setprecision(2)
+            << (operations > 0.0 ? result.medianMs * 1000000.0 / operations : 0.0) << "\n";
+    };
+
+    // a quarter also have health, so queries have to skip an archetype
+    auto populate = [&](EntityWorld* world)
+    {
+        for (UINT i = 0; i < count; i++)
+        {
+            BenchPosition position = { (float)i, 0.0f, 0.0f };
+            BenchVelocity velocity = { 1.0f, 2.0f, 3.0f };
+            if (i % 4 == 0)
+                world->Create(position, velocity, BenchHealth{ 100.0f, 100.0f });
+            else
+                world->Create(position, velocity);
+        }
+    };
+
+    BenchmarkResult create = RunBenchmark("create", iterations, [&]()
+    {
+        EntityWorld scratch;
+        populate(&scratch);
+    });
+    report("create + destroy world", create, count);
+
+    EntityWorld world;
+    populate(&world);
+
+    BenchmarkResult each = RunBenchmark("each", iterations, [&]()
+    {
+        world.Each<BenchPosition, const BenchVelocity>([dt](Entity, BenchPosition& position, const BenchVelocity& velocity)
+        {
+            position.x += velocity.x * dt;
+            position.y += velocity.y * dt;
+            position.z += velocity.z * dt;
+        });
+    });
+    report("Each", each, count);
+
+    BenchmarkResult eachChunk = RunBenchmark("eachChunk", iterations, [&]()
+    {
+        world.EachChunk<BenchPosition, const BenchVelocity>([dt](UINT entities, const Entity*, BenchPosition* positions, const BenchVelocity* velocities)
+        {
+            for (UINT i = 0; i < entities; i++)
+            {
+                positions[i].x += velocities[i].x * dt;
+                positions[i].y += velocities[i].y * dt;
+                positions[i].z += velocities[i].z * dt;
+            }
+        });
+    });
+    report("EachChunk", eachChunk, count);
+
+    BenchmarkResult parallel = RunBenchmark("parallelEach", iterations, [&]()
+    {
+        world.ParallelEach<BenchPosition, const BenchVelocity>([dt](Entity, BenchPosition& position, const BenchVelocity& velocity)
+        {
+            position.x += velocity.x * dt;
+            position.y += velocity.y * dt;
+            position.z += velocity.z * dt;
+        });
+    });
+    report("ParallelEach", parallel, count);
+
+    // the baseline, freed and reallocated in a shuffled order so neighbours in the list aren't neighbours in memory
+    {
+        std::vector<BenchGameObject*> objects(count);
+        for (UINT i = 0; i < count; i++)
+            objects[i] = new BenchGameObject();
+        std::mt19937 random(1234);
+        std::shuffle(objects.begin(), objects.end(), random);
+        for (UINT i = 0; i < count; i += 2)
+        {
+            delete objects[i];
+            objects[i] = new BenchGameObject();
+        }
+        std::shuffle(objects.begin(), objects.end(), random);
+
+        BenchmarkResult pointers = RunBenchmark("pointers", iterations, [&]()
+        {
+            for (BenchGameObject* object : objects)
+            {
+                object->position.x += object->velocity.x * dt;
+                object->position.y += object->velocity.y * dt;
+                object->position.z += object->velocity.z * dt;
+            }
+        });
+        report("heap objects (baseline)", pointers, count);
+
+        for (BenchGameObject* object : objects)
+            delete object;
+    }
+
+    // half the entities get a tag and lose it again, recorded from the workers and played back on this thread
+    UINT changes = 0;
+    BenchmarkResult mutate = RunBenchmark("mutate", iterations, [&]()
+    {
+        world.ParallelEach<const BenchPosition>([&world](Entity entity, const BenchPosition&)
+        {
+            if (entity.index % 2 == 0)
+                world.GetCommands().Add(entity, BenchTag{ entity.index });
+        });
+        world.PlaybackCommands();
+        changes = world.Count<BenchTag>();
+
+        world.ParallelEach<BenchTag>([&world](Entity entity, BenchTag&)
+        {
+            world.GetCommands().Remove<BenchTag>(entity);
+        });
+        world.PlaybackCommands();
+    });
+    report("add + remove a component", mutate, changes * 2.0);
+
+    std::cout << "  " << world.GetArchetypeCount() << " archetypes, " << world.GetChunkCount() << " chunks of "
+        << ECS_CHUNK_SIZE / 1024 << "KB, " << std::thread::hardware_concurrency() << " hardware threads\n\n";
+}
+
+// a large scene saved, loaded and rewound. a tenth of it moves every frame, the rest is scenery
+static void SnapshotBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("snapshot");
+    const UINT count = 500000;
+    const UINT frames = 600;
+    std::cout << "snapshots of " << count << " entities (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(22) << "test" << std::right << std::setw(12) << "ms" << std::setw(12) << "MB"
+        << std::setw(12) << "MB/s" << "\n";
+    auto row = [&](const char* test, const BenchmarkResult& result, double bytes)
+    {
+        double megabytes = bytes / (1024.0 * 1024.0);
+        std::cout << std::left << std::setw(22) << test << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << result.medianMs << std::setprecision(1) << std::setw(12) << megabytes
+            << std::setw(12) << (result.medianMs > 0.0 ? megabytes / (result.medianMs / 1000.0) : 0.0) << "\n";
+    };
+
+    struct BenchScore { UINT frame; UINT score; float clock; };
+    EntityWorld world;
+    BenchScore score = { 0, 0, 0.0f };
+    for (UINT i = 0; i < count; i++)
+    {
+        BenchPosition position = { (float)(i % 1000), 0.0f, (float)(i / 1000) };
+        if (i % 10 == 0)
+            world.Create(position, BenchVelocity{ 1.0f, 0.0f, 0.5f }, BenchHealth{ 100.0f, 100.0f });
+        else
+            world.Create(position, BenchTag{ i });
+    }
+
+    WorldState state;
+    state.SetWorld(&world);
+    state.AddBlock("score", &score);
+
+    std::vector<BYTE> snapshot;
+    BenchmarkResult capture = RunBenchmark("capture", iterations, [&]()
+    {
+        state.Capture(&snapshot);
+    });
+    row("capture", capture, (double)snapshot.size());
+    BenchmarkResult restore = RunBenchmark("restore", iterations, [&]()
+    {
+        state.Restore(snapshot.data(), snapshot.size());
+    });
+    row("restore", restore, (double)snapshot.size());
+
+    const std::wstring path = L"Benchmark.snapshot";
+    BenchmarkResult save = RunBenchmark("save", iterations, [&]()
+    {
+        state.Save(path);
+    });
+    row("save", save, (double)snapshot.size());
+    bool loaded = true;
+    BenchmarkResult load = RunBenchmark("load", iterations, [&]()
+    {
+        loaded = state.Load(path) && loaded;
+    });
+    row("load (mapped)", load, (double)snapshot.size());
+    DeleteFileW(path.c_str());
+
+    // 10 seconds at 60Hz, the moving tenth changes every frame
+    RewindBuffer rewind(&state, frames, 60);
+    std::vector<double> recordTimes;
+    for (UINT frame = 0; frame < frames; frame++)
+    {
+        world.EachChunk<BenchPosition, const BenchVelocity>([](UINT entities, const Entity*, BenchPosition* positions, const BenchVelocity* velocities)
+        {
+            for (UINT i = 0; i < entities; i++)
+            {
+                positions[i].x += velocities[i].x / 60.0f;
+                positions[i].z += velocities[i].z / 60.0f;
+            }
+        });
+        score.frame = frame;
+        score.clock += 1.0f / 60.0f;
+        rewind.Record();
+        recordTimes.push_back(rewind.GetStats().recordMs);
+    }
+    BenchmarkResult record = SummarizeBenchmark("record", recordTimes);
+    RewindStats stats = rewind.GetStats();
+
+    std::vector<double> rewindTimes;
+    bool rewound = true;
+    for (int i = 0; i < iterations && rewound; i++)
+    {
+        // a second back, then record it again so there is always a second to go back over
+        rewound = rewind.Rewind(60) && score.frame == frames - 61;
+        rewindTimes.push_back(rewind.GetStats().rewindMs);
+        for (UINT frame = 0; frame < 60 && rewound; frame++)
+        {
+            score.frame++;
+            rewind.Record();
+        }
+    }
+    BenchmarkResult back = SummarizeBenchmark("rewind", rewindTimes);
+
+    std::cout << "rewind buffer, " << stats.frames << " frames in " << std::setprecision(1) << stats.storedBytes / (1024.0 * 1024.0)
+        << " MB (" << stats.keyframes << " keyframes), " << std::setprecision(1) << (stats.frames ? stats.storedBytes / 1024.0 / stats.frames : 0.0)
+        << " KB a frame against " << (stats.frames ? stats.capturedBytes / 1024.0 / stats.frames : 0.0) << " KB whole\n";
+    std::cout << "record " << std::setprecision(3) << record.medianMs << " ms a frame, rewinding a second " << back.medianMs << " ms"
+        << ((loaded && rewound) ? "" : ", RESTORE FAILED") << "\n\n";
+}
+
+// ==============================================================
+//		spatial queries
+// ==============================================================
+
+static void SpatialBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("spatial");
+    const UINT count = 100000;
+    const UINT queryCount = 1000;
+    const float worldHalf = 1000.0f;
+
+    // mostly crate sized objects with the odd building, over a flat-ish world
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(-worldHalf, worldHalf);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Aabb> bounds(count);
+    for (Aabb& box : bounds)
+    {
+        float size = (unit(random) < 0.01f) ? 10.0f + unit(random) * 40.0f : 0.5f + unit(random) * 2.0f;
+        box = MakeAabb(XMFLOAT3(position(random), position(random) * 0.05f, position(random)), XMFLOAT3(size, size, size));
+    }
+
+    std::vector<Sphere> spheres(queryCount);
+    for (Sphere& sphere : spheres)
+        sphere = { XMFLOAT3(position(random), 0.0f, position(random)), 20.0f };
+
+    // a camera at the origin looking down +z, 60 degrees, 500 units deep
+    const float nearZ = 1.0f, farZ = 500.0f, yScale = 1.0f / tanf(0.5236f), q = farZ / (farZ - nearZ);
+    XMFLOAT4X4 projection;
+    memset(&projection, 0, sizeof(projection));
+    projection._11 = yScale / (16.0f / 9.0f);
+    projection._22 = yScale;
+    projection._33 = q;
+    projection._34 = 1.0f;
+    projection._43 = -q * nearZ;
+    Frustum frustum = MakeFrustum(projection);
+
+    std::cout << "spatial index (" << count << " objects, median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(16) << "index" << std::right << std::setw(11) << "insert ms" << std::setw(11) << "move ms"
+        << std::setw(14) << "sphere q/s" << std::setw(14) << "batched q/s" << std::setw(13) << "frustum ms" << "\n";
+
+    auto row = [&](const char* name, double insertMs, double moveMs, double sphereMs, double batchedMs, double frustumMs)
+    {
+        auto perSecond = [](double queries, double ms) { return ms > 0.0 ? queries / (ms / 1000.0) : 0.0; };
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(11) << insertMs << std::setw(11) << moveMs << std::setprecision(0)
+            << std::setw(14) << perSecond(queryCount, sphereMs) << std::setw(14) << perSecond(queryCount, batchedMs)
+            << std::setprecision(3) << std::setw(13) << frustumMs << "\n";
+    };
+
+    auto measure = [&](const char* name, std::function<SpatialIndex*()> make)
+    {
+        SetBenchmarkVariant(name);
+        BenchmarkResult insert = RunBenchmark("insert", iterations, [&]()
+        {
+            SpatialIndex* index = make();
+            for (UINT i = 0; i < count; i++)
+                index->Insert(bounds[i], i);
+            delete index;
+        });
+
+        SpatialIndex* index = make();
+        for (UINT i = 0; i < count; i++)
+            index->Insert(bounds[i], i);
+
+        // everything drifts a little one way, then back the next run
+        float step = 0.25f;
+        BenchmarkResult move = RunBenchmark("move", iterations, [&]()
+        {
+            step = -step;
+            for (UINT i = 0; i < count; i++)
+            {
+                bounds[i].min.x += step;
+                bounds[i].max.x += step;
+                index->Update(i, bounds[i]);
+            }
+        });
+
+        std::vector<UINT> found;
+        BenchmarkResult sphere = RunBenchmark("sphere", iterations, [&]()
+        {
+            for (const Sphere& query : spheres)
+            {
+                found.clear();
+                index->QuerySphere(query, &found);
+            }
+        });
+
+        std::vector<std::vector<UINT>> results(queryCount);
+        BenchmarkResult batched = RunBenchmark("batched", iterations, [&]()
+        {
+            index->QuerySpheres(spheres.data(), queryCount, results.data());
+        });
+
+        BenchmarkResult frustumQuery = RunBenchmark("frustum", iterations, [&]()
+        {
+            found.clear();
+            index->QueryFrustum(frustum, &found);
+        });
+
+        row(name, insert.medianMs, move.medianMs, sphere.medianMs, batched.medianMs, frustumQuery.medianMs);
+        delete index;
+    };
+
+    measure("loose octree", [&]() { return new LooseOctree(XMFLOAT3(0.0f, 0.0f, 0.0f), worldHalf, 8); });
+    measure("spatial hash", [&]() { return new SpatialHash(8.0f); });
+
+    // what game code does without either, a tenth of the queries since it is that much slower
+    SetBenchmarkVariant("");
+    std::vector<UINT> found;
+    BenchmarkResult linear = RunBenchmark("linear", iterations, [&]()
+    {
+        for (UINT q = 0; q < queryCount / 10; q++)
+        {
+            found.clear();
+            for (UINT i = 0; i < count; i++)
+            {
+                if (SphereOverlapsAabb(spheres[q], bounds[i]))
+                    found.push_back(i);
+            }
+        }
+    });
+    row("linear scan", 0.0, 0.0, linear.medianMs * 10.0, 0.0, 0.0);
+    std::cout << "\n";
+}
+
+// ==============================================================
+//		broadphase
+// ==============================================================
+
+static void BroadphaseBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("broadphase");
+    std::cout << "broadphase, containers and robots milling about (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(10) << "bodies" << std::right << std::setw(10) << "pairs" << std::setw(12) << "frame ms"
+        << std::setw(14) << "pairs/s" << std::setw(12) << "events" << std::setw(14) << "n^2 ms" << "\n";
+
+    const UINT counts[] = { 10000, 50000, 100000 };
+    for (UINT count : counts)
+    {
+        SetBenchmarkVariant(std::to_string(count));
+
+        // the same density whatever the count, a container is about 6 x 2.6 x 2.4 and a robot 1 x 2 x 1
+        float worldHalf = sqrtf((float)count) * 2.5f;
+        std::mt19937 random(count);
+        std::uniform_real_distribution<float> position(-worldHalf, worldHalf);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+        std::vector<Aabb> bounds(count);
+        std::vector<XMFLOAT3> velocities(count);
+        Broadphase broadphase;
+        for (UINT i = 0; i < count; i++)
+        {
+            XMFLOAT3 half = (i % 3 == 0) ? XMFLOAT3(3.0f, 1.3f, 1.2f) : XMFLOAT3(0.5f, 1.0f, 0.5f);
+            bounds[i] = MakeAabb(XMFLOAT3(position(random), half.y + fabsf(unit(random)) * 6.0f, position(random)), half);
+            velocities[i] = XMFLOAT3(unit(random) * 0.05f, 0.0f, unit(random) * 0.05f);
+            broadphase.AddProxy(bounds[i], i);
+        }
+        broadphase.UpdatePairs();
+
+        // everything moves a little every frame and the pairs are brought up to date
+        size_t events = 0;
+        BenchmarkResult frame = RunBenchmark("frame", iterations, [&]()
+        {
+            for (UINT i = 0; i < count; i++)
+            {
+                bounds[i].min.x += velocities[i].x;
+                bounds[i].max.x += velocities[i].x;
+                bounds[i].min.z += velocities[i].z;
+                bounds[i].max.z += velocities[i].z;
+                broadphase.UpdateProxy(i, bounds[i]);
+            }
+            broadphase.UpdatePairs();
+            events = broadphase.GetAddedPairs().size() + broadphase.GetRemovedPairs().size();
+        });
+        size_t pairs = broadphase.GetPairs().size();
+
+        // every body against every other, once and only at the smallest count, it is already painful there
+        std::string naive = "-";
+        if (count <= 10000)
+        {
+            size_t naivePairs = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (UINT i = 0; i < count; i++)
+            {
+                for (UINT j = i + 1; j < count; j++)
+                {
+                    if (AabbOverlaps(bounds[i], bounds[j]))
+                        naivePairs++;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(3) << std::chrono::duration<double, std::milli>(end - start).count();
+            naive = (naivePairs == pairs) ? text.str() : "mismatch!";
+        }
+
+        std::cout << std::left << std::setw(10) << count << std::right << std::setw(10) << pairs << std::fixed << std::setprecision(3)
+            << std::setw(12) << frame.medianMs << std::setprecision(0)
+            << std::setw(14) << (frame.medianMs > 0.0 ? pairs / (frame.medianMs / 1000.0) : 0.0)
+            << std::setw(12) << events << std::setw(14) << naive << "\n";
+    }
+    std::cout << "\n";
+}
+
+// crates and rocks dropped in a grid of short stacks onto a ground box, most of them settled, like the aftermath of an explosion
+static void BuildPhysicsScene(PhysicsWorld* world, UINT count, const ConvexHull* rock)
+{
+    RigidBodyDesc ground;
+    ground.shape = MakeBoxShape(XMFLOAT3(1000.0f, 1.0f, 1000.0f));
+    ground.position = XMFLOAT3(0.0f, -1.0f, 0.0f);
+    ground.mass = 0.0f;
+    world->AddBody(ground);
+
+    const UINT stackHeight = 4;
+    UINT side = (UINT)ceilf(sqrtf((float)count / stackHeight));
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT stack = i / stackHeight;
+        UINT level = i % stackHeight;
+        RigidBodyDesc body;
+        body.shape = (i % 4 == 3) ? MakeHullShape(rock) : MakeBoxShape(XMFLOAT3(0.5f, 0.5f, 0.5f));
+        body.position = XMFLOAT3((stack % side) * 1.6f + unit(random) * 0.1f, 0.55f + level * 1.05f, (stack / side) * 1.6f + unit(random) * 0.1f);
+        body.rotation = QuatFromAxisAngle(XMFLOAT3(0.0f, 1.0f, 0.0f), unit(random) * 0.3f);
+        world->AddBody(body);
+    }
+}
+
+// a rough rock, a few hundred points on a lumpy sphere for the hull builder to pick from
+static void BuildRock(ConvexHull* rock)
+{
+    MeshData rockMesh;
+    std::mt19937 rockRandom(5);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    for (int i = 0; i < 400; i++)
+    {
+        MeshVertex vertex = {};
+        XMFLOAT3 direction = Vec3Normalize(XMFLOAT3(unit(rockRandom), unit(rockRandom), unit(rockRandom)));
+        vertex.position = Vec3Scale(direction, 0.45f + unit(rockRandom) * 0.05f);
+        rockMesh.vertices.push_back(vertex);
+    }
+    BuildConvexHull(rockMesh, rock);
+}
+
+static void PhysicsBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("physics");
+    ConvexHull rock;
+    BuildRock(&rock);
+
+    std::cout << "physics, stacks of crates and rocks settling (median of " << iterations << " steps)\n";
+    std::cout << std::left << std::setw(10) << "bodies" << std::right << std::setw(10) << "islands" << std::setw(10) << "contacts"
+        << std::setw(12) << "step ms" << std::setw(12) << "narrow ms" << std::setw(12) << "solve ms" << std::setw(14) << "bodies/ms" << "\n";
+
+    const UINT counts[] = { 1000, 4000, 16000 };
+    for (UINT count : counts)
+    {
+        SetBenchmarkVariant(std::to_string(count));
+        PhysicsWorld world;
+        BuildPhysicsScene(&world, count, &rock);
+
+        // let the first impacts happen so the steps timed are the steady state
+        for (int i = 0; i < 30; i++)
+            world.Step(1.0f / 60.0f);
+
+        double narrowMs = 0.0, solveMs = 0.0;
+        BenchmarkResult step = RunBenchmark("step", iterations, [&]()
+        {
+            world.Step(1.0f / 60.0f);
+            narrowMs = world.GetStats().narrowphaseMs;
+            solveMs = world.GetStats().solverMs;
+        });
+
+        const PhysicsStats& stats = world.GetStats();
+        std::cout << std::left << std::setw(10) << count << std::right << std::setw(10) << stats.islandCount << std::setw(10) << stats.contactCount
+            << std::fixed << std::setprecision(3) << std::setw(12) << step.medianMs << std::setw(12) << narrowMs << std::setw(12) << solveMs
+            << std::setprecision(0) << std::setw(14) << (step.medianMs > 0.0 ? count / step.medianMs : 0.0) << "\n";
+    }
+
+    // the same scene with one worker and with all of them has to end up bit for bit the same
+    const UINT count = 1000;
+    std::vector<RigidTransform> results[2];
+    const unsigned int threads[2] = { 1, 0 };
+    for (int run = 0; run < 2; run++)
+    {
+        JobSystem::Get()->Init(threads[run]);
+        PhysicsWorld world;
+        BuildPhysicsScene(&world, count, &rock);
+        for (int i = 0; i < 120; i++)
+            world.Step(1.0f / 60.0f);
+        for (UINT id = 0; id <= count; id++)
+            results[run].push_back(world.GetTransform(id));
+    }
+    bool same = memcmp(results[0].data(), results[1].data(), results[0].size() * sizeof(RigidTransform)) == 0;
+    std::cout << "1 worker vs " << JobSystem::Get()->GetWorkerCount() << " workers after 120 steps: " << (same ? "identical" : "DIFFERENT!") << "\n\n";
+}
+
+static void ParticleBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("particles");
+    std::cout << "particles, 1M in one emitter, updated and written as billboards every frame (median of " << iterations << " frames)\n";
+    std::cout << std::left << std::setw(10) << "effect" << std::right << std::setw(10) << "alive" << std::setw(12) << "update ms"
+        << std::setw(14) << "billboard ms" << std::setw(12) << "frame ms" << std::setw(16) << "particles/ms" << std::setw(8) << "60Hz" << "\n";
+
+    const UINT count = 1000000;
+    TransientVertexBuffer vertices;
+    vertices.Create(nullptr, count * 4 * sizeof(ParticleVertex));
+
+    ParticleCamera camera;
+    camera.position = XMFLOAT3(0.0f, 2.0f, -30.0f);
+    camera.right = XMFLOAT3(1.0f, 0.0f, 0.0f);
+    camera.up = XMFLOAT3(0.0f, 1.0f, 0.0f);
+    camera.forward = XMFLOAT3(0.0f, 0.0f, 1.0f);
+
+    // flares are additive and go straight out, smoke is alpha blended and sorted back to front first
+    ParticleEmitterDesc descs[2] = { MakeFlareEmitterDesc(XMFLOAT3(0.0f, 0.0f, 0.0f)), MakeSmokeEmitterDesc(XMFLOAT3(0.0f, 0.0f, 0.0f)) };
+    const char* names[2] = { "flare", "smoke" };
+    for (int effect = 0; effect < 2; effect++)
+    {
+        // deaths and births balance out at about 1M alive
+        SetBenchmarkVariant(names[effect]);
+        ParticleEmitterDesc desc = descs[effect];
+        desc.maxParticles = count;
+        desc.spawnExtents = XMFLOAT3(20.0f, 5.0f, 20.0f);
+        desc.spawnRate = count / ((desc.minLife + desc.maxLife) * 0.5f);
+        ParticleEmitter emitter(desc);
+        emitter.Burst(count);
+
+        BenchmarkResult update = RunBenchmark("update", iterations, [&]()
+        {
+            emitter.Update(1.0f / 60.0f);
+        });
+        UINT quads = 0;
+        BenchmarkResult billboards = RunBenchmark("billboards", iterations, [&]()
+        {
+            UINT firstVertex;
+            vertices.Begin(nullptr);
+            quads = emitter.WriteBillboards(camera, &vertices, &firstVertex);
+            vertices.End(nullptr);
+        });
+
+        double frameMs = update.medianMs + billboards.medianMs;
+        std::cout << std::left << std::setw(10) << names[effect] << std::right << std::setw(10) << quads << std::fixed << std::setprecision(3)
+            << std::setw(12) << update.medianMs << std::setw(14) << billboards.medianMs << std::setw(12) << frameMs << std::setprecision(0)
+            << std::setw(16) << (frameMs > 0.0 ? quads / frameMs : 0.0) << std::setw(8) << (frameMs < 1000.0 / 60.0 ? "yes" : "no") << "\n";
+    }
+    std::cout << "\n";
+}
+
+// 1k point and spot lights over a town sized area, the camera looking down the middle of it
+static void LightBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("lights");
+    std::cout << "clustered lights, 1000 lights (a quarter of them spots) culled at 1920x1080 (median of " << iterations << " frames)\n";
+    std::cout << std::left << std::setw(10) << "grid" << std::right << std::setw(10) << "clusters" << std::setw(10) << "indices"
+        << std::setw(12) << "per cluster" << std::setw(8) << "most" << std::setw(10) << "cull ms" << std::setw(12) << "lights/ms" << "\n";
+
+    const UINT count = 1000;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<LightDesc> lights;
+    for (UINT i = 0; i < count; i++)
+    {
+        XMFLOAT3 position(unit(random) * 200.0f - 100.0f, unit(random) * 15.0f, unit(random) * 300.0f);
+        XMFLOAT3 color(unit(random), unit(random), unit(random));
+        if (i % 4 == 0)
+        {
+            // street lights, pointing mostly down
+            float angle = unit(random) * 6.283f;
+            XMFLOAT3 direction(cosf(angle) * 0.6f, -0.8f, sinf(angle) * 0.6f);
+            lights.push_back(MakeSpotLight(position, direction, 10.0f + unit(random) * 20.0f, 0.3f + unit(random) * 0.6f, color));
+        }
+        else
+        {
+            lights.push_back(MakePointLight(position, 2.0f + unit(random) * 10.0f, color));
+        }
+    }
+
+    // identity apart from the camera standing 5 units up
+    XMFLOAT4X4 view;
+    memset(&view, 0, sizeof(view));
+    view._11 = view._22 = view._33 = view._44 = 1.0f;
+    view._42 = -5.0f;
+
+    // the usual 64 pixel tiles and 24 slices, then four times as many tiles
+    const UINT tileSizes[2] = { 64, 32 };
+    const UINT slices[2] = { 24, 32 };
+    for (int grid = 0; grid < 2; grid++)
+    {
+        ClusterGridDesc desc;
+        desc.tileSize = tileSizes[grid];
+        desc.depthSlices = slices[grid];
+        ClusteredLightCuller culler;
+        if (!culler.SetGrid(desc))
+        {
+            std::cout << "failed to build the cluster grid\n";
+            continue;
+        }
+
+        std::ostringstream name;
+        name << desc.tileSize << "px";
+        SetBenchmarkVariant(name.str());
+        BenchmarkResult cull = RunBenchmark("cull", iterations, [&]()
+        {
+            culler.Cull(lights.data(), count, view);
+        });
+
+        UINT occupied = 0, most = 0;
+        for (const ClusterRange& range : culler.GetClusterRanges())
+        {
+            occupied += range.count ? 1 : 0;
+            most = std::max(most, range.count);
+        }
+        size_t indices = culler.GetLightIndices().size();
+        std::cout << std::left << std::setw(10) << name.str() << std::right << std::setw(10) << culler.GetClusterCount()
+            << std::setw(10) << indices << std::fixed << std::setprecision(1) << std::setw(12) << (occupied ? indices / (double)occupied : 0.0)
+            << std::setw(8) << most << std::setprecision(3) << std::setw(10) << cull.medianMs << std::setprecision(0)
+            << std::setw(12) << (cull.medianMs > 0.0 ? count / cull.medianMs : 0.0) << "\n";
+    }
+    std::cout << "\n";
+}
+
+// a camera walking across Hills.x sampled to a 1 unit heightmap and across a 4k map, the way a game uses it each frame
+static void TerrainBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("terrain");
+    std::cout << "terrain, CDLOD selection, height queries and raycasts (median of " << iterations << " runs)\n";
+
+    MeshData hills;
+    Heightmap hillsMap;
+    std::wstring hillsPath = folder + L"\\Hills.x";
+    BenchmarkResult build = RunBenchmark("hills build", iterations, [&]()
+    {
+        if (ImportXMeshFile(hillsPath, &hills))
+            HeightmapFromMesh(hills, 1.0f, &hillsMap);
+    });
+    if (hillsMap.heights.empty())
+    {
+        std::wcout << L"could not read " << hillsPath << L", skipping the terrain benchmarks\n";
+        return;
+    }
+    std::cout << "Hills.x to a " << hillsMap.width << "x" << hillsMap.depth << " heightmap in " << std::fixed << std::setprecision(3)
+        << build.medianMs << " ms\n";
+
+    // rolling hills, 4097 samples a side
+    Heightmap bigMap;
+    bigMap.width = bigMap.depth = 4097;
+    bigMap.originX = bigMap.originZ = -2048.0f;
+    bigMap.spacing = 1.0f;
+    bigMap.heights.resize((size_t)bigMap.width * bigMap.depth);
+    for (UINT z = 0; z < bigMap.depth; z++)
+    {
+        for (UINT x = 0; x < bigMap.width; x++)
+            bigMap.heights[(size_t)z * bigMap.width + x] = 40.0f * sinf(x * 0.011f) * cosf(z * 0.007f) + 6.0f * sinf((x + z) * 0.05f);
+    }
+
+    std::cout << std::left << std::setw(10) << "map" << std::right << std::setw(10) << "patches" << std::setw(12) << "tile loads"
+        << std::setw(12) << "select ms" << std::setw(14) << "heights/ms" << std::setw(14) << "raycasts/ms" << std::setw(8) << "hit %" << "\n";
+
+    const Heightmap* maps[2] = { &hillsMap, &bigMap };
+    const char* names[2] = { "hills", "4k" };
+    for (int map = 0; map < 2; map++)
+    {
+        Terrain terrain;
+        if (!terrain.Create(*maps[map]) || !terrain.CreateRenderer(nullptr))
+        {
+            std::cout << "failed to create the " << names[map] << " terrain\n";
+            continue;
+        }
+        SetBenchmarkVariant(names[map]);
+        Aabb bounds = terrain.GetBounds();
+        float sizeX = bounds.max.x - bounds.min.x, sizeZ = bounds.max.z - bounds.min.z;
+
+        // looking down +z, 60 degrees, as far as the map is long
+        const float nearZ = 1.0f, farZ = sizeZ, yScale = 1.0f / tanf(0.5236f), q = farZ / (farZ - nearZ);
+        XMFLOAT4X4 projection;
+        memset(&projection, 0, sizeof(projection));
+        projection._11 = yScale / (16.0f / 9.0f);
+        projection._22 = yScale;
+        projection._33 = q;
+        projection._34 = 1.0f;
+        projection._43 = -q * nearZ;
+
+        // a step of a walk from one edge to the other every frame, the view only translates so it folds into the projection
+        // patches is the average over every run, the warm up included
+        const int steps = 64;
+        int step = 0;
+        UINT64 loadsBefore = terrain.GetStats().tileLoads;
+        UINT64 patches = 0;
+        BenchmarkResult select = RunBenchmark("select", iterations, [&]()
+        {
+            for (int i = 0; i < steps; i++, step++)
+            {
+                XMFLOAT3 camera(bounds.min.x + sizeX * 0.5f, 0.0f, bounds.min.z + sizeZ * (0.05f + 0.9f * (step % steps) / steps));
+                float ground = 0.0f;
+                terrain.GetHeight(camera.x, camera.z, &ground);
+                camera.y = ground + 10.0f;
+
+                XMFLOAT4X4 viewProjection = projection;
+                for (int column = 0; column < 4; column++)
+                    viewProjection.m[3][column] = projection.m[3][column] - camera.x * projection.m[0][column] - camera.y * projection.m[1][column] - camera.z * projection.m[2][column];
+                terrain.Update(camera, MakeFrustum(viewProjection));
+                patches += terrain.GetStats().patches;
+            }
+        });
+        double selectMs = select.medianMs / steps;
+        UINT64 loads = terrain.GetStats().tileLoads - loadsBefore;
+
+        std::mt19937 random(46);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        const int queryCount = 100000;
+        std::vector<XMFLOAT2> points(queryCount);
+        for (XMFLOAT2& point : points)
+            point = XMFLOAT2(bounds.min.x + unit(random) * sizeX, bounds.min.z + unit(random) * sizeZ);
+        BenchmarkResult heights = RunBenchmark("heights", iterations, [&]()
+        {
+            for (const XMFLOAT2& point : points)
+            {
+                float height = 0.0f;
+                terrain.GetHeight(point.x, point.y, &height);
+            }
+        });
+
+        // shots from just above the ground, mostly level so they travel a long way before they land
+        const int rayCount = 10000;
+        std::vector<XMFLOAT3> origins(rayCount), directions(rayCount);
+        for (int i = 0; i < rayCount; i++)
+        {
+            float ground = 0.0f;
+            origins[i] = XMFLOAT3(bounds.min.x + unit(random) * sizeX, 0.0f, bounds.min.z + unit(random) * sizeZ);
+            terrain.GetHeight(origins[i].x, origins[i].z, &ground);
+            origins[i].y = ground + 2.0f;
+            float angle = unit(random) * 6.283f;
+            directions[i] = XMFLOAT3(cosf(angle), -0.02f - unit(random) * 0.1f, sinf(angle));
+        }
+        UINT hits = 0;
+        BenchmarkResult raycasts = RunBenchmark("raycasts", iterations, [&]()
+        {
+            hits = 0;
+            for (int i = 0; i < rayCount; i++)
+            {
+                TerrainHit hit;
+                if (terrain.Raycast(origins[i], directions[i], 10000.0f, &hit))
+                    hits++;
+            }
+        });
+
+        std::cout << std::left << std::setw(10) << names[map] << std::right << std::setw(10) << patches / ((UINT64)(iterations + 1) * steps) << std::setw(12) << loads
+            << std::fixed << std::setprecision(4) << std::setw(12) << selectMs << std::setprecision(0)
+            << std::setw(14) << (heights.medianMs > 0.0 ? queryCount / heights.medianMs : 0.0)
+            << std::setw(14) << (raycasts.medianMs > 0.0 ? rayCount / raycasts.medianMs : 0.0)
+            << std::setw(8) << hits * 100.0 / rayCount << "\n";
+    }
+    std::cout << "\n";
+}
+
+// what picking did before there was a BVH, every triangle against the ray
+static bool BruteForceRaycast(const MeshData& mesh, const XMFLOAT3& origin, const XMFLOAT3& direction, float* distance)
+{
+    bool found = false;
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        XMFLOAT3 v0 = mesh.vertices[mesh.indices[i]].position;
+        XMFLOAT3 e1 = Vec3Sub(mesh.vertices[mesh.indices[i + 1]].position, v0);
+        XMFLOAT3 e2 = Vec3Sub(mesh.vertices[mesh.indices[i + 2]].position, v0);
+        XMFLOAT3 p = Vec3Cross(direction, e2);
+        float determinant = Vec3Dot(e1, p);
+        if (determinant == 0.0f)
+            continue;
+        float inverse = 1.0f / determinant;
+        XMFLOAT3 s = Vec3Sub(origin, v0);
+        float u = Vec3Dot(s, p) * inverse;
+        XMFLOAT3 q = Vec3Cross(s, e1);
+        float v = Vec3Dot(direction, q) * inverse;
+        float t = Vec3Dot(e2, q) * inverse;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < *distance)
+        {
+            *distance = t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// the BVHs of Robot.x and Bike.x built on the job system, rays at each from all around, then a field of them picked
+// through a camera the way a mouse click is
+static void PickingBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("picking");
+    std::cout << "picking, BVH build and raycasts against Robot.x and Bike.x (median of " << iterations << " runs)\n";
+
+    const wchar_t* files[2] = { L"Robot.x", L"Bike.x" };
+    MeshData meshes[2];
+    for (int i = 0; i < 2; i++)
+    {
+        if (!ImportXMeshFile(folder + L"\\" + files[i], &meshes[i]))
+        {
+            std::wcout << L"could not read " << folder << L"\\" << files[i] << L", skipping the picking benchmarks\n";
+            return;
+        }
+    }
+
+    std::cout << std::left << std::setw(10) << "mesh" << std::right << std::setw(10) << "tris" << std::setw(10) << "nodes"
+        << std::setw(10) << "KB" << std::setw(12) << "build ms" << std::setw(14) << "rays/s" << std::setw(14) << "brute rays/s"
+        << std::setw(8) << "hit %" << "\n";
+
+    std::mt19937 random(50);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int m = 0; m < 2; m++)
+    {
+        SetBenchmarkVariant(FileName(files[m]));
+        MeshBvh bvh;
+        BenchmarkResult build = RunBenchmark("build", iterations, [&]()
+        {
+            bvh.Build(meshes[m]);
+        });
+
+        // from a sphere twice the mesh's size at a random point in its box, so most of them hit
+        Aabb bounds = bvh.GetBounds();
+        XMFLOAT3 center = Vec3Scale(Vec3Add(bounds.min, bounds.max), 0.5f);
+        float radius = Vec3Length(Vec3Sub(bounds.max, bounds.min));
+        const int rayCount = 100000;
+        std::vector<XMFLOAT3> origins(rayCount), directions(rayCount);
+        for (int i = 0; i < rayCount; i++)
+        {
+            float z = unit(random) * 2.0f - 1.0f, angle = unit(random) * 6.283f, ring = sqrtf(1.0f - z * z);
+            origins[i] = Vec3Add(center, XMFLOAT3(ring * cosf(angle) * radius, z * radius, ring * sinf(angle) * radius));
+            XMFLOAT3 target(bounds.min.x + unit(random) * (bounds.max.x - bounds.min.x), bounds.min.y + unit(random) * (bounds.max.y - bounds.min.y),
+                bounds.min.z + unit(random) * (bounds.max.z - bounds.min.z));
+            directions[i] = Vec3Normalize(Vec3Sub(target, origins[i]));
+        }
+        UINT hits = 0;
+        BenchmarkResult rays = RunBenchmark("raycasts", iterations, [&]()
+        {
+            hits = 0;
+            for (int i = 0; i < rayCount; i++)
+            {
+                PickHit hit;
+                if (bvh.Raycast(origins[i], directions[i], FLT_MAX, &hit))
+                    hits++;
+            }
+        });
+        const int bruteCount = 200;
+        UINT bruteHits = 0;
+        BenchmarkResult brute = RunBenchmark("brute force", iterations, [&]()
+        {
+            bruteHits = 0;
+            for (int i = 0; i < bruteCount; i++)
+            {
+                float distance = FLT_MAX;
+                if (BruteForceRaycast(meshes[m], origins[i], directions[i], &distance))
+                    bruteHits++;
+            }
+        });
+
+        // the same rays through the BVH have to hit just as often
+        UINT bvhHits = 0;
+        for (int i = 0; i < bruteCount; i++)
+        {
+            PickHit hit;
+            if (bvh.Raycast(origins[i], directions[i], FLT_MAX, &hit))
+                bvhHits++;
+        }
+        if (bvhHits != bruteHits)
+            std::cout << "  " << FileName(files[m]) << ": the BVH hit " << bvhHits << " of " << bruteCount << " rays, brute force " << bruteHits << "\n";
+
+        std::cout << std::left << std::setw(10) << FileName(files[m]) << std::right << std::setw(10) << bvh.GetTriangleCount()
+            << std::setw(10) << bvh.GetNodeCount() << std::setw(10) << bvh.GetMemoryUsage() / 1024 << std::fixed << std::setprecision(3)
+            << std::setw(12) << build.medianMs << std::setprecision(0)
+            << std::setw(14) << (rays.medianMs > 0.0 ? rayCount / rays.medianMs * 1000.0 : 0.0)
+            << std::setw(14) << (brute.medianMs > 0.0 ? bruteCount / brute.medianMs * 1000.0 : 0.0)
+            << std::setw(8) << hits * 100.0 / rayCount << "\n";
+    }
+
+    // 32 x 32 of them turned every which way, both meshes built at once, then the top level over the instances
+    PickScene scene;
+    BenchmarkResult meshBuild = RunBenchmark("scene meshes", iterations, [&]()
+    {
+        PickScene meshesOnly;
+        meshesOnly.AddMeshes(meshes, 2);
+    });
+    UINT first = scene.AddMeshes(meshes, 2);
+    XMFLOAT4X4 firstWorld;
+    for (UINT i = 0; i < 32 * 32; i++)
+    {
+        float angle = unit(random) * 6.283f;
+        XMFLOAT4X4 world;
+        memset(&world, 0, sizeof(world));
+        world._11 = world._33 = cosf(angle);
+        world._13 = -sinf(angle);
+        world._31 = sinf(angle);
+        world._22 = world._44 = 1.0f;
+        world._41 = (i % 32) * 30.0f - 480.0f;
+        world._43 = (i / 32) * 30.0f - 480.0f;
+        if (i == 0)
+            firstWorld = world;
+        scene.AddInstance(first + i % 2, world);
+    }
+    BenchmarkResult topLevel = RunBenchmark("top level", iterations, [&]()
+    {
+        // setting any instance's transform is enough to make Update() rebuild
+        scene.SetTransform(0, firstWorld);
+        scene.Update();
+    });
+
+    // looking at the middle of the field from above one corner, 60 degrees
+    XMFLOAT3 eye(-600.0f, 200.0f, -600.0f);
+    XMFLOAT3 forward = Vec3Normalize(Vec3Negate(eye));
+    XMFLOAT3 right = Vec3Normalize(Vec3Cross(XMFLOAT3(0.0f, 1.0f, 0.0f), forward));
+    XMFLOAT3 up = Vec3Cross(forward, right);
+    XMFLOAT4X4 view;
+    memset(&view, 0, sizeof(view));
+    view._11 = right.x;
+    view._21 = right.y;
+    view._31 = right.z;
+    view._12 = up.x;
+    view._22 = up.y;
+    view._32 = up.z;
+    view._13 = forward.x;
+    view._23 = forward.y;
+    view._33 = forward.z;
+    view._41 = -Vec3Dot(right, eye);
+    view._42 = -Vec3Dot(up, eye);
+    view._43 = -Vec3Dot(forward, eye);
+    view._44 = 1.0f;
+
+    const float nearZ = 1.0f, farZ = 2000.0f, yScale = 1.0f / tanf(0.5236f), q = farZ / (farZ - nearZ);
+    XMFLOAT4X4 projection;
+    memset(&projection, 0, sizeof(projection));
+    projection._11 = yScale / (16.0f / 9.0f);
+    projection._22 = yScale;
+    projection._33 = q;
+    projection._34 = 1.0f;
+    projection._43 = -q * nearZ;
+
+    XMFLOAT4X4 viewProjection;
+    for (int row = 0; row < 4; row++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            viewProjection.m[row][column] = 0.0f;
+            for (int i = 0; i < 4; i++)
+                viewProjection.m[row][column] += view.m[row][i] * projection.m[i][column];
+        }
+    }
+
+    // a click at a random pixel
+    const int pickCount = 10000;
+    std::vector<POINT> pixels(pickCount);
+    for (POINT& pixel : pixels)
+    {
+        pixel.x = (LONG)(unit(random) * 1919.0f);
+        pixel.y = (LONG)(unit(random) * 1079.0f);
+    }
+    UINT picked = 0;
+    BenchmarkResult picks = RunBenchmark("picks", iterations, [&]()
+    {
+        picked = 0;
+        for (const POINT& pixel : pixels)
+        {
+            PickHit hit;
+            if (scene.Pick(pixel.x, pixel.y, 1920, 1080, viewProjection, &hit))
+                picked++;
+        }
+    });
+    std::cout << scene.GetInstanceCount() << " instances: both meshes built at once in " << std::fixed << std::setprecision(3)
+        << meshBuild.medianMs << " ms, the top level in " << topLevel.medianMs << " ms, " << std::setprecision(0)
+        << (picks.medianMs > 0.0 ? pickCount / picks.medianMs * 1000.0 : 0.0) << " picks/s, " << picked * 100.0 / pickCount << "% hit\n\n";
+}
+
+// debug boxes and text recorded from every worker at once, then gathered for drawing the way the engine does each frame
+static void DebugDrawBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("debugdraw");
+    std::cout << "debug draw, 5000 boxes and 500 lines of text recorded across the job system and gathered (median of " << iterations << " frames)\n";
+    std::cout << std::left << std::setw(10) << "test" << std::right << std::setw(10) << "lines" << std::setw(12) << "characters"
+        << std::setw(12) << "record ms" << std::setw(12) << "gather ms" << std::setw(14) << "lines/ms" << "\n";
+
+    DebugDraw* debugDraw = DebugDraw::Get();
+    if (!debugDraw->CreateRenderer(nullptr))
+    {
+        std::cout << "failed to create the debug draw buffers\n";
+        return;
+    }
+
+    const UINT boxes = 5000;
+    const UINT texts = 500;
+    std::vector<double> recordTimes, gatherTimes;
+    for (int i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        JobSystem::Get()->ParallelFor(boxes, 250, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int box = begin; box < end; box++)
+            {
+                XMFLOAT3 center((float)(box % 100), (float)(box / 100), 0.0f);
+                debugDraw->AddBox(MakeAabb(center, XMFLOAT3(0.4f, 0.4f, 0.4f)), kDebugGreen);
+                if (box < texts)
+                    debugDraw->AddText(10.0f, 10.0f + box * 20.0f, "entity 1234 at 12.5, 3.0", kDebugWhite);
+            }
+        });
+        auto recorded = std::chrono::high_resolution_clock::now();
+        debugDraw->Render(nullptr, 0, 0);
+        auto gathered = std::chrono::high_resolution_clock::now();
+        recordTimes.push_back(std::chrono::duration<double, std::milli>(recorded - start).count());
+        gatherTimes.push_back(std::chrono::duration<double, std::milli>(gathered - recorded).count());
+    }
+    BenchmarkResult record = SummarizeBenchmark("record", recordTimes);
+    BenchmarkResult gather = SummarizeBenchmark("gather", gatherTimes);
+
+    DebugDrawStats stats = debugDraw->GetStats();
+    std::cout << std::left << std::setw(10) << "boxes" << std::right << std::setw(10) << stats.lines << std::setw(12) << stats.characters
+        << std::fixed << std::setprecision(3) << std::setw(12) << record.medianMs << std::setw(12) << gather.medianMs << std::setprecision(0)
+        << std::setw(14) << (record.medianMs + gather.medianMs > 0.0 ? stats.lines / (record.medianMs + gather.medianMs) : 0.0) << "\n\n";
+    debugDraw->ReleaseRenderer();
+}
+
+// one row of the allocator table, the same work through malloc/free and through one of the engine's allocators
+static void PrintMemoryRow(const char* test, const BenchmarkResult& system, const BenchmarkResult& engine, size_t operations)
+{
+    std::cout << std::left << std::setw(22) << test << std::right << std::fixed << std::setprecision(3)
+        << std::setw(12) << system.medianMs << std::setw(12) << engine.medianMs << std::setprecision(1)
+        << std::setw(12) << (system.medianMs > 0.0 ? system.medianMs * 1000000.0 / operations : 0.0)
+        << std::setw(12) << (engine.medianMs > 0.0 ? engine.medianMs * 1000000.0 / operations : 0.0) << std::setprecision(2)
+        << std::setw(10) << (engine.medianMs > 0.0 ? system.medianMs / engine.medianMs : 0.0) << "x\n";
+}
+
+static void MemoryBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("memory");
+    std::cout << "allocators against malloc/free (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(22) << "test" << std::right << std::setw(12) << "malloc ms" << std::setw(12) << "engine ms"
+        << std::setw(12) << "malloc ns" << std::setw(12) << "engine ns" << std::setw(11) << "speedup" << "\n";
+
+    // the same sizes and the same order of frees for both sides
+    std::mt19937 random(38);
+    const size_t tempCount = 50000;
+    std::vector<size_t> tempSizes(tempCount);
+    for (size_t& size : tempSizes)
+        size = 16 + random() % 225;
+    std::vector<void*> temps(tempCount);
+
+    // a frame's worth of small temporaries, all thrown away at the end of the frame
+    EngineMemory* memory = EngineMemory::Get();
+    BenchmarkResult systemFrame = RunBenchmark("malloc frame", iterations, [&]()
+    {
+        for (size_t i = 0; i < tempCount; i++)
+        {
+            temps[i] = malloc(tempSizes[i]);
+            *(BYTE*)temps[i] = 1;
+        }
+        for (size_t i = 0; i < tempCount; i++)
+            free(temps[i]);
+    });
+    size_t frameFailures = 0;
+    BenchmarkResult engineFrame = RunBenchmark("frame allocator", iterations, [&]()
+    {
+        for (size_t i = 0; i < tempCount; i++)
+        {
+            temps[i] = memory->FrameAllocate(tempSizes[i]);
+            if (temps[i])
+                *(BYTE*)temps[i] = 1;
+            else
+                frameFailures++;
+        }
+        // both frames, so the next run starts on empty memory
+        memory->NewFrame();
+        memory->NewFrame();
+    });
+    PrintMemoryRow(frameFailures ? "frame (ran out!)" : "frame temporaries", systemFrame, engineFrame, tempCount);
+
+    // objects of one size created and destroyed all the time, 4096 of them alive at once
+    const size_t liveCount = 4096;
+    const size_t churnCount = 200000;
+    std::vector<UINT> churnSlots(churnCount);
+    std::vector<size_t> churnSizes(churnCount);
+    for (size_t i = 0; i < churnCount; i++)
+    {
+        churnSlots[i] = random() % liveCount;
+        churnSizes[i] = 16 + random() % 4081;
+    }
+    std::vector<void*> live(liveCount);
+
+    BenchmarkResult systemPool = RunBenchmark("malloc pool", iterations, [&]()
+    {
+        for (size_t i = 0; i < liveCount; i++)
+            live[i] = malloc(64);
+        for (size_t i = 0; i < churnCount; i++)
+        {
+            free(live[churnSlots[i]]);
+            live[churnSlots[i]] = malloc(64);
+        }
+        for (size_t i = 0; i < liveCount; i++)
+            free(live[i]);
+    });
+    PoolAllocator pool;
+    pool.Init(64, 1024);
+    BenchmarkResult enginePool = RunBenchmark("pool", iterations, [&]()
+    {
+        for (size_t i = 0; i < liveCount; i++)
+            live[i] = pool.Allocate();
+        for (size_t i = 0; i < churnCount; i++)
+        {
+            pool.Free(live[churnSlots[i]]);
+            live[churnSlots[i]] = pool.Allocate();
+        }
+        for (size_t i = 0; i < liveCount; i++)
+            pool.Free(live[i]);
+    });
+    PrintMemoryRow("pool churn (64B)", systemPool, enginePool, liveCount + churnCount);
+
+    // the same churn with any size from 16 bytes to 4KB, straight into a TLSF heap and through the engine's locked one
+    BenchmarkResult systemHeap = RunBenchmark("malloc heap", iterations, [&]()
+    {
+        for (size_t i = 0; i < liveCount; i++)
+            live[i] = malloc(churnSizes[i]);
+        for (size_t i = 0; i < churnCount; i++)
+        {
+            free(live[churnSlots[i]]);
+            live[churnSlots[i]] = malloc(churnSizes[i]);
+        }
+        for (size_t i = 0; i < liveCount; i++)
+            free(live[i]);
+    });
+    TlsfAllocator tlsf;
+    tlsf.Init(64 * 1024 * 1024);
+    BenchmarkResult engineTlsf = RunBenchmark("tlsf", iterations, [&]()
+    {
+        for (size_t i = 0; i < liveCount; i++)
+            live[i] = tlsf.Allocate(churnSizes[i]);
+        for (size_t i = 0; i < churnCount; i++)
+        {
+            tlsf.Free(live[churnSlots[i]]);
+            live[churnSlots[i]] = tlsf.Allocate(churnSizes[i]);
+        }
+        for (size_t i = 0; i < liveCount; i++)
+            tlsf.Free(live[i]);
+    });
+    PrintMemoryRow("tlsf churn (16B-4KB)", systemHeap, engineTlsf, liveCount + churnCount);
+    BenchmarkResult engineHeap = RunBenchmark("engine heap", iterations, [&]()
+    {
+        for (size_t i = 0; i < liveCount; i++)
+            live[i] = memory->Allocate(churnSizes[i]);
+        for (size_t i = 0; i < churnCount; i++)
+        {
+            memory->Free(live[churnSlots[i]]);
+            live[churnSlots[i]] = memory->Allocate(churnSizes[i]);
+        }
+        for (size_t i = 0; i < liveCount; i++)
+            memory->Free(live[i]);
+    });
+    PrintMemoryRow("engine heap (locked)", systemHeap, engineHeap, liveCount + churnCount);
+
+    // jobs that each need a bunch of temporaries, malloc'd or from their thread's scratch arena
+    const UINT jobCount = 256;
+    const size_t jobTemps = tempCount / jobCount;
+    BenchmarkResult systemJobs = RunBenchmark("malloc jobs", iterations, [&]()
+    {
+        JobSystem::Get()->ParallelFor(jobCount, 1, [&](unsigned int begin, unsigned int end)
+        {
+            void* mine[256];
+            for (unsigned int job = begin; job < end; job++)
+            {
+                for (size_t i = 0; i < jobTemps; i++)
+                {
+                    mine[i] = malloc(tempSizes[job * jobTemps + i]);
+                    *(BYTE*)mine[i] = 1;
+                }
+                for (size_t i = 0; i < jobTemps; i++)
+                    free(mine[i]);
+            }
+        });
+    });
+    BenchmarkResult engineJobs = RunBenchmark("scratch jobs", iterations, [&]()
+    {
+        JobSystem::Get()->ParallelFor(jobCount, 1, [&](unsigned int begin, unsigned int end)
+        {
+            LinearAllocator* scratch = EngineMemory::Get()->GetScratch();
+            for (unsigned int job = begin; job < end; job++)
+            {
+                ScratchScope scope(scratch);
+                for (size_t i = 0; i < jobTemps; i++)
+                {
+                    void* temp = scratch->Allocate(tempSizes[job * jobTemps + i]);
+                    *(BYTE*)temp = 1;
+                }
+            }
+        });
+    });
+    PrintMemoryRow("scratch in jobs", systemJobs, engineJobs, jobCount * jobTemps);
+
+    // short lived containers, e.g. a visible list built every frame
+    const int vectorCount = 2000;
+    BenchmarkResult systemVectors = RunBenchmark("std::allocator", iterations, [&]()
+    {
+        for (int i = 0; i < vectorCount; i++)
+        {
+            std::vector<int> values;
+            for (int j = 0; j < 64; j++)
+                values.push_back(j);
+        }
+    });
+    BenchmarkResult engineVectors = RunBenchmark("FrameVector", iterations, [&]()
+    {
+        for (int i = 0; i < vectorCount; i++)
+        {
+            FrameVector<int> values;
+            for (int j = 0; j < 64; j++)
+                values.push_back(j);
+        }
+        memory->NewFrame();
+        memory->NewFrame();
+    });
+    PrintMemoryRow("std::vector temps", systemVectors, engineVectors, vectorCount);
+    std::cout << "\n";
+}
+
+static void LogBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("log");
+    std::cout << "logging, cost on the calling thread (median of " << iterations << " runs, the writer thread's work isn't counted)\n";
+    std::cout << std::left << std::setw(26) << "call" << std::right << std::setw(12) << "ms" << std::setw(12) << "ns/call" << "\n";
+
+    // no console so the numbers aren't drowned out, and a ring big enough that nothing is dropped
+    LogSettings settings;
+    settings.console = false;
+    settings.ringBytes = 4 * 1024 * 1024;
+    Logger::Get()->Init(settings);
+    Logger::Get()->SetLevel(LogLevel_Info);
+    UINT64 droppedBefore = Logger::Get()->GetDroppedCount();
+
+    const int calls = 10000;
+    const std::string path = "Media/textures/stone_wall_diffuse.dds";
+    auto printRow = [&](const char* call, const BenchmarkResult& result)
+    {
+        std::cout << std::left << std::setw(26) << call << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << result.medianMs << std::setprecision(1) << std::setw(12) << result.medianMs * 1000000.0 / calls << "\n";
+    };
+
+    printRow("filtered out", RunBenchmark("filtered", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+            LOG_TRACE(LogCategory_Game, "entity {} moved to {} {}", i, i * 0.5f, i * 2.0f);
+    }));
+    printRow("3 numbers", RunBenchmark("numbers", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+            LOG_INFO(LogCategory_Game, "entity {} moved to {} {}", i, i * 0.5f, i * 2.0f);
+    }));
+    Logger::Get()->Flush();
+    printRow("a string and a number", RunBenchmark("string", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+            LOG_INFO(LogCategory_Assets, "loaded {} in {} ms", path, i);
+    }));
+    Logger::Get()->Flush();
+
+    // what every std::cout message used to cost before it even got to the console
+    std::ostringstream stream;
+    printRow("std::ostringstream", RunBenchmark("ostringstream", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+        {
+            stream.str(std::string());
+            stream << "entity " << i << " moved to " << i * 0.5f << " " << i * 2.0f << "\n";
+        }
+    }));
+
+    std::cout << Logger::Get()->GetDroppedCount() - droppedBefore << " messages dropped\n\n";
+    Logger::Get()->Init(LogSettings());
+}
+
+// ==============================================================
+//		frame basics: timer, input, math
+// ==============================================================
+
+// one row of a table of calls made many times over, ms for all of them and ns for one
+static void PrintPerCallRow(const char* call, const BenchmarkResult& result, int calls)
+{
+    std::cout << std::left << std::setw(26) << call << std::right << std::fixed << std::setprecision(3)
+        << std::setw(12) << result.medianMs << std::setprecision(1) << std::setw(12) << result.medianMs * 1000000.0 / calls << "\n";
+}
+
+static void TimerBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("timer");
+    std::cout << "game timer, what it costs every frame (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(26) << "call" << std::right << std::setw(12) << "ms" << std::setw(12) << "ns/call" << "\n";
+
+    const int calls = 1000000;
+    GameTimer timer;
+    timer.Reset();
+    double total = 0.0;
+    PrintPerCallRow("Tick", RunBenchmark("tick", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+            timer.Tick();
+    }), calls);
+    PrintPerCallRow("DeltaTime + GameTime", RunBenchmark("read", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+            total += timer.DeltaTime() + timer.GameTime();
+    }), calls);
+    // what Tick is built on, the rest of its cost is the bookkeeping around it
+    LARGE_INTEGER counter;
+    PrintPerCallRow("QueryPerformanceCounter", RunBenchmark("qpc", iterations, [&]()
+    {
+        for (int i = 0; i < calls; i++)
+        {
+            QueryPerformanceCounter(&counter);
+            total += (double)(counter.QuadPart & 1);
+        }
+    }), calls);
+    std::cout << "(" << total << ")\n\n";
+}
+
+static void InputBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("input");
+    std::cout << "input events, as the window's message handler feeds them in (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(26) << "call" << std::right << std::setw(12) << "ms" << std::setw(12) << "ns/call" << "\n";
+
+    // mostly mouse moves, with movement keys and buttons going down, repeating while held and coming back up
+    struct BenchInputEvent { int type; KeyCode key; int x; int y; };
+    const KeyCode keys[] = { Key_W, Key_A, Key_S, Key_D, Key_Space, Key_Shift, Key_Escape, Mouse_LButton, Mouse_RButton };
+    const int eventCount = 1000000;
+    std::vector<BenchInputEvent> events(eventCount);
+    std::mt19937 random(7);
+    for (BenchInputEvent& event : events)
+    {
+        event.type = random() % 10;
+        event.key = keys[random() % (sizeof(keys) / sizeof(keys[0]))];
+        event.x = random() % 1920;
+        event.y = random() % 1080;
+    }
+
+    InitInput();
+    PrintPerCallRow("events", RunBenchmark("events", iterations, [&]()
+    {
+        for (const BenchInputEvent& event : events)
+        {
+            if (event.type < 6)
+                MouseMoveEvent(event.x, event.y);
+            else if (event.type < 9)
+                KeyDownEvent(event.key);
+            else
+                KeyUpEvent(event.key);
+        }
+    }), eventCount);
+
+    // what a game does every frame, asks about each key it uses and where the mouse is
+    const int frames = 100000;
+    int held = 0;
+    PrintPerCallRow("poll a frame", RunBenchmark("poll", iterations, [&]()
+    {
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (KeyCode key : keys)
+                held += KeyHit(key) + KeyHeld(key);
+            held += GetMouseX() > GetMouseY();
+        }
+    }), frames);
+    InitInput();
+    std::cout << "(" << held << ")\n\n";
+}
+
+static void MathBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("math");
+    const UINT count = 1000000;
+    std::cout << "math kernels over " << count << " values (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(26) << "kernel" << std::right << std::setw(12) << "ms" << std::setw(12) << "M/s" << "\n";
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<XMFLOAT3> vectors(count), results(count);
+    std::vector<XMFLOAT4> rotations(count);
+    for (UINT i = 0; i < count; i++)
+    {
+        vectors[i] = XMFLOAT3(unit(random), unit(random), unit(random));
+        rotations[i] = QuatFromAxisAngle(Vec3Normalize(XMFLOAT3(unit(random), unit(random), unit(random) + 2.0f)), unit(random) * 3.0f);
+    }
+
+    auto row = [&](const char* kernel, const BenchmarkResult& result)
+    {
+        std::cout << std::left << std::setw(26) << kernel << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << result.medianMs << std::setprecision(1)
+            << std::setw(12) << (result.medianMs > 0.0 ? count / (result.medianMs * 1000.0) : 0.0) << "\n";
+    };
+    row("QuatRotate", RunBenchmark("rotate", iterations, [&]()
+    {
+        for (UINT i = 0; i < count; i++)
+            results[i] = QuatRotate(rotations[i], vectors[i]);
+    }));
+    row("QuatIntegrate", RunBenchmark("integrate", iterations, [&]()
+    {
+        for (UINT i = 0; i < count; i++)
+            rotations[i] = QuatIntegrate(rotations[i], vectors[i], 1.0f / 60.0f);
+    }));
+    row("Vec3Cross + Normalize", RunBenchmark("crossNormalize", iterations, [&]()
+    {
+        for (UINT i = 0; i + 1 < count; i++)
+            results[i] = Vec3Normalize(Vec3Cross(vectors[i], vectors[i + 1]));
+    }));
+    row("Vec3Basis", RunBenchmark("basis", iterations, [&]()
+    {
+        XMFLOAT3 t2;
+        for (UINT i = 0; i < count; i++)
+            Vec3Basis(Vec3Normalize(vectors[i]), &results[i], &t2);
+    }));
+    std::cout << "\n";
+}
+
+// ==============================================================
+//		loaders
+// ==============================================================
+
+static bool HasExtension(const std::wstring& path, const wchar_t* extension)
+{
+    size_t length = wcslen(extension);
+    return path.size() > length && _wcsicmp(path.c_str() + path.size() - length, extension) == 0;
+}
+
+// the runtime loaders on the real files in Media/, the image decoders have their own table above
+static void LoaderBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("loaders");
+    std::vector<std::wstring> paths = FindFiles(folder);
+    std::cout << "loaders per file (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(28) << "file" << std::right << std::setw(12) << "size" << std::setw(12) << "ms"
+        << std::setw(10) << "MB/s" << "  loaded\n";
+
+    auto row = [&](const std::wstring& path, const BenchmarkResult& result, size_t bytes, const std::string& loaded)
+    {
+        double megabytes = (double)bytes / (1024.0 * 1024.0);
+        std::cout << std::left << std::setw(28) << FileName(path) << std::right << std::setw(12) << bytes << std::fixed
+            << std::setprecision(3) << std::setw(12) << result.medianMs << std::setprecision(1)
+            << std::setw(10) << (result.medianMs > 0.0 ? megabytes / (result.medianMs / 1000.0) : 0.0) << "  " << loaded << "\n";
+    };
+
+    for (const std::wstring& path : paths)
+    {
+        std::vector<BYTE> bytes;
+        if (!ReadWholeFile(path, &bytes))
+            continue;
+
+        if (HasExtension(path, L".x"))
+        {
+            SetBenchmarkVariant(FileName(path));
+            MeshData mesh;
+            BenchmarkResult import = RunBenchmark("xmesh", iterations, [&]()
+            {
+                ImportXMeshFile(path, &mesh);
+            });
+            row(path, import, bytes.size(), std::to_string(mesh.vertices.size()) + " vertices");
+        }
+        else if (HasExtension(path, L".dds"))
+        {
+            // maps the file, checks the header and makes the mip tail resident
+            SetBenchmarkVariant(FileName(path));
+            UINT mips = 0;
+            BenchmarkResult open = RunBenchmark("dds", iterations, [&]()
+            {
+                DDSTexture texture;
+                texture.Open(path);
+                mips = texture.GetMipCount();
+            });
+            row(path, open, bytes.size(), std::to_string(mips) + " mips");
+        }
+    }
+    std::cout << "\n";
+}
+
+// asset lookups by path against ids hashed while compiling and refs the registry hands out
+static void AssetIdBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("assetids");
+    const UINT assetCount = 10000;
+    const int lookups = 1000000;
+    std::cout << "asset lookups, " << assetCount << " registered (median of " << iterations << " runs)\n";
+    std::cout << std::left << std::setw(26) << "lookup" << std::right << std::setw(12) << "ms" << std::setw(12) << "ns/call" << "\n";
+
+    AssetRegistry* registry = AssetRegistry::Get();
+    registry->Clear();
+    std::vector<std::string> names;
+    std::unordered_map<std::string, UINT> byPath;
+    for (UINT i = 0; i < assetCount; i++)
+    {
+        std::string name = "Textures/Terrain/Tile" + std::to_string(i) + ".png";
+        names.push_back(name);
+        byPath[name] = i;
+        registry->Register(name, Widen(name.c_str()), AssetType_Raw);
+    }
+
+    // the order a game asks in is all over the place
+    std::mt19937 random(13);
+    std::vector<UINT> order(lookups);
+    for (UINT& index : order)
+        index = random() % assetCount;
+    std::vector<AssetId> ids(assetCount);
+    std::vector<AssetRef> refs(assetCount);
+    for (UINT i = 0; i < assetCount; i++)
+    {
+        ids[i] = GetAssetId(names[i]);
+        refs[i] = registry->Find(ids[i]);
+    }
+
+    size_t found = 0;
+    PrintPerCallRow("path string map", RunBenchmark("path", iterations, [&]()
+    {
+        for (UINT index : order)
+            found += byPath.count(names[index]);
+    }), lookups);
+    PrintPerCallRow("hash name + Find", RunBenchmark("hashFind", iterations, [&]()
+    {
+        for (UINT index : order)
+            found += registry->Find(GetAssetId(names[index])).IsValid();
+    }), lookups);
+    PrintPerCallRow("Find (ASSET_ID)", RunBenchmark("find", iterations, [&]()
+    {
+        for (UINT index : order)
+            found += registry->Find(ids[index]).IsValid();
+    }), lookups);
+    PrintPerCallRow("Resolve ref", RunBenchmark("resolve", iterations, [&]()
+    {
+        for (UINT index : order)
+            found += registry->Resolve(refs[index]) != nullptr;
+    }), lookups);
+
+    // refs to unregistered assets have to miss, even once their slots are reused
+    for (UINT i = 0; i < assetCount; i += 2)
+        registry->Unregister(refs[i]);
+    for (UINT i = 0; i < assetCount; i += 2)
+        registry->Register(names[i] + ".new", Widen(names[i].c_str()), AssetType_Raw);
+    UINT stale = 0;
+    for (UINT i = 0; i < assetCount; i += 2)
+        stale += registry->Resolve(refs[i]) == nullptr;
+    registry->Clear();
+    std::cout << "(" << found << ", " << stale << " of " << assetCount / 2 << " stale refs missed)\n\n";
+}
+
+// ==============================================================
+//		headless frame
+// ==============================================================
+
+// when each headless frame got to the game's update(), the time between two of them is a whole frame
+static std::vector<std::chrono::high_resolution_clock::time_point> gFrameTimes;
+
+static void RecordFrameTime()
+{
+    gFrameTimes.push_back(std::chrono::high_resolution_clock::now());
+}
+
+// the whole engine loop without a window: a small game's worth of physics, particles and entities as systems
+static void FrameBenchmarks(int iterations)
+{
+    BeginBenchmarkGroup("frame");
+    ConvexHull rock;
+    BuildRock(&rock);
+    PhysicsWorld physics;
+    BuildPhysicsScene(&physics, 2000, &rock);
+
+    ParticleEmitterDesc smokeDesc = MakeSmokeEmitterDesc(XMFLOAT3(0.0f, 0.0f, 0.0f));
+    smokeDesc.maxParticles = 50000;
+    smokeDesc.spawnRate = smokeDesc.maxParticles / ((smokeDesc.minLife + smokeDesc.maxLife) * 0.5f);
+    ParticleEmitter smoke(smokeDesc);
+    smoke.Burst(smokeDesc.maxParticles);
+    TransientVertexBuffer vertices;
+    vertices.Create(nullptr, smokeDesc.maxParticles * 4 * sizeof(ParticleVertex));
+    ParticleCamera camera;
+    camera.position = XMFLOAT3(0.0f, 2.0f, -30.0f);
+    camera.right = XMFLOAT3(1.0f, 0.0f, 0.0f);
+    camera.up = XMFLOAT3(0.0f, 1.0f, 0.0f);
+    camera.forward = XMFLOAT3(0.0f, 0.0f, 1.0f);
+
+    EntityWorld entities;
+    for (UINT i = 0; i < 100000; i++)
+        entities.Create(BenchPosition{ (float)i, 0.0f, 0.0f }, BenchVelocity{ 1.0f, 2.0f, 3.0f });
+
+    SystemScheduler* scheduler = SystemScheduler::Get();
+    UINT systems[4];
+    systems[0] = scheduler->AddSystem(SystemDesc("physics", FramePhase_Simulation, [&](float) { physics.Step(1.0f / 60.0f); })
+        .Writes("Bodies"));
+    systems[1] = scheduler->AddSystem(SystemDesc("entities", FramePhase_Simulation, [&](float)
+    {
+        entities.ParallelEach<BenchPosition, const BenchVelocity>([](Entity, BenchPosition& position, const BenchVelocity& velocity)
+        {
+            position.x += velocity.x / 60.0f;
+            position.y += velocity.y / 60.0f;
+            position.z += velocity.z / 60.0f;
+        });
+    }).WritesComponent<BenchPosition>().ReadsComponent<const BenchVelocity>());
+    systems[2] = scheduler->AddSystem(SystemDesc("particles", FramePhase_Animation, [&](float) { smoke.Update(1.0f / 60.0f); })
+        .Writes("Smoke"));
+    systems[3] = scheduler->AddSystem(SystemDesc("billboards", FramePhase_RenderPrep, [&](float)
+    {
+        UINT firstVertex;
+        vertices.Begin(nullptr);
+        smoke.WriteBillboards(camera, &vertices, &firstVertex);
+        vertices.End(nullptr);
+    }).Reads("Smoke"));
+
+    // the first frames pay for the first impacts and warming up, like the physics benchmark only the steady state counts
+    const UINT warmup = 30;
+    gFrameTimes.clear();
+    StrangeEngine engine;
+    bool started = engine.StartHeadless(nullptr, RecordFrameTime, true, warmup + iterations + 1);
+    for (UINT system : systems)
+        scheduler->RemoveSystem(system);
+    if (!started)
+    {
+        std::cout << "headless startup failed: " << GetEngineError().message << "\n\n";
+        return;
+    }
+
+    std::vector<double> times;
+    for (size_t i = warmup + 1; i < gFrameTimes.size(); i++)
+        times.push_back(std::chrono::duration<double, std::milli>(gFrameTimes[i] - gFrameTimes[i - 1]).count());
+    BenchmarkResult frame = SummarizeBenchmark("frame", times);
+
+    std::cout << "headless frame, 2000 bodies + 50k smoke particles + 100k entities as systems (median of " << iterations << " frames)\n"
+        << std::fixed << std::setprecision(3)
+        << "  frame:  " << frame.medianMs << " ms (min " << frame.minMs << ", mean " << frame.meanMs << ")\n"
+        << "  60Hz:   " << (frame.medianMs < 1000.0 / 60.0 ? "yes" : "no") << "\n"
+        << "  first frame " << engine.GetTimeToFirstFrameMs() << " ms after starting up\n\n";
+}
+
+static void StartupBenchmarks(const std::wstring& folder, int iterations)
+{
+    BeginBenchmarkGroup("startup");
+    // what a game would do at startup besides the engine's own work: index its files and decode its images
+    std::vector<std::wstring> images = FindImages(folder);
+    UINT64 indexHash = 0;
+    auto addGameTasks = [&](StrangeEngine* engine)
+    {
+        engine->AddStartupTask(StartupTaskDesc("asset index", [&]()
+        {
+            indexHash = 0;
+            for (const std::wstring& path : FindFiles(folder))
+            {
+                std::vector<BYTE> bytes;
+                if (ReadWholeFile(path, &bytes) && !bytes.empty())
+                    indexHash ^= HashBytes(bytes.data(), bytes.size());
+            }
+            return true;
+        }).After("memory"));
+        engine->AddStartupTask(StartupTaskDesc("decode images", [&]()
+        {
+            JobSystem::Get()->ParallelFor((unsigned int)images.size(), 1, [&](unsigned int begin, unsigned int end)
+            {
+                for (unsigned int i = begin; i < end; i++)
+                {
+                    UINT width = 0, height = 0;
+                    std::vector<BYTE> rgba;
+                    DecodeImage(images[i], &width, &height, &rgba);
+                }
+            });
+            return true;
+        }).After("memory"));
+    };
+
+    // a fresh engine each run, StartHeadless shuts the job system, memory and logger down again when it's done
+    auto timeToFirstFrame = [&](bool parallel, StartupReport* report)
+    {
+        std::vector<double> times;
+        for (int i = 0; i < iterations + 1; i++)
+        {
+            StrangeEngine engine;
+            addGameTasks(&engine);
+            if (!engine.StartHeadless(nullptr, nullptr, parallel))
+            {
+                std::cout << "headless startup failed: " << GetEngineError().message << "\n";
+                return 0.0;
+            }
+            // the first run pays for page faults and a cold file cache, don't count it
+            if (i > 0)
+                times.push_back(engine.GetTimeToFirstFrameMs());
+            *report = engine.GetStartupReport();
+        }
+        return SummarizeBenchmark(parallel ? "graph" : "serial", times).medianMs;
+    };
+
+    StartupReport serialReport, parallelReport;
+    double serial = timeToFirstFrame(false, &serialReport);
+    double parallel = timeToFirstFrame(true, &parallelReport);
+    if (serial == 0.0 || parallel == 0.0)
+        return;
+
+    std::cout << "headless startup to the end of the first frame (median of " << iterations << " runs, "
+        << images.size() << " images)\n" << std::fixed << std::setprecision(3)
+        << "  one task at a time: " << serial << " ms\n"
+        << "  task graph:         " << parallel << " ms (" << std::setprecision(2)
+        << (parallel > 0.0 ? serial / parallel : 0.0) << "x on " << std::thread::hardware_concurrency() << " hardware threads)\n";
+
+    std::cout << "\nlast task graph run, " << std::setprecision(3) << parallelReport.serialMs << " ms of work, critical path "
+        << parallelReport.criticalPathMs << " ms (*)\n";
+    std::cout << std::left << std::setw(20) << "task" << std::right << std::setw(12) << "start ms" << std::setw(12) << "ms"
+        << std::setw(8) << "thread" << "\n";
+    for (const StartupTaskTiming& task : parallelReport.tasks)
+    {
+        std::cout << std::left << std::setw(20) << task.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << task.startMs << std::setw(12) << task.ms << std::setw(8) << task.thread
+            << (task.critical ? " *" : "") << "\n";
+    }
+    std::cout << "\n";
+}
+
+// ==============================================================
+//		json results and comparing runs
+// ==============================================================
+
+static std::string JsonEscape(const std::string& text)
+{
+    std::string result;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            result += escaped;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// one benchmark per line, so ReadBenchmarkJson doesn't need a whole json parser for files this program wrote
+static bool WriteBenchmarkJson(const std::string& path, int iterations)
+{
+    std::ofstream file(path.c_str(), std::ios::trunc);
+    if (!file)
+        return false;
+
+    const std::vector<BenchmarkRecord>& records = GetBenchmarkRecords();
+    file << "{\n    \"iterations\": " << iterations << ",\n    \"hardwareThreads\": " << std::thread::hardware_concurrency()
+        << ",\n    \"benchmarks\": [\n" << std::setprecision(9);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const BenchmarkResult& result = records[i].result;
+        file << "        { \"name\": \"" << JsonEscape(records[i].key) << "\", \"iterations\": " << result.iterations
+            << ", \"minMs\": " << result.minMs << ", \"medianMs\": " << result.medianMs << ", \"meanMs\": " << result.meanMs
+            << " }" << (i + 1 < records.size() ? "," : "") << "\n";
+    }
+    file << "    ]\n}\n";
+    return (bool)file;
+}
+
+static bool ReadJsonNumber(const std::string& line, const char* field, double* value)
+{
+    size_t found = line.find(std::string("\"") + field + "\": ");
+    if (found == std::string::npos)
+        return false;
+    *value = strtod(line.c_str() + found + strlen(field) + 4, nullptr);
+    return true;
+}
+
+static bool ReadBenchmarkJson(const std::string& path, std::vector<BenchmarkRecord>* records)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const std::string nameField = "\"name\": \"";
+        size_t start = line.find(nameField);
+        if (start == std::string::npos)
+            continue;
+
+        BenchmarkRecord record;
+        size_t i = start + nameField.size();
+        for (; i < line.size() && line[i] != '"'; i++)
+        {
+            if (line[i] == '\\' && i + 1 < line.size())
+            {
+                i++;
+                if (line[i] == 'u' && i + 4 < line.size())
+                {
+                    record.key += (char)strtol(line.substr(i + 1, 4).c_str(), nullptr, 16);
+                    i += 4;
+                    continue;
+                }
+            }
+            record.key += line[i];
+        }
+
+        double iterations = 0.0;
+        BenchmarkResult& result = record.result;
+        result.name = record.key;
+        if (!ReadJsonNumber(line, "medianMs", &result.medianMs))
+            continue;
+        ReadJsonNumber(line, "iterations", &iterations);
+        ReadJsonNumber(line, "minMs", &result.minMs);
+        ReadJsonNumber(line, "meanMs", &result.meanMs);
+        result.iterations = (int)iterations;
+        records->push_back(record);
+    }
+    return true;
+}
+
+static void PrintUsage()
+{
+    std::cout << "usage:\n"
+        << "  StrangeEngineMK3_Benchmark [media folder] [-iterations <n>] [-json <results.json>] [-only <group,group...>]\n"
+        << "  StrangeEngineMK3_Benchmark compare <baseline.json> <current.json> [-threshold <percent>] [-minms <ms>]\n"
+        << "\n"
+        << "groups: imagesize decode pack loaders assetids timer input math ecs snapshot spatial broadphase physics particles lights terrain picking debugdraw memory log frame startup\n"
+        << "compare lists every benchmark whose median got slower (or faster) by more than the threshold, 5% by default,\n"
+        << "and returns 1 if anything got slower. benchmarks under -minms (0.05 by default) in both runs are timer noise\n"
+        << "and never flagged\n";
+}
+
+static int CompareCommand(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    double threshold = 5.0;
+    double minMs = 0.05;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "-minms") == 0 && i + 1 < argc)
+            minMs = atof(argv[++i]);
+        else
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkRecord> baseline, current;
+    if (!ReadBenchmarkJson(argv[2], &baseline) || !ReadBenchmarkJson(argv[3], &current))
+    {
+        std::cout << "failed to read " << argv[2] << " or " << argv[3] << "\n";
+        return 1;
+    }
+
+    std::cout << "median ms, " << argv[2] << " -> " << argv[3] << ", changes over " << threshold << "%\n";
+    std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(12) << "baseline" << std::setw(12) << "current"
+        << std::setw(10) << "change" << "\n";
+
+    UINT regressed = 0, improved = 0, same = 0, missing = 0;
+    std::vector<bool> matched(current.size(), false);
+    for (const BenchmarkRecord& before : baseline)
+    {
+        size_t found = 0;
+        while (found < current.size() && current[found].key != before.key)
+            found++;
+        if (found == current.size())
+        {
+            std::cout << std::left << std::setw(48) << before.key << std::right << std::fixed << std::setprecision(3)
+                << std::setw(12) << before.result.medianMs << std::setw(12) << "-" << std::setw(10) << "" << "  missing\n";
+            missing++;
+            continue;
+        }
+        matched[found] = true;
+
+        double was = before.result.medianMs;
+        double now = current[found].result.medianMs;
+        double change = was > 0.0 ? (now - was) * 100.0 / was : 0.0;
+        const char* verdict = "";
+        if (was < minMs && now < minMs)
+        {
+            same++;
+        }
+        else if (change > threshold)
+        {
+            verdict = "  SLOWER";
+            regressed++;
+        }
+        else if (change < -threshold)
+        {
+            verdict = "  faster";
+            improved++;
+        }
+        else
+        {
+            same++;
+        }
+
+        std::cout << std::left << std::setw(48) << before.key << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << was << std::setw(12) << now << std::showpos << std::setprecision(1) << std::setw(9) << change
+            << std::noshowpos << "%" << verdict << "\n";
+    }
+
+    UINT added = 0;
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        if (!matched[i])
+        {
+            std::cout << std::left << std::setw(48) << current[i].key << std::right << std::fixed << std::setprecision(3)
+                << std::setw(12) << "-" << std::setw(12) << current[i].result.medianMs << std::setw(10) << "" << "  new\n";
+            added++;
+        }
+    }
+
+    std::cout << std::defaultfloat << "\n" << regressed << " slower, " << improved << " faster, " << same << " within " << threshold << "%, "
+        << missing << " missing, " << added << " new\n";
+    return regressed > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "compare") == 0)
+        return CompareCommand(argc, argv);
+
+    std::wstring media = L"Media";
+    int iterations = 10;
+    std::string jsonPath;
+    std::string only;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-iterations") == 0 && i + 1 < argc)
+            iterations = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "-only") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if (argv[i][0] == '-')
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+        else
+            media = Widen(argv[i]);
+    }
+
+    auto selected = [&](const char* group)
+    {
+        return only.empty() || ("," + only + ",").find(std::string(",") + group + ",") != std::string::npos;
+    };
+
+    if (selected("imagesize"))
+        ImageSizeBenchmarks(iterations);
+    if (selected("decode"))
+        DecodeBenchmarks(media, iterations);
+    if (selected("pack"))
+        PackBenchmarks(media, iterations);
+    if (selected("loaders"))
+        LoaderBenchmarks(media, iterations);
+    if (selected("assetids"))
+        AssetIdBenchmarks(iterations);
+    if (selected("timer"))
+        TimerBenchmarks(iterations);
+    if (selected("input"))
+        InputBenchmarks(iterations);
+    if (selected("math"))
+        MathBenchmarks(iterations);
+    if (selected("ecs"))
+        EntityBenchmarks(iterations);
+    if (selected("snapshot"))
+        SnapshotBenchmarks(iterations);
+    if (selected("spatial"))
+        SpatialBenchmarks(iterations);
+    if (selected("broadphase"))
+        BroadphaseBenchmarks(iterations);
+    if (selected("physics"))
+        PhysicsBenchmarks(iterations);
+    if (selected("particles"))
+        ParticleBenchmarks(iterations);
+    if (selected("lights"))
+        LightBenchmarks(iterations);
+    if (selected("terrain"))
+        TerrainBenchmarks(media, iterations);
+    if (selected("picking"))
+        PickingBenchmarks(media, iterations);
+    if (selected("debugdraw"))
+        DebugDrawBenchmarks(iterations);
+    if (selected("memory"))
+        MemoryBenchmarks(iterations);
+    if (selected("log"))
+        LogBenchmarks(iterations);
+    // last, these start and stop the whole engine
+    if (selected("frame"))
+        FrameBenchmarks(iterations);
+    if (selected("startup"))
+        StartupBenchmarks(media, iterations);
+
+    JobSystem::Get()->Shutdown();
+
+    if (!jsonPath.empty())
+    {
+        if (!WriteBenchmarkJson(jsonPath, iterations))
+        {
+            std::cout << "failed to write " << jsonPath << "\n";
+            return 1;
+        }
+        std::cout << GetBenchmarkRecords().size() << " results written to " << jsonPath << "\n";
+    }
+    return 0;
+}
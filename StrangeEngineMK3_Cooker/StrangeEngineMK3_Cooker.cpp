@@ -0,0 +1,349 @@
+// asset cooker: turns the source assets in Media/ into the formats the engine loads at runtime
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <Windows.h>
+#include "TextureCooker.h"
+#include "PackFile.h"
+#include "CookDatabase.h"
+#include "JobSystem.h"
+
+static void PrintUsage()
+{
+    std::cout << "usage:\n"
+        << "  StrangeEngineMK3_Cooker texture <source> <dest.dds> [-format bc1|bc1a|bc3|bc5|bc7] [-quality fast|normal|high] [-srgb]\n"
+        << "                                  [-mipfilter box|kaiser] [-alphacoverage <cutoff>]\n"
+        << "  StrangeEngineMK3_Cooker compare <source>\n"
+        << "  StrangeEngineMK3_Cooker cook <source folder> <cooked folder> [texture options] [-force]\n"
+        << "  StrangeEngineMK3_Cooker pack <folder> <dest.pak> [-nocompress]\n"
+        << "  StrangeEngineMK3_Cooker list <pack.pak>\n"
+        << "\n"
+        << "sources can be an uncompressed .dds or any image WIC can read (.png, .jpg, .bmp...)\n"
+        << "image sources get a new mip chain, -alphacoverage keeps alpha tested textures from thinning out in the distance\n"
+        << "\n"
+        << "texture  compresses every mip of an uncompressed texture and reports the error and throughput\n"
+        << "compare  tries every format and quality on one texture so you can pick the speed/quality trade-off\n"
+        << "cook     cooks every texture and .x mesh under a folder, only the ones that changed since the last cook\n"
+        << "pack     puts every file under a folder into one LZ4 compressed archive, identical files are stored once\n"
+        << "list     prints what is in an archive and how well each entry compressed\n";
+}
+
+static std::wstring Widen(const char* text)
+{
+    int length = MultiByteToWideChar(CP_ACP, 0, text, -1, nullptr, 0);
+    std::wstring result(length > 0 ? length - 1 : 0, L'\0');
+    if (length > 1)
+        MultiByteToWideChar(CP_ACP, 0, text, -1, &result[0], length);
+    return result;
+}
+
+static const char* FormatName(BCFormat format)
+{
+    switch (format)
+    {
+    case BCFormat_BC1:  return "BC1";
+    case BCFormat_BC1A: return "BC1A";
+    case BCFormat_BC3:  return "BC3";
+    case BCFormat_BC5:  return "BC5";
+    case BCFormat_BC7:  return "BC7";
+    default:            return "?";
+    }
+}
+
+static const char* QualityName(BCQuality quality)
+{
+    switch (quality)
+    {
+    case BCQuality_Fast:   return "fast";
+    case BCQuality_Normal: return "normal";
+    case BCQuality_High:   return "high";
+    default:               return "?";
+    }
+}
+
+static bool ParseFormat(const char* text, BCFormat* format)
+{
+    if (_stricmp(text, "bc1") == 0)  { *format = BCFormat_BC1;  return true; }
+    if (_stricmp(text, "bc1a") == 0) { *format = BCFormat_BC1A; return true; }
+    if (_stricmp(text, "bc3") == 0)  { *format = BCFormat_BC3;  return true; }
+    if (_stricmp(text, "bc5") == 0)  { *format = BCFormat_BC5;  return true; }
+    if (_stricmp(text, "bc7") == 0)  { *format = BCFormat_BC7;  return true; }
+    return false;
+}
+
+static bool ParseQuality(const char* text, BCQuality* quality)
+{
+    if (_stricmp(text, "fast") == 0)   { *quality = BCQuality_Fast;   return true; }
+    if (_stricmp(text, "normal") == 0) { *quality = BCQuality_Normal; return true; }
+    if (_stricmp(text, "high") == 0)   { *quality = BCQuality_High;   return true; }
+    return false;
+}
+
+static bool ParseMipFilter(const char* text, MipFilter* filter)
+{
+    if (_stricmp(text, "box") == 0)    { *filter = MipFilter_Box;    return true; }
+    if (_stricmp(text, "kaiser") == 0) { *filter = MipFilter_Kaiser; return true; }
+    return false;
+}
+
+// reads the option at argv[*i] (and its value, moving *i past it), false if it isn't a texture option
+static bool ParseTextureOption(int argc, char* argv[], int* i, TextureCookSettings* settings)
+{
+    const char* option = argv[*i];
+    const char* value = (*i + 1 < argc) ? argv[*i + 1] : nullptr;
+    bool parsed = true;
+    if (strcmp(option, "-format") == 0 && value && ParseFormat(value, &settings->format))
+        (*i)++;
+    else if (strcmp(option, "-quality") == 0 && value && ParseQuality(value, &settings->quality))
+        (*i)++;
+    else if (strcmp(option, "-srgb") == 0)
+        settings->srgb = true;
+    else if (strcmp(option, "-mipfilter") == 0 && value && ParseMipFilter(value, &settings->mipFilter))
+        (*i)++;
+    else if (strcmp(option, "-alphacoverage") == 0 && value)
+    {
+        settings->preserveAlphaCoverage = true;
+        settings->alphaCutoff = (float)atof(value);
+        (*i)++;
+    }
+    else
+        parsed = false;
+    return parsed;
+}
+
+static void PrintReportHeader()
+{
+    std::cout << std::left << std::setw(6) << "format" << std::setw(8) << "quality"
+        << std::right << std::setw(8) << "RMSE" << std::setw(10) << "PSNR(dB)"
+        << std::setw(8) << "R" << std::setw(8) << "G" << std::setw(8) << "B" << std::setw(8) << "A"
+        << std::setw(10) << "MP/s" << std::setw(10) << "ratio" << "\n";
+}
+
+static void PrintReport(const TextureCookSettings& settings, const TextureCookReport& report)
+{
+    std::cout << std::left << std::setw(6) << FormatName(settings.format) << std::setw(8) << QualityName(settings.quality)
+        << std::right << std::fixed << std::setprecision(2)
+        << std::setw(8) << report.error.rmse << std::setw(10) << report.error.psnr
+        << std::setw(8) << report.error.channelRmse[0] << std::setw(8) << report.error.channelRmse[1]
+        << std::setw(8) << report.error.channelRmse[2] << std::setw(8) << report.error.channelRmse[3]
+        << std::setw(10) << report.megapixelsPerSecond
+        << std::setw(9) << (double)report.sourceBytes / (double)report.cookedBytes << "x\n";
+}
+
+static int CookTextureCommand(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    TextureCookSettings settings = { BCFormat_BC7, BCQuality_Normal, false, MipFilter_Kaiser, false, 0.5f };
+    for (int i = 4; i < argc; i++)
+    {
+        if (!ParseTextureOption(argc, argv, &i, &settings))
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    TextureCookReport report;
+    if (!CookTexture(Widen(argv[2]), Widen(argv[3]), settings, &report))
+    {
+        std::cout << "failed to cook " << argv[2] << "\n";
+        return 1;
+    }
+
+    std::cout << argv[2] << " -> " << argv[3] << " (" << report.width << "x" << report.height << ", " << report.mipCount << " mips)\n";
+    if (report.importSeconds > 0.0)
+        std::cout << "decode + mips: " << std::fixed << std::setprecision(2) << report.importSeconds * 1000.0 << " ms\n";
+    PrintReportHeader();
+    PrintReport(settings, report);
+    return 0;
+}
+
+static int CompareCommand(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // image sources are compared with the default mips, the filter doesn't change the block encoder
+    TextureCookSettings importSettings = { BCFormat_BC7, BCQuality_Normal, false, MipFilter_Kaiser, false, 0.5f };
+    RGBAMipChain chain;
+    if (!LoadTextureSource(Widen(argv[2]), importSettings, &chain))
+    {
+        std::cout << "failed to load " << argv[2] << "\n";
+        return 1;
+    }
+
+    std::cout << argv[2] << " (" << chain.width << "x" << chain.height << ", " << chain.mips.size() << " mips)\n";
+    PrintReportHeader();
+
+    const BCFormat formats[] = { BCFormat_BC1, BCFormat_BC1A, BCFormat_BC3, BCFormat_BC5, BCFormat_BC7 };
+    const BCQuality qualities[] = { BCQuality_Fast, BCQuality_Normal, BCQuality_High };
+    for (BCFormat format : formats)
+    {
+        for (BCQuality quality : qualities)
+        {
+            TextureCookSettings settings = { format, quality, false, MipFilter_Kaiser, false, 0.5f };
+            TextureCookReport report;
+            std::vector<std::vector<BYTE>> compressed;
+            CompressMipChain(chain, settings, &compressed, &report);
+            PrintReport(settings, report);
+        }
+    }
+    return 0;
+}
+
+static int CookCommand(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    AssetCookSettings settings = { { BCFormat_BC7, BCQuality_Normal, false, MipFilter_Kaiser, false, 0.5f } };
+    bool force = false;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-force") == 0)
+            force = true;
+        else if (!ParseTextureOption(argc, argv, &i, &settings.texture))
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::wstring source = Widen(argv[2]);
+    std::wstring cooked = Widen(argv[3]);
+    std::wstring databasePath = cooked + L"\\cook.db";
+    CreateDirectoryW(cooked.c_str(), nullptr);
+
+    CookDatabase database;
+    if (!force)
+        database.Load(databasePath);
+
+    IncrementalCookReport report;
+    bool ok = database.CookFolder(source, cooked, settings, &report);
+    database.Save(databasePath);
+
+    for (const std::wstring& path : report.cookedOutputs)
+        std::wcout << L"  " << path << L"\n";
+    for (const std::wstring& path : report.failedSources)
+        std::wcout << L"  FAILED " << path << L"\n";
+
+    std::cout << report.sources << " sources: " << report.cooked << " cooked, " << report.upToDate << " up to date, "
+        << report.failed << " failed\n"
+        << std::fixed << std::setprecision(2)
+        << "hashing: " << report.hashSeconds * 1000.0 << " ms, cooking: " << report.cookSeconds * 1000.0 << " ms\n";
+    return ok ? 0 : 1;
+}
+
+static int PackCommand(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    PackWriter writer;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-nocompress") == 0)
+            writer.SetCompression(PackCompression_None);
+        else
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (!writer.AddFolder(Widen(argv[2])))
+    {
+        std::cout << "failed to read " << argv[2] << "\n";
+        return 1;
+    }
+
+    PackWriteStats stats;
+    if (!writer.Write(Widen(argv[3]), &stats))
+    {
+        std::cout << "failed to write " << argv[3] << "\n";
+        return 1;
+    }
+
+    std::cout << argv[2] << " -> " << argv[3] << "\n"
+        << "  " << stats.entries << " files, " << stats.blobs << " unique\n"
+        << "  source:   " << stats.sourceBytes << " bytes\n"
+        << "  deduped:  " << stats.dedupedBytes << " bytes\n"
+        << "  stored:   " << stats.storedBytes << " bytes (" << std::fixed << std::setprecision(2)
+        << (stats.storedBytes > 0 ? (double)(stats.sourceBytes - stats.dedupedBytes) / (double)stats.storedBytes : 0.0) << "x compression)\n"
+        << "  pack:     " << stats.fileSize << " bytes\n"
+        << "  compress: " << stats.compressSeconds * 1000.0 << " ms\n";
+    return 0;
+}
+
+static int ListCommand(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    PackFile pack;
+    if (!pack.Open(Widen(argv[2])))
+    {
+        std::cout << "failed to open " << argv[2] << "\n";
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(40) << "name" << std::right << std::setw(12) << "size"
+        << std::setw(12) << "stored" << std::setw(8) << "codec" << "\n";
+    for (UINT i = 0; i < pack.GetEntryCount(); i++)
+    {
+        std::cout << std::left << std::setw(40) << pack.GetEntryName(i) << std::right
+            << std::setw(12) << pack.GetEntrySize(i) << std::setw(12) << pack.GetStoredSize(i)
+            << std::setw(8) << (pack.GetCompression(i) == PackCompression_LZ4 ? "lz4" : "none") << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    int result = 1;
+    if (strcmp(argv[1], "texture") == 0)
+        result = CookTextureCommand(argc, argv);
+    else if (strcmp(argv[1], "compare") == 0)
+        result = CompareCommand(argc, argv);
+    else if (strcmp(argv[1], "cook") == 0)
+        result = CookCommand(argc, argv);
+    else if (strcmp(argv[1], "pack") == 0)
+        result = PackCommand(argc, argv);
+    else if (strcmp(argv[1], "list") == 0)
+        result = ListCommand(argc, argv);
+    else
+        PrintUsage();
+
+    // whichever command ran, the job system's workers are stopped before the process exits
+    JobSystem::Get()->Shutdown();
+    return result;
+}
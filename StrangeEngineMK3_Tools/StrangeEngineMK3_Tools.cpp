@@ -0,0 +1,507 @@
+// engine tools: small command line utilities for the files the engine writes while it runs
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <Windows.h>
+#include "Log.h"
+#include "Telemetry.h"
+#include "RenderCapture.h"
+
+static void PrintUsage()
+{
+    std::cout << "usage:\n"
+        << "  StrangeEngineMK3_Tools decode <log.slog> [-level trace|debug|info|warning|error] [-category <name>] [-thread <id>]\n"
+        << "  StrangeEngineMK3_Tools tail [StrangeEngine.telemetry] [-every <frames>] [-counters <name,name...>] [-timeout <seconds>]\n"
+        << "  StrangeEngineMK3_Tools replay <capture> [-device hardware|warp|null] [-loops <count>]\n"
+        << "\n"
+        << "decode  turns a binary log (StrangeEngine.slog by default) back into text, -level shows that level and above\n"
+        << "tail    follows a running engine's telemetry, one line every 60 frames by default, until no frames have come\n"
+        << "        for -timeout seconds (10). -counters only shows names containing one of the given parts\n"
+        << "replay  plays a render capture back -loops times (100) with no window and times each frame's submission.\n"
+        << "        -device null only decodes the commands, warp is the software rasterizer\n";
+}
+
+static bool ParseLevel(const char* text, LogLevel* level)
+{
+    for (int i = 0; i < LogLevel_Count; i++)
+    {
+        if (_stricmp(text, GetLogLevelName((LogLevel)i)) == 0)
+        {
+            *level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseCategory(const char* text, LogCategory* category)
+{
+    for (int i = 0; i < LogCategory_Count; i++)
+    {
+        if (_stricmp(text, GetLogCategoryName((LogCategory)i)) == 0)
+        {
+            *category = (LogCategory)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int DecodeCommand(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    LogLevel minLevel = LogLevel_Trace;
+    LogCategory category = LogCategory_Count; // all of them
+    long thread = -1;
+    for (int i = 3; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-level") == 0 && hasValue && ParseLevel(argv[i + 1], &minLevel))
+            i++;
+        else if (strcmp(argv[i], "-category") == 0 && hasValue && ParseCategory(argv[i + 1], &category))
+            i++;
+        else if (strcmp(argv[i], "-thread") == 0 && hasValue)
+            thread = strtol(argv[++i], nullptr, 10);
+        else
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    LogFileReader reader;
+    if (!reader.Open(argv[2]))
+    {
+        std::cout << "failed to open " << argv[2] << ": " << GetEngineError().message << "\n";
+        return 1;
+    }
+
+    UINT total = 0;
+    UINT shown = 0;
+    UINT errors = 0;
+    LogMessage message;
+    char prefix[64];
+    while (reader.Next(&message))
+    {
+        total++;
+        if (message.level == LogLevel_Error)
+            errors++;
+
+        if (message.level < minLevel || (category != LogCategory_Count && message.category != category) ||
+            (thread >= 0 && message.thread != (UINT)thread))
+        {
+            continue;
+        }
+
+        snprintf(prefix, sizeof(prefix), "[%9.3f][%u][%s][%s]: ", message.seconds, message.thread,
+            GetLogCategoryName(message.category), GetLogLevelName(message.level));
+        std::cout << prefix << message.text << "\n";
+        shown++;
+    }
+
+    // a log cut short by a crash still decodes up to the last complete message
+    std::cout << shown << " of " << total << " messages shown, " << errors << " errors\n";
+    return 0;
+}
+
+// every counter and histogram over the frames since the last line tail printed
+struct TailTotals
+{
+    UINT firstFrame;
+    UINT frames;
+    double seconds;
+    std::vector<INT64> counters;
+    std::vector<TelemetryHistogram> histograms;
+};
+
+static void ResetTotals(TailTotals* totals, const TelemetryReader& reader)
+{
+    totals->frames = 0;
+    totals->counters.assign(reader.GetCounterCount(), 0);
+    totals->histograms.assign(reader.GetHistogramCount(), TelemetryHistogram());
+    for (TelemetryHistogram& histogram : totals->histograms)
+        memset(&histogram, 0, sizeof(histogram));
+}
+
+static void AddToTotals(TailTotals* totals, const TelemetryReader& reader, const TelemetryFrame& frame)
+{
+    if (totals->frames == 0)
+        totals->firstFrame = frame.frame;
+    totals->frames++;
+    totals->seconds = frame.seconds;
+
+    // per frame counters add up, the rest show their latest value
+    for (UINT i = 0; i < totals->counters.size(); i++)
+    {
+        if (reader.GetCounterKind(i) == TelemetryCounter_PerFrame)
+            totals->counters[i] += frame.counters[i];
+        else
+            totals->counters[i] = frame.counters[i];
+    }
+
+    for (UINT i = 0; i < totals->histograms.size(); i++)
+    {
+        const TelemetryHistogram& from = frame.histograms[i];
+        TelemetryHistogram& to = totals->histograms[i];
+        if (from.count == 0)
+            continue;
+        to.minValue = (to.count == 0 || from.minValue < to.minValue) ? from.minValue : to.minValue;
+        to.maxValue = (to.count == 0 || from.maxValue > to.maxValue) ? from.maxValue : to.maxValue;
+        to.count += from.count;
+        to.sum += from.sum;
+        for (UINT bucket = 0; bucket < kTelemetryBuckets; bucket++)
+            to.buckets[bucket] += from.buckets[bucket];
+    }
+}
+
+static bool TailShows(const std::string& filter, const char* name)
+{
+    if (filter.empty())
+        return true;
+
+    size_t start = 0;
+    while (start <= filter.size())
+    {
+        size_t end = filter.find(',', start);
+        if (end == std::string::npos)
+            end = filter.size();
+        std::string part = filter.substr(start, end - start);
+        if (!part.empty() && strstr(name, part.c_str()) != nullptr)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+static void PrintTotals(const TailTotals& totals, const TelemetryReader& reader, const std::string& filter)
+{
+    char text[160];
+    snprintf(text, sizeof(text), "[%9.3f] frames %u-%u", totals.seconds, totals.firstFrame, totals.firstFrame + totals.frames - 1);
+    std::cout << text;
+
+    for (UINT i = 0; i < totals.histograms.size(); i++)
+    {
+        const TelemetryHistogram& histogram = totals.histograms[i];
+        if (!TailShows(filter, reader.GetHistogramName(i)) || histogram.count == 0)
+            continue;
+        float rangeMin, rangeMax;
+        reader.GetHistogramRange(i, &rangeMin, &rangeMax);
+        snprintf(text, sizeof(text), "  %s mean %.2f p50 %.2f p95 %.2f max %.2f", reader.GetHistogramName(i),
+            histogram.sum / histogram.count, GetTelemetryPercentile(histogram, rangeMin, rangeMax, 0.5f),
+            GetTelemetryPercentile(histogram, rangeMin, rangeMax, 0.95f), histogram.maxValue);
+        std::cout << text;
+    }
+
+    for (UINT i = 0; i < totals.counters.size(); i++)
+    {
+        if (!TailShows(filter, reader.GetCounterName(i)))
+            continue;
+        if (reader.GetCounterKind(i) == TelemetryCounter_PerFrame)
+            snprintf(text, sizeof(text), "  %s %.1f/frame", reader.GetCounterName(i), (double)totals.counters[i] / totals.frames);
+        else
+            snprintf(text, sizeof(text), "  %s %lld", reader.GetCounterName(i), (long long)totals.counters[i]);
+        std::cout << text;
+    }
+    std::cout << "\n";
+}
+
+static int TailCommand(int argc, char* argv[])
+{
+    std::string path = "StrangeEngine.telemetry";
+    UINT every = 60;
+    double timeout = 10.0;
+    std::string filter;
+    for (int i = 2; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-every") == 0 && hasValue)
+            every = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-counters") == 0 && hasValue)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "-timeout") == 0 && hasValue)
+            timeout = atof(argv[++i]);
+        else if (argv[i][0] != '-')
+            path = argv[i];
+        else
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    int length = MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, nullptr, 0);
+    std::wstring widePath(length > 0 ? length - 1 : 0, L'\0');
+    if (length > 1)
+        MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, &widePath[0], length);
+    DWORD waited = 0;
+    while (GetFileAttributesW(widePath.c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        if (waited >= timeout * 1000.0)
+        {
+            std::cout << path << " doesn't exist, is the engine running?\n";
+            return 1;
+        }
+        Sleep(100);
+        waited += 100;
+    }
+
+    TelemetryReader reader;
+    if (!reader.Open(widePath))
+    {
+        std::cout << "failed to open " << path << ": " << GetEngineError().message << "\n";
+        return 1;
+    }
+
+    // starts at the newest frame, everything from before tail started is history
+    UINT session = 0;
+    UINT next = 0;
+    UINT counterCount = 0, histogramCount = 0;
+    TailTotals totals;
+    totals.frames = 0;
+    waited = 0;
+    while (waited < timeout * 1000.0)
+    {
+        if (reader.GetSession() != session || reader.GetCounterCount() != counterCount || reader.GetHistogramCount() != histogramCount)
+        {
+            // what was added up so far still goes out, with the names it was added up under
+            if (session != 0 && totals.frames > 0)
+                PrintTotals(totals, reader, filter);
+
+            bool first = session == 0;
+            bool restarted = reader.GetSession() != session;
+            session = reader.GetSession();
+            counterCount = reader.GetCounterCount();
+            histogramCount = reader.GetHistogramCount();
+            std::cout << "session " << session << ", " << counterCount << " counters and " << histogramCount << " histograms\n";
+            if (restarted)
+                next = (first && reader.GetFramesPublished() > 0) ? reader.GetFramesPublished() - 1 : 0;
+            ResetTotals(&totals, reader);
+        }
+
+        UINT published = reader.GetFramesPublished();
+        if (published < next)
+            next = published;
+        if (published - next > kTelemetryRingFrames)
+        {
+            std::cout << "fell " << published - next - kTelemetryRingFrames << " frames behind, skipping them\n";
+            next = published - kTelemetryRingFrames;
+        }
+
+        if (next == published)
+        {
+            Sleep(50);
+            waited += 50;
+            continue;
+        }
+        waited = 0;
+
+        TelemetryFrame frame;
+        for (; next < published; next++)
+        {
+            // written over while it was being copied, the engine has lapped us
+            if (!reader.ReadFrame(next, &frame))
+                continue;
+            AddToTotals(&totals, reader, frame);
+            if (totals.frames >= every)
+            {
+                PrintTotals(totals, reader, filter);
+                ResetTotals(&totals, reader);
+            }
+        }
+    }
+
+    if (totals.frames > 0)
+        PrintTotals(totals, reader, filter);
+    std::cout << "no new frames for " << timeout << " seconds, stopping\n";
+    return 0;
+}
+
+static double TicksToMs(LONGLONG ticks)
+{
+    static LARGE_INTEGER frequency = {};
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    return (double)ticks * 1000.0 / (double)frequency.QuadPart;
+}
+
+static int ReplayCommand(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string deviceName = "hardware";
+    UINT loops = 100;
+    for (int i = 3; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-device") == 0 && hasValue)
+            deviceName = argv[++i];
+        else if (strcmp(argv[i], "-loops") == 0 && hasValue)
+            loops = std::max(1, atoi(argv[++i]));
+        else
+        {
+            std::cout << "unknown option " << argv[i] << "\n";
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    // the D3D null device still validates every call, what's wanted for 'null' is the replay's own cost so it gets none
+    bool headless = _stricmp(deviceName.c_str(), "null") == 0;
+    D3D_DRIVER_TYPE driverType = D3D_DRIVER_TYPE_HARDWARE;
+    if (_stricmp(deviceName.c_str(), "warp") == 0)
+        driverType = D3D_DRIVER_TYPE_WARP;
+    else if (!headless && _stricmp(deviceName.c_str(), "hardware") != 0)
+    {
+        std::cout << "unknown device " << deviceName << "\n";
+        PrintUsage();
+        return 1;
+    }
+
+    std::string path = argv[2];
+    int length = MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, nullptr, 0);
+    std::wstring widePath(length > 0 ? length - 1 : 0, L'\0');
+    if (length > 1)
+        MultiByteToWideChar(CP_ACP, 0, path.c_str(), -1, &widePath[0], length);
+
+    RenderReplay replay;
+    if (!replay.Load(widePath))
+    {
+        std::cout << "failed to load " << path << ": " << GetEngineError().message << "\n";
+        return 1;
+    }
+
+    ID3D11Device* device = nullptr;
+    ID3D11DeviceContext* context = nullptr;
+    if (!headless)
+    {
+        D3D_FEATURE_LEVEL featureLevel;
+        HRESULT hr = D3D11CreateDevice(nullptr, driverType, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION, &device, &featureLevel, &context);
+        // check for failure
+        if (FAILED(hr))
+        {
+            std::cout << "failed to create a " << deviceName << " device, " << std::hex << hr << std::dec << "\n";
+            return 1;
+        }
+    }
+
+    if (!replay.CreateObjects(device))
+    {
+        std::cout << "failed to create the capture's objects: " << GetEngineError().message << "\n";
+        if (context) context->Release();
+        if (device) device->Release();
+        return 1;
+    }
+
+    // waiting for the GPU between frames keeps one frame's work out of the next one's timing, the wait isn't timed
+    ID3D11Query* idle = nullptr;
+    if (device)
+    {
+        D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+        device->CreateQuery(&queryDesc, &idle);
+    }
+
+    UINT frameCount = replay.GetFrameCount();
+    std::vector<LONGLONG> total(frameCount, 0);
+    std::vector<LONGLONG> fastest(frameCount, LLONG_MAX);
+    std::vector<RenderReplayStats> stats(frameCount);
+    bool failed = false;
+    for (UINT loop = 0; loop < loops && !failed; loop++)
+    {
+        for (UINT i = 0; i < frameCount; i++)
+        {
+            LARGE_INTEGER start, end;
+            QueryPerformanceCounter(&start);
+            bool replayed = replay.ReplayFrame(i, context, &stats[i]);
+            if (context)
+                context->Flush();
+            QueryPerformanceCounter(&end);
+            if (!replayed)
+            {
+                std::cout << "frame " << i << " failed: " << GetEngineError().message << "\n";
+                failed = true;
+                break;
+            }
+            total[i] += end.QuadPart - start.QuadPart;
+            fastest[i] = std::min(fastest[i], end.QuadPart - start.QuadPart);
+
+            if (idle)
+            {
+                context->End(idle);
+                while (context->GetData(idle, nullptr, 0, 0) == S_FALSE)
+                    YieldProcessor();
+            }
+        }
+    }
+
+    if (!failed)
+    {
+        std::cout << path << ": " << frameCount << " frames, " << replay.GetObjectCount() << " objects, " << loops << " loops on " << deviceName << "\n";
+        char text[160];
+        LONGLONG allFrames = 0;
+        UINT64 commands = 0, draws = 0, uploadBytes = 0;
+        for (UINT i = 0; i < frameCount; i++)
+        {
+            snprintf(text, sizeof(text), "  frame %u: %u commands, %u draws, %llu KB uploaded, mean %.3f ms, min %.3f ms\n",
+                i, stats[i].commands, stats[i].draws, (unsigned long long)(stats[i].uploadBytes / 1024),
+                TicksToMs(total[i]) / loops, TicksToMs(fastest[i]));
+            std::cout << text;
+            allFrames += total[i];
+            commands += stats[i].commands;
+            draws += stats[i].draws;
+            uploadBytes += stats[i].uploadBytes;
+        }
+        if (frameCount > 0)
+        {
+            double frameMs = TicksToMs(allFrames) / ((double)loops * frameCount);
+            snprintf(text, sizeof(text), "  all frames: mean %.3f ms, %.1f ns a command, %.1f us a draw, %llu KB uploaded a frame\n",
+                frameMs, commands ? frameMs * 1e6 * frameCount / commands : 0.0, draws ? frameMs * 1e3 * frameCount / draws : 0.0,
+                (unsigned long long)(uploadBytes / frameCount / 1024));
+            std::cout << text;
+        }
+    }
+
+    replay.ReleaseObjects();
+    if (idle) idle->Release();
+    if (context) context->Release();
+    if (device) device->Release();
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    int result = 1;
+    if (strcmp(argv[1], "decode") == 0)
+        result = DecodeCommand(argc, argv);
+    else if (strcmp(argv[1], "tail") == 0)
+        result = TailCommand(argc, argv);
+    else if (strcmp(argv[1], "replay") == 0)
+        result = ReplayCommand(argc, argv);
+    else
+        PrintUsage();
+
+    Logger::Get()->Shutdown();
+    return result;
+}